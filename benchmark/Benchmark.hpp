@@ -0,0 +1,74 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+namespace Benchmark {
+
+// Timing state of a running benchmark. A benchmark prepares its input and then
+// runs the code to measure in a loop like `while (state.keep_running()) { ...
+// }`, which is repeated until enough time has elapsed for a stable result.
+class State
+{
+public:
+  explicit State(std::chrono::nanoseconds min_time);
+
+  bool keep_running();
+
+  // Pause and resume the clock within an iteration, e.g. to reset the input.
+  void pause();
+  void resume();
+
+  // Set the number of bytes processed per iteration to also report throughput.
+  void set_bytes_per_iteration(uint64_t bytes);
+
+  uint64_t iterations() const;
+  uint64_t bytes_per_iteration() const;
+  std::chrono::nanoseconds elapsed() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  const std::chrono::nanoseconds m_min_time;
+  uint64_t m_iterations = 0;
+  uint64_t m_bytes_per_iteration = 0;
+  std::chrono::nanoseconds m_elapsed{0};
+  Clock::time_point m_start;
+  bool m_started = false;
+};
+
+using Function = std::function<void(State& state)>;
+
+// Register a benchmark to run. Names are of the form "Component/variant".
+void add(const std::string& name, const Function& function);
+
+// Register benchmarks at static initialization time by calling `init`, which
+// typically calls `add` once per input size or implementation.
+class Registrar
+{
+public:
+  explicit Registrar(const std::function<void()>& init);
+};
+
+} // namespace Benchmark
@@ -0,0 +1,42 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Hash.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include <vector>
+
+namespace {
+
+const Benchmark::Registrar registrar([] {
+  for (size_t size : {64, 4096, 1024 * 1024, 64 * 1024 * 1024}) {
+    Benchmark::add(FMT("Hash/{}", size), [=](Benchmark::State& state) {
+      const std::vector<uint8_t> data(size, 'x');
+      state.set_bytes_per_iteration(size);
+      while (state.keep_running()) {
+        Hash hash;
+        hash.hash(data.data(), data.size());
+        hash.digest();
+      }
+    });
+  }
+});
+
+} // namespace
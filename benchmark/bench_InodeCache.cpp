@@ -0,0 +1,111 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Config.hpp"
+#include "../src/Hash.hpp"
+#include "../src/InodeCache.hpp"
+#include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t k_files = 64;
+const size_t k_operations_per_thread = 10000;
+
+Config
+make_config()
+{
+  Util::create_dir("cache");
+  Config config;
+  config.set_inode_cache(true);
+  config.set_cache_dir(Util::get_actual_cwd() + "/cache");
+  return config;
+}
+
+std::vector<std::string>
+make_files()
+{
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < k_files; ++i) {
+    paths.push_back(FMT("file_{}", i));
+    Util::write_file(paths.back(), FMT("content {}\n", i));
+  }
+  return paths;
+}
+
+// Run `k_operations_per_thread` gets or puts in each of `thread_count`
+// threads, each with its own InodeCache instance like separate ccache
+// processes sharing the cache.
+void
+run_threads(const Config& config,
+            const std::vector<std::string>& paths,
+            size_t thread_count,
+            bool put)
+{
+  std::atomic<bool> ok(true);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t] {
+      InodeCache inode_cache(config);
+      const Digest digest = Hash().hash(FMT("thread {}", t)).digest();
+      for (size_t i = 0; i < k_operations_per_thread; ++i) {
+        const auto& path = paths[(t + i) % paths.size()];
+        Digest result;
+        const bool success =
+          put ? inode_cache.put(path, InodeCache::ContentType::code, digest)
+              : inode_cache.get(path, InodeCache::ContentType::code, result);
+        if (!success) {
+          ok = false;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (!ok) {
+    throw Error("inode cache {} failed", put ? "put" : "get");
+  }
+}
+
+const Benchmark::Registrar registrar([] {
+  for (size_t thread_count : {1, 4, 16}) {
+    for (bool put : {false, true}) {
+      Benchmark::add(
+        FMT("InodeCache/{}/{}", put ? "put" : "get", thread_count),
+        [=](Benchmark::State& state) {
+          const Config config = make_config();
+          const auto paths = make_files();
+          run_threads(config, paths, 1, true);
+          while (state.keep_running()) {
+            run_threads(config, paths, thread_count, put);
+          }
+        });
+    }
+  }
+});
+
+} // namespace
@@ -0,0 +1,164 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Context.hpp"
+#include "../src/Counters.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Manifest.hpp"
+#include "../src/Result.hpp"
+#include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+#include "../src/hashutil.hpp"
+
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+const size_t k_entries = 10;
+
+void
+init(Context& ctx)
+{
+  Util::create_dir("cache");
+  ctx.config.set_cache_dir(Util::get_actual_cwd() + "/cache");
+}
+
+// Create `count` include files and return their digests. The paths are stored
+// in the arena of `ctx`.
+std::unordered_map<nonstd::string_view, Digest, StringViewHash>
+make_include_files(Context& ctx, size_t count)
+{
+  std::unordered_map<nonstd::string_view, Digest, StringViewHash>
+    included_files;
+  for (size_t i = 0; i < count; ++i) {
+    const std::string path = FMT("header_{}.h", i);
+    Util::write_file(path, FMT("int value_{};\n", i));
+    Hash hash;
+    if (hash_source_code_file(ctx, hash, path) != HASH_SOURCE_CODE_OK) {
+      throw Error("failed to hash {}", path);
+    }
+    included_files.emplace(ctx.arena.copy(path), hash.digest());
+  }
+  return included_files;
+}
+
+// Return a result name that differs for each `i`.
+Digest
+make_result_name(size_t i)
+{
+  return Hash().hash(FMT("result {}", i)).digest();
+}
+
+// Store an empty result named `name` so that Manifest::put keeps its entry.
+Digest
+store_result(Context& ctx, const Digest& name)
+{
+  Counters counter_updates;
+  ctx.storage.put(
+    name, Result::k_file_suffix, counter_updates, [](const std::string& path) {
+      Util::ensure_dir_exists(Util::dir_name(path));
+      Util::write_file(path, "");
+      return true;
+    });
+  return name;
+}
+
+// Write a manifest with `k_entries` results of which only the oldest matches
+// `included_files`, so that a lookup has to verify all of them.
+void
+write_manifest(Context& ctx,
+               const std::string& path,
+               std::unordered_map<nonstd::string_view, Digest, StringViewHash>
+                 included_files)
+{
+  const time_t time = ::time(nullptr);
+  Manifest::put(ctx,
+                path,
+                store_result(ctx, make_result_name(0)),
+                included_files,
+                time,
+                false);
+  for (size_t i = 1; i < k_entries; ++i) {
+    const auto result_name = store_result(ctx, make_result_name(i));
+    included_files["header_0.h"] = result_name;
+    Manifest::put(ctx, path, result_name, included_files, time, false);
+  }
+}
+
+const Benchmark::Registrar registrar([] {
+  for (size_t include_count : {10, 100, 1000}) {
+    Benchmark::add(
+      FMT("Manifest/put/{}", include_count), [=](Benchmark::State& state) {
+        Context ctx;
+        init(ctx);
+        const auto included_files = make_include_files(ctx, include_count);
+        const time_t time = ::time(nullptr);
+        const auto result_name = store_result(ctx, make_result_name(0));
+
+        while (state.keep_running()) {
+          state.pause();
+          Util::unlink_tmp("manifest");
+          state.resume();
+          if (!Manifest::put(ctx,
+                             "manifest",
+                             result_name,
+                             included_files,
+                             time,
+                             false)) {
+            throw Error("failed to write manifest");
+          }
+        }
+      });
+
+  }
+
+  // Lookups with include files verified on one thread and on four threads,
+  // including starting the threads, to tune
+  // k_min_files_for_parallel_verification.
+  for (size_t include_count : {10, 16, 32, 100, 1000}) {
+    for (uint32_t jobs : {1, 4}) {
+      Benchmark::add(
+        FMT("Manifest/get/{}/j{}", include_count, jobs),
+        [=](Benchmark::State& state) {
+          Context ctx;
+          init(ctx);
+          write_manifest(
+            ctx, "manifest", make_include_files(ctx, include_count));
+
+          while (state.keep_running()) {
+            // A fresh context per lookup since stat results are cached in it.
+            state.pause();
+            Context lookup_ctx;
+            init(lookup_ctx);
+            lookup_ctx.config.set_include_file_jobs(jobs);
+            state.resume();
+            if (Manifest::get(lookup_ctx, "manifest")
+                != make_result_name(0)) {
+              throw Error("manifest lookup failed");
+            }
+          }
+        });
+    }
+  }
+});
+
+} // namespace
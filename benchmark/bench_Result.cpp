@@ -0,0 +1,134 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Context.hpp"
+#include "../src/Result.hpp"
+#include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include <string>
+
+namespace {
+
+class NullConsumer : public Result::Reader::Consumer
+{
+public:
+  void
+  on_header(CacheEntryReader& /*cache_entry_reader*/) override
+  {
+  }
+
+  void
+  on_entry_start(uint32_t /*entry_number*/,
+                 Result::FileType /*file_type*/,
+                 uint64_t /*file_len*/,
+                 nonstd::optional<std::string> /*raw_file*/) override
+  {
+  }
+
+  void
+  on_entry_data(const uint8_t* /*data*/, size_t /*size*/) override
+  {
+  }
+
+  void
+  on_entry_end() override
+  {
+  }
+};
+
+// Object file lookalike: somewhat compressible data.
+std::string
+make_object_file(size_t size)
+{
+  std::string data(size, '\0');
+  uint32_t x = 1;
+  for (size_t i = 0; i < size; ++i) {
+    x = x * 1103515245 + 12345;
+    data[i] = static_cast<char>((x >> 16) & 0x3f);
+  }
+  return data;
+}
+
+void
+init(Context& ctx, const std::string& compression)
+{
+  Util::create_dir("cache");
+  Util::write_file("ccache.conf",
+                   compression == "none"
+                     ? "compression = false\n"
+                     : FMT("compression_type = {}\n", compression));
+  ctx.config.update_from_file("ccache.conf");
+  ctx.config.set_cache_dir(Util::get_actual_cwd() + "/cache");
+}
+
+void
+write_result(Context& ctx)
+{
+  Result::Writer writer(ctx, "result");
+  writer.write(Result::FileType::object, "test.o");
+  const auto error = writer.finalize();
+  if (error) {
+    throw Error("failed to write result: {}", *error);
+  }
+}
+
+const Benchmark::Registrar registrar([] {
+  for (const char* compression : {"none",
+                                  "zstd",
+#ifdef HAVE_LZ4
+                                  "lz4",
+#endif
+                                 }) {
+    for (size_t size : {64 * 1024, 16 * 1024 * 1024}) {
+      const std::string compression_name = compression;
+      Benchmark::add(FMT("Result/write/{}/{}", compression_name, size),
+                     [=](Benchmark::State& state) {
+                       Context ctx;
+                       init(ctx, compression_name);
+                       Util::write_file("test.o", make_object_file(size));
+                       state.set_bytes_per_iteration(size);
+                       while (state.keep_running()) {
+                         write_result(ctx);
+                       }
+                     });
+
+      Benchmark::add(FMT("Result/read/{}/{}", compression_name, size),
+                     [=](Benchmark::State& state) {
+                       Context ctx;
+                       init(ctx, compression_name);
+                       Util::write_file("test.o", make_object_file(size));
+                       write_result(ctx);
+                       state.set_bytes_per_iteration(size);
+                       while (state.keep_running()) {
+                         Result::Reader reader("result");
+                         NullConsumer consumer;
+                         const auto error = reader.read(consumer);
+                         if (error) {
+                           throw Error("failed to read result: {}", *error);
+                         }
+                       }
+                     });
+    }
+  }
+});
+
+} // namespace
@@ -0,0 +1,75 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Counters.hpp"
+#include "../src/Statistics.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t k_updates_per_thread = 100;
+
+// Update the same stats file from `thread_count` threads, which contend for
+// its lock like parallel ccache processes finishing at the same time.
+void
+run_threads(size_t thread_count)
+{
+  std::atomic<bool> ok(true);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&] {
+      for (size_t i = 0; i < k_updates_per_thread; ++i) {
+        const auto counters =
+          Statistics::update("stats", [](Counters& counters) {
+            counters.increment(Statistic::cache_miss);
+            counters.increment(Statistic::cache_size_kibibyte, 4);
+            counters.increment(Statistic::files_in_cache);
+          });
+        if (!counters) {
+          ok = false;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (!ok) {
+    throw Error("failed to update stats");
+  }
+}
+
+const Benchmark::Registrar registrar([] {
+  for (size_t thread_count : {1, 4, 16}) {
+    Benchmark::add(FMT("Statistics/update/{}", thread_count),
+                   [=](Benchmark::State& state) {
+                     while (state.keep_running()) {
+                       run_threads(thread_count);
+                     }
+                   });
+  }
+});
+
+} // namespace
@@ -0,0 +1,82 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Context.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Util.hpp"
+#include "../src/ccache.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include <string>
+
+namespace {
+
+// Write preprocessed output of `lines` lines spread over `include_count`
+// include files, which are created as well.
+void
+write_preprocessed_file(const std::string& path,
+                        size_t include_count,
+                        size_t lines)
+{
+  std::string output = "# 1 \"main.c\"\n";
+  for (size_t i = 0; i < include_count; ++i) {
+    const std::string include_file = FMT("header_{}.h", i);
+    Util::write_file(include_file, FMT("int value_{};\n", i));
+    output += FMT("# 1 \"{}\" 1\n", include_file);
+    for (size_t j = 0; j < lines / include_count; ++j) {
+      output += FMT("extern int function_{}_{}(const char* name, int n);\n",
+                    i,
+                    j);
+    }
+    output += FMT("# {} \"main.c\" 2\n", i + 2);
+  }
+  Util::write_file(path, output);
+}
+
+const Benchmark::Registrar registrar([] {
+  for (size_t include_count : {10, 100, 1000}) {
+    Benchmark::add(
+      FMT("process_preprocessed_file/{}", include_count),
+      [=](Benchmark::State& state) {
+        const size_t lines = 100000;
+        write_preprocessed_file("main.i", include_count, lines);
+        Util::write_file(
+          "ccache.conf",
+          "sloppiness = include_file_mtime, include_file_ctime\n");
+        state.set_bytes_per_iteration(Util::read_file("main.i").size());
+
+        while (state.keep_running()) {
+          state.pause();
+          Context ctx;
+          ctx.config.update_from_file("ccache.conf");
+          ctx.args_info.input_file = "main.c";
+          Hash hash;
+          state.resume();
+
+          if (!process_preprocessed_file(ctx, hash, "main.i", false)) {
+            throw Error("failed to process main.i");
+          }
+        }
+      });
+  }
+});
+
+} // namespace
@@ -0,0 +1,83 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/fmtmacros.hpp"
+#include "../src/hashutil.hpp"
+
+#include "third_party/blake3/blake3_cpu_supports_avx2.h"
+
+#include <string>
+
+namespace {
+
+// Source code without temporal macros but with plenty of underscores.
+std::string
+make_source(size_t size)
+{
+  const std::string line =
+    "static inline int __attribute__((unused)) EXAMPLE_value(int x_) {"
+    " return x_ + __LINE__; }\n";
+  std::string source;
+  while (source.size() < size) {
+    source += line;
+  }
+  source.resize(size);
+  return source;
+}
+
+void
+add_temporal_macros_benchmark(const std::string& name,
+                              size_t size,
+                              int (*function)(nonstd::string_view))
+{
+  Benchmark::add(FMT("check_for_temporal_macros/{}/{}", name, size),
+                 [=](Benchmark::State& state) {
+                   const std::string source = make_source(size);
+                   state.set_bytes_per_iteration(size);
+                   while (state.keep_running()) {
+                     if (function(source) != 0) {
+                       abort();
+                     }
+                   }
+                 });
+}
+
+const Benchmark::Registrar registrar([] {
+  for (size_t size : {4096, 1024 * 1024}) {
+    add_temporal_macros_benchmark("bmh", size, check_for_temporal_macros_bmh);
+#ifdef HAVE_AVX2
+    if (blake3_cpu_supports_avx2()) {
+      add_temporal_macros_benchmark(
+        "avx2", size, check_for_temporal_macros_avx2);
+    }
+#endif
+#ifdef HAVE_AVX512BW
+    if (__builtin_cpu_supports("avx512bw")) {
+      add_temporal_macros_benchmark(
+        "avx512bw", size, check_for_temporal_macros_avx512bw);
+    }
+#endif
+#ifdef __ARM_NEON
+    add_temporal_macros_benchmark("neon", size, check_for_temporal_macros_neon);
+#endif
+  }
+});
+
+} // namespace
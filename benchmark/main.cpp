@@ -0,0 +1,293 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Benchmark.hpp"
+
+#include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+
+#include "third_party/fmt/core.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+struct Entry
+{
+  std::string name;
+  Benchmark::Function function;
+};
+
+std::vector<Entry>&
+registry()
+{
+  static std::vector<Entry> entries;
+  return entries;
+}
+
+void
+print_usage(const char* program)
+{
+  PRINT(stdout,
+        "Usage: {} [options] [filter...]\n"
+        "\n"
+        "Run the benchmarks whose name contains any of the filter strings, or\n"
+        "all benchmarks if no filter is given.\n"
+        "\n"
+        "Options:\n"
+        "    --list                 list benchmarks and exit\n"
+        "    --min-time SECONDS     run each benchmark for at least SECONDS\n"
+        "                           (default: 0.5)\n"
+        "    --repetitions N        run each benchmark N times and report the\n"
+        "                           median (default: 3)\n",
+        program);
+}
+
+bool
+matches(const std::string& name, const std::vector<std::string>& filters)
+{
+  return filters.empty()
+         || std::any_of(filters.begin(),
+                        filters.end(),
+                        [&](const std::string& filter) {
+                          return name.find(filter) != std::string::npos;
+                        });
+}
+
+std::string
+format_duration(double ns)
+{
+  if (ns < 1e3) {
+    return FMT("{:.1f} ns", ns);
+  } else if (ns < 1e6) {
+    return FMT("{:.2f} us", ns / 1e3);
+  } else if (ns < 1e9) {
+    return FMT("{:.2f} ms", ns / 1e6);
+  } else {
+    return FMT("{:.2f} s", ns / 1e9);
+  }
+}
+
+} // namespace
+
+namespace Benchmark {
+
+State::State(std::chrono::nanoseconds min_time) : m_min_time(min_time)
+{
+}
+
+bool
+State::keep_running()
+{
+  const auto now = Clock::now();
+  if (m_started) {
+    ++m_iterations;
+    m_elapsed += now - m_start;
+    if (m_elapsed >= m_min_time) {
+      return false;
+    }
+  }
+  m_started = true;
+  m_start = now;
+  return true;
+}
+
+void
+State::pause()
+{
+  m_elapsed += Clock::now() - m_start;
+}
+
+void
+State::resume()
+{
+  m_start = Clock::now();
+}
+
+void
+State::set_bytes_per_iteration(uint64_t bytes)
+{
+  m_bytes_per_iteration = bytes;
+}
+
+uint64_t
+State::iterations() const
+{
+  return m_iterations;
+}
+
+uint64_t
+State::bytes_per_iteration() const
+{
+  return m_bytes_per_iteration;
+}
+
+std::chrono::nanoseconds
+State::elapsed() const
+{
+  return m_elapsed;
+}
+
+void
+add(const std::string& name, const Function& function)
+{
+  registry().push_back({name, function});
+}
+
+Registrar::Registrar(const std::function<void()>& init)
+{
+  init();
+}
+
+} // namespace Benchmark
+
+int
+main(int argc, char** argv)
+{
+  double min_time = 0.5;
+  unsigned repetitions = 3;
+  bool list = false;
+  std::vector<std::string> filters;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      const std::string arg = argv[i];
+      if (arg == "--help" || arg == "-h") {
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      } else if (arg == "--list") {
+        list = true;
+      } else if (arg == "--min-time" && i + 1 < argc) {
+        char* end;
+        min_time = strtod(argv[++i], &end);
+        if (*end != '\0' || min_time < 0) {
+          throw Error("invalid minimum time: {}", argv[i]);
+        }
+      } else if (arg == "--repetitions" && i + 1 < argc) {
+        repetitions = Util::parse_unsigned(argv[++i], 1, 1000, "repetitions");
+      } else if (Util::starts_with(arg, "-")) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      } else {
+        filters.push_back(arg);
+      }
+    }
+  } catch (const Error& e) {
+    PRINT(stderr, "{}: {}\n", argv[0], e.what());
+    return EXIT_FAILURE;
+  }
+
+  auto& entries = registry();
+  // Group by component but keep the registration order of the variants.
+  std::stable_sort(
+    entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      return a.name.substr(0, a.name.find('/'))
+             < b.name.substr(0, b.name.find('/'));
+    });
+
+  if (list) {
+    for (const auto& entry : entries) {
+      if (matches(entry.name, filters)) {
+        PRINT(stdout, "{}\n", entry.name);
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // Benchmarks create their files in a scratch directory like the unit tests.
+  const std::string dir_before = Util::get_actual_cwd();
+  const std::string benchdir = FMT("benchdir/{}", getpid());
+  Util::wipe_path(benchdir);
+  Util::create_dir(benchdir);
+  if (chdir(benchdir.c_str()) != 0) {
+    PRINT(stderr, "{}: failed to change directory to {}\n", argv[0], benchdir);
+    return EXIT_FAILURE;
+  }
+
+  const auto min_duration =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::duration<double>(min_time));
+
+  PRINT(stdout,
+        "{:<40} {:>12} {:>12} {:>12}\n",
+        "Benchmark",
+        "Time",
+        "Iterations",
+        "Throughput");
+
+  int result = EXIT_SUCCESS;
+  size_t counter = 0;
+  for (const auto& entry : entries) {
+    if (!matches(entry.name, filters)) {
+      continue;
+    }
+
+    std::vector<double> ns_per_iteration;
+    uint64_t iterations = 0;
+    uint64_t bytes_per_iteration = 0;
+    try {
+      for (unsigned i = 0; i < repetitions; ++i) {
+        const std::string run_dir = FMT("{}", ++counter);
+        Util::create_dir(run_dir);
+        if (chdir(run_dir.c_str()) != 0) {
+          throw Error("failed to change directory to {}", run_dir);
+        }
+
+        Benchmark::State state(min_duration);
+        entry.function(state);
+        if (chdir("..") != 0) {
+          throw Error("failed to change directory to ..");
+        }
+        Util::wipe_path(run_dir);
+
+        if (state.iterations() == 0) {
+          throw Error("no iterations were run");
+        }
+        ns_per_iteration.push_back(static_cast<double>(state.elapsed().count())
+                                   / state.iterations());
+        iterations = state.iterations();
+        bytes_per_iteration = state.bytes_per_iteration();
+      }
+    } catch (const Error& e) {
+      PRINT(stderr, "{}: {}\n", entry.name, e.what());
+      result = EXIT_FAILURE;
+      continue;
+    }
+
+    std::sort(ns_per_iteration.begin(), ns_per_iteration.end());
+    const double median = ns_per_iteration[ns_per_iteration.size() / 2];
+    const std::string throughput =
+      bytes_per_iteration > 0
+        ? FMT("{:.1f} MB/s", bytes_per_iteration * 1e3 / median)
+        : "";
+    PRINT(stdout,
+          "{:<40} {:>12} {:>12} {:>12}\n",
+          entry.name,
+          format_duration(median),
+          iterations,
+          throughput);
+    fflush(stdout);
+  }
+
+  if (chdir(dir_before.c_str()) == 0) {
+    Util::wipe_path(benchdir);
+  }
+  return result;
+}
@@ -0,0 +1,28 @@
+if(lz4_FOUND)
+  return()
+endif()
+
+find_library(LZ4_LIBRARY lz4)
+find_path(LZ4_INCLUDE_DIR lz4frame.h)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(
+  lz4 "install liblz4 to enable compression_type = lz4"
+  LZ4_INCLUDE_DIR LZ4_LIBRARY)
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARY)
+
+if(lz4_FOUND)
+  add_library(LZ4::LZ4 UNKNOWN IMPORTED)
+  set_target_properties(
+    LZ4::LZ4
+    PROPERTIES
+    IMPORTED_LOCATION "${LZ4_LIBRARY}"
+    INTERFACE_INCLUDE_DIRECTORIES "${LZ4_INCLUDE_DIR}")
+endif()
+
+include(FeatureSummary)
+set_package_properties(
+  lz4
+  PROPERTIES
+  URL "https://lz4.github.io/lz4"
+  DESCRIPTION "LZ4 - Extremely fast compression algorithm")
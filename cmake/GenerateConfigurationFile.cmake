@@ -26,17 +26,22 @@ endforeach()
 include(CheckFunctionExists)
 set(functions
     asctime_r
+    copy_file_range
     geteuid
     getopt_long
     getpwuid
     gettimeofday
+    memfd_create
+    posix_fadvise
     posix_fallocate
+    posix_spawn
     realpath
     setenv
     strndup
     syslog
     unsetenv
-    utimes)
+    utimes
+    wait4)
 foreach(func IN ITEMS ${functions})
   string(TOUPPER ${func} func_var)
   set(func_var HAVE_${func_var})
@@ -63,6 +68,10 @@ check_struct_has_member("struct stat" st_ctim sys/stat.h
                         HAVE_STRUCT_STAT_ST_CTIM)
 check_struct_has_member("struct stat" st_mtim sys/stat.h
                         HAVE_STRUCT_STAT_ST_MTIM)
+check_struct_has_member("struct stat" st_ctimespec sys/stat.h
+                        HAVE_STRUCT_STAT_ST_CTIMESPEC)
+check_struct_has_member("struct stat" st_mtimespec sys/stat.h
+                        HAVE_STRUCT_STAT_ST_MTIMESPEC)
 check_struct_has_member("struct statfs" f_fstypename sys/mount.h
                         HAVE_STRUCT_STATFS_F_FSTYPENAME)
 
@@ -79,6 +88,18 @@ check_cxx_source_compiles(
     }
   ]=]
   HAVE_AVX2)
+check_cxx_source_compiles(
+  [=[
+    #include <immintrin.h>
+    void func() __attribute__((target("avx512bw")));
+    void func() { _mm512_abs_epi8(_mm512_set1_epi32(42)); }
+    int main()
+    {
+      func();
+      return __builtin_cpu_supports("avx512bw");
+    }
+  ]=]
+  HAVE_AVX512BW)
 
 list(APPEND CMAKE_REQUIRED_LIBRARIES ws2_32)
 list(REMOVE_ITEM CMAKE_REQUIRED_LIBRARIES ws2_32)
@@ -0,0 +1,68 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Arena.hpp"
+
+#include "assertions.hpp"
+
+#include <cstring>
+
+Arena::Arena(size_t block_size) : m_block_size(block_size)
+{
+}
+
+void*
+Arena::allocate(size_t size, size_t alignment)
+{
+  DEBUG_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+  const auto aligned = [alignment](char* p) {
+    const auto address = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<char*>((address + alignment - 1)
+                                   & ~(uintptr_t(alignment) - 1));
+  };
+
+  char* p = m_pos ? aligned(m_pos) : nullptr;
+  if (!p || p > m_end || size > static_cast<size_t>(m_end - p)) {
+    // Allocations that wouldn't leave room for others get a block of their
+    // own so that the rest of the current block isn't wasted.
+    const size_t block_size =
+      size + alignment > m_block_size / 4 ? size + alignment : m_block_size;
+    m_blocks.emplace_back(new char[block_size]);
+    m_capacity += block_size;
+    char* block = m_blocks.back().get();
+    p = aligned(block);
+    if (block_size != m_block_size) {
+      return p;
+    }
+    m_end = block + block_size;
+  }
+  m_pos = p + size;
+  return p;
+}
+
+nonstd::string_view
+Arena::copy(nonstd::string_view str)
+{
+  char* p = static_cast<char*>(allocate(str.size() + 1, 1));
+  if (!str.empty()) {
+    memcpy(p, str.data(), str.size());
+  }
+  p[str.size()] = '\0';
+  return nonstd::string_view(p, str.size());
+}
@@ -0,0 +1,81 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#ifdef USE_XXH_DISPATCH
+#  include "third_party/xxh_x86dispatch.h"
+#else
+#  include "third_party/xxhash.h"
+#endif
+#include "third_party/nonstd/string_view.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// A bump allocator for data that lives as long as its owner, typically the
+// Context of the ccache invocation. Allocations are carved out of large blocks
+// and all memory is released at once when the arena is destroyed, which makes
+// the many small strings of an invocation (e.g. include file paths) much
+// cheaper than individual heap allocations. Not thread-safe.
+class Arena : NonCopyable
+{
+public:
+  static const size_t k_default_block_size = 64 * 1024;
+
+  explicit Arena(size_t block_size = k_default_block_size);
+
+  // Allocate `size` bytes aligned to `alignment`, which must be a power of two.
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+  // Copy `str` into the arena. The copy is followed by a NUL byte, so data() of
+  // the returned view can be used as a C string.
+  nonstd::string_view copy(nonstd::string_view str);
+
+  // Total size of the blocks allocated so far.
+  size_t capacity() const;
+
+private:
+  const size_t m_block_size;
+  std::vector<std::unique_ptr<char[]>> m_blocks;
+  size_t m_capacity = 0;
+  char* m_pos = nullptr;
+  char* m_end = nullptr;
+};
+
+inline size_t
+Arena::capacity() const
+{
+  return m_capacity;
+}
+
+// Hash function for string_view keys. std::hash<nonstd::string_view> creates a
+// temporary std::string for each call.
+struct StringViewHash
+{
+  size_t
+  operator()(nonstd::string_view str) const
+  {
+    return XXH3_64bits(str.data(), str.size());
+  }
+};
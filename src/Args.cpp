@@ -20,6 +20,8 @@
 
 #include "Util.hpp"
 
+#include <iterator>
+
 using nonstd::nullopt;
 using nonstd::optional;
 using nonstd::string_view;
@@ -55,7 +57,12 @@ Args::from_gcc_atfile(const std::string& filename)
   } catch (Error&) {
     return nullopt;
   }
+  return from_atfile_string(argtext);
+}
 
+Args
+Args::from_atfile_string(const std::string& argtext)
+{
   Args args;
   auto pos = argtext.c_str();
   std::string argbuf;
@@ -102,9 +109,8 @@ Args::from_gcc_atfile(const std::string& filename)
 
     case '\0':
       // End of token
-      *argpos = '\0';
-      if (argbuf[0] != '\0') {
-        args.push_back(argbuf.substr(0, argbuf.find('\0')));
+      if (argpos != argbuf.begin()) {
+        args.m_args.emplace_back(argbuf.begin(), argpos);
       }
       argpos = argbuf.begin();
       if (*pos == '\0') {
@@ -184,6 +190,17 @@ Args::insert(size_t index, const Args& args)
   m_args.insert(m_args.begin() + index, args.m_args.begin(), args.m_args.end());
 }
 
+void
+Args::insert(size_t index, Args&& args)
+{
+  if (args.size() == 0) {
+    return;
+  }
+  m_args.insert(m_args.begin() + index,
+                std::make_move_iterator(args.m_args.begin()),
+                std::make_move_iterator(args.m_args.end()));
+}
+
 void
 Args::pop_back(size_t count)
 {
@@ -225,3 +242,15 @@ Args::replace(size_t index, const Args& args)
     insert(index, args);
   }
 }
+
+void
+Args::replace(size_t index, Args&& args)
+{
+  if (args.size() == 1) {
+    // Trivial case; replace with 1 element.
+    m_args[index] = std::move(args.m_args[0]);
+  } else {
+    m_args.erase(m_args.begin() + index);
+    insert(index, std::move(args));
+  }
+}
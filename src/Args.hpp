@@ -40,6 +40,10 @@ public:
   static Args from_string(const std::string& command);
   static nonstd::optional<Args> from_gcc_atfile(const std::string& filename);
 
+  // Split `text` into arguments using the quoting rules of GCC @file content,
+  // which also handle typical shell-quoted command lines.
+  static Args from_atfile_string(const std::string& text);
+
   Args& operator=(const Args& other) = default;
   Args& operator=(Args&& other) noexcept;
 
@@ -68,6 +72,7 @@ public:
 
   // Insert arguments in `args` at position `index`.
   void insert(size_t index, const Args& args);
+  void insert(size_t index, Args&& args);
 
   // Remove the last `count` arguments.
   void pop_back(size_t count = 1);
@@ -86,6 +91,7 @@ public:
 
   // Replace the argument at `index` with all arguments in `args`.
   void replace(size_t index, const Args& args);
+  void replace(size_t index, Args&& args);
 
 private:
   std::deque<std::string> m_args;
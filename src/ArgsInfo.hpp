@@ -51,6 +51,14 @@ struct ArgsInfo
   // Split dwarf information (GCC 4.8 and up). Contains pathname if not empty.
   std::string output_dwo;
 
+  // Binary module interface written by Clang's -fmodule-output. Contains
+  // pathname if not empty.
+  std::string output_bmi;
+
+  // Files declared with --input and --output for a command run with --run.
+  std::vector<std::string> command_inputs;
+  std::vector<std::string> command_outputs;
+
   // Language to use for the compilation target (see language.c).
   std::string actual_language;
 
@@ -63,6 +71,12 @@ struct ArgsInfo
   // Seen -MD or -MMD?
   bool seen_MD_MMD = false;
 
+  // Seen -MP?
+  bool seen_MP = false;
+
+  // Has MSVC been asked to list included files with /showIncludes?
+  bool generating_includes = false;
+
   // Is the dependency makefile target name specified with -MT or -MQ?
   bool dependency_target_specified = false;
 
@@ -85,6 +99,10 @@ struct ArgsInfo
   // Are we compiling a .i or .ii file directly?
   bool direct_i_file = false;
 
+  // Was the compiler called with -E, making the preprocessed output (written to
+  // output_obj, or standard output if it's "-") the result?
+  bool preprocessing_only = false;
+
   // Whether the output is a precompiled header.
   bool output_is_precompiled_header = false;
 
@@ -109,6 +127,9 @@ struct ArgsInfo
   // Files referenced by -fsanitize-blacklist options.
   std::vector<std::string> sanitize_blacklists;
 
+  // Binary module interfaces referenced by -fmodule-file options.
+  std::vector<std::string> module_files;
+
   // Architectures from -arch options.
   std::vector<std::string> arch_args;
 
@@ -117,4 +138,8 @@ struct ArgsInfo
 
   // Argument list to add to compiler invocation in depend mode.
   Args depend_extra_args;
+
+  // Dependency file that ccache asks the compiler to write in depend mode when
+  // the compilation doesn't generate one itself. Empty if not used.
+  std::string injected_output_dep;
 };
@@ -40,7 +40,7 @@ AtomicFile::~AtomicFile()
 }
 
 void
-AtomicFile::write(const std::string& data)
+AtomicFile::write(nonstd::string_view data)
 {
   if (fwrite(data.data(), data.size(), 1, m_stream) != 1) {
     throw Error("failed to write data to {}: {}", m_path, strerror(errno));
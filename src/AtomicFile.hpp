@@ -20,6 +20,8 @@
 
 #include "system.hpp"
 
+#include "third_party/nonstd/string_view.hpp"
+
 #include <string>
 #include <vector>
 
@@ -35,7 +37,7 @@ public:
 
   FILE* stream();
 
-  void write(const std::string& data);
+  void write(nonstd::string_view data);
   void write(const std::vector<uint8_t>& data);
 
   // Close the temporary file and rename it to the destination file. Note: The
@@ -0,0 +1,184 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "BackgroundCompressor.hpp"
+
+#include "Compression.hpp"
+#include "Config.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "ZstdCompressor.hpp"
+#include "ZstdDictionary.hpp"
+#include "assertions.hpp"
+
+#include <chrono>
+
+const size_t BackgroundCompressor::k_chunk_size;
+
+namespace {
+
+// How often to look for new chunks while the file is being written.
+const std::chrono::milliseconds k_poll_interval(10);
+
+int
+compression_level(const Config& config)
+{
+  const int level = Compression::level_from_config(config);
+  return level != 0 ? level : ZstdCompressor::default_compression_level;
+}
+
+} // namespace
+
+BackgroundCompressor::BackgroundCompressor(const Config& config,
+                                           const std::string& path)
+  : m_path(path),
+    m_compression_level(compression_level(config)),
+    m_dictionary_id(ZstdDictionary::current_id()),
+    m_initial_stat(Stat::stat(path)),
+    m_token(1)
+{
+  if (m_token.count() == 0) {
+    return;
+  }
+  if (m_dictionary_id != 0) {
+    m_dictionary = ZstdDictionary::load(m_dictionary_id);
+  }
+  m_thread = std::thread(&BackgroundCompressor::run, this);
+}
+
+BackgroundCompressor::~BackgroundCompressor()
+{
+  stop();
+}
+
+void
+BackgroundCompressor::stop()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_stop_condition.notify_one();
+  if (m_thread.joinable()) {
+    m_thread.join();
+    LOG("Compressed {} chunks of {} in the background",
+        m_chunks.size(),
+        m_path);
+  }
+}
+
+nonstd::optional<nonstd::string_view>
+BackgroundCompressor::frame(uint64_t offset, nonstd::string_view data) const
+{
+  ASSERT(!m_thread.joinable());
+
+  if (offset % k_chunk_size != 0 || offset / k_chunk_size >= m_chunks.size()) {
+    return nonstd::nullopt;
+  }
+  const auto& chunk = m_chunks[offset / k_chunk_size];
+  if (chunk.data != data) {
+    // The chunk was rewritten after it was compressed.
+    return nonstd::nullopt;
+  }
+  return nonstd::string_view(chunk.frame);
+}
+
+void
+BackgroundCompressor::run()
+{
+  ZSTD_CCtx* cctx = ZSTD_createCCtx();
+  ZSTD_CDict* cdict =
+    m_dictionary ? ZSTD_createCDict(
+      m_dictionary->data(), m_dictionary->size(), m_compression_level)
+                 : nullptr;
+  if (cctx && (cdict || !m_dictionary)) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+      lock.unlock();
+      compress_new_chunks(cctx, cdict);
+      lock.lock();
+      m_stop_condition.wait_for(
+        lock, k_poll_interval, [this] { return m_stopping.load(); });
+    }
+  }
+  ZSTD_freeCDict(cdict);
+  ZSTD_freeCCtx(cctx);
+}
+
+void
+BackgroundCompressor::compress_new_chunks(ZSTD_CCtx* cctx,
+                                          const ZSTD_CDict* cdict)
+{
+  const auto st = Stat::stat(m_path);
+  if (!st || st.size() < (m_chunks.size() + 1) * k_chunk_size
+      || (st.inode() == m_initial_stat.inode()
+          && st.mtime() == m_initial_stat.mtime()
+          && st.size() == m_initial_stat.size())) {
+    return;
+  }
+
+  Fd fd(open(m_path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    return;
+  }
+  const off_t offset = m_chunks.size() * k_chunk_size;
+  if (lseek(*fd, offset, SEEK_SET) != offset) {
+    return;
+  }
+
+  while (!m_stopping) {
+    Chunk chunk;
+    chunk.data.resize(k_chunk_size);
+    size_t size = 0;
+    while (size < k_chunk_size) {
+      const auto n = read(*fd, &chunk.data[size], k_chunk_size - size);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        // Not written yet. Partial chunks are left to the cache entry writer.
+        return;
+      }
+      size += n;
+    }
+
+    chunk.frame.resize(ZSTD_compressBound(k_chunk_size));
+    const size_t frame_size =
+      cdict ? ZSTD_compress_usingCDict(cctx,
+                                       &chunk.frame[0],
+                                       chunk.frame.size(),
+                                       chunk.data.data(),
+                                       chunk.data.size(),
+                                       cdict)
+            : ZSTD_compressCCtx(cctx,
+                                &chunk.frame[0],
+                                chunk.frame.size(),
+                                chunk.data.data(),
+                                chunk.data.size(),
+                                m_compression_level);
+    if (ZSTD_isError(frame_size)) {
+      LOG("Failed to compress chunk of {}: {}",
+          m_path,
+          ZSTD_getErrorName(frame_size));
+      m_stopping = true;
+      return;
+    }
+    chunk.frame.resize(frame_size);
+    m_chunks.push_back(std::move(chunk));
+  }
+}
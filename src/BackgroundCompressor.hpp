@@ -0,0 +1,113 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Jobserver.hpp"
+#include "NonCopyable.hpp"
+#include "Stat.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <zstd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Config;
+
+// Compresses a file into Zstandard frames of k_chunk_size bytes each in a
+// background thread while another process, typically the compiler, is still
+// writing the file. Once the file is complete, CacheEntryWriter::write_frame
+// can embed the frame of each chunk whose content didn't change afterwards
+// instead of compressing it again, so that most of the compression work
+// overlaps with the compilation. Nothing is compressed ahead if no jobserver
+// token is available for the thread.
+class BackgroundCompressor : NonCopyable
+{
+public:
+  static const size_t k_chunk_size = 1024 * 1024;
+
+  // Start compressing `path` as it grows, using the compression level and
+  // dictionary that result cache entries are written with according to
+  // `config`.
+  BackgroundCompressor(const Config& config, const std::string& path);
+
+  ~BackgroundCompressor();
+
+  // Stop compressing and wait for the background thread. Chunks compressed so
+  // far stay available.
+  void stop();
+
+  const std::string& path() const;
+
+  // ID of the dictionary that the frames were compressed with, 0 for none.
+  uint32_t dictionary_id() const;
+
+  // Return the frame for the chunk starting at `offset` if the chunk was
+  // compressed with content `data`. Must be called after stop().
+  nonstd::optional<nonstd::string_view> frame(uint64_t offset,
+                                              nonstd::string_view data) const;
+
+private:
+  struct Chunk
+  {
+    std::string data;
+    std::string frame;
+  };
+
+  const std::string m_path;
+  const int m_compression_level;
+  const uint32_t m_dictionary_id;
+  std::shared_ptr<const std::string> m_dictionary;
+  // Stat of `path` when starting, i.e. probably a stale output file from a
+  // previous compilation that isn't worth compressing.
+  const Stat m_initial_stat;
+
+  // Only accessed by the background thread until it has been stopped.
+  std::vector<Chunk> m_chunks;
+
+  std::atomic<bool> m_stopping{false};
+  std::mutex m_mutex;
+  std::condition_variable m_stop_condition;
+  Jobserver::Tokens m_token;
+  std::thread m_thread;
+
+  void run();
+  void compress_new_chunks(ZSTD_CCtx* cctx, const ZSTD_CDict* cdict);
+};
+
+inline const std::string&
+BackgroundCompressor::path() const
+{
+  return m_path;
+}
+
+inline uint32_t
+BackgroundCompressor::dictionary_id() const
+{
+  return m_dictionary_id;
+}
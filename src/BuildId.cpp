@@ -0,0 +1,229 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "BuildId.hpp"
+
+#include "File.hpp"
+
+#include <climits>
+
+using nonstd::nullopt;
+using nonstd::optional;
+
+namespace {
+
+// Upper bounds for what is read from a file, to not be fooled by bogus headers
+// into reading a lot.
+const size_t k_max_headers_size = 64 * 1024;
+const uint32_t k_max_fat_architectures = 16;
+
+const uint32_t k_elf_pt_note = 4;
+const uint32_t k_elf_nt_gnu_build_id = 3;
+
+const uint32_t k_macho_magic_32 = 0xfeedface;
+const uint32_t k_macho_magic_64 = 0xfeedfacf;
+const uint32_t k_macho_fat_magic = 0xcafebabe;
+const uint32_t k_macho_lc_uuid = 0x1b;
+
+class Reader
+{
+public:
+  explicit Reader(const std::string& path) : m_file(path, "rb")
+  {
+  }
+
+  explicit operator bool() const
+  {
+    return static_cast<bool>(m_file);
+  }
+
+  // Read `size` bytes at `offset`. Returns an empty string on failure.
+  std::string read(uint64_t offset, size_t size);
+
+private:
+  File m_file;
+};
+
+std::string
+Reader::read(uint64_t offset, size_t size)
+{
+  std::string data(size, '\0');
+  if (size == 0 || size > k_max_headers_size || offset > LONG_MAX
+      || fseek(m_file.get(), static_cast<long>(offset), SEEK_SET) != 0
+      || fread(&data[0], size, 1, m_file.get()) != 1) {
+    return {};
+  }
+  return data;
+}
+
+uint64_t
+load(const std::string& data, size_t offset, size_t size, bool big_endian)
+{
+  uint64_t value = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const size_t index = big_endian ? offset + i : offset + size - 1 - i;
+    value = (value << 8) | static_cast<uint8_t>(data[index]);
+  }
+  return value;
+}
+
+optional<std::string>
+read_elf_build_id(Reader& reader, const std::string& ident)
+{
+  const bool is_64 = ident[4] == 2;
+  const bool big_endian = ident[5] == 2;
+  const auto header = reader.read(0, is_64 ? 64 : 52);
+  if (header.empty()) {
+    return nullopt;
+  }
+
+  const uint64_t phoff = is_64 ? load(header, 0x20, 8, big_endian)
+                               : load(header, 0x1C, 4, big_endian);
+  const size_t phentsize = load(header, is_64 ? 0x36 : 0x2A, 2, big_endian);
+  const size_t phnum = load(header, is_64 ? 0x38 : 0x2C, 2, big_endian);
+  if (phentsize < (is_64 ? 56u : 32u)) {
+    return nullopt;
+  }
+  const auto phdrs = reader.read(phoff, phentsize * phnum);
+
+  for (size_t i = 0; i < phnum && !phdrs.empty(); ++i) {
+    const size_t phdr = i * phentsize;
+    if (load(phdrs, phdr, 4, big_endian) != k_elf_pt_note) {
+      continue;
+    }
+    const uint64_t offset = is_64 ? load(phdrs, phdr + 0x08, 8, big_endian)
+                                  : load(phdrs, phdr + 0x04, 4, big_endian);
+    const uint64_t size = is_64 ? load(phdrs, phdr + 0x20, 8, big_endian)
+                                : load(phdrs, phdr + 0x10, 4, big_endian);
+    const auto notes = reader.read(offset, size);
+
+    size_t pos = 0;
+    while (pos + 12 <= notes.size()) {
+      const size_t namesz = load(notes, pos, 4, big_endian);
+      const size_t descsz = load(notes, pos + 4, 4, big_endian);
+      const uint32_t type = load(notes, pos + 8, 4, big_endian);
+      const size_t name_pos = pos + 12;
+      const size_t desc_pos = name_pos + ((namesz + 3) & ~size_t(3));
+      const size_t next_pos = desc_pos + ((descsz + 3) & ~size_t(3));
+      if (namesz > notes.size() || descsz > notes.size()
+          || next_pos > notes.size()) {
+        break;
+      }
+      if (type == k_elf_nt_gnu_build_id && namesz == 4
+          && notes.compare(name_pos, 4, std::string("GNU\0", 4)) == 0
+          && descsz > 0) {
+        return notes.substr(desc_pos, descsz);
+      }
+      pos = next_pos;
+    }
+  }
+  return nullopt;
+}
+
+optional<std::string>
+read_macho_uuid(Reader& reader, uint64_t offset)
+{
+  const auto magic_data = reader.read(offset, 4);
+  if (magic_data.empty()) {
+    return nullopt;
+  }
+  bool big_endian = false;
+  uint64_t magic = load(magic_data, 0, 4, big_endian);
+  if (magic != k_macho_magic_32 && magic != k_macho_magic_64) {
+    big_endian = true;
+    magic = load(magic_data, 0, 4, big_endian);
+    if (magic != k_macho_magic_32 && magic != k_macho_magic_64) {
+      return nullopt;
+    }
+  }
+
+  const size_t header_size = magic == k_macho_magic_64 ? 32 : 28;
+  const auto header = reader.read(offset, header_size);
+  if (header.empty()) {
+    return nullopt;
+  }
+  const size_t ncmds = load(header, 16, 4, big_endian);
+  const size_t sizeofcmds = load(header, 20, 4, big_endian);
+  const auto commands = reader.read(offset + header_size, sizeofcmds);
+
+  size_t pos = 0;
+  for (size_t i = 0; i < ncmds && pos + 8 <= commands.size(); ++i) {
+    const uint32_t cmd = load(commands, pos, 4, big_endian);
+    const size_t cmdsize = load(commands, pos + 4, 4, big_endian);
+    if (cmdsize < 8 || cmdsize > commands.size() - pos) {
+      break;
+    }
+    if (cmd == k_macho_lc_uuid && cmdsize >= 24) {
+      return commands.substr(pos + 8, 16);
+    }
+    pos += cmdsize;
+  }
+  return nullopt;
+}
+
+optional<std::string>
+read_fat_macho_uuids(Reader& reader, const std::string& magic_data)
+{
+  const uint32_t count = load(magic_data, 4, 4, true);
+  if (count == 0 || count > k_max_fat_architectures) {
+    return nullopt;
+  }
+  const auto archs = reader.read(8, count * 20);
+  if (archs.empty()) {
+    return nullopt;
+  }
+  std::string result;
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto uuid = read_macho_uuid(reader, load(archs, i * 20 + 8, 4, true));
+    if (!uuid) {
+      return nullopt;
+    }
+    result += *uuid;
+  }
+  return result;
+}
+
+} // namespace
+
+namespace BuildId {
+
+optional<std::string>
+read(const std::string& path)
+{
+  Reader reader(path);
+  if (!reader) {
+    return nullopt;
+  }
+  const auto ident = reader.read(0, 8);
+  if (ident.empty()) {
+    return nullopt;
+  }
+
+  if (ident.compare(0, 4, "\x7f" "ELF") == 0) {
+    if ((ident[4] != 1 && ident[4] != 2) || (ident[5] != 1 && ident[5] != 2)) {
+      return nullopt;
+    }
+    return read_elf_build_id(reader, ident);
+  } else if (load(ident, 0, 4, true) == k_macho_fat_magic) {
+    return read_fat_macho_uuids(reader, ident);
+  } else {
+    return read_macho_uuid(reader, 0);
+  }
+}
+
+} // namespace BuildId
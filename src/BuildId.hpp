@@ -0,0 +1,38 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+
+#include <string>
+
+// Reading of the unique identifier that linkers embed in executables: the GNU
+// build ID note of ELF files and the LC_UUID load command of Mach-O files.
+// Only the headers are read, so this is much cheaper than hashing the file.
+namespace BuildId {
+
+// Return the raw build ID of the executable at `path`. For a universal
+// (fat) Mach-O file, the UUIDs of all architectures are concatenated. Returns
+// nullopt if the file can't be read, has an unknown format or has no build
+// ID.
+nonstd::optional<std::string> read(const std::string& path);
+
+} // namespace BuildId
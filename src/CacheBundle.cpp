@@ -0,0 +1,356 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CacheBundle.hpp"
+
+#include "AtomicFile.hpp"
+#include "CacheFile.hpp"
+#include "Config.hpp"
+#include "Counters.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "Manifest.hpp"
+#include "Result.hpp"
+#include "Stat.hpp"
+#include "Statistics.hpp"
+#include "StdMakeUnique.hpp"
+#include "Storage.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+const uint8_t k_magic[4] = {'c', 'C', 'b', 'D'};
+const uint8_t k_version = 1;
+const size_t k_header_size = 16;
+const size_t k_name_size = 48;
+const size_t k_entry_size = k_name_size + 2 * sizeof(uint64_t);
+
+// Return whether the file named `name` in a level 1 subdirectory is a
+// manifest, a result or a raw file of a result.
+bool
+is_bundled_file(string_view name)
+{
+  return !name.empty() && name.size() < k_name_size
+         && (Util::ends_with(name, Manifest::k_file_suffix)
+             || Util::ends_with(name, Result::k_file_suffix)
+             || name.back() == 'W');
+}
+
+} // namespace
+
+uint64_t
+CacheBundle::write(const Config& config,
+                   const std::string& path,
+                   uint64_t max_size,
+                   const Util::ProgressReceiver& progress_receiver)
+{
+  std::vector<std::shared_ptr<CacheFile>> files;
+  // Packs of the subdirectories and their modification times.
+  std::vector<std::pair<std::unique_ptr<CacheBundle>, time_t>> packs;
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      Util::get_level_1_files(subdir, sub_progress_receiver, files);
+      const auto pack_path = FMT("{}/{}", subdir, Storage::k_pack_file_name);
+      const auto pack_stat = Stat::stat(pack_path);
+      if (pack_stat) {
+        auto pack = std::make_unique<CacheBundle>(pack_path);
+        if (*pack) {
+          packs.emplace_back(std::move(pack), pack_stat.mtime());
+        }
+      }
+    },
+    [&](double progress) { progress_receiver(progress / 2); });
+
+  // The name of a file is its path below the cache directory without slashes.
+  struct BundledFile
+  {
+    File file;
+    time_t mtime;
+    uint64_t size;
+  };
+  std::vector<BundledFile> bundled;
+  std::unordered_set<std::string> loose_names;
+  for (const auto& file : files) {
+    auto name = LruIndex::name_from_path(config.cache_dir(), file->path());
+    if (is_bundled_file(name)) {
+      loose_names.insert(name);
+      bundled.push_back({{std::move(name), file->path(), nullopt},
+                         file->lstat().mtime(),
+                         file->lstat().size()});
+    }
+  }
+  // Packed entries are aged as their pack unless shadowed by a loose file.
+  for (const auto& pack : packs) {
+    for (uint64_t i = 0; i < pack.first->size(); ++i) {
+      std::string name(pack.first->name(i));
+      const auto data = pack.first->data(i);
+      if (data && loose_names.count(name) == 0) {
+        bundled.push_back(
+          {{std::move(name), {}, data}, pack.second, data->size()});
+      }
+    }
+  }
+  std::sort(bundled.begin(),
+            bundled.end(),
+            [](const BundledFile& f1, const BundledFile& f2) {
+              return f1.mtime > f2.mtime;
+            });
+  if (max_size != 0) {
+    uint64_t size = 0;
+    auto it = bundled.begin();
+    while (it != bundled.end() && size + it->size <= max_size) {
+      size += it->size;
+      ++it;
+    }
+    bundled.erase(it, bundled.end());
+  }
+  std::sort(bundled.begin(),
+            bundled.end(),
+            [](const BundledFile& f1, const BundledFile& f2) {
+              return f1.file.name < f2.file.name;
+            });
+
+  std::vector<File> bundled_files;
+  bundled_files.reserve(bundled.size());
+  for (auto& file : bundled) {
+    bundled_files.push_back(std::move(file.file));
+  }
+  return write_files(path, bundled_files, [&](double progress) {
+    progress_receiver(0.5 + progress / 2);
+  });
+}
+
+uint64_t
+CacheBundle::write_files(const std::string& path,
+                         const std::vector<File>& files,
+                         const Util::ProgressReceiver& progress_receiver)
+{
+  // The header and index are written again when the offsets are known. Files
+  // removed in the meantime leave unused index space at the end.
+  std::vector<uint8_t> index(k_header_size + files.size() * k_entry_size);
+  AtomicFile bundle(path, AtomicFile::Mode::binary);
+  bundle.write(index);
+
+  uint64_t offset = index.size();
+  uint64_t count = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    progress_receiver(1.0 * i / files.size());
+    const auto& name = files[i].name;
+    if (name.empty() || name.size() >= k_name_size) {
+      LOG("Not bundling {}: bad name", name);
+      continue;
+    }
+    std::string read_data;
+    if (!files[i].data) {
+      try {
+        read_data = Util::read_file(files[i].path);
+      } catch (const Error& e) {
+        LOG("Not bundling {}: {}", files[i].path, e.what());
+        continue;
+      }
+    }
+    const string_view data = files[i].data ? *files[i].data : read_data;
+    uint8_t* entry = &index[k_header_size + count * k_entry_size];
+    memcpy(entry, name.data(), name.size());
+    Util::int_to_big_endian(offset, entry + k_name_size);
+    Util::int_to_big_endian<uint64_t>(data.size(),
+                                      entry + k_name_size + sizeof(uint64_t));
+    if (!data.empty()) {
+      bundle.write(data);
+    }
+    offset += data.size();
+    ++count;
+  }
+
+  memcpy(&index[0], k_magic, sizeof(k_magic));
+  index[sizeof(k_magic)] = k_version;
+  Util::int_to_big_endian(count, &index[8]);
+  if (fseek(bundle.stream(), 0, SEEK_SET) != 0) {
+    throw Error("failed to seek in {}: {}", path, strerror(errno));
+  }
+  bundle.write(index);
+  bundle.commit();
+  progress_receiver(1.0);
+  return count;
+}
+
+CacheBundle::CacheBundle(const std::string& path) : m_path(path)
+{
+#ifdef HAVE_SYS_MMAN_H
+  Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    LOG("Failed to open {}: {}", path, strerror(errno));
+    return;
+  }
+  struct stat st;
+  if (fstat(*fd, &st) != 0) {
+    LOG("Failed to stat {}: {}", path, strerror(errno));
+    return;
+  }
+  if (static_cast<size_t>(st.st_size) < k_header_size) {
+    LOG("{} is not a cache bundle", path);
+    return;
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, *fd, 0);
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap {}: {}", path, strerror(errno));
+    return;
+  }
+  m_data = static_cast<const uint8_t*>(data);
+  m_size = st.st_size;
+#else
+  try {
+    m_buffer = Util::read_file(path);
+  } catch (const Error& e) {
+    LOG("Failed to read {}: {}", path, e.what());
+    return;
+  }
+  m_data = reinterpret_cast<const uint8_t*>(m_buffer.data());
+  m_size = m_buffer.size();
+#endif
+
+  // File offsets are checked when the files are accessed so that mounting a
+  // bundle as a lower cache doesn't have to read the whole index.
+  uint64_t count = 0;
+  bool valid = m_size >= k_header_size
+               && memcmp(m_data, k_magic, sizeof(k_magic)) == 0
+               && m_data[sizeof(k_magic)] == k_version;
+  if (valid) {
+    Util::big_endian_to_int(m_data + 8, count);
+    valid = count <= (m_size - k_header_size) / k_entry_size;
+  }
+  if (!valid) {
+    LOG("{} is not a valid cache bundle", path);
+#ifdef HAVE_SYS_MMAN_H
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    return;
+  }
+  m_count = count;
+}
+
+CacheBundle::~CacheBundle()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (m_data) {
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+  }
+#endif
+}
+
+optional<string_view>
+CacheBundle::get(string_view name) const
+{
+  const uint64_t index = lower_bound(name);
+  if (index == m_count || this->name(index) != name) {
+    return nullopt;
+  }
+  return data(index);
+}
+
+uint64_t
+CacheBundle::import(const Config& config,
+                    const Util::ProgressReceiver& progress_receiver) const
+{
+  std::atomic<uint64_t> imported(0);
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      // The files of a level 1 subdirectory are adjacent in the sorted index.
+      const auto prefix = Util::base_name(subdir);
+      const uint64_t begin = lower_bound(prefix);
+      uint64_t end = begin;
+      while (end < m_count && Util::starts_with(name(end), prefix)) {
+        ++end;
+      }
+
+      Storage storage(config);
+      Counters counter_updates;
+      for (uint64_t i = begin; i < end; ++i) {
+        sub_progress_receiver(1.0 * (i - begin) / (end - begin));
+        const auto file_data = data(i);
+        if (file_data
+            && storage.import_file(
+              std::string(name(i)), *file_data, counter_updates)) {
+          ++imported;
+        }
+      }
+
+      if (!counter_updates.all_zero()) {
+        Statistics::update(
+          config.cache_dir(), subdir + "/stats", [&](Counters& cs) {
+            cs.increment(counter_updates);
+          });
+      }
+    },
+    progress_receiver,
+    config.maintenance_jobs());
+  return imported;
+}
+
+uint64_t
+CacheBundle::lower_bound(string_view name) const
+{
+  uint64_t low = 0;
+  uint64_t high = m_count;
+  while (low < high) {
+    const uint64_t mid = low + (high - low) / 2;
+    if (this->name(mid) < name) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+string_view
+CacheBundle::name(uint64_t index) const
+{
+  const uint8_t* entry = m_data + k_header_size + index * k_entry_size;
+  const char* name = reinterpret_cast<const char*>(entry);
+  return string_view(name, strnlen(name, k_name_size));
+}
+
+optional<string_view>
+CacheBundle::data(uint64_t index) const
+{
+  const uint8_t* entry = m_data + k_header_size + index * k_entry_size;
+  uint64_t offset;
+  uint64_t size;
+  Util::big_endian_to_int(entry + k_name_size, offset);
+  Util::big_endian_to_int(entry + k_name_size + sizeof(uint64_t), size);
+  if (offset > m_size || size > m_size - offset) {
+    LOG("Entry {} in {} is out of bounds", name(index), m_path);
+    return nullopt;
+  }
+  return string_view(reinterpret_cast<const char*>(m_data) + offset, size);
+}
@@ -0,0 +1,127 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+#include "Util.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+class Config;
+
+// A read-only bundle of cache entries (manifests, results and raw files) in a
+// single file, used to seed caches without copying millions of small files, as
+// a lower cache that is searched without being unpacked and as the pack of
+// small entries in a level 1 subdirectory, see pack_max_file_size.
+//
+// Format (integers are big endian):
+//
+// <bundle>    ::= <header> <index> <data>
+// <header>    ::= <magic> <version> <reserved> <count>
+// <magic>     ::= 4 bytes ("cCbD")
+// <version>   ::= uint8_t
+// <reserved>  ::= 3 bytes (zero)
+// <count>     ::= uint64_t ; number of index entries
+// <index>     ::= <entry>* ; sorted by name
+// <entry>     ::= <name> <offset> <size>
+// <name>      ::= 48 bytes ; file name in the cache directory, NUL padded
+// <offset>    ::= uint64_t ; offset of the file data from the start of bundle
+// <size>      ::= uint64_t
+// <data>      ::= file data referred to by the entries
+class CacheBundle : NonCopyable
+{
+public:
+  struct File
+  {
+    // Name of the file in the cache directory, see LruIndex::name_from_path.
+    std::string name;
+    // Path to read the data from if `data` is not set.
+    std::string path;
+    nonstd::optional<nonstd::string_view> data;
+  };
+
+  // Write a bundle of the most recently used entries in the cache directory of
+  // `config`, whose total size does not exceed `max_size` unless it is 0, to
+  // `path`. Returns the number of files written.
+  static uint64_t write(const Config& config,
+                        const std::string& path,
+                        uint64_t max_size,
+                        const Util::ProgressReceiver& progress_receiver);
+
+  // Write a bundle of `files`, which must be sorted by name, to `path`. Files
+  // that can't be read are left out. Returns the number of files written.
+  static uint64_t write_files(const std::string& path,
+                              const std::vector<File>& files,
+                              const Util::ProgressReceiver& progress_receiver);
+
+  // Map the bundle at `path`. Check `operator bool` for success.
+  explicit CacheBundle(const std::string& path);
+  ~CacheBundle();
+
+  // Return whether the bundle could be mapped and is valid.
+  explicit operator bool() const;
+
+  // Number of files in the bundle.
+  uint64_t size() const;
+
+  // Return the data of the file named `name` (entry name with suffix), if any.
+  nonstd::optional<nonstd::string_view> get(nonstd::string_view name) const;
+
+  // Return the name of file `index`, in the range [0, size()).
+  nonstd::string_view name(uint64_t index) const;
+
+  // Return the data of file `index`, or nullopt if the index entry is
+  // corrupt.
+  nonstd::optional<nonstd::string_view> data(uint64_t index) const;
+
+  // Store the files of the bundle that are missing in the cache directory of
+  // `config`, processing maintenance_jobs level 1 subdirectories in parallel.
+  // Returns the number of stored files.
+  uint64_t import(const Config& config,
+                  const Util::ProgressReceiver& progress_receiver) const;
+
+private:
+  std::string m_path;
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  uint64_t m_count = 0;
+#ifndef HAVE_SYS_MMAN_H
+  std::string m_buffer;
+#endif
+
+  // Return the index of the first file whose name is not less than `name`.
+  uint64_t lower_bound(nonstd::string_view name) const;
+};
+
+inline CacheBundle::operator bool() const
+{
+  return m_data != nullptr;
+}
+
+inline uint64_t
+CacheBundle::size() const
+{
+  return m_count;
+}
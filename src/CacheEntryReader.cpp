@@ -24,17 +24,31 @@
 
 #include "third_party/fmt/core.h"
 
+#ifdef __linux__
+#  include <sys/xattr.h>
+#endif
+
+namespace {
+
+// Extended attribute holding the size of a cache entry file when it was
+// verified by `ccache --scrub`.
+const char k_scrubbed_attribute[] = "user.ccache.scrubbed";
+
+} // namespace
+
 CacheEntryReader::CacheEntryReader(FILE* stream,
                                    const uint8_t expected_magic[4],
                                    uint8_t expected_version)
+  : m_stream(stream)
 {
-  uint8_t header_bytes[15];
-  if (fread(header_bytes, sizeof(header_bytes), 1, stream) != 1) {
+  uint8_t header_bytes[15 + 4];
+  if (fread(header_bytes, 15, 1, stream) != 1) {
     throw Error("Error reading header");
   }
 
   memcpy(m_magic, header_bytes, sizeof(m_magic));
-  m_version = header_bytes[4];
+  m_streamed = (header_bytes[4] & k_streamed_flag) != 0;
+  m_version = static_cast<uint8_t>(header_bytes[4] & ~k_streamed_flag);
   m_compression_type = Compression::type_from_int(header_bytes[5]);
   m_compression_level = header_bytes[6];
   Util::big_endian_to_int(header_bytes + 7, m_content_size);
@@ -51,32 +65,155 @@ CacheEntryReader::CacheEntryReader(FILE* stream,
       "Unknown version (actual {}, expected {})", m_version, expected_version);
   }
 
-  m_checksum.update(header_bytes, sizeof(header_bytes));
-  m_decompressor = Decompressor::create_from_type(m_compression_type, stream);
+  if (m_compression_type == Compression::Type::zstd_with_dictionary) {
+    if (fread(header_bytes + 15, 4, 1, stream) != 1) {
+      throw Error("Error reading dictionary ID");
+    }
+    Util::big_endian_to_int(header_bytes + 15, m_dictionary_id);
+    m_header_size = 15 + 4;
+  }
+
+  if (m_streamed) {
+    // The content size wasn't known when the checksum was computed.
+    memset(header_bytes + 7, 0, 8);
+  }
+  m_checksum.update(header_bytes, m_header_size);
+}
+
+uint8_t
+CacheEntryReader::peek_version(FILE* stream)
+{
+  uint8_t header_bytes[5];
+  if (fread(header_bytes, sizeof(header_bytes), 1, stream) != 1) {
+    throw Error("Error reading header");
+  }
+  if (fseek(stream, 0, SEEK_SET) != 0) {
+    throw Error("Error seeking to header: {}", strerror(errno));
+  }
+  return header_bytes[4] & ~k_streamed_flag;
+}
+
+bool
+CacheEntryReader::is_scrubbed(int fd)
+{
+#ifdef __linux__
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_nlink != 1) {
+    return false;
+  }
+  char value[32];
+  const ssize_t length =
+    fgetxattr(fd, k_scrubbed_attribute, value, sizeof(value) - 1);
+  if (length <= 0) {
+    return false;
+  }
+  value[length] = '\0';
+  return FMT("{}", st.st_size) == value;
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+void
+CacheEntryReader::mark_scrubbed(int fd)
+{
+#ifdef __linux__
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return;
+  }
+  const auto value = FMT("{}", st.st_size);
+  fsetxattr(fd, k_scrubbed_attribute, value.data(), value.size(), 0);
+#else
+  (void)fd;
+#endif
 }
 
 void
 CacheEntryReader::dump_header(FILE* dump_stream)
 {
   PRINT(dump_stream, "Magic: {:.4}\n", m_magic);
-  PRINT(dump_stream, "Version: {}\n", m_version);
+  PRINT(dump_stream,
+        "Version: {}{}\n",
+        m_version,
+        m_streamed ? " (streamed)" : "");
   PRINT(dump_stream,
         "Compression type: {}\n",
         Compression::type_to_string(m_compression_type));
   PRINT(dump_stream, "Compression level: {}\n", m_compression_level);
+  if (m_dictionary_id != 0) {
+    PRINT(dump_stream, "Dictionary ID: {:08x}\n", m_dictionary_id);
+  }
   PRINT(dump_stream, "Content size: {}\n", m_content_size);
 }
 
 void
 CacheEntryReader::read(void* data, size_t count)
 {
-  m_decompressor->read(data, count);
-  m_checksum.update(data, count);
+  decompressor().read(data, count);
+  if (m_verify_checksum) {
+    m_checksum.update(data, count);
+  }
+  m_payload_bytes_read += count;
+}
+
+bool
+CacheEntryReader::read_direct(
+  size_t count, const std::function<bool(int fd, uint64_t offset)>& copy)
+{
+#ifndef _WIN32
+  if (m_compression_type != Compression::Type::none) {
+    return false;
+  }
+  const long offset = ftell(m_stream);
+  if (offset < 0) {
+    return false;
+  }
+  const int fd = fileno(m_stream);
+  if (!copy(fd, offset)) {
+    return false;
+  }
+
+  // Verifying the checksum only reads from the page cache that the copy just
+  // populated.
+  uint8_t buffer[READ_BUFFER_SIZE];
+  size_t done = m_verify_checksum ? 0 : count;
+  while (done < count) {
+    const ssize_t n = pread(
+      fd, buffer, std::min(count - done, sizeof(buffer)), offset + done);
+    if (n <= 0) {
+      throw Error("Error reading payload for checksum");
+    }
+    m_checksum.update(buffer, n);
+    done += n;
+  }
+  if (fseek(m_stream, offset + count, SEEK_SET) != 0) {
+    throw Error("Error seeking past payload: {}", strerror(errno));
+  }
+  m_payload_bytes_read += count;
+  return true;
+#else
+  (void)count;
+  (void)copy;
+  return false;
+#endif
 }
 
 void
-CacheEntryReader::finalize()
+CacheEntryReader::finalize(bool more_data_follows)
 {
+  if (m_streamed) {
+    const uint64_t actual_size = m_payload_bytes_read;
+    uint64_t expected_size;
+    read(expected_size);
+    if (actual_size != expected_size) {
+      throw Error("Incorrect payload size (actual {}, expected {})",
+                  actual_size,
+                  expected_size);
+    }
+  }
+
   uint64_t actual_digest = m_checksum.digest();
 
   uint8_t buffer[8];
@@ -84,11 +221,24 @@ CacheEntryReader::finalize()
   uint64_t expected_digest;
   Util::big_endian_to_int(buffer, expected_digest);
 
-  if (actual_digest != expected_digest) {
+  if (m_verify_checksum && actual_digest != expected_digest) {
     throw Error("Incorrect checksum (actual 0x{:016x}, expected 0x{:016x})",
                 actual_digest,
                 expected_digest);
   }
 
-  m_decompressor->finalize();
+  if (!more_data_follows || m_compression_type != Compression::Type::none) {
+    decompressor().finalize();
+  }
+}
+
+Decompressor&
+CacheEntryReader::decompressor()
+{
+  // Created on first use so that only inspecting the header is cheap.
+  if (!m_decompressor) {
+    m_decompressor = Decompressor::create_from_type(
+      m_compression_type, m_stream, m_dictionary_id);
+  }
+  return *m_decompressor;
 }
@@ -24,6 +24,7 @@
 #include "Decompressor.hpp"
 #include "Util.hpp"
 
+#include <functional>
 #include <memory>
 
 // This class knows how to read a cache entry with a common header and a
@@ -32,6 +33,12 @@
 class CacheEntryReader
 {
 public:
+  // Set in the version byte of a streamed entry, i.e. one written without
+  // knowing the payload size in advance. The checksum of such an entry covers
+  // the header with a zero content size, and the payload is followed by its
+  // size before the checksum.
+  static const uint8_t k_streamed_flag = 0x80;
+
   // Constructor.
   //
   // Parameters:
@@ -42,6 +49,21 @@ public:
                    const uint8_t expected_magic[4],
                    uint8_t expected_version);
 
+  // Get the format version of the cache entry in `stream` without consuming
+  // anything. Throws Error on failure.
+  static uint8_t peek_version(FILE* stream);
+
+  // Return whether the cache entry file open as `fd` has been verified by
+  // `ccache --scrub` and has not been replaced or hard linked since.
+  static bool is_scrubbed(int fd);
+
+  // Mark the cache entry file open as `fd` as verified. Does nothing on
+  // platforms or file systems without user extended attributes.
+  static void mark_scrubbed(int fd);
+
+  // Neither compute nor verify the checksum of the entry.
+  void skip_checksum();
+
   // Dump header information in text format.
   //
   // Parameters:
@@ -65,13 +87,27 @@ public:
   // Throws Error on failure.
   template<typename T> void read(T& value);
 
+  // Let `copy` transfer the next `count` bytes of an uncompressed payload
+  // directly from the underlying file, given as a file descriptor and an
+  // offset, instead of reading them into a buffer. The data is still included
+  // in the checksum.
+  //
+  // Returns false without consuming anything if the payload is compressed or
+  // if `copy` returns false. Throws Error on failure.
+  bool read_direct(size_t count,
+                   const std::function<bool(int fd, uint64_t offset)>& copy);
+
   // Close for reading.
   //
   // This method potentially verifies the end state after reading the cache
-  // entry and throws Error if any integrity issues are found.
-  void finalize();
-
-  // Get size of the payload,
+  // entry and throws Error if any integrity issues are found. Pass
+  // `more_data_follows` if the cache entry is followed by other data in the
+  // same file, in which case an uncompressed payload doesn't have to end at the
+  // end of the file.
+  void finalize(bool more_data_follows = false);
+
+  // Get size of the payload, or 0 if unknown since the entry is streamed and
+  // its header couldn't be updated with the size when it was written.
   uint64_t payload_size() const;
 
   // Get content magic.
@@ -80,16 +116,23 @@ public:
   // Get content version.
   uint8_t version() const;
 
+  // Get whether the entry is streamed, see `k_streamed_flag`.
+  bool streamed() const;
+
   // Get compression type.
   Compression::Type compression_type() const;
 
   // Get compression level.
   int8_t compression_level() const;
 
+  // Get ID of the compression dictionary, or 0 if none.
+  uint32_t dictionary_id() const;
+
   // Get size of the content (header + payload + checksum).
   uint64_t content_size() const;
 
 private:
+  FILE* m_stream;
   std::unique_ptr<Decompressor> m_decompressor;
   Checksum m_checksum;
   uint8_t m_magic[4];
@@ -97,6 +140,13 @@ private:
   Compression::Type m_compression_type;
   int8_t m_compression_level;
   uint64_t m_content_size;
+  uint32_t m_dictionary_id = 0;
+  uint8_t m_header_size = 15;
+  bool m_streamed = false;
+  uint64_t m_payload_bytes_read = 0;
+  bool m_verify_checksum = true;
+
+  Decompressor& decompressor();
 };
 
 template<typename T>
@@ -108,6 +158,12 @@ CacheEntryReader::read(T& value)
   Util::big_endian_to_int(buffer, value);
 }
 
+inline void
+CacheEntryReader::skip_checksum()
+{
+  m_verify_checksum = false;
+}
+
 inline const uint8_t*
 CacheEntryReader::magic() const
 {
@@ -132,10 +188,25 @@ CacheEntryReader::compression_level() const
   return m_compression_level;
 }
 
+inline bool
+CacheEntryReader::streamed() const
+{
+  return m_streamed;
+}
+
 inline uint64_t
 CacheEntryReader::payload_size() const
 {
-  return m_content_size - 15 - 8;
+  if (m_streamed) {
+    return m_content_size > 0 ? m_content_size - m_header_size - 8 - 8 : 0;
+  }
+  return m_content_size - m_header_size - 8;
+}
+
+inline uint32_t
+CacheEntryReader::dictionary_id() const
+{
+  return m_dictionary_id;
 }
 
 inline uint64_t
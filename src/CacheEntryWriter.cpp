@@ -18,29 +18,55 @@
 
 #include "CacheEntryWriter.hpp"
 
+#include "CacheEntryReader.hpp"
+#include "ZstdDictionary.hpp"
+
 CacheEntryWriter::CacheEntryWriter(FILE* stream,
                                    const uint8_t magic[4],
                                    uint8_t version,
                                    Compression::Type compression_type,
                                    int8_t compression_level,
-                                   uint64_t payload_size)
-  // clang-format off
-  : m_compressor(
-      Compressor::create_from_type(compression_type, stream, compression_level)
-    )
+                                   nonstd::optional<uint64_t> payload_size,
+                                   uint32_t compression_threads)
+  : m_stream(stream),
+    m_header_offset(ftell(stream)),
+    m_streamed(!payload_size)
 {
-  // clang-format on
-  uint8_t header_bytes[15];
+  uint32_t dictionary_id = 0;
+  if (compression_type == Compression::Type::zstd) {
+    dictionary_id = ZstdDictionary::current_id();
+    if (dictionary_id != 0) {
+      compression_type = Compression::Type::zstd_with_dictionary;
+    }
+  }
+  m_compression_type = compression_type;
+  m_dictionary_id = dictionary_id;
+  m_compressor = Compressor::create_from_type(compression_type,
+                                              stream,
+                                              compression_level,
+                                              dictionary_id,
+                                              compression_threads);
+
+  // The dictionary ID, if any, is stored uncompressed directly after the
+  // common header so that the reader can set up its decompressor.
+  uint8_t header_bytes[15 + 4];
+  m_header_size = dictionary_id != 0 ? 15 + 4 : 15;
   memcpy(header_bytes, magic, 4);
-  header_bytes[4] = version;
+  header_bytes[4] =
+    m_streamed ? version | CacheEntryReader::k_streamed_flag : version;
   header_bytes[5] = static_cast<uint8_t>(compression_type);
   header_bytes[6] = m_compressor->actual_compression_level();
-  uint64_t content_size = 15 + payload_size + 8;
+  // The content size of a streamed entry is filled in by finalize.
+  const uint64_t content_size =
+    m_streamed ? 0 : m_header_size + *payload_size + 8;
   Util::int_to_big_endian(content_size, header_bytes + 7);
-  if (fwrite(header_bytes, sizeof(header_bytes), 1, stream) != 1) {
+  if (dictionary_id != 0) {
+    Util::int_to_big_endian(dictionary_id, header_bytes + 15);
+  }
+  if (fwrite(header_bytes, m_header_size, 1, stream) != 1) {
     throw Error("Failed to write cache entry header");
   }
-  m_checksum.update(header_bytes, sizeof(header_bytes));
+  m_checksum.update(header_bytes, m_header_size);
 }
 
 void
@@ -48,13 +74,48 @@ CacheEntryWriter::write(const void* data, size_t count)
 {
   m_compressor->write(data, count);
   m_checksum.update(data, count);
+  m_payload_bytes_written += count;
+}
+
+void
+CacheEntryWriter::write_frame(const void* data,
+                              size_t count,
+                              nonstd::string_view frame,
+                              uint32_t frame_dictionary_id)
+{
+  const bool is_zstd = m_compression_type == Compression::Type::zstd
+                       || m_compression_type
+                            == Compression::Type::zstd_with_dictionary;
+  if (is_zstd && frame_dictionary_id == m_dictionary_id
+      && m_compressor->write_frame(frame)) {
+    m_checksum.update(data, count);
+    m_payload_bytes_written += count;
+  } else {
+    write(data, count);
+  }
 }
 
 void
 CacheEntryWriter::finalize()
 {
   uint8_t buffer[8];
+  if (m_streamed) {
+    Util::int_to_big_endian(m_payload_bytes_written, buffer);
+    m_compressor->write(buffer, sizeof(buffer));
+    m_checksum.update(buffer, sizeof(buffer));
+  }
   Util::int_to_big_endian(m_checksum.digest(), buffer);
   m_compressor->write(buffer, sizeof(buffer));
   m_compressor->finalize();
+
+  if (m_streamed && m_header_offset >= 0) {
+    const long end_offset = ftell(m_stream);
+    const uint64_t content_size = m_header_size + m_payload_bytes_written + 16;
+    Util::int_to_big_endian(content_size, buffer);
+    if (end_offset < 0 || fseek(m_stream, m_header_offset + 7, SEEK_SET) != 0
+        || fwrite(buffer, sizeof(buffer), 1, m_stream) != 1
+        || fseek(m_stream, end_offset, SEEK_SET) != 0) {
+      throw Error("Failed to update cache entry header");
+    }
+  }
 }
@@ -24,6 +24,8 @@
 #include "Compressor.hpp"
 #include "Util.hpp"
 
+#include "third_party/nonstd/optional.hpp"
+
 #include <memory>
 
 // This class knows how to write a cache entry with a common header and a
@@ -40,13 +42,17 @@ public:
   // - version: File format version.
   // - compression_type: Compression type to use.
   // - compression_level: Compression level to use.
-  // - payload_size: Payload size.
+  // - payload_size: Payload size, or nullopt to write a streamed entry (see
+  //   CacheEntryReader::k_streamed_flag), whose size is written after the
+  //   payload and, if `stream` is seekable, into the header by `finalize`.
+  // - compression_threads: Number of worker threads the compressor may use.
   CacheEntryWriter(FILE* stream,
                    const uint8_t magic[4],
                    uint8_t version,
                    Compression::Type compression_type,
                    int8_t compression_level,
-                   uint64_t payload_size);
+                   nonstd::optional<uint64_t> payload_size,
+                   uint32_t compression_threads = 0);
 
   // Write data to the payload from a buffer.
   //
@@ -65,6 +71,23 @@ public:
   // Throws Error on failure.
   template<typename T> void write(T value);
 
+  // Write data to the payload from a buffer, using `frame` as its compressed
+  // form if possible.
+  //
+  // Parameters:
+  // - data: Data to write.
+  // - count: Size of data to write.
+  // - frame: A frame containing the data compressed with the compression type
+  //   of the entry (see Compressor::write_frame).
+  // - frame_dictionary_id: ID of the dictionary `frame` was compressed with, 0
+  //   for none.
+  //
+  // Throws Error on failure.
+  void write_frame(const void* data,
+                   size_t count,
+                   nonstd::string_view frame,
+                   uint32_t frame_dictionary_id);
+
   // Close for writing.
   //
   // This method potentially verifies the end state after writing the cache
@@ -72,8 +95,16 @@ public:
   void finalize();
 
 private:
+  FILE* m_stream;
   std::unique_ptr<Compressor> m_compressor;
+  Compression::Type m_compression_type;
+  uint32_t m_dictionary_id = 0;
   Checksum m_checksum;
+  // Offset of the header in the stream, or -1 if not seekable.
+  long m_header_offset;
+  size_t m_header_size;
+  bool m_streamed;
+  uint64_t m_payload_bytes_written = 0;
 };
 
 template<typename T>
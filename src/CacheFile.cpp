@@ -18,6 +18,8 @@
 
 #include "CacheFile.hpp"
 
+#include "CacheEntryReader.hpp"
+#include "File.hpp"
 #include "Manifest.hpp"
 #include "Result.hpp"
 #include "Util.hpp"
@@ -43,3 +45,28 @@ CacheFile::type() const
     return Type::unknown;
   }
 }
+
+uint64_t
+CacheFile::content_size() const
+{
+  const auto file_type = type();
+  if (file_type == Type::unknown) {
+    return 0;
+  }
+
+  File file(m_path, "rb");
+  if (!file) {
+    return 0;
+  }
+  try {
+    // The header is the same in all supported versions.
+    const uint8_t version = CacheEntryReader::peek_version(file.get());
+    return CacheEntryReader(file.get(),
+                            file_type == Type::result ? Result::k_magic
+                                                      : Manifest::k_magic,
+                            version)
+      .content_size();
+  } catch (const Error&) {
+    return 0;
+  }
+}
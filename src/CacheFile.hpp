@@ -34,6 +34,9 @@ public:
 
   explicit CacheFile(const std::string& path);
 
+  // Construct with an already known result of lstat-ing `path`.
+  CacheFile(const std::string& path, const Stat& stat);
+
   CacheFile(const CacheFile&) = delete;
   CacheFile& operator=(const CacheFile&) = delete;
 
@@ -41,6 +44,10 @@ public:
   const std::string& path() const;
   Type type() const;
 
+  // Read the uncompressed size of a result or manifest from its header.
+  // Returns 0 if the file isn't a readable cache entry.
+  uint64_t content_size() const;
+
 private:
   const std::string m_path;
   mutable nonstd::optional<Stat> m_stat;
@@ -50,6 +57,12 @@ inline CacheFile::CacheFile(const std::string& path) : m_path(path)
 {
 }
 
+inline CacheFile::CacheFile(const std::string& path, const Stat& stat)
+  : m_path(path),
+    m_stat(stat)
+{
+}
+
 inline const std::string&
 CacheFile::path() const
 {
@@ -0,0 +1,323 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CacheSimulator.hpp"
+
+#include "Config.hpp"
+#include "LruIndex.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <set>
+#include <tuple>
+#include <unordered_map>
+
+using nonstd::string_view;
+
+namespace {
+
+// Number of files that sampled LRU compares if cleanup_sample_size is 0.
+const uint32_t k_default_sample_size = 5;
+
+// Cache sizes to simulate, relative to max_size.
+const double k_size_factors[] = {0.125, 0.25, 0.5, 1.0, 2.0, 4.0};
+
+// Return the value of `key` in `event`, a flat JSON object as written by
+// EventLog, or an empty view if missing. Strings are returned without quotes
+// and are only used for values that don't contain escaped characters.
+string_view
+get_field(string_view event, string_view key)
+{
+  const auto pattern = FMT("\"{}\":", key);
+  const auto pos = event.find(pattern);
+  if (pos == string_view::npos) {
+    return {};
+  }
+  const auto value = event.substr(pos + pattern.size());
+  if (!value.empty() && value[0] == '"') {
+    const auto end = value.find('"', 1);
+    return end == string_view::npos ? string_view() : value.substr(1, end - 1);
+  }
+  return value.substr(0, value.find_first_of(",}"));
+}
+
+uint64_t
+get_number(string_view event, string_view key)
+{
+  const auto value = get_field(event, key);
+  if (value.empty()) {
+    return 0;
+  }
+  try {
+    return Util::parse_unsigned(std::string(value));
+  } catch (const Error&) {
+    return 0;
+  }
+}
+
+// Files are stored in the subdirectory named by the first character of the
+// result name.
+uint8_t
+subdir_of(string_view result_name)
+{
+  const char c = result_name[0];
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else {
+    return static_cast<uint8_t>(c) % 16;
+  }
+}
+
+std::string
+format_row(const std::string& size,
+           const std::string& policy,
+           const CacheSimulator::Outcome& outcome)
+{
+  const uint64_t lookups = outcome.hits + outcome.misses;
+  return FMT("{:>10}  {:<16}  {:>6.2f} %  {:>10.1f} s\n",
+             size,
+             policy,
+             lookups == 0 ? 0.0 : 100.0 * outcome.hits / lookups,
+             outcome.saved_time_ms / 1000.0);
+}
+
+} // namespace
+
+namespace CacheSimulator {
+
+Trace
+parse(string_view content)
+{
+  Trace trace;
+  std::unordered_map<std::string, uint32_t> indexes;
+  std::vector<uint64_t> bytes_retrieved;
+
+  for (const auto event : Util::split_into_views(content, "\n")) {
+    const auto result_name = get_field(event, "result_name");
+    if (result_name.empty()) {
+      continue;
+    }
+    const auto inserted = indexes.emplace(
+      std::string(result_name), static_cast<uint32_t>(trace.results.size()));
+    if (inserted.second) {
+      trace.results.emplace_back();
+      trace.results.back().subdir = subdir_of(result_name);
+      bytes_retrieved.push_back(0);
+    }
+    const uint32_t index = inserted.first->second;
+    auto& result = trace.results[index];
+    result.size = std::max(result.size, get_number(event, "compressed_size"));
+    result.cost =
+      std::max(result.cost, get_number(event, "compiler_duration_ms"));
+    bytes_retrieved[index] =
+      std::max(bytes_retrieved[index], get_number(event, "bytes_retrieved"));
+    trace.lookups.push_back(index);
+  }
+
+  for (size_t i = 0; i < trace.results.size(); ++i) {
+    if (trace.results[i].size == 0) {
+      trace.results[i].size = bytes_retrieved[i];
+    }
+  }
+  return trace;
+}
+
+Outcome
+simulate(const Trace& trace,
+         Policy policy,
+         uint64_t max_size,
+         double limit_multiple,
+         uint32_t sample_size)
+{
+  // Priority (always 0 for LRU), time of last use and result index.
+  using QueueItem = std::tuple<double, int64_t, uint32_t>;
+
+  struct File
+  {
+    bool cached = false;
+    int64_t time = 0;
+    uint64_t hits = 0;
+    double inflation = 0;
+    double priority = 0;
+    // Index in Subdir::files for sampled LRU.
+    size_t position = 0;
+  };
+
+  struct Subdir
+  {
+    uint64_t size = 0;
+    double inflation = 0;
+    std::set<QueueItem> queue;
+    std::vector<uint32_t> files;
+  };
+
+  std::vector<File> files(trace.results.size());
+  std::array<Subdir, 16> subdirs;
+  // The same random choices in each run make the results comparable.
+  std::mt19937_64 random_engine(0);
+  const uint64_t subdir_max_size = max_size / 16;
+  const auto subdir_target_size =
+    static_cast<uint64_t>(std::round(max_size * limit_multiple / 16));
+
+  const auto link = [&](uint32_t index) {
+    auto& file = files[index];
+    auto& subdir = subdirs[trace.results[index].subdir];
+    if (policy == Policy::sampled_lru) {
+      file.position = subdir.files.size();
+      subdir.files.push_back(index);
+      return;
+    }
+    if (policy == Policy::gdsf) {
+      const auto& result = trace.results[index];
+      LruIndex::Entry entry;
+      entry.time = file.time;
+      entry.size = result.size;
+      entry.cost = result.cost;
+      entry.hits = file.hits;
+      entry.inflation = file.inflation;
+      file.priority = entry.priority(result.size);
+    }
+    subdir.queue.emplace(file.priority, file.time, index);
+  };
+
+  const auto unlink = [&](uint32_t index) {
+    const auto& file = files[index];
+    auto& subdir = subdirs[trace.results[index].subdir];
+    if (policy == Policy::sampled_lru) {
+      files[subdir.files.back()].position = file.position;
+      std::swap(subdir.files[file.position], subdir.files.back());
+      subdir.files.pop_back();
+    } else {
+      subdir.queue.erase(QueueItem(file.priority, file.time, index));
+    }
+  };
+
+  const auto evict = [&](Subdir& subdir) {
+    uint32_t index;
+    if (policy == Policy::sampled_lru) {
+      std::uniform_int_distribution<size_t> distribution(
+        0, subdir.files.size() - 1);
+      index = subdir.files[distribution(random_engine)];
+      for (uint32_t i = 1; i < sample_size; ++i) {
+        const uint32_t candidate = subdir.files[distribution(random_engine)];
+        if (files[candidate].time < files[index].time) {
+          index = candidate;
+        }
+      }
+    } else {
+      index = std::get<2>(*subdir.queue.begin());
+      if (policy == Policy::gdsf) {
+        subdir.inflation = std::get<0>(*subdir.queue.begin());
+      }
+    }
+    unlink(index);
+    files[index].cached = false;
+    subdir.size -= trace.results[index].size;
+  };
+
+  Outcome outcome;
+  int64_t time = 0;
+  for (const uint32_t index : trace.lookups) {
+    ++time;
+    const auto& result = trace.results[index];
+    auto& file = files[index];
+    auto& subdir = subdirs[result.subdir];
+
+    if (file.cached) {
+      ++outcome.hits;
+      outcome.saved_time_ms += result.cost;
+      unlink(index);
+      file.time = time;
+      ++file.hits;
+      file.inflation = subdir.inflation;
+      link(index);
+      continue;
+    }
+
+    ++outcome.misses;
+    file = File();
+    file.cached = true;
+    file.time = time;
+    file.inflation = subdir.inflation;
+    link(index);
+    subdir.size += result.size;
+    if (max_size != 0 && subdir.size > subdir_max_size) {
+      while (subdir.size > subdir_target_size) {
+        evict(subdir);
+      }
+    }
+  }
+  return outcome;
+}
+
+std::string
+report(const Config& config, const Trace& trace)
+{
+  uint64_t total_size = 0;
+  for (const auto& result : trace.results) {
+    total_size += result.size;
+  }
+  const uint64_t base_size =
+    config.max_size() != 0 ? config.max_size() : total_size;
+  const uint32_t sample_size = config.cleanup_sample_size() != 0
+                                 ? config.cleanup_sample_size()
+                                 : k_default_sample_size;
+  const std::pair<Policy, std::string> policies[] = {
+    {Policy::lru, "lru"},
+    {Policy::sampled_lru, FMT("sampled lru ({})", sample_size)},
+    {Policy::gdsf, "gdsf"},
+  };
+
+  std::string report = FMT(
+    "Simulated {} compilations of {} results ({}) with limit_multiple {:.1f}\n"
+    "\n"
+    "{:>10}  {:<16}  {:>8}  {:>12}\n",
+    trace.lookups.size(),
+    trace.results.size(),
+    Util::format_human_readable_size(total_size),
+    config.limit_multiple(),
+    "Cache size",
+    "Policy",
+    "Hit rate",
+    "Saved time");
+  for (const double factor : k_size_factors) {
+    const auto max_size = static_cast<uint64_t>(std::round(base_size * factor));
+    for (const auto& policy : policies) {
+      report += format_row(Util::format_human_readable_size(max_size),
+                           policy.second,
+                           simulate(trace,
+                                    policy.first,
+                                    max_size,
+                                    config.limit_multiple(),
+                                    sample_size));
+    }
+  }
+  // Only the first compilation of each result misses without a size limit.
+  report += format_row(
+    "unlimited", "", simulate(trace, Policy::lru, 0, 1.0, sample_size));
+  return report;
+}
+
+} // namespace CacheSimulator
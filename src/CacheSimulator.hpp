@@ -0,0 +1,90 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+class Config;
+
+// Replay of the compilations recorded by the event_log option against
+// simulated caches of different sizes and cleanup policies, used by
+// `ccache --simulate` for capacity planning.
+namespace CacheSimulator {
+
+enum class Policy {
+  // Least recently used files first, like cleanup_policy = lru.
+  lru,
+  // The least recently used of a few random files, like cleanup_sample_size.
+  sampled_lru,
+  // Lowest GreedyDual-Size-Frequency priority first, like cleanup_policy =
+  // gdsf.
+  gdsf,
+};
+
+struct Trace
+{
+  struct Result
+  {
+    // Size of the result file in bytes.
+    uint64_t size = 0;
+    // Compile time in milliseconds that a hit saves.
+    uint64_t cost = 0;
+    // Cache subdirectory (0-15) that the result is stored in.
+    uint8_t subdir = 0;
+  };
+
+  std::vector<Result> results;
+
+  // Index in `results` of the result looked up by each compilation, in order.
+  std::vector<uint32_t> lookups;
+};
+
+struct Outcome
+{
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t saved_time_ms = 0;
+};
+
+// Parse the content of an event log. Events without a result name, e.g. of
+// compilations that can't be cached, are skipped. A result's size is taken from
+// the event that stored it, or else from the bytes retrieved by a hit.
+Trace parse(nonstd::string_view content);
+
+// Replay `trace` against an initially empty cache of `max_size` bytes (0 for no
+// limit) that is cleaned up like automatic cleanup does, i.e. a subdirectory
+// that exceeds its share of `max_size` is cleaned up to `limit_multiple` of
+// that. `sample_size` is the number of files that sampled LRU compares.
+Outcome simulate(const Trace& trace,
+                 Policy policy,
+                 uint64_t max_size,
+                 double limit_multiple,
+                 uint32_t sample_size);
+
+// Return a table of hit rates and saved compile time for each policy at cache
+// sizes from 1/8 to 4 times max_size (or the total size of the results if
+// max_size is 0).
+std::string report(const Config& config, const Trace& trace);
+
+} // namespace CacheSimulator
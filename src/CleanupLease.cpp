@@ -0,0 +1,118 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CleanupLease.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <random>
+
+namespace {
+
+// Return whether a lease with `content` ("host:pid:nonce:expiry") can be taken
+// over.
+bool
+is_stale(const std::string& content)
+{
+  const auto fields = Util::split_into_strings(content, ":");
+  if (fields.size() != 4) {
+    // Not written by us.
+    return true;
+  }
+
+  try {
+    if (Util::parse_signed(fields[3]) <= time(nullptr)) {
+      return true;
+    }
+#ifndef _WIN32
+    if (fields[0] == Util::get_hostname()) {
+      const auto pid = Util::parse_signed(fields[1], 1);
+      return kill(pid, 0) != 0 && errno == ESRCH;
+    }
+#endif
+  } catch (const Error&) {
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+CleanupLease::CleanupLease(const std::string& subdir, uint32_t duration)
+  : m_path(FMT("{}/cleanup.lease", subdir)),
+    m_content(FMT("{}:{}:{:x}:{}",
+                  Util::get_hostname(),
+                  getpid(),
+                  std::random_device()(),
+                  time(nullptr) + duration))
+{
+#ifdef _WIN32
+  // A cache directory shared between Windows hosts is not supported.
+  m_acquired = true;
+#else
+  // Taking over a stale lease is retried once, in case another host took it
+  // over at the same time.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (symlink(m_content.c_str(), m_path.c_str()) == 0) {
+      m_acquired = true;
+      return;
+    }
+    if (errno == EPERM) {
+      // The file system does not support symbolic links, so there is nothing
+      // to coordinate with.
+      m_acquired = true;
+      return;
+    }
+    if (errno != EEXIST) {
+      LOG("Failed to create {}: {}", m_path, strerror(errno));
+      return;
+    }
+
+    const auto content = Util::read_link(m_path);
+    if (content.empty() && errno == ENOENT) {
+      // Released in the meantime.
+      continue;
+    }
+    if (content == m_content) {
+      // Lost NFS reply; the nonce tells our lease from others of this process.
+      m_acquired = true;
+      return;
+    }
+    if (!is_stale(content)) {
+      LOG("Cleanup of {} is leased by {}", subdir, content);
+      return;
+    }
+    LOG("Taking over stale cleanup lease {} ({})", m_path, content);
+    if (Util::read_link(m_path) == content) {
+      unlink(m_path.c_str());
+    }
+  }
+#endif
+}
+
+CleanupLease::~CleanupLease()
+{
+#ifndef _WIN32
+  // Don't remove a lease that has been taken over after ours expired.
+  if (m_acquired && Util::read_link(m_path) == m_content) {
+    unlink(m_path.c_str());
+  }
+#endif
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include <string>
+
+// A lease on cleaning up a cache subdirectory, so that when several hosts share
+// a cache directory on NFS, only one of them cleans up a given subdirectory
+// while the others carry on compiling.
+//
+// The lease is a symbolic link named "cleanup.lease" in the subdirectory whose
+// target records the owning host, the owning process, a nonce and the time
+// when the lease expires. Symbolic links are created atomically on NFS, which
+// flock(2) doesn't reliably coordinate across hosts. A lease that has expired,
+// or that is owned by a process on this host that no longer exists, is taken
+// over.
+class CleanupLease : NonCopyable
+{
+public:
+  // Try to lease `subdir` for `duration` seconds.
+  CleanupLease(const std::string& subdir, uint32_t duration = 600);
+
+  // Release the lease if acquired and still ours.
+  ~CleanupLease();
+
+  // Return whether this process holds the lease.
+  bool acquired() const;
+
+private:
+  std::string m_path;
+  std::string m_content;
+  bool m_acquired = false;
+};
+
+inline bool
+CleanupLease::acquired() const
+{
+  return m_acquired;
+}
@@ -0,0 +1,323 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CompilationDatabase.hpp"
+
+#include "exceptions.hpp"
+
+#include <cctype>
+
+using nonstd::string_view;
+
+namespace {
+
+// A minimal JSON parser that only keeps what a compilation database needs:
+// strings and arrays of strings inside an array of objects. Other values are
+// validated and skipped.
+class Parser
+{
+public:
+  explicit Parser(string_view json) : m_json(json)
+  {
+  }
+
+  std::vector<CompilationDatabase::Entry> parse();
+
+private:
+  string_view m_json;
+  size_t m_pos = 0;
+
+  [[noreturn]] void fail(string_view what) const;
+  void skip_whitespace();
+  bool consume(char c);
+  void expect(char c);
+  std::string parse_string();
+  std::vector<std::string> parse_string_array();
+  void skip_value();
+  void append_utf8(std::string& result, uint32_t code_point);
+  uint32_t parse_hex4();
+  CompilationDatabase::Entry parse_entry();
+};
+
+void
+Parser::fail(string_view what) const
+{
+  throw Error("invalid compilation database: {} at offset {}", what, m_pos);
+}
+
+void
+Parser::skip_whitespace()
+{
+  while (m_pos < m_json.size()
+         && (m_json[m_pos] == ' ' || m_json[m_pos] == '\t'
+             || m_json[m_pos] == '\n' || m_json[m_pos] == '\r')) {
+    ++m_pos;
+  }
+}
+
+bool
+Parser::consume(char c)
+{
+  skip_whitespace();
+  if (m_pos < m_json.size() && m_json[m_pos] == c) {
+    ++m_pos;
+    return true;
+  }
+  return false;
+}
+
+void
+Parser::expect(char c)
+{
+  if (!consume(c)) {
+    fail(std::string("expected '") + c + "'");
+  }
+}
+
+uint32_t
+Parser::parse_hex4()
+{
+  if (m_pos + 4 > m_json.size()) {
+    fail("truncated escape");
+  }
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    const char c = m_json[m_pos++];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      fail("invalid escape");
+    }
+  }
+  return value;
+}
+
+void
+Parser::append_utf8(std::string& result, uint32_t code_point)
+{
+  if (code_point < 0x80) {
+    result += static_cast<char>(code_point);
+  } else if (code_point < 0x800) {
+    result += static_cast<char>(0xC0 | (code_point >> 6));
+    result += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else if (code_point < 0x10000) {
+    result += static_cast<char>(0xE0 | (code_point >> 12));
+    result += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    result += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else {
+    result += static_cast<char>(0xF0 | (code_point >> 18));
+    result += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+    result += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    result += static_cast<char>(0x80 | (code_point & 0x3F));
+  }
+}
+
+std::string
+Parser::parse_string()
+{
+  expect('"');
+  std::string result;
+  while (true) {
+    if (m_pos >= m_json.size()) {
+      fail("unterminated string");
+    }
+    const char c = m_json[m_pos++];
+    if (c == '"') {
+      return result;
+    } else if (c != '\\') {
+      result += c;
+      continue;
+    }
+    if (m_pos >= m_json.size()) {
+      fail("unterminated string");
+    }
+    switch (m_json[m_pos++]) {
+    case '"':
+      result += '"';
+      break;
+    case '\\':
+      result += '\\';
+      break;
+    case '/':
+      result += '/';
+      break;
+    case 'b':
+      result += '\b';
+      break;
+    case 'f':
+      result += '\f';
+      break;
+    case 'n':
+      result += '\n';
+      break;
+    case 'r':
+      result += '\r';
+      break;
+    case 't':
+      result += '\t';
+      break;
+    case 'u': {
+      uint32_t code_point = parse_hex4();
+      if (code_point >= 0xD800 && code_point < 0xDC00
+          && m_json.substr(m_pos, 2) == "\\u") {
+        m_pos += 2;
+        const uint32_t low = parse_hex4();
+        if (low < 0xDC00 || low >= 0xE000) {
+          fail("invalid surrogate pair");
+        }
+        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+      }
+      append_utf8(result, code_point);
+      break;
+    }
+    default:
+      fail("invalid escape");
+    }
+  }
+}
+
+std::vector<std::string>
+Parser::parse_string_array()
+{
+  std::vector<std::string> result;
+  expect('[');
+  if (consume(']')) {
+    return result;
+  }
+  do {
+    result.push_back(parse_string());
+  } while (consume(','));
+  expect(']');
+  return result;
+}
+
+void
+Parser::skip_value()
+{
+  skip_whitespace();
+  if (m_pos >= m_json.size()) {
+    fail("unexpected end");
+  }
+  const char c = m_json[m_pos];
+  if (c == '"') {
+    parse_string();
+  } else if (c == '[' || c == '{') {
+    ++m_pos;
+    const char end = c == '[' ? ']' : '}';
+    if (consume(end)) {
+      return;
+    }
+    do {
+      if (c == '{') {
+        parse_string();
+        expect(':');
+      }
+      skip_value();
+    } while (consume(','));
+    expect(end);
+  } else {
+    // Number, true, false or null.
+    const size_t start = m_pos;
+    while (m_pos < m_json.size()
+           && (isalnum(static_cast<unsigned char>(m_json[m_pos]))
+               || m_json[m_pos] == '-' || m_json[m_pos] == '+'
+               || m_json[m_pos] == '.')) {
+      ++m_pos;
+    }
+    if (m_pos == start) {
+      fail("unexpected character");
+    }
+  }
+}
+
+CompilationDatabase::Entry
+Parser::parse_entry()
+{
+  CompilationDatabase::Entry entry;
+  bool has_directory = false;
+  bool has_args = false;
+  std::string command;
+
+  expect('{');
+  if (!consume('}')) {
+    do {
+      const std::string key = parse_string();
+      expect(':');
+      if (key == "directory") {
+        entry.directory = parse_string();
+        has_directory = true;
+      } else if (key == "file") {
+        entry.file = parse_string();
+      } else if (key == "arguments") {
+        for (const auto& arg : parse_string_array()) {
+          entry.args.push_back(arg);
+        }
+        has_args = true;
+      } else if (key == "command") {
+        command = parse_string();
+      } else {
+        skip_value();
+      }
+    } while (consume(','));
+    expect('}');
+  }
+
+  if (!has_args && !command.empty()) {
+    entry.args = Args::from_atfile_string(command);
+    has_args = true;
+  }
+  if (!has_directory || !has_args || entry.args.size() == 0) {
+    fail("entry without directory or command");
+  }
+  return entry;
+}
+
+std::vector<CompilationDatabase::Entry>
+Parser::parse()
+{
+  std::vector<CompilationDatabase::Entry> entries;
+  expect('[');
+  if (!consume(']')) {
+    do {
+      entries.push_back(parse_entry());
+    } while (consume(','));
+    expect(']');
+  }
+  skip_whitespace();
+  if (m_pos != m_json.size()) {
+    fail("trailing data");
+  }
+  return entries;
+}
+
+} // namespace
+
+namespace CompilationDatabase {
+
+std::vector<Entry>
+parse(string_view json)
+{
+  return Parser(json).parse();
+}
+
+} // namespace CompilationDatabase
@@ -0,0 +1,52 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Args.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+// Reader of JSON compilation databases (compile_commands.json) as written by
+// e.g. CMake, Meson and Bear.
+namespace CompilationDatabase {
+
+struct Entry
+{
+  // Working directory of the compilation.
+  std::string directory;
+
+  // The main source file, possibly relative to `directory`.
+  std::string file;
+
+  // The compiler command line, from either the "arguments" array or the
+  // shell-quoted "command" string.
+  Args args;
+};
+
+// Parse the content of a compilation database. Unknown keys are ignored.
+// Throws Error if the content is not valid JSON or if an entry lacks the
+// directory or the command.
+std::vector<Entry> parse(nonstd::string_view json);
+
+} // namespace CompilationDatabase
@@ -0,0 +1,83 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CompileClaim.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+CompileClaim::CompileClaim(const std::string& path) : m_path(path)
+{
+#ifndef _WIN32
+  Util::create_dir(Util::dir_name(path));
+  m_fd = Fd(open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666));
+  if (!m_fd) {
+    LOG("Failed to open {}: {}", path, strerror(errno));
+    return;
+  }
+  m_acquired = flock(*m_fd, LOCK_EX | LOCK_NB) == 0;
+  LOG("{} compile claim {}",
+      m_acquired ? "Acquired" : "Another process holds",
+      path);
+#endif
+}
+
+CompileClaim::~CompileClaim()
+{
+  if (m_acquired) {
+    // Remove the file while still holding the lock, or another process could
+    // claim the file just before it's removed.
+    Util::unlink_tmp(m_path);
+    LOG("Released compile claim {}", m_path);
+  }
+}
+
+bool
+CompileClaim::wait(uint32_t timeout) const
+{
+#ifndef _WIN32
+  if (!m_fd || m_acquired) {
+    return false;
+  }
+
+  const auto deadline =
+    std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  uint32_t to_sleep = 1000; // Microseconds.
+  while (flock(*m_fd, LOCK_SH | LOCK_NB) != 0) {
+    if (errno != EWOULDBLOCK && errno != EINTR) {
+      LOG("Failed to lock {}: {}", m_path, strerror(errno));
+      return false;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      LOG("Timed out waiting for compile claim {}", m_path);
+      return false;
+    }
+    usleep(to_sleep);
+    to_sleep = std::min(2 * to_sleep, 50000u);
+  }
+  flock(*m_fd, LOCK_UN);
+  LOG("Compile claim {} was released", m_path);
+  return true;
+#else
+  (void)timeout;
+  return false;
+#endif
+}
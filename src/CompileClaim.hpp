@@ -0,0 +1,63 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Fd.hpp"
+#include "NonCopyable.hpp"
+
+#include <string>
+
+// A claim on compiling a result, so that identical compilations that miss the
+// cache at the same time wait for the first one instead of all running the
+// compiler.
+//
+// A claim is an exclusive flock on a file named after the result, which is
+// released when the claiming process exits, so a crashed compilation never
+// blocks others for longer than it ran. The claim file is removed when the
+// claim is released.
+class CompileClaim : NonCopyable
+{
+public:
+  // Try to claim `path`, creating its directory if needed.
+  explicit CompileClaim(const std::string& path);
+
+  // Release the claim if acquired.
+  ~CompileClaim();
+
+  // Return whether this process holds the claim.
+  bool acquired() const;
+
+  // Wait for another process to release its claim. Returns true if it was
+  // released within `timeout` milliseconds, false if it wasn't or if the claim
+  // file couldn't be opened.
+  bool wait(uint32_t timeout) const;
+
+private:
+  std::string m_path;
+  Fd m_fd;
+  bool m_acquired = false;
+};
+
+inline bool
+CompileClaim::acquired() const
+{
+  return m_acquired;
+}
@@ -0,0 +1,588 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CompileServer.hpp"
+
+#include "Args.hpp"
+#include "Config.hpp"
+#include "Hash.hpp"
+#include "HttpStorage.hpp"
+#include "Logging.hpp"
+#include "TcpConnection.hpp"
+#include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "execute.hpp"
+#include "fmtmacros.hpp"
+
+#include <memory>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+// Headers of a job are a request line and a few headers.
+const size_t k_max_header_size = 8192;
+
+// Preprocessed source code of a large translation unit can be tens of MB.
+const size_t k_max_job_size = 1024 * 1024 * 1024;
+
+// Time a client waits for the connection to a server.
+const std::chrono::seconds k_connect_timeout(1);
+
+// Time a client waits for a job to be sent, compiled and returned.
+const std::chrono::minutes k_job_timeout(10);
+
+// Time a client gets to send its job and to receive the outcome.
+const std::chrono::minutes k_transfer_timeout(1);
+
+// Options accepted in a job: the ones that select code generation, language
+// dialect, diagnostics and debug info. None of them takes a path, so a job
+// can't make the compiler read or write other files than its source and object
+// file.
+const char* const k_allowed_options[] = {
+  "-ansi",
+  "-c",
+  "-fasynchronous-unwind-tables",
+  "-fbuiltin",
+  "-fchar8_t",
+  "-fcolor-diagnostics",
+  "-fcommon",
+  "-fcoroutines",
+  "-fcxx-exceptions",
+  "-fdata-sections",
+  "-fexceptions",
+  "-ffast-math",
+  "-ffreestanding",
+  "-ffunction-sections",
+  "-fhosted",
+  "-flto",
+  "-fms-extensions",
+  "-fomit-frame-pointer",
+  "-fopenmp",
+  "-fpermissive",
+  "-fPIC",
+  "-fpic",
+  "-fPIE",
+  "-fpie",
+  "-frtti",
+  "-fshort-enums",
+  "-fshort-wchar",
+  "-fsigned-char",
+  "-fsized-deallocation",
+  "-fstack-clash-protection",
+  "-fstack-protector",
+  "-ftrapv",
+  "-funsigned-char",
+  "-funwind-tables",
+  "-fwrapv",
+  "-pedantic",
+  "-pedantic-errors",
+  "-pipe",
+  "-pthread",
+  "-w",
+};
+
+// Prefixes of further accepted options.
+const char* const k_allowed_option_prefixes[] = {
+  "-O",
+  "-W",
+  "-faligned-",
+  "-fcf-protection",
+  "-fconstexpr-",
+  "-fdiagnostics-",
+  "-ffp-",
+  "-finline-",
+  "-flto=",
+  "-fmerge-",
+  "-fmessage-length=",
+  "-fno-",
+  "-fopenmp-",
+  "-fsanitize=",
+  "-fstack-protector-",
+  "-fstrict-",
+  "-ftemplate-",
+  "-ftrivial-auto-var-init=",
+  "-fvisibility",
+  "-g",
+  "-m",
+  "-std=",
+};
+
+// Options that start like an accepted option but pass arguments on to other
+// programs.
+const char* const k_refused_prefixes[] = {"-Wa,", "-Wl,", "-Wp,", "-mllvm"};
+
+// Only these accepted options may have a value containing a path, since they
+// just map paths.
+const char* const k_path_map_options[] = {
+  "-fdebug-prefix-map=",
+  "-ffile-prefix-map=",
+  "-fmacro-prefix-map=",
+};
+
+std::string
+make_response(string_view status, const std::string& body = "")
+{
+  return FMT(
+    "HTTP/1.1 {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+    status,
+    body.size(),
+    body);
+}
+
+// Return the value of the Content-Length header among `headers`, 0 if there is
+// none or nullopt if it's malformed.
+optional<size_t>
+parse_content_length(string_view headers)
+{
+  for (const auto& line : Util::split_into_views(headers, "\r\n")) {
+    const auto colon = line.find(':');
+    if (colon == string_view::npos
+        || Util::to_lowercase(line.substr(0, colon)) != "content-length") {
+      continue;
+    }
+    try {
+      return Util::parse_unsigned(
+        Util::strip_whitespace(line.substr(colon + 1)),
+        0,
+        k_max_job_size,
+        "Content-Length");
+    } catch (const Error&) {
+      return nullopt;
+    }
+  }
+  return 0;
+}
+
+// A private working directory for a job, removed when going out of scope.
+class JobDir
+{
+public:
+  explicit JobDir(const std::string& temporary_dir);
+  ~JobDir();
+
+  const std::string& path() const;
+
+private:
+  std::string m_path;
+};
+
+JobDir::JobDir(const std::string& temporary_dir)
+{
+  Util::ensure_dir_exists(temporary_dir);
+  std::string path = FMT("{}/compile.XXXXXX", temporary_dir);
+  if (!mkdtemp(&path[0])) {
+    throw Error("failed to create directory {}: {}", path, strerror(errno));
+  }
+  // The compiler records the real path of its working directory.
+  m_path = Util::real_path(path);
+}
+
+JobDir::~JobDir()
+{
+  try {
+    Util::wipe_path(m_path);
+  } catch (const Error& e) {
+    LOG("Failed to remove {}: {}", m_path, e.what());
+  }
+}
+
+inline const std::string&
+JobDir::path() const
+{
+  return m_path;
+}
+
+bool
+is_allowed_option(const std::string& arg)
+{
+  for (const char* prefix : k_refused_prefixes) {
+    if (Util::starts_with(arg, prefix)) {
+      return false;
+    }
+  }
+  for (const char* option : k_path_map_options) {
+    if (Util::starts_with(arg, option)) {
+      return true;
+    }
+  }
+  if (arg.find('/') != std::string::npos) {
+    return false;
+  }
+  for (const char* option : k_allowed_options) {
+    if (arg == option) {
+      return true;
+    }
+  }
+  for (const char* prefix : k_allowed_option_prefixes) {
+    if (Util::starts_with(arg, prefix)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+const char CompileServer::k_default_port[] = "8384";
+const char CompileServer::k_default_host[] = "127.0.0.1";
+
+optional<std::string>
+CompileServer::find_refused_arg(const std::vector<std::string>& args)
+{
+  for (size_t i = 0; i < args.size(); ++i) {
+    const bool is_language = args[i] == "-x" && i + 1 < args.size()
+                             && !args[i + 1].empty() && args[i + 1][0] != '-'
+                             && args[i + 1].find('/') == std::string::npos;
+    if (is_language) {
+      ++i;
+    } else if (!is_allowed_option(args[i])) {
+      return args[i];
+    }
+  }
+  return nullopt;
+}
+
+std::string
+CompileServer::compiler_digest(const std::string& path)
+{
+  Hash hash;
+  if (!hash.hash_file(path)) {
+    return "";
+  }
+  return hash.digest().to_string();
+}
+
+optional<CompileServer::Outcome>
+CompileServer::compile(const std::string& host,
+                       const std::string& port,
+                       const Job& job)
+{
+  const auto start = TcpConnection::Clock::now();
+  auto connection =
+    TcpConnection::connect(host, port, start + k_connect_timeout);
+  if (!connection) {
+    return nullopt;
+  }
+
+  const bool is_ipv6 = host.find(':') != std::string::npos;
+  const std::string authority =
+    is_ipv6 ? FMT("[{}]:{}", host, port) : FMT("{}:{}", host, port);
+  const std::string body = encode_job(job);
+  const std::string header = FMT(
+    "POST /compile HTTP/1.1\r\n"
+    "Host: {}\r\n"
+    "Connection: close\r\n"
+    "Content-Length: {}\r\n"
+    "\r\n",
+    authority,
+    body.size());
+  const auto deadline = start + k_job_timeout;
+  if (!connection.send(header, deadline) || !connection.send(body, deadline)) {
+    LOG("Failed to send job to {}: {}", authority, strerror(errno));
+    return nullopt;
+  }
+
+  std::string data;
+  if (!connection.receive_all(data, deadline)) {
+    LOG("Failed to receive outcome from {}: {}", authority, strerror(errno));
+    return nullopt;
+  }
+  const auto response = HttpStorage::parse_response(data);
+  if (!response) {
+    LOG("Malformed response from {}", authority);
+    return nullopt;
+  }
+  if (response->status != 200) {
+    LOG("{} did not accept the job: {} {}",
+        authority,
+        response->status,
+        response->body);
+    return nullopt;
+  }
+  auto outcome = decode_outcome(response->body);
+  if (!outcome) {
+    LOG("Malformed outcome from {}", authority);
+  }
+  return outcome;
+}
+
+std::string
+CompileServer::encode_job(const Job& job)
+{
+  std::string data;
+  for (const auto& field :
+       {job.compiler, job.compiler_digest, job.extension, job.cwd}) {
+    data += field;
+    data += '\0';
+  }
+  for (const auto& arg : job.args) {
+    data += arg;
+    data += '\0';
+  }
+  data += '\0';
+  data += job.source;
+  return data;
+}
+
+optional<CompileServer::Job>
+CompileServer::decode_job(string_view data)
+{
+  // The four fixed fields, then the arguments terminated by an empty field.
+  std::vector<std::string> fields;
+  size_t pos = 0;
+  while (true) {
+    const auto end = data.find('\0', pos);
+    if (end == string_view::npos) {
+      return nullopt;
+    }
+    const auto field = data.substr(pos, end - pos);
+    pos = end + 1;
+    if (fields.size() >= 4 && field.empty()) {
+      break;
+    }
+    fields.emplace_back(field);
+  }
+
+  Job job;
+  job.compiler = fields[0];
+  job.compiler_digest = fields[1];
+  job.extension = fields[2];
+  job.cwd = fields[3];
+  job.args.assign(fields.begin() + 4, fields.end());
+  job.source = std::string(data.substr(pos));
+  return job;
+}
+
+std::string
+CompileServer::encode_outcome(const Outcome& outcome)
+{
+  return FMT("{} {} {}\n{}{}{}",
+             outcome.status,
+             outcome.stdout_data.size(),
+             outcome.stderr_data.size(),
+             outcome.stdout_data,
+             outcome.stderr_data,
+             outcome.object);
+}
+
+optional<CompileServer::Outcome>
+CompileServer::decode_outcome(string_view data)
+{
+  const auto newline = data.find('\n');
+  if (newline == string_view::npos) {
+    return nullopt;
+  }
+  const auto sizes = Util::split_into_strings(data.substr(0, newline), " ");
+  if (sizes.size() != 3) {
+    return nullopt;
+  }
+
+  Outcome outcome;
+  size_t stdout_size;
+  size_t stderr_size;
+  try {
+    outcome.status = Util::parse_signed(sizes[0], INT_MIN, INT_MAX, "status");
+    stdout_size = Util::parse_unsigned(sizes[1]);
+    stderr_size = Util::parse_unsigned(sizes[2]);
+  } catch (const Error&) {
+    return nullopt;
+  }
+  data = data.substr(newline + 1);
+  if (stdout_size > data.size() || stderr_size > data.size() - stdout_size) {
+    return nullopt;
+  }
+  outcome.stdout_data = std::string(data.substr(0, stdout_size));
+  outcome.stderr_data = std::string(data.substr(stdout_size, stderr_size));
+  outcome.object = std::string(data.substr(stdout_size + stderr_size));
+  return outcome;
+}
+
+CompileServer::CompileServer(const Config& config, size_t jobs)
+  : m_config(config),
+    m_jobs(jobs)
+{
+}
+
+bool
+CompileServer::listen(const std::string& host, const std::string& port)
+{
+  // Compiling lets clients read local files (see --serve-compiles in the
+  // manual), so other workstations are only served if a host is given.
+  m_fd = TcpConnection::listen(host.empty() ? k_default_host : host, port);
+  return static_cast<bool>(m_fd);
+}
+
+std::string
+CompileServer::port() const
+{
+  return TcpConnection::get_local_port(*m_fd);
+}
+
+void
+CompileServer::run()
+{
+  // Connections wait in the listen backlog while all jobs are running.
+  ThreadPool thread_pool(m_jobs, 1);
+  while (true) {
+    auto connection =
+      std::make_shared<TcpConnection>(TcpConnection::accept(*m_fd));
+    if (!*connection) {
+      LOG("Failed to accept connection: {}", strerror(errno));
+      continue;
+    }
+    thread_pool.enqueue([this, connection] { serve_connection(*connection); });
+  }
+}
+
+void
+CompileServer::serve_connection(TcpConnection& connection) const
+{
+  const auto deadline = TcpConnection::Clock::now() + k_transfer_timeout;
+  std::string request;
+  size_t header_end;
+  // The body may arrive together with the headers.
+  while ((header_end = request.find("\r\n\r\n")) == std::string::npos) {
+    if (request.size() > k_max_header_size) {
+      return;
+    }
+    const auto received = connection.receive(request, deadline);
+    if (!received || *received == 0) {
+      return;
+    }
+  }
+
+  const auto content_length =
+    parse_content_length(string_view(request).substr(0, header_end));
+  if (!content_length) {
+    return;
+  }
+  while (request.size() < header_end + 4 + *content_length) {
+    const auto received = connection.receive(request, deadline);
+    if (!received || *received == 0) {
+      return;
+    }
+  }
+
+  const auto response = respond(request);
+  if (!connection.send(response,
+                       TcpConnection::Clock::now() + k_transfer_timeout)) {
+    LOG("Failed to send response: {}", strerror(errno));
+  }
+}
+
+std::string
+CompileServer::respond(string_view request) const
+{
+  const auto header_end = request.find("\r\n\r\n");
+  if (header_end == string_view::npos) {
+    return make_response("400 Bad Request");
+  }
+  const auto headers = request.substr(0, header_end);
+  const auto request_line = headers.substr(0, headers.find("\r\n"));
+  const auto parts = Util::split_into_views(request_line, " ");
+  if (parts.size() != 3 || !Util::starts_with(parts[2], "HTTP/1.")) {
+    return make_response("400 Bad Request");
+  }
+  if (parts[1] != "/compile") {
+    return make_response("404 Not Found");
+  }
+  if (parts[0] != "POST") {
+    return make_response("405 Method Not Allowed");
+  }
+
+  const auto body = request.substr(header_end + 4);
+  const auto content_length = parse_content_length(headers);
+  const auto job = decode_job(body);
+  if (!content_length || *content_length != body.size() || !job
+      || job->compiler.empty() || job->compiler.find('/') != std::string::npos
+      || job->extension.empty()
+      || job->extension.find('/') != std::string::npos) {
+    return make_response("400 Bad Request");
+  }
+  const auto refused_arg = find_refused_arg(job->args);
+  if (refused_arg) {
+    return make_response("403 Forbidden",
+                         FMT("Refused argument {}", *refused_arg));
+  }
+
+  const std::string path =
+    m_config.path().empty() ? getenv("PATH") : m_config.path();
+  const auto compiler_path =
+    find_executable_in_path(job->compiler, "ccache", path);
+  if (compiler_path.empty()
+      || compiler_digest(compiler_path) != job->compiler_digest) {
+    return make_response("409 Conflict",
+                         FMT("Compiler {} not available", job->compiler));
+  }
+
+  try {
+    return make_response("200 OK",
+                         encode_outcome(run_job(*job, compiler_path)));
+  } catch (const ErrorBase& e) {
+    LOG("Failed to run job: {}", e.what());
+    return make_response("500 Internal Server Error");
+  }
+}
+
+CompileServer::Outcome
+CompileServer::run_job(const Job& job, const std::string& compiler_path) const
+{
+  // Files that the compiler derives from the output name end up in the job's
+  // own directory.
+  const JobDir dir(m_config.temporary_dir());
+  const auto source_path = FMT("{}/job.{}", dir.path(), job.extension);
+  const auto object_path = FMT("{}/job.o", dir.path());
+  TemporaryFile stdout_file(FMT("{}/stdout", dir.path()));
+  TemporaryFile stderr_file(FMT("{}/stderr", dir.path()));
+
+  Util::write_file(source_path, job.source);
+
+  Args args;
+  args.push_back(compiler_path);
+  for (const auto& arg : job.args) {
+    args.push_back(arg);
+  }
+  if (!job.cwd.empty()) {
+    // Last so that it wins over the client's maps.
+    args.push_back(FMT("-fdebug-prefix-map={}={}", dir.path(), job.cwd));
+  }
+  args.push_back("-o");
+  args.push_back(object_path);
+  args.push_back(source_path);
+
+  Outcome outcome;
+  pid_t pid = 0;
+  outcome.status = execute_in_dir(dir.path(),
+                                  args.to_argv().data(),
+                                  std::move(stdout_file.fd),
+                                  std::move(stderr_file.fd),
+                                  &pid);
+  outcome.stdout_data = Util::read_file(stdout_file.path);
+  outcome.stderr_data = Util::read_file(stderr_file.path);
+  if (outcome.status == 0) {
+    outcome.object = Util::read_file(object_path);
+  }
+
+  LOG("Compiled {} job with exit status {}", job.compiler, outcome.status);
+  return outcome;
+}
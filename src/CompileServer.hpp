@@ -0,0 +1,121 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Fd.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+class Config;
+class TcpConnection;
+
+// Compiles preprocessed source code for ccache on other workstations that list
+// this one in their `compile_servers` setting.
+//
+// A job is sent as "POST /compile" over plain HTTP/1.1 and each connection
+// serves a single job. The server only runs a compiler with the same file name
+// that it finds in its own PATH and whose digest matches the client's compiler,
+// so that the object file is the same as a local compilation would produce.
+class CompileServer
+{
+public:
+  static const char k_default_port[];
+
+  // Only the local host can connect unless another host is given.
+  static const char k_default_host[];
+
+  struct Job
+  {
+    // File name of the compiler, without directory.
+    std::string compiler;
+    // Digest of the compiler executable, see `compiler_digest`.
+    std::string compiler_digest;
+    // Extension of the source file, e.g. "i" or "ii".
+    std::string extension;
+    // Directory that debug info should refer to as the working directory, or
+    // empty if no debug info is generated.
+    std::string cwd;
+    // Compiler arguments without compiler, source file and output file.
+    std::vector<std::string> args;
+    std::string source;
+  };
+
+  struct Outcome
+  {
+    int status = 0;
+    std::string stdout_data;
+    std::string stderr_data;
+    std::string object;
+  };
+
+  // Return the first of `args` (compiler arguments of a job) that a server
+  // refuses, or nullopt if it accepts them all. Only options that select code
+  // generation, language dialect, diagnostics and debug info are accepted, so
+  // that a job can't make the compiler read or write other files than its own.
+  static nonstd::optional<std::string>
+  find_refused_arg(const std::vector<std::string>& args);
+
+  // Return the digest of the compiler executable at `path`, or the empty
+  // string if it can't be read.
+  static std::string compiler_digest(const std::string& path);
+
+  // Run `job` on the server at `host` and `port`. Returns nullopt (and logs the
+  // reason) if the server can't be reached or doesn't accept the job.
+  static nonstd::optional<Outcome>
+  compile(const std::string& host, const std::string& port, const Job& job);
+
+  // Serialize `job` and `outcome` for the request and response bodies.
+  // Arguments can't be empty or contain NUL characters.
+  static std::string encode_job(const Job& job);
+  static nonstd::optional<Job> decode_job(nonstd::string_view data);
+  static std::string encode_outcome(const Outcome& outcome);
+  static nonstd::optional<Outcome> decode_outcome(nonstd::string_view data);
+
+  // Run at most `jobs` compilations at a time.
+  CompileServer(const Config& config, size_t jobs);
+
+  // Start listening on `host` and `port`. An empty host means
+  // k_default_host and port "0" means any free port. Returns false on failure.
+  bool listen(const std::string& host, const std::string& port);
+
+  // Return the port that `listen` bound.
+  std::string port() const;
+
+  // Serve connections until the process is terminated.
+  void run();
+
+  // Return the complete HTTP response to `request` (request line, headers and
+  // body).
+  std::string respond(nonstd::string_view request) const;
+
+private:
+  const Config& m_config;
+  const size_t m_jobs;
+  Fd m_fd;
+
+  Outcome run_job(const Job& job, const std::string& compiler_path) const;
+
+  void serve_connection(TcpConnection& connection) const;
+};
@@ -0,0 +1,87 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CompilerSlot.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+CompilerSlot::CompilerSlot(const std::string& dir,
+                           uint32_t count,
+                           uint32_t timeout)
+{
+#ifndef _WIN32
+  if (count == 0) {
+    return;
+  }
+  Util::create_dir(dir);
+
+  std::vector<Fd> fds;
+  for (uint32_t i = 0; i < count; ++i) {
+    const auto path = FMT("{}/{}", dir, i);
+    Fd fd(open(path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0666));
+    if (!fd) {
+      LOG("Failed to open {}: {}", path, strerror(errno));
+      return;
+    }
+    fds.push_back(std::move(fd));
+  }
+
+  // Start probing at a process specific slot so that concurrent processes
+  // don't all contend for the first one.
+  const uint32_t first = static_cast<uint32_t>(getpid()) % count;
+  const auto start = std::chrono::steady_clock::now();
+  const auto deadline = start + std::chrono::milliseconds(timeout);
+  uint32_t to_sleep = 1000; // Microseconds.
+  while (true) {
+    for (uint32_t i = 0; i < count; ++i) {
+      const uint32_t slot = (first + i) % count;
+      if (flock(*fds[slot], LOCK_EX | LOCK_NB) == 0) {
+        m_fd = std::move(fds[slot]);
+        const auto waited =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+        LOG("Acquired compiler slot {}/{} after {} ms",
+            dir,
+            slot,
+            waited.count());
+        return;
+      }
+      if (errno != EWOULDBLOCK && errno != EINTR) {
+        LOG("Failed to lock {}/{}: {}", dir, slot, strerror(errno));
+        return;
+      }
+    }
+    if (timeout > 0 && std::chrono::steady_clock::now() >= deadline) {
+      LOG("Timed out waiting for a compiler slot in {}", dir);
+      return;
+    }
+    usleep(to_sleep);
+    to_sleep = std::min(2 * to_sleep, 50000u);
+  }
+#else
+  (void)dir;
+  (void)count;
+  (void)timeout;
+#endif
+}
@@ -0,0 +1,53 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+#include "Fd.hpp"
+#include "NonCopyable.hpp"
+
+#include <string>
+
+// One of a fixed number of slots for running the real compiler, so that a
+// burst of cache misses doesn't run more memory-hungry compilers at once than
+// the host can handle while cache hits proceed without waiting.
+//
+// Slot i is an exclusive flock on the file `<dir>/<i>`, which is released when
+// the holding process exits, so a crashed compilation never holds on to its
+// slot.
+class CompilerSlot : NonCopyable
+{
+public:
+  // Wait for one of `count` slots in `dir`, creating the directory if needed.
+  // Does nothing if `count` is 0. If `timeout` is nonzero, give up after that
+  // many milliseconds.
+  CompilerSlot(const std::string& dir, uint32_t count, uint32_t timeout = 0);
+
+  // Return whether this process holds a slot.
+  bool acquired() const;
+
+private:
+  Fd m_fd;
+};
+
+inline bool
+CompilerSlot::acquired() const
+{
+  return bool(m_fd);
+}
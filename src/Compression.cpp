@@ -20,9 +20,36 @@
 
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Logging.hpp"
+#include "ZstdCompressor.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+const uint64_t k_small_entry_size = 64 * 1024;
+const uint64_t k_huge_entry_size = 64 * 1024 * 1024;
+const int8_t k_small_entry_min_level = 6;
+const int8_t k_fast_max_level = -1;
+
+// Whether the 1-minute load average exceeds the number of CPUs.
+bool
+system_is_busy()
+{
+#ifndef _WIN32
+  double load;
+  const unsigned cpus = std::thread::hardware_concurrency();
+  return cpus > 0 && getloadavg(&load, 1) == 1 && load > cpus;
+#else
+  return false;
+#endif
+}
+
+} // namespace
+
 namespace Compression {
 
 int8_t
@@ -31,10 +58,49 @@ level_from_config(const Config& config)
   return config.compression() ? config.compression_level() : 0;
 }
 
+int8_t
+level_for_entry(const Config& config, uint64_t payload_size)
+{
+  const int8_t level = level_from_config(config);
+  if (!config.compression() || !config.adaptive_compression()) {
+    return level;
+  }
+  const int8_t adapted = adapt_level(level, payload_size, system_is_busy());
+  if (adapted != level) {
+    LOG("Using compression level {} for {} bytes", adapted, payload_size);
+  }
+  return adapted;
+}
+
+int8_t
+adapt_level(int8_t level, uint64_t payload_size, bool system_is_busy)
+{
+  if (level == 0) {
+    level = ZstdCompressor::default_compression_level;
+  }
+  if (system_is_busy || payload_size >= k_huge_entry_size) {
+    return std::min(level, k_fast_max_level);
+  } else if (payload_size < k_small_entry_size) {
+    return std::max(level, k_small_entry_min_level);
+  } else {
+    return level;
+  }
+}
+
 Type
 type_from_config(const Config& config)
 {
-  return config.compression() ? Type::zstd : Type::none;
+  if (!config.compression()) {
+    return Type::none;
+  }
+  if (config.compression_type() == "lz4") {
+#ifdef HAVE_LZ4
+    return Type::lz4;
+#else
+    LOG_RAW("LZ4 support not compiled in, using zstd");
+#endif
+  }
+  return Type::zstd;
 }
 
 Type
@@ -46,6 +112,12 @@ type_from_int(uint8_t type)
 
   case static_cast<uint8_t>(Type::zstd):
     return Type::zstd;
+
+  case static_cast<uint8_t>(Type::zstd_with_dictionary):
+    return Type::zstd_with_dictionary;
+
+  case static_cast<uint8_t>(Type::lz4):
+    return Type::lz4;
   }
 
   throw Error("Unknown type: {}", type);
@@ -60,6 +132,12 @@ type_to_string(Type type)
 
   case Type::zstd:
     return "zstd";
+
+  case Type::zstd_with_dictionary:
+    return "zstd with dictionary";
+
+  case Type::lz4:
+    return "lz4";
   }
 
   ASSERT(false);
@@ -29,10 +29,22 @@ namespace Compression {
 enum class Type : uint8_t {
   none = 0,
   zstd = 1,
+  // Zstandard with a dictionary whose ID follows the cache entry header.
+  zstd_with_dictionary = 2,
+  lz4 = 3,
 };
 
 int8_t level_from_config(const Config& config);
 
+// Return the compression level to use for a cache entry with `payload_size`
+// bytes, taking adaptive_compression into account.
+int8_t level_for_entry(const Config& config, uint64_t payload_size);
+
+// Return `level` (0 meaning the default level) adjusted for a cache entry with
+// `payload_size` bytes as done when adaptive_compression is enabled.
+int8_t
+adapt_level(int8_t level, uint64_t payload_size, bool system_is_busy = false);
+
 Type type_from_config(const Config& config);
 
 Type type_from_int(uint8_t type);
@@ -21,20 +21,48 @@
 #include "NullCompressor.hpp"
 #include "StdMakeUnique.hpp"
 #include "ZstdCompressor.hpp"
+#include "ZstdDictionary.hpp"
 #include "assertions.hpp"
+#include "exceptions.hpp"
+
+#ifdef HAVE_LZ4
+#  include "Lz4Compressor.hpp"
+#endif
 
 std::unique_ptr<Compressor>
 Compressor::create_from_type(Compression::Type type,
                              FILE* stream,
-                             int8_t compression_level)
+                             int8_t compression_level,
+                             uint32_t dictionary_id,
+                             uint32_t threads)
 {
   switch (type) {
   case Compression::Type::none:
     return std::make_unique<NullCompressor>(stream);
 
   case Compression::Type::zstd:
-    return std::make_unique<ZstdCompressor>(stream, compression_level);
+    return std::make_unique<ZstdCompressor>(
+      stream, compression_level, nonstd::string_view(), threads);
+
+  case Compression::Type::zstd_with_dictionary: {
+    const auto dictionary = ZstdDictionary::load(dictionary_id);
+    return std::make_unique<ZstdCompressor>(
+      stream, compression_level, *dictionary, threads);
+  }
+
+  case Compression::Type::lz4:
+#ifdef HAVE_LZ4
+    return std::make_unique<Lz4Compressor>(stream, compression_level);
+#else
+    throw Error("LZ4 support not compiled in");
+#endif
   }
 
   ASSERT(false);
 }
+
+bool
+Compressor::write_frame(nonstd::string_view /*frame*/)
+{
+  return false;
+}
@@ -22,6 +22,8 @@
 
 #include "Compression.hpp"
 
+#include "third_party/nonstd/string_view.hpp"
+
 #include <memory>
 
 class Compressor
@@ -35,9 +37,15 @@ public:
   // - type: The type.
   // - stream: The stream to write to.
   // - compression_level: Desired compression level.
-  static std::unique_ptr<Compressor> create_from_type(Compression::Type type,
-                                                      FILE* stream,
-                                                      int8_t compression_level);
+  // - dictionary_id: ID of the dictionary to use for
+  //   Compression::Type::zstd_with_dictionary.
+  // - threads: Number of worker threads the compressor may use, 0 for none.
+  static std::unique_ptr<Compressor>
+  create_from_type(Compression::Type type,
+                   FILE* stream,
+                   int8_t compression_level,
+                   uint32_t dictionary_id = 0,
+                   uint32_t threads = 0);
 
   // Get the actual compression level used for the compressed stream.
   virtual int8_t actual_compression_level() const = 0;
@@ -59,6 +67,15 @@ public:
   // Throws Error on failure.
   template<typename T> void write(T value);
 
+  // Write an already compressed, self-contained frame of the compression type
+  // to the compressed stream, ending any frame being written first.
+  //
+  // Returns false without writing anything if the compression type can't
+  // embed frames.
+  //
+  // Throws Error on failure.
+  virtual bool write_frame(nonstd::string_view frame);
+
   // Finalize compression.
   //
   // This method checks that the end state of the compressed stream is correct
@@ -20,6 +20,9 @@
 
 #include "AtomicFile.hpp"
 #include "Compression.hpp"
+#include "DigestMemo.hpp"
+#include "Hash.hpp"
+#include "Stat.hpp"
 #include "Util.hpp"
 #include "assertions.hpp"
 #include "ccache.hpp"
@@ -33,6 +36,7 @@
 #include <fstream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -43,123 +47,336 @@ namespace {
 
 enum class ConfigItem {
   absolute_paths_in_stderr,
+  adaptive_compression,
+  admission_threshold,
+  auto_prefix_map,
+  background_cleanup,
   base_dir,
+  cache_compiler_queries,
   cache_dir,
+  cache_failures,
+  cache_links,
+  cache_preprocessing,
+  cleanup_policy,
+  cleanup_sample_size,
+  coalesce_timeout,
+  compile_servers,
   compiler,
   compiler_check,
   compiler_type,
   compression,
   compression_level,
+  compression_threads,
+  compression_type,
+  config_snapshot,
   cpp_extension,
   debug,
+  deduplication,
+  defer_mtime_updates,
   depend_mode,
+  digest_map,
   direct_mode,
   disable,
+  event_log,
+  explain_misses,
   extra_files_to_hash,
   file_clone,
+  framed_results,
+  git_index,
   hard_link,
+  hash_algorithm,
   hash_dir,
   ignore_headers_in_manifest,
   ignore_options,
+  ignore_warning_options,
+  include_file_jobs,
   inode_cache,
+  inode_cache_entries,
+  inode_cache_dir,
+  inode_cache_immutable_dirs,
   keep_comments_cpp,
+  keep_identical_outputs,
   limit_multiple,
+  log_buffer_size,
   log_file,
+  lookup_timeout,
+  lower_cache_copy_up,
+  lower_cache_dirs,
+  maintenance_jobs,
+  max_compiler_jobs,
+  max_delta_chain,
+  max_failure_age,
   max_files,
+  max_link_size,
+  max_manifest_entries,
+  max_manifest_entry_age,
   max_size,
+  memoize_compiler_check,
+  memoize_path_lookup,
+  namespace_,
+  namespace_max_size,
+  pack_max_file_size,
   path,
   pch_external_checksum,
+  peer_timeout,
+  peers,
+  phase_durations,
   prefix_command,
   prefix_command_cpp,
+  presence_filter,
+  raw_file_min_size,
   read_only,
   read_only_direct,
   recache,
+  recompress_low_priority,
+  recompress_rate_limit,
+  regenerate_depfiles,
   run_second_cpp,
+  secondary_storage,
+  secondary_storage_miss_ttl,
+  secondary_storage_timeout,
+  session,
+  shared_stats,
   sloppiness,
+  speculative_compile_delay,
+  speculative_cpp,
+  split_arch,
+  split_source_jobs,
+  split_sources,
   stats,
+  stats_breakdown,
+  stream_compression,
+  stripe_dirs,
+  system_include_roots,
   temporary_dir,
+  trace_file,
+  trace_sample_rate,
+  trust_scrubbed_entries,
   umask,
+  write_behind,
 };
 
 const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"absolute_paths_in_stderr", ConfigItem::absolute_paths_in_stderr},
+  {"adaptive_compression", ConfigItem::adaptive_compression},
+  {"admission_threshold", ConfigItem::admission_threshold},
+  {"auto_prefix_map", ConfigItem::auto_prefix_map},
+  {"background_cleanup", ConfigItem::background_cleanup},
   {"base_dir", ConfigItem::base_dir},
+  {"cache_compiler_queries", ConfigItem::cache_compiler_queries},
   {"cache_dir", ConfigItem::cache_dir},
+  {"cache_failures", ConfigItem::cache_failures},
+  {"cache_links", ConfigItem::cache_links},
+  {"cache_preprocessing", ConfigItem::cache_preprocessing},
+  {"cleanup_policy", ConfigItem::cleanup_policy},
+  {"cleanup_sample_size", ConfigItem::cleanup_sample_size},
+  {"coalesce_timeout", ConfigItem::coalesce_timeout},
+  {"compile_servers", ConfigItem::compile_servers},
   {"compiler", ConfigItem::compiler},
   {"compiler_check", ConfigItem::compiler_check},
   {"compiler_type", ConfigItem::compiler_type},
   {"compression", ConfigItem::compression},
   {"compression_level", ConfigItem::compression_level},
+  {"compression_threads", ConfigItem::compression_threads},
+  {"compression_type", ConfigItem::compression_type},
+  {"config_snapshot", ConfigItem::config_snapshot},
   {"cpp_extension", ConfigItem::cpp_extension},
   {"debug", ConfigItem::debug},
+  {"deduplication", ConfigItem::deduplication},
+  {"defer_mtime_updates", ConfigItem::defer_mtime_updates},
   {"depend_mode", ConfigItem::depend_mode},
+  {"digest_map", ConfigItem::digest_map},
   {"direct_mode", ConfigItem::direct_mode},
   {"disable", ConfigItem::disable},
+  {"event_log", ConfigItem::event_log},
+  {"explain_misses", ConfigItem::explain_misses},
   {"extra_files_to_hash", ConfigItem::extra_files_to_hash},
   {"file_clone", ConfigItem::file_clone},
+  {"framed_results", ConfigItem::framed_results},
+  {"git_index", ConfigItem::git_index},
   {"hard_link", ConfigItem::hard_link},
+  {"hash_algorithm", ConfigItem::hash_algorithm},
   {"hash_dir", ConfigItem::hash_dir},
   {"ignore_headers_in_manifest", ConfigItem::ignore_headers_in_manifest},
   {"ignore_options", ConfigItem::ignore_options},
+  {"ignore_warning_options", ConfigItem::ignore_warning_options},
+  {"include_file_jobs", ConfigItem::include_file_jobs},
   {"inode_cache", ConfigItem::inode_cache},
+  {"inode_cache_dir", ConfigItem::inode_cache_dir},
+  {"inode_cache_entries", ConfigItem::inode_cache_entries},
+  {"inode_cache_immutable_dirs", ConfigItem::inode_cache_immutable_dirs},
   {"keep_comments_cpp", ConfigItem::keep_comments_cpp},
+  {"keep_identical_outputs", ConfigItem::keep_identical_outputs},
   {"limit_multiple", ConfigItem::limit_multiple},
+  {"log_buffer_size", ConfigItem::log_buffer_size},
   {"log_file", ConfigItem::log_file},
+  {"lookup_timeout", ConfigItem::lookup_timeout},
+  {"lower_cache_copy_up", ConfigItem::lower_cache_copy_up},
+  {"lower_cache_dirs", ConfigItem::lower_cache_dirs},
+  {"maintenance_jobs", ConfigItem::maintenance_jobs},
+  {"max_compiler_jobs", ConfigItem::max_compiler_jobs},
+  {"max_delta_chain", ConfigItem::max_delta_chain},
+  {"max_failure_age", ConfigItem::max_failure_age},
   {"max_files", ConfigItem::max_files},
+  {"max_link_size", ConfigItem::max_link_size},
+  {"max_manifest_entries", ConfigItem::max_manifest_entries},
+  {"max_manifest_entry_age", ConfigItem::max_manifest_entry_age},
   {"max_size", ConfigItem::max_size},
+  {"memoize_compiler_check", ConfigItem::memoize_compiler_check},
+  {"memoize_path_lookup", ConfigItem::memoize_path_lookup},
+  {"namespace", ConfigItem::namespace_},
+  {"namespace_max_size", ConfigItem::namespace_max_size},
+  {"pack_max_file_size", ConfigItem::pack_max_file_size},
   {"path", ConfigItem::path},
   {"pch_external_checksum", ConfigItem::pch_external_checksum},
+  {"peer_timeout", ConfigItem::peer_timeout},
+  {"peers", ConfigItem::peers},
+  {"phase_durations", ConfigItem::phase_durations},
   {"prefix_command", ConfigItem::prefix_command},
   {"prefix_command_cpp", ConfigItem::prefix_command_cpp},
+  {"presence_filter", ConfigItem::presence_filter},
+  {"raw_file_min_size", ConfigItem::raw_file_min_size},
   {"read_only", ConfigItem::read_only},
   {"read_only_direct", ConfigItem::read_only_direct},
   {"recache", ConfigItem::recache},
+  {"recompress_low_priority", ConfigItem::recompress_low_priority},
+  {"recompress_rate_limit", ConfigItem::recompress_rate_limit},
+  {"regenerate_depfiles", ConfigItem::regenerate_depfiles},
   {"run_second_cpp", ConfigItem::run_second_cpp},
+  {"secondary_storage", ConfigItem::secondary_storage},
+  {"secondary_storage_miss_ttl", ConfigItem::secondary_storage_miss_ttl},
+  {"secondary_storage_timeout", ConfigItem::secondary_storage_timeout},
+  {"session", ConfigItem::session},
+  {"shared_stats", ConfigItem::shared_stats},
   {"sloppiness", ConfigItem::sloppiness},
+  {"speculative_compile_delay", ConfigItem::speculative_compile_delay},
+  {"speculative_cpp", ConfigItem::speculative_cpp},
+  {"split_arch", ConfigItem::split_arch},
+  {"split_source_jobs", ConfigItem::split_source_jobs},
+  {"split_sources", ConfigItem::split_sources},
   {"stats", ConfigItem::stats},
+  {"stats_breakdown", ConfigItem::stats_breakdown},
+  {"stream_compression", ConfigItem::stream_compression},
+  {"stripe_dirs", ConfigItem::stripe_dirs},
+  {"system_include_roots", ConfigItem::system_include_roots},
   {"temporary_dir", ConfigItem::temporary_dir},
+  {"trace_file", ConfigItem::trace_file},
+  {"trace_sample_rate", ConfigItem::trace_sample_rate},
+  {"trust_scrubbed_entries", ConfigItem::trust_scrubbed_entries},
   {"umask", ConfigItem::umask},
+  {"write_behind", ConfigItem::write_behind},
 };
 
 const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"ABSSTDERR", "absolute_paths_in_stderr"},
+  {"ADAPTIVECOMPRESSION", "adaptive_compression"},
+  {"ADMISSIONTHRESHOLD", "admission_threshold"},
+  {"AUTOPREFIXMAP", "auto_prefix_map"},
+  {"BACKGROUNDCLEANUP", "background_cleanup"},
   {"BASEDIR", "base_dir"},
+  {"CACHECOMPILERQUERIES", "cache_compiler_queries"},
+  {"CACHEFAILURES", "cache_failures"},
+  {"CACHELINKS", "cache_links"},
+  {"CACHEPREPROCESSING", "cache_preprocessing"},
   {"CC", "compiler"}, // Alias for CCACHE_COMPILER
+  {"CLEANUPPOLICY", "cleanup_policy"},
+  {"CLEANUPSAMPLESIZE", "cleanup_sample_size"},
+  {"COALESCETIMEOUT", "coalesce_timeout"},
   {"COMMENTS", "keep_comments_cpp"},
   {"COMPILER", "compiler"},
+  {"COMPILESERVERS", "compile_servers"},
   {"COMPILERCHECK", "compiler_check"},
   {"COMPILERTYPE", "compiler_type"},
   {"COMPRESS", "compression"},
   {"COMPRESSLEVEL", "compression_level"},
+  {"COMPRESSTHREADS", "compression_threads"},
+  {"COMPRESSTYPE", "compression_type"},
+  {"CONFIGSNAPSHOT", "config_snapshot"},
   {"CPP2", "run_second_cpp"},
   {"DEBUG", "debug"},
+  {"DEDUPLICATION", "deduplication"},
+  {"DEFERMTIMEUPDATES", "defer_mtime_updates"},
   {"DEPEND", "depend_mode"},
+  {"DIGESTMAP", "digest_map"},
   {"DIR", "cache_dir"},
   {"DIRECT", "direct_mode"},
   {"DISABLE", "disable"},
   {"EXTENSION", "cpp_extension"},
+  {"EVENTLOG", "event_log"},
+  {"EXPLAINMISSES", "explain_misses"},
   {"EXTRAFILES", "extra_files_to_hash"},
   {"FILECLONE", "file_clone"},
+  {"FRAMEDRESULTS", "framed_results"},
+  {"GITINDEX", "git_index"},
   {"HARDLINK", "hard_link"},
+  {"HASHALGORITHM", "hash_algorithm"},
   {"HASHDIR", "hash_dir"},
   {"IGNOREHEADERS", "ignore_headers_in_manifest"},
   {"IGNOREOPTIONS", "ignore_options"},
+  {"IGNOREWARNINGOPTIONS", "ignore_warning_options"},
+  {"INCLUDEFILEJOBS", "include_file_jobs"},
   {"INODECACHE", "inode_cache"},
+  {"INODECACHEDIR", "inode_cache_dir"},
+  {"INODECACHEENTRIES", "inode_cache_entries"},
+  {"INODECACHEIMMUTABLEDIRS", "inode_cache_immutable_dirs"},
+  {"KEEPIDENTICALOUTPUTS", "keep_identical_outputs"},
   {"LIMIT_MULTIPLE", "limit_multiple"},
+  {"LOGBUFFERSIZE", "log_buffer_size"},
   {"LOGFILE", "log_file"},
+  {"LOOKUPTIMEOUT", "lookup_timeout"},
+  {"LOWERCACHECOPYUP", "lower_cache_copy_up"},
+  {"LOWERCACHEDIRS", "lower_cache_dirs"},
+  {"MAINTENANCEJOBS", "maintenance_jobs"},
+  {"MAXCOMPILERJOBS", "max_compiler_jobs"},
+  {"MAXDELTACHAIN", "max_delta_chain"},
+  {"MAXFAILUREAGE", "max_failure_age"},
   {"MAXFILES", "max_files"},
+  {"MAXLINKSIZE", "max_link_size"},
+  {"MAXMANIFESTENTRIES", "max_manifest_entries"},
+  {"MAXMANIFESTENTRYAGE", "max_manifest_entry_age"},
   {"MAXSIZE", "max_size"},
+  {"MEMOIZE_COMPILERCHECK", "memoize_compiler_check"},
+  {"MEMOIZE_PATHLOOKUP", "memoize_path_lookup"},
+  {"NAMESPACE", "namespace"},
+  {"NAMESPACEMAXSIZE", "namespace_max_size"},
+  {"PACKMAXFILESIZE", "pack_max_file_size"},
   {"PATH", "path"},
   {"PCH_EXTSUM", "pch_external_checksum"},
+  {"PEERS", "peers"},
+  {"PEER_TIMEOUT", "peer_timeout"},
+  {"PHASEDURATIONS", "phase_durations"},
   {"PREFIX", "prefix_command"},
   {"PREFIX_CPP", "prefix_command_cpp"},
+  {"PRESENCEFILTER", "presence_filter"},
+  {"RAWFILEMINSIZE", "raw_file_min_size"},
   {"READONLY", "read_only"},
   {"READONLY_DIRECT", "read_only_direct"},
   {"RECACHE", "recache"},
+  {"RECOMPRESSLOWPRIORITY", "recompress_low_priority"},
+  {"RECOMPRESSRATELIMIT", "recompress_rate_limit"},
+  {"REGENERATEDEPFILES", "regenerate_depfiles"},
+  {"SECONDARY_STORAGE", "secondary_storage"},
+  {"SECONDARY_STORAGE_MISS_TTL", "secondary_storage_miss_ttl"},
+  {"SECONDARY_STORAGE_TIMEOUT", "secondary_storage_timeout"},
+  {"SESSION", "session"},
+  {"SHAREDSTATS", "shared_stats"},
   {"SLOPPINESS", "sloppiness"},
+  {"SPECULATIVECOMPILEDELAY", "speculative_compile_delay"},
+  {"SPECULATIVECPP", "speculative_cpp"},
+  {"SPLITARCH", "split_arch"},
+  {"SPLITSOURCEJOBS", "split_source_jobs"},
+  {"SPLITSOURCES", "split_sources"},
   {"STATS", "stats"},
+  {"STATSBREAKDOWN", "stats_breakdown"},
+  {"STREAMCOMPRESSION", "stream_compression"},
+  {"STRIPEDIRS", "stripe_dirs"},
+  {"SYSTEMINCLUDEROOTS", "system_include_roots"},
   {"TEMPDIR", "temporary_dir"},
+  {"TRACEFILE", "trace_file"},
+  {"TRACESAMPLERATE", "trace_sample_rate"},
+  {"TRUSTSCRUBBED", "trust_scrubbed_entries"},
   {"UMASK", "umask"},
+  {"WRITEBEHIND", "write_behind"},
 };
 
 bool
@@ -230,6 +447,8 @@ parse_compiler_type(const std::string& value)
     return CompilerType::clang;
   } else if (value == "gcc") {
     return CompilerType::gcc;
+  } else if (value == "msvc") {
+    return CompilerType::msvc;
   } else if (value == "nvcc") {
     return CompilerType::nvcc;
   } else if (value == "other") {
@@ -264,6 +483,8 @@ parse_sloppiness(const std::string& value)
       result |= SLOPPY_SYSTEM_HEADERS;
     } else if (token == "pch_defines") {
       result |= SLOPPY_PCH_DEFINES;
+    } else if (token == "pch_input_mtime") {
+      result |= SLOPPY_PCH_INPUT_MTIME;
     } else if (token == "time_macros") {
       result |= SLOPPY_TIME_MACROS;
     } else if (token == "clang_index_store") {
@@ -312,6 +533,9 @@ format_sloppiness(uint32_t sloppiness)
   if (sloppiness & SLOPPY_MODULES) {
     result += "modules, ";
   }
+  if (sloppiness & SLOPPY_PCH_INPUT_MTIME) {
+    result += "pch_input_mtime, ";
+  }
   if (!result.empty()) {
     // Strip last ", ".
     result.resize(result.size() - 2);
@@ -410,6 +634,126 @@ parse_config_file(const std::string& path,
   return true;
 }
 
+// Version of the config snapshot format. Increment when changing the format.
+const uint8_t k_config_snapshot_version = 1;
+
+using ConfigItems = std::vector<std::pair<std::string, std::string>>;
+
+// Compute a digest identifying the current content of the config file `path`,
+// or return nullopt if the identity can't be trusted.
+optional<Digest>
+config_file_identity(const std::string& path, const Stat& stat)
+{
+  // Read before hash_algorithm is known.
+  Hash hash(Hash::Algorithm::blake3);
+  // Items are stored by name, whose meaning may change between versions.
+  hash.hash(CCACHE_VERSION);
+  hash.hash(k_config_snapshot_version);
+  if (!DigestMemo::hash_file_identity(hash, path, stat)) {
+    return nullopt;
+  }
+  return hash.digest();
+}
+
+// Config snapshot format:
+//
+// <snapshot>  ::= <identity> <item>*
+// <identity>  ::= 20 bytes ; digest of the config file identity
+// <item>      ::= <key_len> <key> <value_len> <value>
+// <key_len>   ::= uint32_t
+// <key>       ::= key_len bytes
+// <value_len> ::= uint32_t
+// <value>     ::= value_len bytes
+//
+// All multi-byte integers are big-endian.
+
+optional<ConfigItems>
+read_config_snapshot(const std::string& path, const Digest& identity)
+{
+  std::string data;
+  try {
+    data = Util::read_file(path);
+  } catch (const Error&) {
+    return nullopt;
+  }
+  if (data.size() < Digest::size()
+      || memcmp(data.data(), identity.bytes(), Digest::size()) != 0) {
+    return nullopt;
+  }
+
+  const auto* p = reinterpret_cast<const uint8_t*>(data.data());
+  size_t pos = Digest::size();
+  const auto read_string = [&](std::string& result) {
+    uint32_t length;
+    if (data.size() - pos < sizeof(length)) {
+      return false;
+    }
+    Util::big_endian_to_int(p + pos, length);
+    pos += sizeof(length);
+    if (data.size() - pos < length) {
+      return false;
+    }
+    result.assign(data, pos, length);
+    pos += length;
+    return true;
+  };
+
+  ConfigItems items;
+  while (pos < data.size()) {
+    std::string key;
+    std::string value;
+    if (!read_string(key) || !read_string(value)) {
+      return nullopt;
+    }
+    items.emplace_back(std::move(key), std::move(value));
+  }
+  return items;
+}
+
+void
+write_config_snapshot(const std::string& path,
+                      const Digest& identity,
+                      const ConfigItems& items)
+{
+  std::vector<uint8_t> data(identity.bytes(),
+                            identity.bytes() + Digest::size());
+  const auto write_string = [&](const std::string& string) {
+    uint8_t length[4];
+    Util::int_to_big_endian(static_cast<uint32_t>(string.length()), length);
+    data.insert(data.end(), length, length + sizeof(length));
+    data.insert(data.end(), string.begin(), string.end());
+  };
+  for (const auto& item : items) {
+    write_string(item.first);
+    write_string(item.second);
+  }
+
+  try {
+    AtomicFile file(path, AtomicFile::Mode::binary);
+    file.write(data);
+    file.commit();
+  } catch (const Error&) {
+    // Not fatal; the config file will be parsed again next time.
+  }
+}
+
+// Size the compiler job limit by the number of cores, but leave each job about
+// 2 GiB of physical memory.
+uint32_t
+default_max_compiler_jobs()
+{
+  uint64_t jobs = std::max(std::thread::hardware_concurrency(), 1u);
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+  const long pages = sysconf(_SC_PHYS_PAGES);
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && page_size > 0) {
+    const uint64_t memory = static_cast<uint64_t>(pages) * page_size;
+    jobs = std::min<uint64_t>(jobs, std::max<uint64_t>(memory >> 31, 1));
+  }
+#endif
+  return static_cast<uint32_t>(jobs);
+}
+
 } // namespace
 
 std::string
@@ -425,6 +769,7 @@ compiler_type_to_string(CompilerType compiler_type)
 
     CASE(clang);
     CASE(gcc);
+    CASE(msvc);
     CASE(nvcc);
     CASE(other);
     CASE(pump);
@@ -471,6 +816,45 @@ Config::update_from_file(const std::string& path)
                            });
 }
 
+bool
+Config::update_from_file_via_snapshot(const std::string& path,
+                                      const std::string& snapshot_path)
+{
+  const auto stat = Stat::stat(path);
+  if (!stat) {
+    return false;
+  }
+
+  const auto identity = config_file_identity(path, stat);
+  if (identity) {
+    const auto items = read_config_snapshot(snapshot_path, *identity);
+    if (items) {
+      for (const auto& item : *items) {
+        set_item(item.first, item.second, nullopt, false, path);
+      }
+      return true;
+    }
+  }
+
+  ConfigItems items;
+  if (!parse_config_file(path,
+                         [&](const std::string& /*line*/,
+                             const std::string& key,
+                             const std::string& value) {
+                           if (!key.empty()) {
+                             set_item(key, value, nullopt, false, path);
+                             items.emplace_back(key, value);
+                           }
+                         })) {
+    return false;
+  }
+
+  if (m_config_snapshot && !m_read_only && identity) {
+    write_config_snapshot(snapshot_path, *identity, items);
+  }
+  return true;
+}
+
 void
 Config::update_from_environment()
 {
@@ -519,12 +903,48 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::absolute_paths_in_stderr:
     return format_bool(m_absolute_paths_in_stderr);
 
+  case ConfigItem::adaptive_compression:
+    return format_bool(m_adaptive_compression);
+
+  case ConfigItem::admission_threshold:
+    return FMT("{}", m_admission_threshold);
+
+  case ConfigItem::auto_prefix_map:
+    return format_bool(m_auto_prefix_map);
+
+  case ConfigItem::background_cleanup:
+    return format_bool(m_background_cleanup);
+
   case ConfigItem::base_dir:
     return m_base_dir;
 
+  case ConfigItem::cache_compiler_queries:
+    return format_bool(m_cache_compiler_queries);
+
   case ConfigItem::cache_dir:
     return m_cache_dir;
 
+  case ConfigItem::cache_failures:
+    return format_bool(m_cache_failures);
+
+  case ConfigItem::cache_links:
+    return format_bool(m_cache_links);
+
+  case ConfigItem::cache_preprocessing:
+    return format_bool(m_cache_preprocessing);
+
+  case ConfigItem::cleanup_policy:
+    return m_cleanup_policy;
+
+  case ConfigItem::cleanup_sample_size:
+    return FMT("{}", m_cleanup_sample_size);
+
+  case ConfigItem::coalesce_timeout:
+    return FMT("{}", m_coalesce_timeout);
+
+  case ConfigItem::compile_servers:
+    return m_compile_servers;
+
   case ConfigItem::compiler:
     return m_compiler;
 
@@ -540,30 +960,63 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::compression_level:
     return FMT("{}", m_compression_level);
 
+  case ConfigItem::compression_threads:
+    return FMT("{}", m_compression_threads);
+
+  case ConfigItem::compression_type:
+    return m_compression_type;
+
+  case ConfigItem::config_snapshot:
+    return format_bool(m_config_snapshot);
+
   case ConfigItem::cpp_extension:
     return m_cpp_extension;
 
   case ConfigItem::debug:
     return format_bool(m_debug);
 
+  case ConfigItem::deduplication:
+    return format_bool(m_deduplication);
+
+  case ConfigItem::defer_mtime_updates:
+    return format_bool(m_defer_mtime_updates);
+
   case ConfigItem::depend_mode:
     return format_bool(m_depend_mode);
 
+  case ConfigItem::digest_map:
+    return m_digest_map;
+
   case ConfigItem::direct_mode:
     return format_bool(m_direct_mode);
 
   case ConfigItem::disable:
     return format_bool(m_disable);
 
+  case ConfigItem::event_log:
+    return m_event_log;
+
+  case ConfigItem::explain_misses:
+    return format_bool(m_explain_misses);
+
   case ConfigItem::extra_files_to_hash:
     return m_extra_files_to_hash;
 
   case ConfigItem::file_clone:
     return format_bool(m_file_clone);
 
+  case ConfigItem::framed_results:
+    return format_bool(m_framed_results);
+
+  case ConfigItem::git_index:
+    return format_bool(m_git_index);
+
   case ConfigItem::hard_link:
     return format_bool(m_hard_link);
 
+  case ConfigItem::hash_algorithm:
+    return m_hash_algorithm;
+
   case ConfigItem::hash_dir:
     return format_bool(m_hash_dir);
 
@@ -573,36 +1026,117 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::ignore_options:
     return m_ignore_options;
 
+  case ConfigItem::ignore_warning_options:
+    return format_bool(m_ignore_warning_options);
+
+  case ConfigItem::include_file_jobs:
+    return FMT("{}", m_include_file_jobs);
+
   case ConfigItem::inode_cache:
     return format_bool(m_inode_cache);
 
+  case ConfigItem::inode_cache_dir:
+    return m_inode_cache_dir;
+
+  case ConfigItem::inode_cache_entries:
+    return FMT("{}", m_inode_cache_entries);
+
+  case ConfigItem::inode_cache_immutable_dirs:
+    return m_inode_cache_immutable_dirs;
+
   case ConfigItem::keep_comments_cpp:
     return format_bool(m_keep_comments_cpp);
 
+  case ConfigItem::keep_identical_outputs:
+    return format_bool(m_keep_identical_outputs);
+
   case ConfigItem::limit_multiple:
     return FMT("{:.1f}", m_limit_multiple);
 
+  case ConfigItem::log_buffer_size:
+    return format_cache_size(m_log_buffer_size);
+
   case ConfigItem::log_file:
     return m_log_file;
 
+  case ConfigItem::lookup_timeout:
+    return FMT("{}", m_lookup_timeout);
+
+  case ConfigItem::lower_cache_copy_up:
+    return format_bool(m_lower_cache_copy_up);
+
+  case ConfigItem::lower_cache_dirs:
+    return m_lower_cache_dirs;
+
+  case ConfigItem::maintenance_jobs:
+    return FMT("{}", m_maintenance_jobs);
+
+  case ConfigItem::max_compiler_jobs:
+    return FMT("{}", m_max_compiler_jobs);
+
+  case ConfigItem::max_delta_chain:
+    return FMT("{}", m_max_delta_chain);
+
+  case ConfigItem::max_failure_age:
+    return FMT("{}s", m_max_failure_age);
+
   case ConfigItem::max_files:
     return FMT("{}", m_max_files);
 
+  case ConfigItem::max_link_size:
+    return format_cache_size(m_max_link_size);
+
+  case ConfigItem::max_manifest_entries:
+    return FMT("{}", m_max_manifest_entries);
+
+  case ConfigItem::max_manifest_entry_age:
+    return FMT("{}s", m_max_manifest_entry_age);
+
   case ConfigItem::max_size:
     return format_cache_size(m_max_size);
 
+  case ConfigItem::memoize_compiler_check:
+    return format_bool(m_memoize_compiler_check);
+
+  case ConfigItem::memoize_path_lookup:
+    return format_bool(m_memoize_path_lookup);
+
+  case ConfigItem::namespace_:
+    return m_namespace;
+
+  case ConfigItem::namespace_max_size:
+    return format_cache_size(m_namespace_max_size);
+
+  case ConfigItem::pack_max_file_size:
+    return format_cache_size(m_pack_max_file_size);
+
   case ConfigItem::path:
     return m_path;
 
   case ConfigItem::pch_external_checksum:
     return format_bool(m_pch_external_checksum);
 
+  case ConfigItem::peer_timeout:
+    return FMT("{}", m_peer_timeout);
+
+  case ConfigItem::peers:
+    return m_peers;
+
+  case ConfigItem::phase_durations:
+    return format_bool(m_phase_durations);
+
   case ConfigItem::prefix_command:
     return m_prefix_command;
 
   case ConfigItem::prefix_command_cpp:
     return m_prefix_command_cpp;
 
+  case ConfigItem::presence_filter:
+    return format_bool(m_presence_filter);
+
+  case ConfigItem::raw_file_min_size:
+    return format_cache_size(m_raw_file_min_size);
+
   case ConfigItem::read_only:
     return format_bool(m_read_only);
 
@@ -612,20 +1146,83 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::recache:
     return format_bool(m_recache);
 
+  case ConfigItem::recompress_low_priority:
+    return format_bool(m_recompress_low_priority);
+
+  case ConfigItem::recompress_rate_limit:
+    return format_cache_size(m_recompress_rate_limit);
+
+  case ConfigItem::regenerate_depfiles:
+    return format_bool(m_regenerate_depfiles);
+
   case ConfigItem::run_second_cpp:
     return format_bool(m_run_second_cpp);
 
+  case ConfigItem::secondary_storage:
+    return m_secondary_storage;
+
+  case ConfigItem::secondary_storage_miss_ttl:
+    return FMT("{}", m_secondary_storage_miss_ttl);
+
+  case ConfigItem::secondary_storage_timeout:
+    return FMT("{}", m_secondary_storage_timeout);
+
+  case ConfigItem::session:
+    return m_session;
+
+  case ConfigItem::shared_stats:
+    return format_bool(m_shared_stats);
+
   case ConfigItem::sloppiness:
     return format_sloppiness(m_sloppiness);
 
+  case ConfigItem::speculative_compile_delay:
+    return FMT("{}", m_speculative_compile_delay);
+
+  case ConfigItem::speculative_cpp:
+    return format_bool(m_speculative_cpp);
+
+  case ConfigItem::split_arch:
+    return format_bool(m_split_arch);
+
+  case ConfigItem::split_source_jobs:
+    return FMT("{}", m_split_source_jobs);
+
+  case ConfigItem::split_sources:
+    return format_bool(m_split_sources);
+
   case ConfigItem::stats:
     return format_bool(m_stats);
 
+  case ConfigItem::stats_breakdown:
+    return m_stats_breakdown;
+
+  case ConfigItem::stream_compression:
+    return format_bool(m_stream_compression);
+
+  case ConfigItem::stripe_dirs:
+    return m_stripe_dirs;
+
+  case ConfigItem::system_include_roots:
+    return m_system_include_roots;
+
   case ConfigItem::temporary_dir:
     return m_temporary_dir;
 
+  case ConfigItem::trace_file:
+    return m_trace_file;
+
+  case ConfigItem::trace_sample_rate:
+    return FMT("{}", m_trace_sample_rate);
+
+  case ConfigItem::trust_scrubbed_entries:
+    return format_bool(m_trust_scrubbed_entries);
+
   case ConfigItem::umask:
     return format_umask(m_umask);
+
+  case ConfigItem::write_behind:
+    return format_bool(m_write_behind);
   }
 
   ASSERT(false); // Never reached
@@ -714,6 +1311,23 @@ Config::set_item(const std::string& key,
     m_absolute_paths_in_stderr = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::adaptive_compression:
+    m_adaptive_compression = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::admission_threshold:
+    m_admission_threshold =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "admission_threshold");
+    break;
+
+  case ConfigItem::auto_prefix_map:
+    m_auto_prefix_map = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::background_cleanup:
+    m_background_cleanup = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::base_dir:
     m_base_dir = Util::expand_environment_variables(value);
     if (!m_base_dir.empty()) { // The empty string means "disable"
@@ -722,10 +1336,47 @@ Config::set_item(const std::string& key,
     }
     break;
 
+  case ConfigItem::cache_compiler_queries:
+    m_cache_compiler_queries = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::cache_dir:
     set_cache_dir(Util::expand_environment_variables(value));
     break;
 
+  case ConfigItem::cache_failures:
+    m_cache_failures = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::cache_links:
+    m_cache_links = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::cache_preprocessing:
+    m_cache_preprocessing = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::cleanup_policy:
+    if (value != "lru" && value != "gdsf") {
+      throw Error("unknown cleanup policy: \"{}\"", value);
+    }
+    m_cleanup_policy = value;
+    break;
+
+  case ConfigItem::cleanup_sample_size:
+    m_cleanup_sample_size =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "cleanup_sample_size");
+    break;
+
+  case ConfigItem::coalesce_timeout:
+    m_coalesce_timeout =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "coalesce_timeout");
+    break;
+
+  case ConfigItem::compile_servers:
+    m_compile_servers = value;
+    break;
+
   case ConfigItem::compiler:
     m_compiler = value;
     break;
@@ -748,6 +1399,22 @@ Config::set_item(const std::string& key,
     break;
   }
 
+  case ConfigItem::compression_threads:
+    m_compression_threads =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "compression_threads");
+    break;
+
+  case ConfigItem::compression_type:
+    if (value != "zstd" && value != "lz4") {
+      throw Error("unknown compression type: \"{}\"", value);
+    }
+    m_compression_type = value;
+    break;
+
+  case ConfigItem::config_snapshot:
+    m_config_snapshot = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::cpp_extension:
     m_cpp_extension = value;
     break;
@@ -756,10 +1423,22 @@ Config::set_item(const std::string& key,
     m_debug = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::deduplication:
+    m_deduplication = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::defer_mtime_updates:
+    m_defer_mtime_updates = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::depend_mode:
     m_depend_mode = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::digest_map:
+    m_digest_map = Util::expand_environment_variables(value);
+    break;
+
   case ConfigItem::direct_mode:
     m_direct_mode = parse_bool(value, env_var_key, negate);
     break;
@@ -768,6 +1447,14 @@ Config::set_item(const std::string& key,
     m_disable = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::event_log:
+    m_event_log = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::explain_misses:
+    m_explain_misses = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::extra_files_to_hash:
     m_extra_files_to_hash = Util::expand_environment_variables(value);
     break;
@@ -776,10 +1463,25 @@ Config::set_item(const std::string& key,
     m_file_clone = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::framed_results:
+    m_framed_results = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::git_index:
+    m_git_index = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::hard_link:
     m_hard_link = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::hash_algorithm:
+    if (value != "blake3" && value != "xxh3") {
+      throw Error("unknown hash algorithm: \"{}\"", value);
+    }
+    m_hash_algorithm = value;
+    break;
+
   case ConfigItem::hash_dir:
     m_hash_dir = parse_bool(value, env_var_key, negate);
     break;
@@ -792,30 +1494,127 @@ Config::set_item(const std::string& key,
     m_ignore_options = Util::expand_environment_variables(value);
     break;
 
+  case ConfigItem::ignore_warning_options:
+    m_ignore_warning_options = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::include_file_jobs:
+    m_include_file_jobs =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "include_file_jobs");
+    break;
+
   case ConfigItem::inode_cache:
     m_inode_cache = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::inode_cache_dir:
+    m_inode_cache_dir = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::inode_cache_entries:
+    m_inode_cache_entries =
+      Util::parse_unsigned(value, 1, UINT32_MAX, "inode_cache_entries");
+    break;
+
+  case ConfigItem::inode_cache_immutable_dirs:
+    m_inode_cache_immutable_dirs = Util::expand_environment_variables(value);
+    break;
+
   case ConfigItem::keep_comments_cpp:
     m_keep_comments_cpp = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::keep_identical_outputs:
+    m_keep_identical_outputs = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::limit_multiple:
     m_limit_multiple = Util::clamp(parse_double(value), 0.0, 1.0);
     break;
 
+  case ConfigItem::log_buffer_size:
+    m_log_buffer_size = Util::parse_size(value);
+    break;
+
   case ConfigItem::log_file:
     m_log_file = Util::expand_environment_variables(value);
     break;
 
+  case ConfigItem::lookup_timeout:
+    m_lookup_timeout =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "lookup_timeout");
+    break;
+
+  case ConfigItem::lower_cache_copy_up:
+    m_lower_cache_copy_up = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::lower_cache_dirs:
+    m_lower_cache_dirs = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::maintenance_jobs:
+    m_maintenance_jobs =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "maintenance_jobs");
+    break;
+
+  case ConfigItem::max_compiler_jobs:
+    m_max_compiler_jobs =
+      value == "auto"
+        ? default_max_compiler_jobs()
+        : Util::parse_unsigned(value, nullopt, UINT32_MAX, "max_compiler_jobs");
+    break;
+
+  case ConfigItem::max_delta_chain:
+    m_max_delta_chain =
+      Util::parse_unsigned(value, 0, UINT8_MAX, "max_delta_chain");
+    break;
+
+  case ConfigItem::max_failure_age:
+    m_max_failure_age = Util::parse_duration(value);
+    break;
+
   case ConfigItem::max_files:
     m_max_files = Util::parse_unsigned(value, nullopt, nullopt, "max_files");
     break;
 
+  case ConfigItem::max_link_size:
+    m_max_link_size = Util::parse_size(value);
+    break;
+
+  case ConfigItem::max_manifest_entries:
+    m_max_manifest_entries =
+      Util::parse_unsigned(value, 1, UINT32_MAX, "max_manifest_entries");
+    break;
+
+  case ConfigItem::max_manifest_entry_age:
+    m_max_manifest_entry_age = Util::parse_duration(value);
+    break;
+
   case ConfigItem::max_size:
     m_max_size = Util::parse_size(value);
     break;
 
+  case ConfigItem::memoize_compiler_check:
+    m_memoize_compiler_check = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::memoize_path_lookup:
+    m_memoize_path_lookup = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::namespace_:
+    m_namespace = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::namespace_max_size:
+    m_namespace_max_size = Util::parse_size(value);
+    break;
+
+  case ConfigItem::pack_max_file_size:
+    m_pack_max_file_size = Util::parse_size(value);
+    break;
+
   case ConfigItem::path:
     m_path = Util::expand_environment_variables(value);
     break;
@@ -824,6 +1623,19 @@ Config::set_item(const std::string& key,
     m_pch_external_checksum = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::peer_timeout:
+    m_peer_timeout =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "peer_timeout");
+    break;
+
+  case ConfigItem::peers:
+    m_peers = value;
+    break;
+
+  case ConfigItem::phase_durations:
+    m_phase_durations = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::prefix_command:
     m_prefix_command = Util::expand_environment_variables(value);
     break;
@@ -832,6 +1644,14 @@ Config::set_item(const std::string& key,
     m_prefix_command_cpp = Util::expand_environment_variables(value);
     break;
 
+  case ConfigItem::presence_filter:
+    m_presence_filter = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::raw_file_min_size:
+    m_raw_file_min_size = Util::parse_size(value);
+    break;
+
   case ConfigItem::read_only:
     m_read_only = parse_bool(value, env_var_key, negate);
     break;
@@ -844,26 +1664,120 @@ Config::set_item(const std::string& key,
     m_recache = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::recompress_low_priority:
+    m_recompress_low_priority = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::recompress_rate_limit:
+    m_recompress_rate_limit = Util::parse_size(value);
+    break;
+
+  case ConfigItem::regenerate_depfiles:
+    m_regenerate_depfiles = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::run_second_cpp:
     m_run_second_cpp = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::secondary_storage:
+    m_secondary_storage = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::secondary_storage_miss_ttl:
+    m_secondary_storage_miss_ttl = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_miss_ttl");
+    break;
+
+  case ConfigItem::secondary_storage_timeout:
+    m_secondary_storage_timeout = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "secondary_storage_timeout");
+    break;
+
+  case ConfigItem::session:
+    m_session = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::shared_stats:
+    m_shared_stats = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::sloppiness:
     m_sloppiness = parse_sloppiness(value);
     break;
 
+  case ConfigItem::speculative_compile_delay:
+    m_speculative_compile_delay = Util::parse_unsigned(
+      value, nullopt, UINT32_MAX, "speculative_compile_delay");
+    break;
+
+  case ConfigItem::speculative_cpp:
+    m_speculative_cpp = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::split_arch:
+    m_split_arch = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::split_source_jobs:
+    m_split_source_jobs =
+      Util::parse_unsigned(value, nullopt, UINT32_MAX, "split_source_jobs");
+    break;
+
+  case ConfigItem::split_sources:
+    m_split_sources = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::stats:
     m_stats = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::stats_breakdown:
+    for (const auto& dimension : Util::split_into_views(value, ", ")) {
+      if (dimension != "compiler" && dimension != "directory"
+          && dimension != "namespace") {
+        throw Error("unknown statistics dimension: \"{}\"", dimension);
+      }
+    }
+    m_stats_breakdown = value;
+    break;
+
+  case ConfigItem::stream_compression:
+    m_stream_compression = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::stripe_dirs:
+    m_stripe_dirs = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::system_include_roots:
+    m_system_include_roots = Util::expand_environment_variables(value);
+    break;
+
   case ConfigItem::temporary_dir:
     m_temporary_dir = Util::expand_environment_variables(value);
     m_temporary_dir_configured_explicitly = true;
     break;
 
+  case ConfigItem::trace_file:
+    m_trace_file = Util::expand_environment_variables(value);
+    break;
+
+  case ConfigItem::trace_sample_rate:
+    m_trace_sample_rate = Util::clamp(parse_double(value), 0.0, 1.0);
+    break;
+
+  case ConfigItem::trust_scrubbed_entries:
+    m_trust_scrubbed_entries = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::umask:
     m_umask = parse_umask(value);
     break;
+
+  case ConfigItem::write_behind:
+    m_write_behind = parse_bool(value, env_var_key, negate);
+    break;
   }
 
   m_origins.emplace(key, origin);
@@ -886,9 +1800,16 @@ std::string
 Config::default_temporary_dir(const std::string& cache_dir)
 {
 #ifdef HAVE_GETEUID
-  std::string user_tmp_dir = FMT("/run/user/{}", geteuid());
-  if (Stat::stat(user_tmp_dir).is_directory()) {
-    return user_tmp_dir + "/ccache-tmp";
+  // This is called each time cache_dir is set during configuration setup, so
+  // only check for the directory once.
+  static const std::string run_user_tmp_dir = [] {
+    std::string user_tmp_dir = FMT("/run/user/{}", geteuid());
+    return Stat::stat(user_tmp_dir).is_directory()
+             ? user_tmp_dir + "/ccache-tmp"
+             : std::string();
+  }();
+  if (!run_user_tmp_dir.empty()) {
+    return run_user_tmp_dir;
   }
 #endif
   return cache_dir + "/tmp";
@@ -30,7 +30,7 @@
 #include <string>
 #include <unordered_map>
 
-enum class CompilerType { auto_guess, clang, gcc, nvcc, other, pump };
+enum class CompilerType { auto_guess, clang, gcc, msvc, nvcc, other, pump };
 
 std::string compiler_type_to_string(CompilerType compiler_type);
 
@@ -38,49 +38,121 @@ class Config
 {
 public:
   Config() = default;
-  Config(Config&) = default;
+  Config(const Config&) = default;
   Config& operator=(const Config&) = default;
 
   bool absolute_paths_in_stderr() const;
+  bool adaptive_compression() const;
+  uint32_t admission_threshold() const;
+  bool auto_prefix_map() const;
+  bool background_cleanup() const;
   const std::string& base_dir() const;
+  bool cache_compiler_queries() const;
   const std::string& cache_dir() const;
+  bool cache_failures() const;
+  bool cache_links() const;
+  bool cache_preprocessing() const;
+  const std::string& cleanup_policy() const;
+  uint32_t cleanup_sample_size() const;
+  uint32_t coalesce_timeout() const;
+  const std::string& compile_servers() const;
   const std::string& compiler() const;
   const std::string& compiler_check() const;
   CompilerType compiler_type() const;
   bool compression() const;
   int8_t compression_level() const;
+  uint32_t compression_threads() const;
+  const std::string& compression_type() const;
+  bool config_snapshot() const;
   const std::string& cpp_extension() const;
   bool debug() const;
+  bool deduplication() const;
+  bool defer_mtime_updates() const;
   bool depend_mode() const;
+  const std::string& digest_map() const;
   bool direct_mode() const;
   bool disable() const;
+  const std::string& event_log() const;
+  bool explain_misses() const;
   const std::string& extra_files_to_hash() const;
   bool file_clone() const;
+  bool framed_results() const;
+  bool git_index() const;
   bool hard_link() const;
+  const std::string& hash_algorithm() const;
   bool hash_dir() const;
   const std::string& ignore_headers_in_manifest() const;
   const std::string& ignore_options() const;
+  bool ignore_warning_options() const;
+  uint32_t include_file_jobs() const;
   bool inode_cache() const;
+  const std::string& inode_cache_dir() const;
+  uint32_t inode_cache_entries() const;
+  const std::string& inode_cache_immutable_dirs() const;
   bool keep_comments_cpp() const;
+  bool keep_identical_outputs() const;
   double limit_multiple() const;
+  uint64_t log_buffer_size() const;
   const std::string& log_file() const;
+  uint32_t lookup_timeout() const;
+  bool lower_cache_copy_up() const;
+  const std::string& lower_cache_dirs() const;
+  uint32_t maintenance_jobs() const;
+  uint32_t max_compiler_jobs() const;
+  uint8_t max_delta_chain() const;
+  uint64_t max_failure_age() const;
   uint64_t max_files() const;
+  uint64_t max_link_size() const;
+  uint32_t max_manifest_entries() const;
+  uint64_t max_manifest_entry_age() const;
   uint64_t max_size() const;
+  bool memoize_compiler_check() const;
+  bool memoize_path_lookup() const;
+  const std::string& namespace_() const;
+  uint64_t namespace_max_size() const;
+  uint64_t pack_max_file_size() const;
   const std::string& path() const;
   bool pch_external_checksum() const;
+  uint32_t peer_timeout() const;
+  const std::string& peers() const;
+  bool phase_durations() const;
   const std::string& prefix_command() const;
   const std::string& prefix_command_cpp() const;
+  bool presence_filter() const;
+  uint64_t raw_file_min_size() const;
   bool read_only() const;
   bool read_only_direct() const;
   bool recache() const;
+  bool recompress_low_priority() const;
+  uint64_t recompress_rate_limit() const;
+  bool regenerate_depfiles() const;
   bool run_second_cpp() const;
+  const std::string& secondary_storage() const;
+  uint32_t secondary_storage_miss_ttl() const;
+  uint32_t secondary_storage_timeout() const;
+  const std::string& session() const;
+  bool shared_stats() const;
   uint32_t sloppiness() const;
+  uint32_t speculative_compile_delay() const;
+  bool speculative_cpp() const;
+  bool split_arch() const;
+  uint32_t split_source_jobs() const;
+  bool split_sources() const;
   bool stats() const;
+  const std::string& stats_breakdown() const;
+  bool stream_compression() const;
+  const std::string& stripe_dirs() const;
+  const std::string& system_include_roots() const;
   const std::string& temporary_dir() const;
+  const std::string& trace_file() const;
+  double trace_sample_rate() const;
+  bool trust_scrubbed_entries() const;
   uint32_t umask() const;
+  bool write_behind() const;
 
   void set_base_dir(const std::string& value);
   void set_cache_dir(const std::string& value);
+  void set_cache_preprocessing(bool value);
   void set_cpp_extension(const std::string& value);
   void set_compiler(const std::string& value);
   void set_compiler_type(CompilerType compiler_type);
@@ -88,10 +160,16 @@ public:
   void set_debug(bool value);
   void set_direct_mode(bool value);
   void set_ignore_options(const std::string& value);
+  void set_include_file_jobs(uint32_t value);
   void set_inode_cache(bool value);
+  void set_inode_cache_dir(const std::string& value);
+  void set_inode_cache_entries(uint32_t value);
+  void set_inode_cache_immutable_dirs(const std::string& value);
   void set_max_files(uint64_t value);
   void set_max_size(uint64_t value);
+  void set_read_only_direct(bool value);
   void set_run_second_cpp(bool value);
+  void set_secondary_storage(const std::string& value);
 
   // Where to write configuration changes.
   const std::string& primary_config_path() const;
@@ -111,6 +189,13 @@ public:
   // invalid configuration values.
   bool update_from_file(const std::string& path);
 
+  // Like update_from_file, but load the items from `snapshot_path` instead of
+  // parsing `path` if the snapshot was made from the current version of
+  // `path`. The snapshot is (re)written after parsing `path` if config_snapshot
+  // is enabled.
+  bool update_from_file_via_snapshot(const std::string& path,
+                                     const std::string& snapshot_path);
+
   // Set config values from environment variables.
   //
   // Throws Error on invalid configuration values.
@@ -133,42 +218,113 @@ private:
   std::string m_secondary_config_path;
 
   bool m_absolute_paths_in_stderr = false;
+  bool m_adaptive_compression = false;
+  uint32_t m_admission_threshold = 1;
+  bool m_auto_prefix_map = false;
+  bool m_background_cleanup = false;
   std::string m_base_dir = "";
+  bool m_cache_compiler_queries = false;
   std::string m_cache_dir;
+  bool m_cache_failures = false;
+  bool m_cache_links = false;
+  bool m_cache_preprocessing = false;
+  std::string m_cleanup_policy = "lru";
+  uint32_t m_cleanup_sample_size = 0;
+  uint32_t m_coalesce_timeout = 0;
+  std::string m_compile_servers = "";
   std::string m_compiler = "";
   std::string m_compiler_check = "mtime";
   CompilerType m_compiler_type = CompilerType::auto_guess;
   bool m_compression = true;
   int8_t m_compression_level = 0; // Use default level
+  uint32_t m_compression_threads = 0;
+  std::string m_compression_type = "zstd";
+  bool m_config_snapshot = false;
   std::string m_cpp_extension = "";
   bool m_debug = false;
+  bool m_deduplication = false;
+  bool m_defer_mtime_updates = false;
   bool m_depend_mode = false;
+  std::string m_digest_map = "";
   bool m_direct_mode = true;
   bool m_disable = false;
+  std::string m_event_log = "";
+  bool m_explain_misses = false;
   std::string m_extra_files_to_hash = "";
   bool m_file_clone = false;
+  bool m_framed_results = false;
+  bool m_git_index = false;
   bool m_hard_link = false;
+  std::string m_hash_algorithm = "blake3";
   bool m_hash_dir = true;
   std::string m_ignore_headers_in_manifest = "";
   std::string m_ignore_options = "";
+  bool m_ignore_warning_options = false;
+  uint32_t m_include_file_jobs = 0;
   bool m_inode_cache = false;
+  std::string m_inode_cache_dir;
+  uint32_t m_inode_cache_entries = 128 * 1024;
+  std::string m_inode_cache_immutable_dirs;
   bool m_keep_comments_cpp = false;
+  bool m_keep_identical_outputs = false;
   double m_limit_multiple = 0.8;
+  uint64_t m_log_buffer_size = 0;
   std::string m_log_file = "";
+  uint32_t m_lookup_timeout = 0;
+  bool m_lower_cache_copy_up = false;
+  std::string m_lower_cache_dirs;
+  uint32_t m_maintenance_jobs = 0;
+  uint32_t m_max_compiler_jobs = 0;
+  uint8_t m_max_delta_chain = 0;
+  uint64_t m_max_failure_age = 86400;
   uint64_t m_max_files = 0;
+  uint64_t m_max_link_size = 0;
+  uint32_t m_max_manifest_entries = 100;
+  uint64_t m_max_manifest_entry_age = 0;
   uint64_t m_max_size = 5ULL * 1000 * 1000 * 1000;
+  bool m_memoize_compiler_check = false;
+  bool m_memoize_path_lookup = false;
+  std::string m_namespace = "";
+  uint64_t m_namespace_max_size = 0;
+  uint64_t m_pack_max_file_size = 0;
   std::string m_path = "";
   bool m_pch_external_checksum = false;
+  uint32_t m_peer_timeout = 100;
+  std::string m_peers = "";
+  bool m_phase_durations = false;
   std::string m_prefix_command = "";
   std::string m_prefix_command_cpp = "";
+  bool m_presence_filter = false;
+  uint64_t m_raw_file_min_size = 0;
   bool m_read_only = false;
   bool m_read_only_direct = false;
   bool m_recache = false;
+  bool m_recompress_low_priority = false;
+  uint64_t m_recompress_rate_limit = 0;
+  bool m_regenerate_depfiles = false;
   bool m_run_second_cpp = true;
+  std::string m_secondary_storage;
+  uint32_t m_secondary_storage_miss_ttl = 0;
+  uint32_t m_secondary_storage_timeout = 500;
+  std::string m_session;
+  bool m_shared_stats = false;
   uint32_t m_sloppiness = 0;
+  uint32_t m_speculative_compile_delay = 0;
+  bool m_speculative_cpp = false;
+  bool m_split_arch = false;
+  uint32_t m_split_source_jobs = 0;
+  bool m_split_sources = false;
   bool m_stats = true;
+  std::string m_stats_breakdown = "";
+  bool m_stream_compression = false;
+  std::string m_stripe_dirs = "";
+  std::string m_system_include_roots = "";
   std::string m_temporary_dir;
+  std::string m_trace_file;
+  double m_trace_sample_rate = 1.0;
+  bool m_trust_scrubbed_entries = false;
   uint32_t m_umask = std::numeric_limits<uint32_t>::max(); // Don't set umask
+  bool m_write_behind = false;
 
   bool m_temporary_dir_configured_explicitly = false;
 
@@ -189,18 +345,90 @@ Config::absolute_paths_in_stderr() const
   return m_absolute_paths_in_stderr;
 }
 
+inline bool
+Config::adaptive_compression() const
+{
+  return m_adaptive_compression;
+}
+
+inline uint32_t
+Config::admission_threshold() const
+{
+  return m_admission_threshold;
+}
+
+inline bool
+Config::auto_prefix_map() const
+{
+  return m_auto_prefix_map;
+}
+
+inline bool
+Config::background_cleanup() const
+{
+  return m_background_cleanup;
+}
+
 inline const std::string&
 Config::base_dir() const
 {
   return m_base_dir;
 }
 
+inline bool
+Config::cache_compiler_queries() const
+{
+  return m_cache_compiler_queries;
+}
+
 inline const std::string&
 Config::cache_dir() const
 {
   return m_cache_dir;
 }
 
+inline bool
+Config::cache_failures() const
+{
+  return m_cache_failures;
+}
+
+inline bool
+Config::cache_links() const
+{
+  return m_cache_links;
+}
+
+inline bool
+Config::cache_preprocessing() const
+{
+  return m_cache_preprocessing;
+}
+
+inline const std::string&
+Config::cleanup_policy() const
+{
+  return m_cleanup_policy;
+}
+
+inline uint32_t
+Config::cleanup_sample_size() const
+{
+  return m_cleanup_sample_size;
+}
+
+inline uint32_t
+Config::coalesce_timeout() const
+{
+  return m_coalesce_timeout;
+}
+
+inline const std::string&
+Config::compile_servers() const
+{
+  return m_compile_servers;
+}
+
 inline const std::string&
 Config::compiler() const
 {
@@ -231,6 +459,24 @@ Config::compression_level() const
   return m_compression_level;
 }
 
+inline uint32_t
+Config::compression_threads() const
+{
+  return m_compression_threads;
+}
+
+inline const std::string&
+Config::compression_type() const
+{
+  return m_compression_type;
+}
+
+inline bool
+Config::config_snapshot() const
+{
+  return m_config_snapshot;
+}
+
 inline const std::string&
 Config::cpp_extension() const
 {
@@ -243,12 +489,30 @@ Config::debug() const
   return m_debug;
 }
 
+inline bool
+Config::deduplication() const
+{
+  return m_deduplication;
+}
+
+inline bool
+Config::defer_mtime_updates() const
+{
+  return m_defer_mtime_updates;
+}
+
 inline bool
 Config::depend_mode() const
 {
   return m_depend_mode;
 }
 
+inline const std::string&
+Config::digest_map() const
+{
+  return m_digest_map;
+}
+
 inline bool
 Config::direct_mode() const
 {
@@ -261,6 +525,18 @@ Config::disable() const
   return m_disable;
 }
 
+inline const std::string&
+Config::event_log() const
+{
+  return m_event_log;
+}
+
+inline bool
+Config::explain_misses() const
+{
+  return m_explain_misses;
+}
+
 inline const std::string&
 Config::extra_files_to_hash() const
 {
@@ -273,12 +549,30 @@ Config::file_clone() const
   return m_file_clone;
 }
 
+inline bool
+Config::framed_results() const
+{
+  return m_framed_results;
+}
+
+inline bool
+Config::git_index() const
+{
+  return m_git_index;
+}
+
 inline bool
 Config::hard_link() const
 {
   return m_hard_link;
 }
 
+inline const std::string&
+Config::hash_algorithm() const
+{
+  return m_hash_algorithm;
+}
+
 inline bool
 Config::hash_dir() const
 {
@@ -297,42 +591,174 @@ Config::ignore_options() const
   return m_ignore_options;
 }
 
+inline bool
+Config::ignore_warning_options() const
+{
+  return m_ignore_warning_options;
+}
+
+inline uint32_t
+Config::include_file_jobs() const
+{
+  return m_include_file_jobs;
+}
+
 inline bool
 Config::inode_cache() const
 {
   return m_inode_cache;
 }
 
+inline const std::string&
+Config::inode_cache_dir() const
+{
+  return m_inode_cache_dir;
+}
+
+inline uint32_t
+Config::inode_cache_entries() const
+{
+  return m_inode_cache_entries;
+}
+
+inline const std::string&
+Config::inode_cache_immutable_dirs() const
+{
+  return m_inode_cache_immutable_dirs;
+}
+
 inline bool
 Config::keep_comments_cpp() const
 {
   return m_keep_comments_cpp;
 }
 
+inline bool
+Config::keep_identical_outputs() const
+{
+  return m_keep_identical_outputs;
+}
+
 inline double
 Config::limit_multiple() const
 {
   return m_limit_multiple;
 }
 
+inline uint64_t
+Config::log_buffer_size() const
+{
+  return m_log_buffer_size;
+}
+
 inline const std::string&
 Config::log_file() const
 {
   return m_log_file;
 }
 
+inline uint32_t
+Config::lookup_timeout() const
+{
+  return m_lookup_timeout;
+}
+
+inline bool
+Config::lower_cache_copy_up() const
+{
+  return m_lower_cache_copy_up;
+}
+
+inline const std::string&
+Config::lower_cache_dirs() const
+{
+  return m_lower_cache_dirs;
+}
+
+inline uint32_t
+Config::maintenance_jobs() const
+{
+  return m_maintenance_jobs;
+}
+
+inline uint32_t
+Config::max_compiler_jobs() const
+{
+  return m_max_compiler_jobs;
+}
+
+inline uint8_t
+Config::max_delta_chain() const
+{
+  return m_max_delta_chain;
+}
+
+inline uint64_t
+Config::max_failure_age() const
+{
+  return m_max_failure_age;
+}
+
 inline uint64_t
 Config::max_files() const
 {
   return m_max_files;
 }
 
+inline uint64_t
+Config::max_link_size() const
+{
+  return m_max_link_size;
+}
+
+inline uint32_t
+Config::max_manifest_entries() const
+{
+  return m_max_manifest_entries;
+}
+
+inline uint64_t
+Config::max_manifest_entry_age() const
+{
+  return m_max_manifest_entry_age;
+}
+
 inline uint64_t
 Config::max_size() const
 {
   return m_max_size;
 }
 
+inline bool
+Config::memoize_compiler_check() const
+{
+  return m_memoize_compiler_check;
+}
+
+inline bool
+Config::memoize_path_lookup() const
+{
+  return m_memoize_path_lookup;
+}
+
+inline const std::string&
+Config::namespace_() const
+{
+  return m_namespace;
+}
+
+inline uint64_t
+Config::namespace_max_size() const
+{
+  return m_namespace_max_size;
+}
+
+inline uint64_t
+Config::pack_max_file_size() const
+{
+  return m_pack_max_file_size;
+}
+
 inline const std::string&
 Config::path() const
 {
@@ -345,6 +771,24 @@ Config::pch_external_checksum() const
   return m_pch_external_checksum;
 }
 
+inline uint32_t
+Config::peer_timeout() const
+{
+  return m_peer_timeout;
+}
+
+inline const std::string&
+Config::peers() const
+{
+  return m_peers;
+}
+
+inline bool
+Config::phase_durations() const
+{
+  return m_phase_durations;
+}
+
 inline const std::string&
 Config::prefix_command() const
 {
@@ -357,6 +801,18 @@ Config::prefix_command_cpp() const
   return m_prefix_command_cpp;
 }
 
+inline bool
+Config::presence_filter() const
+{
+  return m_presence_filter;
+}
+
+inline uint64_t
+Config::raw_file_min_size() const
+{
+  return m_raw_file_min_size;
+}
+
 inline bool
 Config::read_only() const
 {
@@ -375,36 +831,162 @@ Config::recache() const
   return m_recache;
 }
 
+inline bool
+Config::recompress_low_priority() const
+{
+  return m_recompress_low_priority;
+}
+
+inline uint64_t
+Config::recompress_rate_limit() const
+{
+  return m_recompress_rate_limit;
+}
+
+inline bool
+Config::regenerate_depfiles() const
+{
+  return m_regenerate_depfiles;
+}
+
 inline bool
 Config::run_second_cpp() const
 {
   return m_run_second_cpp;
 }
 
+inline const std::string&
+Config::secondary_storage() const
+{
+  return m_secondary_storage;
+}
+
+inline uint32_t
+Config::secondary_storage_miss_ttl() const
+{
+  return m_secondary_storage_miss_ttl;
+}
+
+inline uint32_t
+Config::secondary_storage_timeout() const
+{
+  return m_secondary_storage_timeout;
+}
+
+inline const std::string&
+Config::session() const
+{
+  return m_session;
+}
+
+inline bool
+Config::shared_stats() const
+{
+  return m_shared_stats;
+}
+
 inline uint32_t
 Config::sloppiness() const
 {
   return m_sloppiness;
 }
 
+inline uint32_t
+Config::speculative_compile_delay() const
+{
+  return m_speculative_compile_delay;
+}
+
+inline bool
+Config::speculative_cpp() const
+{
+  return m_speculative_cpp;
+}
+
+inline bool
+Config::split_arch() const
+{
+  return m_split_arch;
+}
+
+inline uint32_t
+Config::split_source_jobs() const
+{
+  return m_split_source_jobs;
+}
+
+inline bool
+Config::split_sources() const
+{
+  return m_split_sources;
+}
+
 inline bool
 Config::stats() const
 {
   return m_stats;
 }
 
+inline const std::string&
+Config::stats_breakdown() const
+{
+  return m_stats_breakdown;
+}
+
+inline bool
+Config::stream_compression() const
+{
+  return m_stream_compression;
+}
+
+inline const std::string&
+Config::stripe_dirs() const
+{
+  return m_stripe_dirs;
+}
+
+inline const std::string&
+Config::system_include_roots() const
+{
+  return m_system_include_roots;
+}
+
 inline const std::string&
 Config::temporary_dir() const
 {
   return m_temporary_dir;
 }
 
+inline const std::string&
+Config::trace_file() const
+{
+  return m_trace_file;
+}
+
+inline double
+Config::trace_sample_rate() const
+{
+  return m_trace_sample_rate;
+}
+
+inline bool
+Config::trust_scrubbed_entries() const
+{
+  return m_trust_scrubbed_entries;
+}
+
 inline uint32_t
 Config::umask() const
 {
   return m_umask;
 }
 
+inline bool
+Config::write_behind() const
+{
+  return m_write_behind;
+}
+
 inline void
 Config::set_base_dir(const std::string& value)
 {
@@ -420,6 +1002,12 @@ Config::set_cache_dir(const std::string& value)
   }
 }
 
+inline void
+Config::set_cache_preprocessing(bool value)
+{
+  m_cache_preprocessing = value;
+}
+
 inline void
 Config::set_cpp_extension(const std::string& value)
 {
@@ -462,12 +1050,36 @@ Config::set_ignore_options(const std::string& value)
   m_ignore_options = value;
 }
 
+inline void
+Config::set_include_file_jobs(uint32_t value)
+{
+  m_include_file_jobs = value;
+}
+
 inline void
 Config::set_inode_cache(bool value)
 {
   m_inode_cache = value;
 }
 
+inline void
+Config::set_inode_cache_dir(const std::string& value)
+{
+  m_inode_cache_dir = value;
+}
+
+inline void
+Config::set_inode_cache_entries(uint32_t value)
+{
+  m_inode_cache_entries = value;
+}
+
+inline void
+Config::set_inode_cache_immutable_dirs(const std::string& value)
+{
+  m_inode_cache_immutable_dirs = value;
+}
+
 inline void
 Config::set_max_files(uint64_t value)
 {
@@ -480,8 +1092,20 @@ Config::set_max_size(uint64_t value)
   m_max_size = value;
 }
 
+inline void
+Config::set_read_only_direct(bool value)
+{
+  m_read_only_direct = value;
+}
+
 inline void
 Config::set_run_second_cpp(bool value)
 {
   m_run_second_cpp = value;
 }
+
+inline void
+Config::set_secondary_storage(const std::string& value)
+{
+  m_secondary_storage = value;
+}
@@ -18,25 +18,42 @@
 
 #include "Context.hpp"
 
+#include "BackgroundCompressor.hpp"
 #include "Counters.hpp"
 #include "Logging.hpp"
 #include "SignalHandler.hpp"
+#include "Stat.hpp"
+#include "StdMakeUnique.hpp"
+#include "ThreadPool.hpp"
 #include "Util.hpp"
+#include "fmtmacros.hpp"
 #include "hashutil.hpp"
 
+#ifdef HAVE_MEMFD_CREATE
+#  include <sys/mman.h>
+#endif
+
 #include <algorithm>
 #include <string>
+#include <thread>
 #include <vector>
 
 using nonstd::string_view;
 
+// More threads than this rarely help when reading include files, not even with
+// a cold page cache.
+const size_t k_max_include_file_threads = 8;
+
 Context::Context()
   : actual_cwd(Util::get_actual_cwd()),
     apparent_cwd(Util::get_apparent_cwd(actual_cwd))
 #ifdef INODE_CACHE_SUPPORTED
     ,
-    inode_cache(config)
+    inode_cache(config, &stat_cache)
 #endif
+    ,
+    digest_memo(config),
+    storage(config)
 {
 }
 
@@ -45,6 +62,33 @@ Context::~Context()
   unlink_pending_tmp_files();
 }
 
+size_t
+Context::include_file_threads() const
+{
+  if (config.include_file_jobs() != 0) {
+    return config.include_file_jobs();
+  }
+  return std::min<size_t>(std::thread::hardware_concurrency(),
+                          k_max_include_file_threads);
+}
+
+ThreadPool&
+Context::include_file_thread_pool() const
+{
+  if (!m_include_file_thread_pool) {
+    // The calling thread also takes part in the hashing.
+    m_include_file_thread_pool = std::make_unique<ThreadPool>(
+      std::max<size_t>(include_file_threads(), 1) - 1);
+  }
+  return *m_include_file_thread_pool;
+}
+
+void
+Context::shut_down_include_file_thread_pool()
+{
+  m_include_file_thread_pool.reset();
+}
+
 void
 Context::register_pending_tmp_file(const std::string& path)
 {
@@ -53,6 +97,31 @@ Context::register_pending_tmp_file(const std::string& path)
   m_pending_tmp_files.push_back(path);
 }
 
+TemporaryFile
+Context::create_transient_file(const std::string& path_prefix)
+{
+#ifdef HAVE_MEMFD_CREATE
+  Fd memfd(memfd_create(std::string(Util::base_name(path_prefix)).c_str(),
+                        MFD_CLOEXEC));
+  if (memfd) {
+    const auto path = FMT("/proc/self/fd/{}", *memfd);
+    // The file descriptor of the returned TemporaryFile is typically consumed
+    // by `execute`, so hand out a duplicate.
+    Fd fd(dup(*memfd));
+    if (fd && Stat::stat(path)) {
+      Util::set_cloexec_flag(*fd);
+      m_transient_files.push_back(std::move(memfd));
+      return TemporaryFile(std::move(fd), path);
+    }
+  }
+  LOG("Failed to create in-memory file: {}", strerror(errno));
+#endif
+
+  TemporaryFile tmp_file(path_prefix);
+  register_pending_tmp_file(tmp_file.path);
+  return tmp_file;
+}
+
 void
 Context::unlink_pending_tmp_files_signal_safe()
 {
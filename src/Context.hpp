@@ -20,13 +20,22 @@
 
 #include "system.hpp"
 
+#include "Arena.hpp"
 #include "Args.hpp"
 #include "ArgsInfo.hpp"
 #include "Config.hpp"
 #include "Digest.hpp"
+#include "DigestMemo.hpp"
+#include "EventLog.hpp"
 #include "File.hpp"
+#include "GitIndex.hpp"
+#include "Manifest.hpp"
 #include "MiniTrace.hpp"
 #include "NonCopyable.hpp"
+#include "PathPrefixSet.hpp"
+#include "StatCache.hpp"
+#include "Storage.hpp"
+#include "TemporaryFile.hpp"
 #include "ccache.hpp"
 
 #ifdef INODE_CACHE_SUPPORTED
@@ -36,11 +45,16 @@
 #include "third_party/nonstd/optional.hpp"
 #include "third_party/nonstd/string_view.hpp"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+class BackgroundCompressor;
+class Hash;
 class SignalHandler;
+class ThreadPool;
 
 class Context : NonCopyable
 {
@@ -78,8 +92,29 @@ public:
   // compilation.
   time_t time_of_compilation = 0;
 
-  // Files included by the preprocessor and their hashes.
-  std::unordered_map<std::string, Digest> included_files;
+  // Time in milliseconds that the real compiler took, recorded as the cost of
+  // the stored cache entries for cost-aware cleanup and in the stored result.
+  uint64_t compiler_duration_ms = 0;
+
+  // Storage for strings that live as long as the context, e.g. the include
+  // file paths below.
+  Arena arena;
+
+  // Files included by the preprocessor and their hashes. Paths are stored in
+  // arena.
+  std::unordered_map<nonstd::string_view, Digest, StringViewHash>
+    included_files;
+
+  // Include files of the manifest entry that gave the result name in the direct
+  // mode, used to regenerate a dependency file that the result doesn't store.
+  nonstd::optional<std::vector<std::string>> manifest_included_files;
+
+  // Included files that are yet to be hashed and added to included_files, in
+  // the order they were found, and the depend mode hash to update. Paths are
+  // stored in arena.
+  std::vector<std::pair<nonstd::string_view, Hash*>> pending_include_files;
+  std::unordered_set<nonstd::string_view, StringViewHash>
+    pending_include_file_paths;
 
   // Uses absolute path for some include files.
   bool has_absolute_include_headers = false;
@@ -87,6 +122,22 @@ public:
   // Have we tried and failed to get colored diagnostics?
   bool diagnostics_color_failed = false;
 
+  // Exit status of a failed compilation retrieved from the cache, if any.
+  nonstd::optional<int> cached_exit_status;
+
+  // Digest of the options that only affect diagnostics and were left out of
+  // the result name, if ignore_warning_options applies to the compilation.
+  nonstd::optional<Digest> warning_options_digest;
+
+  // Arguments for checking the syntax of the input file, which regenerates the
+  // diagnostics of a result stored for other warning options. Only set if
+  // ignore_warning_options applies to the compilation.
+  Args syntax_check_args;
+
+  // Time in milliseconds that the real compiler took to produce the result
+  // retrieved from the cache, or 0 if unknown.
+  uint64_t cached_compiler_duration_ms = 0;
+
   // The name of the temporary preprocessed file.
   std::string i_tmpfile;
 
@@ -97,13 +148,50 @@ public:
   std::string included_pch_file;
 
   // Headers (or directories with headers) to ignore in manifest mode.
-  std::vector<std::string> ignore_header_paths;
+  PathPrefixSet ignore_header_paths;
+
+  // Roots from the `system_include_roots` setting. Include files below them are
+  // not recorded in the manifest since the roots are fingerprinted instead.
+  PathPrefixSet system_include_roots;
+
+  // Stat results of include files and other files that shouldn't change
+  // during the compilation.
+  StatCache stat_cache;
+
+  // Digests of include files hashed while verifying the manifest, reused when
+  // hashing the include files found by the preprocessor after a direct mode
+  // miss if the files still match their stat results in stat_cache. Mutable
+  // since it's filled in code that otherwise only reads the context.
+  mutable std::unordered_map<std::string, Digest> verified_include_digests;
+
+  // The manifest read by a direct mode lookup that missed, reused when adding
+  // the new result to it. Mutable for the same reason.
+  mutable Manifest::Snapshot manifest_snapshot;
+
+  // Content digests of files listed in the `digest_map` file, keyed by
+  // normalized absolute path. Files found here are not read when hashed.
+  std::unordered_map<std::string, std::string> digest_map;
 
 #ifdef INODE_CACHE_SUPPORTED
   // InodeCache that caches source file hashes when enabled.
   mutable InodeCache inode_cache;
 #endif
 
+  // Index of the git repository containing the current directory if git_index
+  // is enabled, used to find inode cache entries by blob id.
+  std::unique_ptr<GitIndex> git_index;
+
+  // Relative forms of absolute directories computed by
+  // Util::make_relative_path. Mutable since the cache is filled in code that
+  // otherwise only reads the context.
+  mutable std::unordered_map<std::string, std::string> relative_dir_cache;
+
+  // Persistent memo of expensive digests, e.g. compiler identification.
+  DigestMemo digest_memo;
+
+  // Access to cache entries in primary and secondary storage.
+  Storage storage;
+
   // Statistics updates which get written into the statistics file belonging to
   // the result.
   Counters counter_updates;
@@ -112,10 +200,28 @@ public:
   // the manifest.
   Counters manifest_counter_updates;
 
+  // Cache bookkeeping amounts to subtract from the statistics file belonging to
+  // the result, e.g. for stale raw files removed when storing it. Kept apart
+  // from `counter_updates` since counters can't go below zero.
+  Counters counter_decrements;
+
+  // Phase duration histograms (see Statistics::PhaseTimer), added to
+  // counter_updates when finalizing. Mutable since phases are timed in code
+  // that otherwise only reads the context.
+  mutable Counters phase_durations;
+
+  // Measurements for the event log. Mutable since they are collected in code
+  // that otherwise only reads the context.
+  mutable EventLog::Invocation invocation;
+
   // PID of currently executing compiler that we have started, if any. 0 means
   // no ongoing compilation.
   pid_t compiler_pid = 0;
 
+  // Compressor of the object file while the compiler writes it, if
+  // stream_compression is enabled.
+  std::unique_ptr<BackgroundCompressor> background_compressor;
+
   // Files used by the hash debugging functionality.
   std::vector<File> hash_debug_files;
 
@@ -137,9 +243,30 @@ public:
   void set_result_name(const Digest& name);
   void set_result_path(const std::string& path);
 
+  // Number of threads, including the calling thread, to hash include files
+  // with.
+  size_t include_file_threads() const;
+
+  // Worker threads for hashing include files, shared by the manifest
+  // verification and hash_pending_include_files so that they are started at
+  // most once per invocation. The workers don't hold jobserver tokens, so
+  // users must acquire tokens for the workers they use. Created on first use.
+  ThreadPool& include_file_thread_pool() const;
+
+  // Stop the worker threads before forking a process that continues without
+  // them.
+  void shut_down_include_file_thread_pool();
+
   // Register a temporary file to remove at program exit.
   void register_pending_tmp_file(const std::string& path);
 
+  // Create a temporary file for output that is only read by this process and
+  // its forked children. If supported, the file only lives in memory and its
+  // path refers to it via /proc/self/fd, so it never touches the temporary
+  // directory and needs no removal. Otherwise a TemporaryFile based on
+  // `path_prefix` is created and registered for removal.
+  TemporaryFile create_transient_file(const std::string& path_prefix);
+
 private:
   nonstd::optional<Digest> m_manifest_name;
   nonstd::optional<std::string> m_manifest_path;
@@ -150,6 +277,11 @@ private:
   // Options to ignore for the hash.
   std::vector<std::string> m_ignore_options;
 
+  mutable std::unique_ptr<ThreadPool> m_include_file_thread_pool;
+
+  // Keep the in-memory files created by create_transient_file alive.
+  std::vector<Fd> m_transient_files;
+
   // [Start of variables touched by the signal handler]
 
   // Temporary files to remove at program exit.
@@ -21,10 +21,18 @@
 #include "NullDecompressor.hpp"
 #include "StdMakeUnique.hpp"
 #include "ZstdDecompressor.hpp"
+#include "ZstdDictionary.hpp"
 #include "assertions.hpp"
+#include "exceptions.hpp"
+
+#ifdef HAVE_LZ4
+#  include "Lz4Decompressor.hpp"
+#endif
 
 std::unique_ptr<Decompressor>
-Decompressor::create_from_type(Compression::Type type, FILE* stream)
+Decompressor::create_from_type(Compression::Type type,
+                               FILE* stream,
+                               uint32_t dictionary_id)
 {
   switch (type) {
   case Compression::Type::none:
@@ -32,6 +40,17 @@ Decompressor::create_from_type(Compression::Type type, FILE* stream)
 
   case Compression::Type::zstd:
     return std::make_unique<ZstdDecompressor>(stream);
+
+  case Compression::Type::zstd_with_dictionary:
+    return std::make_unique<ZstdDecompressor>(
+      stream, *ZstdDictionary::load(dictionary_id));
+
+  case Compression::Type::lz4:
+#ifdef HAVE_LZ4
+    return std::make_unique<Lz4Decompressor>(stream);
+#else
+    throw Error("LZ4 support not compiled in");
+#endif
   }
 
   ASSERT(false);
@@ -34,8 +34,10 @@ public:
   // Parameters:
   // - type: The type.
   // - stream: The stream to read from.
-  static std::unique_ptr<Decompressor> create_from_type(Compression::Type type,
-                                                        FILE* stream);
+  // - dictionary_id: ID of the dictionary to use for
+  //   Compression::Type::zstd_with_dictionary.
+  static std::unique_ptr<Decompressor> create_from_type(
+    Compression::Type type, FILE* stream, uint32_t dictionary_id = 0);
 
   // Read data into a buffer from the compressed stream.
   //
@@ -23,12 +23,67 @@
 #include "Logging.hpp"
 #include "assertions.hpp"
 
+#include <algorithm>
+
 static inline bool
-is_blank(const std::string& s)
+is_blank(nonstd::string_view s)
 {
   return std::all_of(s.begin(), s.end(), [](char c) { return isspace(c); });
 }
 
+static inline bool
+is_path_separator(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Targets and prerequisites of a rule.
+using Rule = std::pair<std::vector<std::string>, std::vector<std::string>>;
+
+// Parse `file_content` into rules with the prerequisites after the first one
+// sorted, and sort the rules.
+static std::vector<Rule>
+parse_rules(nonstd::string_view file_content)
+{
+  std::vector<Rule> rules;
+  size_t start = 0;
+  while (start < file_content.size()) {
+    // A rule ends at the first newline not preceded by a backslash.
+    size_t end = start;
+    while (end < file_content.size()
+           && (file_content[end] != '\n'
+               || (end > start && file_content[end - 1] == '\\'))) {
+      ++end;
+    }
+
+    Rule rule;
+    bool in_targets = true;
+    Depfile::for_each_token(
+      file_content.substr(start, end - start), [&](nonstd::string_view token) {
+        if (!in_targets) {
+          rule.second.emplace_back(token.data(), token.size());
+        } else if (token.back() == ':') {
+          in_targets = false;
+          if (token.size() > 1) {
+            rule.first.emplace_back(token.data(), token.size() - 1);
+          }
+        } else {
+          rule.first.emplace_back(token.data(), token.size());
+        }
+      });
+    if (!rule.first.empty() || !rule.second.empty()) {
+      std::sort(rule.first.begin(), rule.first.end());
+      if (!rule.second.empty()) {
+        std::sort(rule.second.begin() + 1, rule.second.end());
+      }
+      rules.push_back(std::move(rule));
+    }
+    start = end + 1;
+  }
+  std::sort(rules.begin(), rules.end());
+  return rules;
+}
+
 namespace Depfile {
 
 std::string
@@ -65,37 +120,42 @@ rewrite_paths(const Context& ctx, const std::string& file_content)
     return nonstd::nullopt;
   }
 
+  // The adjusted content is only built once a path has actually been
+  // rewritten. Content before copied_pos has already been handled.
   std::string adjusted_file_content;
-  adjusted_file_content.reserve(file_content.size());
-
   bool content_rewritten = false;
-  for (const auto& line : Util::split_into_views(file_content, "\n")) {
-    const auto tokens = Util::split_into_views(line, " \t");
-    for (size_t i = 0; i < tokens.size(); ++i) {
-      DEBUG_ASSERT(line.length() > 0); // line.empty() -> no tokens
-      if (i > 0 || line[0] == ' ' || line[0] == '\t') {
-        adjusted_file_content.push_back(' ');
-      }
+  size_t copied_pos = 0;
 
-      const auto& token = tokens[i];
-      bool token_rewritten = false;
-      if (Util::is_absolute_path(token)) {
-        const auto new_path = Util::make_relative_path(ctx, token);
-        if (new_path != token) {
-          adjusted_file_content.append(new_path);
-          token_rewritten = true;
-        }
-      }
-      if (token_rewritten) {
-        content_rewritten = true;
-      } else {
-        adjusted_file_content.append(token.begin(), token.end());
-      }
+  const size_t length = file_content.size();
+  size_t p = 0;
+  while (p < length) {
+    while (p < length && is_path_separator(file_content[p])) {
+      ++p;
+    }
+    const size_t start = p;
+    while (p < length && !is_path_separator(file_content[p])) {
+      ++p;
+    }
+
+    const nonstd::string_view token(file_content.data() + start, p - start);
+    if (token.empty() || !Util::is_absolute_path(token)) {
+      continue;
+    }
+    const auto new_path = Util::make_relative_path(ctx, token);
+    if (new_path == token) {
+      continue;
     }
-    adjusted_file_content.push_back('\n');
+    if (!content_rewritten) {
+      adjusted_file_content.reserve(file_content.size());
+      content_rewritten = true;
+    }
+    adjusted_file_content.append(file_content, copied_pos, start - copied_pos);
+    adjusted_file_content.append(new_path);
+    copied_pos = p;
   }
 
   if (content_rewritten) {
+    adjusted_file_content.append(file_content, copied_pos, std::string::npos);
     return adjusted_file_content;
   } else {
     return nonstd::nullopt;
@@ -132,77 +192,121 @@ make_paths_relative_in_output_dep(const Context& ctx)
   }
 }
 
-std::vector<std::string>
-tokenize(nonstd::string_view file_content)
+void
+for_each_token(nonstd::string_view file_content,
+               const std::function<void(nonstd::string_view)>& visitor)
 {
   // A dependency file uses Makefile syntax. This is not perfect parser but
   // should be enough for parsing a regular dependency file.
 
-  std::vector<std::string> result;
   const size_t length = file_content.size();
-  std::string token;
+  // Unescaped form of the current token, only used if the token contains
+  // escape sequences. Other tokens are passed as views into file_content.
+  std::string unescaped;
   size_t p = 0;
 
   while (p < length) {
     // Each token is separated by whitespace.
-    if (isspace(file_content[p])) {
-      while (p < length && isspace(file_content[p])) {
-        ++p;
-      }
-      if (!is_blank(token)) {
-        result.push_back(token);
-      }
-      token.clear();
-      continue;
+    while (p < length && isspace(file_content[p])) {
+      ++p;
+    }
+    if (p == length) {
+      break;
     }
 
-    char c = file_content[p];
-    switch (c) {
-    case '\\':
-      if (p + 1 < length) {
-        const char next = file_content[p + 1];
-        switch (next) {
-        // A backspace followed by any of the below characters leaves the
-        // character as is.
-        case '\\':
-        case '#':
-        case ':':
-        case ' ':
-        case '\t':
-          c = next;
-          ++p;
-          break;
-        // Backslash followed by newline is interpreted like a space, so simply
-        // the backslash.
-        case '\n':
-          ++p;
-          continue;
+    const size_t start = p;
+    bool escaped = false;
+    while (p < length && !isspace(file_content[p])) {
+      char c = file_content[p];
+      size_t skip = 1;
+      bool keep = true;
+      switch (c) {
+      case '\\':
+        if (p + 1 < length) {
+          const char next = file_content[p + 1];
+          switch (next) {
+          // A backspace followed by any of the below characters leaves the
+          // character as is.
+          case '\\':
+          case '#':
+          case ':':
+          case ' ':
+          case '\t':
+            c = next;
+            skip = 2;
+            break;
+          // Backslash followed by newline is interpreted like a space, so
+          // simply drop the backslash.
+          case '\n':
+            keep = false;
+            break;
+          }
         }
-      }
-      break;
-    case '$':
-      if (p + 1 < length) {
-        const char next = file_content[p + 1];
-        switch (next) {
+        break;
+      case '$':
         // A dollar sign preceded by a dollar sign escapes the dollar sign.
-        case '$':
-          c = next;
-          ++p;
-          break;
+        if (p + 1 < length && file_content[p + 1] == '$') {
+          skip = 2;
         }
+        break;
       }
-      break;
+
+      if (!escaped && (skip > 1 || !keep)) {
+        escaped = true;
+        unescaped.assign(file_content.data() + start, p - start);
+      }
+      if (escaped && keep) {
+        unescaped.push_back(c);
+      }
+      p += skip;
     }
 
-    token.push_back(c);
-    ++p;
+    const auto token = escaped ? nonstd::string_view(unescaped)
+                               : file_content.substr(start, p - start);
+    if (!is_blank(token)) {
+      visitor(token);
+    }
   }
+}
 
-  if (!is_blank(token)) {
-    result.push_back(token);
-  }
+std::vector<std::string>
+tokenize(nonstd::string_view file_content)
+{
+  std::vector<std::string> result;
+  for_each_token(file_content, [&](nonstd::string_view token) {
+    result.emplace_back(token.data(), token.size());
+  });
+  return result;
+}
 
+std::string
+generate(nonstd::string_view target,
+         nonstd::string_view source,
+         const std::vector<std::string>& headers,
+         bool phony_targets)
+{
+  std::string result = escape_filename(target);
+  result += ": ";
+  result += escape_filename(source);
+  for (const auto& header : headers) {
+    result += " \\\n ";
+    result += escape_filename(header);
+  }
+  result += '\n';
+  if (phony_targets) {
+    for (const auto& header : headers) {
+      result += '\n';
+      result += escape_filename(header);
+      result += ":\n";
+    }
+  }
   return result;
 }
 
+bool
+is_equivalent(nonstd::string_view a, nonstd::string_view b)
+{
+  return parse_rules(a) == parse_rules(b);
+}
+
 } // namespace Depfile
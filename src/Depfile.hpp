@@ -24,6 +24,7 @@ class Hash;
 #include "third_party/nonstd/optional.hpp"
 #include "third_party/nonstd/string_view.hpp"
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -33,6 +34,24 @@ std::string escape_filename(nonstd::string_view filename);
 nonstd::optional<std::string> rewrite_paths(const Context& ctx,
                                             const std::string& file_content);
 void make_paths_relative_in_output_dep(const Context& ctx);
+
+// Call `visitor` with each unescaped token in `file_content`. The token view
+// is only valid during the call.
+void for_each_token(nonstd::string_view file_content,
+                    const std::function<void(nonstd::string_view)>& visitor);
+
 std::vector<std::string> tokenize(nonstd::string_view file_content);
 
+// Return the content of a dependency file with a rule that makes `target`
+// depend on `source` and `headers`, plus an empty rule for each header if
+// `phony_targets` is true (like the -MP option does).
+std::string generate(nonstd::string_view target,
+                     nonstd::string_view source,
+                     const std::vector<std::string>& headers,
+                     bool phony_targets);
+
+// Return whether dependency file contents `a` and `b` have the same rules,
+// disregarding the order of rules and of prerequisites except the first one.
+bool is_equivalent(nonstd::string_view a, nonstd::string_view b);
+
 } // namespace Depfile
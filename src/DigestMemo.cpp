@@ -0,0 +1,161 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "DigestMemo.hpp"
+
+#include "AtomicFile.hpp"
+#include "Config.hpp"
+#include "Hash.hpp"
+#include "Logging.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+using nonstd::nullopt;
+using nonstd::optional;
+
+namespace {
+
+// Version of the memo key format. Increment to invalidate all memo entries.
+const uint8_t k_version = 1;
+
+// Number of leading hex digits of the key that select the slot of an entry,
+// giving 4096 slots of typically less than 100 bytes.
+const size_t k_slot_digits = 3;
+
+} // namespace
+
+DigestMemo::DigestMemo(const Config& config) : m_config(config)
+{
+}
+
+optional<Digest>
+DigestMemo::get(const Digest& key) const
+{
+  const auto data = get_data(key);
+  if (!data) {
+    return nullopt;
+  }
+
+  Digest value;
+  if (data->size() != Digest::size()) {
+    LOG("Ignoring truncated digest memo {}", get_path(key));
+    return nullopt;
+  }
+  memcpy(value.bytes(), data->data(), Digest::size());
+  return value;
+}
+
+void
+DigestMemo::put(const Digest& key, const Digest& value) const
+{
+  put_data(key,
+           nonstd::string_view(reinterpret_cast<const char*>(value.bytes()),
+                               Digest::size()));
+}
+
+optional<std::string>
+DigestMemo::get_data(const Digest& key) const
+{
+  std::string slot;
+  try {
+    slot = Util::read_file(get_path(key));
+  } catch (const Error&) {
+    return nullopt;
+  }
+  // The slot may hold the entry of another key.
+  if (slot.size() < Digest::size()
+      || memcmp(slot.data(), key.bytes(), Digest::size()) != 0) {
+    return nullopt;
+  }
+  return slot.substr(Digest::size());
+}
+
+void
+DigestMemo::put_data(const Digest& key, nonstd::string_view data) const
+{
+  if (m_config.read_only()) {
+    return;
+  }
+
+  const auto path = get_path(key);
+  try {
+    Util::ensure_dir_exists(get_dir());
+    AtomicFile file(path, AtomicFile::Mode::binary);
+    std::string slot(reinterpret_cast<const char*>(key.bytes()),
+                     Digest::size());
+    slot.append(data.data(), data.size());
+    file.write(slot);
+    file.commit();
+  } catch (const ErrorBase& e) {
+    LOG("Failed to write digest memo {}: {}", path, e.what());
+  }
+}
+
+bool
+DigestMemo::hash_file_identity(Hash& hash,
+                               const std::string& path,
+                               const Stat& stat)
+{
+  hash.hash_delimiter("file_identity");
+  hash.hash(k_version);
+  hash.hash(path);
+  hash.hash(stat.device());
+  hash.hash(stat.inode());
+  hash.hash(stat.size());
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  hash.hash(stat.mtim().tv_sec);
+  hash.hash(stat.mtim().tv_nsec);
+#else
+  hash.hash(stat.mtime());
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM
+  hash.hash(stat.ctim().tv_sec);
+  hash.hash(stat.ctim().tv_nsec);
+#else
+  hash.hash(stat.ctime());
+#endif
+
+  // A file modified during the same second as the stat call could be modified
+  // again without changing its identity on file systems with coarse
+  // timestamps.
+  return stat.mtime() < time(nullptr);
+}
+
+void
+DigestMemo::clear() const
+{
+  try {
+    Util::wipe_path(get_dir());
+  } catch (const Error& e) {
+    LOG("Failed to remove digest memos: {}", e.what());
+  }
+}
+
+std::string
+DigestMemo::get_dir() const
+{
+  return FMT("{}/memo", m_config.cache_dir());
+}
+
+std::string
+DigestMemo::get_path(const Digest& key) const
+{
+  return FMT("{}/{}", get_dir(), key.to_string().substr(0, k_slot_digits));
+}
@@ -0,0 +1,73 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+class Config;
+class Hash;
+class Stat;
+
+// A persistent memo of digests that are expensive to compute, stored as small
+// files in <cache_dir>/memo. A memo entry maps a key digest, which must capture
+// everything that the memoized digest depends on, to a value digest.
+//
+// The memo has a fixed number of slots (files) selected by the key, so it
+// doesn't grow without bound. An entry replaces the entry of another key in
+// the same slot, which is then simply computed again when needed.
+class DigestMemo
+{
+public:
+  DigestMemo(const Config& config);
+
+  // Get the digest previously memoized for `key`, if any.
+  nonstd::optional<Digest> get(const Digest& key) const;
+
+  // Memoize `value` for `key`. Does nothing in read-only mode.
+  void put(const Digest& key, const Digest& value) const;
+
+  // Like get and put but for arbitrary data.
+  nonstd::optional<std::string> get_data(const Digest& key) const;
+  void put_data(const Digest& key, nonstd::string_view data) const;
+
+  // Add the identity (path, device, inode, size, mtime and ctime) of a file
+  // with stat result `stat` to `hash`.
+  //
+  // Returns false if the file is too new for its identity to be trusted (it
+  // could still be modified without changing the timestamps), in which case
+  // digests depending on it should not be memoized.
+  static bool
+  hash_file_identity(Hash& hash, const std::string& path, const Stat& stat);
+
+  // Remove all memoized digests.
+  void clear() const;
+
+private:
+  const Config& m_config;
+
+  std::string get_dir() const;
+  std::string get_path(const Digest& key) const;
+};
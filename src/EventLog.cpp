@@ -0,0 +1,152 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "EventLog.hpp"
+
+#include "Context.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Statistics.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#ifndef _WIN32
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#endif
+
+using nonstd::string_view;
+
+namespace {
+
+const string_view k_socket_prefix = "unix:";
+
+std::string
+format_event(const Context& ctx, const std::string& result)
+{
+  const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - ctx.invocation.start);
+  const uint64_t include_files = ctx.invocation.include_files != 0
+                                   ? ctx.invocation.include_files
+                                   : ctx.included_files.size();
+  const auto& usage = ctx.invocation.compiler_usage;
+
+  return FMT(
+    "{{\"time\":{},\"pid\":{},\"cwd\":\"{}\",\"input_file\":\"{}\","
+    "\"output_file\":\"{}\",\"result\":\"{}\",\"duration_us\":{},"
+    "\"include_files\":{},\"manifest_entries_scanned\":{},"
+    "\"bytes_retrieved\":{},\"bytes_stored\":{},\"compressed_size\":{},"
+    "\"result_name\":\"{}\",\"compiler_duration_ms\":{},"
+    "\"compiler_cpu_us\":{},\"compiler_max_rss_kib\":{},"
+    "\"compiler_blocks_read\":{},\"compiler_blocks_written\":{}}}\n",
+    time(nullptr),
+    getpid(),
+    Util::escape_json(ctx.apparent_cwd),
+    Util::escape_json(ctx.args_info.input_file),
+    Util::escape_json(ctx.args_info.output_obj),
+    result,
+    duration.count(),
+    include_files,
+    ctx.invocation.manifest_entries_scanned,
+    ctx.invocation.bytes_retrieved,
+    ctx.invocation.bytes_stored,
+    ctx.invocation.compressed_size,
+    ctx.result_name() ? ctx.result_name()->to_string() : "",
+    ctx.compiler_duration_ms != 0 ? ctx.compiler_duration_ms
+                                  : ctx.cached_compiler_duration_ms,
+    usage.cpu_time_us,
+    usage.max_rss_kib,
+    usage.blocks_read,
+    usage.blocks_written);
+}
+
+void
+send_to_socket(const std::string& socket_path, const std::string& event)
+{
+#ifndef _WIN32
+  sockaddr_un address{};
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    throw Error("Socket path {} is too long", socket_path);
+  }
+  address.sun_family = AF_UNIX;
+  memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+  Fd fd(socket(AF_UNIX, SOCK_DGRAM, 0));
+  if (!fd) {
+    throw Error("Failed to create socket: {}", strerror(errno));
+  }
+  // Don't wait for a slow receiver; dropping the event is preferable.
+  if (sendto(*fd,
+             event.data(),
+             event.size(),
+             MSG_DONTWAIT,
+             reinterpret_cast<const sockaddr*>(&address),
+             sizeof(address))
+      < 0) {
+    throw Error("Failed to send to {}: {}", socket_path, strerror(errno));
+  }
+#else
+  (void)event;
+  throw Error("Unix sockets are not supported: {}", socket_path);
+#endif
+}
+
+void
+append_to_file(const std::string& path, const std::string& event)
+{
+  Fd fd(open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0666));
+  if (!fd) {
+    throw Error("Failed to open {}: {}", path, strerror(errno));
+  }
+  // A single write with O_APPEND keeps events of concurrent invocations from
+  // being interleaved.
+  Util::write_fd(*fd, event.data(), event.size());
+}
+
+} // namespace
+
+namespace EventLog {
+
+void
+write(const Context& ctx)
+{
+  const auto& event_log = ctx.config.event_log();
+  if (event_log.empty()) {
+    return;
+  }
+  const auto result = Statistics::get_result_id(ctx.counter_updates);
+  if (!result) {
+    return;
+  }
+
+  const auto event = format_event(ctx, *result);
+  try {
+    if (Util::starts_with(event_log, k_socket_prefix)) {
+      send_to_socket(event_log.substr(k_socket_prefix.size()), event);
+    } else {
+      append_to_file(event_log, event);
+    }
+  } catch (const Error& e) {
+    LOG("Failed to write event log: {}", e.what());
+  }
+}
+
+} // namespace EventLog
@@ -0,0 +1,58 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "execute.hpp"
+
+#include <chrono>
+
+class Context;
+
+// Per-compilation events for offline analysis of the cache, enabled with the
+// event_log option. One JSON object per invocation is appended to a file or
+// sent to a Unix datagram socket when the invocation finishes.
+namespace EventLog {
+
+// Measurements of an invocation that aren't in the statistics counters.
+struct Invocation
+{
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  // Include files of the result found in the manifest, if any.
+  uint32_t include_files = 0;
+
+  uint32_t manifest_entries_scanned = 0;
+  uint64_t bytes_retrieved = 0;
+  uint64_t bytes_stored = 0;
+
+  // Size of the result file written to the cache, if any.
+  uint64_t compressed_size = 0;
+
+  // Resources used by the compiler, if run.
+  ProcessUsage compiler_usage;
+};
+
+// Write the event of the invocation to event_log if set and the invocation has
+// a result.
+void write(const Context& ctx);
+
+} // namespace EventLog
@@ -29,6 +29,8 @@ class File : public NonCopyable
 public:
   File() = default;
   File(const std::string& path, const char* mode);
+  // Take ownership of `file`, which may be null.
+  explicit File(FILE* file);
   File(File&& other) noexcept;
   ~File();
 
@@ -50,6 +52,10 @@ inline File::File(const std::string& path, const char* mode)
   open(path, mode);
 }
 
+inline File::File(FILE* file) : m_file(file)
+{
+}
+
 inline File::File(File&& other) noexcept : m_file(other.m_file)
 {
   other.m_file = nullptr;
@@ -0,0 +1,106 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "FileStorage.hpp"
+
+#include "AtomicFile.hpp"
+#include "Logging.hpp"
+#include "Storage.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+FileStorage::FileStorage(const std::string& dir) : m_dir(dir)
+{
+}
+
+optional<std::string>
+FileStorage::get(const Digest& name, string_view suffix)
+{
+  const auto path = get_entry_path(name, suffix);
+  try {
+    auto data = Util::read_file(path);
+    Util::update_mtime(path);
+    return data;
+  } catch (const Error& e) {
+    LOG("Failed to read {}: {}", path, e.what());
+    return nullopt;
+  }
+}
+
+bool
+FileStorage::put(const Digest& name,
+                 string_view suffix,
+                 const std::string& data)
+{
+  const auto path = get_entry_path(name, suffix);
+  const auto dir = Util::dir_name(path);
+  if (!Util::create_dir(dir)) {
+    LOG("Failed to create directory {}: {}", dir, strerror(errno));
+    return false;
+  }
+  try {
+    AtomicFile file(path, AtomicFile::Mode::binary);
+    file.write(data);
+    file.commit();
+    return true;
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", path, e.what());
+    return false;
+  }
+}
+
+bool
+FileStorage::remove(const Digest& name, string_view suffix)
+{
+  return Util::unlink_safe(get_entry_path(name, suffix));
+}
+
+optional<std::string>
+FileStorage::parse_url(string_view url)
+{
+  const string_view scheme = "file:";
+  if (!Util::starts_with(url, scheme)) {
+    return nullopt;
+  }
+  auto path = url.substr(scheme.length());
+  if (Util::starts_with(path, "//")) {
+    // file://host/path is not supported, only an empty host.
+    path = path.substr(2);
+    if (!Util::starts_with(path, "/")) {
+      return nullopt;
+    }
+  }
+  while (path.length() > 1 && path.back() == '/') {
+    path.remove_suffix(1);
+  }
+  if (path.empty() || !Util::is_absolute_path(path)) {
+    return nullopt;
+  }
+  return std::string(path);
+}
+
+std::string
+FileStorage::get_entry_path(const Digest& name, string_view suffix) const
+{
+  return Util::get_path_in_cache(
+    m_dir, Storage::k_min_cache_levels, name.to_string() + std::string(suffix));
+}
@@ -0,0 +1,57 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "SecondaryStorage.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Secondary storage in a local or network-mounted directory, typically a
+// larger and slower disk behind a small cache_dir on tmpfs. Entries are stored
+// at <dir>/<n>/<n>/<name><suffix>, i.e. with the same layout as files on cache
+// level 2 in the local cache, and their mtime is updated when they are read so
+// that the directory can be pruned by age.
+class FileStorage : public SecondaryStorage
+{
+public:
+  explicit FileStorage(const std::string& dir);
+
+  nonstd::optional<std::string> get(const Digest& name,
+                                    nonstd::string_view suffix) override;
+  bool put(const Digest& name,
+           nonstd::string_view suffix,
+           const std::string& data) override;
+  bool remove(const Digest& name, nonstd::string_view suffix) override;
+
+  // Parse an URL on the form "file:/path" or "file:///path" and return the
+  // directory path without trailing slash. Returns nullopt if `url` is not
+  // such an URL or if the path is not absolute.
+  static nonstd::optional<std::string> parse_url(nonstd::string_view url);
+
+private:
+  const std::string m_dir;
+
+  std::string get_entry_path(const Digest& name,
+                             nonstd::string_view suffix) const;
+};
@@ -0,0 +1,613 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "FileWatch.hpp"
+
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include "third_party/xxhash.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#ifdef __linux__
+#  include <dirent.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/inotify.h>
+#  define FILE_WATCH_SUPPORTED
+#endif
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+const uint32_t k_version = 1;
+
+// Slots in the table of last change generations, indexed by path hash.
+const size_t k_change_slots = 1 << 16;
+
+// Slots in the open addressing set of watched directories.
+const size_t k_dir_slots = 1 << 16;
+const size_t k_max_dir_probes = 32;
+
+// Slots for acknowledged synchronization requests.
+const size_t k_ack_slots = 4096;
+
+// Slots for recorded digests, indexed by path hash. A new digest replaces the
+// previous one in the same slot.
+const size_t k_entry_slots = 1 << 15;
+
+// Maximum age in seconds of the watcher's heartbeat for the watcher to be
+// considered alive.
+const int64_t k_max_heartbeat_age = 5;
+
+// Maximum time to wait for the watcher to acknowledge a synchronization
+// request.
+const int64_t k_sync_timeout_us = 50 * 1000;
+
+// Generation of files whose content can't be tracked, e.g. symlinks.
+const uint64_t k_never = std::numeric_limits<uint64_t>::max();
+
+const size_t k_digest_words = (Digest::size() + 7) / 8;
+
+uint64_t
+path_hash(string_view path)
+{
+  const uint64_t hash = XXH3_64bits(path.data(), path.size());
+  return hash != 0 ? hash : 1;
+}
+
+string_view
+dir_name(string_view path)
+{
+  const size_t slash = path.rfind('/');
+  return slash == 0 ? path.substr(0, 1) : path.substr(0, slash);
+}
+
+} // namespace
+
+const char FileWatch::k_file_name[] = "file_watch";
+
+struct FileWatch::Region
+{
+  struct Entry
+  {
+    // Odd while the entry is being written.
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> path_hash;
+    // Generation before the file was read.
+    std::atomic<uint64_t> generation;
+    std::atomic<uint64_t> size;
+    std::atomic<uint64_t> digest[k_digest_words];
+  };
+
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  std::atomic<int64_t> heartbeat;
+  std::atomic<uint64_t> generation;
+  // Entries recorded before this generation are invalid since changes may
+  // have been missed, e.g. because of an event queue overflow.
+  std::atomic<uint64_t> valid_from;
+  std::atomic<uint64_t> sync_requested;
+  std::atomic<uint64_t> changes[k_change_slots];
+  std::atomic<uint64_t> dirs[k_dir_slots];
+  std::atomic<uint64_t> acks[k_ack_slots];
+  Entry entries[k_entry_slots];
+
+  bool
+  has_dir(string_view dir) const
+  {
+    const uint64_t hash = path_hash(dir);
+    for (size_t i = 0; i < k_max_dir_probes; ++i) {
+      const uint64_t value = dirs[(hash + i) % k_dir_slots].load();
+      if (value == hash) {
+        return true;
+      } else if (value == 0) {
+        return false;
+      }
+    }
+    return false;
+  }
+};
+
+#ifdef FILE_WATCH_SUPPORTED
+
+namespace {
+
+int64_t
+now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+} // namespace
+
+FileWatch::FileWatch(const std::string& cache_dir)
+{
+  const auto path = FMT("{}/{}", cache_dir, k_file_name);
+  if (!m_shared.map(
+        path, sizeof(Region), k_version, SharedRegion::Create::no)) {
+    return;
+  }
+  auto region = static_cast<Region*>(m_shared.data());
+  if (time(nullptr) - region->heartbeat.load() > k_max_heartbeat_age) {
+    LOG("Not using {} since no watcher is running", path);
+    m_shared.unmap();
+    return;
+  }
+
+  // Wait until the watcher has processed all events that happened before now.
+  const uint64_t request = ++region->sync_requested;
+  const auto sync_file = FMT("{}.sync/{}", path, request);
+  Fd fd(open(sync_file.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666));
+  bool synced = false;
+  if (fd) {
+    fd.close();
+    const int64_t deadline = now_us() + k_sync_timeout_us;
+    while (!(synced = region->acks[request % k_ack_slots].load() == request)
+           && now_us() < deadline) {
+      usleep(100);
+    }
+    unlink(sync_file.c_str());
+  }
+  if (!synced) {
+    LOG("Not using {} since synchronization with the watcher failed", path);
+    m_shared.unmap();
+    return;
+  }
+
+  m_generation = region->generation.load();
+  m_region = region;
+}
+
+FileWatch::~FileWatch()
+{
+}
+
+optional<FileWatch::Entry>
+FileWatch::get(const std::string& path) const
+{
+  if (!m_region || !m_region->has_dir(dir_name(path))) {
+    return nullopt;
+  }
+  const uint64_t hash = path_hash(path);
+  const auto& e = m_region->entries[hash % k_entry_slots];
+
+  const uint64_t sequence = e.sequence.load();
+  if (sequence == 0 || sequence % 2 != 0) {
+    return nullopt;
+  }
+  const uint64_t entry_hash = e.path_hash.load();
+  const uint64_t generation = e.generation.load();
+  Entry entry;
+  entry.size = e.size.load();
+  uint64_t words[k_digest_words];
+  for (size_t i = 0; i < k_digest_words; ++i) {
+    words[i] = e.digest[i].load();
+  }
+  if (e.sequence.load() != sequence || entry_hash != hash) {
+    return nullopt;
+  }
+
+  if (generation < m_region->valid_from.load()
+      || m_region->changes[hash % k_change_slots].load() > generation) {
+    return nullopt;
+  }
+  memcpy(entry.digest.bytes(), words, Digest::size());
+  return entry;
+}
+
+void
+FileWatch::put(const std::string& path, const Digest& digest, uint64_t size)
+{
+  if (!m_region || m_generation < m_region->valid_from.load()
+      || !m_region->has_dir(dir_name(path))) {
+    return;
+  }
+  const uint64_t hash = path_hash(path);
+  auto& e = m_region->entries[hash % k_entry_slots];
+
+  uint64_t sequence = e.sequence.load();
+  if (sequence % 2 != 0
+      || !e.sequence.compare_exchange_strong(sequence, sequence + 1)) {
+    // Another process is writing the entry.
+    return;
+  }
+  uint64_t words[k_digest_words] = {};
+  memcpy(words, digest.bytes(), Digest::size());
+  e.path_hash.store(hash);
+  e.generation.store(m_generation);
+  e.size.store(size);
+  for (size_t i = 0; i < k_digest_words; ++i) {
+    e.digest[i].store(words[i]);
+  }
+  e.sequence.store(sequence + 2);
+}
+
+namespace {
+
+volatile sig_atomic_t g_stop_watching = 0;
+
+void
+stop_watching(int /*signum*/)
+{
+  g_stop_watching = 1;
+}
+
+const uint32_t k_watch_mask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE
+                              | IN_DELETE | IN_DELETE_SELF | IN_MODIFY
+                              | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO;
+
+class Watcher
+{
+public:
+  Watcher(FileWatch::Region& region,
+          const std::string& cache_dir,
+          const std::vector<std::string>& roots);
+
+  void run();
+
+private:
+  FileWatch::Region& m_region;
+  const std::string m_cache_dir;
+  const std::string m_sync_dir;
+  std::vector<std::string> m_roots;
+  Fd m_fd;
+  int m_sync_wd = -1;
+  std::unordered_map<int, std::string> m_dirs;
+
+  void rebuild();
+  void add_tree(const std::string& dir, uint64_t generation);
+  void add_dir(const std::string& dir);
+  void mark_changed(const std::string& path, uint64_t generation);
+  bool handle_event(const struct inotify_event& event);
+};
+
+Watcher::Watcher(FileWatch::Region& region,
+                 const std::string& cache_dir,
+                 const std::vector<std::string>& roots)
+  : m_region(region),
+    m_cache_dir(Util::real_path(cache_dir)),
+    m_sync_dir(FMT("{}/{}.sync", cache_dir, FileWatch::k_file_name)),
+    m_fd(inotify_init1(IN_CLOEXEC))
+{
+  if (!m_fd) {
+    throw Error("failed to initialize inotify: {}", strerror(errno));
+  }
+  for (const auto& root : roots) {
+    auto real_root = Util::real_path(root);
+    if (!Stat::stat(real_root).is_directory()) {
+      throw Error("{} is not a directory", root);
+    }
+    m_roots.push_back(std::move(real_root));
+  }
+  Util::ensure_dir_exists(m_sync_dir);
+  m_sync_wd = inotify_add_watch(*m_fd, m_sync_dir.c_str(), IN_CREATE);
+  if (m_sync_wd < 0) {
+    throw Error("failed to watch {}: {}", m_sync_dir, strerror(errno));
+  }
+}
+
+void
+Watcher::rebuild()
+{
+  LOG_RAW("Rebuilding the set of watched directories");
+  m_region.valid_from.store(++m_region.generation);
+
+  for (const auto& wd_dir : m_dirs) {
+    inotify_rm_watch(*m_fd, wd_dir.first);
+  }
+  m_dirs.clear();
+  for (auto& dir : m_region.dirs) {
+    dir.store(0);
+  }
+
+  for (const auto& root : m_roots) {
+    add_tree(root, 0);
+  }
+
+  // Changes made during the traversal may have been missed.
+  m_region.valid_from.store(++m_region.generation);
+  LOG("Watching {} directories", m_dirs.size());
+}
+
+// Watch `dir` and its subdirectories. Files found are marked as changed in
+// `generation` unless it's 0.
+void
+Watcher::add_tree(const std::string& dir, uint64_t generation)
+{
+  if (dir == m_cache_dir) {
+    return;
+  }
+
+  // Start watching before reading the directory so that no change is missed.
+  const int wd =
+    inotify_add_watch(*m_fd, dir.c_str(), k_watch_mask | IN_ONLYDIR);
+  if (wd < 0) {
+    LOG("Failed to watch {}: {}", dir, strerror(errno));
+    return;
+  }
+  m_dirs[wd] = dir;
+  add_dir(dir);
+
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    LOG("Failed to read {}: {}", dir, strerror(errno));
+    return;
+  }
+  struct dirent* de;
+  while ((de = readdir(d))) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    const auto path =
+      dir == "/" ? FMT("/{}", de->d_name) : FMT("{}/{}", dir, de->d_name);
+    const auto st = Stat::lstat(path);
+    if (st.is_directory()) {
+      add_tree(path, generation);
+    } else if (st.is_symlink()) {
+      mark_changed(path, k_never);
+    } else if (generation != 0) {
+      mark_changed(path, generation);
+    }
+  }
+  closedir(d);
+}
+
+void
+Watcher::add_dir(const std::string& dir)
+{
+  const uint64_t hash = path_hash(dir);
+  for (size_t i = 0; i < k_max_dir_probes; ++i) {
+    auto& slot = m_region.dirs[(hash + i) % k_dir_slots];
+    const uint64_t value = slot.load();
+    if (value == hash) {
+      return;
+    } else if (value == 0) {
+      slot.store(hash);
+      return;
+    }
+  }
+  LOG("Too many watched directories to record {}", dir);
+}
+
+void
+Watcher::mark_changed(const std::string& path, uint64_t generation)
+{
+  auto& slot = m_region.changes[path_hash(path) % k_change_slots];
+  if (slot.load() < generation) {
+    slot.store(generation);
+  }
+}
+
+// Returns false if the watched directories need to be rebuilt.
+bool
+Watcher::handle_event(const struct inotify_event& event)
+{
+  if (event.mask & IN_Q_OVERFLOW) {
+    return false;
+  }
+
+  if (event.wd == m_sync_wd) {
+    if ((event.mask & IN_CREATE) && event.len > 0) {
+      const uint64_t request = strtoull(event.name, nullptr, 10);
+      m_region.acks[request % k_ack_slots].store(request);
+    }
+    return true;
+  }
+
+  const auto it = m_dirs.find(event.wd);
+  if (it == m_dirs.end()) {
+    // Event for a directory that is no longer watched.
+    return true;
+  }
+  if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+    return false;
+  }
+  if (event.len == 0) {
+    return true;
+  }
+
+  const auto& dir = it->second;
+  const auto path =
+    dir == "/" ? FMT("/{}", event.name) : FMT("{}/{}", dir, event.name);
+  const uint64_t generation = m_region.generation.load() + 1;
+  if (event.mask & IN_ISDIR) {
+    if (!(event.mask & IN_CREATE)) {
+      // Paths below a removed or renamed directory now refer to other files.
+      return false;
+    }
+    add_tree(path, generation);
+  } else if ((event.mask & (IN_CREATE | IN_MOVED_TO))
+             && Stat::lstat(path).is_symlink()) {
+    mark_changed(path, k_never);
+  } else {
+    mark_changed(path, generation);
+  }
+  m_region.generation.store(generation);
+  return true;
+}
+
+void
+Watcher::run()
+{
+  rebuild();
+
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  struct pollfd pfd;
+  pfd.fd = *m_fd;
+  pfd.events = POLLIN;
+  while (!g_stop_watching) {
+    m_region.heartbeat.store(time(nullptr));
+    const int ret = poll(&pfd, 1, 1000);
+    if (ret < 0 && errno != EINTR) {
+      throw Error("failed to poll inotify events: {}", strerror(errno));
+    }
+    if (ret <= 0) {
+      continue;
+    }
+    const ssize_t length = read(*m_fd, buffer, sizeof(buffer));
+    if (length < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      throw Error("failed to read inotify events: {}", strerror(errno));
+    }
+    bool needs_rebuild = false;
+    for (ssize_t offset = 0; offset < length;) {
+      const auto event =
+        reinterpret_cast<const struct inotify_event*>(buffer + offset);
+      if (!handle_event(*event)) {
+        needs_rebuild = true;
+      }
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+    if (needs_rebuild) {
+      rebuild();
+    }
+  }
+}
+
+} // namespace
+
+void
+FileWatch::watch(const std::string& cache_dir,
+                 const std::vector<std::string>& dirs)
+{
+  Util::ensure_dir_exists(cache_dir);
+  const auto path = FMT("{}/{}", cache_dir, k_file_name);
+  SharedRegion shared;
+  if (!shared.map(
+        path, sizeof(Region), k_version, SharedRegion::Create::file)) {
+    throw Error("failed to map {}", path);
+  }
+  auto& region = *static_cast<Region*>(shared.data());
+  if (time(nullptr) - region.heartbeat.load() <= k_max_heartbeat_age) {
+    throw Error("another watcher is already running for {}", cache_dir);
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop_watching;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+
+  try {
+    Watcher watcher(region, cache_dir, dirs);
+    watcher.run();
+  } catch (const Error&) {
+    region.heartbeat.store(0);
+    throw;
+  }
+
+  region.heartbeat.store(0);
+  shared.unmap();
+  unlink(path.c_str());
+  Util::wipe_path(FMT("{}.sync", path));
+}
+
+#else // FILE_WATCH_SUPPORTED
+
+FileWatch::FileWatch(const std::string& /*cache_dir*/)
+{
+}
+
+FileWatch::~FileWatch()
+{
+}
+
+optional<FileWatch::Entry>
+FileWatch::get(const std::string& /*path*/) const
+{
+  return nullopt;
+}
+
+void
+FileWatch::put(const std::string& /*path*/,
+               const Digest& /*digest*/,
+               uint64_t /*size*/)
+{
+}
+
+void
+FileWatch::watch(const std::string& /*cache_dir*/,
+                 const std::vector<std::string>& /*dirs*/)
+{
+  throw Error("watching files is only supported on Linux");
+}
+
+#endif // FILE_WATCH_SUPPORTED
+
+optional<std::string>
+FileWatch::absolute_path(string_view cwd, string_view path)
+{
+  std::string result;
+  size_t pos = 0;
+  if (Util::is_absolute_path(path)) {
+    pos = 1;
+  } else {
+    result.assign(cwd.data(), cwd.size());
+    // Leading ".." components only apply to `cwd`, which has no symlinks.
+    while (path.substr(pos, 3) == "../" || path.substr(pos, 2) == "./") {
+      if (path[pos + 1] == '.') {
+        const size_t slash = result.rfind('/');
+        if (slash == std::string::npos) {
+          return nullopt;
+        }
+        result.resize(slash == 0 ? 1 : slash);
+        pos += 3;
+      } else {
+        pos += 2;
+      }
+    }
+  }
+
+  while (pos < path.size()) {
+    size_t end = path.find('/', pos);
+    if (end == string_view::npos) {
+      end = path.size();
+    }
+    const auto component = path.substr(pos, end - pos);
+    if (component.empty() || component == "." || component == "..") {
+      return nullopt;
+    }
+    if (result.empty() || result.back() != '/') {
+      result += '/';
+    }
+    result.append(component.data(), component.size());
+    pos = end + 1;
+  }
+  if (result.empty() || result.back() == '/') {
+    return nullopt;
+  }
+  return result;
+}
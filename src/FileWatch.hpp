@@ -0,0 +1,106 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+#include "NonCopyable.hpp"
+#include "SharedRegion.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+// Knowledge about unchanged files, provided by a watcher process (`ccache
+// --watch`) that subscribes to changes in a set of directory trees with
+// inotify.
+//
+// The watcher and the ccache processes share the memory-mapped file
+// "file_watch" in the cache directory. It contains:
+//
+// - The generation, a counter that the watcher increments for each change.
+// - The generation of the last change of each file, in a table indexed by a
+//   hash of the path. Unrelated paths may share a slot, which only makes them
+//   look changed more often.
+// - The set of watched directories.
+// - Digests of files recorded by ccache processes together with the generation
+//   at the time before the file was read.
+//
+// A recorded digest is valid as long as no change to the file has been seen
+// since its generation. Before trusting the table, a ccache process
+// synchronizes with the watcher by creating a file in a directory that the
+// watcher watches and waiting for the watcher to acknowledge the event. Since
+// inotify delivers events in order, all changes made before that have then been
+// processed.
+class FileWatch : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  struct Entry
+  {
+    Digest digest;
+    uint64_t size;
+  };
+
+  // Map the file watch of `cache_dir` and synchronize with the watcher. The
+  // object is unusable if no watcher is running or if synchronization fails.
+  explicit FileWatch(const std::string& cache_dir);
+  ~FileWatch();
+
+  // Return whether the file watch can be used.
+  explicit operator bool() const;
+
+  // Return the recorded digest and size of the file at `path` if the file is
+  // known to be unchanged since they were recorded. `path` must be as returned
+  // by `absolute_path`.
+  nonstd::optional<Entry> get(const std::string& path) const;
+
+  // Record the digest and size of the file at `path`, which must have been
+  // read after this object was created. `path` must be as returned by
+  // `absolute_path`.
+  void put(const std::string& path, const Digest& digest, uint64_t size);
+
+  // Return `path` made absolute relative to `cwd` if that can be done without
+  // resolving symlinks, i.e. if `path` has no "." or ".." components except
+  // for leading ones in a relative path. `cwd` must not contain symlinks.
+  static nonstd::optional<std::string> absolute_path(nonstd::string_view cwd,
+                                                     nonstd::string_view path);
+
+  // Watch the directory trees `dirs` for the cache directory `cache_dir` until
+  // interrupted by SIGINT or SIGTERM. Throws Error on failure.
+  static void watch(const std::string& cache_dir,
+                    const std::vector<std::string>& dirs);
+
+  // Layout of the shared file.
+  struct Region;
+
+private:
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+  uint64_t m_generation = 0;
+};
+
+inline FileWatch::operator bool() const
+{
+  return m_region != nullptr;
+}
@@ -0,0 +1,101 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "FrequencySketch.hpp"
+
+#include "fmtmacros.hpp"
+
+#include "third_party/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+const uint32_t k_version = 1;
+
+// 2^19 one-byte counters (512 KiB) with four counters per name keep the
+// estimate of a name that hasn't been missed below 2 for about 98% of names at
+// the end of a window.
+const uint32_t k_counters = 1 << 19;
+const uint32_t k_counters_per_name = 4;
+const uint8_t k_max_count = UINT8_MAX;
+
+} // namespace
+
+const char FrequencySketch::k_file_name[] = "miss_frequencies";
+const uint32_t FrequencySketch::k_window = 1 << 16;
+
+struct FrequencySketch::Region
+{
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  // Misses recorded since the counters were last halved.
+  std::atomic<uint32_t> additions;
+  std::atomic<uint8_t> counters[k_counters];
+};
+
+FrequencySketch::FrequencySketch(const std::string& cache_dir)
+{
+  if (m_shared.map(FMT("{}/{}", cache_dir, k_file_name),
+                   sizeof(Region),
+                   k_version,
+                   SharedRegion::Create::file_and_dir)) {
+    m_region = static_cast<Region*>(m_shared.data());
+  }
+}
+
+uint32_t
+FrequencySketch::add(const Digest& name)
+{
+  // Double hashing: the counters are h1, h1 + h2, h1 + 2 * h2, ...
+  const uint64_t hash = XXH3_64bits(name.bytes(), Digest::size());
+  const uint32_t h1 = static_cast<uint32_t>(hash);
+  const uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+  std::atomic<uint8_t>* counters[k_counters_per_name];
+  uint8_t count = k_max_count;
+  for (uint32_t i = 0; i < k_counters_per_name; ++i) {
+    counters[i] = &m_region->counters[(h1 + i * h2) % k_counters];
+    count = std::min(count, counters[i]->load(std::memory_order_relaxed));
+  }
+
+  // Only incrementing the smallest counters (conservative update) keeps the
+  // larger ones, which are shared with other names, from growing further.
+  if (count < k_max_count) {
+    for (auto counter : counters) {
+      uint8_t expected = count;
+      counter->compare_exchange_strong(expected, count + 1);
+    }
+    ++count;
+  }
+
+  if (m_region->additions.fetch_add(1) + 1 == k_window) {
+    age();
+  }
+  return count;
+}
+
+void
+FrequencySketch::age()
+{
+  for (auto& counter : m_region->counters) {
+    counter.store(counter.load(std::memory_order_relaxed) / 2,
+                  std::memory_order_relaxed);
+  }
+  m_region->additions.fetch_sub(k_window);
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+#include "NonCopyable.hpp"
+#include "SharedRegion.hpp"
+
+#include <string>
+
+// Approximate number of recent cache misses of each result name, in a
+// memory-mapped count-min sketch shared by all ccache invocations, so that
+// results can be stored only once they have been missed a number of times.
+//
+// The file is named "miss_frequencies" and lives in the cache directory. All
+// counters are halved after a fixed number of recorded misses, so a miss is
+// gradually forgotten. Estimates may be too high due to hash collisions, but
+// never too low except for concurrent updates that get lost.
+class FrequencySketch : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  // Number of recorded misses after which all counters are halved.
+  static const uint32_t k_window;
+
+  // Map the sketch of `cache_dir`, creating the file if needed.
+  explicit FrequencySketch(const std::string& cache_dir);
+
+  // Return whether the file could be mapped.
+  explicit operator bool() const;
+
+  // Record a miss of `name` and return the estimated number of recent misses,
+  // including this one.
+  uint32_t add(const Digest& name);
+
+private:
+  struct Region;
+
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+
+  void age();
+};
+
+inline FrequencySketch::operator bool() const
+{
+  return m_region != nullptr;
+}
@@ -0,0 +1,358 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "GitIndex.hpp"
+
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+// Offsets in the fixed-size part of an index entry, in which all fields are
+// 32-bit big-endian integers except the object id and the flags.
+const size_t k_ctime_sec = 0;
+const size_t k_ctime_nsec = 4;
+const size_t k_mtime_sec = 8;
+const size_t k_mtime_nsec = 12;
+const size_t k_ino = 20;
+const size_t k_mode = 24;
+const size_t k_size = 36;
+const size_t k_oid = 40;
+const size_t k_oid_size = 20;
+const size_t k_flags = 60;
+const size_t k_path = 62;
+
+const uint16_t k_flag_assume_valid = 0x8000;
+const uint16_t k_flag_extended = 0x4000;
+const uint16_t k_flag_stage_mask = 0x3000;
+const uint16_t k_extended_flag_skip_worktree = 0x4000;
+const uint16_t k_extended_flag_intent_to_add = 0x2000;
+
+uint32_t
+read_uint32(const uint8_t* data)
+{
+  uint32_t value;
+  Util::big_endian_to_int(data, value);
+  return value;
+}
+
+uint16_t
+read_uint16(const uint8_t* data)
+{
+  uint16_t value;
+  Util::big_endian_to_int(data, value);
+  return value;
+}
+
+// Find the git directory of the repository containing `dir` and set
+// `work_tree` to the top-level directory of the repository.
+optional<std::string>
+find_git_dir(const std::string& dir, std::string& work_tree)
+{
+  std::string current = dir;
+  while (true) {
+    const auto dot_git = FMT("{}/.git", current);
+    const auto st = Stat::stat(dot_git);
+    if (st.is_directory()) {
+      work_tree = current;
+      return dot_git;
+    }
+    if (st.is_regular()) {
+      // A linked worktree or a submodule: ".git" contains "gitdir: <path>".
+      std::string content;
+      try {
+        content = Util::read_file(dot_git);
+      } catch (const Error&) {
+        return nullopt;
+      }
+      const string_view prefix = "gitdir: ";
+      if (!Util::starts_with(content, prefix)) {
+        return nullopt;
+      }
+      auto git_dir =
+        std::string(Util::strip_whitespace(content.substr(prefix.size())));
+      if (!Util::is_absolute_path(git_dir)) {
+        git_dir = FMT("{}/{}", current, git_dir);
+      }
+      work_tree = current;
+      return git_dir;
+    }
+    const auto parent = std::string(Util::dir_name(current));
+    if (parent == current) {
+      return nullopt;
+    }
+    current = parent;
+  }
+}
+
+// Return whether the repository with git directory `git_dir` uses an object
+// format other than SHA-1.
+bool
+uses_other_object_format(const std::string& git_dir)
+{
+  std::string config_dir = git_dir;
+  try {
+    // Linked worktrees share the config of the main repository.
+    const auto common_dir = std::string(
+      Util::strip_whitespace(Util::read_file(git_dir + "/commondir")));
+    config_dir = Util::is_absolute_path(common_dir)
+                   ? common_dir
+                   : FMT("{}/{}", git_dir, common_dir);
+  } catch (const Error&) {
+  }
+  std::string config;
+  try {
+    config = Util::to_lowercase(Util::read_file(config_dir + "/config"));
+  } catch (const Error&) {
+    return false;
+  }
+  for (const auto line : Util::split_into_views(config, "\n")) {
+    if (line.find("objectformat") != string_view::npos
+        && line.find("sha1") == string_view::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+GitIndex::GitIndex(std::string dir) : m_dir(std::move(dir))
+{
+}
+
+optional<std::string>
+GitIndex::blob_id(const std::string& path, const Stat& stat)
+{
+  std::call_once(m_load_flag, [this] { load(); });
+  if (m_entries.empty() || !stat || !stat.is_regular()) {
+    return nullopt;
+  }
+
+  const auto absolute_path = Util::normalize_absolute_path(
+    Util::is_absolute_path(path) ? path : FMT("{}/{}", m_dir, path));
+  if (!Util::starts_with(absolute_path, m_work_tree)) {
+    return nullopt;
+  }
+  const string_view relative_path =
+    string_view(absolute_path).substr(m_work_tree.size());
+
+  const auto it = std::lower_bound(
+    m_entries.begin(),
+    m_entries.end(),
+    relative_path,
+    [](const Entry& entry, string_view p) { return entry.path < p; });
+  if (it == m_entries.end() || it->path != relative_path) {
+    return nullopt;
+  }
+
+  const uint8_t* const data = it->stat_data;
+  const auto mtime_sec = read_uint32(data + k_mtime_sec);
+  const auto mtime_nsec = read_uint32(data + k_mtime_nsec);
+  const auto ctime_sec = read_uint32(data + k_ctime_sec);
+  const auto ctime_nsec = read_uint32(data + k_ctime_nsec);
+  const auto ino = read_uint32(data + k_ino);
+
+  // Like git, only trust entries of files modified before the index was
+  // written since the file could otherwise have been modified again within
+  // the timestamp granularity. The nanoseconds are only recorded if git was
+  // built to do so.
+  if (static_cast<int64_t>(mtime_sec) >= m_index_mtime
+      || mtime_sec != static_cast<uint32_t>(stat.mtime())
+      || ctime_sec != static_cast<uint32_t>(stat.ctime())
+      || read_uint32(data + k_size) != static_cast<uint32_t>(stat.size())
+      || (ino != 0 && ino != static_cast<uint32_t>(stat.inode()))) {
+    return nullopt;
+  }
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+  if (mtime_nsec != 0
+      && mtime_nsec != static_cast<uint32_t>(stat.mtim().tv_nsec)) {
+    return nullopt;
+  }
+#else
+  (void)mtime_nsec;
+#endif
+#ifdef HAVE_STRUCT_STAT_ST_CTIM
+  if (ctime_nsec != 0
+      && ctime_nsec != static_cast<uint32_t>(stat.ctim().tv_nsec)) {
+    return nullopt;
+  }
+#else
+  (void)ctime_nsec;
+#endif
+
+  return Util::format_base16(data + k_oid, k_oid_size);
+}
+
+void
+GitIndex::load()
+{
+  const auto git_dir = find_git_dir(m_dir, m_work_tree);
+  if (!git_dir) {
+    LOG("No git repository found for {}", m_dir);
+    return;
+  }
+  m_work_tree = Util::normalize_absolute_path(m_work_tree);
+  if (!Util::ends_with(m_work_tree, "/")) {
+    m_work_tree += '/';
+  }
+  if (uses_other_object_format(*git_dir)) {
+    LOG("Not using git index in {} since it doesn't use SHA-1", *git_dir);
+    return;
+  }
+
+  const auto index_path = FMT("{}/index", *git_dir);
+  Fd fd(open(index_path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    LOG("Failed to open {}: {}", index_path, strerror(errno));
+    return;
+  }
+  const auto st = Stat::stat(index_path);
+  if (!st) {
+    return;
+  }
+  m_index_mtime = st.mtime();
+
+  string_view data;
+  if (m_map.map(*fd)) {
+    data = m_map.data();
+  } else {
+    try {
+      m_buffer = Util::read_file(index_path, st.size());
+    } catch (const Error& e) {
+      LOG("Failed to read {}: {}", index_path, e.what());
+      return;
+    }
+    data = m_buffer;
+  }
+
+  if (!parse(data)) {
+    LOG("Failed to parse git index {}", index_path);
+    m_entries.clear();
+    return;
+  }
+  if (!std::is_sorted(
+        m_entries.begin(),
+        m_entries.end(),
+        [](const Entry& a, const Entry& b) { return a.path < b.path; })) {
+    std::sort(
+      m_entries.begin(),
+      m_entries.end(),
+      [](const Entry& a, const Entry& b) { return a.path < b.path; });
+  }
+  LOG("Read {} entries from git index {}", m_entries.size(), index_path);
+}
+
+bool
+GitIndex::parse(string_view data)
+{
+  const auto* const begin = reinterpret_cast<const uint8_t*>(data.data());
+  const auto* const end = begin + data.size();
+  if (data.size() < 12 || data.substr(0, 4) != "DIRC") {
+    return false;
+  }
+  const auto version = read_uint32(begin + 4);
+  const auto count = read_uint32(begin + 8);
+  if (version < 2 || version > 4) {
+    return false;
+  }
+
+  m_entries.reserve(count);
+  if (version == 4) {
+    // Reserved up front since the entries refer to the strings.
+    m_expanded_paths.reserve(count);
+  }
+  const uint8_t* p = begin + 12;
+  std::string previous_path;
+  for (uint32_t i = 0; i < count; ++i) {
+    if (end - p < static_cast<ptrdiff_t>(k_path)) {
+      return false;
+    }
+    const uint8_t* const entry = p;
+    const auto flags = read_uint16(entry + k_flags);
+    uint16_t extended_flags = 0;
+    p = entry + k_path;
+    if (flags & k_flag_extended) {
+      if (version < 3 || end - p < 2) {
+        return false;
+      }
+      extended_flags = read_uint16(p);
+      p += 2;
+    }
+
+    string_view path;
+    if (version == 4) {
+      // The path is stored as the number of bytes to remove from the end of
+      // the previous path followed by the NUL-terminated suffix to append.
+      if (p == end) {
+        return false;
+      }
+      uint8_t c = *p++;
+      uint64_t strip = c & 0x7f;
+      while (c & 0x80) {
+        if (p == end || strip > previous_path.size()) {
+          return false;
+        }
+        c = *p++;
+        strip = ((strip + 1) << 7) | (c & 0x7f);
+      }
+      const auto* const nul = std::find(p, end, 0);
+      if (nul == end || strip > previous_path.size()) {
+        return false;
+      }
+      previous_path.resize(previous_path.size() - strip);
+      previous_path.append(reinterpret_cast<const char*>(p), nul - p);
+      m_expanded_paths.push_back(previous_path);
+      path = m_expanded_paths.back();
+      p = nul + 1;
+    } else {
+      const auto* const nul = std::find(p, end, 0);
+      if (nul == end) {
+        return false;
+      }
+      path = string_view(reinterpret_cast<const char*>(p), nul - p);
+      // Entries are padded with 1-8 NULs to a multiple of eight bytes.
+      const size_t entry_size = ((nul - entry) + 8) & ~static_cast<size_t>(7);
+      if (static_cast<size_t>(end - entry) < entry_size) {
+        return false;
+      }
+      p = entry + entry_size;
+    }
+
+    // Skip entries whose stat data doesn't describe the file in the work tree
+    // and entries that aren't regular files, e.g. symlinks and submodules.
+    const auto mode = read_uint32(entry + k_mode);
+    if ((flags & (k_flag_assume_valid | k_flag_stage_mask))
+        || (extended_flags
+            & (k_extended_flag_skip_worktree | k_extended_flag_intent_to_add))
+        || (mode & 0170000) != 0100000) {
+      continue;
+    }
+    m_entries.push_back({path, entry});
+  }
+  return true;
+}
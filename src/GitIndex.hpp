@@ -0,0 +1,71 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "MemoryMap.hpp"
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Stat;
+
+// A read-only view of the index of the git repository that contains a
+// directory. The index records the stat data and blob id of each tracked file
+// as of when git last looked at it, so a file whose stat data still matches has
+// the content of the blob and can be identified by the blob id without reading
+// it.
+//
+// The index is read on first use. Only the SHA-1 object format is supported.
+class GitIndex : NonCopyable
+{
+public:
+  explicit GitIndex(std::string dir);
+
+  // Return the hexadecimal blob id of the file at `path` (absolute or relative
+  // to the directory) with stat result `stat` if the index has an up-to-date
+  // entry for it, otherwise nullopt. Can be called from several threads.
+  nonstd::optional<std::string> blob_id(const std::string& path,
+                                        const Stat& stat);
+
+private:
+  struct Entry
+  {
+    nonstd::string_view path;
+    const uint8_t* stat_data;
+  };
+
+  const std::string m_dir;
+  std::once_flag m_load_flag;
+  std::string m_work_tree;
+  MemoryMap m_map;
+  std::string m_buffer;
+  int64_t m_index_mtime = 0;
+  std::vector<Entry> m_entries;
+  std::vector<std::string> m_expanded_paths;
+
+  void load();
+  bool parse(nonstd::string_view data);
+};
@@ -19,16 +19,232 @@
 #include "Hash.hpp"
 
 #include "Fd.hpp"
+#include "Jobserver.hpp"
 #include "Logging.hpp"
+#include "MemoryMap.hpp"
 #include "fmtmacros.hpp"
 
+#ifdef USE_XXH_DISPATCH
+#  include "third_party/xxh_x86dispatch.h"
+#else
+#  include "third_party/xxhash.h"
+#endif
+
+#include <atomic>
+#include <system_error>
+#include <thread>
+
 using nonstd::string_view;
 
 const string_view HASH_DELIMITER("\000cCaChE\000", 8);
 
-Hash::Hash()
+namespace {
+
+// Text of sections longer than this, e.g. file contents, is not recorded.
+const size_t k_max_section_text_size = 200;
+
+// Buffers at least this large, e.g. memory-mapped precompiled headers and
+// profile data files, are hashed on several threads.
+const size_t k_min_size_for_parallel_hashing = 8 * 1024 * 1024;
+
+// BLAKE3 joiner that runs the left half of a subtree on a new thread while
+// there are spare threads, otherwise on the calling thread like the right
+// half.
+void
+join_on_threads(void* context,
+                void (*task)(void*),
+                void* left_arg,
+                void* right_arg)
+{
+  auto& spare_threads = *static_cast<std::atomic<size_t>*>(context);
+  size_t spare = spare_threads.load();
+  while (spare > 0
+         && !spare_threads.compare_exchange_weak(spare, spare - 1)) {
+  }
+  if (spare > 0) {
+    try {
+      std::thread thread(task, left_arg);
+      task(right_arg);
+      thread.join();
+      ++spare_threads;
+      return;
+    } catch (const std::system_error&) {
+      ++spare_threads;
+    }
+  }
+  task(left_arg);
+  task(right_arg);
+}
+
+Hash::Algorithm g_default_algorithm = Hash::Algorithm::blake3;
+
+} // namespace
+
+Hash::State::State(Algorithm algorithm) : m_algorithm(algorithm)
+{
+  switch (m_algorithm) {
+  case Algorithm::blake3:
+    blake3_hasher_init(&m_blake3);
+    break;
+
+  case Algorithm::xxh3:
+    m_xxh3 = XXH3_createState();
+    XXH3_128bits_reset(m_xxh3);
+    break;
+  }
+}
+
+Hash::State::State(const State& other)
+  : m_algorithm(other.m_algorithm),
+    m_blake3(other.m_blake3)
+{
+  if (other.m_xxh3) {
+    m_xxh3 = XXH3_createState();
+    XXH3_copyState(m_xxh3, other.m_xxh3);
+  }
+}
+
+Hash::State::~State()
+{
+  XXH3_freeState(m_xxh3);
+}
+
+Hash::State&
+Hash::State::operator=(const State& other)
+{
+  if (this != &other) {
+    XXH3_freeState(m_xxh3);
+    m_xxh3 = nullptr;
+    m_algorithm = other.m_algorithm;
+    m_blake3 = other.m_blake3;
+    if (other.m_xxh3) {
+      m_xxh3 = XXH3_createState();
+      XXH3_copyState(m_xxh3, other.m_xxh3);
+    }
+  }
+  return *this;
+}
+
+Hash::Algorithm
+Hash::State::algorithm() const
+{
+  return m_algorithm;
+}
+
+void
+Hash::State::update(string_view data, size_t spare_threads)
+{
+  switch (m_algorithm) {
+  case Algorithm::blake3:
+    if (spare_threads > 0) {
+      std::atomic<size_t> spare(spare_threads);
+      const blake3_joiner joiner{join_on_threads, &spare};
+      blake3_hasher_update_join(&m_blake3, data.data(), data.size(), &joiner);
+    } else {
+      blake3_hasher_update(&m_blake3, data.data(), data.size());
+    }
+    break;
+
+  case Algorithm::xxh3:
+    XXH3_128bits_update(m_xxh3, data.data(), data.size());
+    break;
+  }
+}
+
+Digest
+Hash::State::digest() const
+{
+  Digest digest;
+  switch (m_algorithm) {
+  case Algorithm::blake3:
+    // Note that blake3_hasher_finalize doesn't modify the hasher itself, thus
+    // it is possible to finalize again after more data has been added.
+    blake3_hasher_finalize(&m_blake3, digest.bytes(), digest.size());
+    break;
+
+  case Algorithm::xxh3: {
+    static_assert(Digest::size() == sizeof(XXH128_canonical_t) + 4,
+                  "unexpected digest size");
+    XXH128_canonical_t canonical;
+    XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(m_xxh3));
+    memcpy(digest.bytes(), canonical.digest, sizeof(canonical.digest));
+    memcpy(digest.bytes() + sizeof(canonical.digest), "xxh3", 4);
+    break;
+  }
+  }
+  return digest;
+}
+
+std::string
+Hash::State::serialize() const
+{
+  std::string data(1, static_cast<char>(m_algorithm));
+  switch (m_algorithm) {
+  case Algorithm::blake3:
+    data.append(reinterpret_cast<const char*>(&m_blake3), sizeof(m_blake3));
+    break;
+
+  case Algorithm::xxh3:
+    data.append(reinterpret_cast<const char*>(m_xxh3), sizeof(*m_xxh3));
+    break;
+  }
+  return data;
+}
+
+bool
+Hash::State::deserialize(string_view data)
+{
+  if (data.empty() || data[0] != static_cast<char>(m_algorithm)) {
+    return false;
+  }
+  data = data.substr(1);
+  switch (m_algorithm) {
+  case Algorithm::blake3:
+    if (data.size() != sizeof(m_blake3)) {
+      return false;
+    }
+    memcpy(&m_blake3, data.data(), data.size());
+    break;
+
+  case Algorithm::xxh3: {
+    if (data.size() != sizeof(*m_xxh3)) {
+      return false;
+    }
+    // The state points to the default secret, whose address differs between
+    // processes.
+    const auto secret = m_xxh3->extSecret;
+    memcpy(m_xxh3, data.data(), data.size());
+    m_xxh3->extSecret = secret;
+    break;
+  }
+  }
+  return true;
+}
+
+Hash::SectionState::SectionState(string_view name_, Algorithm algorithm)
+  : name(name_),
+    state(algorithm)
+{
+}
+
+void
+Hash::set_default_algorithm(Algorithm algorithm)
+{
+  g_default_algorithm = algorithm;
+}
+
+Hash::Algorithm
+Hash::default_algorithm()
+{
+  return g_default_algorithm;
+}
+
+Hash::Hash() : m_state(g_default_algorithm)
+{
+}
+
+Hash::Hash(Algorithm algorithm) : m_state(algorithm)
 {
-  blake3_hasher_init(&m_hasher);
 }
 
 void
@@ -44,19 +260,51 @@ Hash::enable_debug(string_view section_name,
   add_debug_text(" ===\n");
 }
 
+void
+Hash::enable_sections()
+{
+  m_record_sections = true;
+  start_section("");
+}
+
+std::vector<Hash::Section>
+Hash::sections() const
+{
+  std::vector<Section> result;
+  for (const auto& state : m_sections) {
+    Section section;
+    section.name = state.name;
+    section.digest = state.state.digest();
+    section.text = state.text;
+    result.push_back(std::move(section));
+  }
+  return result;
+}
+
 Digest
 Hash::digest() const
 {
-  // Note that blake3_hasher_finalize doesn't modify the hasher itself, thus it
-  // is possible to finalize again after more data has been added.
-  Digest digest;
-  blake3_hasher_finalize(&m_hasher, digest.bytes(), digest.size());
-  return digest;
+  return m_state.digest();
+}
+
+std::string
+Hash::state() const
+{
+  return m_state.serialize();
+}
+
+bool
+Hash::set_state(string_view state)
+{
+  return m_state.deserialize(state);
 }
 
 Hash&
 Hash::hash_delimiter(string_view type)
 {
+  if (m_record_sections) {
+    start_section(type);
+  }
   hash_buffer(HASH_DELIMITER);
   hash_buffer(type);
   hash_buffer(string_view("", 1)); // NUL
@@ -73,13 +321,17 @@ Hash::hash(const void* data, size_t size, HashType hash_type)
   hash_buffer(buffer);
 
   switch (hash_type) {
-  case HashType::binary:
-    add_debug_text(
-      Util::format_base16(static_cast<const uint8_t*>(data), size));
+  case HashType::binary: {
+    const auto hex =
+      Util::format_base16(static_cast<const uint8_t*>(data), size);
+    add_debug_text(hex);
+    add_section_text(hex);
     break;
+  }
 
   case HashType::text:
     add_debug_text(buffer);
+    add_section_text(buffer);
     break;
   }
 
@@ -99,12 +351,19 @@ Hash::hash(int64_t x)
 {
   hash_buffer(string_view(reinterpret_cast<const char*>(&x), sizeof(x)));
   add_debug_text(FMT("{}\n", x));
+  add_section_text(FMT("{}", x));
   return *this;
 }
 
 bool
 Hash::hash_fd(int fd)
 {
+  MemoryMap map;
+  if (map.map(fd)) {
+    hash_buffer(map.data());
+    add_section_text(map.data());
+    return true;
+  }
   return Util::read_fd(
     fd, [=](const void* data, size_t size) { hash(data, size); });
 }
@@ -125,7 +384,17 @@ Hash::hash_file(const std::string& path)
 void
 Hash::hash_buffer(string_view buffer)
 {
-  blake3_hasher_update(&m_hasher, buffer.data(), buffer.size());
+  // XXH3 is fast enough on one thread.
+  const size_t threads =
+    buffer.size() >= k_min_size_for_parallel_hashing
+        && m_state.algorithm() == Algorithm::blake3
+      ? std::max(std::thread::hardware_concurrency(), 1u)
+      : 1;
+  const Jobserver::Tokens tokens(threads - 1);
+  m_state.update(buffer, tokens.count());
+  if (m_record_sections) {
+    m_sections.back().state.update(buffer);
+  }
   if (!buffer.empty() && m_debug_binary) {
     (void)fwrite(buffer.data(), 1, buffer.size(), m_debug_binary);
   }
@@ -138,3 +407,30 @@ Hash::add_debug_text(string_view text)
     (void)fwrite(text.data(), 1, text.length(), m_debug_text);
   }
 }
+
+void
+Hash::start_section(string_view name)
+{
+  m_sections.emplace_back(name, m_state.algorithm());
+}
+
+void
+Hash::add_section_text(string_view text)
+{
+  if (!m_record_sections) {
+    return;
+  }
+  auto& section = m_sections.back();
+  if (section.long_text) {
+    return;
+  }
+  if (!section.text.empty()) {
+    section.text += ' ';
+  }
+  if (section.text.size() + text.size() > k_max_section_text_size) {
+    section.text.clear();
+    section.long_text = true;
+    return;
+  }
+  section.text.append(text.data(), text.size());
+}
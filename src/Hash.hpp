@@ -25,13 +25,40 @@
 #include "third_party/blake3/blake3.h"
 #include "third_party/nonstd/string_view.hpp"
 
+#include <string>
+#include <vector>
+
+struct XXH3_state_s;
+
 // This class represents a hash state.
 class Hash
 {
 public:
   enum class HashType { binary, text };
 
+  enum class Algorithm {
+    blake3,
+    // XXH3-128, which is much faster but not collision resistant against
+    // adversaries. The last four bytes of its digests are "xxh3", so its keys
+    // never equal BLAKE3 keys.
+    xxh3,
+  };
+
+  // The data hashed after a delimiter, see enable_sections.
+  struct Section
+  {
+    std::string name; // Type of the delimiter.
+    Digest digest;
+    std::string text; // Text form of the data if short, otherwise empty.
+  };
+
+  // Set the algorithm of Hash objects constructed without one, which is BLAKE3
+  // unless changed.
+  static void set_default_algorithm(Algorithm algorithm);
+  static Algorithm default_algorithm();
+
   Hash();
+  explicit Hash(Algorithm algorithm);
   Hash(const Hash& other) = default;
 
   Hash& operator=(const Hash& other) = default;
@@ -41,9 +68,26 @@ public:
                     FILE* debug_binary,
                     FILE* debug_text);
 
+  // Record a digest of the data hashed after each delimiter, retrieved with
+  // sections(). Hashing is then about twice as expensive.
+  void enable_sections();
+
+  // Retrieve the sections recorded since enable_sections was called.
+  std::vector<Section> sections() const;
+
   // Retrieve the digest.
   Digest digest() const;
 
+  // Retrieve the internal state of the hash algorithm, which set_state can
+  // restore in a Hash with the same algorithm in the same ccache build to
+  // continue where this object left off. Debug output and sections are not part
+  // of the state.
+  std::string state() const;
+
+  // Returns false, leaving the state unchanged, if `state` wasn't retrieved
+  // with state() from a Hash with the same algorithm.
+  bool set_state(nonstd::string_view state);
+
   // Hash some data that is unlikely to occur in the input. The idea is twofold:
   //
   // - Delimit things like arguments from each other (e.g., so that -I -O2 and
@@ -96,10 +140,50 @@ public:
   bool hash_file(const std::string& path);
 
 private:
-  blake3_hasher m_hasher;
+  class State
+  {
+  public:
+    explicit State(Algorithm algorithm);
+    State(const State& other);
+    ~State();
+
+    State& operator=(const State& other);
+
+    Algorithm algorithm() const;
+
+    // Add `data`, using up to `spare_threads` extra threads for BLAKE3.
+    void update(nonstd::string_view data, size_t spare_threads = 0);
+
+    // May be called again after more data has been added.
+    Digest digest() const;
+
+    std::string serialize() const;
+    bool deserialize(nonstd::string_view data);
+
+  private:
+    Algorithm m_algorithm;
+    blake3_hasher m_blake3;
+    XXH3_state_s* m_xxh3 = nullptr;
+  };
+
+  State m_state;
   FILE* m_debug_binary = nullptr;
   FILE* m_debug_text = nullptr;
 
+  struct SectionState
+  {
+    SectionState(nonstd::string_view name_, Algorithm algorithm);
+
+    std::string name;
+    State state;
+    std::string text;
+    bool long_text = false;
+  };
+  bool m_record_sections = false;
+  std::vector<SectionState> m_sections;
+
   void hash_buffer(nonstd::string_view buffer);
   void add_debug_text(nonstd::string_view text);
+  void start_section(nonstd::string_view name);
+  void add_section_text(nonstd::string_view text);
 };
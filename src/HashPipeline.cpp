@@ -0,0 +1,133 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "HashPipeline.hpp"
+
+#include "Hash.hpp"
+
+#include <iterator>
+#include <system_error>
+
+namespace {
+
+// Amount of data to hand over to the thread at a time, which keeps locking
+// rare without delaying the start of hashing much.
+const size_t k_batch_size = 256 * 1024;
+
+} // namespace
+
+HashPipeline::HashPipeline(Hash& hash, bool threaded)
+  : m_hash(hash),
+    m_token(threaded ? 1 : 0)
+{
+  if (m_token.count() > 0) {
+    try {
+      m_thread = std::thread(&HashPipeline::run, this);
+    } catch (const std::system_error&) {
+      // Hash on the calling thread instead.
+    }
+  }
+}
+
+HashPipeline::~HashPipeline()
+{
+  finish();
+}
+
+void
+HashPipeline::hash(const char* data, size_t size)
+{
+  if (!m_thread.joinable()) {
+    m_hash.hash(data, size);
+    return;
+  }
+  m_batch.push_back({data, size, {}});
+  m_batch_size += size;
+  if (m_batch_size >= k_batch_size) {
+    flush_batch();
+  }
+}
+
+void
+HashPipeline::hash(nonstd::string_view data)
+{
+  if (!m_thread.joinable()) {
+    m_hash.hash(data);
+    return;
+  }
+  m_batch.push_back({nullptr, data.size(), std::string(data)});
+  m_batch_size += data.size();
+}
+
+void
+HashPipeline::finish()
+{
+  if (!m_thread.joinable()) {
+    return;
+  }
+  flush_batch();
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finishing = true;
+  }
+  m_condition.notify_one();
+  m_thread.join();
+  m_token.release();
+}
+
+void
+HashPipeline::flush_batch()
+{
+  if (m_batch.empty()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queue.empty()) {
+      m_queue.swap(m_batch);
+    } else {
+      m_queue.insert(m_queue.end(),
+                     std::make_move_iterator(m_batch.begin()),
+                     std::make_move_iterator(m_batch.end()));
+    }
+  }
+  m_condition.notify_one();
+  m_batch.clear();
+  m_batch_size = 0;
+}
+
+void
+HashPipeline::run()
+{
+  std::vector<Item> items;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock,
+                       [this] { return !m_queue.empty() || m_finishing; });
+      if (m_queue.empty()) {
+        return;
+      }
+      items.swap(m_queue);
+    }
+    for (const auto& item : items) {
+      m_hash.hash(item.data ? item.data : item.copy.data(), item.size);
+    }
+    items.clear();
+  }
+}
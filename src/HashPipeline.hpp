@@ -0,0 +1,82 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Jobserver.hpp"
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Hash;
+
+// Feeds data to a Hash in order, on a separate thread if requested and a
+// jobserver token is available, so that producing the data (e.g. scanning
+// preprocessed output) overlaps with hashing it. Without the thread, data is
+// hashed right away.
+class HashPipeline : NonCopyable
+{
+public:
+  HashPipeline(Hash& hash, bool threaded);
+
+  // Calls finish.
+  ~HashPipeline();
+
+  // Queue `size` bytes at `data`, which must stay valid and unchanged until
+  // finish returns.
+  void hash(const char* data, size_t size);
+
+  // Queue a copy of `data`.
+  void hash(nonstd::string_view data);
+
+  // Wait until all queued data has been hashed. The Hash may then be used
+  // directly.
+  void finish();
+
+private:
+  struct Item
+  {
+    const char* data;
+    size_t size;
+    std::string copy; // Used if data is nullptr.
+  };
+
+  Hash& m_hash;
+  Jobserver::Tokens m_token;
+  std::thread m_thread;
+
+  // Items not yet handed over to the thread, and their total size.
+  std::vector<Item> m_batch;
+  size_t m_batch_size = 0;
+
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::vector<Item> m_queue;
+  bool m_finishing = false;
+
+  void flush_batch();
+  void run();
+};
@@ -0,0 +1,274 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "HttpStorage.hpp"
+
+#include "Logging.hpp"
+#include "TcpConnection.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+optional<size_t>
+parse_chunk_size(string_view line)
+{
+  size_t size = 0;
+  size_t digits = 0;
+  for (const char c : line) {
+    size_t value;
+    if (c >= '0' && c <= '9') {
+      value = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value = c - 'A' + 10;
+    } else {
+      break; // Chunk extension or whitespace.
+    }
+    if (size > (SIZE_MAX >> 4)) {
+      return nullopt;
+    }
+    size = (size << 4) | value;
+    ++digits;
+  }
+  return digits > 0 ? optional<size_t>(size) : nullopt;
+}
+
+} // namespace
+
+HttpStorage::HttpStorage(const Url& url, uint32_t timeout_ms)
+  : m_url(url),
+    m_timeout_ms(timeout_ms)
+{
+}
+
+optional<std::string>
+HttpStorage::get(const Digest& name, string_view suffix)
+{
+  const auto path = get_entry_path(name, suffix);
+  auto response = request("GET", path);
+  if (!response) {
+    return nullopt;
+  }
+  if (response->status != 200) {
+    if (response->status != 404) {
+      LOG("Unexpected HTTP status {} for GET {}", response->status, path);
+    }
+    return nullopt;
+  }
+  return std::move(response->body);
+}
+
+bool
+HttpStorage::put(const Digest& name,
+                 string_view suffix,
+                 const std::string& data)
+{
+  const auto path = get_entry_path(name, suffix);
+  const auto response = request("PUT", path, data);
+  if (!response) {
+    return false;
+  }
+  if (response->status < 200 || response->status >= 300) {
+    LOG("Unexpected HTTP status {} for PUT {}", response->status, path);
+    return false;
+  }
+  return true;
+}
+
+bool
+HttpStorage::remove(const Digest& name, string_view suffix)
+{
+  const auto path = get_entry_path(name, suffix);
+  const auto response = request("DELETE", path);
+  if (!response) {
+    return false;
+  }
+  if (response->status < 200 || response->status >= 300) {
+    LOG("Unexpected HTTP status {} for DELETE {}", response->status, path);
+    return false;
+  }
+  return true;
+}
+
+optional<HttpStorage::Url>
+HttpStorage::parse_url(string_view url)
+{
+  const string_view scheme = "http://";
+  if (!Util::starts_with(url, scheme)) {
+    return nullopt;
+  }
+  auto rest = url.substr(scheme.length());
+
+  const auto slash = rest.find('/');
+  const auto authority = rest.substr(0, slash);
+  Url result;
+  if (slash != string_view::npos) {
+    result.path = std::string(rest.substr(slash));
+    while (!result.path.empty() && result.path.back() == '/') {
+      result.path.pop_back();
+    }
+  }
+
+  const auto host_and_port =
+    TcpConnection::parse_host_and_port(authority, "80");
+  if (!host_and_port) {
+    return nullopt;
+  }
+  result.host = host_and_port->first;
+  result.port = host_and_port->second;
+
+  return result;
+}
+
+optional<HttpStorage::Response>
+HttpStorage::parse_response(string_view data)
+{
+  const auto header_end = data.find("\r\n\r\n");
+  if (header_end == string_view::npos) {
+    return nullopt;
+  }
+  const auto lines = Util::split_into_views(data.substr(0, header_end), "\r\n");
+  if (lines.empty() || !Util::starts_with(lines[0], "HTTP/")) {
+    return nullopt;
+  }
+  const auto status_fields = Util::split_into_views(lines[0], " ");
+  if (status_fields.size() < 2) {
+    return nullopt;
+  }
+
+  Response response;
+  optional<uint64_t> content_length;
+  bool chunked = false;
+  try {
+    response.status = static_cast<int>(Util::parse_unsigned(
+      std::string(status_fields[1]), 100, 999, "status code"));
+    for (size_t i = 1; i < lines.size(); ++i) {
+      const auto colon = lines[i].find(':');
+      if (colon == string_view::npos) {
+        continue;
+      }
+      const auto field = Util::to_lowercase(lines[i].substr(0, colon));
+      const auto value =
+        Util::to_lowercase(Util::strip_whitespace(lines[i].substr(colon + 1)));
+      if (field == "content-length") {
+        content_length = Util::parse_unsigned(value);
+      } else if (field == "transfer-encoding") {
+        chunked = Util::ends_with(value, "chunked");
+      }
+    }
+  } catch (const Error&) {
+    return nullopt;
+  }
+
+  auto body = data.substr(header_end + 4);
+  if (chunked) {
+    while (true) {
+      const auto line_end = body.find("\r\n");
+      if (line_end == string_view::npos) {
+        return nullopt;
+      }
+      const auto chunk_size = parse_chunk_size(body.substr(0, line_end));
+      if (!chunk_size) {
+        return nullopt;
+      }
+      body = body.substr(line_end + 2);
+      if (*chunk_size == 0) {
+        break; // Trailer fields, if any, are ignored.
+      }
+      if (body.size() < *chunk_size + 2) {
+        return nullopt;
+      }
+      response.body.append(body.data(), *chunk_size);
+      body = body.substr(*chunk_size + 2);
+    }
+  } else if (content_length) {
+    if (body.size() < *content_length) {
+      return nullopt;
+    }
+    response.body = std::string(body.substr(0, *content_length));
+  } else {
+    response.body = std::string(body);
+  }
+
+  return response;
+}
+
+std::string
+HttpStorage::get_entry_path(const Digest& name, string_view suffix) const
+{
+  return FMT("{}/{}{}", m_url.path, name.to_string(), suffix);
+}
+
+optional<HttpStorage::Response>
+HttpStorage::request(string_view method,
+                     const std::string& path,
+                     const std::string& body) const
+{
+  const auto deadline =
+    TcpConnection::Clock::now() + std::chrono::milliseconds(m_timeout_ms);
+
+  auto connection = TcpConnection::connect(m_url.host, m_url.port, deadline);
+  if (!connection) {
+    return nullopt;
+  }
+
+  const bool is_ipv6 = m_url.host.find(':') != std::string::npos;
+  const std::string host = is_ipv6 ? FMT("[{}]:{}", m_url.host, m_url.port)
+                                   : FMT("{}:{}", m_url.host, m_url.port);
+  const std::string header = FMT(
+    "{} {} HTTP/1.1\r\n"
+    "Host: {}\r\n"
+    "Connection: close\r\n"
+    "Content-Length: {}\r\n"
+    "\r\n",
+    method,
+    path,
+    host,
+    body.size());
+  if (!connection.send(header, deadline) || !connection.send(body, deadline)) {
+    LOG("Failed to send HTTP {} request for {} to {}: {}",
+        method,
+        path,
+        host,
+        strerror(errno));
+    return nullopt;
+  }
+
+  std::string data;
+  if (!connection.receive_all(data, deadline)) {
+    LOG("Failed to receive HTTP {} response for {} from {}: {}",
+        method,
+        path,
+        host,
+        strerror(errno));
+    return nullopt;
+  }
+
+  auto response = parse_response(data);
+  if (!response) {
+    LOG("Malformed HTTP {} response for {} from {}", method, path, host);
+  }
+  return response;
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "SecondaryStorage.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Secondary storage accessed with plain HTTP/1.1 GET, PUT and DELETE requests,
+// e.g. a WebDAV server or an S3-compatible object store bucket that allows
+// anonymous access. An entry is stored at <path>/<name><suffix>.
+//
+// Each request uses a new connection and must finish within a configured
+// timeout (including connecting) or it is treated as a failure.
+class HttpStorage : public SecondaryStorage
+{
+public:
+  struct Url
+  {
+    std::string host;
+    std::string port;
+    std::string path; // Without trailing slash.
+  };
+
+  struct Response
+  {
+    int status = 0;
+    std::string body;
+  };
+
+  HttpStorage(const Url& url, uint32_t timeout_ms);
+
+  nonstd::optional<std::string> get(const Digest& name,
+                                    nonstd::string_view suffix) override;
+  bool put(const Digest& name,
+           nonstd::string_view suffix,
+           const std::string& data) override;
+  bool remove(const Digest& name, nonstd::string_view suffix) override;
+
+  // Parse an URL on the form "http://host[:port][/path]". Returns nullopt if
+  // `url` is not such an URL.
+  static nonstd::optional<Url> parse_url(nonstd::string_view url);
+
+  // Parse a complete HTTP response (status line, headers and body, which may
+  // use chunked transfer encoding). Returns nullopt if the response is
+  // malformed or truncated.
+  static nonstd::optional<Response> parse_response(nonstd::string_view data);
+
+private:
+  const Url m_url;
+  const uint32_t m_timeout_ms;
+
+  std::string get_entry_path(const Digest& name,
+                             nonstd::string_view suffix) const;
+
+  nonstd::optional<Response> request(nonstd::string_view method,
+                                     const std::string& path,
+                                     const std::string& body = "") const;
+};
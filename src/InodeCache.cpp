@@ -24,26 +24,34 @@
 #include "Hash.hpp"
 #include "Logging.hpp"
 #include "Stat.hpp"
+#include "StatCache.hpp"
 #include "TemporaryFile.hpp"
 #include "Util.hpp"
 #include "fmtmacros.hpp"
 
 #include <atomic>
 #include <libgen.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <type_traits>
 
+using nonstd::string_view;
+
 // The inode cache resides on a file that is mapped into shared memory by
 // running processes. It is implemented as a two level structure, where the top
 // level is a hash table consisting of buckets. Each bucket contains entries
 // that are sorted in LRU order. Entries map from keys representing files to
 // cached hash results.
 //
-// Concurrent access is guarded by a mutex in each bucket.
+// Modifications are guarded by a mutex in each bucket. Lookups don't take the
+// mutex: they copy the bucket's entries and retry if its sequence counter shows
+// that a writer modified the bucket in the meantime (a "seqlock"). The
+// sequence counter is odd while a writer holds the mutex.
 //
-// Current cache size is fixed and the given constants are considered large
-// enough for most projects. The size could be made configurable if there is a
-// demand for it.
+// The number of buckets is a power of two derived from the inode_cache_entries
+// configuration option and stored in the file. If an existing file has fewer
+// buckets than configured, a new, larger file is created, the existing entries
+// are rehashed into it and the new file is renamed over the old one.
 
 namespace {
 
@@ -53,13 +61,22 @@ namespace {
 // Note: The key is hashed using the main hash algorithm, so the version number
 // does not need to be incremented if said algorithm is changed (except if the
 // digest size changes since that affects the entry format).
-const uint32_t k_version = 1;
+const uint32_t k_version = 3;
 
 // Note: Increment the version number if constants affecting storage size are
 // changed.
-const uint32_t k_num_buckets = 32 * 1024;
 const uint32_t k_num_entries = 4;
 
+// Number of optimistic attempts to read a bucket before falling back to taking
+// its mutex.
+const uint32_t k_max_read_attempts = 100;
+
+#ifndef HAVE_PTHREAD_MUTEX_ROBUST
+// Number of attempts to take a busy bucket lock between yielding and checking
+// whether the owner is alive.
+const uint32_t k_lock_spin_count = 100;
+#endif
+
 static_assert(Digest::size() == 20,
               "Increment version number if size of digest is changed.");
 static_assert(IS_TRIVIALLY_COPYABLE(Digest),
@@ -78,6 +95,19 @@ static_assert(
   static_cast<int>(InodeCache::ContentType::precompiled_header) == 3,
   "Numeric value is part of key, increment version number if changed.");
 
+// Return the smallest power of two number of buckets that holds `entries`
+// entries.
+uint32_t
+num_buckets_for(uint32_t entries)
+{
+  const uint32_t min_buckets = (entries + k_num_entries - 1) / k_num_entries;
+  uint32_t num_buckets = 1;
+  while (num_buckets < min_buckets && num_buckets < (1U << 31)) {
+    num_buckets <<= 1;
+  }
+  return num_buckets;
+}
+
 } // namespace
 
 struct InodeCache::Key
@@ -109,24 +139,45 @@ struct InodeCache::Entry
 
 struct InodeCache::Bucket
 {
+#ifdef HAVE_PTHREAD_MUTEX_ROBUST
   pthread_mutex_t mt;
+#else
+  std::atomic<int32_t> owner; // PID of lock owner, see lock_bucket
+#endif
+  std::atomic<uint32_t> sequence;
   Entry entries[k_num_entries];
 };
 
+// Header of the shared region. It is followed by `num_buckets` buckets.
 struct InodeCache::SharedRegion
 {
   uint32_t version;
+  uint32_t num_buckets;
   std::atomic<int64_t> hits;
   std::atomic<int64_t> misses;
   std::atomic<int64_t> errors;
-  Bucket buckets[k_num_buckets];
+  std::atomic<int64_t> evictions;
+
+  Bucket*
+  buckets()
+  {
+    return reinterpret_cast<Bucket*>(this + 1);
+  }
 };
 
+size_t
+InodeCache::region_size(uint32_t num_buckets)
+{
+  static_assert(sizeof(SharedRegion) % alignof(Bucket) == 0,
+                "Buckets following the shared region header must be aligned.");
+  return sizeof(SharedRegion) + size_t{num_buckets} * sizeof(Bucket);
+}
+
 bool
 InodeCache::mmap_file(const std::string& inode_cache_file)
 {
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
+    munmap(m_sr, m_sr_size);
     m_sr = nullptr;
   }
   Fd fd(open(inode_cache_file.c_str(), O_RDWR));
@@ -141,8 +192,19 @@ InodeCache::mmap_file(const std::string& inode_cache_file)
       inode_cache_file);
     return false;
   }
-  SharedRegion* sr = reinterpret_cast<SharedRegion*>(mmap(
-    nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0));
+  struct stat st;
+  if (fstat(*fd, &st) != 0) {
+    LOG("Failed to stat {}: {}", inode_cache_file, strerror(errno));
+    return false;
+  }
+  const size_t size = st.st_size;
+  if (size < sizeof(SharedRegion)) {
+    LOG("Dropping truncated inode cache {}", inode_cache_file);
+    unlink(inode_cache_file.c_str());
+    return false;
+  }
+  SharedRegion* sr = reinterpret_cast<SharedRegion*>(
+    mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0));
   fd.close();
   if (sr == reinterpret_cast<void*>(-1)) {
     LOG("Failed to mmap {}: {}", inode_cache_file, strerror(errno));
@@ -156,11 +218,18 @@ InodeCache::mmap_file(const std::string& inode_cache_file)
       " version {}",
       sr->version,
       k_version);
-    munmap(sr, sizeof(SharedRegion));
+    munmap(sr, size);
+    unlink(inode_cache_file.c_str());
+    return false;
+  }
+  if (sr->num_buckets == 0 || size != region_size(sr->num_buckets)) {
+    LOG("Dropping inode cache {} because of bad size", inode_cache_file);
+    munmap(sr, size);
     unlink(inode_cache_file.c_str());
     return false;
   }
   m_sr = sr;
+  m_sr_size = size;
   if (m_config.debug()) {
     LOG("inode cache file loaded: {}", inode_cache_file);
   }
@@ -172,50 +241,173 @@ InodeCache::hash_inode(const std::string& path,
                        ContentType type,
                        Digest& digest)
 {
-  Stat stat = Stat::stat(path);
+  Stat stat = m_stat_cache ? m_stat_cache->stat(path) : Stat::stat(path);
   if (!stat) {
     LOG("Could not stat {}: {}", path, strerror(stat.error_number()));
     return false;
   }
 
+  // Device and inode numbers and ctime of files in container image layers
+  // change when a new container is created, so files in immutable directories
+  // are identified by path, size and mtime instead.
+  const bool immutable = is_in_immutable_dir(path);
+
   Key key;
   memset(&key, 0, sizeof(Key));
   key.type = type;
-  key.st_dev = stat.device();
-  key.st_ino = stat.inode();
+  if (!immutable) {
+    key.st_dev = stat.device();
+    key.st_ino = stat.inode();
+  }
   key.st_mode = stat.mode();
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
   key.st_mtim = stat.mtim();
 #else
   key.st_mtim = stat.mtime();
 #endif
+  if (!immutable) {
 #ifdef HAVE_STRUCT_STAT_ST_CTIM
-  key.st_ctim = stat.ctim();
+    key.st_ctim = stat.ctim();
 #else
-  key.st_ctim = stat.ctime();
+    key.st_ctim = stat.ctime();
 #endif
+  }
   key.st_size = stat.size();
 
   Hash hash;
   hash.hash(&key, sizeof(Key));
+  if (immutable) {
+    hash.hash(path);
+  }
   digest = hash.digest();
   return true;
 }
 
+Digest
+InodeCache::hash_content_id(string_view content_id, ContentType type)
+{
+  Hash hash;
+  hash.hash_delimiter("content id");
+  hash.hash(static_cast<int64_t>(type));
+  hash.hash(content_id);
+  return hash.digest();
+}
+
 bool
-InodeCache::with_bucket(const Digest& key_digest,
-                        const BucketHandler& bucket_handler)
+InodeCache::is_in_immutable_dir(const std::string& path) const
+{
+  for (const auto& dir : m_immutable_dirs) {
+    if (Util::starts_with(path, dir)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t
+InodeCache::bucket_index(const Digest& key_digest, uint32_t num_buckets)
 {
   uint32_t hash;
   Util::big_endian_to_int(key_digest.bytes(), hash);
-  const uint32_t index = hash % k_num_buckets;
-  Bucket* bucket = &m_sr->buckets[index];
-  int err = pthread_mutex_lock(&bucket->mt);
+  return hash & (num_buckets - 1);
+}
+
+bool
+InodeCache::read_entries(Bucket* bucket, Entry* entries)
+{
+  for (uint32_t i = 0; i < k_max_read_attempts; ++i) {
+    const uint32_t sequence = bucket->sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      continue;
+    }
+    memcpy(entries, bucket->entries, sizeof(Bucket::entries));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (bucket->sequence.load(std::memory_order_relaxed) == sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
 #ifdef HAVE_PTHREAD_MUTEX_ROBUST
+
+int
+InodeCache::lock_bucket(Bucket* bucket, bool wait)
+{
+  return wait ? pthread_mutex_lock(&bucket->mt)
+              : pthread_mutex_trylock(&bucket->mt);
+}
+
+void
+InodeCache::unlock_bucket(Bucket* bucket)
+{
+  pthread_mutex_unlock(&bucket->mt);
+}
+
+#else
+
+// Without robust mutexes (e.g. on macOS), a bucket is locked by storing the
+// PID of the owning process in it. A lock held by a process that no longer
+// exists is taken over, which gives the same semantics as EOWNERDEAD.
+int
+InodeCache::lock_bucket(Bucket* bucket, bool wait)
+{
+  const int32_t pid = getpid();
+  for (uint32_t i = 0;; ++i) {
+    int32_t owner = 0;
+    if (bucket->owner.compare_exchange_weak(
+          owner, pid, std::memory_order_acquire)) {
+      return 0;
+    }
+    if (!wait) {
+      return EBUSY;
+    }
+    if (i < k_lock_spin_count) {
+      continue;
+    }
+    if (owner != 0 && i % k_lock_spin_count == 0 && kill(owner, 0) != 0
+        && errno == ESRCH
+        && bucket->owner.compare_exchange_strong(
+          owner, pid, std::memory_order_acquire)) {
+      return EOWNERDEAD;
+    }
+    sched_yield();
+  }
+}
+
+void
+InodeCache::unlock_bucket(Bucket* bucket)
+{
+  bucket->owner.store(0, std::memory_order_release);
+}
+
+#endif
+
+bool
+InodeCache::with_bucket(const Digest& key_digest,
+                        const BucketHandler& bucket_handler,
+                        bool wait)
+{
+  return with_bucket(
+    m_sr, bucket_index(key_digest, m_sr->num_buckets), bucket_handler, wait);
+}
+
+bool
+InodeCache::with_bucket(SharedRegion* sr,
+                        uint32_t index,
+                        const BucketHandler& bucket_handler,
+                        bool wait)
+{
+  Bucket* bucket = &sr->buckets()[index];
+  int err = lock_bucket(bucket, wait);
+  if (err == EBUSY && !wait) {
+    return false;
+  }
   if (err == EOWNERDEAD) {
     if (m_config.debug()) {
-      ++m_sr->errors;
+      ++sr->errors;
     }
+#ifdef HAVE_PTHREAD_MUTEX_ROBUST
     err = pthread_mutex_consistent(&bucket->mt);
     if (err) {
       LOG(
@@ -223,34 +415,42 @@ InodeCache::with_bucket(const Digest& key_digest,
       LOG_RAW("Consider removing the inode cache file if the problem persists");
       return false;
     }
+#endif
     LOG("Wiping bucket at index {} because of stale mutex", index);
     memset(bucket->entries, 0, sizeof(Bucket::entries));
-  } else {
-#endif
-    if (err != 0) {
-      LOG("Failed to lock mutex at index {}: {}", index, strerror(err));
-      LOG_RAW("Consider removing the inode cache file if problem persists");
-      ++m_sr->errors;
-      return false;
-    }
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
+  } else if (err != 0) {
+    LOG("Failed to lock mutex at index {}: {}", index, strerror(err));
+    LOG_RAW("Consider removing the inode cache file if problem persists");
+    ++sr->errors;
+    return false;
   }
-#endif
+
+  // Make the sequence counter odd (it may already be if a previous writer
+  // died) to make concurrent readers retry.
+  const uint32_t sequence =
+    bucket->sequence.load(std::memory_order_relaxed) | 1;
+  bucket->sequence.store(sequence, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
 
   try {
     bucket_handler(bucket);
   } catch (...) {
-    pthread_mutex_unlock(&bucket->mt);
+    bucket->sequence.store(sequence + 1, std::memory_order_release);
+    unlock_bucket(bucket);
     throw;
   }
-  pthread_mutex_unlock(&bucket->mt);
+  bucket->sequence.store(sequence + 1, std::memory_order_release);
+  unlock_bucket(bucket);
   return true;
 }
 
 bool
-InodeCache::create_new_file(const std::string& filename)
+InodeCache::create_new_file(const std::string& filename,
+                            uint32_t num_buckets,
+                            SharedRegion* old_sr)
 {
-  LOG_RAW("Creating a new inode cache");
+  LOG("Creating a new inode cache with {} entries",
+      size_t{num_buckets} * k_num_entries);
 
   // Create the new file to a temporary name to prevent other processes from
   // mapping it before it is fully initialized.
@@ -266,18 +466,14 @@ InodeCache::create_new_file(const std::string& filename)
       filename);
     return false;
   }
-  int err = Util::fallocate(*tmp_file.fd, sizeof(SharedRegion));
+  const size_t size = region_size(num_buckets);
+  int err = Util::fallocate(*tmp_file.fd, size);
   if (err) {
     LOG("Failed to allocate file space for inode cache: {}", strerror(err));
     return false;
   }
-  SharedRegion* sr =
-    reinterpret_cast<SharedRegion*>(mmap(nullptr,
-                                         sizeof(SharedRegion),
-                                         PROT_READ | PROT_WRITE,
-                                         MAP_SHARED,
-                                         *tmp_file.fd,
-                                         0));
+  SharedRegion* sr = reinterpret_cast<SharedRegion*>(mmap(
+    nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *tmp_file.fd, 0));
   if (sr == reinterpret_cast<void*>(-1)) {
     LOG("Failed to mmap new inode cache: {}", strerror(errno));
     return false;
@@ -285,19 +481,57 @@ InodeCache::create_new_file(const std::string& filename)
 
   // Initialize new shared region.
   sr->version = k_version;
+  sr->num_buckets = num_buckets;
+#ifdef HAVE_PTHREAD_MUTEX_ROBUST
   pthread_mutexattr_t mattr;
   pthread_mutexattr_init(&mattr);
   pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
   pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  for (uint32_t i = 0; i < num_buckets; ++i) {
+    pthread_mutex_init(&sr->buckets()[i].mt, &mattr);
+  }
 #endif
-  for (auto& bucket : sr->buckets) {
-    pthread_mutex_init(&bucket.mt, &mattr);
+
+  if (old_sr) {
+    // Rehash the entries of the old cache, oldest first so that the LRU order
+    // within each bucket is kept. Nobody else can see the new file yet, so
+    // its buckets don't need to be locked.
+    sr->hits = old_sr->hits.load();
+    sr->misses = old_sr->misses.load();
+    sr->errors = old_sr->errors.load();
+    sr->evictions = old_sr->evictions.load();
+    for (uint32_t i = 0; i < old_sr->num_buckets; ++i) {
+      with_bucket(old_sr, i, [&](Bucket* const old_bucket) {
+        for (uint32_t j = k_num_entries; j > 0; --j) {
+          const Entry& entry = old_bucket->entries[j - 1];
+          if (entry.key_digest == Digest()) {
+            continue;
+          }
+          Bucket& bucket =
+            sr->buckets()[bucket_index(entry.key_digest, num_buckets)];
+          memmove(&bucket.entries[1],
+                  &bucket.entries[0],
+                  sizeof(Entry) * (k_num_entries - 1));
+          bucket.entries[0] = entry;
+        }
+      });
+    }
   }
 
-  munmap(sr, sizeof(SharedRegion));
+  munmap(sr, size);
   tmp_file.fd.close();
 
+  if (old_sr) {
+    // Replace the old file. If several processes grow the cache at the same
+    // time, the last one wins and entries added by the others in the meantime
+    // are lost.
+    if (rename(tmp_file.path.c_str(), filename.c_str()) != 0) {
+      LOG("Failed to rename new inode cache: {}", strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
   // link() will fail silently if a file with the same name already exists.
   // This will be the case if two processes try to create a new file
   // simultaneously. Thus close the current file handle and reopen a new one,
@@ -314,6 +548,8 @@ InodeCache::create_new_file(const std::string& filename)
 bool
 InodeCache::initialize()
 {
+  std::lock_guard<std::mutex> lock(m_initialize_mutex);
+
   if (m_failed || !m_config.inode_cache()) {
     return false;
   }
@@ -322,13 +558,36 @@ InodeCache::initialize()
     return true;
   }
 
+  m_immutable_dirs.clear();
+  for (const auto& dir : Util::split_into_strings(
+         m_config.inode_cache_immutable_dirs(), PATH_DELIM)) {
+    if (Util::is_absolute_path(dir)) {
+      auto prefix = Util::normalize_absolute_path(dir);
+      if (!Util::ends_with(prefix, "/")) {
+        prefix += '/';
+      }
+      m_immutable_dirs.push_back(std::move(prefix));
+    }
+  }
+
+  const uint32_t num_buckets = num_buckets_for(m_config.inode_cache_entries());
   std::string filename = get_file();
-  if (m_sr || mmap_file(filename)) {
-    return true;
+  if (mmap_file(filename)) {
+    if (m_sr->num_buckets < num_buckets) {
+      // Keep using the current file if growing it fails.
+      if (create_new_file(filename, num_buckets, m_sr)) {
+        mmap_file(filename);
+      }
+    }
+    if (m_sr) {
+      return true;
+    }
+    m_failed = true;
+    return false;
   }
 
   // Try to create a new cache if we failed to map an existing file.
-  create_new_file(filename);
+  create_new_file(filename, num_buckets);
 
   // Concurrent processes could try to create new files simultaneously and the
   // file that actually landed on disk will be from the process that won the
@@ -342,14 +601,16 @@ InodeCache::initialize()
   return false;
 }
 
-InodeCache::InodeCache(const Config& config) : m_config(config)
+InodeCache::InodeCache(const Config& config, const StatCache* stat_cache)
+  : m_config(config),
+    m_stat_cache(stat_cache)
 {
 }
 
 InodeCache::~InodeCache()
 {
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
+    munmap(m_sr, m_sr_size);
   }
 }
 
@@ -367,31 +628,74 @@ InodeCache::get(const std::string& path,
   if (!hash_inode(path, type, key_digest)) {
     return false;
   }
+  return get_by_key(key_digest, path, file_digest, return_value);
+}
 
-  bool found = false;
-  const bool success = with_bucket(key_digest, [&](Bucket* const bucket) {
-    for (uint32_t i = 0; i < k_num_entries; ++i) {
-      if (bucket->entries[i].key_digest == key_digest) {
-        if (i > 0) {
-          Entry tmp = bucket->entries[i];
-          memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
-          bucket->entries[0] = tmp;
-        }
+bool
+InodeCache::get_by_content_id(string_view content_id,
+                              ContentType type,
+                              Digest& file_digest,
+                              int* return_value)
+{
+  if (!initialize()) {
+    return false;
+  }
+  return get_by_key(hash_content_id(content_id, type),
+                    FMT("content {}", content_id),
+                    file_digest,
+                    return_value);
+}
 
-        file_digest = bucket->entries[0].file_digest;
-        if (return_value) {
-          *return_value = bucket->entries[0].return_value;
-        }
-        found = true;
-        break;
+bool
+InodeCache::get_by_key(const Digest& key_digest,
+                       const std::string& description,
+                       Digest& file_digest,
+                       int* return_value)
+{
+  Bucket* const bucket =
+    &m_sr->buckets()[bucket_index(key_digest, m_sr->num_buckets)];
+  Entry entries[k_num_entries];
+  if (!read_entries(bucket, entries)) {
+    // Writers keep modifying the bucket or one died while doing so.
+    const bool success = with_bucket(key_digest, [&](Bucket* const b) {
+      memcpy(entries, b->entries, sizeof(entries));
+    });
+    if (!success) {
+      return false;
+    }
+  }
+
+  bool found = false;
+  for (uint32_t i = 0; i < k_num_entries; ++i) {
+    if (entries[i].key_digest == key_digest) {
+      file_digest = entries[i].file_digest;
+      if (return_value) {
+        *return_value = entries[i].return_value;
+      }
+      found = true;
+
+      if (i > 0) {
+        // Move the entry first in LRU order, unless somebody else is busy with
+        // the bucket.
+        with_bucket(
+          key_digest,
+          [&](Bucket* const b) {
+            for (uint32_t j = 1; j < k_num_entries; ++j) {
+              if (b->entries[j].key_digest == key_digest) {
+                Entry tmp = b->entries[j];
+                memmove(&b->entries[1], &b->entries[0], sizeof(Entry) * j);
+                b->entries[0] = tmp;
+                break;
+              }
+            }
+          },
+          false);
       }
+      break;
     }
-  });
-  if (!success) {
-    return false;
   }
 
-  LOG("inode cache {}: {}", found ? "hit" : "miss", path);
+  LOG("inode cache {}: {}", found ? "hit" : "miss", description);
 
   if (m_config.debug()) {
     if (found) {
@@ -399,10 +703,13 @@ InodeCache::get(const std::string& path,
     } else {
       ++m_sr->misses;
     }
-    LOG("accumulated stats for inode cache: hits={}, misses={}, errors={}",
-        m_sr->hits.load(),
-        m_sr->misses.load(),
-        m_sr->errors.load());
+    LOG(
+      "accumulated stats for inode cache: hits={}, misses={}, errors={},"
+      " evictions={}",
+      m_sr->hits.load(),
+      m_sr->misses.load(),
+      m_sr->errors.load(),
+      m_sr->evictions.load());
   }
   return found;
 }
@@ -421,11 +728,43 @@ InodeCache::put(const std::string& path,
   if (!hash_inode(path, type, key_digest)) {
     return false;
   }
+  return put_by_key(key_digest, path, file_digest, return_value);
+}
+
+bool
+InodeCache::put_by_content_id(string_view content_id,
+                              ContentType type,
+                              const Digest& file_digest,
+                              int return_value)
+{
+  if (!initialize()) {
+    return false;
+  }
+  return put_by_key(hash_content_id(content_id, type),
+                    FMT("content {}", content_id),
+                    file_digest,
+                    return_value);
+}
 
+bool
+InodeCache::put_by_key(const Digest& key_digest,
+                       const std::string& description,
+                       const Digest& file_digest,
+                       int return_value)
+{
+  bool evicted = false;
   const bool success = with_bucket(key_digest, [&](Bucket* const bucket) {
-    memmove(&bucket->entries[1],
-            &bucket->entries[0],
-            sizeof(Entry) * (k_num_entries - 1));
+    // Replace an existing entry for the key, otherwise the least recently
+    // used one.
+    uint32_t i = 0;
+    while (i < k_num_entries - 1 && bucket->entries[i].key_digest != key_digest
+           && bucket->entries[i].key_digest != Digest()) {
+      ++i;
+    }
+    evicted = i == k_num_entries - 1
+              && bucket->entries[i].key_digest != key_digest
+              && bucket->entries[i].key_digest != Digest();
+    memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
 
     bucket->entries[0].key_digest = key_digest;
     bucket->entries[0].file_digest = file_digest;
@@ -436,7 +775,11 @@ InodeCache::put(const std::string& path,
     return false;
   }
 
-  LOG("inode cache insert: {}", path);
+  LOG("inode cache insert: {}", description);
+
+  if (evicted && m_config.debug()) {
+    ++m_sr->evictions;
+  }
 
   return true;
 }
@@ -449,7 +792,7 @@ InodeCache::drop()
     return false;
   }
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
+    munmap(m_sr, m_sr_size);
     m_sr = nullptr;
   }
   return true;
@@ -458,6 +801,16 @@ InodeCache::drop()
 std::string
 InodeCache::get_file()
 {
+  if (!m_config.inode_cache_dir().empty()) {
+    return FMT("{}/inode-cache.v{}", m_config.inode_cache_dir(), k_version);
+  }
+
+  // The keys are only meaningful on this host, so prefer the per-user runtime
+  // directory since temporary_dir may be on a cache directory shared over NFS.
+  const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && Stat::stat(runtime_dir).is_directory()) {
+    return FMT("{}/ccache-inode-cache/inode-cache.v{}", runtime_dir, k_version);
+  }
   return FMT("{}/inode-cache.v{}", m_config.temporary_dir(), k_version);
 }
 
@@ -478,3 +831,34 @@ InodeCache::get_errors()
 {
   return initialize() ? m_sr->errors.load() : -1;
 }
+
+int64_t
+InodeCache::get_evictions()
+{
+  return initialize() ? m_sr->evictions.load() : -1;
+}
+
+int64_t
+InodeCache::get_occupancy()
+{
+  if (!initialize()) {
+    return -1;
+  }
+  int64_t occupancy = 0;
+  for (uint32_t i = 0; i < m_sr->num_buckets; ++i) {
+    with_bucket(m_sr, i, [&](Bucket* const bucket) {
+      for (const auto& entry : bucket->entries) {
+        if (entry.key_digest != Digest()) {
+          ++occupancy;
+        }
+      }
+    });
+  }
+  return occupancy;
+}
+
+int64_t
+InodeCache::get_capacity()
+{
+  return initialize() ? int64_t{m_sr->num_buckets} * k_num_entries : -1;
+}
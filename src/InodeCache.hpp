@@ -22,12 +22,17 @@
 
 #include "config.h"
 
+#include "third_party/nonstd/string_view.hpp"
+
 #include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
 
 class Config;
 class Context;
 class Digest;
+class StatCache;
 
 class InodeCache
 {
@@ -42,7 +47,8 @@ public:
     precompiled_header = 3,
   };
 
-  InodeCache(const Config& config);
+  // Files are stat-ed through `stat_cache` if given.
+  InodeCache(const Config& config, const StatCache* stat_cache = nullptr);
   ~InodeCache();
 
   // Get saved hash digest and return value from a previous call to
@@ -64,6 +70,18 @@ public:
            const Digest& file_digest,
            int return_value = 0);
 
+  // Like get and put but for a file whose content is identified by
+  // `content_id`, e.g. a git blob id, instead of by its inode. Only put values
+  // that depend on nothing but the content.
+  bool get_by_content_id(nonstd::string_view content_id,
+                         ContentType type,
+                         Digest& file_digest,
+                         int* return_value = nullptr);
+  bool put_by_content_id(nonstd::string_view content_id,
+                         ContentType type,
+                         const Digest& file_digest,
+                         int return_value = 0);
+
   // Unmaps the current cache and removes the mapped file from disk.
   //
   // Returns true on success, false otherwise.
@@ -90,6 +108,18 @@ public:
   // Counters are incremented in debug mode only.
   int64_t get_errors();
 
+  // Returns total number of entries that were evicted to make room for new
+  // ones.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_evictions();
+
+  // Returns number of entries currently in the cache.
+  int64_t get_occupancy();
+
+  // Returns maximum number of entries in the cache.
+  int64_t get_capacity();
+
 private:
   struct Bucket;
   struct Entry;
@@ -97,15 +127,41 @@ private:
   struct SharedRegion;
   using BucketHandler = std::function<void(Bucket* bucket)>;
 
+  static size_t region_size(uint32_t num_buckets);
   bool mmap_file(const std::string& inode_cache_file);
-  static bool
-  hash_inode(const std::string& path, ContentType type, Digest& digest);
+  bool hash_inode(const std::string& path, ContentType type, Digest& digest);
+  static Digest hash_content_id(nonstd::string_view content_id,
+                                ContentType type);
+  bool get_by_key(const Digest& key_digest,
+                  const std::string& description,
+                  Digest& file_digest,
+                  int* return_value);
+  bool put_by_key(const Digest& key_digest,
+                  const std::string& description,
+                  const Digest& file_digest,
+                  int return_value);
+  bool is_in_immutable_dir(const std::string& path) const;
+  static uint32_t bucket_index(const Digest& key_digest, uint32_t num_buckets);
+  bool read_entries(Bucket* bucket, Entry* entries);
+  static int lock_bucket(Bucket* bucket, bool wait);
+  static void unlock_bucket(Bucket* bucket);
   bool with_bucket(const Digest& key_digest,
-                   const BucketHandler& bucket_handler);
-  static bool create_new_file(const std::string& filename);
+                   const BucketHandler& bucket_handler,
+                   bool wait = true);
+  bool with_bucket(SharedRegion* sr,
+                   uint32_t index,
+                   const BucketHandler& bucket_handler,
+                   bool wait = true);
+  bool create_new_file(const std::string& filename,
+                       uint32_t num_buckets,
+                       SharedRegion* old_sr = nullptr);
   bool initialize();
 
   const Config& m_config;
+  const StatCache* m_stat_cache;
   struct SharedRegion* m_sr = nullptr;
+  size_t m_sr_size = 0;
   bool m_failed = false;
+  std::vector<std::string> m_immutable_dirs;
+  std::mutex m_initialize_mutex;
 };
@@ -0,0 +1,187 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Jobserver.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+struct Connection
+{
+  // Whether MAKEFLAGS announces a jobserver.
+  bool present = false;
+  // Non-blocking descriptor to read tokens from, or -1 if the jobserver can't
+  // be used.
+  int read_fd = -1;
+  int write_fd = -1;
+};
+
+#ifndef _WIN32
+
+Connection
+connect()
+{
+  Connection connection;
+  const char* makeflags = getenv("MAKEFLAGS");
+  const auto auth = makeflags ? Jobserver::parse_auth(makeflags) : nullopt;
+  if (!auth) {
+    return connection;
+  }
+  connection.present = true;
+
+  if (Util::starts_with(*auth, "fifo:")) {
+    const std::string path = auth->substr(5);
+    connection.read_fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    connection.write_fd =
+      open(path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  } else {
+    const auto fds = Util::split_into_strings(*auth, ",");
+    if (fds.size() == 2) {
+      const int read_fd = atoi(fds[0].c_str());
+      const int write_fd = atoi(fds[1].c_str());
+      // make only lets commands that it considers recursive inherit the pipe
+      // but exports MAKEFLAGS to all of them, so the descriptors may be closed
+      // or reused.
+      struct stat read_st;
+      struct stat write_st;
+      if (fstat(read_fd, &read_st) == 0 && S_ISFIFO(read_st.st_mode)
+          && fstat(write_fd, &write_st) == 0 && S_ISFIFO(write_st.st_mode)) {
+        // The pipe is shared with make and the other jobs, so open a private
+        // file description of it to be able to read without blocking.
+        connection.read_fd = open(FMT("/dev/fd/{}", read_fd).c_str(),
+                                  O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        connection.write_fd = write_fd;
+      }
+    }
+  }
+
+  if (connection.read_fd == -1 || connection.write_fd == -1) {
+    LOG("Jobserver {} is not available; not running anything in parallel",
+        *auth);
+    connection.read_fd = -1;
+  } else {
+    LOG("Using jobserver {}", *auth);
+  }
+  return connection;
+}
+
+#endif
+
+const Connection&
+connection()
+{
+#ifndef _WIN32
+  static const Connection connection = connect();
+#else
+  static const Connection connection = Connection();
+#endif
+  return connection;
+}
+
+} // namespace
+
+namespace Jobserver {
+
+optional<std::string>
+parse_auth(string_view makeflags)
+{
+  optional<std::string> auth;
+  for (const auto& word : Util::split_into_views(makeflags, " ")) {
+    for (const char* option : {"--jobserver-auth=", "--jobserver-fds="}) {
+      if (Util::starts_with(word, option)) {
+        auth = std::string(word.substr(strlen(option)));
+      }
+    }
+  }
+  return auth;
+}
+
+Tokens::Tokens(size_t wanted) : m_count(0)
+{
+  const auto& jobserver = connection();
+  if (!jobserver.present) {
+    m_count = wanted;
+    return;
+  }
+  if (jobserver.read_fd == -1 || wanted == 0) {
+    return;
+  }
+
+#ifndef _WIN32
+  m_tokens.resize(wanted);
+  ssize_t n;
+  do {
+    n = read(jobserver.read_fd, &m_tokens[0], wanted);
+  } while (n == -1 && errno == EINTR);
+  m_tokens.resize(n > 0 ? n : 0);
+  m_count = m_tokens.size();
+  LOG("Acquired {} of {} wanted jobserver tokens", m_count, wanted);
+#endif
+}
+
+Tokens::~Tokens()
+{
+  release();
+}
+
+size_t
+Tokens::count() const
+{
+  return m_count;
+}
+
+void
+Tokens::release()
+{
+#ifndef _WIN32
+  if (!m_tokens.empty()) {
+    const auto& jobserver = connection();
+    size_t written = 0;
+    while (written < m_tokens.size()) {
+      const ssize_t n = write(jobserver.write_fd,
+                              m_tokens.data() + written,
+                              m_tokens.size() - written);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        LOG("Failed to return jobserver tokens: {}", strerror(errno));
+        break;
+      }
+      written += n;
+    }
+  }
+#endif
+  forget();
+}
+
+void
+Tokens::forget()
+{
+  m_tokens.clear();
+  m_count = 0;
+}
+
+} // namespace Jobserver
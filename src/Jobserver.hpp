@@ -0,0 +1,65 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Client side of the GNU make jobserver protocol, which ninja also implements.
+// When ccache is run by make with a jobserver, each thread or process that
+// ccache runs in addition to the one it was started as needs a token from the
+// jobserver, so internal parallelism doesn't steal cores from other jobs.
+namespace Jobserver {
+
+// Return the value of the last --jobserver-auth (or older --jobserver-fds)
+// option in `makeflags`, e.g. "3,4" or "fifo:/tmp/GMfifo1234".
+nonstd::optional<std::string> parse_auth(nonstd::string_view makeflags);
+
+class Tokens : NonCopyable
+{
+public:
+  // Acquire up to `wanted` tokens without waiting for them. All are granted if
+  // ccache isn't run by make with a jobserver and none if the jobserver
+  // announced in MAKEFLAGS can't be used.
+  explicit Tokens(size_t wanted);
+
+  ~Tokens();
+
+  size_t count() const;
+
+  // Return the tokens to the jobserver.
+  void release();
+
+  // Drop the tokens without returning them, e.g. in a parent after forking a
+  // child process that releases them.
+  void forget();
+
+private:
+  // Bytes read from the jobserver, which must be written back as they were.
+  std::string m_tokens;
+  size_t m_count;
+};
+
+} // namespace Jobserver
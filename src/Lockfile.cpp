@@ -18,7 +18,9 @@
 
 #include "Lockfile.hpp"
 
+#include "Fd.hpp"
 #include "Logging.hpp"
+#include "StdMakeUnique.hpp"
 #include "Util.hpp"
 #include "fmtmacros.hpp"
 
@@ -29,20 +31,94 @@
 #include "third_party/fmt/core.h"
 
 #include <algorithm>
+#include <chrono>
 #include <sstream>
 #include <thread>
 
+#ifdef __linux__
+#  include <poll.h>
+#  include <sys/inotify.h>
+#endif
+
 namespace {
 
 #ifndef _WIN32
 
+// Waits for the removal of a lockfile so that a waiter can retry as soon as the
+// lock is released instead of when its sleep ends. Only the lockfile's own
+// removal counts, so locks of other paths in the same directory don't
+// interfere. Removals on other hosts (NFS) are not seen, so waiting is always
+// bounded by a timeout.
+class RemovalWatch
+{
+public:
+  explicit RemovalWatch(const std::string& lockfile);
+
+  // Wait until the lockfile is removed or `usec` microseconds have passed.
+  void wait(uint32_t usec);
+
+private:
+  Fd m_fd;
+  std::string m_name;
+};
+
+RemovalWatch::RemovalWatch(const std::string& lockfile)
+  : m_name(Util::base_name(lockfile))
+{
+#ifdef __linux__
+  m_fd = Fd(inotify_init1(IN_CLOEXEC | IN_NONBLOCK));
+  if (m_fd
+      && inotify_add_watch(*m_fd,
+                           std::string(Util::dir_name(lockfile)).c_str(),
+                           IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR)
+           < 0) {
+    m_fd.close();
+  }
+#endif
+}
+
+void
+RemovalWatch::wait(uint32_t usec)
+{
+#ifdef __linux__
+  if (m_fd) {
+    const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::microseconds(usec);
+    while (true) {
+      const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+      pollfd pfd{*m_fd, POLLIN, 0};
+      // Round up so that a short wait doesn't become a busy loop.
+      if (left.count() < 0 || poll(&pfd, 1, left.count() + 1) <= 0) {
+        return;
+      }
+      alignas(inotify_event) char buffer[4096];
+      const ssize_t size = read(*m_fd, buffer, sizeof(buffer));
+      for (ssize_t offset = 0; offset < size;) {
+        const auto event =
+          reinterpret_cast<const inotify_event*>(buffer + offset);
+        if (event->len > 0 && m_name == event->name) {
+          return;
+        }
+        offset += sizeof(inotify_event) + event->len;
+      }
+    }
+  }
+#endif
+  usleep(usec);
+}
+
 bool
-do_acquire_posix(const std::string& lockfile, uint32_t staleness_limit)
+do_acquire_posix(const std::string& lockfile,
+                 uint32_t staleness_limit,
+                 uint32_t timeout)
 {
   const uint32_t max_to_sleep = 10000; // Microseconds.
   uint32_t to_sleep = 1000;            // Microseconds.
   uint32_t slept = 0;                  // Microseconds.
+  uint64_t total_slept = 0;            // Microseconds.
   std::string initial_content;
+  std::unique_ptr<RemovalWatch> watch;
 
   std::stringstream ss;
   ss << Util::get_hostname() << ':' << getpid() << ':'
@@ -105,12 +181,30 @@ do_acquire_posix(const std::string& lockfile, uint32_t staleness_limit)
       initial_content = content;
     }
 
-    if (slept <= staleness_limit) {
-      LOG("lockfile_acquire: failed to acquire {}; sleeping {} microseconds",
+    if (!watch) {
+      // Retry once the watch is in place in case the lock was released
+      // before.
+      watch = std::make_unique<RemovalWatch>(lockfile);
+      continue;
+    }
+
+    if (total_slept >= timeout) {
+      LOG("lockfile_acquire: timed out acquiring {}", lockfile);
+      return false;
+    } else if (slept <= staleness_limit) {
+      LOG("lockfile_acquire: failed to acquire {}; waiting {} microseconds",
           lockfile,
           to_sleep);
-      usleep(to_sleep);
-      slept += to_sleep;
+      // Count the time actually waited since the wait ends early when the
+      // lockfile is removed.
+      const auto start = std::chrono::steady_clock::now();
+      watch->wait(to_sleep);
+      const auto waited = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start)
+          .count());
+      slept += waited;
+      total_slept += waited;
       to_sleep = std::min(max_to_sleep, 2 * to_sleep);
     } else if (content != initial_content) {
       LOG("lockfile_acquire: gave up acquiring {}", lockfile);
@@ -132,7 +226,9 @@ do_acquire_posix(const std::string& lockfile, uint32_t staleness_limit)
 #else // !_WIN32
 
 HANDLE
-do_acquire_win32(const std::string& lockfile, uint32_t staleness_limit)
+do_acquire_win32(const std::string& lockfile,
+                 uint32_t staleness_limit,
+                 uint32_t timeout)
 {
   unsigned to_sleep = 1000;      // Microseconds.
   unsigned max_to_sleep = 10000; // Microseconds.
@@ -173,7 +269,7 @@ do_acquire_win32(const std::string& lockfile, uint32_t staleness_limit)
       break;
     }
 
-    if (slept > staleness_limit) {
+    if (slept > staleness_limit || slept >= timeout) {
       LOG("lockfile_acquire: gave up acquiring {}", lockfile);
       break;
     }
@@ -193,13 +289,15 @@ do_acquire_win32(const std::string& lockfile, uint32_t staleness_limit)
 
 } // namespace
 
-Lockfile::Lockfile(const std::string& path, uint32_t staleness_limit)
+Lockfile::Lockfile(const std::string& path,
+                   uint32_t staleness_limit,
+                   uint32_t timeout)
   : m_lockfile(path + ".lock")
 {
 #ifndef _WIN32
-  m_acquired = do_acquire_posix(m_lockfile, staleness_limit);
+  m_acquired = do_acquire_posix(m_lockfile, staleness_limit, timeout);
 #else
-  m_handle = do_acquire_win32(m_lockfile, staleness_limit);
+  m_handle = do_acquire_win32(m_lockfile, staleness_limit, timeout);
 #endif
   if (acquired()) {
     LOG("Acquired lock {}", m_lockfile);
@@ -22,12 +22,19 @@
 
 #include <string>
 
+// On POSIX systems, the lock is a symbolic link named `path` + ".lock", which
+// works on NFS and with older ccache versions. On Linux, a contending process
+// watches the directory with inotify while it waits, so that it wakes up as
+// soon as the lock is released locally instead of when its sleep ends.
 class Lockfile
 {
 public:
   // Acquire a lock on `path`. Break the lock (or give up, depending on
-  // implementation) after `staleness_limit` Microseconds.
-  Lockfile(const std::string& path, uint32_t staleness_limit = 2000000);
+  // implementation) after `staleness_limit` Microseconds. Give up without
+  // breaking the lock if it can't be acquired within `timeout` Microseconds.
+  Lockfile(const std::string& path,
+           uint32_t staleness_limit = 2000000,
+           uint32_t timeout = UINT32_MAX);
 
   // Release the lock if acquired.
   ~Lockfile();
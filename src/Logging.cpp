@@ -26,6 +26,8 @@
 #include "execute.hpp"
 #include "fmtmacros.hpp"
 
+#include <mutex>
+
 #ifdef HAVE_SYSLOG_H
 #  include <syslog.h>
 #endif
@@ -53,6 +55,12 @@ namespace {
 std::string logfile_path;
 File logfile;
 
+// Messages to the log file are collected in logfile_buffer and written with a
+// single write when it reaches logfile_buffer_size bytes and at exit, if
+// enabled via Config::log_buffer_size().
+uint64_t logfile_buffer_size = 0;
+std::string logfile_buffer;
+
 // Whether to use syslog() instead.
 bool use_syslog;
 
@@ -62,6 +70,9 @@ std::string debug_log_buffer;
 // Whether debug logging is enabled via configuration or environment variable.
 bool debug_log_enabled = false;
 
+// Serializes logging from worker threads.
+std::mutex log_mutex;
+
 // Print error message to stderr about failure writing to the log file and exit
 // with failure.
 [[noreturn]] void
@@ -75,9 +86,28 @@ print_fatal_error_and_exit()
   exit(EXIT_FAILURE);
 }
 
+void
+flush_logfile_buffer()
+{
+  if (logfile_buffer.empty()) {
+    return;
+  }
+  try {
+    // The log file is opened in append mode so the buffer ends up contiguous
+    // in the log file even if other ccache processes write to it.
+    Util::write_fd(
+      fileno(*logfile), logfile_buffer.data(), logfile_buffer.size());
+  } catch (const Error&) {
+    print_fatal_error_and_exit();
+  }
+  logfile_buffer.clear();
+}
+
 void
 do_log(string_view message, bool bulk)
 {
+  std::lock_guard<std::mutex> lock(log_mutex);
+
   static char prefix[200];
 
   if (!bulk) {
@@ -98,11 +128,18 @@ do_log(string_view message, bool bulk)
              static_cast<int>(getpid()));
   }
 
-  if (logfile
-      && (fputs(prefix, *logfile) == EOF
-          || fwrite(message.data(), message.length(), 1, *logfile) != 1
-          || fputc('\n', *logfile) == EOF
-          || (!bulk && fflush(*logfile) == EOF))) {
+  if (logfile && logfile_buffer_size > 0) {
+    logfile_buffer += prefix;
+    logfile_buffer.append(message.data(), message.length());
+    logfile_buffer += '\n';
+    if (logfile_buffer.size() >= logfile_buffer_size) {
+      flush_logfile_buffer();
+    }
+  } else if (logfile
+             && (fputs(prefix, *logfile) == EOF
+                 || fwrite(message.data(), message.length(), 1, *logfile) != 1
+                 || fputc('\n', *logfile) == EOF
+                 || (!bulk && fflush(*logfile) == EOF))) {
     print_fatal_error_and_exit();
   }
 #ifdef HAVE_SYSLOG
@@ -143,6 +180,7 @@ init(const Config& config)
     logfile.open(logfile_path, "a");
     if (logfile) {
       Util::set_cloexec_flag(fileno(*logfile));
+      logfile_buffer_size = config.log_buffer_size();
     } else {
       print_fatal_error_and_exit();
     }
@@ -173,6 +211,15 @@ bulk_log(string_view message)
   do_log(message, true);
 }
 
+void
+flush()
+{
+  std::lock_guard<std::mutex> lock(log_mutex);
+  if (logfile) {
+    flush_logfile_buffer();
+  }
+}
+
 void
 dump_log(const std::string& path)
 {
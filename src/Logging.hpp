@@ -71,6 +71,9 @@ void log(nonstd::string_view message);
 // timestamp.
 void bulk_log(nonstd::string_view message);
 
+// Write messages buffered due to Config::log_buffer_size() to the log file.
+void flush();
+
 // Write the current log memory buffer `path`.
 void dump_log(const std::string& path);
 
@@ -0,0 +1,297 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "LruIndex.hpp"
+
+#include "AtomicFile.hpp"
+#include "CacheFile.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+#include <functional>
+
+using nonstd::string_view;
+
+const char LruIndex::k_file_name[] = "lru";
+
+namespace {
+
+const string_view k_header_prefix = "ccache lru index 2 ";
+
+// A rebuilt index may grow to this many times its size, or to at least
+// k_min_size_limit, before it's removed.
+const uint64_t k_growth_factor = 4;
+const uint64_t k_min_size_limit = 1024 * 1024;
+
+// Parse the header line at the start of `data`. Returns the size limit of the
+// index and sets `*header_end` to the position after the line and `*inflation`
+// to the inflation value, or returns 0 if the header is invalid.
+uint64_t
+parse_header(string_view data,
+             size_t* header_end = nullptr,
+             double* inflation = nullptr)
+{
+  const size_t end = data.find('\n');
+  if (!Util::starts_with(data, k_header_prefix) || end == string_view::npos) {
+    return 0;
+  }
+  const std::string fields(
+    data.substr(k_header_prefix.size(), end - k_header_prefix.size()));
+  char* q;
+  const uint64_t limit = strtoull(fields.c_str(), &q, 10);
+  if (header_end) {
+    *header_end = end + 1;
+  }
+  if (inflation) {
+    *inflation = strtod(q, nullptr);
+  }
+  return limit;
+}
+
+// Read the size limit from the header of the index open as `fd`.
+uint64_t
+read_size_limit(int fd)
+{
+  char buffer[64];
+  if (lseek(fd, 0, SEEK_SET) != 0) {
+    return 0;
+  }
+  const auto n = read(fd, buffer, sizeof(buffer));
+  return n > 0 ? parse_header(string_view(buffer, n)) : 0;
+}
+
+std::string
+format_sizes(uint64_t file_size, uint64_t content_size)
+{
+  return file_size > 0 ? FMT("{}:{}", file_size, content_size) : "-";
+}
+
+// Append a record with `fields` (as returned by `get_fields`, which is only
+// called if there is an index) between the time and the name.
+void
+append_record(const std::string& cache_dir,
+              const std::string& path,
+              const std::function<std::string()>& get_fields)
+{
+  const auto name = LruIndex::name_from_path(cache_dir, path);
+  if (name.empty()) {
+    return;
+  }
+  const auto index_path =
+    FMT("{}/{}/{}", cache_dir, name[0], LruIndex::k_file_name);
+
+  // Don't create the index; a record is of no use until the subdirectory has
+  // been scanned by a cleanup, which rebuilds the index.
+  Fd fd(open(index_path.c_str(), O_RDWR | O_APPEND | O_BINARY));
+  if (!fd) {
+    return;
+  }
+
+  const auto record = FMT("{} {} {}\n", time(nullptr), get_fields(), name);
+  try {
+    Util::write_fd(*fd, record.data(), record.size());
+  } catch (const Error& e) {
+    LOG("Failed to write to {}: {}", index_path, e.what());
+    return;
+  }
+
+  struct stat st;
+  if (fstat(*fd, &st) == 0
+      && static_cast<uint64_t>(st.st_size) > k_min_size_limit
+      && static_cast<uint64_t>(st.st_size) > read_size_limit(*fd)) {
+    LOG("Removing {} since it has grown too large", index_path);
+    Util::unlink_safe(index_path);
+  }
+}
+
+} // namespace
+
+void
+LruIndex::record_store(const std::string& cache_dir,
+                       const std::string& path,
+                       uint64_t size_on_disk,
+                       uint64_t cost,
+                       const std::string& namespace_tag)
+{
+  append_record(cache_dir, path, [&] {
+    const CacheFile cache_file(path);
+    const uint64_t file_size = cache_file.lstat().size();
+    return FMT("{} {} {} {}",
+               size_on_disk,
+               cost,
+               format_sizes(file_size,
+                            file_size > 0 ? cache_file.content_size() : 0),
+               namespace_tag.empty() ? "-" : namespace_tag);
+  });
+}
+
+void
+LruIndex::record_use(const std::string& cache_dir, const std::string& path)
+{
+  append_record(cache_dir, path, [] { return std::string("-"); });
+}
+
+double
+LruIndex::Entry::priority(uint64_t total_size) const
+{
+  // Compile time saved per KiB of disk space, counting the store as a use.
+  return inflation
+         + static_cast<double>(hits + 1) * cost
+             / std::max<double>(total_size / 1024.0, 1.0);
+}
+
+std::string
+LruIndex::name_from_path(const std::string& cache_dir, const std::string& path)
+{
+  if (path.size() <= cache_dir.size() + 1 || !Util::starts_with(path, cache_dir)
+      || path[cache_dir.size()] != '/') {
+    return {};
+  }
+  std::string name;
+  name.reserve(path.size() - cache_dir.size());
+  std::copy_if(path.begin() + cache_dir.size(),
+               path.end(),
+               std::back_inserter(name),
+               [](char c) { return c != '/'; });
+  return name;
+}
+
+LruIndex::LruIndex(const std::string& subdir)
+  : m_path(FMT("{}/{}", subdir, k_file_name))
+{
+}
+
+bool
+LruIndex::load()
+{
+  std::string data;
+  try {
+    data = Util::read_file(m_path);
+  } catch (const Error&) {
+    return false;
+  }
+
+  size_t header_end;
+  if (parse_header(data, &header_end, &m_inflation) == 0) {
+    LOG("Ignoring {} since it has an invalid header", m_path);
+    return false;
+  }
+
+  m_entries.clear();
+  m_loaded_size = apply_records(data, header_end);
+  return true;
+}
+
+void
+LruIndex::save()
+{
+  if (m_loaded_size > 0) {
+    Fd fd(open(m_path.c_str(), O_RDONLY | O_BINARY));
+    if (fd && lseek(*fd, m_loaded_size, SEEK_SET) != -1) {
+      std::string appended;
+      Util::read_fd(*fd, [&appended](const void* data, size_t size) {
+        appended.append(static_cast<const char*>(data), size);
+      });
+      m_loaded_size += apply_records(appended, 0);
+    }
+  }
+
+  std::string records;
+  for (const auto& entry : m_entries) {
+    records += FMT("{} {} {} {} {} {} {} {}\n",
+                   entry.second.time,
+                   entry.second.size,
+                   entry.second.cost,
+                   entry.second.hits,
+                   entry.second.inflation,
+                   format_sizes(entry.second.file_size,
+                                entry.second.content_size),
+                   entry.second.namespace_tag.empty()
+                     ? "-"
+                     : entry.second.namespace_tag,
+                   entry.first);
+  }
+  const uint64_t limit =
+    std::max(k_min_size_limit, k_growth_factor * (records.size() + 64));
+
+  try {
+    AtomicFile file(m_path, AtomicFile::Mode::binary);
+    file.write(
+      FMT("{}{} {}\n{}", k_header_prefix, limit, m_inflation, records));
+    file.commit();
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", m_path, e.what());
+  }
+}
+
+size_t
+LruIndex::apply_records(const std::string& data, size_t pos)
+{
+  while (true) {
+    const size_t end = data.find('\n', pos);
+    if (end == std::string::npos) {
+      // Ignore an incomplete record; it's picked up by save if it's completed
+      // by then.
+      break;
+    }
+
+    const auto fields = Util::split_into_strings(
+      string_view(data).substr(pos, end - pos), " ");
+    // Store records without cost and namespace tag (3 fields) or sizes (5
+    // fields) and cleanup records without sizes (7 fields) are written by older
+    // versions.
+    const size_t n = fields.size();
+    const bool is_use = n == 3 && fields[1] == "-";
+    const bool is_cleanup = n >= 7;
+    const bool has_sizes = n == 6 || n == 8;
+    if (n < 3 || n > 8 || n == 4) {
+      LOG("Ignoring bad record in {}", m_path);
+    } else if (is_use) {
+      const auto entry = m_entries.find(fields[2]);
+      if (entry != m_entries.end()) {
+        entry->second.time = strtoll(fields[0].c_str(), nullptr, 10);
+        ++entry->second.hits;
+        entry->second.inflation = m_inflation;
+      }
+    } else {
+      Entry& entry = m_entries[fields.back()];
+      entry.time = strtoll(fields[0].c_str(), nullptr, 10);
+      entry.size = strtoull(fields[1].c_str(), nullptr, 10);
+      entry.cost = n > 3 ? strtoull(fields[2].c_str(), nullptr, 10) : 0;
+      entry.hits = is_cleanup ? strtoull(fields[3].c_str(), nullptr, 10) : 0;
+      entry.inflation =
+        is_cleanup ? strtod(fields[4].c_str(), nullptr) : m_inflation;
+      entry.file_size = 0;
+      entry.content_size = 0;
+      if (has_sizes) {
+        char* q;
+        entry.file_size = strtoull(fields[n - 3].c_str(), &q, 10);
+        entry.content_size = *q == ':' ? strtoull(q + 1, nullptr, 10) : 0;
+      }
+      const auto& tag = fields[n - 2];
+      entry.namespace_tag = n > 3 && tag != "-" ? tag : "";
+    }
+
+    pos = end + 1;
+  }
+  return pos;
+}
@@ -0,0 +1,136 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <string>
+#include <unordered_map>
+
+// An on-disk index of when the files in a level 1 cache subdirectory were last
+// used and how much space they take up, so that automatic cleanups can find the
+// least recently used files without scanning the whole subdirectory.
+//
+// The index is a text file named "lru" in the subdirectory. It starts with a
+// header line written when the index is (re)built by a cleanup, followed by one
+// record per line: "<time> <size on disk> <cost> <sizes> <namespace tag> <name>"
+// when a file is stored and "<time> - <name>" when it is used. Entries written
+// by a cleanup also hold the number of uses and the inflation value of the last
+// use: "<time> <size on disk> <cost> <hits> <inflation> <sizes> <namespace tag>
+// <name>". The sizes are "<file size>:<content size>", see `Entry::file_size`,
+// or "-" if unknown. A missing namespace tag is written as "-". Names are paths
+// relative to the cache directory without slashes so that they don't change
+// when a file is moved to another cache level.
+//
+// The cost (the compile time in milliseconds that a hit saves), the number of
+// hits and the inflation value are used for cost-aware cleanup, see
+// `Entry::priority`. The inflation value of the index is raised by such
+// cleanups to the priority of the last evicted file, so that files that have
+// not been used for a while are eventually evicted even if they are costly.
+//
+// Records are only appended to an existing index. If the index is missing, or
+// if it has grown too much since it was last rebuilt and therefore has been
+// removed, the next cleanup falls back to scanning the subdirectory.
+class LruIndex
+{
+public:
+  static const char k_file_name[];
+
+  struct Entry
+  {
+    int64_t time = 0;
+    uint64_t size = 0;
+    uint64_t cost = 0;
+    uint64_t hits = 0;
+    double inflation = 0.0;
+    // See Statistics::namespace_tag.
+    std::string namespace_tag;
+    // The apparent size of the file and, if it's a cache entry, the size of
+    // its uncompressed content as read from the header (otherwise 0), so that
+    // `ccache --show-compression` doesn't have to open the file. Only valid if
+    // file_size matches the current size of the file.
+    uint64_t file_size = 0;
+    uint64_t content_size = 0;
+
+    // The GreedyDual-Size-Frequency priority of a file that, together with the
+    // files evicted along with it, takes up `total_size` bytes. Files with the
+    // lowest priority are evicted first.
+    double priority(uint64_t total_size) const;
+  };
+
+  // Record that the cache file at `path` in `cache_dir` has been stored and now
+  // takes up `size_on_disk` bytes. `cost` is the compile time in milliseconds
+  // that a hit saves, if known, and `namespace_tag` identifies the namespace
+  // that stored the file, if any. The file sizes are read from the file.
+  static void record_store(const std::string& cache_dir,
+                           const std::string& path,
+                           uint64_t size_on_disk,
+                           uint64_t cost = 0,
+                           const std::string& namespace_tag = {});
+
+  // Record that the cache file at `path` in `cache_dir` has been used.
+  static void record_use(const std::string& cache_dir, const std::string& path);
+
+  // Get the index name of the cache file at `path` in `cache_dir`. Returns an
+  // empty string if `path` is not in a cache subdirectory.
+  static std::string name_from_path(const std::string& cache_dir,
+                                    const std::string& path);
+
+  explicit LruIndex(const std::string& subdir);
+
+  // Read the index. Returns false if there is no valid index.
+  bool load();
+
+  // Rewrite the index from the current entries, including records appended by
+  // other processes since `load`.
+  void save();
+
+  std::unordered_map<std::string, Entry>& entries();
+
+  double inflation() const;
+  void set_inflation(double value);
+
+private:
+  const std::string m_path;
+  std::unordered_map<std::string, Entry> m_entries;
+  uint64_t m_loaded_size = 0;
+  double m_inflation = 0;
+
+  // Apply the complete records in `data` starting at `pos`. Returns the
+  // position after the last complete record.
+  size_t apply_records(const std::string& data, size_t pos);
+};
+
+inline std::unordered_map<std::string, LruIndex::Entry>&
+LruIndex::entries()
+{
+  return m_entries;
+}
+
+inline double
+LruIndex::inflation() const
+{
+  return m_inflation;
+}
+
+inline void
+LruIndex::set_inflation(double value)
+{
+  m_inflation = value;
+}
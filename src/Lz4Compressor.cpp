@@ -0,0 +1,124 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Lz4Compressor.hpp"
+
+#include "Logging.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+
+Lz4Compressor::Lz4Compressor(FILE* stream, int8_t compression_level)
+  : m_stream(stream), m_context(nullptr), m_preferences()
+{
+  if (compression_level == 0) {
+    compression_level = default_compression_level;
+    LOG("Using default compression level {}", compression_level);
+  }
+
+  m_compression_level =
+    std::min<int>(compression_level, LZ4F_compressionLevel_max());
+  if (m_compression_level != compression_level) {
+    LOG("Using compression level {} (max liblz4 level) instead of {}",
+        m_compression_level,
+        compression_level);
+  }
+
+  const size_t ret = LZ4F_createCompressionContext(&m_context, LZ4F_VERSION);
+  if (LZ4F_isError(ret)) {
+    throw Error("error initializing lz4 compression context");
+  }
+
+  m_preferences.compressionLevel = m_compression_level;
+  m_buffer.resize(
+    std::max<size_t>(LZ4F_HEADER_SIZE_MAX,
+                     LZ4F_compressBound(READ_BUFFER_SIZE, &m_preferences)));
+}
+
+Lz4Compressor::~Lz4Compressor()
+{
+  LZ4F_freeCompressionContext(m_context);
+}
+
+int8_t
+Lz4Compressor::actual_compression_level() const
+{
+  return m_compression_level;
+}
+
+void
+Lz4Compressor::write(const void* data, size_t count)
+{
+  begin_frame();
+
+  const auto* input = static_cast<const uint8_t*>(data);
+  while (count > 0) {
+    const size_t input_size = std::min(count, READ_BUFFER_SIZE);
+    const size_t ret = LZ4F_compressUpdate(m_context,
+                                           m_buffer.data(),
+                                           m_buffer.size(),
+                                           input,
+                                           input_size,
+                                           nullptr);
+    if (LZ4F_isError(ret)) {
+      throw Error("error compressing lz4 data: {}", LZ4F_getErrorName(ret));
+    }
+    write_buffer(ret);
+    input += input_size;
+    count -= input_size;
+  }
+}
+
+void
+Lz4Compressor::finalize()
+{
+  begin_frame();
+
+  const size_t ret =
+    LZ4F_compressEnd(m_context, m_buffer.data(), m_buffer.size(), nullptr);
+  if (LZ4F_isError(ret)) {
+    throw Error("error ending lz4 frame: {}", LZ4F_getErrorName(ret));
+  }
+  write_buffer(ret);
+}
+
+void
+Lz4Compressor::begin_frame()
+{
+  // The frame header must not be written by the constructor since the caller
+  // may write its own header to the stream before the compressed data.
+  if (m_frame_started) {
+    return;
+  }
+  const size_t ret = LZ4F_compressBegin(
+    m_context, m_buffer.data(), m_buffer.size(), &m_preferences);
+  if (LZ4F_isError(ret)) {
+    throw Error("error starting lz4 frame: {}", LZ4F_getErrorName(ret));
+  }
+  write_buffer(ret);
+  m_frame_started = true;
+}
+
+void
+Lz4Compressor::write_buffer(size_t size)
+{
+  if (fwrite(m_buffer.data(), 1, size, m_stream) != size
+      || ferror(m_stream)) {
+    throw Error("failed to write to lz4 output stream");
+  }
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Compressor.hpp"
+#include "NonCopyable.hpp"
+
+#include <lz4frame.h>
+
+#include <vector>
+
+// A compressor of an LZ4 frame.
+class Lz4Compressor : public Compressor, NonCopyable
+{
+public:
+  // Parameters:
+  // - stream: The file to write data to.
+  // - compression_level: Desired compression level. Levels below 3 select the
+  //   fast LZ4 algorithm (negative levels being even faster) and higher levels
+  //   select LZ4HC.
+  Lz4Compressor(FILE* stream, int8_t compression_level);
+
+  ~Lz4Compressor() override;
+
+  int8_t actual_compression_level() const override;
+  void write(const void* data, size_t count) override;
+  void finalize() override;
+
+  constexpr static int8_t default_compression_level = 1;
+
+private:
+  FILE* m_stream;
+  LZ4F_cctx* m_context;
+  LZ4F_preferences_t m_preferences;
+  std::vector<uint8_t> m_buffer;
+  int8_t m_compression_level;
+  bool m_frame_started = false;
+
+  void begin_frame();
+  void write_buffer(size_t size);
+};
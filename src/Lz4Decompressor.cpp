@@ -0,0 +1,102 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Lz4Decompressor.hpp"
+
+#include "assertions.hpp"
+#include "exceptions.hpp"
+
+Lz4Decompressor::Lz4Decompressor(FILE* stream)
+  : m_stream(stream),
+    m_context(nullptr),
+    m_input_size(0),
+    m_input_consumed(0),
+    m_reached_frame_end(false)
+{
+  size_t ret = LZ4F_createDecompressionContext(&m_context, LZ4F_VERSION);
+  if (LZ4F_isError(ret)) {
+    throw Error("failed to initialize lz4 decompression context");
+  }
+}
+
+Lz4Decompressor::~Lz4Decompressor()
+{
+  LZ4F_freeDecompressionContext(m_context);
+}
+
+void
+Lz4Decompressor::read(void* data, size_t count)
+{
+  auto* output = static_cast<uint8_t*>(data);
+  size_t bytes_read = 0;
+  while (bytes_read < count) {
+    if (m_reached_frame_end) {
+      throw Error("failed to read from lz4 input stream");
+    }
+    bytes_read += decompress(output + bytes_read, count - bytes_read);
+  }
+}
+
+void
+Lz4Decompressor::finalize()
+{
+  // The frame end mark (and possibly a frame checksum) may still be unread.
+  while (!m_reached_frame_end) {
+    size_t input_consumed;
+    decompress(nullptr, 0, &input_consumed);
+    if (!m_reached_frame_end && input_consumed == 0) {
+      throw Error("garbage data at end of lz4 input stream");
+    }
+  }
+}
+
+size_t
+Lz4Decompressor::decompress(uint8_t* data,
+                             size_t count,
+                             size_t* input_consumed)
+{
+  ASSERT(m_input_size >= m_input_consumed);
+  if (m_input_size == m_input_consumed) {
+    m_input_size = fread(m_input_buffer, 1, sizeof(m_input_buffer), m_stream);
+    if (m_input_size == 0) {
+      throw Error("failed to read from lz4 input stream");
+    }
+    m_input_consumed = 0;
+  }
+
+  size_t output_size = count;
+  size_t input_size = m_input_size - m_input_consumed;
+  const size_t ret = LZ4F_decompress(m_context,
+                                     data,
+                                     &output_size,
+                                     m_input_buffer + m_input_consumed,
+                                     &input_size,
+                                     nullptr);
+  if (LZ4F_isError(ret)) {
+    throw Error("failed to read from lz4 input stream: {}",
+                LZ4F_getErrorName(ret));
+  }
+  m_input_consumed += input_size;
+  if (input_consumed) {
+    *input_consumed = input_size;
+  }
+  if (ret == 0) {
+    m_reached_frame_end = true;
+  }
+  return output_size;
+}
@@ -0,0 +1,54 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Decompressor.hpp"
+#include "NonCopyable.hpp"
+
+#include <lz4frame.h>
+
+// A decompressor of an LZ4 frame.
+class Lz4Decompressor : public Decompressor, NonCopyable
+{
+public:
+  // Parameters:
+  // - stream: The file to read data from.
+  explicit Lz4Decompressor(FILE* stream);
+
+  ~Lz4Decompressor() override;
+
+  void read(void* data, size_t count) override;
+  void finalize() override;
+
+private:
+  FILE* m_stream;
+  LZ4F_dctx* m_context;
+  uint8_t m_input_buffer[READ_BUFFER_SIZE];
+  size_t m_input_size;
+  size_t m_input_consumed;
+  bool m_reached_frame_end;
+
+  // Decompress from the input buffer into `data`, refilling the input buffer
+  // when needed. Returns the number of bytes written to `data` and stores the
+  // number of consumed input bytes in `*input_consumed` if non-null.
+  size_t
+  decompress(uint8_t* data, size_t count, size_t* input_consumed = nullptr);
+};
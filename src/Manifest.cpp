@@ -25,81 +25,135 @@
 #include "Config.hpp"
 #include "Context.hpp"
 #include "Digest.hpp"
+#include "Fd.hpp"
 #include "File.hpp"
+#include "FileWatch.hpp"
 #include "Hash.hpp"
+#include "Jobserver.hpp"
+#include "Lockfile.hpp"
 #include "Logging.hpp"
+#include "MtimeJournal.hpp"
+#include "Result.hpp"
+#include "Statistics.hpp"
 #include "StdMakeUnique.hpp"
+#include "ThreadPool.hpp"
+#include "Tracing.hpp"
+#include "Util.hpp"
 #include "ccache.hpp"
 #include "fmtmacros.hpp"
 #include "hashutil.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <numeric>
+
 // Manifest data format
 // ====================
 //
-// Integers are big-endian.
+// Integers are big-endian. The body can be queried in place without parsing it
+// into separate objects.
 //
-// <manifest>      ::= <header> <body> <epilogue
-// <header>        ::= <magic> <version> <compr_type> <compr_level>
-//                     <content_len>
-// <magic>         ::= 4 bytes ("cCrS")
-// <version>       ::= uint8_t
-// <compr_type>    ::= <compr_none> | <compr_zstd>
-// <compr_none>    ::= 0 (uint8_t)
-// <compr_zstd>    ::= 1 (uint8_t)
-// <compr_level>   ::= int8_t
-// <content_len>   ::= uint64_t ; size of file if stored uncompressed
-// <body>          ::= <paths> <includes> <results> ; body is potentially
-//                                                  ; compressed
-// <paths>         ::= <n_paths> <path_entry>*
-// <n_paths>       ::= uint32_t
-// <path_entry>    ::= <path_len> <path>
-// <path_len>      ::= uint16_t
-// <path>          ::= path_len bytes
-// <includes>      ::= <n_includes> <include_entry>*
-// <n_includes>    ::= uint32_t
-// <include_entry> ::= <path_index> <digest> <fsize> <mtime> <ctime>
-// <path_index>    ::= uint32_t
-// <digest>        ::= Digest::size() bytes
-// <fsize>         ::= uint64_t ; file size
-// <mtime>         ::= int64_t ; modification time
-// <ctime>         ::= int64_t ; status change time
-// <results>       ::= <n_results> <result>*
-// <n_results>     ::= uint32_t
-// <result>        ::= <n_indexes> <include_index>* <name>
-// <n_indexes>     ::= uint32_t
-// <include_index> ::= uint32_t
-// <name>          ::= Digest::size() bytes
-// <epilogue>      ::= <checksum>
-// <checksum>      ::= uint64_t ; XXH3 of content bytes
+// <manifest>       ::= <header> <body> <epilogue>
+// <header>         ::= <magic> <version> <compr_type> <compr_level>
+//                      <content_len>
+// <magic>          ::= 4 bytes ("cCmF")
+// <version>        ::= uint8_t
+// <compr_type>     ::= <compr_none> | <compr_zstd>
+// <compr_none>     ::= 0 (uint8_t)
+// <compr_zstd>     ::= 1 (uint8_t)
+// <compr_level>    ::= int8_t
+// <content_len>    ::= uint64_t ; size of file if stored uncompressed
+// <body>           ::= <n_paths> <n_includes> <n_results> <path_offsets>
+//                      <result_offsets> <includes> <path_data> <results>
+//                      ; body is potentially compressed
+// <n_paths>        ::= uint32_t
+// <n_includes>     ::= uint32_t
+// <n_results>      ::= uint32_t
+// <path_offsets>   ::= <path_offset>{n_paths + 1}
+// <path_offset>    ::= uint32_t ; path i is the bytes between path_offset i
+//                               ; and i + 1 in path_data
+// <result_offsets> ::= <result_offset>{n_results}
+// <result_offset>  ::= uint32_t ; offset of result i in results
+// <includes>       ::= <include_entry>{n_includes}
+// <include_entry>  ::= <path_index> <digest> <fsize> <mtime> <ctime>
+// <path_index>     ::= uint32_t
+// <digest>         ::= Digest::size() bytes
+// <fsize>          ::= uint64_t ; file size
+// <mtime>          ::= int64_t ; modification time
+// <ctime>          ::= int64_t ; status change time
+// <path_data>      ::= path_offset n_paths bytes
+// <results>        ::= <result>{n_results}
+// <result>         ::= <name> <last_used> <n_indexes> <include_index>*
+//                      ; results are ordered from least to most recently used
+// <name>           ::= Digest::size() bytes
+// <last_used>      ::= int64_t ; time of the last put or hit
+// <n_indexes>      ::= uint32_t
+// <include_index>  ::= uint32_t
+// <epilogue>       ::= <checksum>
+// <checksum>       ::= uint64_t ; XXH3 of content bytes
 //
 // Sketch of concrete layout:
 
-// <magic>         4 bytes
-// <version>       1 byte
-// <compr_type>    1 byte
-// <compr_level>   1 byte
-// <content_len>   8 bytes
+// <magic>          4 bytes
+// <version>        1 byte
+// <compr_type>     1 byte
+// <compr_level>    1 byte
+// <content_len>    8 bytes
 // --- [potentially compressed from here] -------------------------------------
-// <n_paths>       4 bytes
-// <path_len>      2 bytes
-// <path>          path_len bytes
+// <n_paths>        4 bytes
+// <n_includes>     4 bytes
+// <n_results>      4 bytes
+// <path_offset>    4 bytes
 // ...
-// ----------------------------------------------------------------------------
-// <n_includes>    4 bytes
-// <path_index>    4 bytes
-// <digest>        Digest::size() bytes
-// <fsize>         8 bytes
-// <mtime>         8 bytes
-// <ctime>         8 bytes
+// <result_offset>  4 bytes
 // ...
 // ----------------------------------------------------------------------------
-// <n_results>     4 bytes
-// <n_indexes>     4 bytes
-// <include_index> 4 bytes
+// <path_index>     4 bytes
+// <digest>         Digest::size() bytes
+// <fsize>          8 bytes
+// <mtime>          8 bytes
+// <ctime>          8 bytes
 // ...
-// <name>          Digest::size() bytes
+// ----------------------------------------------------------------------------
+// <path_data>      path_offset n_paths bytes
+// ----------------------------------------------------------------------------
+// <name>           Digest::size() bytes
+// <last_used>      8 bytes
+// <n_indexes>      4 bytes
+// <include_index>  4 bytes
 // ...
-// checksum        8 bytes
+// ----------------------------------------------------------------------------
+// checksum         8 bytes
+//
+//
+// Appended result entries
+// =======================
+//
+// New and refreshed result entries are normally appended to the manifest file
+// instead of recompressing and rewriting the whole file. Appended entries are
+// merged into the body when the manifest is read, and the file is rewritten
+// with all entries in the body once there are k_max_appended_entries of them or
+// when entries are evicted.
+//
+// <appended>         ::= <log_record>*
+// <log_record>       ::= <record_body> <record_size> <record_checksum>
+//                        <log_magic>
+// <record_body>      ::= <name> <last_used> <n_includes> <log_include>*
+// <n_includes>       ::= uint32_t
+// <log_include>      ::= <path_len> <path> <digest> <fsize> <mtime> <ctime>
+// <path_len>         ::= uint32_t
+// <path>             ::= path_len bytes
+// <record_size>      ::= uint32_t ; size of record_body
+// <record_checksum>  ::= uint64_t ; XXH3 of record_body
+// <log_magic>        ::= 4 bytes ("cCmL")
+//
+// Records are self-contained and uncompressed. They are found by walking
+// backwards from the end of the file since the size of the compressed body is
+// not known until it has been decompressed. Each record is written with a
+// single write call to a file opened for appending, so concurrent appends
+// don't interleave. A damaged record (e.g. after a crash) ends the walk, which
+// loses the records before it, just like a lost race between two writers.
 //
 //
 // Version history
@@ -107,13 +161,56 @@
 //
 // 1: Introduced in ccache 3.0. (Files are always compressed with gzip.)
 // 2: Introduced in ccache 4.0.
+// 4: Introduced in ccache 4.2. (Fixed layout with offset tables, result entries
+//    in LRU order.) Version 3 was never released.
+//
+// Manifests of version 2 are still read. They are rewritten in the current
+// version when used or by `ccache --migrate`.
 
 using nonstd::nullopt;
 using nonstd::optional;
+using nonstd::string_view;
+
+// Version 2 stores the same information as the current version except for
+// <last_used>, but as a sequence of variable size records:
+//
+// <body>          ::= <paths> <includes> <results>
+// <paths>         ::= <n_paths> <path_entry>*
+// <path_entry>    ::= <path_len> <path>
+// <path_len>      ::= uint16_t
+// <includes>      ::= <n_includes> <include_entry>*
+// <results>       ::= <n_results> <result>*
+// <result>        ::= <n_indexes> <include_index>* <name>
+//
+// <n_*>, <path>, <include_entry>, <include_index> and <name> are as in the
+// current version.
+const uint8_t k_previous_version = 2;
 
-const uint32_t k_max_manifest_entries = 100;
 const uint32_t k_max_manifest_file_info_entries = 10000;
 
+// Number of appended result entries that triggers a rewrite of the manifest.
+const size_t k_max_appended_entries = 16;
+
+const uint8_t k_log_magic[4] = {'c', 'C', 'm', 'L'};
+const size_t k_log_footer_size = 4 + 8 + 4;
+
+// The last use time of the most recently used result entry is refreshed at
+// most this often so that hits don't rewrite the manifest every time.
+const int64_t k_last_used_resolution = 60 * 60;
+
+// Include files of manifests with fewer files are verified serially since
+// starting and handing work to other threads costs more than it saves. See the
+// Manifest/get benchmarks.
+const size_t k_min_files_for_parallel_verification = 16;
+
+// Synchronizing with the file watcher costs about as much as stating a few
+// files, so it's only done for manifests with more files than this.
+const size_t k_min_files_for_file_watch = 16;
+
+// Verifying fewer include files than this is too quick for reading the likely
+// result ahead to pay off.
+const size_t k_min_files_for_result_readahead = 16;
+
 namespace {
 
 struct FileInfo
@@ -138,148 +235,359 @@ operator==(const FileInfo& lhs, const FileInfo& rhs)
          && lhs.ctime == rhs.ctime;
 }
 
-} // namespace
-
-namespace std {
-
-template<> struct hash<FileInfo>
-{
-  size_t
-  operator()(const FileInfo& file_info) const
-  {
-    static_assert(sizeof(FileInfo) == 48, "unexpected size"); // No padding.
-    Checksum checksum;
-    checksum.update(&file_info, sizeof(file_info));
-    return checksum.digest();
-  }
-};
-
-} // namespace std
-
-namespace {
-
 struct ResultEntry
 {
-  // Indexes to file_infos.
-  std::vector<uint32_t> file_info_indexes;
+  // Span of the result's indexes in ManifestData::file_info_indexes.
+  uint32_t first_index;
+  uint32_t index_count;
 
   // Name of the result.
   Digest name;
+
+  // Time of the last put or hit.
+  int64_t last_used;
 };
 
-bool
-operator==(const ResultEntry& lhs, const ResultEntry& rhs)
+// An include file of a result entry to add, with FileInfo::index ignored.
+using Include = std::pair<string_view, FileInfo>;
+
+FileInfo
+make_file_info(const StatCache& stat_cache,
+               const std::string& path,
+               const Digest& digest,
+               time_t time_of_compilation,
+               bool save_timestamp)
 {
-  return lhs.file_info_indexes == rhs.file_info_indexes && lhs.name == rhs.name;
+  FileInfo fi;
+  fi.index = 0;
+  fi.digest = digest;
+
+  // file_stat.{m,c}time() have a resolution of 1 second, so we can cache the
+  // file's mtime and ctime only if they're at least one second older than
+  // time_of_compilation.
+  //
+  // file_stat.ctime() may be 0, so we have to check time_of_compilation
+  // against MAX(mtime, ctime).
+  //
+  // ccache only reads mtime/ctime if file_stat_match sloppiness is enabled,
+  // so mtimes/ctimes are stored as a dummy value (-1) if not enabled. This
+  // reduces the number of file_info entries for the common case.
+
+  auto file_stat = stat_cache.stat(path, Stat::OnError::log);
+  if (file_stat) {
+    if (save_timestamp
+        && time_of_compilation
+             > std::max(file_stat.mtime(), file_stat.ctime())) {
+      fi.mtime = file_stat.mtime();
+      fi.ctime = file_stat.ctime();
+    } else {
+      fi.mtime = -1;
+      fi.ctime = -1;
+    }
+    fi.fsize = file_stat.size();
+  } else {
+    fi.mtime = -1;
+    fi.ctime = -1;
+    fi.fsize = 0;
+  }
+
+  return fi;
 }
 
+// A manifest in memory. Paths are stored back to back in one buffer, file
+// infos as one array per field and the file info indexes of all result entries
+// in one array, so that reading even a manifest near
+// k_max_manifest_file_info_entries only needs a handful of allocations.
 struct ManifestData
 {
-  // Referenced include files.
-  std::vector<std::string> files;
-
-  // Information about referenced include files.
-  std::vector<FileInfo> file_infos;
+  // Referenced include files. Path i is path_data[path_offsets[i],
+  // path_offsets[i + 1]).
+  std::string path_data;
+  std::vector<uint32_t> path_offsets{0};
+
+  // Information about referenced include files, see FileInfo.
+  std::vector<uint32_t> fi_path_indexes;
+  std::vector<Digest> fi_digests;
+  std::vector<uint64_t> fi_sizes;
+  std::vector<int64_t> fi_mtimes;
+  std::vector<int64_t> fi_ctimes;
+
+  // Indexes to file infos, referenced by spans of result entries.
+  std::vector<uint32_t> file_info_indexes;
 
-  // Result names plus references to include file infos.
+  // Result names plus references to include file infos, from least to most
+  // recently used.
   std::vector<ResultEntry> results;
 
+  uint32_t
+  path_count() const
+  {
+    return path_offsets.size() - 1;
+  }
+
+  string_view
+  path(uint32_t index) const
+  {
+    return string_view(path_data).substr(
+      path_offsets[index], path_offsets[index + 1] - path_offsets[index]);
+  }
+
+  void
+  add_path(string_view path)
+  {
+    path_data.append(path.data(), path.size());
+    path_offsets.push_back(path_data.size());
+  }
+
+  uint32_t
+  file_info_count() const
+  {
+    return fi_path_indexes.size();
+  }
+
+  FileInfo
+  file_info(uint32_t index) const
+  {
+    FileInfo fi;
+    fi.index = fi_path_indexes[index];
+    fi.digest = fi_digests[index];
+    fi.fsize = fi_sizes[index];
+    fi.mtime = fi_mtimes[index];
+    fi.ctime = fi_ctimes[index];
+    return fi;
+  }
+
+  void
+  add_file_info(const FileInfo& fi)
+  {
+    fi_path_indexes.push_back(fi.index);
+    fi_digests.push_back(fi.digest);
+    fi_sizes.push_back(fi.fsize);
+    fi_mtimes.push_back(fi.mtime);
+    fi_ctimes.push_back(fi.ctime);
+  }
+
+  void
+  reserve_file_infos(size_t count)
+  {
+    fi_path_indexes.reserve(count);
+    fi_digests.reserve(count);
+    fi_sizes.reserve(count);
+    fi_mtimes.reserve(count);
+    fi_ctimes.reserve(count);
+  }
+
+  // Return the file info indexes of `entry`.
+  const uint32_t*
+  indexes_of(const ResultEntry& entry) const
+  {
+    return file_info_indexes.data() + entry.first_index;
+  }
+
   bool
   add_result_entry(
+    const StatCache& stat_cache,
     const Digest& result_digest,
-    const std::unordered_map<std::string, Digest>& included_files,
+    const std::unordered_map<nonstd::string_view, Digest, StringViewHash>&
+      included_files,
     time_t time_of_compilation,
     bool save_timestamp)
   {
-    std::unordered_map<std::string, uint32_t /*index*/> mf_files;
-    for (uint32_t i = 0; i < files.size(); ++i) {
-      mf_files.emplace(files[i], i);
+    std::vector<Include> includes;
+    includes.reserve(included_files.size());
+    std::string path;
+    for (const auto& item : included_files) {
+      path.assign(item.first.data(), item.first.size());
+      includes.emplace_back(item.first,
+                            make_file_info(stat_cache,
+                                           path,
+                                           item.second,
+                                           time_of_compilation,
+                                           save_timestamp));
     }
+    return add_entry(result_digest, includes, time_of_compilation);
+  }
 
-    std::unordered_map<FileInfo, uint32_t /*index*/> mf_file_infos;
-    for (uint32_t i = 0; i < file_infos.size(); ++i) {
-      mf_file_infos.emplace(file_infos[i], i);
+  // Add a result entry for `includes` or make an identical existing entry the
+  // most recently used one. Returns false if the manifest didn't change.
+  bool
+  add_entry(const Digest& result_digest,
+            const std::vector<Include>& includes,
+            int64_t last_used)
+  {
+    // Existing paths and file infos are found by binary search in index arrays
+    // sorted by path instead of in hash maps, which would need one allocation
+    // per path and file info.
+    std::vector<uint32_t> path_order(path_count());
+    std::iota(path_order.begin(), path_order.end(), 0);
+    std::sort(path_order.begin(),
+              path_order.end(),
+              [&](uint32_t lhs, uint32_t rhs) {
+                return path(lhs) < path(rhs);
+              });
+
+    std::vector<uint32_t> file_info_order(file_info_count());
+    std::iota(file_info_order.begin(), file_info_order.end(), 0);
+    std::stable_sort(file_info_order.begin(),
+                     file_info_order.end(),
+                     [&](uint32_t lhs, uint32_t rhs) {
+                       return fi_path_indexes[lhs] < fi_path_indexes[rhs];
+                     });
+
+    const uint32_t first_index = file_info_indexes.size();
+    for (const auto& include : includes) {
+      file_info_indexes.push_back(get_file_info_index(
+        include.first, include.second, path_order, file_info_order));
+    }
+    const uint32_t index_count = file_info_indexes.size() - first_index;
+
+    const auto it = std::find_if(
+      results.begin(), results.end(), [&](const ResultEntry& entry) {
+        return entry.name == result_digest && entry.index_count == index_count
+               && std::equal(indexes_of(entry),
+                             indexes_of(entry) + index_count,
+                             file_info_indexes.data() + first_index);
+      });
+    if (it == results.end()) {
+      results.push_back({first_index, index_count, result_digest, last_used});
+      return true;
     }
 
-    std::vector<uint32_t> file_info_indexes;
-    file_info_indexes.reserve(included_files.size());
+    file_info_indexes.resize(first_index);
+    if (it + 1 != results.end()
+        || it->last_used + k_last_used_resolution <= last_used) {
+      mark_used(it - results.begin(), last_used);
+      return true;
+    }
+    return false;
+  }
 
-    for (const auto& item : included_files) {
-      file_info_indexes.push_back(get_file_info_index(item.first,
-                                                      item.second,
-                                                      mf_files,
-                                                      mf_file_infos,
-                                                      time_of_compilation,
-                                                      save_timestamp));
+  // Make the result entry at `index` the most recently used one.
+  void
+  mark_used(size_t index, time_t time)
+  {
+    std::rotate(results.begin() + index,
+                results.begin() + index + 1,
+                results.end());
+    results.back().last_used = time;
+  }
+
+  // Remove result entries that were last used more than `max_age` seconds
+  // before `now` (if `max_age` is nonzero) and the least recently used entries
+  // beyond `max_entries`, and then file infos and paths that are no longer
+  // referenced. Returns the number of removed result entries.
+  size_t
+  evict(time_t now, uint32_t max_entries, uint64_t max_age)
+  {
+    const size_t old_size = results.size();
+    if (max_age > 0) {
+      const int64_t oldest = now - static_cast<int64_t>(max_age);
+      const auto too_old = [&](const ResultEntry& entry) {
+        return entry.last_used < oldest;
+      };
+      results.erase(std::remove_if(results.begin(), results.end(), too_old),
+                    results.end());
+    }
+    if (results.size() > max_entries) {
+      results.erase(results.begin(),
+                    results.begin() + (results.size() - max_entries));
     }
+    if (results.size() == old_size) {
+      return 0;
+    }
+    remove_unreferenced_files();
+    return old_size - results.size();
+  }
 
-    ResultEntry entry{std::move(file_info_indexes), result_digest};
-    if (std::find(results.begin(), results.end(), entry) == results.end()) {
-      results.push_back(std::move(entry));
-      return true;
-    } else {
-      return false;
+  // Remove result entries whose result is missing according to `is_missing`,
+  // and then file infos and paths that are no longer referenced. Returns the
+  // number of removed result entries.
+  size_t
+  prune(const std::function<bool(const Digest& result_name)>& is_missing)
+  {
+    const size_t old_size = results.size();
+    results.erase(std::remove_if(results.begin(),
+                                 results.end(),
+                                 [&](const ResultEntry& entry) {
+                                   return is_missing(entry.name);
+                                 }),
+                  results.end());
+    if (results.size() == old_size) {
+      return 0;
     }
+    remove_unreferenced_files();
+    return old_size - results.size();
   }
 
 private:
-  uint32_t
-  get_file_info_index(
-    const std::string& path,
-    const Digest& digest,
-    const std::unordered_map<std::string, uint32_t>& mf_files,
-    const std::unordered_map<FileInfo, uint32_t>& mf_file_infos,
-    time_t time_of_compilation,
-    bool save_timestamp)
+  void
+  remove_unreferenced_files()
   {
-    struct FileInfo fi;
-
-    auto f_it = mf_files.find(path);
-    if (f_it != mf_files.end()) {
-      fi.index = f_it->second;
-    } else {
-      files.push_back(path);
-      fi.index = files.size() - 1;
-    }
-
-    fi.digest = digest;
-
-    // file_stat.{m,c}time() have a resolution of 1 second, so we can cache the
-    // file's mtime and ctime only if they're at least one second older than
-    // time_of_compilation.
-    //
-    // file_stat.ctime() may be 0, so we have to check time_of_compilation
-    // against MAX(mtime, ctime).
-    //
-    // ccache only reads mtime/ctime if file_stat_match sloppiness is enabled,
-    // so mtimes/ctimes are stored as a dummy value (-1) if not enabled. This
-    // reduces the number of file_info entries for the common case.
-
-    auto file_stat = Stat::stat(path, Stat::OnError::log);
-    if (file_stat) {
-      if (save_timestamp
-          && time_of_compilation
-               > std::max(file_stat.mtime(), file_stat.ctime())) {
-        fi.mtime = file_stat.mtime();
-        fi.ctime = file_stat.ctime();
-      } else {
-        fi.mtime = -1;
-        fi.ctime = -1;
+    std::vector<int64_t> file_info_map(file_info_count(), -1);
+    std::vector<int64_t> file_map(path_count(), -1);
+    ManifestData kept;
+    kept.file_info_indexes.reserve(file_info_indexes.size());
+    kept.results.reserve(results.size());
+    for (const auto& result : results) {
+      const uint32_t first_index = kept.file_info_indexes.size();
+      const uint32_t* indexes = indexes_of(result);
+      for (uint32_t i = 0; i < result.index_count; ++i) {
+        const uint32_t index = indexes[i];
+        if (file_info_map[index] < 0) {
+          auto fi = file_info(index);
+          if (file_map[fi.index] < 0) {
+            file_map[fi.index] = kept.path_count();
+            kept.add_path(path(fi.index));
+          }
+          fi.index = file_map[fi.index];
+          file_info_map[index] = kept.file_info_count();
+          kept.add_file_info(fi);
+        }
+        kept.file_info_indexes.push_back(file_info_map[index]);
       }
-      fi.fsize = file_stat.size();
-    } else {
-      fi.mtime = -1;
-      fi.ctime = -1;
-      fi.fsize = 0;
+      kept.results.push_back(
+        {first_index, result.index_count, result.name, result.last_used});
     }
+    *this = std::move(kept);
+  }
 
-    auto fi_it = mf_file_infos.find(fi);
-    if (fi_it != mf_file_infos.end()) {
-      return fi_it->second;
+  uint32_t
+  get_file_info_index(string_view include_path,
+                      FileInfo fi,
+                      std::vector<uint32_t>& path_order,
+                      std::vector<uint32_t>& file_info_order)
+  {
+    const auto p_it = std::lower_bound(
+      path_order.begin(),
+      path_order.end(),
+      include_path,
+      [&](uint32_t index, string_view value) { return path(index) < value; });
+    if (p_it != path_order.end() && path(*p_it) == include_path) {
+      fi.index = *p_it;
     } else {
-      file_infos.push_back(fi);
-      return file_infos.size() - 1;
+      fi.index = path_count();
+      add_path(include_path);
+      path_order.insert(p_it, fi.index);
+    }
+
+    auto fi_it = std::lower_bound(
+      file_info_order.begin(),
+      file_info_order.end(),
+      fi.index,
+      [&](uint32_t index, uint32_t value) {
+        return fi_path_indexes[index] < value;
+      });
+    for (; fi_it != file_info_order.end()
+           && fi_path_indexes[*fi_it] == fi.index;
+         ++fi_it) {
+      if (file_info(*fi_it) == fi) {
+        return *fi_it;
+      }
     }
+    const uint32_t index = file_info_count();
+    add_file_info(fi);
+    file_info_order.insert(fi_it, index);
+    return index;
   }
 };
 
@@ -290,63 +598,598 @@ struct FileStats
   int64_t ctime;
 };
 
-std::unique_ptr<ManifestData>
-read_manifest(const std::string& path, FILE* dump_stream = nullptr)
+const size_t k_body_header_size = 3 * 4;
+const size_t k_file_info_size = 4 + Digest::size() + 8 + 8 + 8;
+const size_t k_result_header_size = Digest::size() + 8 + 4;
+
+// Read-only view of a manifest body, see "Manifest data format" above. Only
+// the sizes of the tables are checked up front; accessors throw Error when they
+// would read outside the body.
+class ManifestView
+{
+public:
+  struct Result
+  {
+    Digest name;
+    int64_t last_used;
+    uint32_t file_info_count;
+    const uint8_t* file_info_indexes;
+
+    uint32_t file_info_index(uint32_t i) const;
+  };
+
+  explicit ManifestView(string_view body);
+
+  uint32_t path_count() const;
+  string_view path(uint32_t index) const;
+
+  uint32_t file_info_count() const;
+  FileInfo file_info(uint32_t index) const;
+
+  uint32_t result_count() const;
+  Result result(uint32_t index) const;
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  uint32_t m_path_count;
+  uint32_t m_file_info_count;
+  uint32_t m_result_count;
+  size_t m_path_offsets;
+  size_t m_result_offsets;
+  size_t m_file_infos;
+  size_t m_path_data;
+  size_t m_results;
+
+  template<typename T> T read_int(size_t offset) const;
+};
+
+template<typename T>
+T
+ManifestView::read_int(size_t offset) const
+{
+  T value;
+  Util::big_endian_to_int(m_data + offset, value);
+  return value;
+}
+
+ManifestView::ManifestView(string_view body)
+  : m_data(reinterpret_cast<const uint8_t*>(body.data())),
+    m_size(body.size())
+{
+  if (m_size < k_body_header_size) {
+    throw Error("Truncated manifest body");
+  }
+  m_path_count = read_int<uint32_t>(0);
+  m_file_info_count = read_int<uint32_t>(4);
+  m_result_count = read_int<uint32_t>(8);
+
+  // 64-bit arithmetic can't overflow for 32-bit counts.
+  const uint64_t path_offsets = k_body_header_size;
+  const uint64_t result_offsets =
+    path_offsets + 4 * (static_cast<uint64_t>(m_path_count) + 1);
+  const uint64_t file_infos = result_offsets + 4 * uint64_t{m_result_count};
+  const uint64_t path_data =
+    file_infos + k_file_info_size * uint64_t{m_file_info_count};
+  if (path_data > m_size) {
+    throw Error("Truncated manifest body");
+  }
+  m_path_offsets = path_offsets;
+  m_result_offsets = result_offsets;
+  m_file_infos = file_infos;
+  m_path_data = path_data;
+
+  const uint64_t path_data_size =
+    read_int<uint32_t>(m_path_offsets + 4 * m_path_count);
+  if (m_path_data + path_data_size > m_size) {
+    throw Error("Truncated manifest body");
+  }
+  m_results = m_path_data + path_data_size;
+}
+
+inline uint32_t
+ManifestView::path_count() const
+{
+  return m_path_count;
+}
+
+string_view
+ManifestView::path(uint32_t index) const
+{
+  if (index >= m_path_count) {
+    throw Error("Bad path index {} in manifest", index);
+  }
+  const uint32_t begin = read_int<uint32_t>(m_path_offsets + 4 * index);
+  const uint32_t end = read_int<uint32_t>(m_path_offsets + 4 * (index + 1));
+  if (begin > end || m_path_data + end > m_results) {
+    throw Error("Bad offset for path {} in manifest", index);
+  }
+  return string_view(
+    reinterpret_cast<const char*>(m_data + m_path_data + begin), end - begin);
+}
+
+inline uint32_t
+ManifestView::file_info_count() const
+{
+  return m_file_info_count;
+}
+
+FileInfo
+ManifestView::file_info(uint32_t index) const
+{
+  if (index >= m_file_info_count) {
+    throw Error("Bad file info index {} in manifest", index);
+  }
+  const size_t offset = m_file_infos + k_file_info_size * index;
+  FileInfo fi;
+  fi.index = read_int<uint32_t>(offset);
+  memcpy(fi.digest.bytes(), m_data + offset + 4, Digest::size());
+  fi.fsize = read_int<uint64_t>(offset + 4 + Digest::size());
+  fi.mtime = read_int<int64_t>(offset + 4 + Digest::size() + 8);
+  fi.ctime = read_int<int64_t>(offset + 4 + Digest::size() + 16);
+  return fi;
+}
+
+inline uint32_t
+ManifestView::result_count() const
+{
+  return m_result_count;
+}
+
+ManifestView::Result
+ManifestView::result(uint32_t index) const
+{
+  if (index >= m_result_count) {
+    throw Error("Bad result index {} in manifest", index);
+  }
+  const uint64_t offset =
+    m_results + read_int<uint32_t>(m_result_offsets + 4 * index);
+  if (offset + k_result_header_size > m_size) {
+    throw Error("Bad offset for result {} in manifest", index);
+  }
+  Result result;
+  memcpy(result.name.bytes(), m_data + offset, Digest::size());
+  result.last_used = read_int<int64_t>(offset + Digest::size());
+  result.file_info_count = read_int<uint32_t>(offset + Digest::size() + 8);
+  result.file_info_indexes = m_data + offset + k_result_header_size;
+  if (offset + k_result_header_size + 4 * uint64_t{result.file_info_count}
+      > m_size) {
+    throw Error("Bad size of result {} in manifest", index);
+  }
+  return result;
+}
+
+inline uint32_t
+ManifestView::Result::file_info_index(uint32_t i) const
+{
+  uint32_t value;
+  Util::big_endian_to_int(file_info_indexes + 4 * i, value);
+  return value;
+}
+
+template<typename T>
+void
+append_int(std::string& buffer, T value)
+{
+  uint8_t bytes[sizeof(T)];
+  Util::int_to_big_endian(value, bytes);
+  buffer.append(reinterpret_cast<const char*>(bytes), sizeof(T));
+}
+
+// Bounds-checked reader of an appended result entry, or of another part of a
+// manifest described by `what`.
+class LogRecordReader
+{
+public:
+  explicit LogRecordReader(string_view record,
+                           const char* what = "appended result entry")
+    : m_record(record),
+      m_what(what)
+  {
+  }
+
+  string_view
+  read_bytes(size_t count)
+  {
+    if (count > m_record.size() - m_pos) {
+      throw Error("Truncated {} in manifest", m_what);
+    }
+    const auto bytes = m_record.substr(m_pos, count);
+    m_pos += count;
+    return bytes;
+  }
+
+  template<typename T>
+  T
+  read_int()
+  {
+    T value;
+    Util::big_endian_to_int(
+      reinterpret_cast<const uint8_t*>(read_bytes(sizeof(T)).data()), value);
+    return value;
+  }
+
+  bool
+  at_end() const
+  {
+    return m_pos == m_record.size();
+  }
+
+private:
+  string_view m_record;
+  const char* m_what;
+  size_t m_pos = 0;
+};
+
+// Append `body` and a log record footer to `buffer`.
+void
+append_log_record(std::string& buffer, string_view body)
+{
+  Checksum checksum;
+  checksum.update(body.data(), body.size());
+  buffer.append(body.data(), body.size());
+  append_int<uint32_t>(buffer, body.size());
+  append_int(buffer, checksum.digest());
+  buffer.append(reinterpret_cast<const char*>(k_log_magic),
+                sizeof(k_log_magic));
+}
+
+// Serialize `entry` of `mf` as a log record, see "Appended result entries"
+// above.
+std::string
+make_log_record(const ManifestData& mf, const ResultEntry& entry)
+{
+  std::string record;
+  record.append(reinterpret_cast<const char*>(entry.name.bytes()),
+                Digest::size());
+  append_int(record, entry.last_used);
+  append_int<uint32_t>(record, entry.index_count);
+  const uint32_t* indexes = mf.indexes_of(entry);
+  for (uint32_t i = 0; i < entry.index_count; ++i) {
+    const auto fi = mf.file_info(indexes[i]);
+    const auto file = mf.path(fi.index);
+    append_int<uint32_t>(record, file.length());
+    record.append(file.data(), file.length());
+    record.append(reinterpret_cast<const char*>(fi.digest.bytes()),
+                  Digest::size());
+    append_int(record, fi.fsize);
+    append_int(record, fi.mtime);
+    append_int(record, fi.ctime);
+  }
+
+  std::string log_record;
+  append_log_record(log_record, record);
+  return log_record;
+}
+
+// Merge a log record body into `mf`. Throws Error if the record is malformed.
+void
+apply_log_record(ManifestData& mf, string_view record)
+{
+  LogRecordReader reader(record);
+  Digest name;
+  memcpy(
+    name.bytes(), reader.read_bytes(Digest::size()).data(), Digest::size());
+  const auto last_used = reader.read_int<int64_t>();
+  const auto n_includes = reader.read_int<uint32_t>();
+
+  std::vector<Include> includes;
+  for (uint32_t i = 0; i < n_includes; ++i) {
+    const auto path_length = reader.read_int<uint32_t>();
+    const auto path = reader.read_bytes(path_length);
+    FileInfo fi;
+    fi.index = 0;
+    memcpy(fi.digest.bytes(),
+           reader.read_bytes(Digest::size()).data(),
+           Digest::size());
+    fi.fsize = reader.read_int<uint64_t>();
+    fi.mtime = reader.read_int<int64_t>();
+    fi.ctime = reader.read_int<int64_t>();
+    includes.emplace_back(path, fi);
+  }
+  if (!reader.at_end()) {
+    throw Error("Garbage at end of appended result entry in manifest");
+  }
+
+  mf.add_entry(name, includes, last_used);
+}
+
+// Read the bodies of the log records at the end of `stream`, oldest first.
+std::vector<std::string>
+read_log_records(FILE* stream)
+{
+  std::vector<std::string> records;
+  if (fseek(stream, 0, SEEK_END) != 0) {
+    return records;
+  }
+  long end = ftell(stream);
+
+  // The cache entry header is never part of a record.
+  const long min_record_start = 15;
+
+  while (end - min_record_start >= static_cast<long>(k_log_footer_size)) {
+    uint8_t footer[k_log_footer_size];
+    if (fseek(stream, end - k_log_footer_size, SEEK_SET) != 0
+        || fread(footer, sizeof(footer), 1, stream) != 1
+        || memcmp(footer + 12, k_log_magic, sizeof(k_log_magic)) != 0) {
+      break;
+    }
+    uint32_t size;
+    uint64_t expected_checksum;
+    Util::big_endian_to_int(footer, size);
+    Util::big_endian_to_int(footer + 4, expected_checksum);
+
+    const long start = end - static_cast<long>(k_log_footer_size) - size;
+    if (start < min_record_start) {
+      break;
+    }
+    std::string record(size, '\0');
+    if (fseek(stream, start, SEEK_SET) != 0
+        || (size > 0 && fread(&record[0], size, 1, stream) != 1)) {
+      break;
+    }
+    Checksum checksum;
+    checksum.update(record.data(), record.size());
+    if (checksum.digest() != expected_checksum) {
+      break;
+    }
+
+    records.push_back(std::move(record));
+    end = start;
+  }
+
+  std::reverse(records.begin(), records.end());
+  return records;
+}
+
+std::string serialize_manifest_body(const ManifestData& mf);
+
+// Convert a body of version 2 (see k_previous_version) to the current format.
+// All result entries get `last_used` as their time of last use. Indexes are
+// validated when the converted body is read.
+std::string
+upgrade_body_from_previous_version(string_view body, int64_t last_used)
+{
+  LogRecordReader reader(body, "body");
+  ManifestData mf;
+
+  const auto path_count = reader.read_int<uint32_t>();
+  for (uint32_t i = 0; i < path_count; ++i) {
+    const auto length = reader.read_int<uint16_t>();
+    mf.add_path(reader.read_bytes(length));
+  }
+
+  const auto file_info_count = reader.read_int<uint32_t>();
+  if (file_info_count > k_max_manifest_file_info_entries) {
+    throw Error("Too many include entries in manifest: {}", file_info_count);
+  }
+  mf.reserve_file_infos(file_info_count);
+  for (uint32_t i = 0; i < file_info_count; ++i) {
+    FileInfo fi;
+    fi.index = reader.read_int<uint32_t>();
+    memcpy(fi.digest.bytes(),
+           reader.read_bytes(Digest::size()).data(),
+           Digest::size());
+    fi.fsize = reader.read_int<uint64_t>();
+    fi.mtime = reader.read_int<int64_t>();
+    fi.ctime = reader.read_int<int64_t>();
+    mf.add_file_info(fi);
+  }
+
+  const auto result_count = reader.read_int<uint32_t>();
+  for (uint32_t i = 0; i < result_count; ++i) {
+    ResultEntry entry;
+    entry.first_index = mf.file_info_indexes.size();
+    entry.index_count = reader.read_int<uint32_t>();
+    for (uint32_t j = 0; j < entry.index_count; ++j) {
+      mf.file_info_indexes.push_back(reader.read_int<uint32_t>());
+    }
+    memcpy(entry.name.bytes(),
+           reader.read_bytes(Digest::size()).data(),
+           Digest::size());
+    entry.last_used = last_used;
+    mf.results.push_back(entry);
+  }
+
+  if (!reader.at_end()) {
+    throw Error("Garbage at end of manifest body");
+  }
+  return serialize_manifest_body(mf);
+}
+
+struct ManifestFile
+{
+  // Body in the format described in "Manifest data format" above.
+  std::string body;
+
+  // Bodies of appended log records, oldest first.
+  std::vector<std::string> log_records;
+
+  // Whether the file is stored in the previous format version.
+  bool outdated = false;
+};
+
+// Read a manifest file into memory. Returns nullopt if the manifest doesn't
+// exist.
+optional<ManifestFile>
+read_manifest_file(const std::string& path, FILE* dump_stream = nullptr)
 {
   File file(path, "rb");
   if (!file) {
-    return {};
+    return nullopt;
   }
 
-  CacheEntryReader reader(file.get(), Manifest::k_magic, Manifest::k_version);
+  ManifestFile manifest_file;
+  manifest_file.outdated =
+    CacheEntryReader::peek_version(file.get()) == k_previous_version;
+  CacheEntryReader reader(file.get(),
+                          Manifest::k_magic,
+                          manifest_file.outdated ? k_previous_version
+                                                 : Manifest::k_version);
 
   if (dump_stream) {
     reader.dump_header(dump_stream);
   }
 
+  manifest_file.body.resize(reader.payload_size());
+  reader.read(&manifest_file.body[0], manifest_file.body.size());
+  reader.finalize();
+  manifest_file.log_records = read_log_records(file.get());
+  if (manifest_file.outdated) {
+    // The file was last written when its newest entry was used.
+    manifest_file.body = upgrade_body_from_previous_version(
+      manifest_file.body, Stat::stat(path).mtime());
+  }
+  return manifest_file;
+}
+
+std::unique_ptr<ManifestData>
+manifest_data_from_file(const ManifestFile& manifest_file)
+{
+  const ManifestView view(manifest_file.body);
+
   auto mf = std::make_unique<ManifestData>();
 
-  uint32_t entry_count;
-  reader.read(entry_count);
-  for (uint32_t i = 0; i < entry_count; ++i) {
-    mf->files.emplace_back();
-    auto& entry = mf->files.back();
+  mf->path_offsets.reserve(view.path_count() + 1);
+  for (uint32_t i = 0; i < view.path_count(); ++i) {
+    mf->add_path(view.path(i));
+  }
 
-    uint16_t length;
-    reader.read(length);
-    entry.assign(length, 0);
-    reader.read(&entry[0], length);
+  // Indexes are validated here since ManifestData trusts them.
+  mf->reserve_file_infos(view.file_info_count());
+  for (uint32_t i = 0; i < view.file_info_count(); ++i) {
+    const auto fi = view.file_info(i);
+    if (fi.index >= view.path_count()) {
+      throw Error("Bad path index {} in manifest", fi.index);
+    }
+    mf->add_file_info(fi);
   }
 
-  reader.read(entry_count);
-  for (uint32_t i = 0; i < entry_count; ++i) {
-    mf->file_infos.emplace_back();
-    auto& entry = mf->file_infos.back();
+  mf->results.reserve(view.result_count());
+  for (uint32_t i = 0; i < view.result_count(); ++i) {
+    const auto result = view.result(i);
+    const uint32_t first_index = mf->file_info_indexes.size();
+    for (uint32_t j = 0; j < result.file_info_count; ++j) {
+      const uint32_t file_info_index = result.file_info_index(j);
+      if (file_info_index >= view.file_info_count()) {
+        throw Error("Bad file info index {} in manifest", file_info_index);
+      }
+      mf->file_info_indexes.push_back(file_info_index);
+    }
+    mf->results.push_back(
+      {first_index, result.file_info_count, result.name, result.last_used});
+  }
 
-    reader.read(entry.index);
-    reader.read(entry.digest.bytes(), Digest::size());
-    reader.read(entry.fsize);
-    reader.read(entry.mtime);
-    reader.read(entry.ctime);
+  for (const auto& record : manifest_file.log_records) {
+    apply_log_record(*mf, record);
   }
 
-  reader.read(entry_count);
-  for (uint32_t i = 0; i < entry_count; ++i) {
-    mf->results.emplace_back();
-    auto& entry = mf->results.back();
+  return mf;
+}
 
-    uint32_t file_info_count;
-    reader.read(file_info_count);
-    for (uint32_t j = 0; j < file_info_count; ++j) {
-      uint32_t file_info_index;
-      reader.read(file_info_index);
-      entry.file_info_indexes.push_back(file_info_index);
+// Read a manifest including appended result entries. Returns nullptr if the
+// manifest doesn't exist. `appended_entries` (if given) is set to the number
+// of appended result entries and `outdated` (if given) to whether the manifest
+// is stored in the previous format version.
+std::unique_ptr<ManifestData>
+read_manifest(const std::string& path,
+              FILE* dump_stream = nullptr,
+              size_t* appended_entries = nullptr,
+              bool* outdated = nullptr)
+{
+  const auto manifest_file = read_manifest_file(path, dump_stream);
+  if (!manifest_file) {
+    return {};
+  }
+  if (appended_entries) {
+    *appended_entries = manifest_file->log_records.size();
+  }
+  if (outdated) {
+    *outdated = manifest_file->outdated;
+  }
+  return manifest_data_from_file(*manifest_file);
+}
+
+std::string
+serialize_manifest_body(const ManifestData& mf)
+{
+  const uint64_t path_data_size = mf.path_data.size();
+  uint64_t results_size = 0;
+  for (const auto& result : mf.results) {
+    results_size += k_result_header_size + uint64_t{result.index_count} * 4;
+  }
+  if (path_data_size > std::numeric_limits<uint32_t>::max()
+      || results_size > std::numeric_limits<uint32_t>::max()) {
+    throw Error("Manifest too large");
+  }
+
+  uint64_t body_size = k_body_header_size;
+  body_size += mf.path_offsets.size() * 4; // path_offsets
+  body_size += mf.results.size() * 4;      // result_offsets
+  body_size += mf.file_info_count() * k_file_info_size;
+  body_size += path_data_size;
+  body_size += results_size;
+
+  std::string body;
+  body.reserve(body_size);
+  append_int<uint32_t>(body, mf.path_count());
+  append_int<uint32_t>(body, mf.file_info_count());
+  append_int<uint32_t>(body, mf.results.size());
+
+  for (auto path_offset : mf.path_offsets) {
+    append_int(body, path_offset);
+  }
+
+  uint32_t result_offset = 0;
+  for (const auto& result : mf.results) {
+    append_int(body, result_offset);
+    result_offset += k_result_header_size + result.index_count * 4;
+  }
+
+  for (uint32_t i = 0; i < mf.file_info_count(); ++i) {
+    append_int(body, mf.fi_path_indexes[i]);
+    body.append(reinterpret_cast<const char*>(mf.fi_digests[i].bytes()),
+                Digest::size());
+    append_int(body, mf.fi_sizes[i]);
+    append_int(body, mf.fi_mtimes[i]);
+    append_int(body, mf.fi_ctimes[i]);
+  }
+
+  body.append(mf.path_data);
+
+  for (const auto& result : mf.results) {
+    body.append(reinterpret_cast<const char*>(result.name.bytes()),
+                Digest::size());
+    append_int(body, result.last_used);
+    append_int(body, result.index_count);
+    const uint32_t* indexes = mf.indexes_of(result);
+    for (uint32_t i = 0; i < result.index_count; ++i) {
+      append_int(body, indexes[i]);
     }
-    reader.read(entry.name.bytes(), Digest::size());
   }
 
-  reader.finalize();
-  return mf;
+  return body;
+}
+
+// Read the body of a manifest into a buffer, merging any appended result
+// entries into it. Returns nullopt if the manifest doesn't exist. `outdated` is
+// set to whether the manifest is stored in the previous format version and
+// `appended_entries` to the number of appended result entries.
+optional<std::string>
+read_manifest_body(const std::string& path,
+                   bool& outdated,
+                   size_t& appended_entries)
+{
+  auto manifest_file = read_manifest_file(path);
+  if (!manifest_file) {
+    return nullopt;
+  }
+  outdated = manifest_file->outdated;
+  appended_entries = manifest_file->log_records.size();
+  if (manifest_file->log_records.empty()) {
+    return std::move(manifest_file->body);
+  }
+  return serialize_manifest_body(*manifest_data_from_file(*manifest_file));
 }
 
 bool
@@ -354,92 +1197,251 @@ write_manifest(const Config& config,
                const std::string& path,
                const ManifestData& mf)
 {
-  uint64_t payload_size = 0;
-  payload_size += 4; // n_files
-  for (const auto& file : mf.files) {
-    payload_size += 2 + file.length();
-  }
-  payload_size += 4; // n_file_infos
-  payload_size += mf.file_infos.size() * (4 + Digest::size() + 8 + 8 + 8);
-  payload_size += 4; // n_results
-  for (const auto& result : mf.results) {
-    payload_size += 4; // n_file_info_indexes
-    payload_size += result.file_info_indexes.size() * 4;
-    payload_size += Digest::size();
-  }
+  const auto body = serialize_manifest_body(mf);
 
   AtomicFile atomic_manifest_file(path, AtomicFile::Mode::binary);
   CacheEntryWriter writer(atomic_manifest_file.stream(),
                           Manifest::k_magic,
                           Manifest::k_version,
                           Compression::type_from_config(config),
-                          Compression::level_from_config(config),
-                          payload_size);
-  writer.write<uint32_t>(mf.files.size());
-  for (const auto& file : mf.files) {
-    writer.write<uint16_t>(file.length());
-    writer.write(file.data(), file.length());
-  }
+                          Compression::level_for_entry(config, body.size()),
+                          body.size());
+  writer.write(body.data(), body.size());
+  writer.finalize();
+  atomic_manifest_file.commit();
+  return true;
+}
 
-  writer.write<uint32_t>(mf.file_infos.size());
-  for (const auto& file_info : mf.file_infos) {
-    writer.write<uint32_t>(file_info.index);
-    writer.write(file_info.digest.bytes(), Digest::size());
-    writer.write(file_info.fsize);
-    writer.write(file_info.mtime);
-    writer.write(file_info.ctime);
+// Append the most recently used result entry of `mf` to the manifest file at
+// `path`.
+void
+append_manifest_entry(const std::string& path, const ManifestData& mf)
+{
+  const auto record = make_log_record(mf, mf.results.back());
+  Fd fd(open(path.c_str(), O_WRONLY | O_APPEND | O_BINARY));
+  if (!fd) {
+    throw Error("Failed to open {}: {}", path, strerror(errno));
   }
+  Util::write_fd(*fd, record.data(), record.size());
+}
 
-  writer.write<uint32_t>(mf.results.size());
-  for (const auto& result : mf.results) {
-    writer.write<uint32_t>(result.file_info_indexes.size());
-    for (auto index : result.file_info_indexes) {
-      writer.write(index);
+// Save `mf` after its most recently used result entry was added or refreshed.
+// The entry is appended if `may_append` is true, otherwise the whole manifest
+// is rewritten.
+bool
+save_manifest(const Config& config,
+              const std::string& path,
+              const ManifestData& mf,
+              bool may_append)
+{
+  try {
+    if (may_append) {
+      append_manifest_entry(path, mf);
+    } else {
+      write_manifest(config, path, mf);
     }
-    writer.write(result.name.bytes(), Digest::size());
+    return true;
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
+    return false;
   }
+}
 
-  writer.finalize();
-  atomic_manifest_file.commit();
-  return true;
+// Return the manifest data of the snapshot taken by Manifest::get if it's of
+// `path` and the file is unchanged, otherwise nullptr. Appending to a manifest
+// changes its size and rewriting it replaces the file, so the identity doesn't
+// need finer timestamps than the stat call gives.
+std::unique_ptr<ManifestData>
+take_manifest_snapshot(const Context& ctx,
+                       const std::string& path,
+                       size_t& appended_entries,
+                       bool& outdated)
+{
+  Manifest::Snapshot snapshot;
+  std::swap(snapshot, ctx.manifest_snapshot);
+  if (snapshot.path != path) {
+    return nullptr;
+  }
+  const auto stat = Stat::stat(path);
+  if (!stat || !snapshot.stat || !stat.same_inode_as(snapshot.stat)
+      || stat.size() != snapshot.stat.size()
+      || stat.mtime() != snapshot.stat.mtime()
+      || stat.ctime() != snapshot.stat.ctime()) {
+    LOG("Manifest {} changed since it was read", path);
+    return nullptr;
+  }
+
+  LOG("Reusing manifest {} read during lookup", path);
+  ManifestFile manifest_file;
+  manifest_file.body = std::move(snapshot.body);
+  appended_entries = snapshot.appended_entries;
+  outdated = snapshot.outdated;
+  return manifest_data_from_file(manifest_file);
+}
+
+enum class FileInfoState : uint8_t { unknown, match, mismatch };
+
+// What Manifest::get has found out about include files so far. Result entries
+// share most of their file infos, so each one only needs to be checked once.
+struct VerificationMemo
+{
+  explicit VerificationMemo(const ManifestView& mf)
+    : stated_files(mf.path_count()),
+      hashed_files(mf.path_count()),
+      watched_files(mf.path_count()),
+      file_info_states(mf.file_info_count(), FileInfoState::unknown)
+  {
+  }
+
+  // Indexed by path index.
+  std::vector<optional<FileStats>> stated_files;
+  std::vector<optional<Digest>> hashed_files;
+  std::vector<optional<FileWatch::Entry>> watched_files;
+
+  // Indexed by file info index.
+  std::vector<FileInfoState> file_info_states;
+};
+
+// Return whether the result is a Clang precompiled header that records the
+// mtimes of its include files.
+bool
+records_pch_mtimes(const Context& ctx)
+{
+  return (ctx.config.compiler_type() == CompilerType::clang
+          || ctx.config.compiler_type() == CompilerType::other)
+         && ctx.args_info.output_is_precompiled_header
+         && !ctx.args_info.fno_pch_timestamp;
 }
 
 bool
 verify_result(const Context& ctx,
-              const ManifestData& mf,
-              const ResultEntry& result,
-              std::unordered_map<std::string, FileStats>& stated_files,
-              std::unordered_map<std::string, Digest>& hashed_files)
-{
-  for (uint32_t file_info_index : result.file_info_indexes) {
-    const auto& fi = mf.file_infos[file_info_index];
-    const auto& path = mf.files[fi.index];
-
-    auto stated_files_iter = stated_files.find(path);
-    if (stated_files_iter == stated_files.end()) {
-      auto file_stat = Stat::stat(path, Stat::OnError::log);
-      if (!file_stat) {
-        return false;
+              const ManifestView& mf,
+              const ManifestView::Result& result,
+              VerificationMemo& memo,
+              ThreadPool* thread_pool,
+              size_t helpers,
+              FileWatch* file_watch)
+{
+  const auto for_each_index =
+    [&](size_t count, const std::function<bool(size_t)>& function) {
+      if (thread_pool) {
+        return thread_pool->for_each_index(count, function, helpers);
+      }
+      for (size_t i = 0; i < count; ++i) {
+        if (!function(i)) {
+          return false;
+        }
       }
-      FileStats st;
-      st.size = file_stat.size();
-      st.mtime = file_stat.mtime();
-      st.ctime = file_stat.ctime();
-      stated_files_iter = stated_files.emplace(path, st).first;
+      return true;
+    };
+
+  auto& stated_files = memo.stated_files;
+  auto& hashed_files = memo.hashed_files;
+  auto& states = memo.file_info_states;
+
+  // Reject the result without any I/O if a file info is already known to
+  // mismatch.
+  std::vector<uint32_t> unknown;
+  for (uint32_t i = 0; i < result.file_info_count; ++i) {
+    const uint32_t file_info_index = result.file_info_index(i);
+    if (file_info_index >= states.size()) {
+      throw Error("Bad file info index {} in manifest", file_info_index);
+    }
+    switch (states[file_info_index]) {
+    case FileInfoState::unknown:
+      unknown.push_back(file_info_index);
+      break;
+    case FileInfoState::match:
+      break;
+    case FileInfoState::mismatch:
+      return false;
+    }
+  }
+
+  std::vector<FileInfo> file_infos;
+  file_infos.reserve(unknown.size());
+  for (uint32_t file_info_index : unknown) {
+    file_infos.push_back(mf.file_info(file_info_index));
+    if (file_infos.back().index >= mf.path_count()) {
+      throw Error("Bad path index {} in manifest", file_infos.back().index);
+    }
+  }
+
+  // Files known by the file watch to be unchanged are neither stated nor
+  // hashed.
+  size_t remaining = 0;
+  for (size_t i = 0; i < file_infos.size(); ++i) {
+    const auto& fi = file_infos[i];
+    const auto& watched = memo.watched_files[fi.index];
+    if (!watched) {
+      file_infos[remaining] = fi;
+      unknown[remaining] = unknown[i];
+      ++remaining;
+    } else if (fi.digest == watched->digest && fi.fsize == watched->size) {
+      states[unknown[i]] = FileInfoState::match;
+    } else {
+      states[unknown[i]] = FileInfoState::mismatch;
+      return false;
+    }
+  }
+  file_infos.resize(remaining);
+  unknown.resize(remaining);
+
+  // Stat files not seen in previously verified results.
+  std::vector<size_t> to_stat;
+  for (size_t i = 0; i < file_infos.size(); ++i) {
+    if (!stated_files[file_infos[i].index]) {
+      to_stat.push_back(i);
+    }
+  }
+
+  std::vector<optional<FileStats>> new_stats(to_stat.size());
+  const bool stat_ok = for_each_index(to_stat.size(), [&](size_t i) {
+    const auto& fi = file_infos[to_stat[i]];
+    // Reuse the buffer of the thread instead of allocating one per file.
+    thread_local std::string path;
+    path.assign(mf.path(fi.index).data(), mf.path(fi.index).size());
+    auto file_stat = ctx.stat_cache.stat(path, Stat::OnError::log);
+    if (!file_stat) {
+      states[unknown[to_stat[i]]] = FileInfoState::mismatch;
+      return false;
     }
-    const FileStats& fs = stated_files_iter->second;
+    new_stats[i] = FileStats{static_cast<uint64_t>(file_stat.size()),
+                             file_stat.mtime(),
+                             file_stat.ctime()};
+    // The size of a file in the digest map may change without changing its
+    // digest.
+    return fi.fsize == new_stats[i]->size || find_in_digest_map(ctx, path);
+  });
+  for (size_t i = 0; i < to_stat.size(); ++i) {
+    if (new_stats[i]) {
+      stated_files[file_infos[to_stat[i]].index] = new_stats[i];
+    }
+  }
+  if (!stat_ok) {
+    return false;
+  }
 
-    if (fi.fsize != fs.size) {
+  std::vector<size_t> to_hash;
+  for (size_t i = 0; i < file_infos.size(); ++i) {
+    const auto& fi = file_infos[i];
+    auto& state = states[unknown[i]];
+    const auto path = mf.path(fi.index);
+    const FileStats& fs = *stated_files[fi.index];
+
+    if (fi.fsize != fs.size && !find_in_digest_map(ctx, std::string(path))) {
+      state = FileInfoState::mismatch;
       return false;
     }
 
     // Clang stores the mtime of the included files in the precompiled header,
-    // and will error out if that header is later used without rebuilding.
-    if ((ctx.config.compiler_type() == CompilerType::clang
-         || ctx.config.compiler_type() == CompilerType::other)
-        && ctx.args_info.output_is_precompiled_header
-        && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime) {
+    // and will error out if that header is later used without rebuilding,
+    // unless the recorded mtime is restored after a content match.
+    if (records_pch_mtimes(ctx) && fi.mtime != fs.mtime
+        && (fi.mtime == -1
+            || !(ctx.config.sloppiness() & SLOPPY_PCH_INPUT_MTIME))) {
       LOG("Precompiled header includes {}, which has a new mtime", path);
+      state = FileInfoState::mismatch;
       return false;
     }
 
@@ -447,6 +1449,7 @@ verify_result(const Context& ctx,
       if (!(ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES_CTIME)) {
         if (fi.mtime == fs.mtime && fi.ctime == fs.ctime) {
           LOG("mtime/ctime hit for {}", path);
+          state = FileInfoState::match;
           continue;
         } else {
           LOG("mtime/ctime miss for {}", path);
@@ -454,6 +1457,7 @@ verify_result(const Context& ctx,
       } else {
         if (fi.mtime == fs.mtime) {
           LOG("mtime hit for {}", path);
+          state = FileInfoState::match;
           continue;
         } else {
           LOG("mtime miss for {}", path);
@@ -461,27 +1465,76 @@ verify_result(const Context& ctx,
       }
     }
 
-    auto hashed_files_iter = hashed_files.find(path);
-    if (hashed_files_iter == hashed_files.end()) {
-      Hash hash;
-      int ret = hash_source_code_file(ctx, hash, path, fs.size);
-      if (ret & HASH_SOURCE_CODE_ERROR) {
-        LOG("Failed hashing {}", path);
-        return false;
-      }
-      if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
-        return false;
-      }
-
-      Digest actual = hash.digest();
-      hashed_files_iter = hashed_files.emplace(path, actual).first;
+    if (!hashed_files[fi.index]) {
+      to_hash.push_back(i);
+    } else if (fi.digest == *hashed_files[fi.index]) {
+      state = FileInfoState::match;
+    } else {
+      state = FileInfoState::mismatch;
+      return false;
     }
+  }
 
-    if (fi.digest != hashed_files_iter->second) {
+  std::vector<optional<Digest>> new_digests(to_hash.size());
+  const bool hash_ok = for_each_index(to_hash.size(), [&](size_t i) {
+    const auto& fi = file_infos[to_hash[i]];
+    auto& state = states[unknown[to_hash[i]]];
+    thread_local std::string path;
+    path.assign(mf.path(fi.index).data(), mf.path(fi.index).size());
+    Hash hash;
+    int ret =
+      hash_source_code_file(ctx, hash, path, stated_files[fi.index]->size);
+    if (ret & HASH_SOURCE_CODE_ERROR) {
+      LOG("Failed hashing {}", path);
+      state = FileInfoState::mismatch;
       return false;
     }
+    if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
+      state = FileInfoState::mismatch;
+      return false;
+    }
+    new_digests[i] = hash.digest();
+    if (file_watch && ret == HASH_SOURCE_CODE_OK) {
+      const auto abs_path = FileWatch::absolute_path(ctx.actual_cwd, path);
+      if (abs_path) {
+        file_watch->put(
+          *abs_path, *new_digests[i], stated_files[fi.index]->size);
+      }
+    }
+    state = fi.digest == *new_digests[i] ? FileInfoState::match
+                                         : FileInfoState::mismatch;
+    return state == FileInfoState::match;
+  });
+  for (size_t i = 0; i < to_hash.size(); ++i) {
+    if (new_digests[i]) {
+      hashed_files[file_infos[to_hash[i]].index] = new_digests[i];
+    }
   }
 
+  return hash_ok;
+}
+
+// Give the include files of a verified result the mtimes recorded in the
+// manifest, which are the ones that Clang stored in the cached precompiled
+// header. Returns false if an mtime couldn't be restored.
+bool
+restore_pch_input_mtimes(const ManifestView& mf,
+                         const ManifestView::Result& result,
+                         const VerificationMemo& memo)
+{
+  for (uint32_t i = 0; i < result.file_info_count; ++i) {
+    const auto fi = mf.file_info(result.file_info_index(i));
+    const auto& fs = memo.stated_files[fi.index];
+    if (!fs || fs->mtime == fi.mtime) {
+      continue;
+    }
+    const std::string path(mf.path(fi.index));
+    if (!Util::set_mtime(path, fi.mtime)) {
+      LOG("Failed to restore mtime of {}: {}", path, strerror(errno));
+      return false;
+    }
+    LOG("Restored mtime of {}", path);
+  }
   return true;
 }
 
@@ -491,18 +1544,31 @@ namespace Manifest {
 
 const std::string k_file_suffix = "M";
 const uint8_t k_magic[4] = {'c', 'C', 'm', 'F'};
-const uint8_t k_version = 2;
+const uint8_t k_version = 4;
 
 // Try to get the result name from a manifest file. Returns nullopt on failure.
+// If `needs_touch` is given, it's set to whether the matching entry should be
+// marked as used with `touch`. If `included_files` is given, it's set to the
+// include files of the matching entry.
 optional<Digest>
-get(const Context& ctx, const std::string& path)
+get(const Context& ctx,
+    const std::string& path,
+    bool* needs_touch,
+    std::vector<std::string>* included_files)
 {
-  std::unique_ptr<ManifestData> mf;
+  optional<std::string> body;
+  bool outdated = false;
+  size_t appended_entries = 0;
+  // Taken before reading, so a concurrent update makes the snapshot unusable
+  // rather than stale.
+  const auto stat = Stat::stat(path);
   try {
-    mf = read_manifest(path);
-    if (mf) {
+    body = read_manifest_body(path, outdated, appended_entries);
+    if (body) {
       // Update modification timestamp to save files from LRU cleanup.
-      Util::update_mtime(path);
+      if (ctx.storage.is_primary_path(path)) {
+        MtimeJournal::record_use(ctx.config, path);
+      }
     } else {
       LOG_RAW("No such manifest file");
       return nullopt;
@@ -512,39 +1578,163 @@ get(const Context& ctx, const std::string& path)
     return nullopt;
   }
 
-  std::unordered_map<std::string, FileStats> stated_files;
-  std::unordered_map<std::string, Digest> hashed_files;
+  try {
+    const ManifestView mf(*body);
+
+    // Most likely the newest result matches, so let the kernel read it while
+    // the include files are verified.
+    if (mf.result_count() > 0
+        && mf.path_count() >= k_min_files_for_result_readahead) {
+      ctx.storage.readahead(mf.result(mf.result_count() - 1).name,
+                            Result::k_file_suffix);
+    }
 
-  // Check newest result first since it's a bit more likely to match.
-  for (uint32_t i = mf->results.size(); i > 0; i--) {
-    if (verify_result(
-          ctx, *mf, mf->results[i - 1], stated_files, hashed_files)) {
-      return mf->results[i - 1].name;
+    Statistics::PhaseTimer verification_timer(ctx, Phase::include_verification);
+    Tracing::Span verification_span("include_verification");
+    VerificationMemo memo(mf);
+
+    // With many include files and a cold inode cache, stat and read latency
+    // dominates the lookup, so spread it over a few threads.
+    std::unique_ptr<Jobserver::Tokens> tokens;
+    ThreadPool* thread_pool = nullptr;
+    const size_t threads = ctx.include_file_threads();
+    if (mf.path_count() >= k_min_files_for_parallel_verification
+        && threads > 1) {
+      // The calling thread also takes part in the verification.
+      tokens = std::make_unique<Jobserver::Tokens>(threads - 1);
+      if (tokens->count() > 0) {
+        thread_pool = &ctx.include_file_thread_pool();
+      }
     }
+
+    // The watcher can't tell whether mtimes, which Clang records in
+    // precompiled headers, have changed.
+    std::unique_ptr<FileWatch> file_watch;
+    if (mf.path_count() >= k_min_files_for_file_watch
+        && !ctx.args_info.output_is_precompiled_header) {
+      file_watch = std::make_unique<FileWatch>(ctx.config.cache_dir());
+      if (*file_watch) {
+        uint32_t unchanged = 0;
+        for (uint32_t i = 0; i < mf.path_count(); ++i) {
+          const auto abs_path =
+            FileWatch::absolute_path(ctx.actual_cwd, mf.path(i));
+          if (abs_path) {
+            memo.watched_files[i] = file_watch->get(*abs_path);
+            if (memo.watched_files[i]) {
+              memo.hashed_files[i] = memo.watched_files[i]->digest;
+              ++unchanged;
+            }
+          }
+        }
+        LOG("{} of {} include files known to be unchanged",
+            unchanged,
+            mf.path_count());
+      } else {
+        file_watch.reset();
+      }
+    }
+
+    // Check newest result first since it's a bit more likely to match.
+    for (uint32_t i = mf.result_count(); i > 0; i--) {
+      if (ctx.storage.lookup_deadline_passed()) {
+        return nullopt;
+      }
+      const auto result = mf.result(i - 1);
+      ++ctx.invocation.manifest_entries_scanned;
+      if (verify_result(
+            ctx,
+            mf,
+            result,
+            memo,
+            thread_pool,
+            tokens ? tokens->count() : 0,
+            file_watch.get())) {
+        if (records_pch_mtimes(ctx)
+            && !restore_pch_input_mtimes(mf, result, memo)) {
+          continue;
+        }
+        ctx.invocation.include_files = result.file_info_count;
+        if (included_files) {
+          included_files->clear();
+          for (uint32_t j = 0; j < result.file_info_count; ++j) {
+            const auto file_path =
+              mf.path(mf.file_info(result.file_info_index(j)).index);
+            included_files->emplace_back(file_path.data(), file_path.size());
+          }
+        }
+        if (needs_touch) {
+          const uint64_t max_age = ctx.config.max_manifest_entry_age();
+          const int64_t resolution =
+            max_age > 0 ? std::min<int64_t>(k_last_used_resolution, max_age / 2)
+                        : k_last_used_resolution;
+          // An outdated manifest is rewritten in the current format.
+          *needs_touch = outdated || i != mf.result_count()
+                         || result.last_used + resolution <= time(nullptr);
+        }
+        return result.name;
+      }
+    }
+
+    // Include files are hashed again after a miss to update the manifest, so
+    // let that reuse the digests computed here.
+    for (uint32_t i = 0; i < mf.path_count(); ++i) {
+      if (memo.hashed_files[i]) {
+        ctx.verified_include_digests.emplace(std::string(mf.path(i)),
+                                             *memo.hashed_files[i]);
+      }
+    }
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
+    return nullopt;
   }
 
+  // The new result will be added to the manifest, so save reading it again.
+  auto& snapshot = ctx.manifest_snapshot;
+  snapshot.path = path;
+  snapshot.stat = stat;
+  snapshot.body = std::move(*body);
+  snapshot.appended_entries = appended_entries;
+  snapshot.outdated = outdated;
+
   return nullopt;
 }
 
 // Put the result name into a manifest file given a set of included files.
 // Returns true on success, otherwise false.
 bool
-put(const Config& config,
+put(const Context& ctx,
     const std::string& path,
     const Digest& result_name,
-    const std::unordered_map<std::string, Digest>& included_files,
+    const std::unordered_map<nonstd::string_view, Digest, StringViewHash>&
+      included_files,
 
     time_t time_of_compilation,
     bool save_timestamp)
 {
-  // We don't bother to acquire a lock when writing the manifest to disk. A
-  // race between two processes will only result in one lost entry, which is
-  // not a big deal, and it's also very unlikely.
+  const Config& config = ctx.config;
+
+  // Parallel compilations that share the manifest, e.g. of the same source in
+  // several build trees with base_dir, would otherwise lose entries when one
+  // process rewrites the manifest while another one creates, rewrites or
+  // appends to it. Readers don't need the lock since the manifest is replaced
+  // atomically and incomplete appended entries are ignored.
+  Lockfile lock(path);
+  if (!lock.acquired()) {
+    LOG("Failed to lock {}, updating it anyway", path);
+  }
 
   std::unique_ptr<ManifestData> mf;
+  size_t appended_entries = 0;
+  bool outdated = false;
+  bool may_append = false;
   try {
-    mf = read_manifest(path);
+    mf = take_manifest_snapshot(ctx, path, appended_entries, outdated);
     if (!mf) {
+      mf = read_manifest(path, nullptr, &appended_entries, &outdated);
+    }
+    if (mf) {
+      may_append = !outdated && appended_entries < k_max_appended_entries;
+    } else {
       // Manifest file didn't exist.
       mf = std::make_unique<ManifestData>();
     }
@@ -554,49 +1744,133 @@ put(const Config& config,
     mf = std::make_unique<ManifestData>();
   }
 
-  if (mf->results.size() > k_max_manifest_entries) {
-    // Normally, there shouldn't be many result entries in the manifest since
-    // new entries are added only if an include file has changed but not the
-    // source file, and you typically change source files more often than
-    // header files. However, it's certainly possible to imagine cases where
-    // the manifest will grow large (for instance, a generated header file that
-    // changes for every build), and this must be taken care of since
-    // processing an ever growing manifest eventually will take too much time.
-    // A good way of solving this would be to maintain the result entries in
-    // LRU order and discarding the old ones. An easy way is to throw away all
-    // entries when there are too many. Let's do that for now.
-    LOG("More than {} entries in manifest file; discarding",
-        k_max_manifest_entries);
-    mf = std::make_unique<ManifestData>();
-  } else if (mf->file_infos.size() > k_max_manifest_file_info_entries) {
+  if (mf->file_info_count() > k_max_manifest_file_info_entries) {
     // Rarely, FileInfo entries can grow large in pathological cases where
     // many included files change, but the main file does not. This also puts
     // an upper bound on the number of FileInfo entries.
     LOG("More than {} FileInfo entries in manifest file; discarding",
         k_max_manifest_file_info_entries);
     mf = std::make_unique<ManifestData>();
+    may_append = false;
   }
 
-  bool added = mf->add_result_entry(
-    result_name, included_files, time_of_compilation, save_timestamp);
+  // Entries whose results have been evicted by cleanup would otherwise still
+  // be verified by every lookup that gets to them.
+  const size_t pruned = mf->prune([&](const Digest& name) {
+    return name != result_name
+           && !ctx.storage.may_contain(name, Result::k_file_suffix);
+  });
+  if (pruned > 0) {
+    LOG("Removed {} entries with missing results from manifest file", pruned);
+  }
 
-  if (added) {
-    try {
-      write_manifest(config, path, *mf);
-      return true;
-    } catch (const Error& e) {
-      LOG("Error: {}", e.what());
+  bool added = mf->add_result_entry(ctx.stat_cache,
+                                    result_name,
+                                    included_files,
+                                    time_of_compilation,
+                                    save_timestamp);
+
+  // Normally, there shouldn't be many result entries in the manifest since new
+  // entries are added only if an include file has changed but not the source
+  // file, and you typically change source files more often than header files.
+  // However, it's certainly possible to imagine cases where the manifest will
+  // grow large (for instance, a generated header file that changes for every
+  // build), and this must be taken care of since processing an ever growing
+  // manifest eventually will take too much time. Entries are kept in LRU order,
+  // so discard the least recently used ones.
+  const size_t evicted = mf->evict(time_of_compilation,
+                                   config.max_manifest_entries(),
+                                   config.max_manifest_entry_age());
+  if (evicted > 0) {
+    LOG("Evicted {} entries from manifest file", evicted);
+  }
+
+  if (pruned > 0 || evicted > 0) {
+    return save_manifest(config, path, *mf, false);
+  } else if (added) {
+    return save_manifest(config, path, *mf, may_append);
+  }
+  return false;
+}
+
+// Make the entry for `result_name` the most recently used one at `time`. The
+// manifest is left as is if it can't be locked within `lock_timeout`
+// microseconds. Returns true on success, otherwise false.
+bool
+touch(const Config& config,
+      const std::string& path,
+      const Digest& result_name,
+      time_t time,
+      uint32_t lock_timeout)
+{
+  Lockfile lock(path, 2000000, lock_timeout);
+  if (!lock.acquired() && lock_timeout != UINT32_MAX) {
+    LOG("Failed to lock {} in time, not updating it", path);
+    return false;
+  } else if (!lock.acquired()) {
+    LOG("Failed to lock {}, updating it anyway", path);
+  }
+
+  std::unique_ptr<ManifestData> mf;
+  size_t appended_entries = 0;
+  bool outdated = false;
+  try {
+    mf = read_manifest(path, nullptr, &appended_entries, &outdated);
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
+  }
+  if (!mf) {
+    return false;
+  }
+  for (size_t i = mf->results.size(); i > 0; i--) {
+    if (mf->results[i - 1].name == result_name) {
+      mf->mark_used(i - 1, time);
+      if (outdated) {
+        LOG("Upgrading {} to the current format", path);
+      }
+      return save_manifest(config,
+                           path,
+                           *mf,
+                           !outdated
+                             && appended_entries < k_max_appended_entries);
     }
   }
   return false;
 }
 
+bool
+upgrade(const Config& config, const std::string& path)
+{
+  Lockfile lock(path);
+  if (!lock.acquired()) {
+    LOG("Failed to lock {}, upgrading it anyway", path);
+  }
+
+  bool outdated = false;
+  const auto mf = read_manifest(path, nullptr, nullptr, &outdated);
+  if (!mf || !outdated) {
+    return false;
+  }
+  return write_manifest(config, path, *mf);
+}
+
+std::string
+read_appended_entries(FILE* stream)
+{
+  std::string appended;
+  for (const auto& record : read_log_records(stream)) {
+    append_log_record(appended, record);
+  }
+  return appended;
+}
+
 bool
 dump(const std::string& path, FILE* stream)
 {
   std::unique_ptr<ManifestData> mf;
+  size_t appended_entries = 0;
   try {
-    mf = read_manifest(path, stream);
+    mf = read_manifest(path, stream, &appended_entries);
   } catch (const Error& e) {
     PRINT(stream, "Error: {}\n", e.what());
     return false;
@@ -607,28 +1881,32 @@ dump(const std::string& path, FILE* stream)
     return false;
   }
 
-  PRINT(stream, "File paths ({}):\n", mf->files.size());
-  for (size_t i = 0; i < mf->files.size(); ++i) {
-    PRINT(stream, "  {}: {}\n", i, mf->files[i]);
+  PRINT(stream, "Appended result entries: {}\n", appended_entries);
+  PRINT(stream, "File paths ({}):\n", mf->path_count());
+  for (uint32_t i = 0; i < mf->path_count(); ++i) {
+    PRINT(stream, "  {}: {}\n", i, mf->path(i));
   }
-  PRINT(stream, "File infos ({}):\n", mf->file_infos.size());
-  for (size_t i = 0; i < mf->file_infos.size(); ++i) {
+  PRINT(stream, "File infos ({}):\n", mf->file_info_count());
+  for (uint32_t i = 0; i < mf->file_info_count(); ++i) {
+    const auto fi = mf->file_info(i);
     PRINT(stream, "  {}:\n", i);
-    PRINT(stream, "    Path index: {}\n", mf->file_infos[i].index);
-    PRINT(stream, "    Hash: {}\n", mf->file_infos[i].digest.to_string());
-    PRINT(stream, "    File size: {}\n", mf->file_infos[i].fsize);
-    PRINT(stream, "    Mtime: {}\n", mf->file_infos[i].mtime);
-    PRINT(stream, "    Ctime: {}\n", mf->file_infos[i].ctime);
+    PRINT(stream, "    Path index: {}\n", fi.index);
+    PRINT(stream, "    Hash: {}\n", fi.digest.to_string());
+    PRINT(stream, "    File size: {}\n", fi.fsize);
+    PRINT(stream, "    Mtime: {}\n", fi.mtime);
+    PRINT(stream, "    Ctime: {}\n", fi.ctime);
   }
   PRINT(stream, "Results ({}):\n", mf->results.size());
   for (size_t i = 0; i < mf->results.size(); ++i) {
     PRINT(stream, "  {}:\n", i);
     PRINT_RAW(stream, "    File info indexes:");
-    for (uint32_t file_info_index : mf->results[i].file_info_indexes) {
-      PRINT(stream, " {}", file_info_index);
+    const uint32_t* indexes = mf->indexes_of(mf->results[i]);
+    for (uint32_t j = 0; j < mf->results[i].index_count; ++j) {
+      PRINT(stream, " {}", indexes[j]);
     }
     PRINT_RAW(stream, "\n");
     PRINT(stream, "    Name: {}\n", mf->results[i].name.to_string());
+    PRINT(stream, "    Last used: {}\n", mf->results[i].last_used);
   }
 
   return true;
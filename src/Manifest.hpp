@@ -20,10 +20,15 @@
 
 #include "system.hpp"
 
+#include "Arena.hpp"
+#include "Stat.hpp"
+
 #include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
 
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 class Config;
 class Context;
@@ -35,13 +40,46 @@ extern const std::string k_file_suffix;
 extern const uint8_t k_magic[4];
 extern const uint8_t k_version;
 
-nonstd::optional<Digest> get(const Context& ctx, const std::string& path);
-bool put(const Config& config,
-         const std::string& path,
-         const Digest& result_name,
-         const std::unordered_map<std::string, Digest>& included_files,
-         time_t time_of_compilation,
-         bool save_timestamp);
+// A manifest read by `get` that didn't give a result name. `put` uses it
+// instead of reading the manifest again if the file is still the same.
+struct Snapshot
+{
+  std::string path;
+  Stat stat;
+  // Body with appended result entries merged in.
+  std::string body;
+  size_t appended_entries = 0;
+  bool outdated = false;
+};
+
+nonstd::optional<Digest>
+get(const Context& ctx,
+    const std::string& path,
+    bool* needs_touch = nullptr,
+    std::vector<std::string>* included_files = nullptr);
+bool put(
+  const Context& ctx,
+  const std::string& path,
+  const Digest& result_name,
+  const std::unordered_map<nonstd::string_view, Digest, StringViewHash>&
+    included_files,
+  time_t time_of_compilation,
+  bool save_timestamp);
+bool touch(const Config& config,
+           const std::string& path,
+           const Digest& result_name,
+           time_t time,
+           uint32_t lock_timeout = UINT32_MAX);
+
+// Rewrite the manifest at `path` in the current format version if it's stored
+// in the previous one. Returns whether the manifest was rewritten. Throws Error
+// on failure.
+bool upgrade(const Config& config, const std::string& path);
+
+// Return the result entries appended after the body of the manifest in
+// `stream` in their on-disk form.
+std::string read_appended_entries(FILE* stream);
+
 bool dump(const std::string& path, FILE* stream);
 
 } // namespace Manifest
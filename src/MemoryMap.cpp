@@ -0,0 +1,69 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "MemoryMap.hpp"
+
+#include "Logging.hpp"
+#include "assertions.hpp"
+
+namespace {
+
+// Below this size, setting up and tearing down a mapping costs more than
+// reading the file into a buffer.
+const size_t k_min_map_size = 64 * 1024;
+
+} // namespace
+
+MemoryMap::~MemoryMap()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (m_data) {
+    munmap(m_data, m_size);
+  }
+#endif
+}
+
+bool
+MemoryMap::map(int fd)
+{
+#ifdef HAVE_SYS_MMAN_H
+  ASSERT(!m_data);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+      || static_cast<uint64_t>(st.st_size) < k_min_map_size) {
+    return false;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap file: {}", strerror(errno));
+    return false;
+  }
+#  ifdef MADV_SEQUENTIAL
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+#  endif
+
+  m_data = data;
+  m_size = st.st_size;
+  return true;
+#else
+  (void)fd;
+  return false;
+#endif
+}
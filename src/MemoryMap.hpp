@@ -0,0 +1,55 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+// A read-only memory mapping of a whole file, used to hash large files without
+// copying them through a buffer.
+//
+// Note that the file must not be truncated while it is mapped since accessing
+// pages past the end of the file raises SIGBUS.
+class MemoryMap : NonCopyable
+{
+public:
+  MemoryMap() = default;
+  ~MemoryMap();
+
+  // Map the file referred to by `fd`, advising the kernel that it will be read
+  // sequentially. Returns false if the file is not a regular file, is too small
+  // to benefit from being mapped or can't be mapped, in which case the caller
+  // should read it the ordinary way.
+  bool map(int fd);
+
+  nonstd::string_view data() const;
+
+private:
+  void* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+inline nonstd::string_view
+MemoryMap::data() const
+{
+  return {static_cast<const char*>(m_data), m_size};
+}
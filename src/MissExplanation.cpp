@@ -0,0 +1,273 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "MissExplanation.hpp"
+
+#include "AtomicFile.hpp"
+#include "Config.hpp"
+#include "Context.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+// Components that differ between two fingerprints are aligned with a longest
+// common subsequence table, which isn't computed if it would have more cells
+// than this. All differing components are then reported as removed and added.
+const size_t k_max_alignment_cells = 16 * 1024 * 1024;
+
+std::string
+absolute_path(const std::string& path)
+{
+  // Resolve symlinks so that e.g. paths based on $PWD and getcwd() agree.
+  const auto real_path = Util::real_path(path, true);
+  if (!real_path.empty()) {
+    return real_path;
+  }
+  return Util::normalize_absolute_path(
+    Util::is_absolute_path(path) ? path
+                                 : FMT("{}/{}", Util::get_actual_cwd(), path));
+}
+
+std::string
+fingerprint_path(const Config& config, const std::string& output_path)
+{
+  return FMT("{}/fingerprints/{}",
+             config.cache_dir(),
+             Hash().hash(absolute_path(output_path)).digest().to_string());
+}
+
+// Replace characters that would break the line and field structure of the
+// fingerprint file.
+std::string
+sanitize(string_view text)
+{
+  std::string result(text);
+  for (char& c : result) {
+    if (static_cast<unsigned char>(c) < 0x20) {
+      c = ' ';
+    }
+  }
+  return result;
+}
+
+bool
+same(const MissExplanation::Component& a, const MissExplanation::Component& b)
+{
+  return a.name == b.name && a.digest == b.digest;
+}
+
+std::string
+display_name(const MissExplanation::Component& component)
+{
+  return component.name.empty() ? "(start)" : component.name;
+}
+
+std::string
+describe(const char* change, const MissExplanation::Component& component)
+{
+  return component.text.empty()
+           ? FMT("{} {}", display_name(component), change)
+           : FMT("{} {}: {}", display_name(component), change, component.text);
+}
+
+} // namespace
+
+namespace MissExplanation {
+
+void
+record(const Context& ctx, const std::vector<Hash::Section>& sections)
+{
+  std::string data;
+  for (const auto& section : sections) {
+    data += FMT("{}\t{}\t{}\n",
+                sanitize(section.name),
+                section.digest.to_string(),
+                sanitize(section.text));
+  }
+
+  std::vector<std::pair<string_view, Digest>> included_files(
+    ctx.included_files.begin(), ctx.included_files.end());
+  std::sort(included_files.begin(),
+            included_files.end(),
+            [](const std::pair<string_view, Digest>& a,
+               const std::pair<string_view, Digest>& b) {
+              return a.first < b.first;
+            });
+  for (const auto& included_file : included_files) {
+    data += FMT("include file {}\t{}\t\n",
+                sanitize(included_file.first),
+                included_file.second.to_string());
+  }
+
+  const auto path = fingerprint_path(ctx.config, ctx.args_info.output_obj);
+  try {
+    if (!Util::create_dir(Util::dir_name(path))) {
+      throw Error("Failed to create directory: {}", strerror(errno));
+    }
+    if (rename(path.c_str(), FMT("{}.previous", path).c_str()) != 0
+        && errno != ENOENT) {
+      throw Error("Failed to rename: {}", strerror(errno));
+    }
+    AtomicFile file(path, AtomicFile::Mode::text);
+    file.write(data);
+    file.commit();
+    LOG("Recorded hash fingerprint in {}", path);
+  } catch (const Error& e) {
+    LOG("Failed to record hash fingerprint in {}: {}", path, e.what());
+  }
+}
+
+std::vector<Component>
+parse(string_view data)
+{
+  std::vector<Component> result;
+  for (const auto line : Util::split_into_views(data, "\n")) {
+    const size_t first_tab = line.find('\t');
+    const size_t second_tab = first_tab == string_view::npos
+                                ? string_view::npos
+                                : line.find('\t', first_tab + 1);
+    if (second_tab == string_view::npos) {
+      continue;
+    }
+    Component component;
+    component.name = std::string(line.substr(0, first_tab));
+    component.digest =
+      std::string(line.substr(first_tab + 1, second_tab - first_tab - 1));
+    component.text = std::string(line.substr(second_tab + 1));
+    result.push_back(std::move(component));
+  }
+  return result;
+}
+
+std::vector<std::string>
+compare(const std::vector<Component>& before,
+        const std::vector<Component>& after)
+{
+  // Skip the common prefix and suffix, which is usually almost everything.
+  size_t prefix = 0;
+  while (prefix < before.size() && prefix < after.size()
+         && same(before[prefix], after[prefix])) {
+    ++prefix;
+  }
+  size_t suffix = 0;
+  while (suffix < before.size() - prefix && suffix < after.size() - prefix
+         && same(before[before.size() - 1 - suffix],
+                 after[after.size() - 1 - suffix])) {
+    ++suffix;
+  }
+  const size_t n = before.size() - prefix - suffix;
+  const size_t m = after.size() - prefix - suffix;
+  const auto b = [&](size_t i) -> const Component& {
+    return before[prefix + i];
+  };
+  const auto a = [&](size_t j) -> const Component& {
+    return after[prefix + j];
+  };
+
+  // lcs[i * (m + 1) + j] is the length of the longest common subsequence of
+  // the differing components from index i of `before` and j of `after`.
+  std::vector<uint32_t> lcs;
+  if ((n + 1) * (m + 1) <= k_max_alignment_cells) {
+    lcs.resize((n + 1) * (m + 1));
+    for (size_t i = n; i-- > 0;) {
+      for (size_t j = m; j-- > 0;) {
+        lcs[i * (m + 1) + j] =
+          same(b(i), a(j)) ? lcs[(i + 1) * (m + 1) + j + 1] + 1
+                           : std::max(lcs[(i + 1) * (m + 1) + j],
+                                      lcs[i * (m + 1) + j + 1]);
+      }
+    }
+  }
+  const auto common = [&](size_t i, size_t j) {
+    return lcs.empty() ? 0 : lcs[i * (m + 1) + j];
+  };
+
+  std::vector<std::string> result;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < n || j < m) {
+    if (i < n && j < m && same(b(i), a(j))) {
+      ++i;
+      ++j;
+    } else if (i < n && (j == m || common(i + 1, j) >= common(i, j + 1))) {
+      // A removal directly followed by an addition of a component with the
+      // same name is a change.
+      if (j < m && b(i).name == a(j).name
+          && common(i + 1, j + 1) == common(i, j)) {
+        if (!b(i).text.empty() && !a(j).text.empty()) {
+          result.push_back(FMT("{} changed: {} -> {}",
+                               display_name(b(i)),
+                               b(i).text,
+                               a(j).text));
+        } else {
+          result.push_back(FMT("{} changed", display_name(b(i))));
+        }
+        ++i;
+        ++j;
+      } else {
+        result.push_back(describe("removed", b(i)));
+        ++i;
+      }
+    } else {
+      result.push_back(describe("added", a(j)));
+      ++j;
+    }
+  }
+  return result;
+}
+
+optional<std::string>
+explain(const Config& config, const std::string& path)
+{
+  const auto current_path = fingerprint_path(config, path);
+  std::string current;
+  std::string previous;
+  try {
+    current = Util::read_file(current_path);
+    previous = Util::read_file(FMT("{}.previous", current_path));
+  } catch (const Error&) {
+    return nullopt;
+  }
+
+  const auto differences = compare(parse(previous), parse(current));
+  if (differences.empty()) {
+    return FMT(
+      "The hashed inputs of the last two compilations of {} stored in the"
+      " cache are identical, so the result was likely removed from the cache"
+      " in between.\n",
+      path);
+  }
+  std::string result = FMT(
+    "Changes between the last two compilations of {} stored in the cache:\n",
+    path);
+  for (const auto& difference : differences) {
+    result += FMT("  {}\n", difference);
+  }
+  return result;
+}
+
+} // namespace MissExplanation
@@ -0,0 +1,67 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Hash.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+class Config;
+class Context;
+
+// Explanation of cache misses, enabled with the explain_misses option. A
+// fingerprint of the hashed inputs (a digest of each hash section and each
+// include file) is recorded for every compilation that is stored in the cache,
+// keyed by the output file. `ccache --explain-miss` then compares the
+// fingerprints of the last two such compilations of an output file.
+namespace MissExplanation {
+
+struct Component
+{
+  std::string name;
+  std::string digest;
+  std::string text; // Short text form of the hashed data, if known.
+};
+
+// Record the fingerprint of the compilation in `ctx`, whose result was hashed
+// with `sections`, replacing the previous fingerprint of the output file which
+// is kept for comparison.
+void record(const Context& ctx, const std::vector<Hash::Section>& sections);
+
+// Parse a fingerprint written by record.
+std::vector<Component> parse(nonstd::string_view data);
+
+// Return one line per component that differs between fingerprints `before`
+// and `after`.
+std::vector<std::string> compare(const std::vector<Component>& before,
+                                 const std::vector<Component>& after);
+
+// Return a description of what changed between the last two compilations of
+// output file `path` that were stored in the cache, or nullopt if fewer than
+// two have been recorded.
+nonstd::optional<std::string> explain(const Config& config,
+                                      const std::string& path);
+
+} // namespace MissExplanation
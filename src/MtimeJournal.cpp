@@ -0,0 +1,123 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "MtimeJournal.hpp"
+
+#include "Config.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <unordered_set>
+
+namespace {
+
+// The journal is flushed when it reaches this size, i.e. after several
+// hundred recorded uses.
+const uint64_t k_flush_size = 64 * 1024;
+
+std::string
+journal_path(const Config& config)
+{
+  return FMT("{}/mtime_journal", config.temporary_dir());
+}
+
+void
+update_now(const Config& config, const std::string& path)
+{
+  Util::update_mtime(path);
+  LruIndex::record_use(config.cache_dir(), path);
+}
+
+} // namespace
+
+namespace MtimeJournal {
+
+void
+record_use(const Config& config, const std::string& path)
+{
+  if (!config.defer_mtime_updates()) {
+    update_now(config, path);
+    return;
+  }
+
+  const auto journal = journal_path(config);
+  Fd fd(open(journal.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0666));
+  if (!fd) {
+    Util::ensure_dir_exists(config.temporary_dir());
+    fd = Fd(
+      open(journal.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0666));
+  }
+
+  // A single write of a short line is atomic with O_APPEND, so concurrent
+  // ccache processes don't corrupt each other's records.
+  const auto record = FMT("{}\n", path);
+  try {
+    if (!fd) {
+      throw Error("{}", strerror(errno));
+    }
+    Util::write_fd(*fd, record.data(), record.size());
+  } catch (const Error& e) {
+    LOG("Failed to write to {}: {}", journal, e.what());
+    update_now(config, path);
+    return;
+  }
+
+  struct stat st;
+  if (fstat(*fd, &st) == 0
+      && static_cast<uint64_t>(st.st_size) >= k_flush_size) {
+    fd.close();
+    flush(config);
+  }
+}
+
+void
+flush(const Config& config)
+{
+  // Claim the journal by renaming it so that only one process applies it and
+  // new records go to a new journal.
+  const auto journal = journal_path(config);
+  const auto claimed = FMT("{}.{}", journal, getpid());
+  if (rename(journal.c_str(), claimed.c_str()) != 0) {
+    if (errno != ENOENT) {
+      LOG("Failed to rename {}: {}", journal, strerror(errno));
+    }
+    return;
+  }
+
+  std::string data;
+  try {
+    data = Util::read_file(claimed);
+  } catch (const Error& e) {
+    LOG("Failed to read {}: {}", claimed, e.what());
+  }
+  Util::unlink_safe(claimed);
+
+  std::unordered_set<std::string> paths;
+  for (auto& path : Util::split_into_strings(data, "\n")) {
+    if (paths.insert(path).second) {
+      update_now(config, path);
+    }
+  }
+  LOG("Applied {} deferred mtime updates", paths.size());
+}
+
+} // namespace MtimeJournal
@@ -0,0 +1,40 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <string>
+
+class Config;
+
+// Updates of the modification time (and LRU index) of cache files when they
+// are used. With defer_mtime_updates, used files are instead recorded in a
+// journal in the temporary directory and updated in one batch when the journal
+// has grown large enough or before a cleanup, which removes the metadata
+// writes from the cache hit path on network file systems.
+namespace MtimeJournal {
+
+// Record that the cache file at `path` has been used.
+void record_use(const Config& config, const std::string& path);
+
+// Update all files recorded in the journal and remove it.
+void flush(const Config& config);
+
+} // namespace MtimeJournal
@@ -0,0 +1,100 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "NegativeCache.hpp"
+
+#include "fmtmacros.hpp"
+
+#include "third_party/xxhash.h"
+
+#include <algorithm>
+#include <atomic>
+
+using nonstd::string_view;
+
+namespace {
+
+const uint32_t k_version = 1;
+
+// 16384 slots of 8 bytes each.
+const uint32_t k_slots = 16384;
+
+// A slot holds the upper 32 bits of the entry's hash and the time until which
+// the entry is missing, so that a slot is always read and written atomically.
+uint64_t
+make_slot(uint32_t tag, time_t until)
+{
+  return (static_cast<uint64_t>(tag) << 32)
+         | static_cast<uint32_t>(std::min<int64_t>(until, UINT32_MAX));
+}
+
+uint64_t
+hash_key(const Digest& name, string_view suffix)
+{
+  return XXH3_64bits_withSeed(
+    name.bytes(), Digest::size(), XXH3_64bits(suffix.data(), suffix.size()));
+}
+
+} // namespace
+
+const char NegativeCache::k_file_name[] = "secondary_misses";
+
+struct NegativeCache::Region
+{
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  std::atomic<uint64_t> slots[k_slots];
+};
+
+NegativeCache::NegativeCache(const std::string& cache_dir)
+{
+  if (m_shared.map(FMT("{}/{}", cache_dir, k_file_name),
+                   sizeof(Region),
+                   k_version,
+                   SharedRegion::Create::file_and_dir)) {
+    m_region = static_cast<Region*>(m_shared.data());
+  }
+}
+
+bool
+NegativeCache::is_missing(const Digest& name, string_view suffix, time_t now)
+{
+  const uint64_t hash = hash_key(name, suffix);
+  const uint64_t slot = m_region->slots[hash % k_slots];
+  return (slot >> 32) == (hash >> 32)
+         && static_cast<uint32_t>(slot) > static_cast<uint64_t>(now);
+}
+
+void
+NegativeCache::add(const Digest& name, string_view suffix, time_t until)
+{
+  const uint64_t hash = hash_key(name, suffix);
+  m_region->slots[hash % k_slots] = make_slot(hash >> 32, until);
+}
+
+void
+NegativeCache::remove(const Digest& name, string_view suffix)
+{
+  const uint64_t hash = hash_key(name, suffix);
+  auto& slot = m_region->slots[hash % k_slots];
+  uint64_t value = slot;
+  if ((value >> 32) == (hash >> 32)) {
+    // Leave the slot alone if another miss has replaced it meanwhile.
+    slot.compare_exchange_strong(value, 0);
+  }
+}
@@ -0,0 +1,71 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+#include "NonCopyable.hpp"
+#include "SharedRegion.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <ctime>
+#include <string>
+
+// Entries recently missing in the secondary storage, in a memory-mapped file
+// shared by all ccache invocations, so that lookups of them can be answered
+// locally until the remembered miss expires.
+//
+// The file is named "secondary_misses" and lives in the cache directory. It is
+// a fixed-size hash table where a new miss replaces whatever miss was stored in
+// its slot, so a miss may be forgotten early but never remembered for longer
+// than requested.
+class NegativeCache : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  // Map the negative cache of `cache_dir`, creating the file if needed.
+  explicit NegativeCache(const std::string& cache_dir);
+
+  // Return whether the file could be mapped.
+  explicit operator bool() const;
+
+  // Return whether the entry was recorded as missing at a time later than
+  // `now`.
+  bool is_missing(const Digest& name, nonstd::string_view suffix, time_t now);
+
+  // Record that the entry is missing until `until`.
+  void add(const Digest& name, nonstd::string_view suffix, time_t until);
+
+  // Forget a recorded miss of the entry, e.g. after it has been stored.
+  void remove(const Digest& name, nonstd::string_view suffix);
+
+private:
+  struct Region;
+
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+};
+
+inline NegativeCache::operator bool() const
+{
+  return m_region != nullptr;
+}
@@ -0,0 +1,58 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "PathPrefixSet.hpp"
+
+#include "Util.hpp"
+
+using nonstd::string_view;
+
+void
+PathPrefixSet::add(string_view dir_prefix_or_file)
+{
+  if (dir_prefix_or_file.empty()) {
+    return;
+  }
+  m_entries.emplace_back(dir_prefix_or_file.data(), dir_prefix_or_file.size());
+  m_set.insert(m_entries.back());
+}
+
+void
+PathPrefixSet::clear()
+{
+  m_set.clear();
+  m_entries.clear();
+}
+
+bool
+PathPrefixSet::matches(string_view path) const
+{
+  if (m_set.empty() || path.empty()) {
+    return false;
+  }
+  // An entry matches if it's equal to the path or to a prefix of it that ends
+  // just before or at a directory separator.
+  for (size_t i = 0; i < path.length(); ++i) {
+    if (Util::is_dir_separator(path[i])
+        && ((i > 0 && m_set.count(path.substr(0, i)) > 0)
+            || m_set.count(path.substr(0, i + 1)) > 0)) {
+      return true;
+    }
+  }
+  return m_set.count(path) > 0;
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Arena.hpp"
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <deque>
+#include <string>
+#include <unordered_set>
+
+// Set of directory prefixes and files that a path matches like
+// Util::matches_dir_prefix_or_file matches a single entry. Matching costs one
+// hash lookup per directory level of the path regardless of the number of
+// entries.
+class PathPrefixSet : NonCopyable
+{
+public:
+  // Add a directory prefix or file. Empty entries are ignored.
+  void add(nonstd::string_view dir_prefix_or_file);
+
+  void clear();
+
+  bool empty() const;
+
+  // Return whether `path` is one of the entries or is below a directory entry.
+  bool matches(nonstd::string_view path) const;
+
+private:
+  // A deque since the set refers to the entries.
+  std::deque<std::string> m_entries;
+  std::unordered_set<nonstd::string_view, StringViewHash> m_set;
+};
+
+inline bool
+PathPrefixSet::empty() const
+{
+  return m_set.empty();
+}
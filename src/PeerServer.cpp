@@ -0,0 +1,231 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "PeerServer.hpp"
+
+#include "CacheBundle.hpp"
+#include "Config.hpp"
+#include "Logging.hpp"
+#include "Manifest.hpp"
+#include "Result.hpp"
+#include "Stat.hpp"
+#include "Storage.hpp"
+#include "TcpConnection.hpp"
+#include "ThreadPool.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+// Requests are a request line and a few headers, so anything larger is not
+// from ccache.
+const size_t k_max_request_size = 8192;
+
+// Peers give up after peer_timeout (100 ms by default), so a connection that
+// takes much longer than that only occupies a thread.
+const std::chrono::seconds k_request_timeout(1);
+const std::chrono::seconds k_response_timeout(5);
+
+// Connections served at the same time. Serving is mostly waiting for the
+// network, so this is not related to the number of CPUs.
+const size_t k_max_connections = 32;
+
+std::string
+make_response(string_view status, const std::string& body = "")
+{
+  return FMT(
+    "HTTP/1.1 {}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+    status,
+    body.size(),
+    body);
+}
+
+// Return whether `name_string` looks like the name of a result or manifest,
+// i.e. Digest::to_string() of a digest followed by a suffix.
+bool
+is_entry_name(string_view name_string)
+{
+  const size_t digest_length = 4 + 29;
+  if (name_string.size() != digest_length + 1) {
+    return false;
+  }
+  for (size_t i = 0; i < digest_length; ++i) {
+    const char c = name_string[i];
+    if (!(c >= '0' && c <= '9') && !(c >= 'a' && c <= (i < 4 ? 'f' : 'v'))) {
+      return false;
+    }
+  }
+  const auto suffix = name_string.substr(digest_length);
+  return suffix == Result::k_file_suffix || suffix == Manifest::k_file_suffix;
+}
+
+} // namespace
+
+const char PeerServer::k_default_port[] = "8383";
+
+PeerServer::PeerServer(const Config& config) : m_config(config)
+{
+}
+
+bool
+PeerServer::listen(const std::string& host, const std::string& port)
+{
+  m_fd = TcpConnection::listen(host, port);
+  return static_cast<bool>(m_fd);
+}
+
+std::string
+PeerServer::port() const
+{
+  return TcpConnection::get_local_port(*m_fd);
+}
+
+void
+PeerServer::run()
+{
+  // Connections wait in the listen backlog while all threads are busy.
+  ThreadPool thread_pool(k_max_connections, 1);
+  while (true) {
+    auto connection =
+      std::make_shared<TcpConnection>(TcpConnection::accept(*m_fd));
+    if (!*connection) {
+      LOG("Failed to accept connection: {}", strerror(errno));
+      continue;
+    }
+    thread_pool.enqueue([this, connection] { serve_connection(*connection); });
+  }
+}
+
+void
+PeerServer::serve_connection(TcpConnection& connection) const
+{
+  const auto request_deadline = TcpConnection::Clock::now() + k_request_timeout;
+  std::string request;
+  while (request.find("\r\n\r\n") == std::string::npos) {
+    const auto received = connection.receive(request, request_deadline);
+    if (!received || *received == 0 || request.size() > k_max_request_size) {
+      return;
+    }
+  }
+
+  const auto response_deadline =
+    TcpConnection::Clock::now() + k_response_timeout;
+  if (!connection.send(respond(request), response_deadline)) {
+    LOG("Failed to send response: {}", strerror(errno));
+  }
+}
+
+std::string
+PeerServer::respond(string_view request) const
+{
+  const auto request_line = request.substr(0, request.find("\r\n"));
+  const auto parts = Util::split_into_views(request_line, " ");
+  if (parts.size() != 3 || !Util::starts_with(parts[1], "/")
+      || !Util::starts_with(parts[2], "HTTP/1.")) {
+    return make_response("400 Bad Request");
+  }
+  if (parts[0] != "GET") {
+    return make_response("405 Method Not Allowed");
+  }
+
+  const auto name_string = parts[1].substr(1);
+  if (!is_entry_name(name_string)) {
+    return make_response("404 Not Found");
+  }
+
+  // Results referring to raw, shared or delta base files can't be used on
+  // their own, just like when sharing with the secondary storage.
+  if (Util::ends_with(name_string, Result::k_file_suffix)
+      && (m_config.file_clone() || m_config.hard_link()
+          || m_config.deduplication() || m_config.max_delta_chain() > 0)) {
+    return make_response("404 Not Found");
+  }
+
+  const auto data = read_entry(std::string(name_string));
+  if (!data) {
+    return make_response("404 Not Found");
+  }
+  return make_response("200 OK", *data);
+}
+
+std::shared_ptr<const CacheBundle>
+PeerServer::get_pack(char subdir) const
+{
+  const auto path =
+    FMT("{}/{}/{}", m_config.cache_dir(), subdir, Storage::k_pack_file_name);
+  const auto stat = Stat::stat(path);
+
+  std::lock_guard<std::mutex> lock(m_packs_mutex);
+  auto& pack = m_packs[subdir];
+  if (!stat) {
+    pack = Pack();
+  } else if (!pack.stat || !stat.same_inode_as(pack.stat)
+             || stat.size() != pack.stat.size()) {
+    // Cleanups write a new pack file, so a changed inode means new content.
+    auto bundle = std::make_shared<const CacheBundle>(path);
+    pack = Pack{stat, *bundle ? bundle : nullptr};
+  }
+  return pack.bundle;
+}
+
+optional<std::string>
+PeerServer::read_entry(const std::string& name_string) const
+{
+  const auto recorded_level = Storage::read_cache_level(
+    FMT("{}/{}", m_config.cache_dir(), name_string[0]));
+  for (uint8_t level = Storage::k_min_cache_levels;
+       level <= Storage::k_max_cache_levels;
+       ++level) {
+    if (recorded_level && level != *recorded_level) {
+      continue;
+    }
+    const auto path =
+      Util::get_path_in_cache(m_config.cache_dir(), level, name_string);
+    if (Stat::stat(path)) {
+      try {
+        auto data = Util::read_file(path);
+        LOG("Serving {} to peer", path);
+        return data;
+      } catch (const Error&) {
+        // Removed or packed by cleanup since it was found, so look in the
+        // pack below.
+        break;
+      }
+    }
+  }
+
+  // Packs are only searched if packing is enabled, like in Storage.
+  if (m_config.pack_max_file_size() == 0) {
+    return nullopt;
+  }
+  const auto pack = get_pack(name_string[0]);
+  if (!pack) {
+    return nullopt;
+  }
+  const auto data = pack->get(name_string);
+  if (!data) {
+    return nullopt;
+  }
+  LOG("Serving {} to peer from pack", name_string);
+  return std::string(*data);
+}
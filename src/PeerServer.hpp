@@ -0,0 +1,91 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Fd.hpp"
+#include "Stat.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class CacheBundle;
+class Config;
+class TcpConnection;
+
+// Serves the primary storage of the local cache, read-only, to ccache on other
+// workstations that list this one in their `peers` setting.
+//
+// The protocol is the flat layout of HttpStorage: an entry is fetched with
+// "GET /<name><suffix>" over plain HTTP/1.1 and each connection serves a
+// single request. Entries are looked up like Storage does, including the packs
+// of level 1 subdirectories. Lookups don't update the mtime of the served
+// files, so serving peers doesn't keep entries alive in the local cache.
+class PeerServer
+{
+public:
+  static const char k_default_port[];
+
+  explicit PeerServer(const Config& config);
+
+  // Start listening on `host` and `port`. An empty host means all local
+  // addresses and port "0" means any free port. Returns false on failure.
+  bool listen(const std::string& host, const std::string& port);
+
+  // Return the port that `listen` bound.
+  std::string port() const;
+
+  // Serve connections concurrently until the process is terminated.
+  void run();
+
+  // Return the complete HTTP response to `request` (request line and
+  // headers).
+  std::string respond(nonstd::string_view request) const;
+
+private:
+  struct Pack
+  {
+    Stat stat;
+    std::shared_ptr<const CacheBundle> bundle;
+  };
+
+  const Config& m_config;
+  Fd m_fd;
+
+  // Mapped packs of level 1 subdirectories, by subdirectory name. Remapped
+  // when a cleanup has replaced the pack file.
+  mutable std::mutex m_packs_mutex;
+  mutable std::unordered_map<char, Pack> m_packs;
+
+  // Get the pack of a level 1 subdirectory, or nullptr if it has none.
+  std::shared_ptr<const CacheBundle> get_pack(char subdir) const;
+
+  // Read the primary storage file named `name_string`, from its pack if it
+  // has been packed, if any.
+  nonstd::optional<std::string>
+  read_entry(const std::string& name_string) const;
+
+  void serve_connection(TcpConnection& connection) const;
+};
@@ -0,0 +1,121 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "PresenceFilter.hpp"
+
+#include "fmtmacros.hpp"
+
+#include "third_party/xxhash.h"
+
+#include <atomic>
+
+using nonstd::string_view;
+
+namespace {
+
+const uint32_t k_version = 1;
+
+// 2^20 bits (128 KiB) with four bits per name give a false positive rate of
+// about 1% at 100,000 entries in a subdirectory.
+const uint32_t k_bits = 1 << 20;
+const uint32_t k_words = k_bits / 64;
+const uint32_t k_bits_per_name = 4;
+
+template<typename Visitor>
+void
+for_each_bit(string_view name, Visitor visitor)
+{
+  // Double hashing: the bits are h1, h1 + h2, h1 + 2 * h2, ...
+  const uint64_t hash = XXH3_64bits(name.data(), name.size());
+  const uint32_t h1 = static_cast<uint32_t>(hash);
+  const uint32_t h2 = static_cast<uint32_t>(hash >> 32) | 1;
+  for (uint32_t i = 0; i < k_bits_per_name; ++i) {
+    const uint32_t bit = (h1 + i * h2) % k_bits;
+    visitor(bit / 64, UINT64_C(1) << (bit % 64));
+  }
+}
+
+} // namespace
+
+const char PresenceFilter::k_file_name[] = "presence";
+
+struct PresenceFilter::Region
+{
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  // 1 when the filter has been rebuilt, 0 when created or being rebuilt.
+  std::atomic<uint32_t> trusted;
+  std::atomic<uint64_t> words[k_words];
+};
+
+PresenceFilter::PresenceFilter(const std::string& subdir, bool create)
+{
+  if (m_shared.map(FMT("{}/{}", subdir, k_file_name),
+                   sizeof(Region),
+                   k_version,
+                   create ? SharedRegion::Create::file
+                          : SharedRegion::Create::no)) {
+    m_region = static_cast<Region*>(m_shared.data());
+  }
+}
+
+bool
+PresenceFilter::may_contain(string_view name) const
+{
+  if (!m_region->trusted) {
+    return true;
+  }
+  bool found = true;
+  for_each_bit(name, [&](uint32_t word, uint64_t mask) {
+    if (!(m_region->words[word].load(std::memory_order_relaxed) & mask)) {
+      found = false;
+    }
+  });
+  return found;
+}
+
+void
+PresenceFilter::add(string_view name)
+{
+  for_each_bit(name, [&](uint32_t word, uint64_t mask) {
+    m_region->words[word].fetch_or(mask);
+  });
+}
+
+void
+PresenceFilter::begin_rebuild()
+{
+#ifndef _WIN32
+  // Waiting for other rebuilds makes sure that they don't clear the names
+  // added by this one.
+  flock(m_shared.fd(), LOCK_EX);
+#endif
+  m_region->trusted = 0;
+  for (auto& word : m_region->words) {
+    word = 0;
+  }
+}
+
+void
+PresenceFilter::end_rebuild()
+{
+  m_region->trusted = 1;
+#ifndef _WIN32
+  flock(m_shared.fd(), LOCK_UN);
+#endif
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+#include "SharedRegion.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Bloom filter of the names of the entries in a level 1 cache subdirectory in a
+// memory-mapped file, so that most lookups of missing entries can be answered
+// without looking for the file on every cache level.
+//
+// The file is named "presence" and lives in the subdirectory. Names are added
+// when entries are stored and the filter is rebuilt from the remaining files
+// when the subdirectory is cleaned up. A newly created filter doesn't know
+// about existing entries, so it is not trusted until it has been rebuilt.
+class PresenceFilter : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  // Map the filter of `subdir`. The file is created if `create` is true and
+  // the subdirectory exists.
+  PresenceFilter(const std::string& subdir, bool create);
+
+  // Return whether the filter could be mapped.
+  explicit operator bool() const;
+
+  // Return false if the entry `name` is known not to be in the subdirectory.
+  bool may_contain(nonstd::string_view name) const;
+
+  // Record that the entry `name` is in the subdirectory.
+  void add(nonstd::string_view name);
+
+  // Clear the filter before a rebuild. The filter is not trusted until
+  // `end_rebuild` is called, and other rebuilds wait until then. Names of
+  // entries stored after this call are kept, so the caller must add the
+  // entries it finds in the subdirectory after this call.
+  void begin_rebuild();
+
+  // Mark the filter as trusted again after the entries have been added.
+  void end_rebuild();
+
+private:
+  struct Region;
+
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+};
+
+inline PresenceFilter::operator bool() const
+{
+  return m_region != nullptr;
+}
@@ -0,0 +1,352 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "RedisStorage.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+RedisStorage::RedisStorage(const Url& url, uint32_t timeout_ms)
+  : m_url(url),
+    m_timeout_ms(timeout_ms)
+{
+}
+
+namespace {
+
+optional<std::string>
+get_value(optional<RedisStorage::Reply>& reply, const std::string& key)
+{
+  if (!reply || reply->type == RedisStorage::Reply::Type::nil) {
+    return nullopt;
+  }
+  if (reply->type != RedisStorage::Reply::Type::bulk_string) {
+    LOG("Unexpected Redis reply to GET {}", key);
+    return nullopt;
+  }
+  return std::move(reply->string);
+}
+
+bool
+is_ok(const optional<RedisStorage::Reply>& reply)
+{
+  return reply && reply->type == RedisStorage::Reply::Type::status;
+}
+
+} // namespace
+
+optional<std::string>
+RedisStorage::get(const Digest& name, string_view suffix)
+{
+  const auto key = get_key(name, suffix);
+  auto reply = execute({"GET", key});
+  return get_value(reply, key);
+}
+
+bool
+RedisStorage::put(const Digest& name,
+                  string_view suffix,
+                  const std::string& data)
+{
+  return is_ok(execute({"SET", get_key(name, suffix), data}));
+}
+
+bool
+RedisStorage::remove(const Digest& name, string_view suffix)
+{
+  const auto reply = execute({"DEL", get_key(name, suffix)});
+  return reply && reply->type == Reply::Type::integer && reply->integer > 0;
+}
+
+std::vector<optional<std::string>>
+RedisStorage::get_many(const std::vector<Key>& keys)
+{
+  std::vector<std::string> redis_keys;
+  for (const auto& key : keys) {
+    redis_keys.push_back(get_key(key.name, key.suffix));
+  }
+  std::vector<std::vector<string_view>> commands;
+  for (const auto& redis_key : redis_keys) {
+    commands.push_back({"GET", redis_key});
+  }
+
+  auto replies = execute_many(commands);
+  std::vector<optional<std::string>> result;
+  for (size_t i = 0; i < replies.size(); ++i) {
+    result.push_back(get_value(replies[i], redis_keys[i]));
+  }
+  return result;
+}
+
+size_t
+RedisStorage::put_many(const std::vector<Entry>& entries)
+{
+  std::vector<std::string> redis_keys;
+  for (const auto& entry : entries) {
+    redis_keys.push_back(get_key(entry.key.name, entry.key.suffix));
+  }
+  std::vector<std::vector<string_view>> commands;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    commands.push_back({"SET", redis_keys[i], entries[i].data});
+  }
+
+  const auto replies = execute_many(commands);
+  return std::count_if(replies.begin(), replies.end(), is_ok);
+}
+
+optional<RedisStorage::Url>
+RedisStorage::parse_url(string_view url)
+{
+  const string_view scheme = "redis://";
+  if (!Util::starts_with(url, scheme)) {
+    return nullopt;
+  }
+  auto rest = url.substr(scheme.length());
+
+  Url result;
+  const auto slash = rest.find('/');
+  if (slash != string_view::npos) {
+    result.database = std::string(rest.substr(slash + 1));
+    if (!result.database.empty()) {
+      try {
+        Util::parse_unsigned(result.database, nullopt, nullopt, "database");
+      } catch (const Error&) {
+        return nullopt;
+      }
+    }
+    rest = rest.substr(0, slash);
+  }
+
+  const auto at = rest.rfind('@');
+  if (at != string_view::npos) {
+    const auto user_info = rest.substr(0, at);
+    const auto colon = user_info.find(':');
+    if (colon == string_view::npos) {
+      result.password = std::string(user_info);
+    } else {
+      result.username = std::string(user_info.substr(0, colon));
+      result.password = std::string(user_info.substr(colon + 1));
+    }
+    rest = rest.substr(at + 1);
+  }
+
+  const auto host_and_port = TcpConnection::parse_host_and_port(rest, "6379");
+  if (!host_and_port) {
+    return nullopt;
+  }
+  result.host = host_and_port->first;
+  result.port = host_and_port->second;
+
+  return result;
+}
+
+std::string
+RedisStorage::format_command(const std::vector<string_view>& args)
+{
+  std::string result = FMT("*{}\r\n", args.size());
+  for (const auto& arg : args) {
+    result += FMT("${}\r\n", arg.size());
+    result.append(arg.data(), arg.size());
+    result += "\r\n";
+  }
+  return result;
+}
+
+optional<RedisStorage::Reply>
+RedisStorage::parse_reply(string_view data, size_t& pos)
+{
+  const auto line_end = data.find("\r\n", pos);
+  if (line_end == string_view::npos) {
+    return nullopt;
+  }
+  const char type = data[pos];
+  const auto line = std::string(data.substr(pos + 1, line_end - pos - 1));
+  size_t next = line_end + 2;
+
+  Reply reply;
+  switch (type) {
+  case '+':
+    reply.type = Reply::Type::status;
+    reply.string = line;
+    break;
+
+  case '-':
+    reply.type = Reply::Type::error;
+    reply.string = line;
+    break;
+
+  case ':':
+    reply.type = Reply::Type::integer;
+    reply.integer = Util::parse_signed(line);
+    break;
+
+  case '$': {
+    const auto length = Util::parse_signed(line, -1);
+    if (length < 0) {
+      reply.type = Reply::Type::nil;
+      break;
+    }
+    const auto size = static_cast<size_t>(length);
+    if (data.size() < next + size + 2) {
+      return nullopt;
+    }
+    if (data.substr(next + size, 2) != "\r\n") {
+      throw Error("missing bulk string terminator");
+    }
+    reply.type = Reply::Type::bulk_string;
+    reply.string = std::string(data.substr(next, size));
+    next += size + 2;
+    break;
+  }
+
+  case '*': {
+    const auto count = Util::parse_signed(line, -1);
+    if (count < 0) {
+      reply.type = Reply::Type::nil;
+      break;
+    }
+    reply.type = Reply::Type::array;
+    for (int64_t i = 0; i < count; ++i) {
+      auto element = parse_reply(data, next);
+      if (!element) {
+        return nullopt;
+      }
+      reply.elements.push_back(std::move(*element));
+    }
+    break;
+  }
+
+  default:
+    throw Error("unknown reply type '{}'", type);
+  }
+
+  pos = next;
+  return reply;
+}
+
+std::string
+RedisStorage::get_key(const Digest& name, string_view suffix)
+{
+  return FMT("ccache:{}{}", name.to_string(), suffix);
+}
+
+optional<RedisStorage::Reply>
+RedisStorage::execute(const std::vector<string_view>& command)
+{
+  return std::move(execute_many({command})[0]);
+}
+
+std::vector<optional<RedisStorage::Reply>>
+RedisStorage::execute_many(
+  const std::vector<std::vector<string_view>>& commands)
+{
+  std::vector<optional<Reply>> result(commands.size());
+  if (commands.empty()) {
+    return result;
+  }
+
+  const auto deadline =
+    TcpConnection::Clock::now() + std::chrono::milliseconds(m_timeout_ms);
+
+  std::string request;
+  size_t setup_replies = 0;
+  if (!m_connection) {
+    m_connection = TcpConnection::connect(m_url.host, m_url.port, deadline);
+    if (!m_connection) {
+      return result;
+    }
+    if (!m_url.password.empty()) {
+      request += m_url.username.empty()
+                   ? format_command({"AUTH", m_url.password})
+                   : format_command({"AUTH", m_url.username, m_url.password});
+      ++setup_replies;
+    }
+    if (!m_url.database.empty()) {
+      request += format_command({"SELECT", m_url.database});
+      ++setup_replies;
+    }
+  }
+  for (const auto& command : commands) {
+    request += format_command(command);
+  }
+
+  if (!m_connection.send(request, deadline)) {
+    LOG("Failed to send Redis {} command to {}:{}: {}",
+        commands[0][0],
+        m_url.host,
+        m_url.port,
+        strerror(errno));
+    m_connection.close();
+    return result;
+  }
+
+  std::vector<Reply> replies;
+  std::string data;
+  size_t pos = 0;
+  try {
+    while (replies.size() < setup_replies + commands.size()) {
+      auto reply = parse_reply(data, pos);
+      if (reply) {
+        replies.push_back(std::move(*reply));
+        continue;
+      }
+      const auto received = m_connection.receive(data, deadline);
+      if (!received || *received == 0) {
+        LOG("Failed to receive Redis {} reply from {}:{}: {}",
+            commands[0][0],
+            m_url.host,
+            m_url.port,
+            received ? "connection closed" : strerror(errno));
+        m_connection.close();
+        return result;
+      }
+    }
+  } catch (const Error& e) {
+    LOG("Malformed Redis {} reply from {}:{}: {}",
+        commands[0][0],
+        m_url.host,
+        m_url.port,
+        e.what());
+    m_connection.close();
+    return result;
+  }
+
+  for (size_t i = 0; i < replies.size(); ++i) {
+    if (replies[i].type == Reply::Type::error) {
+      LOG("Redis error from {}:{}: {}",
+          m_url.host,
+          m_url.port,
+          replies[i].string);
+      if (i < setup_replies) {
+        m_connection.close();
+        return result;
+      }
+    } else if (i >= setup_replies) {
+      result[i - setup_replies] = std::move(replies[i]);
+    }
+  }
+  return result;
+}
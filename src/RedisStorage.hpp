@@ -0,0 +1,104 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "SecondaryStorage.hpp"
+#include "TcpConnection.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+#include <vector>
+
+// Secondary storage in a Redis (or Redis protocol compatible) server, suited
+// for small manifests and results where the latency of an HTTP request would
+// dominate. An entry is stored under the key "ccache:<name><suffix>".
+//
+// The connection is opened on first use and reused for the rest of the
+// process. Commands needed to set up the connection (AUTH and SELECT) are
+// pipelined with the first request so that each operation needs a single round
+// trip.
+class RedisStorage : public SecondaryStorage
+{
+public:
+  struct Url
+  {
+    std::string host;
+    std::string port;
+    std::string username;
+    std::string password;
+    std::string database;
+  };
+
+  struct Reply
+  {
+    enum class Type { status, error, integer, bulk_string, nil, array };
+
+    Type type = Type::nil;
+    std::string string;
+    int64_t integer = 0;
+    std::vector<Reply> elements;
+  };
+
+  RedisStorage(const Url& url, uint32_t timeout_ms);
+
+  nonstd::optional<std::string> get(const Digest& name,
+                                    nonstd::string_view suffix) override;
+  bool put(const Digest& name,
+           nonstd::string_view suffix,
+           const std::string& data) override;
+  bool remove(const Digest& name, nonstd::string_view suffix) override;
+
+  // Pipeline the requests.
+  std::vector<nonstd::optional<std::string>>
+  get_many(const std::vector<Key>& keys) override;
+  size_t put_many(const std::vector<Entry>& entries) override;
+
+  // Parse an URL on the form "redis://[[username]:password@]host[:port][/db]".
+  // Returns nullopt if `url` is not such an URL.
+  static nonstd::optional<Url> parse_url(nonstd::string_view url);
+
+  // Format `args` as a command in the Redis serialization protocol.
+  static std::string
+  format_command(const std::vector<nonstd::string_view>& args);
+
+  // Parse a reply starting at `pos` in `data` and advance `pos` past it.
+  // Returns nullopt if `data` doesn't contain a complete reply. Throws `Error`
+  // if the reply is malformed.
+  static nonstd::optional<Reply> parse_reply(nonstd::string_view data,
+                                             size_t& pos);
+
+private:
+  const Url m_url;
+  const uint32_t m_timeout_ms;
+  TcpConnection m_connection;
+
+  static std::string get_key(const Digest& name, nonstd::string_view suffix);
+
+  nonstd::optional<Reply>
+  execute(const std::vector<nonstd::string_view>& command);
+
+  // Send `commands` in one batch and return their replies, with nullopt for
+  // failed commands.
+  std::vector<nonstd::optional<Reply>>
+  execute_many(const std::vector<std::vector<nonstd::string_view>>& commands);
+};
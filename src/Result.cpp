@@ -19,20 +19,32 @@
 #include "Result.hpp"
 
 #include "AtomicFile.hpp"
+#include "BackgroundCompressor.hpp"
+#include "CacheBundle.hpp"
 #include "CacheEntryReader.hpp"
 #include "CacheEntryWriter.hpp"
+#include "Checksum.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
 #include "Fd.hpp"
 #include "File.hpp"
+#include "Hash.hpp"
+#include "Jobserver.hpp"
 #include "Logging.hpp"
+#include "LruIndex.hpp"
 #include "Stat.hpp"
+#include "Storage.hpp"
 #include "Statistics.hpp"
+#include "StdMakeUnique.hpp"
+#include "ThreadPool.hpp"
+#include "Tracing.hpp"
 #include "Util.hpp"
+#include "ZstdDelta.hpp"
 #include "exceptions.hpp"
 #include "fmtmacros.hpp"
 
 #include <algorithm>
+#include <thread>
 
 // Result data format
 // ==================
@@ -52,6 +64,7 @@
 // <body>                 ::= <n_entries> <entry>* ; potentially compressed
 // <n_entries>            ::= uint8_t
 // <entry>                ::= <embedded_file_entry> | <raw_file_entry>
+//                          | <shared_file_entry> | <delta_file_entry>
 // <embedded_file_entry>  ::= <embedded_file_marker> <suffix_len> <suffix>
 //                            <data_len> <data>
 // <embedded_file_marker> ::= 0 (uint8_t)
@@ -61,9 +74,28 @@
 // <raw_file_entry>       ::= <raw_file_marker> <suffix_len> <suffix> <file_len>
 // <raw_file_marker>      ::= 1 (uint8_t)
 // <file_len>             ::= uint64_t
+// <shared_file_entry>    ::= <shared_file_marker> <suffix_len> <suffix>
+//                            <file_len> <content_digest>
+// <shared_file_marker>   ::= 2 (uint8_t)
+// <content_digest>       ::= 20 bytes ; names the shared file result
+// <delta_file_entry>     ::= <delta_file_marker> <suffix_len> <suffix>
+//                            <file_len> <base_name> <base_checksum>
+//                            <delta_depth> <delta_len> <delta>
+// <delta_file_marker>    ::= 3 (uint8_t)
+// <base_name>            ::= 20 bytes ; names the result holding the base
+// <base_checksum>        ::= uint64_t ; XXH3 of the base object file
+// <delta_depth>          ::= uint8_t ; 1 + delta depth of the base entry
+// <delta_len>            ::= uint64_t
+// <delta>                ::= delta_len bytes ; zstd frame with base as prefix
 // <epilogue>             ::= <checksum>
 // <checksum>             ::= uint64_t ; XXH3 of content bytes
 //
+// A cache entry (result or manifest) written without knowing the payload size
+// in advance is "streamed": its <version> has the 0x80 bit set, its epilogue is
+// <payload_len> <checksum> where <payload_len> is the uint64_t size of the body
+// and <content_len> is filled in after writing the epilogue (if possible). The
+// checksum covers the header with <content_len> set to 0.
+//
 // Sketch of concrete layout:
 //
 // <magic>                4 bytes
@@ -84,11 +116,31 @@
 // ...
 // checksum               8 bytes
 //
+// Framed result data format
+// =========================
+//
+// When the framed_results option is enabled, each embedded file is stored in a
+// separately compressed frame so that a reader can seek to the entries it
+// wants and decompress them independently:
+//
+// <framed_result>        ::= <entry_table> <frame>*
+// <entry_table>          ::= <header> <table_body> <epilogue> ; <compr_none>
+// <table_body>           ::= <n_entries> <table_entry>*
+// <table_entry>          ::= <marker> <embedded_file_type> <file_len>
+//                            <frame_len> [<content_digest>]
+// <marker>               ::= <embedded_file_marker> | <raw_file_marker>
+//                          | <shared_file_marker>
+// <frame_len>            ::= uint64_t ; 0 for raw and shared files
+// <frame>                ::= <header> <data> <epilogue> ; one per embedded file
+//
+// Both the entry table and the frames use version 2 in their headers.
+//
 //
 // Version history
 // ===============
 //
 // 1: Introduced in ccache 4.0.
+// 2: Framed layout.
 
 using nonstd::nullopt;
 using nonstd::optional;
@@ -102,21 +154,250 @@ const uint8_t k_embedded_file_marker = 0;
 // File stored as-is in the file system.
 const uint8_t k_raw_file_marker = 1;
 
+// File data stored in a separate result named by the digest of the data, shared
+// by all results with the same file content.
+const uint8_t k_shared_file_marker = 2;
+
+// Object file data stored as a zstd delta against the object file of an earlier
+// result for the same output file (see the max_delta_chain option).
+const uint8_t k_delta_file_marker = 3;
+
+// Files smaller than this are always embedded even if deduplication is enabled
+// since sharing them would not pay off.
+const uint64_t k_min_size_for_deduplication = 16 * 1024;
+
+// Deltas that don't save at least this fraction of the compressed object file
+// size are not worth depending on another result.
+const double k_min_delta_savings = 0.5;
+
+// Results (or frames) smaller than this are compressed without zstd worker
+// threads.
+const uint64_t k_min_size_for_compression_threads = 8 * 1024 * 1024;
+
+// Frames of a framed result are decompressed in parallel if the wanted ones
+// are at least this large in total (below, threads don't pay off)...
+const uint64_t k_min_size_for_parallel_decompression = 1024 * 1024;
+
+// ...and at most this large, since they are then held in memory.
+const uint64_t k_max_size_for_parallel_decompression = 512 * 1024 * 1024;
+
 std::string
-get_raw_file_path(string_view result_path, uint32_t entry_number)
+get_shared_file_path(const std::string& cache_dir, const Digest& digest)
 {
-  const auto prefix = result_path.substr(
-    0, result_path.length() - Result::k_file_suffix.length());
-  return FMT("{}{}W", prefix, entry_number);
+  const auto name = digest.to_string() + Result::k_file_suffix;
+  const auto level =
+    Storage::read_cache_level(FMT("{}/{}", cache_dir, name[0]));
+  return Util::get_path_in_cache(
+    cache_dir, level ? *level : Storage::k_min_cache_levels, name);
 }
 
+// Unpack the shared file at `path` if a cleanup has packed it, see
+// pack_max_file_size. Returns whether the file was unpacked.
 bool
-should_store_raw_file(const Config& config, Result::FileType type)
+unpack_shared_file(const std::string& cache_dir, const std::string& path)
+{
+  const auto name = LruIndex::name_from_path(cache_dir, path);
+  if (name.empty()) {
+    return false;
+  }
+  const auto pack_path =
+    FMT("{}/{}/{}", cache_dir, name[0], Storage::k_pack_file_name);
+  if (!Stat::stat(pack_path)) {
+    return false;
+  }
+  CacheBundle pack(pack_path);
+  const auto data = pack ? pack.get(name) : nullopt;
+  return data && Storage::unpack_file(cache_dir, path, *data);
+}
+
+void
+read_embedded_data(CacheEntryReader& cache_entry_reader,
+                   uint64_t file_len,
+                   Result::Reader::Consumer& consumer)
+{
+  const bool copied_directly = cache_entry_reader.read_direct(
+    file_len, [&](int fd, uint64_t offset) {
+      return consumer.on_entry_data_direct(fd, offset, file_len);
+    });
+
+  uint8_t buf[READ_BUFFER_SIZE];
+  uint64_t remain = copied_directly ? 0 : file_len;
+  while (remain > 0) {
+    size_t n = std::min(remain, static_cast<uint64_t>(sizeof(buf)));
+    cache_entry_reader.read(buf, n);
+    consumer.on_entry_data(buf, n);
+    remain -= n;
+  }
+}
+
+// Open the frame of entry `entry_number` at `offset` in a framed result.
+std::unique_ptr<CacheEntryReader>
+open_frame(FILE* stream,
+           uint64_t offset,
+           uint32_t entry_number,
+           uint64_t file_len)
+{
+  if (fseek(stream, offset, SEEK_SET) != 0) {
+    throw Error("Error seeking to frame {}: {}", entry_number, strerror(errno));
+  }
+  auto frame_reader = std::make_unique<CacheEntryReader>(
+    stream, Result::k_magic, Result::k_framed_version);
+  if (frame_reader->payload_size() != file_len) {
+    throw Error("Bad size of frame {} (actual {} bytes, expected {} bytes)",
+                entry_number,
+                frame_reader->payload_size(),
+                file_len);
+  }
+  return frame_reader;
+}
+
+// Forwards the data of the single entry in a shared file result to the
+// consumer of the result referring to it.
+class SharedFileConsumer : public Result::Reader::Consumer
+{
+public:
+  SharedFileConsumer(Result::Reader::Consumer& consumer)
+    : m_consumer(consumer)
+  {
+  }
+
+  void
+  on_header(CacheEntryReader& /*cache_entry_reader*/) override
+  {
+  }
+
+  void
+  on_entry_start(uint32_t /*entry_number*/,
+                 Result::FileType /*file_type*/,
+                 uint64_t file_len,
+                 optional<std::string> raw_file) override
+  {
+    if (raw_file) {
+      throw Error("Unexpected raw file entry in shared file");
+    }
+    m_file_len = file_len;
+  }
+
+  void
+  on_entry_data(const uint8_t* data, size_t size) override
+  {
+    m_consumer.on_entry_data(data, size);
+  }
+
+  bool
+  on_entry_data_direct(int fd, uint64_t offset, uint64_t size) override
+  {
+    return m_consumer.on_entry_data_direct(fd, offset, size);
+  }
+
+  void
+  on_entry_end() override
+  {
+  }
+
+  uint64_t
+  file_len() const
+  {
+    return m_file_len;
+  }
+
+private:
+  Result::Reader::Consumer& m_consumer;
+  uint64_t m_file_len = 0;
+};
+
+// Collects the object file data of a result used as base for a delta entry.
+class DeltaBaseConsumer : public Result::Reader::Consumer
+{
+public:
+  DeltaBaseConsumer(std::string& data) : m_data(data)
+  {
+  }
+
+  bool
+  wants_entry(Result::FileType file_type) const override
+  {
+    return file_type == Result::FileType::object;
+  }
+
+  void
+  on_header(CacheEntryReader& /*cache_entry_reader*/) override
+  {
+  }
+
+  void
+  on_entry_start(uint32_t /*entry_number*/,
+                 Result::FileType file_type,
+                 uint64_t file_len,
+                 optional<std::string> raw_file) override
+  {
+    m_in_object = file_type == Result::FileType::object;
+    if (!m_in_object) {
+      return;
+    }
+    m_found = true;
+    if (raw_file) {
+      m_data = Util::read_file(*raw_file, file_len);
+    } else {
+      m_data.clear();
+      m_data.reserve(file_len);
+    }
+  }
+
+  void
+  on_entry_data(const uint8_t* data, size_t size) override
+  {
+    if (m_in_object) {
+      m_data.append(reinterpret_cast<const char*>(data), size);
+    }
+  }
+
+  void
+  on_entry_end() override
+  {
+    m_in_object = false;
+  }
+
+  bool
+  found() const
+  {
+    return m_found;
+  }
+
+private:
+  std::string& m_data;
+  bool m_in_object = false;
+  bool m_found = false;
+};
+
+// Key of the digest memo entry naming the latest result stored for the output
+// file of `ctx`, which is the base for a delta of the next result.
+Digest
+delta_base_key(const Context& ctx)
+{
+  Hash hash;
+  hash.hash_delimiter("delta base");
+  hash.hash(ctx.config.namespace_());
+  hash.hash(ctx.apparent_cwd);
+  hash.hash(ctx.args_info.output_obj);
+  return hash.digest();
+}
+
+bool
+should_store_raw_file(const Config& config,
+                      Result::FileType type,
+                      uint64_t file_size)
 {
   if (!config.file_clone() && !config.hard_link()) {
     return false;
   }
 
+  // Small files are cheap to copy, so keep them embedded and compressed and
+  // only pay for uncompressed storage where cloning or hard linking matters.
+  if (file_size < config.raw_file_min_size()) {
+    return false;
+  }
+
   // Only store object files as raw files since there are several problems with
   // storing other file types:
   //
@@ -143,6 +424,7 @@ namespace Result {
 const std::string k_file_suffix = "R";
 const uint8_t k_magic[4] = {'c', 'C', 'r', 'S'};
 const uint8_t k_version = 1;
+const uint8_t k_framed_version = 2;
 const char* const k_unknown_file_type = "<unknown type>";
 
 const char*
@@ -158,6 +440,9 @@ file_type_to_string(FileType type)
   case FileType::stderr_output:
     return "<stderr>";
 
+  case FileType::stdout_output:
+    return "<stdout>";
+
   case FileType::coverage_unmangled:
     return ".gcno-unmangled";
 
@@ -172,11 +457,37 @@ file_type_to_string(FileType type)
 
   case FileType::coverage_mangled:
     return ".gcno-mangled";
+
+  case FileType::exit_status:
+    return "<exit status>";
+
+  case FileType::module_interface:
+    return ".pcm";
+
+  case FileType::compile_time:
+    return "<compile time>";
+
+  case FileType::output_digests:
+    return "<output digests>";
+
+  case FileType::command_output:
+    return "<command output>";
+
+  case FileType::warning_options:
+    return "<warning options>";
   }
 
   return k_unknown_file_type;
 }
 
+std::string
+get_raw_file_path(string_view result_path, uint32_t entry_number)
+{
+  const auto prefix =
+    result_path.substr(0, result_path.length() - k_file_suffix.length());
+  return FMT("{}{}W", prefix, entry_number);
+}
+
 std::string
 gcno_file_in_mangled_form(const Context& ctx)
 {
@@ -196,8 +507,12 @@ gcno_file_in_unmangled_form(const Context& ctx)
   return Util::change_extension(ctx.args_info.output_obj, ".gcno");
 }
 
-Result::Reader::Reader(const std::string& result_path)
-  : m_result_path(result_path)
+Result::Reader::Reader(const std::string& result_path,
+                       const std::string& cache_dir,
+                       bool trust_scrubbed)
+  : m_result_path(result_path),
+    m_cache_dir(cache_dir),
+    m_trust_scrubbed(trust_scrubbed)
 {
 }
 
@@ -205,6 +520,7 @@ optional<std::string>
 Result::Reader::read(Consumer& consumer)
 {
   LOG("Reading result {}", m_result_path);
+  Tracing::Span span("result_read", m_result_path);
 
   try {
     if (read_result(consumer)) {
@@ -226,13 +542,26 @@ Reader::read_result(Consumer& consumer)
     return false;
   }
 
-  CacheEntryReader cache_entry_reader(file.get(), k_magic, k_version);
+  const bool framed =
+    CacheEntryReader::peek_version(file.get()) == k_framed_version;
+  CacheEntryReader cache_entry_reader(
+    file.get(), k_magic, framed ? k_framed_version : k_version);
+  m_skip_checksums =
+    m_trust_scrubbed && CacheEntryReader::is_scrubbed(fileno(file.get()));
+  if (m_skip_checksums) {
+    cache_entry_reader.skip_checksum();
+  }
 
   consumer.on_header(cache_entry_reader);
 
   uint8_t n_entries;
   cache_entry_reader.read(n_entries);
 
+  if (framed) {
+    read_framed_entries(file.get(), cache_entry_reader, n_entries, consumer);
+    return true;
+  }
+
   uint32_t i;
   for (i = 0; i < n_entries; ++i) {
     read_entry(cache_entry_reader, i, consumer);
@@ -257,6 +586,8 @@ Reader::read_entry(CacheEntryReader& cache_entry_reader,
   switch (marker) {
   case k_embedded_file_marker:
   case k_raw_file_marker:
+  case k_shared_file_marker:
+  case k_delta_file_marker:
     break;
 
   default:
@@ -272,35 +603,305 @@ Reader::read_entry(CacheEntryReader& cache_entry_reader,
 
   if (marker == k_embedded_file_marker) {
     consumer.on_entry_start(entry_number, file_type, file_len, nullopt);
-
-    uint8_t buf[READ_BUFFER_SIZE];
-    size_t remain = file_len;
-    while (remain > 0) {
-      size_t n = std::min(remain, sizeof(buf));
-      cache_entry_reader.read(buf, n);
-      consumer.on_entry_data(buf, n);
-      remain -= n;
-    }
+    read_embedded_data(cache_entry_reader, file_len, consumer);
+  } else if (marker == k_shared_file_marker) {
+    Digest digest;
+    cache_entry_reader.read(digest.bytes(), digest.size());
+    read_shared_file(digest, entry_number, file_type, file_len, consumer);
+  } else if (marker == k_delta_file_marker) {
+    read_delta_file(
+      cache_entry_reader, entry_number, file_type, file_len, consumer);
   } else {
     ASSERT(marker == k_raw_file_marker);
+    read_raw_file(entry_number, file_type, file_len, consumer);
+  }
+
+  consumer.on_entry_end();
+}
+
+void
+Reader::read_framed_entries(FILE* stream,
+                            CacheEntryReader& table_reader,
+                            uint8_t n_entries,
+                            Reader::Consumer& consumer)
+{
+  struct TableEntry
+  {
+    uint8_t marker;
+    FileType file_type;
+    uint64_t file_len;
+    uint64_t frame_len;
+    Digest digest;
+  };
 
-    auto raw_path = get_raw_file_path(m_result_path, entry_number);
-    auto st = Stat::stat(raw_path, Stat::OnError::throw_error);
-    if (st.size() != file_len) {
-      throw Error("Bad file size of {} (actual {} bytes, expected {} bytes)",
-                  raw_path,
-                  st.size(),
-                  file_len);
+  std::vector<TableEntry> table(n_entries);
+  for (auto& entry : table) {
+    table_reader.read(entry.marker);
+    if (entry.marker != k_embedded_file_marker
+        && entry.marker != k_raw_file_marker
+        && entry.marker != k_shared_file_marker) {
+      throw Error("Unknown entry type: {}", entry.marker);
     }
+    UnderlyingFileTypeInt type;
+    table_reader.read(type);
+    entry.file_type = FileType(type);
+    table_reader.read(entry.file_len);
+    table_reader.read(entry.frame_len);
+    if (entry.marker == k_shared_file_marker) {
+      table_reader.read(entry.digest.bytes(), Digest::size());
+    }
+  }
+  table_reader.finalize(true);
 
-    consumer.on_entry_start(entry_number, file_type, file_len, raw_path);
+  std::vector<uint64_t> frame_offsets;
+  std::vector<uint32_t> wanted_frames;
+  uint64_t wanted_frames_size = 0;
+  uint64_t frame_offset = table_reader.content_size();
+  for (uint32_t i = 0; i < n_entries; ++i) {
+    frame_offsets.push_back(frame_offset);
+    frame_offset += table[i].frame_len;
+    if (table[i].marker == k_embedded_file_marker
+        && consumer.wants_entry(table[i].file_type)) {
+      wanted_frames.push_back(i);
+      wanted_frames_size += table[i].file_len;
+    }
   }
 
-  consumer.on_entry_end();
+  // Decompress several large enough frames in parallel into memory. The
+  // consumer is still called for one entry at a time, in order.
+  std::vector<std::string> frame_data(n_entries);
+  std::vector<bool> prefetched(n_entries, false);
+  const size_t threads =
+    std::min<size_t>(std::thread::hardware_concurrency(), wanted_frames.size());
+  if (threads > 1
+      && wanted_frames_size >= k_min_size_for_parallel_decompression
+      && wanted_frames_size <= k_max_size_for_parallel_decompression) {
+    std::vector<std::string> errors(wanted_frames.size());
+    // The calling thread also takes part in the decompression.
+    Jobserver::Tokens tokens(threads - 1);
+    ThreadPool thread_pool(tokens.count());
+    thread_pool.for_each_index(wanted_frames.size(), [&](size_t j) {
+      const uint32_t i = wanted_frames[j];
+      try {
+        File file(m_result_path, "rb");
+        if (!file) {
+          throw Error("Failed to open {}: {}", m_result_path, strerror(errno));
+        }
+        auto frame_reader =
+          open_frame(file.get(), frame_offsets[i], i, table[i].file_len);
+        if (m_skip_checksums) {
+          frame_reader->skip_checksum();
+        }
+        frame_data[i].resize(table[i].file_len);
+        frame_reader->read(&frame_data[i][0], frame_data[i].size());
+        frame_reader->finalize(true);
+      } catch (const Error& e) {
+        errors[j] = e.what();
+        return false;
+      }
+      return true;
+    });
+    for (const auto& error : errors) {
+      if (!error.empty()) {
+        throw Error(error);
+      }
+    }
+    for (const auto i : wanted_frames) {
+      prefetched[i] = true;
+    }
+    LOG("Decompressed {} frames using {} threads",
+        wanted_frames.size(),
+        threads);
+  }
+
+  for (uint32_t i = 0; i < n_entries; ++i) {
+    const auto& entry = table[i];
+    if (!consumer.wants_entry(entry.file_type)) {
+      continue;
+    }
+
+    if (prefetched[i]) {
+      consumer.on_entry_start(i, entry.file_type, entry.file_len, nullopt);
+      if (!frame_data[i].empty()) {
+        consumer.on_entry_data(
+          reinterpret_cast<const uint8_t*>(frame_data[i].data()),
+          frame_data[i].size());
+      }
+      std::string().swap(frame_data[i]);
+    } else if (entry.marker == k_embedded_file_marker) {
+      auto frame_reader =
+        open_frame(stream, frame_offsets[i], i, entry.file_len);
+      if (m_skip_checksums) {
+        frame_reader->skip_checksum();
+      }
+      consumer.on_entry_start(i, entry.file_type, entry.file_len, nullopt);
+      read_embedded_data(*frame_reader, entry.file_len, consumer);
+      frame_reader->finalize(true);
+    } else if (entry.marker == k_shared_file_marker) {
+      read_shared_file(
+        entry.digest, i, entry.file_type, entry.file_len, consumer);
+    } else {
+      read_raw_file(i, entry.file_type, entry.file_len, consumer);
+    }
+
+    consumer.on_entry_end();
+  }
+}
+
+void
+Reader::read_raw_file(uint32_t entry_number,
+                      FileType file_type,
+                      uint64_t file_len,
+                      Reader::Consumer& consumer)
+{
+  auto raw_path = get_raw_file_path(m_result_path, entry_number);
+  auto st = Stat::stat(raw_path, Stat::OnError::throw_error);
+  if (st.size() != file_len) {
+    throw Error("Bad file size of {} (actual {} bytes, expected {} bytes)",
+                raw_path,
+                st.size(),
+                file_len);
+  }
+
+  consumer.on_entry_start(entry_number, file_type, file_len, raw_path);
+}
+
+void
+Reader::read_shared_file(const Digest& digest,
+                         uint32_t entry_number,
+                         FileType file_type,
+                         uint64_t file_len,
+                         Reader::Consumer& consumer)
+{
+  if (m_cache_dir.empty()) {
+    throw Error("Shared file {} referenced without a cache directory",
+                digest.to_string());
+  }
+
+  const auto shared_path = get_shared_file_path(m_cache_dir, digest);
+  if (!Stat::stat(shared_path)
+      && !unpack_shared_file(m_cache_dir, shared_path)) {
+    // Most likely removed by cleanup, so treat the result as missing.
+    throw Error("Missing shared file {}", shared_path);
+  }
+
+  consumer.on_entry_start(entry_number, file_type, file_len, nullopt);
+
+  SharedFileConsumer shared_file_consumer(consumer);
+  Reader shared_file_reader(shared_path, {}, m_trust_scrubbed);
+  if (!shared_file_reader.read_result(shared_file_consumer)) {
+    throw Error("Missing shared file {}", shared_path);
+  }
+  if (shared_file_consumer.file_len() != file_len) {
+    throw Error("Bad file size of {} (actual {} bytes, expected {} bytes)",
+                shared_path,
+                shared_file_consumer.file_len(),
+                file_len);
+  }
+
+  // Keep the shared file alive for as long as it is referenced by used results.
+  Util::update_mtime(shared_path);
+  LruIndex::record_use(m_cache_dir, shared_path);
+}
+
+void
+Reader::read_delta_file(CacheEntryReader& cache_entry_reader,
+                        uint32_t entry_number,
+                        FileType file_type,
+                        uint64_t file_len,
+                        Reader::Consumer& consumer)
+{
+  Digest base_name;
+  cache_entry_reader.read(base_name.bytes(), base_name.size());
+  uint64_t base_checksum;
+  cache_entry_reader.read(base_checksum);
+  uint8_t delta_depth;
+  cache_entry_reader.read(delta_depth);
+  uint64_t delta_len;
+  cache_entry_reader.read(delta_len);
+  std::string delta(delta_len, '\0');
+  if (delta_len > 0) {
+    cache_entry_reader.read(&delta[0], delta_len);
+  }
+
+  if (m_cache_dir.empty()) {
+    throw Error("Delta base {} referenced without a cache directory",
+                base_name.to_string());
+  }
+  if (delta_depth == 0 || delta_depth > m_max_delta_depth) {
+    throw Error("Bad delta depth {} (expected 1 to {})",
+                delta_depth,
+                m_max_delta_depth);
+  }
+
+  std::string base;
+  read_delta_base(
+    m_cache_dir, base_name, delta_depth - 1, m_trust_scrubbed, base);
+  Checksum checksum;
+  checksum.update(base.data(), base.size());
+  if (checksum.digest() != base_checksum) {
+    throw Error("Delta base {} has changed", base_name.to_string());
+  }
+  const std::string data = ZstdDelta::decompress(base, delta, file_len);
+
+  consumer.on_entry_start(entry_number, file_type, file_len, nullopt);
+  if (!data.empty()) {
+    consumer.on_entry_data(reinterpret_cast<const uint8_t*>(data.data()),
+                           data.size());
+  }
+  if (file_type == FileType::object) {
+    m_object_delta_depth = delta_depth;
+  }
+}
+
+uint8_t
+Reader::read_delta_base(const std::string& cache_dir,
+                        const Digest& name,
+                        uint8_t max_depth,
+                        bool trust_scrubbed,
+                        std::string& data)
+{
+  const auto base_path = get_shared_file_path(cache_dir, name);
+  if (!Stat::stat(base_path)) {
+    unpack_shared_file(cache_dir, base_path);
+  }
+  DeltaBaseConsumer consumer(data);
+  Reader reader(base_path, cache_dir, trust_scrubbed);
+  reader.m_max_delta_depth = max_depth;
+  if (!reader.read_result(consumer)) {
+    // Most likely removed by cleanup, so treat the result as missing.
+    throw Error("Missing delta base {}", base_path);
+  }
+  if (!consumer.found()) {
+    throw Error("No object file in delta base {}", base_path);
+  }
+
+  // Keep the base alive for as long as it is referenced by used results.
+  Util::update_mtime(base_path);
+  LruIndex::record_use(cache_dir, base_path);
+  return reader.m_object_delta_depth;
 }
 
+struct Writer::EntryToWrite
+{
+  FileType file_type;
+  std::string path;
+  uint64_t size;
+  bool store_raw;
+  optional<Digest> shared_file_digest;
+  // Set if the file is stored as a delta against the object file of the result
+  // named delta_base.
+  optional<std::string> delta;
+  Digest delta_base;
+  uint64_t delta_base_checksum = 0;
+  uint8_t delta_depth = 0;
+};
+
 Writer::Writer(Context& ctx, const std::string& result_path)
-  : m_ctx(ctx), m_result_path(result_path)
+  : m_ctx(ctx),
+    m_result_path(result_path),
+    m_deduplicate(ctx.config.deduplication()),
+    m_delta(ctx.config.max_delta_chain() > 0 && ZstdDelta::supported())
 {
 }
 
@@ -315,6 +916,18 @@ Writer::finalize()
 {
   try {
     do_finalize();
+    m_ctx.invocation.compressed_size += Stat::stat(m_result_path).size();
+    const bool has_object =
+      std::any_of(m_entries_to_write.begin(),
+                  m_entries_to_write.end(),
+                  [](const std::pair<FileType, std::string>& entry) {
+                    return entry.first == FileType::object;
+                  });
+    if (m_delta && has_object && m_ctx.result_name()) {
+      // The next result for the same output file may be stored as a delta
+      // against this one.
+      m_ctx.digest_memo.put(delta_base_key(m_ctx), *m_ctx.result_name());
+    }
     return nullopt;
   } catch (const Error& e) {
     return e.what();
@@ -324,56 +937,92 @@ Writer::finalize()
 void
 Writer::do_finalize()
 {
-  uint64_t payload_size = 0;
-  payload_size += 1; // n_entries
+  Tracing::Span span("result_write", m_result_path);
+
+  std::vector<EntryToWrite> entries;
   for (const auto& pair : m_entries_to_write) {
-    const auto& path = pair.second;
-    auto st = Stat::stat(path, Stat::OnError::throw_error);
+    EntryToWrite entry;
+    entry.file_type = pair.first;
+    entry.path = pair.second;
+    entry.size = Stat::stat(entry.path, Stat::OnError::throw_error).size();
+    m_ctx.invocation.bytes_stored += entry.size;
+    entry.store_raw =
+      should_store_raw_file(m_ctx.config, entry.file_type, entry.size);
+    if (m_delta && !entry.store_raw && entry.file_type == FileType::object
+        && !m_ctx.config.framed_results()) {
+      prepare_delta(entry);
+    }
+    if (m_deduplicate && !entry.store_raw && !entry.delta
+        && entry.size >= k_min_size_for_deduplication) {
+      Hash hash;
+      hash.hash_delimiter("shared_file");
+      if (!hash.hash_file(entry.path)) {
+        throw Error("Failed to hash {}", entry.path);
+      }
+      entry.shared_file_digest = hash.digest();
+    }
+    entries.push_back(std::move(entry));
+  }
+
+  if (m_ctx.config.framed_results()) {
+    write_framed(entries);
+    return;
+  }
 
-    payload_size += 1;         // embedded_file_marker
-    payload_size += 1;         // embedded_file_type
-    payload_size += 8;         // data_len
-    payload_size += st.size(); // data
+  uint64_t payload_size = 0;
+  payload_size += 1; // n_entries
+  for (const auto& entry : entries) {
+    payload_size += 1; // embedded_file_marker
+    payload_size += 1; // embedded_file_type
+    payload_size += 8; // data_len
+    if (entry.shared_file_digest) {
+      payload_size += Digest::size();
+    } else if (entry.delta) {
+      payload_size += Digest::size() + 8 + 1 + 8 + entry.delta->size();
+    } else {
+      payload_size += entry.size;
+    }
   }
 
+  const uint32_t compression_threads =
+    payload_size >= k_min_size_for_compression_threads
+      ? m_ctx.config.compression_threads()
+      : 0;
+
   AtomicFile atomic_result_file(m_result_path, AtomicFile::Mode::binary);
   CacheEntryWriter writer(atomic_result_file.stream(),
                           k_magic,
                           k_version,
                           Compression::type_from_config(m_ctx.config),
-                          Compression::level_from_config(m_ctx.config),
-                          payload_size);
+                          Compression::level_for_entry(m_ctx.config,
+                                                       payload_size),
+                          payload_size,
+                          compression_threads);
 
-  writer.write<uint8_t>(m_entries_to_write.size());
+  writer.write<uint8_t>(entries.size());
 
-  uint32_t entry_number = 0;
-  for (const auto& pair : m_entries_to_write) {
-    const auto file_type = pair.first;
-    const auto& path = pair.second;
-    LOG("Storing result {}", path);
-
-    const bool store_raw = should_store_raw_file(m_ctx.config, file_type);
-    uint64_t file_size = Stat::stat(path, Stat::OnError::throw_error).size();
-
-    LOG("Storing {} file #{} {} ({} bytes) from {}",
-        store_raw ? "raw" : "embedded",
-        entry_number,
-        file_type_to_string(file_type),
-        file_size,
-        path);
-
-    writer.write<uint8_t>(store_raw ? k_raw_file_marker
-                                    : k_embedded_file_marker);
-    writer.write(UnderlyingFileTypeInt(file_type));
-    writer.write(file_size);
-
-    if (store_raw) {
-      write_raw_file_entry(path, entry_number);
-    } else {
-      write_embedded_file_entry(writer, path, file_size);
-    }
+  for (uint32_t entry_number = 0; entry_number < entries.size();
+       ++entry_number) {
+    const auto& entry = entries[entry_number];
+    writer.write(entry_marker(entry));
+    writer.write(UnderlyingFileTypeInt(entry.file_type));
+    writer.write(entry.size);
 
-    ++entry_number;
+    store_entry(entry, entry_number);
+    if (entry.shared_file_digest) {
+      writer.write(entry.shared_file_digest->bytes(), Digest::size());
+    } else if (entry.delta) {
+      writer.write(entry.delta_base.bytes(), Digest::size());
+      writer.write(entry.delta_base_checksum);
+      writer.write(entry.delta_depth);
+      writer.write(static_cast<uint64_t>(entry.delta->size()));
+      writer.write(entry.delta->data(), entry.delta->size());
+    } else if (!entry.store_raw) {
+      write_embedded_file_entry(writer,
+                                entry.path,
+                                entry.size,
+                                m_ctx.background_compressor.get());
+    }
   }
 
   writer.finalize();
@@ -381,31 +1030,235 @@ Writer::do_finalize()
 }
 
 void
-Result::Writer::write_embedded_file_entry(CacheEntryWriter& writer,
-                                          const std::string& path,
-                                          uint64_t file_size)
+Writer::prepare_delta(EntryToWrite& entry) const
+{
+  const auto base_name = m_ctx.digest_memo.get(delta_base_key(m_ctx));
+  if (!base_name || !m_ctx.result_name() || *base_name == *m_ctx.result_name()) {
+    return;
+  }
+
+  const auto& cache_dir = m_ctx.config.cache_dir();
+  std::string base;
+  uint8_t base_depth;
+  try {
+    base_depth =
+      Reader::read_delta_base(cache_dir,
+                              *base_name,
+                              m_ctx.config.max_delta_chain() - 1,
+                              m_ctx.config.trust_scrubbed_entries(),
+                              base);
+  } catch (const Error& e) {
+    LOG("Not storing {} as a delta: {}", entry.path, e.what());
+    return;
+  }
+  if (!ZstdDelta::fits(base.size(), entry.size)) {
+    LOG_RAW("Not storing object file as a delta since it is too large");
+    return;
+  }
+
+  const std::string data = Util::read_file(entry.path, entry.size);
+  const int8_t level = Compression::level_from_config(m_ctx.config);
+  std::string delta = ZstdDelta::compress(base, data, level);
+  const size_t full_size = ZstdDelta::compress({}, data, level).size();
+  if (delta.size() > full_size * (1 - k_min_delta_savings)) {
+    LOG("Not storing {} as a delta since it only saves {} of {} bytes",
+        entry.path,
+        full_size - std::min(full_size, delta.size()),
+        full_size);
+    return;
+  }
+
+  LOG("Storing {} as a delta of {} bytes against {} (depth {})",
+      entry.path,
+      delta.size(),
+      base_name->to_string(),
+      base_depth + 1);
+  Checksum checksum;
+  checksum.update(base.data(), base.size());
+  entry.delta = std::move(delta);
+  entry.delta_base = *base_name;
+  entry.delta_base_checksum = checksum.digest();
+  entry.delta_depth = base_depth + 1;
+}
+
+void
+Writer::write_framed(const std::vector<EntryToWrite>& entries)
+{
+  uint64_t table_size = 0;
+  table_size += 1; // n_entries
+  for (const auto& entry : entries) {
+    table_size += 1; // marker
+    table_size += 1; // file_type
+    table_size += 8; // file_len
+    table_size += 8; // frame_len
+    table_size += entry.shared_file_digest ? Digest::size() : 0;
+  }
+
+  // The frames follow the entry table, whose size is known up front, but the
+  // table can't be written until the frame sizes are known.
+  AtomicFile atomic_result_file(m_result_path, AtomicFile::Mode::binary);
+  FILE* stream = atomic_result_file.stream();
+  const uint64_t table_content_size = 15 + table_size + 8;
+  if (fseek(stream, table_content_size, SEEK_SET) != 0) {
+    throw Error("Failed to seek in {}: {}", m_result_path, strerror(errno));
+  }
+
+  std::vector<uint64_t> frame_sizes;
+  for (uint32_t entry_number = 0; entry_number < entries.size();
+       ++entry_number) {
+    const auto& entry = entries[entry_number];
+    store_entry(entry, entry_number);
+    if (entry.store_raw || entry.shared_file_digest) {
+      frame_sizes.push_back(0);
+      continue;
+    }
+
+    const long frame_start = ftell(stream);
+    CacheEntryWriter frame_writer(
+      stream,
+      k_magic,
+      k_framed_version,
+      Compression::type_from_config(m_ctx.config),
+      Compression::level_for_entry(m_ctx.config, entry.size),
+      entry.size,
+      entry.size >= k_min_size_for_compression_threads
+        ? m_ctx.config.compression_threads()
+        : 0);
+    write_embedded_file_entry(frame_writer,
+                              entry.path,
+                              entry.size,
+                              m_ctx.background_compressor.get());
+    frame_writer.finalize();
+    const long frame_end = ftell(stream);
+    if (frame_start < 0 || frame_end < frame_start) {
+      throw Error("Failed to get position in {}", m_result_path);
+    }
+    frame_sizes.push_back(frame_end - frame_start);
+  }
+
+  if (fseek(stream, 0, SEEK_SET) != 0) {
+    throw Error("Failed to seek in {}: {}", m_result_path, strerror(errno));
+  }
+  CacheEntryWriter table_writer(stream,
+                                k_magic,
+                                k_framed_version,
+                                Compression::Type::none,
+                                0,
+                                table_size);
+  table_writer.write<uint8_t>(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    table_writer.write(entry_marker(entry));
+    table_writer.write(UnderlyingFileTypeInt(entry.file_type));
+    table_writer.write(entry.size);
+    table_writer.write(frame_sizes[i]);
+    if (entry.shared_file_digest) {
+      table_writer.write(entry.shared_file_digest->bytes(), Digest::size());
+    }
+  }
+  table_writer.finalize();
+  atomic_result_file.commit();
+}
+
+uint8_t
+Writer::entry_marker(const EntryToWrite& entry)
+{
+  if (entry.store_raw) {
+    return k_raw_file_marker;
+  } else if (entry.shared_file_digest) {
+    return k_shared_file_marker;
+  } else if (entry.delta) {
+    return k_delta_file_marker;
+  } else {
+    return k_embedded_file_marker;
+  }
+}
+
+void
+Writer::store_entry(const EntryToWrite& entry, uint32_t entry_number)
+{
+  LOG("Storing {} file #{} {} ({} bytes) from {}",
+      entry.store_raw            ? "raw"
+      : entry.shared_file_digest ? "shared"
+      : entry.delta              ? "delta"
+                                 : "embedded",
+      entry_number,
+      file_type_to_string(entry.file_type),
+      entry.size,
+      entry.path);
+
+  if (entry.store_raw) {
+    write_raw_file_entry(entry.path, entry_number);
+    return;
+  }
+
+  remove_stale_raw_file(entry_number);
+  if (entry.shared_file_digest) {
+    write_shared_file(*entry.shared_file_digest, entry.file_type, entry.path);
+  }
+}
+
+void
+Result::Writer::write_embedded_file_entry(
+  CacheEntryWriter& writer,
+  const std::string& path,
+  uint64_t file_size,
+  const BackgroundCompressor* background_compressor)
 {
   Fd file(open(path.c_str(), O_RDONLY | O_BINARY));
   if (!file) {
     throw Error("Failed to open {} for reading", path);
   }
 
+  const auto read_fully = [&](void* buf, size_t count) {
+    size_t total = 0;
+    while (total < count) {
+      ssize_t bytes_read =
+        read(*file, static_cast<uint8_t*>(buf) + total, count - total);
+      if (bytes_read == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw Error("Error reading from {}: {}", path, strerror(errno));
+      }
+      if (bytes_read == 0) {
+        throw Error("Error reading from {}: end of file", path);
+      }
+      total += bytes_read;
+    }
+  };
+
+  if (background_compressor && background_compressor->path() == path) {
+    // Chunks compressed while the compiler wrote the file only need to be
+    // compared, not compressed again.
+    std::string chunk;
+    size_t reused_chunks = 0;
+    for (uint64_t offset = 0; offset < file_size; offset += chunk.size()) {
+      chunk.resize(std::min<uint64_t>(file_size - offset,
+                                      BackgroundCompressor::k_chunk_size));
+      read_fully(&chunk[0], chunk.size());
+      const auto frame = background_compressor->frame(offset, chunk);
+      if (frame) {
+        writer.write_frame(chunk.data(),
+                           chunk.size(),
+                           *frame,
+                           background_compressor->dictionary_id());
+        ++reused_chunks;
+      } else {
+        writer.write(chunk.data(), chunk.size());
+      }
+    }
+    LOG("Reused {} chunks compressed in the background", reused_chunks);
+    return;
+  }
+
   uint64_t remain = file_size;
   while (remain > 0) {
     uint8_t buf[READ_BUFFER_SIZE];
     size_t n = std::min(remain, static_cast<uint64_t>(sizeof(buf)));
-    ssize_t bytes_read = read(*file, buf, n);
-    if (bytes_read == -1) {
-      if (errno == EINTR) {
-        continue;
-      }
-      throw Error("Error reading from {}: {}", path, strerror(errno));
-    }
-    if (bytes_read == 0) {
-      throw Error("Error reading from {}: end of file", path);
-    }
-    writer.write(buf, bytes_read);
-    remain -= bytes_read;
+    read_fully(buf, n);
+    writer.write(buf, n);
+    remain -= n;
   }
 }
 
@@ -427,6 +1280,69 @@ Result::Writer::write_raw_file_entry(const std::string& path,
     Util::size_change_kibibyte(old_stat, new_stat));
   m_ctx.counter_updates.increment(Statistic::files_in_cache,
                                   (new_stat ? 1 : 0) - (old_stat ? 1 : 0));
+  if (new_stat) {
+    LruIndex::record_store(
+      m_ctx.config.cache_dir(),
+      raw_file,
+      new_stat.size_on_disk(),
+      m_ctx.compiler_duration_ms,
+      Statistics::namespace_tag(m_ctx.config.namespace_()));
+  }
+}
+
+void
+Result::Writer::remove_stale_raw_file(uint32_t entry_number)
+{
+  // A previous result with the same name may have stored this entry as a raw
+  // file, which would otherwise linger in the cache until evicted.
+  const auto raw_file = get_raw_file_path(m_result_path, entry_number);
+  const auto old_stat = Stat::stat(raw_file);
+  if (!old_stat || !Util::unlink_safe(raw_file)) {
+    return;
+  }
+
+  // Subtracted from the stats file of the result together with the other
+  // statistics updates of the invocation.
+  m_ctx.counter_decrements.increment(
+    Statistic::cache_size_kibibyte,
+    -Util::size_change_kibibyte(old_stat, Stat()));
+  m_ctx.counter_decrements.increment(Statistic::files_in_cache, 1);
+}
+
+void
+Result::Writer::write_shared_file(const Digest& digest,
+                                  FileType file_type,
+                                  const std::string& path)
+{
+  const auto& cache_dir = m_ctx.config.cache_dir();
+  const auto shared_path = get_shared_file_path(cache_dir, digest);
+  if (Stat::stat(shared_path)) {
+    LOG("Reusing shared file {}", shared_path);
+    Util::update_mtime(shared_path);
+    LruIndex::record_use(cache_dir, shared_path);
+    return;
+  }
+
+  LOG("Storing shared file {}", shared_path);
+  Util::ensure_dir_exists(Util::dir_name(shared_path));
+  Writer shared_file_writer(m_ctx, shared_path);
+  shared_file_writer.m_deduplicate = false;
+  shared_file_writer.m_delta = false;
+  shared_file_writer.write(file_type, path);
+  shared_file_writer.do_finalize();
+
+  const auto new_stat = Stat::stat(shared_path, Stat::OnError::log);
+  m_ctx.counter_updates.increment(Statistic::cache_size_kibibyte,
+                                  Util::size_change_kibibyte(Stat(), new_stat));
+  m_ctx.counter_updates.increment(Statistic::files_in_cache, new_stat ? 1 : 0);
+  if (new_stat) {
+    LruIndex::record_store(
+      cache_dir,
+      shared_path,
+      new_stat.size_on_disk(),
+      m_ctx.compiler_duration_ms,
+      Statistics::namespace_tag(m_ctx.config.namespace_()));
+  }
 }
 
 } // namespace Result
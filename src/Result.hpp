@@ -21,20 +21,24 @@
 #include "system.hpp"
 
 #include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
 
 #include <map>
 #include <string>
 #include <vector>
 
+class BackgroundCompressor;
 class CacheEntryReader;
 class CacheEntryWriter;
 class Context;
+class Digest;
 
 namespace Result {
 
 extern const std::string k_file_suffix;
 extern const uint8_t k_magic[4];
 extern const uint8_t k_version;
+extern const uint8_t k_framed_version;
 
 extern const char* const k_unknown_file_type;
 
@@ -72,10 +76,48 @@ enum class FileType : UnderlyingFileTypeInt {
   // form, i.e. full output file path but with a .gcno extension and with
   // slashes replaced with hashes.
   coverage_mangled = 7,
+
+  // Exit status of a failed compilation and the time it was stored, as the
+  // text "<status> <seconds since epoch>". Only present in results of failed
+  // compilations, where it is the first entry.
+  exit_status = 8,
+
+  // Binary module interface file generated by Clang's -fmodule-output.
+  module_interface = 9,
+
+  // Text sent to standard output, which MSVC uses for diagnostics.
+  stdout_output = 10,
+
+  // Wall time in milliseconds that the compiler took to produce the result, as
+  // text. Counted as saved time when the result is used.
+  compile_time = 11,
+
+  // Content digest of each file entry, as lines of the text
+  // "<file type> <digest>". Written if the keep_identical_outputs option is
+  // enabled, in which case it is the first entry.
+  output_digests = 12,
+
+  // Output file of a command run with --run. A result holds one such entry
+  // per declared output file, in the order they were declared.
+  command_output = 13,
+
+  // Digest of the options that only affect diagnostics, as text, if they were
+  // left out of the result name (see the ignore_warning_options option). The
+  // stderr_output and stdout_output entries are only valid for these options
+  // and come after this entry.
+  warning_options = 14,
 };
 
+// A result holds at most one entry of each file type, except command_output.
+const uint8_t k_max_entries = 15;
+
 const char* file_type_to_string(FileType type);
 
+// Get the path of the raw file storing entry `entry_number` of the result at
+// `result_path`.
+std::string get_raw_file_path(nonstd::string_view result_path,
+                              uint32_t entry_number);
+
 std::string gcno_file_in_mangled_form(const Context& ctx);
 std::string gcno_file_in_unmangled_form(const Context& ctx);
 
@@ -83,19 +125,45 @@ std::string gcno_file_in_unmangled_form(const Context& ctx);
 class Reader
 {
 public:
-  Reader(const std::string& result_path);
+  // Parameters:
+  // - result_path: Path to the result file.
+  // - cache_dir: Cache directory to look for shared files in (see the
+  //   deduplication option).
+  // - trust_scrubbed: Whether to skip checksum verification of result files
+  //   verified by `ccache --scrub` (see the trust_scrubbed_entries option).
+  Reader(const std::string& result_path,
+         const std::string& cache_dir = {},
+         bool trust_scrubbed = false);
 
   class Consumer
   {
   public:
     virtual ~Consumer() = default;
 
+    // Return false if entries of `file_type` are of no interest. Such entries
+    // may then be skipped without calling any other method for them, which
+    // avoids decompressing them in framed results.
+    virtual bool
+    wants_entry(FileType /*file_type*/) const
+    {
+      return true;
+    }
+
     virtual void on_header(CacheEntryReader& cache_entry_reader) = 0;
     virtual void on_entry_start(uint32_t entry_number,
                                 FileType file_type,
                                 uint64_t file_len,
                                 nonstd::optional<std::string> raw_file) = 0;
     virtual void on_entry_data(const uint8_t* data, size_t size) = 0;
+
+    // Called instead of on_entry_data for an uncompressed embedded file if
+    // possible. Return true if the `size` bytes at `offset` in `fd` were
+    // consumed, otherwise false to get them via on_entry_data instead.
+    virtual bool
+    on_entry_data_direct(int /*fd*/, uint64_t /*offset*/, uint64_t /*size*/)
+    {
+      return false;
+    }
     virtual void on_entry_end() = 0;
   };
 
@@ -103,12 +171,47 @@ public:
   nonstd::optional<std::string> read(Consumer& consumer);
 
 private:
+  friend class Writer;
+
   const std::string m_result_path;
+  const std::string m_cache_dir;
+  const bool m_trust_scrubbed;
+  bool m_skip_checksums = false;
+  // Delta entries may be at most this many deltas away from a full file.
+  uint8_t m_max_delta_depth = UINT8_MAX;
+  // Delta depth of the object file entry read, 0 if not stored as a delta.
+  uint8_t m_object_delta_depth = 0;
 
   bool read_result(Consumer& consumer);
   void read_entry(CacheEntryReader& cache_entry_reader,
                   uint32_t entry_number,
                   Reader::Consumer& consumer);
+  void read_framed_entries(FILE* stream,
+                           CacheEntryReader& table_reader,
+                           uint8_t n_entries,
+                           Reader::Consumer& consumer);
+  void read_raw_file(uint32_t entry_number,
+                     FileType file_type,
+                     uint64_t file_len,
+                     Reader::Consumer& consumer);
+  void read_shared_file(const Digest& digest,
+                        uint32_t entry_number,
+                        FileType file_type,
+                        uint64_t file_len,
+                        Reader::Consumer& consumer);
+  void read_delta_file(CacheEntryReader& cache_entry_reader,
+                       uint32_t entry_number,
+                       FileType file_type,
+                       uint64_t file_len,
+                       Reader::Consumer& consumer);
+
+  // Read the object file of the result named `name` into `data`. Returns the
+  // delta depth of the object file entry, which must be at most `max_depth`.
+  static uint8_t read_delta_base(const std::string& cache_dir,
+                                 const Digest& name,
+                                 uint8_t max_depth,
+                                 bool trust_scrubbed,
+                                 std::string& data);
 };
 
 // This class knows how to write a result cache entry.
@@ -127,12 +230,26 @@ private:
   Context& m_ctx;
   const std::string m_result_path;
   std::vector<std::pair<FileType, std::string>> m_entries_to_write;
+  bool m_deduplicate;
+  bool m_delta;
+
+  struct EntryToWrite;
 
   void do_finalize();
-  static void write_embedded_file_entry(CacheEntryWriter& writer,
-                                        const std::string& path,
-                                        uint64_t file_size);
+  void prepare_delta(EntryToWrite& entry) const;
+  void write_framed(const std::vector<EntryToWrite>& entries);
+  static uint8_t entry_marker(const EntryToWrite& entry);
+  void store_entry(const EntryToWrite& entry, uint32_t entry_number);
+  static void write_embedded_file_entry(
+    CacheEntryWriter& writer,
+    const std::string& path,
+    uint64_t file_size,
+    const BackgroundCompressor* background_compressor = nullptr);
   void write_raw_file_entry(const std::string& path, uint32_t entry_number);
+  void remove_stale_raw_file(uint32_t entry_number);
+  void write_shared_file(const Digest& digest,
+                         FileType file_type,
+                         const std::string& path);
 };
 
 } // namespace Result
@@ -20,15 +20,76 @@
 
 #include "Context.hpp"
 #include "Depfile.hpp"
+#include "Hash.hpp"
 #include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "MtimeJournal.hpp"
 
 using Result::FileType;
 
+namespace {
+
+// Destination files at least this large are preallocated to their final size
+// before being written to avoid fragmentation.
+const uint64_t k_min_size_for_preallocation = 1024 * 1024;
+
+const size_t k_write_buffer_size = 1024 * 1024;
+
+// Entries whose data isn't written to a file.
+bool
+is_buffered(FileType file_type)
+{
+  return file_type == FileType::stderr_output
+         || file_type == FileType::stdout_output
+         || file_type == FileType::exit_status
+         || file_type == FileType::compile_time
+         || file_type == FileType::output_digests
+         || file_type == FileType::warning_options;
+}
+
+// Entries holding diagnostics.
+bool
+is_diagnostics(FileType file_type)
+{
+  return file_type == FileType::stderr_output
+         || file_type == FileType::stdout_output;
+}
+
+} // namespace
+
 ResultRetriever::ResultRetriever(Context& ctx, bool rewrite_dependency_target)
   : m_ctx(ctx), m_rewrite_dependency_target(rewrite_dependency_target)
 {
 }
 
+bool
+ResultRetriever::has_dependency_file() const
+{
+  return m_has_dependency_file;
+}
+
+bool
+ResultRetriever::has_stale_diagnostics() const
+{
+  return m_stale_diagnostics;
+}
+
+bool
+ResultRetriever::wants_entry(FileType file_type) const
+{
+  if (m_stale_diagnostics && is_diagnostics(file_type)) {
+    return false;
+  }
+  if (is_buffered(file_type)) {
+    return true;
+  }
+  if (file_type == FileType::command_output) {
+    return !m_ctx.args_info.command_outputs.empty();
+  }
+  const auto dest_path = get_dest_path(file_type);
+  return !dest_path.empty() && dest_path != "/dev/null";
+}
+
 void
 ResultRetriever::on_header(CacheEntryReader& /*cache_entry_reader*/)
 {
@@ -40,62 +101,65 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
                                 uint64_t file_len,
                                 nonstd::optional<std::string> raw_file)
 {
-  std::string dest_path;
-
   m_dest_file_type = file_type;
+  m_dest_index =
+    file_type == FileType::command_output ? m_command_outputs_seen++ : 0;
+  m_keep_dest = false;
+  m_ctx.invocation.bytes_retrieved += file_len;
+  if (file_type == FileType::dependency) {
+    m_has_dependency_file = true;
+  }
 
-  switch (file_type) {
-  case FileType::object:
-    dest_path = m_ctx.args_info.output_obj;
-    break;
-
-  case FileType::dependency:
-    if (m_ctx.args_info.generating_dependencies) {
-      dest_path = m_ctx.args_info.output_dep;
-      m_dest_data.reserve(file_len);
-    }
-    break;
-
-  case FileType::stderr_output:
-    m_dest_data.reserve(file_len);
+  if (m_stale_diagnostics && is_diagnostics(file_type)) {
+    // Nothing is written for an entry whose destination is kept.
+    LOG("Not replaying {} for other warning options",
+        Result::file_type_to_string(file_type));
+    m_keep_dest = true;
+    m_pass_through = true;
     return;
+  }
 
-  case FileType::coverage_unmangled:
-    if (m_ctx.args_info.generating_coverage) {
-      dest_path = Util::change_extension(m_ctx.args_info.output_obj, ".gcno");
-    }
-    break;
-
-  case FileType::stackusage:
-    if (m_ctx.args_info.generating_stackusage) {
-      dest_path = m_ctx.args_info.output_su;
-    }
-    break;
-
-  case FileType::diagnostic:
-    if (m_ctx.args_info.generating_diagnostics) {
-      dest_path = m_ctx.args_info.output_dia;
-    }
-    break;
+  if (is_buffered(file_type)) {
+    m_pass_through =
+      file_type == FileType::stdout_output
+      || (file_type == FileType::stderr_output
+          && !m_ctx.args_info.strip_diagnostics_colors
+          && !m_ctx.config.absolute_paths_in_stderr());
+    return;
+  }
 
-  case FileType::dwarf_object:
-    if (m_ctx.args_info.seen_split_dwarf
-        && m_ctx.args_info.output_obj != "/dev/null") {
-      dest_path = m_ctx.args_info.output_dwo;
-    }
-    break;
+  m_pass_through =
+    file_type != FileType::dependency || !m_rewrite_dependency_target;
 
-  case FileType::coverage_mangled:
-    if (m_ctx.args_info.generating_coverage) {
-      dest_path = Result::gcno_file_in_mangled_form(m_ctx);
-    }
-    break;
-  }
+  const std::string dest_path = get_dest_path(file_type);
 
   if (dest_path.empty()) {
     LOG_RAW("Not copying");
   } else if (dest_path == "/dev/null") {
     LOG_RAW("Not copying to /dev/null");
+  } else if (dest_path == "-") {
+    // Preprocessed output of a -E invocation without -o.
+    LOG("Retrieving {} file #{} {} ({} bytes) to standard output",
+        raw_file ? "raw" : "embedded",
+        entry_number,
+        Result::file_type_to_string(file_type),
+        file_len);
+    m_dest_fd = Fd(dup(STDOUT_FILENO));
+    if (!m_dest_fd) {
+      throw Error("Failed to duplicate standard output: {}", strerror(errno));
+    }
+    m_dest_path = "<stdout>";
+    if (raw_file) {
+      Fd raw_fd(open(raw_file->c_str(), O_RDONLY | O_BINARY));
+      if (!raw_fd) {
+        throw Error("Failed to open {}: {}", *raw_file, strerror(errno));
+      }
+      Util::copy_fd(*raw_fd, *m_dest_fd);
+      m_dest_fd.close();
+      if (m_ctx.storage.is_primary_path(*raw_file)) {
+        LruIndex::record_use(m_ctx.config.cache_dir(), *raw_file);
+      }
+    }
   } else {
     LOG("Retrieving {} file #{} {} ({} bytes)",
         raw_file ? "raw" : "embedded",
@@ -103,12 +167,28 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
         Result::file_type_to_string(file_type),
         file_len);
 
-    if (raw_file) {
+    if (m_pass_through && dest_is_identical(file_type, file_len, dest_path)) {
+      LOG("Keeping identical {}", dest_path);
+      m_keep_dest = true;
+      if (raw_file && m_ctx.storage.is_primary_path(*raw_file)) {
+        MtimeJournal::record_use(m_ctx.config, *raw_file);
+      }
+    } else if (raw_file && !m_ctx.storage.is_primary_path(*raw_file)) {
+      // Files in a lower cache are never linked since they must not change.
+      LOG("Copying {} to {}", *raw_file, dest_path);
+      Util::copy_file(*raw_file, dest_path, false);
+    } else if (raw_file) {
       Util::clone_hard_link_or_copy_file(m_ctx, *raw_file, dest_path, false);
 
       // Update modification timestamp to save the file from LRU cleanup (and,
-      // if hard-linked, to make the object file newer than the source file).
-      Util::update_mtime(*raw_file);
+      // if hard-linked, to make the object file newer than the source file,
+      // which can't wait).
+      if (m_ctx.config.hard_link()) {
+        Util::update_mtime(*raw_file);
+        LruIndex::record_use(m_ctx.config.cache_dir(), *raw_file);
+      } else {
+        MtimeJournal::record_use(m_ctx.config, *raw_file);
+      }
     } else {
       LOG("Copying to {}", dest_path);
       m_dest_fd = Fd(
@@ -118,6 +198,14 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
           "Failed to open {} for writing: {}", dest_path, strerror(errno));
       }
       m_dest_path = dest_path;
+
+      if (file_type != FileType::dependency
+          && file_len >= k_min_size_for_preallocation) {
+        const int err = Util::fallocate(*m_dest_fd, file_len);
+        if (err) {
+          LOG("Failed to preallocate {}: {}", dest_path, strerror(err));
+        }
+      }
     }
   }
 }
@@ -125,57 +213,288 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
 void
 ResultRetriever::on_entry_data(const uint8_t* data, size_t size)
 {
-  ASSERT((m_dest_file_type == FileType::stderr_output && !m_dest_fd)
-         || (m_dest_file_type != FileType::stderr_output && m_dest_fd));
+  if (m_keep_dest) {
+    return;
+  }
+  ASSERT((is_buffered(m_dest_file_type) && !m_dest_fd)
+         || (!is_buffered(m_dest_file_type) && m_dest_fd));
 
-  if (m_dest_file_type == FileType::stderr_output
-      || (m_dest_file_type == FileType::dependency && !m_dest_path.empty())) {
+  if (m_dest_file_type == FileType::stdout_output) {
+    Util::write_fd(STDOUT_FILENO, data, size);
+  } else if (m_dest_file_type == FileType::stderr_output && m_pass_through) {
+    try {
+      Util::write_fd(STDERR_FILENO, data, size);
+    } catch (Error& e) {
+      throw Error("Failed to write to stderr: {}", e.what());
+    }
+  } else if (!m_pass_through) {
     m_dest_data.append(reinterpret_cast<const char*>(data), size);
-  } else {
+    if (m_dest_file_type == FileType::stderr_output) {
+      write_stderr_lines(false);
+    } else if (m_dest_file_type == FileType::dependency) {
+      write_dependency_target();
+    }
+  } else if (size >= k_write_buffer_size) {
+    flush_write_buffer();
     try {
       Util::write_fd(*m_dest_fd, data, size);
     } catch (Error& e) {
       throw Error("Failed to write to {}: {}", m_dest_path, e.what());
     }
+  } else {
+    if (m_write_buffer.size() + size > k_write_buffer_size) {
+      flush_write_buffer();
+    }
+    if (m_write_buffer.capacity() < k_write_buffer_size) {
+      m_write_buffer.reserve(k_write_buffer_size);
+    }
+    m_write_buffer.insert(m_write_buffer.end(), data, data + size);
+  }
+}
+
+bool
+ResultRetriever::on_entry_data_direct(int fd, uint64_t offset, uint64_t size)
+{
+  if (m_keep_dest) {
+    return true;
+  }
+  // Data that is post-processed must go through on_entry_data.
+  if (!m_dest_fd || is_buffered(m_dest_file_type) || !m_pass_through) {
+    return false;
+  }
+
+  flush_write_buffer();
+  try {
+    return Util::copy_fd_range(fd, offset, *m_dest_fd, size);
+  } catch (Error& e) {
+    throw Error("Failed to write to {}: {}", m_dest_path, e.what());
   }
 }
 
 void
 ResultRetriever::on_entry_end()
 {
-  if (m_dest_file_type == FileType::stderr_output) {
-    Util::send_to_stderr(m_ctx, m_dest_data);
-  } else if (m_dest_file_type == FileType::dependency && !m_dest_path.empty()) {
-    write_dependency_file();
+  if (m_dest_file_type == FileType::stderr_output && !m_pass_through) {
+    write_stderr_lines(true);
+  } else if (m_dest_file_type == FileType::exit_status) {
+    handle_exit_status();
+  } else if (m_dest_file_type == FileType::compile_time) {
+    m_ctx.cached_compiler_duration_ms = Util::parse_unsigned(m_dest_data);
+  } else if (m_dest_file_type == FileType::output_digests) {
+    read_output_digests();
+  } else if (m_dest_file_type == FileType::warning_options) {
+    check_warning_options();
+  } else if (m_dest_file_type == FileType::dependency && !m_pass_through) {
+    // No colon in the data, so there is no target to rewrite.
+    m_pass_through = true;
+    flush_dest_data();
   }
 
   if (m_dest_fd) {
+    flush_write_buffer();
     m_dest_fd.close();
   }
   m_dest_path.clear();
   m_dest_data.clear();
 }
 
+std::string
+ResultRetriever::get_dest_path(FileType file_type) const
+{
+  switch (file_type) {
+  case FileType::object:
+    return m_ctx.args_info.output_obj;
+
+  case FileType::dependency:
+    if (m_ctx.args_info.generating_dependencies) {
+      return m_ctx.args_info.output_dep;
+    }
+    break;
+
+  case FileType::stderr_output:
+  case FileType::stdout_output:
+  case FileType::exit_status:
+  case FileType::compile_time:
+  case FileType::output_digests:
+  case FileType::warning_options:
+    break;
+
+  case FileType::module_interface:
+    return m_ctx.args_info.output_bmi;
+
+  case FileType::coverage_unmangled:
+    if (m_ctx.args_info.generating_coverage) {
+      return Util::change_extension(m_ctx.args_info.output_obj, ".gcno");
+    }
+    break;
+
+  case FileType::stackusage:
+    if (m_ctx.args_info.generating_stackusage) {
+      return m_ctx.args_info.output_su;
+    }
+    break;
+
+  case FileType::diagnostic:
+    if (m_ctx.args_info.generating_diagnostics) {
+      return m_ctx.args_info.output_dia;
+    }
+    break;
+
+  case FileType::dwarf_object:
+    if (m_ctx.args_info.seen_split_dwarf
+        && m_ctx.args_info.output_obj != "/dev/null") {
+      return m_ctx.args_info.output_dwo;
+    }
+    break;
+
+  case FileType::coverage_mangled:
+    if (m_ctx.args_info.generating_coverage) {
+      return Result::gcno_file_in_mangled_form(m_ctx);
+    }
+    break;
+
+  case FileType::command_output:
+    if (m_dest_index < m_ctx.args_info.command_outputs.size()) {
+      return m_ctx.args_info.command_outputs[m_dest_index];
+    }
+    break;
+  }
+
+  return {};
+}
+
+bool
+ResultRetriever::dest_is_identical(FileType file_type,
+                                   uint64_t file_len,
+                                   const std::string& dest_path) const
+{
+  // A hard-linked destination file must be replaced to get a fresh mtime.
+  if (!m_ctx.config.keep_identical_outputs() || m_ctx.config.hard_link()) {
+    return false;
+  }
+  const auto digests = m_output_digests.find(file_type);
+  if (digests == m_output_digests.end()
+      || m_dest_index >= digests->second.size()) {
+    return false;
+  }
+  const auto st = Stat::stat(dest_path);
+  if (!st || !st.is_regular() || st.size() != file_len) {
+    return false;
+  }
+  Hash hash;
+  return hash.hash_file(dest_path)
+         && hash.digest().to_string() == digests->second[m_dest_index];
+}
+
 void
-ResultRetriever::write_dependency_file()
+ResultRetriever::read_output_digests()
 {
-  try {
-    size_t start_pos = 0;
-    if (m_rewrite_dependency_target) {
-      size_t colon_pos = m_dest_data.find(':');
-      if (colon_pos != std::string::npos) {
-        const auto escaped_output_obj =
-          Depfile::escape_filename(m_ctx.args_info.output_obj);
-        Util::write_fd(
-          *m_dest_fd, escaped_output_obj.data(), escaped_output_obj.length());
-        start_pos = colon_pos;
-      }
+  for (const auto& line : Util::split_into_views(m_dest_data, "\n")) {
+    const auto fields = Util::split_into_strings(line, " ");
+    if (fields.size() != 2) {
+      throw Error("Invalid output digests entry: {}", m_dest_data);
+    }
+    const auto type = static_cast<Result::UnderlyingFileTypeInt>(
+      Util::parse_unsigned(fields[0], nonstd::nullopt, UINT8_MAX, "file type"));
+    m_output_digests[FileType(type)].push_back(fields[1]);
+  }
+}
+
+void
+ResultRetriever::check_warning_options()
+{
+  const auto& digest = m_ctx.warning_options_digest;
+  if (!digest || m_dest_data != digest->to_string()) {
+    LOG_RAW("Result has diagnostics for other warning options");
+    m_stale_diagnostics = true;
+  }
+}
+
+void
+ResultRetriever::write_stderr_lines(bool all)
+{
+  // Stripping color codes and rewriting paths are done line by line, so
+  // complete lines are sent as soon as they have been read.
+  size_t end = m_dest_data.size();
+  if (!all) {
+    const size_t newline_pos = m_dest_data.rfind('\n');
+    if (newline_pos == std::string::npos) {
+      return;
     }
+    end = newline_pos + 1;
+  }
+  Util::send_to_stderr(m_ctx, nonstd::string_view(m_dest_data).substr(0, end));
+  m_dest_data.erase(0, end);
+}
 
-    Util::write_fd(*m_dest_fd,
-                   m_dest_data.data() + start_pos,
-                   m_dest_data.length() - start_pos);
+void
+ResultRetriever::write_dependency_target()
+{
+  // The target ends at the first colon, after which the data is written as
+  // is.
+  const size_t colon_pos = m_dest_data.find(':');
+  if (colon_pos == std::string::npos) {
+    return;
+  }
+  const auto escaped_output_obj =
+    Depfile::escape_filename(m_ctx.args_info.output_obj);
+  m_write_buffer.insert(
+    m_write_buffer.end(), escaped_output_obj.begin(), escaped_output_obj.end());
+  m_dest_data.erase(0, colon_pos);
+  m_pass_through = true;
+  flush_dest_data();
+}
+
+void
+ResultRetriever::flush_dest_data()
+{
+  m_write_buffer.insert(
+    m_write_buffer.end(), m_dest_data.begin(), m_dest_data.end());
+  m_dest_data.clear();
+  flush_write_buffer();
+}
+
+void
+ResultRetriever::handle_exit_status()
+{
+  const auto fields = Util::split_into_strings(m_dest_data, " ");
+  if (fields.size() != 2) {
+    throw Error("Invalid exit status entry: {}", m_dest_data);
+  }
+  const int status =
+    static_cast<int>(Util::parse_signed(fields[0], INT_MIN, INT_MAX));
+  const int64_t stored = Util::parse_signed(fields[1]);
+
+  // Refusing the result makes the caller treat it as a cache miss, so the
+  // compilation is run again and its outcome replaces the stored failure.
+  if (!m_ctx.config.cache_failures()) {
+    throw Error("Not using cached failure since cache_failures is false");
+  }
+  const uint64_t max_age = m_ctx.config.max_failure_age();
+  if (max_age > 0 && time(nullptr) - stored > static_cast<int64_t>(max_age)) {
+    throw Error("Cached failure is older than max_failure_age");
+  }
+
+  LOG("Retrieved failed compilation with exit status {}", status);
+  m_ctx.cached_exit_status = status;
+
+  // Like the compiler, don't leave an object file from an earlier successful
+  // compilation behind.
+  if (m_ctx.args_info.output_obj != "/dev/null") {
+    Util::unlink_safe(m_ctx.args_info.output_obj);
+  }
+}
+
+void
+ResultRetriever::flush_write_buffer()
+{
+  if (m_write_buffer.empty()) {
+    return;
+  }
+  try {
+    Util::write_fd(*m_dest_fd, m_write_buffer.data(), m_write_buffer.size());
   } catch (Error& e) {
     throw Error("Failed to write to {}: {}", m_dest_path, e.what());
   }
+  m_write_buffer.clear();
 }
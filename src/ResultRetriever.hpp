@@ -23,6 +23,8 @@
 #include "Fd.hpp"
 #include "Result.hpp"
 
+#include <map>
+
 class Context;
 
 // This class retrieves a result entry to the local file system.
@@ -31,12 +33,22 @@ class ResultRetriever : public Result::Reader::Consumer
 public:
   ResultRetriever(Context& ctx, bool rewrite_dependency_target);
 
+  // Return whether the result had a dependency file entry.
+  bool has_dependency_file() const;
+
+  // Return whether the diagnostics in the result were produced with other
+  // warning options than the current ones, in which case they were not
+  // written to stdout and stderr.
+  bool has_stale_diagnostics() const;
+
+  bool wants_entry(Result::FileType file_type) const override;
   void on_header(CacheEntryReader& cache_entry_reader) override;
   void on_entry_start(uint32_t entry_number,
                       Result::FileType file_type,
                       uint64_t file_len,
                       nonstd::optional<std::string> raw_file) override;
   void on_entry_data(const uint8_t* data, size_t size) override;
+  bool on_entry_data_direct(int fd, uint64_t offset, uint64_t size) override;
   void on_entry_end() override;
 
 private:
@@ -45,15 +57,50 @@ private:
   Fd m_dest_fd;
   std::string m_dest_path;
 
-  // Collects the full data of stderr output (since we want to potentially strip
-  // color codes which could span chunk boundaries) or dependency data (since we
-  // potentially want to rewrite the dependency target which in theory can span
-  // a chunk boundary).
+  // Collects the exit status, the last incomplete line of stderr output that
+  // is post-processed line by line, or the start of dependency data until the
+  // end of the dependency target that is to be rewritten.
   std::string m_dest_data;
 
+  // Whether the data of the current entry is passed on as is.
+  bool m_pass_through = false;
+
+  // Whether the destination file of the current entry is left as it is since
+  // it's identical to the entry.
+  bool m_keep_dest = false;
+
+  // Digests from the output_digests entry, formatted as strings, per file type
+  // in entry order.
+  std::map<Result::FileType, std::vector<std::string>> m_output_digests;
+
+  // Number of command_output entries started so far.
+  size_t m_command_outputs_seen = 0;
+
+  // Index of the current entry among the entries of its file type.
+  size_t m_dest_index = 0;
+
+  // Buffers data of embedded entries so that the destination file is written
+  // in large chunks instead of one write per decompressed chunk.
+  std::vector<uint8_t> m_write_buffer;
+
   // Whether to rewrite the first part of the dependency file data to the
   // destination object file.
   const bool m_rewrite_dependency_target;
 
-  void write_dependency_file();
+  bool m_has_dependency_file = false;
+
+  // Whether the warning_options entry didn't match the current options.
+  bool m_stale_diagnostics = false;
+
+  std::string get_dest_path(Result::FileType file_type) const;
+  bool dest_is_identical(Result::FileType file_type,
+                         uint64_t file_len,
+                         const std::string& dest_path) const;
+  void read_output_digests();
+  void check_warning_options();
+  void write_stderr_lines(bool all);
+  void write_dependency_target();
+  void flush_dest_data();
+  void handle_exit_status();
+  void flush_write_buffer();
 };
@@ -0,0 +1,106 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SecondaryStorage.hpp"
+
+#include "Config.hpp"
+#include "FileStorage.hpp"
+#include "Logging.hpp"
+#include "StdMakeUnique.hpp"
+
+#include "Util.hpp"
+
+#ifndef _WIN32
+#  include "HttpStorage.hpp"
+#  include "PeerServer.hpp"
+#  include "RedisStorage.hpp"
+#  include "TcpConnection.hpp"
+#endif
+
+std::unique_ptr<SecondaryStorage>
+SecondaryStorage::create(const Config& config)
+{
+  const auto& url = config.secondary_storage();
+  if (url.empty()) {
+    return nullptr;
+  }
+
+  const auto file_dir = FileStorage::parse_url(url);
+  if (file_dir) {
+    return std::make_unique<FileStorage>(*file_dir);
+  }
+#ifndef _WIN32
+  const auto http_url = HttpStorage::parse_url(url);
+  if (http_url) {
+    return std::make_unique<HttpStorage>(*http_url,
+                                         config.secondary_storage_timeout());
+  }
+  const auto redis_url = RedisStorage::parse_url(url);
+  if (redis_url) {
+    return std::make_unique<RedisStorage>(*redis_url,
+                                          config.secondary_storage_timeout());
+  }
+#endif
+
+  LOG("Unsupported secondary storage URL: {}", url);
+  return nullptr;
+}
+
+std::vector<std::unique_ptr<SecondaryStorage>>
+SecondaryStorage::create_peers(const Config& config)
+{
+  std::vector<std::unique_ptr<SecondaryStorage>> peers;
+  for (const auto& peer : Util::split_into_strings(config.peers(), " ")) {
+#ifndef _WIN32
+    const auto host_and_port =
+      TcpConnection::parse_host_and_port(peer, PeerServer::k_default_port);
+    if (host_and_port) {
+      HttpStorage::Url url;
+      url.host = host_and_port->first;
+      url.port = host_and_port->second;
+      peers.push_back(
+        std::make_unique<HttpStorage>(url, config.peer_timeout()));
+      continue;
+    }
+#endif
+    LOG("Unsupported peer: {}", peer);
+  }
+  return peers;
+}
+
+std::vector<nonstd::optional<std::string>>
+SecondaryStorage::get_many(const std::vector<Key>& keys)
+{
+  std::vector<nonstd::optional<std::string>> result;
+  for (const auto& key : keys) {
+    result.push_back(get(key.name, key.suffix));
+  }
+  return result;
+}
+
+size_t
+SecondaryStorage::put_many(const std::vector<Entry>& entries)
+{
+  size_t stored = 0;
+  for (const auto& entry : entries) {
+    if (put(entry.key.name, entry.key.suffix, entry.data)) {
+      ++stored;
+    }
+  }
+  return stored;
+}
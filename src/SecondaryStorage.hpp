@@ -0,0 +1,93 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class Config;
+
+// A remote cache tier that is consulted when a result or manifest is not found
+// in the local cache. Entries are identified by their name (result or manifest
+// digest) and file suffix, just like files in the local cache. Failures (e.g.
+// timeouts) are logged and reported as misses so that a broken secondary
+// storage never fails a compilation.
+class SecondaryStorage
+{
+public:
+  struct Key
+  {
+    Digest name;
+    std::string suffix;
+  };
+
+  struct Entry
+  {
+    Key key;
+    std::string data;
+  };
+
+  virtual ~SecondaryStorage() = default;
+
+  // Get the data stored for `name` and `suffix`, or nullopt if there is no
+  // such entry or if the request failed.
+  virtual nonstd::optional<std::string> get(const Digest& name,
+                                            nonstd::string_view suffix) = 0;
+
+  // Store `data` for `name` and `suffix`. Returns whether the entry was
+  // stored.
+  virtual bool put(const Digest& name,
+                   nonstd::string_view suffix,
+                   const std::string& data) = 0;
+
+  // Remove the entry for `name` and `suffix`. Returns whether the entry was
+  // removed.
+  virtual bool remove(const Digest& name, nonstd::string_view suffix) = 0;
+
+  // Get several entries, with the same semantics as `get` for each key. The
+  // default implementation calls `get` for one key at a time; backends that
+  // can pipeline requests should override it.
+  virtual std::vector<nonstd::optional<std::string>>
+  get_many(const std::vector<Key>& keys);
+
+  // Store several entries, with the same semantics as `put` for each entry.
+  // Returns the number of stored entries. The default implementation calls
+  // `put` for one entry at a time; backends that can pipeline requests should
+  // override it.
+  virtual size_t put_many(const std::vector<Entry>& entries);
+
+  // Create a secondary storage backend for the configured
+  // `secondary_storage` URL. Returns nullptr if no secondary storage is
+  // configured or if the URL is not supported.
+  static std::unique_ptr<SecondaryStorage> create(const Config& config);
+
+  // Create read-only connections to the caches served by the workstations in
+  // the configured `peers` list, see `ccache --serve-peers`. Invalid peers are
+  // logged and skipped.
+  static std::vector<std::unique_ptr<SecondaryStorage>>
+  create_peers(const Config& config);
+};
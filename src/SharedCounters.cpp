@@ -0,0 +1,285 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SharedCounters.hpp"
+
+#include "Finalizer.hpp"
+#include "Logging.hpp"
+#include "Statistics.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <atomic>
+
+namespace {
+
+const uint32_t k_version = 1;
+const uint32_t k_summary_version = 1;
+
+// Room for statistics added in the future and for the phase durations. Files
+// created with fewer counters are grown when opened.
+const size_t k_max_counters = 1024;
+
+// Minimum time in seconds between moving the counters to the stats file.
+const int64_t k_flush_interval = 10;
+
+// Changes of the statistics summary are assumed to be done or abandoned (e.g.
+// by a killed process) after this many seconds. This bounds how long a missing
+// StatsSummary::end_change call or a newly created summary prevents trusting a
+// recount.
+const int64_t k_max_summary_change_duration = 60;
+
+} // namespace
+
+const char SharedCounters::k_file_name[] = "stats.shared";
+const char StatsSummary::k_file_name[] = "stats.summary";
+
+struct SharedCounters::Region
+{
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  std::atomic<int64_t> last_flush;
+  std::atomic<uint64_t> counters[k_max_counters];
+};
+
+struct StatsSummary::Region
+{
+  // See SharedRegion.
+  std::atomic<uint32_t> version;
+  std::atomic<int64_t> last_updated;
+  std::atomic<int64_t> last_recount;
+  std::atomic<uint64_t> counters[k_max_counters];
+  // Added after version 1 was released. Files without them are grown with
+  // zeros when opened with create set.
+  std::atomic<uint64_t> changes_begun;
+  std::atomic<uint64_t> changes_ended;
+  std::atomic<int64_t> last_change_begun;
+};
+
+static_assert(Statistics::k_phase_counters_end <= k_max_counters,
+              "Too many statistics for the shared counters region");
+
+SharedCounters::SharedCounters(const std::string& subdir, bool create)
+  : m_stats_file(subdir + "/stats")
+{
+  if (m_shared.map(FMT("{}/{}", subdir, k_file_name),
+                   sizeof(Region),
+                   k_version,
+                   create ? SharedRegion::Create::file_and_dir
+                          : SharedRegion::Create::no)) {
+    m_region = static_cast<Region*>(m_shared.data());
+  }
+}
+
+void
+SharedCounters::increment(const Counters& counters)
+{
+  // The summary includes the counters when they are added here, not when they
+  // are moved to the stats file.
+  StatsSummary summary(
+    std::string(Util::dir_name(Util::dir_name(m_stats_file))), false);
+  if (summary) {
+    summary.begin_change();
+  }
+  for (size_t i = 0; i < counters.size() && i < k_max_counters; ++i) {
+    const uint64_t value = counters.get_raw(i);
+    if (value != 0) {
+      m_region->counters[i] += value;
+    }
+  }
+  if (summary) {
+    summary.add(counters);
+    summary.end_change();
+  }
+
+  // Only one process gets to flush when the interval has passed.
+  const int64_t now = time(nullptr);
+  int64_t last_flush = m_region->last_flush;
+  if (now - last_flush >= k_flush_interval
+      && m_region->last_flush.compare_exchange_strong(last_flush, now)) {
+    flush();
+  }
+}
+
+Counters
+SharedCounters::get() const
+{
+  Counters counters;
+  for (size_t i = 0; i < k_max_counters; ++i) {
+    const uint64_t value = m_region->counters[i];
+    if (value != 0) {
+      counters.set_raw(i, value);
+    }
+  }
+  return counters;
+}
+
+bool
+SharedCounters::flush()
+{
+  // Moving the counters doesn't change the summary, but a recount could see
+  // them in both places or in neither.
+  StatsSummary summary(
+    std::string(Util::dir_name(Util::dir_name(m_stats_file))), false);
+  if (summary) {
+    summary.begin_change();
+  }
+  Finalizer end_change([&] {
+    if (summary) {
+      summary.end_change();
+    }
+  });
+
+  const auto result = Statistics::update(m_stats_file, [this](Counters& cs) {
+    // Increments made after a counter has been taken stay in the region until
+    // the next flush.
+    Counters taken;
+    for (size_t i = 0; i < k_max_counters; ++i) {
+      const uint64_t value = m_region->counters[i].exchange(0);
+      if (value != 0) {
+        taken.set_raw(i, value);
+      }
+    }
+    cs.increment(taken);
+  });
+  return result.has_value();
+}
+
+StatsSummary::StatsSummary(const std::string& cache_dir, bool create)
+{
+  if (!m_shared.map(FMT("{}/{}", cache_dir, k_file_name),
+                    sizeof(Region),
+                    k_summary_version,
+                    create ? SharedRegion::Create::file
+                           : SharedRegion::Create::no)) {
+    return;
+  }
+  m_region = static_cast<Region*>(m_shared.data());
+  if (m_shared.is_new() || m_region->last_change_begun == 0) {
+    // Updaters that found no usable file didn't announce their changes, so
+    // count them as a change that is never ended.
+    begin_change();
+  }
+}
+
+void
+StatsSummary::add(const Counters& counters)
+{
+  add_change(Counters(), counters);
+}
+
+void
+StatsSummary::add_change(const Counters& before, const Counters& after)
+{
+  const auto zeroed_index =
+    static_cast<size_t>(Statistic::stats_zeroed_timestamp);
+  const size_t size =
+    std::min(std::max(before.size(), after.size()), k_max_counters);
+  for (size_t i = 0; i < size; ++i) {
+    const uint64_t old_value = i < before.size() ? before.get_raw(i) : 0;
+    const uint64_t new_value = i < after.size() ? after.get_raw(i) : 0;
+    if (i == zeroed_index) {
+      // The summary has the latest timestamp of all stats files.
+      uint64_t value = m_region->counters[i];
+      while (new_value > value
+             && !m_region->counters[i].compare_exchange_weak(value,
+                                                             new_value)) {
+      }
+    } else if (new_value != old_value) {
+      // Wraps around correctly for decrements.
+      m_region->counters[i] += new_value - old_value;
+    }
+  }
+  m_region->last_updated = time(nullptr);
+}
+
+void
+StatsSummary::begin_change()
+{
+  // Set before changes_begun so that begin_recount sees the time of every
+  // change included in the count it reads.
+  m_region->last_change_begun = time(nullptr);
+  ++m_region->changes_begun;
+}
+
+void
+StatsSummary::end_change()
+{
+  ++m_region->changes_ended;
+}
+
+nonstd::optional<uint64_t>
+StatsSummary::begin_recount(time_t now) const
+{
+  // Reading changes_ended first means that a change in progress at that point
+  // makes changes_begun differ.
+  const uint64_t ended = m_region->changes_ended;
+  const uint64_t begun = m_region->changes_begun;
+  if (begun != ended
+      && now - m_region->last_change_begun < k_max_summary_change_duration) {
+    return nonstd::nullopt;
+  }
+  return begun;
+}
+
+void
+StatsSummary::reset(const Counters& counters,
+                    time_t last_updated,
+                    nonstd::optional<uint64_t> recount)
+{
+  for (size_t i = 0; i < k_max_counters; ++i) {
+    m_region->counters[i] = i < counters.size() ? counters.get_raw(i) : 0;
+  }
+  m_region->last_updated = last_updated;
+  if (recount && *recount == m_region->changes_begun) {
+    m_region->last_recount = time(nullptr);
+    // Changes that haven't ended by now were abandoned, see begin_recount.
+    uint64_t ended = m_region->changes_ended;
+    while (ended < *recount
+           && !m_region->changes_ended.compare_exchange_weak(ended, *recount)) {
+    }
+  } else {
+    LOG_RAW("Statistics changed while recounting the summary");
+    m_region->last_recount = 0;
+  }
+}
+
+Counters
+StatsSummary::get() const
+{
+  Counters counters;
+  for (size_t i = 0; i < k_max_counters; ++i) {
+    const uint64_t value = m_region->counters[i];
+    if (value != 0) {
+      counters.set_raw(i, value);
+    }
+  }
+  return counters;
+}
+
+time_t
+StatsSummary::last_updated() const
+{
+  return m_region->last_recount != 0 ? m_region->last_updated.load() : 0;
+}
+
+time_t
+StatsSummary::last_recount() const
+{
+  return m_region->last_recount;
+}
@@ -0,0 +1,145 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Counters.hpp"
+#include "NonCopyable.hpp"
+#include "SharedRegion.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+// Statistics counters of a level 1 cache subdirectory in a memory-mapped file,
+// so that concurrent ccache invocations can update them with atomic increments
+// instead of locking, reading and rewriting a stats file.
+//
+// The file is named "stats.shared" and lives in the subdirectory. Accumulated
+// values are periodically moved to the subdirectory's stats file, which remains
+// the authoritative storage, so readers must add get() to what they read from
+// the stats files. Counters that need to be read back consistently, like the
+// cache size, should not be kept here.
+class SharedCounters : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  // Map the counters of `subdir`. The file is created if `create` is true.
+  SharedCounters(const std::string& subdir, bool create);
+
+  // Return whether the counters could be mapped. Mapping fails e.g. if the
+  // file doesn't exist, is on NFS or if mmap is not available.
+  explicit operator bool() const;
+
+  // Add `counters`, and move the accumulated counters to the stats file if
+  // that hasn't been done for a while.
+  void increment(const Counters& counters);
+
+  // Get the counters that have not been moved to the stats file yet.
+  Counters get() const;
+
+  // Move the accumulated counters to the stats file. Returns false if the
+  // stats file could not be updated, in which case the counters are kept.
+  bool flush();
+
+private:
+  struct Region;
+
+  const std::string m_stats_file;
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+};
+
+inline SharedCounters::operator bool() const
+{
+  return m_region != nullptr;
+}
+
+// The sum of all statistics counters of a cache directory in a memory-mapped
+// file, so that showing statistics doesn't require reading every stats file.
+//
+// The file is named "stats.summary" and lives in the cache directory. Updaters
+// of the stats files and shared counters add their changes with atomic
+// additions, bracketed by begin_change and end_change so that a recount that
+// overlaps a change is not trusted. Updaters only use an existing summary, so a
+// new summary is not trusted until changes that started before it existed are
+// done. Since changes made by older ccache versions or by editing or removing
+// stats files are missed, the summary is only trusted for a limited time after
+// having been recounted from the stats files.
+class StatsSummary : NonCopyable
+{
+public:
+  static const char k_file_name[];
+
+  // Map the summary of `cache_dir`. The file is created if `create` is true
+  // and the cache directory exists.
+  StatsSummary(const std::string& cache_dir, bool create);
+
+  // Return whether the summary could be mapped.
+  explicit operator bool() const;
+
+  // Add `counters`, e.g. increments of shared counters.
+  void add(const Counters& counters);
+
+  // Add the change of a stats file from `before` to `after`.
+  void add_change(const Counters& before, const Counters& after);
+
+  // Mark the start and end of a change of the stats files or shared counters,
+  // which is added with add or add_change in between. Must be called before
+  // the stats file or shared counters are modified and after the change has
+  // been added, respectively. A change that is never ended, e.g. since the
+  // process was killed, is considered abandoned after a while.
+  void begin_change();
+  void end_change();
+
+  // Start recounting the summary at time `now`. Returns a token to pass to
+  // reset, or nullopt if a change may be in progress.
+  nonstd::optional<uint64_t> begin_recount(time_t now) const;
+
+  // Replace the summary with `counters` counted from the stats files, which
+  // were last updated at `last_updated`. The summary is only trusted if no
+  // change has begun since `begin_recount` returned `recount`, since the
+  // counting may otherwise have missed the change or included it twice.
+  void reset(const Counters& counters,
+             time_t last_updated,
+             nonstd::optional<uint64_t> recount);
+
+  Counters get() const;
+
+  // Time of the last change, or 0 if the summary has never been counted.
+  time_t last_updated() const;
+
+  // Time of the last reset, or 0 if the summary has never been counted.
+  time_t last_recount() const;
+
+private:
+  struct Region;
+
+  SharedRegion m_shared;
+  Region* m_region = nullptr;
+};
+
+inline StatsSummary::operator bool() const
+{
+  return m_region != nullptr;
+}
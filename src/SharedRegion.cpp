@@ -0,0 +1,108 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SharedRegion.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "assertions.hpp"
+
+SharedRegion::~SharedRegion()
+{
+  unmap();
+}
+
+bool
+SharedRegion::map(const std::string& path,
+                  size_t size,
+                  uint32_t version,
+                  Create create)
+{
+#ifdef HAVE_SYS_MMAN_H
+  ASSERT(!m_data);
+
+  const int flags = create == Create::no ? O_RDWR : O_RDWR | O_CREAT;
+  Fd fd(open(path.c_str(), flags | O_CLOEXEC, 0666));
+  if (!fd && errno == ENOENT && create == Create::file_and_dir
+      && Util::create_dir(Util::dir_name(path))) {
+    fd = Fd(open(path.c_str(), flags | O_CLOEXEC, 0666));
+  }
+  if (!fd) {
+    if (errno != ENOENT) {
+      LOG("Failed to open {}: {}", path, strerror(errno));
+    }
+    return false;
+  }
+  bool is_nfs;
+  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
+    LOG("Not using {} since it is located on NFS", path);
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(*fd, &st) != 0) {
+    LOG("Failed to stat {}: {}", path, strerror(errno));
+    return false;
+  }
+  // Growing a file that another process has already grown is harmless since
+  // truncating to the same size doesn't change the content.
+  if (static_cast<size_t>(st.st_size) < size) {
+    if (create == Create::no || ftruncate(*fd, size) != 0) {
+      return false;
+    }
+  }
+
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap {}: {}", path, strerror(errno));
+    return false;
+  }
+  auto& stored_version = *static_cast<std::atomic<uint32_t>*>(data);
+  uint32_t expected = 0;
+  stored_version.compare_exchange_strong(expected, version);
+  if (expected != 0 && expected != version) {
+    LOG("Not using {} since it has version {}", path, expected);
+    munmap(data, size);
+    return false;
+  }
+
+  m_fd = std::move(fd);
+  m_data = data;
+  m_size = size;
+  m_is_new = expected == 0;
+  return true;
+#else
+  (void)path;
+  (void)size;
+  (void)version;
+  (void)create;
+  return false;
+#endif
+}
+
+void
+SharedRegion::unmap()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (m_data) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+    m_fd.close();
+  }
+#endif
+}
@@ -0,0 +1,91 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Fd.hpp"
+#include "NonCopyable.hpp"
+
+#include <atomic>
+#include <string>
+
+// A file that concurrent ccache processes map into memory and update with
+// atomic operations, e.g. shared counters or filters.
+//
+// The region must start with a std::atomic<uint32_t> holding the version of its
+// layout, which is 0 in a newly created file and set to the expected version
+// when mapped. Files on NFS are not used since the processes sharing them may
+// run on different hosts.
+class SharedRegion : NonCopyable
+{
+public:
+  enum class Create {
+    no,           // Only map an existing file.
+    file,         // Create the file if its directory exists.
+    file_and_dir, // Create the file and its directory if needed.
+  };
+
+  SharedRegion() = default;
+  ~SharedRegion();
+
+  // Map the first `size` bytes of the file at `path`, creating or growing the
+  // file according to `create`. Returns false if the file doesn't exist, is
+  // too small and may not be grown, has another version than `version`, or
+  // can't be mapped.
+  bool map(const std::string& path,
+           size_t size,
+           uint32_t version,
+           Create create);
+
+  // Unmap the region if mapped.
+  void unmap();
+
+  void* data() const;
+
+  // Return whether the version was 0 when mapped, i.e. the file was new.
+  bool is_new() const;
+
+  // Return the file descriptor of the mapped file, e.g. for flock.
+  int fd() const;
+
+private:
+  Fd m_fd;
+  void* m_data = nullptr;
+  size_t m_size = 0;
+  bool m_is_new = false;
+};
+
+inline void*
+SharedRegion::data() const
+{
+  return m_data;
+}
+
+inline bool
+SharedRegion::is_new() const
+{
+  return m_is_new;
+}
+
+inline int
+SharedRegion::fd() const
+{
+  return *m_fd;
+}
@@ -24,7 +24,34 @@ Stat::Stat(StatFunction stat_function,
            const std::string& path,
            Stat::OnError on_error)
 {
-  int result = stat_function(path.c_str(), &m_stat);
+  handle_result(stat_function(path.c_str(), &m_stat), path, on_error);
+}
+
+#ifndef _WIN32
+Stat
+Stat::stat_at(int dir_fd, const std::string& name, OnError on_error)
+{
+  Stat st;
+  st.handle_result(
+    fstatat(dir_fd, name.c_str(), &st.m_stat, 0), name, on_error);
+  return st;
+}
+
+Stat
+Stat::lstat_at(int dir_fd, const std::string& name, OnError on_error)
+{
+  Stat st;
+  st.handle_result(
+    fstatat(dir_fd, name.c_str(), &st.m_stat, AT_SYMLINK_NOFOLLOW),
+    name,
+    on_error);
+  return st;
+}
+#endif
+
+void
+Stat::handle_result(int result, const std::string& path, OnError on_error)
+{
   if (result == 0) {
     m_errno = 0;
   } else {
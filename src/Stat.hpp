@@ -57,6 +57,24 @@ public:
   static Stat lstat(const std::string& path,
                     OnError on_error = OnError::ignore);
 
+#ifndef _WIN32
+  // Run fstatat(2), which avoids resolving the directory part of a path again
+  // when stat-ing several files in the same directory.
+  //
+  // Arguments:
+  // - dir_fd: File descriptor of an open directory.
+  // - name: Path relative to the directory.
+  // - on_error: What to do on errors (including missing file).
+  static Stat stat_at(int dir_fd,
+                      const std::string& name,
+                      OnError on_error = OnError::ignore);
+
+  // Like stat_at, but don't follow a symbolic link named `name`.
+  static Stat lstat_at(int dir_fd,
+                       const std::string& name,
+                       OnError on_error = OnError::ignore);
+#endif
+
   // Return true if the file could be (l)stat-ed (i.e., the file exists),
   // otherwise false.
   operator bool() const;
@@ -98,6 +116,8 @@ private:
   struct stat m_stat;
   int m_errno;
 
+  void handle_result(int result, const std::string& path, OnError on_error);
+
   bool operator==(const Stat&) const;
   bool operator!=(const Stat&) const;
 };
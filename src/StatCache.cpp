@@ -0,0 +1,94 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "StatCache.hpp"
+
+namespace {
+
+// Maximum number of directory file descriptors to keep open.
+const size_t k_max_open_directories = 256;
+
+} // namespace
+
+Stat
+StatCache::stat(const std::string& path, Stat::OnError on_error) const
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_stats.find(path);
+    if (it != m_stats.end()) {
+      return it->second;
+    }
+  }
+
+  // Don't hold the lock while stat-ing so that other threads can proceed.
+  // Failures are not cached since they are rare and the caller could retry
+  // after creating the file.
+  auto st = do_stat(path, on_error);
+  if (st) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stats.find(path) == m_stats.end()) {
+      m_stats.emplace(m_arena.copy(path), st);
+    }
+  }
+  return st;
+}
+
+Stat
+StatCache::do_stat(const std::string& path, Stat::OnError on_error) const
+{
+#ifndef _WIN32
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos || slash + 1 == path.size()) {
+    return Stat::stat(path, on_error);
+  }
+
+  const nonstd::string_view dir(path.data(), slash == 0 ? 1 : slash);
+  int dir_fd = -1;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_directories.find(dir);
+    if (it == m_directories.end()) {
+      it = m_directories.emplace(m_arena.copy(dir), Directory()).first;
+    }
+    auto& directory = it->second;
+    ++directory.files;
+    // Opening the directory only pays off for the second file in it. The
+    // arena copy of the key is NUL-terminated.
+    if (directory.files == 2 && m_open_directories < k_max_open_directories) {
+      directory.fd = Fd(
+        open(it->first.data(), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_BINARY));
+      if (directory.fd) {
+        ++m_open_directories;
+      }
+    }
+    if (directory.fd) {
+      dir_fd = *directory.fd;
+    }
+  }
+
+  if (dir_fd != -1) {
+    auto st = Stat::stat_at(dir_fd, path.substr(slash + 1));
+    if (st || on_error == Stat::OnError::ignore) {
+      return st;
+    }
+    // Let Stat::stat report the error with the full path.
+  }
+#endif
+  return Stat::stat(path, on_error);
+}
@@ -0,0 +1,65 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Arena.hpp"
+#include "Fd.hpp"
+#include "Stat.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A cache of Stat::stat results for files that are not expected to change
+// during a ccache invocation, e.g. include files, so that each of them only
+// needs to be stat-ed once. The cache is safe to use from several threads.
+//
+// Files in a directory that has been seen before are stat-ed relative to a
+// file descriptor for the directory so that the kernel doesn't have to resolve
+// the directory part of the path again.
+class StatCache
+{
+public:
+  // Like Stat::stat but returns the result of a previous successful call for
+  // `path` if there is one.
+  Stat stat(const std::string& path,
+            Stat::OnError on_error = Stat::OnError::ignore) const;
+
+private:
+  struct Directory
+  {
+    uint32_t files = 0;
+    Fd fd;
+  };
+
+  // Keys of m_stats and m_directories are stored in m_arena. All three are
+  // guarded by m_mutex.
+  mutable std::mutex m_mutex;
+  mutable Arena m_arena;
+  mutable std::unordered_map<nonstd::string_view, Stat, StringViewHash> m_stats;
+  mutable std::unordered_map<nonstd::string_view, Directory, StringViewHash>
+    m_directories;
+  mutable size_t m_open_directories = 0;
+
+  Stat do_stat(const std::string& path, Stat::OnError on_error) const;
+};
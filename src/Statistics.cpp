@@ -20,12 +20,21 @@
 
 #include "AtomicFile.hpp"
 #include "Config.hpp"
+#include "Context.hpp"
+#include "Finalizer.hpp"
+#include "Hash.hpp"
 #include "Lockfile.hpp"
 #include "Logging.hpp"
+#include "SharedCounters.hpp"
+#include "StdMakeUnique.hpp"
+#include "Tracing.hpp"
 #include "Util.hpp"
 #include "exceptions.hpp"
 #include "fmtmacros.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 const unsigned FLAG_NOZERO = 1; // don't zero with the -z option
 const unsigned FLAG_ALWAYS = 2; // always show, even if zero
 const unsigned FLAG_NEVER = 4;  // never show
@@ -49,6 +58,12 @@ format_size_times_1024(uint64_t size)
   return format_size(size * 1024);
 }
 
+static std::string
+format_milliseconds(uint64_t milliseconds)
+{
+  return FMT("{:8.2f} s", milliseconds / 1000.0);
+}
+
 static std::string
 format_timestamp(uint64_t timestamp)
 {
@@ -75,6 +90,74 @@ hit_rate(const Counters& counters)
   return total > 0 ? (100.0 * hit) / total : 0.0;
 }
 
+static std::string
+format_duration(uint64_t duration_us)
+{
+  if (duration_us < 1000) {
+    return FMT("{:>9}", FMT("{} us", duration_us));
+  } else if (duration_us < 1000 * 1000) {
+    return FMT("{:>9}", FMT("{:.1f} ms", duration_us / 1000.0));
+  } else {
+    return FMT("{:>9}", FMT("{:.2f} s", duration_us / 1000000.0));
+  }
+}
+
+// Format a duration in microseconds as seconds for OpenMetrics.
+static std::string
+format_seconds(uint64_t duration_us)
+{
+  return FMT("{}", duration_us / 1000000.0);
+}
+
+static uint64_t
+get_raw_or_zero(const Counters& counters, size_t index)
+{
+  return index < counters.size() ? counters.get_raw(index) : 0;
+}
+
+static size_t
+phase_counters_begin(Phase phase)
+{
+  return Statistics::k_phase_counters_begin
+         + static_cast<size_t>(phase) * (Statistics::k_phase_buckets + 1);
+}
+
+static uint64_t
+phase_count(const Counters& counters, Phase phase)
+{
+  uint64_t count = 0;
+  for (size_t i = 0; i < Statistics::k_phase_buckets; ++i) {
+    count += get_raw_or_zero(counters, phase_counters_begin(phase) + i);
+  }
+  return count;
+}
+
+static uint64_t
+phase_total(const Counters& counters, Phase phase)
+{
+  return get_raw_or_zero(
+    counters, phase_counters_begin(phase) + Statistics::k_phase_buckets);
+}
+
+// Returns an estimate of quantile `q` of the durations of `phase`: the upper
+// bound of the bucket containing the quantile, or the lower bound if it's the
+// last bucket.
+static uint64_t
+phase_quantile(const Counters& counters, Phase phase, double q)
+{
+  const uint64_t count = phase_count(counters, phase);
+  const auto rank = static_cast<uint64_t>(std::ceil(q * count));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < Statistics::k_phase_buckets; ++i) {
+    seen += get_raw_or_zero(counters, phase_counters_begin(phase) + i);
+    if (seen >= rank) {
+      return Statistics::phase_bucket_lower_bound(
+        std::min(i + 1, Statistics::k_phase_buckets - 1));
+    }
+  }
+  return 0;
+}
+
 static void
 for_each_level_1_and_2_stats_file(
   const std::string& cache_dir,
@@ -88,6 +171,10 @@ for_each_level_1_and_2_stats_file(
   }
 }
 
+// The statistics summary is recounted from the stats files when showing
+// statistics if it hasn't been recounted for this many seconds, to bound drift.
+const time_t k_max_summary_age = 3600;
+
 static std::pair<Counters, time_t>
 collect_counters(const Config& config)
 {
@@ -105,10 +192,50 @@ collect_counters(const Config& config)
       last_updated = std::max(last_updated, Stat::stat(path).mtime());
     });
 
+  // Add counters that have not been moved to the stats files yet.
+  for (size_t level_1 = 0; level_1 <= 0xF; ++level_1) {
+    SharedCounters shared_counters(
+      FMT("{}/{:x}", config.cache_dir(), level_1), false);
+    if (shared_counters) {
+      counters.increment(shared_counters.get());
+    }
+  }
+
   counters.set(Statistic::stats_zeroed_timestamp, zero_timestamp);
   return std::make_pair(counters, last_updated);
 }
 
+static std::string
+breakdown_dir(const Config& config, const std::string& dimension)
+{
+  return FMT("{}/stats_breakdown/{}", config.cache_dir(), dimension);
+}
+
+static std::string
+sessions_dir(const Config& config)
+{
+  return FMT("{}/sessions", config.cache_dir());
+}
+
+// Get the counters from the statistics summary, recounting it if needed.
+static std::pair<Counters, time_t>
+get_counters(const Config& config)
+{
+  StatsSummary summary(config.cache_dir(), !config.read_only());
+  if (summary && summary.last_recount() != 0
+      && time(nullptr) - summary.last_recount() < k_max_summary_age) {
+    return std::make_pair(summary.get(), summary.last_updated());
+  }
+
+  const auto recount =
+    summary ? summary.begin_recount(time(nullptr)) : optional<uint64_t>();
+  const auto result = collect_counters(config);
+  if (summary) {
+    summary.reset(result.first, result.second, recount);
+  }
+  return result;
+}
+
 namespace {
 
 struct StatisticsField
@@ -133,8 +260,39 @@ struct StatisticsField
   const FormatFunction format; // nullptr -> use plain integer format
 };
 
+struct PhaseField
+{
+  const Phase phase;
+  const char* const id;      // for --print-stats
+  const char* const message; // for --show-stats --verbose
+};
+
 } // namespace
 
+// Phases in display order.
+const PhaseField k_phase_fields[] = {
+  {Phase::config_setup, "config_setup", "config setup"},
+  {Phase::find_compiler, "find_compiler", "find compiler"},
+  {Phase::hash_common_info, "hash_common_info", "hash common info"},
+  {Phase::manifest_lookup, "manifest_lookup", "manifest lookup"},
+  {Phase::include_verification,
+   "include_verification",
+   "  include verification"},
+  {Phase::result_retrieval, "result_retrieval", "result retrieval"},
+  {Phase::compiler_execution, "compiler_execution", "compiler execution"},
+  {Phase::compiler_cpu_time, "compiler_cpu_time", "compiler CPU time"},
+  {Phase::to_cache, "to_cache", "store in cache"},
+  {Phase::stats_update, "stats_update", "stats update"},
+  {Phase::cleanup, "cleanup", "cleanup"},
+};
+
+static_assert(sizeof(k_phase_fields) / sizeof(k_phase_fields[0])
+                == static_cast<size_t>(Phase::END),
+              "Missing phase field");
+static_assert(static_cast<size_t>(Statistic::END)
+                <= Statistics::k_phase_counters_begin,
+              "Statistics overlap the phase durations");
+
 #define STATISTICS_FIELD(id, ...)                                              \
   {                                                                            \
     Statistic::id, #id, __VA_ARGS__                                            \
@@ -148,6 +306,17 @@ const StatisticsField k_statistics_fields[] = {
   STATISTICS_FIELD(
     preprocessed_cache_hit, "cache hit (preprocessed)", FLAG_ALWAYS),
   STATISTICS_FIELD(cache_miss, "cache miss", FLAG_ALWAYS),
+  STATISTICS_FIELD(
+    time_saved_by_hits, "time saved by hits", 0, format_milliseconds),
+  STATISTICS_FIELD(
+    time_spent_on_misses, "time spent on misses", 0, format_milliseconds),
+  STATISTICS_FIELD(result_not_admitted, "result not admitted"),
+  STATISTICS_FIELD(link_cache_hit, "cache hit (link)"),
+  STATISTICS_FIELD(link_cache_miss, "link not in cache"),
+  STATISTICS_FIELD(query_cache_hit, "cache hit (query)"),
+  STATISTICS_FIELD(query_cache_miss, "query not in cache"),
+  STATISTICS_FIELD(command_cache_hit, "cache hit (command)"),
+  STATISTICS_FIELD(command_cache_miss, "command not in cache"),
   STATISTICS_FIELD(called_for_link, "called for link"),
   STATISTICS_FIELD(called_for_preprocessing, "called for preprocessing"),
   STATISTICS_FIELD(multiple_source_files, "multiple source files"),
@@ -163,6 +332,7 @@ const StatisticsField k_statistics_fields[] = {
   STATISTICS_FIELD(could_not_use_modules, "can't use modules"),
   STATISTICS_FIELD(could_not_find_compiler, "couldn't find the compiler"),
   STATISTICS_FIELD(missing_cache_file, "cache file missing"),
+  STATISTICS_FIELD(lookup_timeout, "lookup timed out"),
   STATISTICS_FIELD(bad_compiler_arguments, "bad compiler arguments"),
   STATISTICS_FIELD(unsupported_source_language, "unsupported source language"),
   STATISTICS_FIELD(compiler_check_failed, "compiler check failed"),
@@ -186,6 +356,42 @@ const StatisticsField k_statistics_fields[] = {
 
 namespace Statistics {
 
+size_t
+phase_bucket_index(uint64_t duration_us)
+{
+  if (duration_us < 32) {
+    return 0;
+  }
+  size_t log2 = 5;
+  while (log2 < 63 && (duration_us >> (log2 + 1)) != 0) {
+    ++log2;
+  }
+  // Two buckets per power of two, selected by the bit after the leading one.
+  const size_t index =
+    1 + 2 * (log2 - 5) + ((duration_us >> (log2 - 1)) & 1);
+  return std::min(index, k_phase_buckets - 1);
+}
+
+uint64_t
+phase_bucket_lower_bound(size_t index)
+{
+  if (index == 0) {
+    return 0;
+  }
+  const size_t log2 = 5 + (index - 1) / 2;
+  return static_cast<uint64_t>(2 + (index - 1) % 2) << (log2 - 1);
+}
+
+void
+add_phase_duration(Counters& counters, Phase phase, uint64_t duration_us)
+{
+  const size_t begin = phase_counters_begin(phase);
+  const size_t bucket = begin + phase_bucket_index(duration_us);
+  counters.set_raw(bucket, get_raw_or_zero(counters, bucket) + 1);
+  const size_t total = begin + k_phase_buckets;
+  counters.set_raw(total, get_raw_or_zero(counters, total) + duration_us);
+}
+
 Counters
 read(const std::string& path)
 {
@@ -219,13 +425,40 @@ optional<Counters>
 update(const std::string& path,
        std::function<void(Counters& counters)> function)
 {
+  return update(std::string(), path, function);
+}
+
+optional<Counters>
+update(const std::string& cache_dir,
+       const std::string& path,
+       std::function<void(Counters& counters)> function)
+{
+  Tracing::Span span("stats_update", path);
   Lockfile lock(path);
   if (!lock.acquired()) {
     LOG("Failed to acquire lock for {}", path);
     return nullopt;
   }
 
+  // The change is announced before the stats file is written so that a
+  // concurrent recount of the summary isn't trusted.
+  std::unique_ptr<StatsSummary> summary;
+  if (!cache_dir.empty()) {
+    summary = std::make_unique<StatsSummary>(cache_dir, false);
+    if (*summary) {
+      summary->begin_change();
+    } else {
+      summary.reset();
+    }
+  }
+  Finalizer end_change([&] {
+    if (summary) {
+      summary->end_change();
+    }
+  });
+
   auto counters = Statistics::read(path);
+  const Counters before = counters;
   function(counters);
 
   AtomicFile file(path, AtomicFile::Mode::text);
@@ -239,11 +472,203 @@ update(const std::string& path,
     // important enough to fail whole the process and also because it is
     // called in the Context destructor.
     LOG("Error: {}", e.what());
+    return counters;
+  }
+
+  if (summary) {
+    summary->add_change(before, counters);
   }
 
   return counters;
 }
 
+// Return the counters file of `key` in directory `dir`.
+static std::string
+keyed_counters_file(const std::string& dir, const std::string& key)
+{
+  // Independent of hash_algorithm since all invocations share the files.
+  const auto name = Hash(Hash::Algorithm::blake3).hash(key).digest();
+  return FMT("{}/{}", dir, name.to_string());
+}
+
+// Add the compilation result counters and phase durations in `updates` to the
+// counters of `key` in directory `dir`.
+static void
+update_keyed_counters(const std::string& dir,
+                      const std::string& key,
+                      const Counters& updates)
+{
+  const auto path = keyed_counters_file(dir, key);
+
+  // The key is stored next to the counters since the file name is a hash.
+  const auto key_path = path + ".key";
+  if (!Stat::stat(key_path)) {
+    if (!Util::create_dir(dir)) {
+      LOG("Failed to create {}: {}", dir, strerror(errno));
+      return;
+    }
+    try {
+      AtomicFile file(key_path, AtomicFile::Mode::text);
+      file.write(key);
+      file.commit();
+    } catch (const Error& e) {
+      LOG("Error: {}", e.what());
+      return;
+    }
+  }
+
+  update(path, [&](Counters& cs) {
+    for (size_t i = 0; k_statistics_fields[i].message; ++i) {
+      const auto& field = k_statistics_fields[i];
+      if (!(field.flags & FLAG_NOZERO)
+          && field.statistic != Statistic::stats_zeroed_timestamp
+          && field.statistic != Statistic::cleanups_performed) {
+        cs.increment(field.statistic, updates.get(field.statistic));
+      }
+    }
+    for (size_t i = k_phase_counters_begin;
+         i < std::min(updates.size(), k_phase_counters_end);
+         ++i) {
+      cs.set_raw(i, get_raw_or_zero(cs, i) + updates.get_raw(i));
+    }
+  });
+}
+
+void
+update_breakdown(const Config& config,
+                 const std::string& dimension,
+                 const std::string& key,
+                 const Counters& updates)
+{
+  update_keyed_counters(breakdown_dir(config, dimension), key, updates);
+}
+
+void
+update_session(const Config& config, const Counters& updates)
+{
+  update_keyed_counters(sessions_dir(config), config.session(), updates);
+}
+
+bool
+zero_session(const Config& config, const std::string& session)
+{
+  const auto path = keyed_counters_file(sessions_dir(config), session);
+  Util::unlink_safe(path + ".key", Util::UnlinkLog::ignore_failure);
+  return Util::unlink_safe(path, Util::UnlinkLog::ignore_failure);
+}
+
+std::string
+format_breakdown(const Config& config, const std::string& dimension)
+{
+  struct Row
+  {
+    std::string key;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t uncached;
+    uint64_t compile_time_us;
+  };
+  std::vector<Row> rows;
+
+  const auto dir = breakdown_dir(config, dimension);
+  if (Stat::stat(dir).is_directory()) {
+    Util::traverse(dir, [&](const std::string& path, bool is_dir) {
+      // Skip key, lock and temporary files.
+      if (is_dir
+          || Util::base_name(path).find('.') != nonstd::string_view::npos) {
+        return;
+      }
+      const auto counters = read(path);
+      Row row;
+      try {
+        row.key = Util::read_file(path + ".key");
+      } catch (const Error&) {
+        row.key = std::string(Util::base_name(path));
+      }
+      row.hits = counters.get(Statistic::direct_cache_hit)
+                 + counters.get(Statistic::preprocessed_cache_hit)
+                 + counters.get(Statistic::link_cache_hit)
+                 + counters.get(Statistic::query_cache_hit)
+                 + counters.get(Statistic::command_cache_hit);
+      row.misses = counters.get(Statistic::cache_miss)
+                   + counters.get(Statistic::link_cache_miss)
+                   + counters.get(Statistic::query_cache_miss)
+                   + counters.get(Statistic::command_cache_miss);
+      row.uncached = 0;
+      for (size_t i = 0; k_statistics_fields[i].message; ++i) {
+        const auto& field = k_statistics_fields[i];
+        if (!(field.flags & (FLAG_NOZERO | FLAG_ALWAYS))
+            && field.statistic != Statistic::link_cache_hit
+            && field.statistic != Statistic::link_cache_miss
+            && field.statistic != Statistic::query_cache_hit
+            && field.statistic != Statistic::query_cache_miss
+            && field.statistic != Statistic::command_cache_hit
+            && field.statistic != Statistic::command_cache_miss
+            && field.statistic != Statistic::result_not_admitted) {
+          row.uncached += counters.get(field.statistic);
+        }
+      }
+      row.compile_time_us = phase_total(counters, Phase::compiler_execution);
+      rows.push_back(std::move(row));
+    });
+  }
+
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    if (a.compile_time_us != b.compile_time_us) {
+      return a.compile_time_us > b.compile_time_us;
+    }
+    if (a.misses != b.misses) {
+      return a.misses > b.misses;
+    }
+    return a.key < b.key;
+  });
+
+  size_t key_width = dimension.length();
+  for (const auto& row : rows) {
+    key_width = std::max(key_width, row.key.length());
+  }
+
+  std::string result = FMT("{:{}}  {:>8}  {:>8}  {:>8}  {:>8}  {:>12}\n",
+                           dimension,
+                           key_width,
+                           "hits",
+                           "misses",
+                           "uncached",
+                           "hit rate",
+                           "compile time");
+  for (const auto& row : rows) {
+    const uint64_t total = row.hits + row.misses;
+    result += FMT("{:{}}  {:8}  {:8}  {:8}  {:6.2f} %  {:>12}\n",
+                  row.key,
+                  key_width,
+                  row.hits,
+                  row.misses,
+                  row.uncached,
+                  total > 0 ? (100.0 * row.hits) / total : 0.0,
+                  format_duration(row.compile_time_us));
+  }
+  return result;
+}
+
+std::string
+namespace_tag(const std::string& ns)
+{
+  if (ns.empty()) {
+    return std::string();
+  }
+  // Independent of hash_algorithm since the tag is recorded in the LRU index.
+  const auto digest = Hash(Hash::Algorithm::blake3).hash(ns).digest();
+  return digest.to_string().substr(0, 16);
+}
+
+std::string
+namespace_stats_file(const std::string& cache_dir,
+                     const std::string& tag,
+                     const std::string& level_string)
+{
+  return FMT("{}/namespaces/{}/{}", cache_dir, tag, level_string);
+}
+
 optional<std::string>
 get_result(const Counters& counters)
 {
@@ -255,36 +680,93 @@ get_result(const Counters& counters)
   return nullopt;
 }
 
+optional<std::string>
+get_result_id(const Counters& counters)
+{
+  for (const auto& field : k_statistics_fields) {
+    if (counters.get(field.statistic) != 0 && !(field.flags & FLAG_NOZERO)) {
+      return field.id;
+    }
+  }
+  return nullopt;
+}
+
 void
 zero_all_counters(const Config& config)
 {
   const time_t timestamp = time(nullptr);
 
+  const auto breakdown_root = FMT("{}/stats_breakdown", config.cache_dir());
+  if (Stat::stat(breakdown_root).is_directory()) {
+    Util::wipe_path(breakdown_root);
+  }
+
+  // Move shared counters to the stats files so that they are zeroed too.
+  for (size_t level_1 = 0; level_1 <= 0xF; ++level_1) {
+    SharedCounters shared_counters(
+      FMT("{}/{:x}", config.cache_dir(), level_1), false);
+    if (shared_counters) {
+      shared_counters.flush();
+    }
+  }
+
   for_each_level_1_and_2_stats_file(
     config.cache_dir(), [=](const std::string& path) {
-      Statistics::update(path, [=](Counters& cs) {
+      Statistics::update(config.cache_dir(), path, [=](Counters& cs) {
         for (size_t i = 0; k_statistics_fields[i].message; ++i) {
           if (!(k_statistics_fields[i].flags & FLAG_NOZERO)) {
             cs.set(k_statistics_fields[i].statistic, 0);
           }
         }
         cs.set(Statistic::stats_zeroed_timestamp, timestamp);
+        for (size_t i = k_phase_counters_begin;
+             i < std::min(cs.size(), k_phase_counters_end);
+             ++i) {
+          cs.set_raw(i, 0);
+        }
       });
     });
 }
 
+void
+recount(const Config& config)
+{
+  StatsSummary summary(config.cache_dir(), true);
+  if (!summary) {
+    throw Error("Failed to open statistics summary in {}", config.cache_dir());
+  }
+  const auto recount = summary.begin_recount(time(nullptr));
+  const auto result = collect_counters(config);
+  summary.reset(result.first, result.second, recount);
+}
+
 std::string
-format_human_readable(const Config& config)
+format_human_readable(const Config& config,
+                      bool verbose,
+                      const std::string& session)
 {
   Counters counters;
   time_t last_updated;
-  std::tie(counters, last_updated) = collect_counters(config);
+  if (session.empty()) {
+    std::tie(counters, last_updated) = get_counters(config);
+  } else {
+    const auto path = keyed_counters_file(sessions_dir(config), session);
+    const auto st = Stat::stat(path);
+    if (!st) {
+      throw Error("no statistics recorded for session \"{}\"", session);
+    }
+    counters = read(path);
+    last_updated = st.mtime();
+  }
   std::string result;
 
   result += FMT("{:36}{}\n", "cache directory", config.cache_dir());
   result += FMT("{:36}{}\n", "primary config", config.primary_config_path());
   result += FMT(
     "{:36}{}\n", "secondary config (readonly)", config.secondary_config_path());
+  if (!session.empty()) {
+    result += FMT("{:36}{}\n", "session", session);
+  }
   if (last_updated > 0) {
     const auto tm = Util::localtime(last_updated);
     char timestamp[100] = "?";
@@ -301,6 +783,12 @@ format_human_readable(const Config& config)
     if (k_statistics_fields[i].flags & FLAG_NEVER) {
       continue;
     }
+    // Sessions only record compilation results, not the cache size.
+    if (!session.empty()
+        && ((k_statistics_fields[i].flags & FLAG_NOZERO)
+            || statistic == Statistic::cleanups_performed)) {
+      continue;
+    }
     if (counters.get(statistic) == 0
         && !(k_statistics_fields[i].flags & FLAG_ALWAYS)) {
       continue;
@@ -320,13 +808,60 @@ format_human_readable(const Config& config)
     }
   }
 
-  if (config.max_files() != 0) {
+  if (config.max_files() != 0 && session.empty()) {
     result += FMT("{:32}{:8}\n", "max files", config.max_files());
   }
-  if (config.max_size() != 0) {
+  if (config.max_size() != 0 && session.empty()) {
     result +=
       FMT("{:32}{}\n", "max cache size", format_size(config.max_size()));
   }
+  if (!config.namespace_().empty() && session.empty()) {
+    const auto tag = namespace_tag(config.namespace_());
+    uint64_t size_kibibyte = 0;
+    for (uint8_t i = 0; i <= 0xF; ++i) {
+      size_kibibyte +=
+        read(namespace_stats_file(config.cache_dir(), tag, FMT("{:x}", i)))
+          .get(Statistic::cache_size_kibibyte);
+    }
+    result += FMT(
+      "{:32}{}\n", "namespace cache size", format_size(size_kibibyte * 1024));
+    if (config.namespace_max_size() != 0) {
+      result += FMT("{:32}{}\n",
+                    "namespace max size",
+                    format_size(config.namespace_max_size()));
+    }
+  }
+
+  if (verbose) {
+    bool header_printed = false;
+    for (const auto& field : k_phase_fields) {
+      const uint64_t count = phase_count(counters, field.phase);
+      if (count == 0) {
+        continue;
+      }
+      if (!header_printed) {
+        result += FMT("{:24}{:>8}{:>9}{:>9}{:>9}{:>9}\n",
+                      "phase durations",
+                      "count",
+                      "mean",
+                      "p50",
+                      "p90",
+                      "p99");
+        header_printed = true;
+      }
+      const uint64_t mean = phase_total(counters, field.phase) / count;
+      const auto quantile = [&](double q) {
+        return format_duration(phase_quantile(counters, field.phase, q));
+      };
+      result += FMT("  {:22}{:8}{}{}{}{}\n",
+                    field.message,
+                    count,
+                    format_duration(mean),
+                    quantile(0.5),
+                    quantile(0.9),
+                    quantile(0.99));
+    }
+  }
 
   return result;
 }
@@ -336,7 +871,7 @@ format_machine_readable(const Config& config)
 {
   Counters counters;
   time_t last_updated;
-  std::tie(counters, last_updated) = collect_counters(config);
+  std::tie(counters, last_updated) = get_counters(config);
   std::string result;
 
   result += FMT("stats_updated_timestamp\t{}\n", last_updated);
@@ -349,7 +884,151 @@ format_machine_readable(const Config& config)
     }
   }
 
+  for (const auto& field : k_phase_fields) {
+    const uint64_t count = phase_count(counters, field.phase);
+    if (count == 0) {
+      continue;
+    }
+    result += FMT("phase_{}_count\t{}\n", field.id, count);
+    result += FMT("phase_{}_total_us\t{}\n",
+                  field.id,
+                  phase_total(counters, field.phase));
+    // Buckets are identified by their lower bound so that histograms from
+    // several caches can be added up.
+    for (size_t i = 0; i < k_phase_buckets; ++i) {
+      const uint64_t value =
+        get_raw_or_zero(counters, phase_counters_begin(field.phase) + i);
+      if (value != 0) {
+        result += FMT("phase_{}_bucket_{}_us\t{}\n",
+                      field.id,
+                      phase_bucket_lower_bound(i),
+                      value);
+      }
+    }
+  }
+
+  return result;
+}
+
+std::string
+format_open_metrics(const Config& config)
+{
+  Counters counters;
+  time_t last_updated;
+  std::tie(counters, last_updated) = get_counters(config);
+  std::string result;
+
+  const auto add_family = [&](const std::string& name,
+                              const char* type,
+                              const std::string& help) {
+    result += FMT("# TYPE ccache_{} {}\n", name, type);
+    result += FMT("# HELP ccache_{} {}\n", name, help);
+  };
+
+  add_family("stats_updated_timestamp_seconds",
+             "gauge",
+             "Time of the last statistics update.");
+  result += FMT("ccache_stats_updated_timestamp_seconds {}\n", last_updated);
+
+  for (size_t i = 0; k_statistics_fields[i].message; i++) {
+    const auto& field = k_statistics_fields[i];
+    if (field.flags & FLAG_NEVER) {
+      continue;
+    }
+    const uint64_t value = counters.get(field.statistic);
+    if (field.statistic == Statistic::stats_zeroed_timestamp) {
+      add_family(
+        "stats_zeroed_timestamp_seconds", "gauge", "Time of the last -z.");
+      result += FMT("ccache_stats_zeroed_timestamp_seconds {}\n", value);
+    } else if (field.statistic == Statistic::cache_size_kibibyte) {
+      add_family("cache_size_bytes", "gauge", field.message);
+      result += FMT("ccache_cache_size_bytes {}\n", value * 1024);
+    } else if (field.flags & FLAG_NOZERO) {
+      add_family(field.id, "gauge", field.message);
+      result += FMT("ccache_{} {}\n", field.id, value);
+    } else {
+      // Counters are reset by -z, which OpenMetrics consumers handle like a
+      // restart.
+      add_family(field.id, "counter", field.message);
+      result += FMT("ccache_{}_total {}\n", field.id, value);
+    }
+  }
+
+  add_family("phase_duration_seconds",
+             "histogram",
+             "Durations of the phases of ccache invocations.");
+  for (const auto& field : k_phase_fields) {
+    // Bucket i holds durations from its lower bound up to the lower bound of
+    // bucket i + 1.
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i + 1 < k_phase_buckets; ++i) {
+      cumulative +=
+        get_raw_or_zero(counters, phase_counters_begin(field.phase) + i);
+      result += FMT("ccache_phase_duration_seconds_bucket{{phase=\"{}\","
+                    "le=\"{}\"}} {}\n",
+                    field.id,
+                    format_seconds(phase_bucket_lower_bound(i + 1)),
+                    cumulative);
+    }
+    result += FMT("ccache_phase_duration_seconds_bucket{{phase=\"{}\","
+                  "le=\"+Inf\"}} {}\n",
+                  field.id,
+                  phase_count(counters, field.phase));
+    result += FMT("ccache_phase_duration_seconds_count{{phase=\"{}\"}} {}\n",
+                  field.id,
+                  phase_count(counters, field.phase));
+    result += FMT("ccache_phase_duration_seconds_sum{{phase=\"{}\"}} {}\n",
+                  field.id,
+                  format_seconds(phase_total(counters, field.phase)));
+  }
+
+#ifdef INODE_CACHE_SUPPORTED
+  // Only report an existing inode cache since querying it would create it.
+  InodeCache inode_cache(config);
+  if (config.inode_cache() && Stat::stat(inode_cache.get_file())) {
+    const std::pair<const char*, int64_t> inode_cache_counters[] = {
+      {"hits", inode_cache.get_hits()},
+      {"misses", inode_cache.get_misses()},
+      {"errors", inode_cache.get_errors()},
+      {"evictions", inode_cache.get_evictions()},
+    };
+    for (const auto& counter : inode_cache_counters) {
+      if (counter.second < 0) {
+        continue;
+      }
+      const auto name = FMT("inode_cache_{}", counter.first);
+      add_family(name, "counter", FMT("Inode cache {}.", counter.first));
+      result += FMT("ccache_{}_total {}\n", name, counter.second);
+    }
+  }
+#endif
+
+  result += "# EOF\n";
   return result;
 }
 
+PhaseTimer::PhaseTimer(const Context& ctx, Phase phase)
+  : m_ctx(ctx),
+    m_phase(phase),
+    m_start(std::chrono::steady_clock::now())
+{
+}
+
+PhaseTimer::~PhaseTimer()
+{
+  stop();
+}
+
+void
+PhaseTimer::stop()
+{
+  if (m_stopped || !m_ctx.config.phase_durations()) {
+    return;
+  }
+  m_stopped = true;
+  const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - m_start);
+  add_phase_duration(m_ctx.phase_durations, m_phase, duration.count());
+}
+
 } // namespace Statistics
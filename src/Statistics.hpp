@@ -21,13 +21,16 @@
 #include "system.hpp"
 
 #include "Counters.hpp"
+#include "NonCopyable.hpp"
 
 #include "third_party/nonstd/optional.hpp"
 
+#include <chrono>
 #include <functional>
 #include <string>
 
 class Config;
+class Context;
 
 // Statistics fields in storage order.
 enum class Statistic {
@@ -64,12 +67,67 @@ enum class Statistic {
   unsupported_code_directive = 30,
   stats_zeroed_timestamp = 31,
   could_not_use_modules = 32,
+  link_cache_hit = 33,
+  link_cache_miss = 34,
+  // Compiler wall time in milliseconds that cache hits saved, as recorded in
+  // the results when they were stored.
+  time_saved_by_hits = 35,
+  // Compiler wall time in milliseconds spent on cache misses.
+  time_spent_on_misses = 36,
+  query_cache_hit = 37,
+  query_cache_miss = 38,
+  // Cache misses whose results were not stored due to admission_threshold.
+  result_not_admitted = 39,
+  command_cache_hit = 40,
+  command_cache_miss = 41,
+  // Lookups abandoned after lookup_timeout in favor of running the compiler.
+  lookup_timeout = 42,
+
+  END
+};
+
+// Phases of a ccache invocation whose durations are recorded in histograms
+// when phase_durations is enabled.
+enum class Phase {
+  config_setup,
+  find_compiler,
+  hash_common_info,
+  manifest_lookup,
+  include_verification, // Part of manifest_lookup.
+  result_retrieval,
+  compiler_execution, // Part of to_cache.
+  to_cache,
+  stats_update,
+  cleanup,
+  // User and system CPU time of compiler_execution, which may exceed its
+  // duration.
+  compiler_cpu_time,
 
   END
 };
 
 namespace Statistics {
 
+// The phase duration histograms are stored after the statistics counters,
+// starting at counter index k_phase_counters_begin so that statistics can be
+// added without moving them. Each phase has k_phase_buckets log-linear buckets
+// (two per power of two, from 32 to 2^24 microseconds) followed by the total
+// duration in microseconds.
+const size_t k_phase_counters_begin = 64;
+const size_t k_phase_buckets = 40;
+const size_t k_phase_counters_end =
+  k_phase_counters_begin
+  + static_cast<size_t>(Phase::END) * (k_phase_buckets + 1);
+
+// Add a duration of `phase` to the histogram in `counters`.
+void add_phase_duration(Counters& counters, Phase phase, uint64_t duration_us);
+
+// Return the lower bound in microseconds of phase histogram bucket `index`.
+uint64_t phase_bucket_lower_bound(size_t index);
+
+// Return the bucket index of a phase duration.
+size_t phase_bucket_index(uint64_t duration_us);
+
 // Read counters from `path`. No lock is acquired.
 Counters read(const std::string& path);
 
@@ -79,18 +137,87 @@ Counters read(const std::string& path);
 nonstd::optional<Counters> update(const std::string& path,
                                   std::function<void(Counters& counters)>);
 
+// Like above but for the stats file `path` in a subdirectory of `cache_dir`,
+// whose statistics summary is updated as well.
+nonstd::optional<Counters> update(const std::string& cache_dir,
+                                  const std::string& path,
+                                  std::function<void(Counters& counters)>);
+
+// Add the compilation result counters in `updates`, i.e. not the cache size
+// bookkeeping, and the phase durations to the statistics of `key` in the
+// statistics breakdown `dimension` (see stats_breakdown).
+void update_breakdown(const Config& config,
+                      const std::string& dimension,
+                      const std::string& key,
+                      const Counters& updates);
+
+// Add the compilation result counters in `updates` and the phase durations to
+// the statistics of the session Config::session.
+void update_session(const Config& config, const Counters& updates);
+
+// Remove the statistics of `session`. Returns false if there were none.
+bool zero_session(const Config& config, const std::string& session);
+
+// Format the statistics breakdown `dimension` in human-readable format, keys
+// with the longest compiler execution time and most misses first.
+std::string format_breakdown(const Config& config,
+                             const std::string& dimension);
+
+// Return the tag that identifies namespace `ns` (see Config::namespace_) in LRU
+// indexes and file names, or an empty string if `ns` is empty.
+std::string namespace_tag(const std::string& ns);
+
+// Return the stats file that tracks the cache size and number of files of the
+// namespace with tag `tag` in the level 1 subdirectory named `level_string`.
+std::string namespace_stats_file(const std::string& cache_dir,
+                                 const std::string& tag,
+                                 const std::string& level_string);
+
 // Return a human-readable string representing the final ccache result, or
 // nullopt if there was no result.
 nonstd::optional<std::string> get_result(const Counters& counters);
 
+// Like get_result but return the identifier of the result as printed by
+// --print-stats, e.g. "direct_cache_hit".
+nonstd::optional<std::string> get_result_id(const Counters& counters);
+
 // Zero all statistics counters except those tracking cache size and number of
 // files in the cache.
 void zero_all_counters(const Config& config);
 
-// Format cache statistics in human-readable format.
-std::string format_human_readable(const Config& config);
+// Recount the statistics summary from the stats files.
+void recount(const Config& config);
+
+// Format cache statistics in human-readable format. If `verbose` is true,
+// phase durations are included. If `session` is not empty, the statistics
+// recorded for that session (see Config::session) are formatted instead of
+// those of the whole cache. Throws Error if there are none.
+std::string format_human_readable(const Config& config,
+                                  bool verbose = false,
+                                  const std::string& session = {});
 
 // Format cache statistics in machine-readable format.
 std::string format_machine_readable(const Config& config);
 
+// Format cache statistics, phase duration histograms and inode cache counters
+// in the OpenMetrics text format.
+std::string format_open_metrics(const Config& config);
+
+// Measures the time from construction to stop() or destruction and adds it to
+// the phase durations of `ctx` if phase_durations is enabled.
+class PhaseTimer : NonCopyable
+{
+public:
+  PhaseTimer(const Context& ctx, Phase phase);
+  ~PhaseTimer();
+
+  void stop();
+
+private:
+  const Context& m_ctx;
+  const Phase m_phase;
+  const std::chrono::steady_clock::time_point m_start;
+  bool m_stopped = false;
+};
+
 } // namespace Statistics
@@ -0,0 +1,790 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Storage.hpp"
+
+#include "AtomicFile.hpp"
+#include "CacheBundle.hpp"
+#include "Config.hpp"
+#include "Counters.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "MiniTrace.hpp"
+#include "NegativeCache.hpp"
+#include "PresenceFilter.hpp"
+#include "Statistics.hpp"
+#include "StdMakeUnique.hpp"
+#include "TemporaryFile.hpp"
+#include "Tracing.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <unordered_set>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+const uint64_t Storage::k_max_cache_files_per_directory;
+const uint8_t Storage::k_min_cache_levels;
+const uint8_t Storage::k_max_cache_levels;
+const char Storage::k_level_file_name[] = "level";
+const char Storage::k_pack_file_name[] = "pack";
+
+Storage::Storage(const Config& config) : m_config(config)
+{
+}
+
+Storage::~Storage()
+{
+  if (!m_pending_uploads.empty()) {
+    LOG("Discarding {} queued uploads to secondary storage",
+        m_pending_uploads.size());
+  }
+  for (const auto& path : m_extracted_files) {
+    Util::unlink_tmp(path);
+  }
+}
+
+void
+Storage::initialize()
+{
+  for (auto& dir :
+       Util::split_into_strings(m_config.lower_cache_dirs(), PATH_DELIM)) {
+    while (dir.size() > 1 && dir.back() == '/') {
+      dir.pop_back();
+    }
+    if (dir == m_config.cache_dir()) {
+      continue;
+    }
+    LowerCache lower_cache;
+    if (Stat::stat(dir).is_regular()) {
+      lower_cache.bundle = std::make_unique<CacheBundle>(dir);
+      if (!*lower_cache.bundle) {
+        continue;
+      }
+    }
+    lower_cache.path = std::move(dir);
+    m_lower_caches.push_back(std::move(lower_cache));
+  }
+  set_up_stripes(m_config);
+  m_secondary_storage = SecondaryStorage::create(m_config);
+  m_peers = SecondaryStorage::create_peers(m_config);
+}
+
+optional<std::string>
+Storage::get(const Digest& name, string_view suffix, Counters& counter_updates)
+{
+  auto file = look_up_primary_file(name, suffix);
+  if (file.stat || get_from_pack(name, suffix, file)) {
+    return file.path;
+  }
+  if (!m_lower_caches.empty() && !lookup_deadline_passed()) {
+    if (!m_config.lower_cache_copy_up() || m_config.read_only()) {
+      const auto lower_file = look_up_lower_file(name, suffix);
+      if (lower_file && lower_file->bundled_data) {
+        const auto path = extract_bundled_file(*lower_file->bundled_data);
+        LOG("Using {} from bundle {}", path, lower_file->path);
+        return path;
+      } else if (lower_file) {
+        LOG("Using {} from lower cache", lower_file->path);
+        return lower_file->path;
+      }
+    } else if (get_from_lower_cache(name, suffix, file, counter_updates)) {
+      return file.path;
+    }
+  }
+  if (get_from_peers(name, suffix, file, counter_updates)) {
+    return file.path;
+  }
+  if (get_from_secondary_storage(name, suffix, file, counter_updates)) {
+    return file.path;
+  }
+  return nullopt;
+}
+
+bool
+Storage::import_file(const std::string& file_name,
+                     string_view data,
+                     Counters& counter_updates)
+{
+  auto file = look_up_primary_file(file_name);
+  return !file.stat
+         && store_fetched_file(
+           file, std::string(data), counter_updates, "bundle");
+}
+
+bool
+Storage::may_contain(const Digest& name, string_view suffix) const
+{
+  if (!m_lower_caches.empty() || m_secondary_storage || !m_peers.empty()
+      || look_up_primary_file(name, suffix).stat) {
+    return true;
+  }
+  if (m_config.pack_max_file_size() == 0) {
+    return false;
+  }
+  const auto name_string = FMT("{}{}", name.to_string(), suffix);
+  const auto pack = get_pack(name_string[0]);
+  return pack && pack->get(name_string);
+}
+
+void
+Storage::set_lookup_deadline(
+  optional<std::chrono::steady_clock::time_point> deadline)
+{
+  m_lookup_deadline = deadline;
+}
+
+bool
+Storage::lookup_deadline_passed() const
+{
+  if (m_lookup_deadline
+      && std::chrono::steady_clock::now() >= *m_lookup_deadline) {
+    LOG_RAW("Lookup deadline has passed");
+    return true;
+  }
+  return false;
+}
+
+uint32_t
+Storage::lookup_time_left() const
+{
+  if (!m_lookup_deadline) {
+    return UINT32_MAX;
+  }
+  const auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+                      *m_lookup_deadline - std::chrono::steady_clock::now())
+                      .count();
+  return Util::clamp<int64_t>(left, 0, UINT32_MAX - 1);
+}
+
+bool
+Storage::is_primary_path(const std::string& path) const
+{
+  return Util::starts_with(path, m_config.cache_dir())
+         && path.size() > m_config.cache_dir().size()
+         && path[m_config.cache_dir().size()] == '/';
+}
+
+void
+Storage::readahead(const Digest& name, string_view suffix) const
+{
+#ifdef HAVE_POSIX_FADVISE
+  const auto file = look_up_primary_file(name, suffix);
+  if (!file.stat) {
+    return;
+  }
+  Fd fd(open(file.path.c_str(), O_RDONLY | O_BINARY));
+  if (fd) {
+    // The kernel keeps reading after the descriptor has been closed.
+    posix_fadvise(*fd, 0, 0, POSIX_FADV_WILLNEED);
+  }
+#else
+  (void)name;
+  (void)suffix;
+#endif
+}
+
+bool
+Storage::put(const Digest& name,
+             string_view suffix,
+             Counters& counter_updates,
+             const std::function<bool(const std::string& path)>& entry_writer,
+             const bool share,
+             const uint64_t cost)
+{
+  const auto file = look_up_primary_file(name, suffix);
+  if (!entry_writer(file.path)) {
+    return false;
+  }
+
+  const auto new_stat = Stat::stat(file.path, Stat::OnError::log);
+  if (!new_stat) {
+    return false;
+  }
+  counter_updates.increment(Statistic::cache_size_kibibyte,
+                            Util::size_change_kibibyte(file.stat, new_stat));
+  counter_updates.increment(Statistic::files_in_cache, file.stat ? 0 : 1);
+  LruIndex::record_store(m_config.cache_dir(),
+                         file.path,
+                         new_stat.size_on_disk(),
+                         cost,
+                         Statistics::namespace_tag(m_config.namespace_()));
+  record_presence(file.path);
+  remove_duplicates(file.path, counter_updates);
+
+  if (share && m_secondary_storage) {
+    try {
+      m_pending_uploads.push_back(
+        {{name, std::string(suffix)}, Util::read_file(file.path)});
+    } catch (const Error& e) {
+      LOG("Failed to read {}: {}", file.path, e.what());
+    }
+  }
+  return true;
+}
+
+void
+Storage::remove(const Digest& name, string_view suffix)
+{
+  const auto file = look_up_primary_file(name, suffix);
+  if (file.stat) {
+    Util::unlink_safe(file.path);
+  }
+}
+
+void
+Storage::flush()
+{
+  if (m_pending_uploads.empty()) {
+    return;
+  }
+
+  const auto negative_cache = get_negative_cache();
+  if (negative_cache) {
+    for (const auto& entry : m_pending_uploads) {
+      negative_cache->remove(entry.key.name, entry.key.suffix);
+    }
+  }
+
+#ifndef _WIN32
+  // A slow secondary storage must not delay the build, so upload in a detached
+  // child process.
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+  } else if (pid > 0) {
+    LOG("Uploading {} entries to secondary storage in background process {}",
+        m_pending_uploads.size(),
+        pid);
+    m_pending_uploads.clear();
+    return;
+  } else {
+    // Detach from the build system, which may wait for the standard streams
+    // to be closed.
+    setsid();
+    Fd null_fd(open("/dev/null", O_RDWR));
+    if (null_fd) {
+      dup2(*null_fd, STDIN_FILENO);
+      dup2(*null_fd, STDOUT_FILENO);
+      dup2(*null_fd, STDERR_FILENO);
+    }
+    upload_pending_entries();
+    Logging::flush();
+
+    // Don't run any destructors or exit handlers of the original process.
+    _exit(EXIT_SUCCESS);
+  }
+#endif
+
+  upload_pending_entries();
+}
+
+void
+Storage::upload_pending_entries()
+{
+  MTR_BEGIN("secondary_storage", "secondary_storage_put");
+  Tracing::Span span("secondary_storage_put");
+  const size_t stored = m_secondary_storage->put_many(m_pending_uploads);
+  span.end();
+  MTR_END("secondary_storage", "secondary_storage_put");
+  LOG("Uploaded {} of {} entries to secondary storage",
+      stored,
+      m_pending_uploads.size());
+  m_pending_uploads.clear();
+}
+
+size_t
+Storage::prefetch(const std::vector<SecondaryStorage::Key>& keys,
+                  std::array<Counters, 16>& level_1_counter_updates)
+{
+  if (!m_secondary_storage || m_config.read_only()) {
+    return 0;
+  }
+
+  const time_t now = time(nullptr);
+  const auto negative_cache = get_negative_cache();
+  std::vector<SecondaryStorage::Key> missing_keys;
+  std::vector<PrimaryStorageFile> missing_files;
+  std::unordered_set<std::string> seen_paths;
+  for (const auto& key : keys) {
+    if (negative_cache
+        && negative_cache->is_missing(key.name, key.suffix, now)) {
+      continue;
+    }
+    auto file = look_up_primary_file(key.name, key.suffix);
+    if (!file.stat && seen_paths.insert(file.path).second) {
+      missing_keys.push_back(key);
+      missing_files.push_back(std::move(file));
+    }
+  }
+  if (missing_keys.empty()) {
+    return 0;
+  }
+
+  MTR_BEGIN("secondary_storage", "secondary_storage_get");
+  Tracing::Span span("secondary_storage_get");
+  const auto data = m_secondary_storage->get_many(missing_keys);
+  span.end();
+  MTR_END("secondary_storage", "secondary_storage_get");
+
+  size_t fetched = 0;
+  for (size_t i = 0; i < missing_keys.size(); ++i) {
+    auto& counter_updates =
+      level_1_counter_updates[missing_keys[i].name.bytes()[0] >> 4];
+    if (data[i]
+        && store_fetched_file(missing_files[i], *data[i], counter_updates)) {
+      ++fetched;
+    } else if (!data[i] && negative_cache) {
+      negative_cache->add(missing_keys[i].name,
+                          missing_keys[i].suffix,
+                          now + m_config.secondary_storage_miss_ttl());
+    }
+  }
+  return fetched;
+}
+
+uint8_t
+Storage::wanted_cache_level(uint64_t files_in_level_1)
+{
+  uint64_t files_per_directory = files_in_level_1 / 16;
+  for (uint8_t i = k_min_cache_levels; i <= k_max_cache_levels; ++i) {
+    if (files_per_directory < k_max_cache_files_per_directory) {
+      return i;
+    }
+    files_per_directory /= 16;
+  }
+  return k_max_cache_levels;
+}
+
+optional<uint8_t>
+Storage::read_cache_level(const std::string& subdir)
+{
+  std::string content;
+  try {
+    content = Util::read_file(FMT("{}/{}", subdir, k_level_file_name));
+  } catch (const Error&) {
+    return nullopt;
+  }
+  try {
+    const auto level = Util::parse_unsigned(
+      Util::strip_whitespace(content), k_min_cache_levels, k_max_cache_levels);
+    return static_cast<uint8_t>(level);
+  } catch (const Error& e) {
+    LOG("Ignoring cache level in {}: {}", subdir, e.what());
+    return nullopt;
+  }
+}
+
+void
+Storage::write_cache_level(const std::string& subdir, uint8_t level)
+{
+  Util::ensure_dir_exists(subdir);
+  AtomicFile file(FMT("{}/{}", subdir, k_level_file_name),
+                  AtomicFile::Mode::text);
+  file.write(FMT("{}\n", level));
+  file.commit();
+}
+
+void
+Storage::set_up_stripes(const Config& config)
+{
+  if (config.stripe_dirs().empty()) {
+    return;
+  }
+#ifdef _WIN32
+  LOG_RAW("Ignoring stripe_dirs since symbolic links are not supported");
+#else
+  const auto stripes =
+    Util::split_into_strings(config.stripe_dirs(), PATH_DELIM);
+  const auto get_target = [&](uint8_t subdir) {
+    return FMT("{}/{:x}", stripes[subdir % stripes.size()], subdir);
+  };
+
+  // The last subdirectory is linked last, so if it's in place, all are.
+  if (Util::read_link(FMT("{}/f", config.cache_dir())) == get_target(0xF)) {
+    return;
+  }
+
+  for (uint8_t subdir = 0; subdir <= 0xF; ++subdir) {
+    const auto link = FMT("{}/{:x}", config.cache_dir(), subdir);
+    const auto target = get_target(subdir);
+    if (Util::read_link(link) == target) {
+      continue;
+    }
+    if (!Util::create_dir(target) || !Util::create_dir(config.cache_dir())) {
+      LOG("Failed to create {}: {}", target, strerror(errno));
+      return;
+    }
+    if (symlink(target.c_str(), link.c_str()) != 0
+        // Another process may have created the same link.
+        && Util::read_link(link) != target) {
+      LOG("Not placing {} on {}: {}", link, target, strerror(errno));
+    }
+  }
+#endif
+}
+
+bool
+Storage::unpack_file(const std::string& cache_dir,
+                     const std::string& path,
+                     string_view data)
+{
+  try {
+    Util::ensure_dir_exists(Util::dir_name(path));
+    AtomicFile file(path, AtomicFile::Mode::binary);
+    file.write(data);
+    file.commit();
+  } catch (const Error& e) {
+    LOG("Failed to unpack {}: {}", path, e.what());
+    return false;
+  }
+  LruIndex::record_use(cache_dir, path);
+  LOG("Unpacked {}", path);
+  return true;
+}
+
+Storage::PrimaryStorageFile
+Storage::look_up_primary_file(const Digest& name, string_view suffix) const
+{
+  return look_up_primary_file(FMT("{}{}", name.to_string(), suffix));
+}
+
+Storage::PrimaryStorageFile
+Storage::look_up_primary_file(const std::string& name_string) const
+{
+  const auto recorded_level = get_recorded_cache_level(name_string[0]);
+  if (m_config.presence_filter()) {
+    const auto filter = get_presence_filter(name_string[0]);
+    if (filter && !filter->may_contain(name_string)) {
+      const auto path = Util::get_path_in_cache(
+        m_config.cache_dir(),
+        recorded_level ? *recorded_level : k_min_cache_levels,
+        name_string);
+      return {path, Stat()};
+    }
+  }
+  if (recorded_level) {
+    // All entries in the subdirectory are on the recorded level.
+    const auto path = Util::get_path_in_cache(
+      m_config.cache_dir(), *recorded_level, name_string);
+    return {path, Stat::stat(path)};
+  }
+
+  const auto hinted_path =
+    Util::get_path_in_cache(m_config.cache_dir(), m_level_hint, name_string);
+  const auto hinted_stat = Stat::stat(hinted_path);
+  if (hinted_stat) {
+    return {hinted_path, hinted_stat};
+  }
+
+  for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
+       ++level) {
+    if (level == m_level_hint) {
+      continue;
+    }
+    const auto path =
+      Util::get_path_in_cache(m_config.cache_dir(), level, name_string);
+    const auto stat = Stat::stat(path);
+    if (stat) {
+      m_level_hint = level;
+      return {path, stat};
+    }
+  }
+
+  const auto shallowest_path = Util::get_path_in_cache(
+    m_config.cache_dir(), k_min_cache_levels, name_string);
+  return {shallowest_path, Stat()};
+}
+
+optional<uint8_t>
+Storage::get_recorded_cache_level(char subdir) const
+{
+  const auto it = m_recorded_levels.find(subdir);
+  if (it != m_recorded_levels.end()) {
+    return it->second;
+  }
+  const auto level =
+    read_cache_level(FMT("{}/{}", m_config.cache_dir(), subdir));
+  m_recorded_levels.emplace(subdir, level);
+  return level;
+}
+
+PresenceFilter*
+Storage::get_presence_filter(char subdir) const
+{
+  auto it = m_presence_filters.find(subdir);
+  if (it == m_presence_filters.end()) {
+    it = m_presence_filters
+           .emplace(subdir,
+                    std::make_unique<PresenceFilter>(
+                      FMT("{}/{}", m_config.cache_dir(), subdir),
+                      m_config.presence_filter()))
+           .first;
+  }
+  return *it->second ? it->second.get() : nullptr;
+}
+
+void
+Storage::record_presence(const std::string& path) const
+{
+  // Existing filters are kept up to date even if presence_filter is disabled
+  // so that they can be trusted if it is enabled again.
+  const auto name = LruIndex::name_from_path(m_config.cache_dir(), path);
+  const auto filter = name.empty() ? nullptr : get_presence_filter(name[0]);
+  if (filter) {
+    filter->add(name);
+  }
+}
+
+void
+Storage::remove_duplicates(const std::string& path,
+                           Counters& counter_updates) const
+{
+  const auto name = LruIndex::name_from_path(m_config.cache_dir(), path);
+  if (name.empty() || get_recorded_cache_level(name[0])) {
+    return;
+  }
+  for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
+       ++level) {
+    const auto other_path =
+      Util::get_path_in_cache(m_config.cache_dir(), level, name);
+    if (other_path == path) {
+      continue;
+    }
+    const auto stat = Stat::stat(other_path);
+    if (stat && Util::unlink_safe(other_path)) {
+      LOG("Removed duplicate {}", other_path);
+      counter_updates.increment(Statistic::cache_size_kibibyte,
+                                Util::size_change_kibibyte(stat, Stat()));
+      counter_updates.increment(Statistic::files_in_cache, -1);
+    }
+  }
+}
+
+CacheBundle*
+Storage::get_pack(char subdir) const
+{
+  auto it = m_packs.find(subdir);
+  if (it == m_packs.end()) {
+    const auto path =
+      FMT("{}/{}/{}", m_config.cache_dir(), subdir, k_pack_file_name);
+    std::unique_ptr<CacheBundle> pack;
+    if (Stat::stat(path)) {
+      pack = std::make_unique<CacheBundle>(path);
+      if (!*pack) {
+        pack.reset();
+      }
+    }
+    it = m_packs.emplace(subdir, std::move(pack)).first;
+  }
+  return it->second.get();
+}
+
+bool
+Storage::get_from_pack(const Digest& name,
+                       string_view suffix,
+                       PrimaryStorageFile& file)
+{
+  // Packs are only searched if packing is enabled. Disabling it makes the next
+  // cleanup of each subdirectory unpack its entries.
+  if (m_config.pack_max_file_size() == 0) {
+    return false;
+  }
+  const auto name_string = FMT("{}{}", name.to_string(), suffix);
+  const auto pack = get_pack(name_string[0]);
+  if (!pack) {
+    return false;
+  }
+  const auto data = pack->get(name_string);
+  if (!data) {
+    return false;
+  }
+  if (m_config.read_only()) {
+    file.path = extract_bundled_file(*data);
+    LOG("Using {} from pack", file.path);
+    return true;
+  }
+  if (!unpack_file(m_config.cache_dir(), file.path, *data)) {
+    return false;
+  }
+  file.stat = Stat::stat(file.path, Stat::OnError::log);
+  record_presence(file.path);
+  return file.stat;
+}
+
+optional<Storage::LowerFile>
+Storage::look_up_lower_file(const Digest& name, string_view suffix)
+{
+  const auto name_string = FMT("{}{}", name.to_string(), suffix);
+  for (const auto& lower_cache : m_lower_caches) {
+    if (lower_cache.bundle) {
+      const auto data = lower_cache.bundle->get(name_string);
+      if (data) {
+        return LowerFile{lower_cache.path, data};
+      }
+      continue;
+    }
+    for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
+         ++level) {
+      auto path = Util::get_path_in_cache(lower_cache.path, level, name_string);
+      if (Stat::stat(path)) {
+        return LowerFile{std::move(path), nullopt};
+      }
+    }
+  }
+  return nullopt;
+}
+
+std::string
+Storage::extract_bundled_file(string_view data)
+{
+  TemporaryFile tmp_file(FMT("{}/tmp.bundled", m_config.temporary_dir()));
+  m_extracted_files.push_back(tmp_file.path);
+  Util::write_fd(*tmp_file.fd, data.data(), data.size());
+  return tmp_file.path;
+}
+
+bool
+Storage::get_from_lower_cache(const Digest& name,
+                              string_view suffix,
+                              PrimaryStorageFile& file,
+                              Counters& counter_updates)
+{
+  const auto lower_file = look_up_lower_file(name, suffix);
+  if (!lower_file) {
+    return false;
+  }
+  std::string data;
+  if (lower_file->bundled_data) {
+    data = std::string(*lower_file->bundled_data);
+  } else {
+    try {
+      data = Util::read_file(lower_file->path);
+    } catch (const Error& e) {
+      LOG("Failed to read {}: {}", lower_file->path, e.what());
+      return false;
+    }
+  }
+  return store_fetched_file(file, data, counter_updates, "lower cache");
+}
+
+bool
+Storage::get_from_peers(const Digest& name,
+                        string_view suffix,
+                        PrimaryStorageFile& file,
+                        Counters& counter_updates)
+{
+  if (m_config.read_only()) {
+    return false;
+  }
+  for (const auto& peer : m_peers) {
+    if (lookup_deadline_passed()) {
+      return false;
+    }
+    MTR_BEGIN("secondary_storage", "peer_get");
+    const auto data = peer->get(name, suffix);
+    MTR_END("secondary_storage", "peer_get");
+    if (data) {
+      return store_fetched_file(file, *data, counter_updates, "peer");
+    }
+  }
+  return false;
+}
+
+bool
+Storage::get_from_secondary_storage(const Digest& name,
+                                    string_view suffix,
+                                    PrimaryStorageFile& file,
+                                    Counters& counter_updates)
+{
+  if (!m_secondary_storage || m_config.read_only()
+      || lookup_deadline_passed()) {
+    return false;
+  }
+
+  const time_t now = time(nullptr);
+  const auto negative_cache = get_negative_cache();
+  if (negative_cache && negative_cache->is_missing(name, suffix, now)) {
+    LOG("Skipping secondary storage lookup of recently missing {}{}",
+        name.to_string(),
+        suffix);
+    return false;
+  }
+
+  MTR_BEGIN("secondary_storage", "secondary_storage_get");
+  Tracing::Span span("secondary_storage_get");
+  const auto data = m_secondary_storage->get(name, suffix);
+  span.end();
+  MTR_END("secondary_storage", "secondary_storage_get");
+  if (!data && negative_cache) {
+    negative_cache->add(
+      name, suffix, now + m_config.secondary_storage_miss_ttl());
+  }
+  return data && store_fetched_file(file, *data, counter_updates);
+}
+
+NegativeCache*
+Storage::get_negative_cache()
+{
+  if (m_config.secondary_storage_miss_ttl() == 0) {
+    return nullptr;
+  }
+  if (!m_negative_cache) {
+    m_negative_cache = std::make_unique<NegativeCache>(m_config.cache_dir());
+  }
+  return *m_negative_cache ? m_negative_cache.get() : nullptr;
+}
+
+bool
+Storage::store_fetched_file(PrimaryStorageFile& file,
+                            const std::string& data,
+                            Counters& counter_updates,
+                            string_view source)
+{
+  try {
+    Util::ensure_dir_exists(Util::dir_name(file.path));
+    AtomicFile atomic_file(file.path, AtomicFile::Mode::binary);
+    atomic_file.write(data);
+    atomic_file.commit();
+  } catch (const Error& e) {
+    LOG("Failed to store {}: {}", file.path, e.what());
+    return false;
+  }
+
+  file.stat = Stat::stat(file.path, Stat::OnError::log);
+  if (!file.stat) {
+    return false;
+  }
+  counter_updates.increment(Statistic::cache_size_kibibyte,
+                            Util::size_change_kibibyte(Stat(), file.stat));
+  counter_updates.increment(Statistic::files_in_cache, 1);
+  LruIndex::record_store(m_config.cache_dir(),
+                         file.path,
+                         file.stat.size_on_disk(),
+                         0,
+                         Statistics::namespace_tag(m_config.namespace_()));
+  record_presence(file.path);
+  remove_duplicates(file.path, counter_updates);
+
+  LOG("Fetched {} from {}", file.path, source);
+  return true;
+}
@@ -0,0 +1,319 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Digest.hpp"
+#include "SecondaryStorage.hpp"
+#include "Stat.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class CacheBundle;
+class Config;
+class Counters;
+class NegativeCache;
+class PresenceFilter;
+
+// Access to cache entries (results and manifests), identified by name and file
+// suffix.
+//
+// Entries live in the primary storage, i.e. the cache directory with its two
+// to four levels of subdirectories. Small entries that have not been used for a
+// while may instead be packed into one file per level 1 subdirectory by
+// cleanups, see pack_max_file_size; a packed entry is unpacked when it's used.
+// On other primary storage misses, the read-only
+// lower caches (other cache directories or bundles) are searched first, then
+// the caches of peer workstations and then the secondary storage, if
+// configured. New entries are uploaded to the secondary storage but never
+// written to lower caches or peers.
+// Counter updates for the size and number of files in the primary storage are
+// added to the `counter_updates` passed to the functions.
+//
+// Storage is not a pluggable backend layer. The primary storage is always a
+// cache directory: results refer to raw and shared files by path, entries are
+// hard linked, cloned or memory-mapped, and cleanup and recompression work on
+// the files. Other kinds of stores are added as SecondaryStorage backends,
+// which store entries as blobs and can batch requests (get_many and put_many).
+class Storage
+{
+public:
+  // Maximum files per cache directory. This constant is somewhat arbitrarily
+  // chosen to be large enough to avoid unnecessary cache levels but small
+  // enough not to make esoteric file systems (with bad performance for large
+  // directories) too slow. It could be made configurable, but hopefully there
+  // will be no need to do that.
+  static const uint64_t k_max_cache_files_per_directory = 2000;
+
+  // Minimum number of cache levels ($CCACHE_DIR/1/2/stored_file).
+  static const uint8_t k_min_cache_levels = 2;
+
+  // Maximum number of cache levels ($CCACHE_DIR/1/2/3/stored_file).
+  //
+  // On a cache miss, (k_max_cache_levels - k_min_cache_levels + 1) cache
+  // lookups (i.e. stat system calls) will be performed for a cache entry.
+  //
+  // An assumption made here is that if a cache is so large that it holds more
+  // than 16^4 * k_max_cache_files_per_directory files then we can assume that
+  // the file system is sane enough to handle more than
+  // k_max_cache_files_per_directory.
+  static const uint8_t k_max_cache_levels = 4;
+
+  // Name of the file in a level 1 cache subdirectory that records the cache
+  // level of all entries in the subdirectory, written when the subdirectory is
+  // rebalanced. Without it, entries may be on any level.
+  static const char k_level_file_name[];
+
+  // Name of the CacheBundle in a level 1 cache subdirectory that holds the
+  // packed entries of the subdirectory.
+  static const char k_pack_file_name[];
+
+  // Get the cache level wanted for a level 1 subdirectory with
+  // `files_in_level_1` files.
+  static uint8_t wanted_cache_level(uint64_t files_in_level_1);
+
+  // Get the cache level recorded in the level 1 subdirectory `subdir`, if any.
+  static nonstd::optional<uint8_t> read_cache_level(const std::string& subdir);
+
+  // Record that all entries in the level 1 subdirectory `subdir` are on cache
+  // level `level`.
+  static void write_cache_level(const std::string& subdir, uint8_t level);
+
+  // Place the level 1 subdirectories of the cache directory on the directories
+  // listed in stripe_dirs, subdirectory i on stripe i modulo the number of
+  // stripes, by replacing missing subdirectories with symbolic links. Since
+  // everything else reaches the subdirectories through the links, lookups,
+  // statistics and maintenance commands work unchanged and spread their I/O
+  // over the stripes. Existing subdirectories are left in place.
+  static void set_up_stripes(const Config& config);
+
+  // Store `data` of a packed entry as the primary storage file at `path` in
+  // `cache_dir` and record the use in the LRU index. The statistics are not
+  // updated since the entry is already counted. Returns false if the file could
+  // not be written.
+  static bool unpack_file(const std::string& cache_dir,
+                          const std::string& path,
+                          nonstd::string_view data);
+
+  Storage(const Config& config);
+  ~Storage();
+
+  // Set up stripes and secondary storage, if configured. Must be called after
+  // the configuration has been read.
+  void initialize();
+
+  // Get the path to the primary storage file for an entry, fetching it from
+  // the secondary storage on a primary storage miss. An entry found in a lower
+  // cache is copied to the primary storage if lower_cache_copy_up is set,
+  // otherwise the path in the lower cache (or of a temporary copy of an entry
+  // in a bundle, removed by the destructor) is returned. Returns nullopt if the
+  // entry doesn't exist.
+  nonstd::optional<std::string> get(const Digest& name,
+                                    nonstd::string_view suffix,
+                                    Counters& counter_updates);
+
+  // Create or update an entry by letting `entry_writer` write the primary
+  // storage file at the path it's given. If `share` is true, the entry is
+  // queued for upload to the secondary storage by `flush`. `cost` is recorded
+  // in the LRU index, see LruIndex::record_store. Returns false if
+  // `entry_writer` returned false or didn't produce a file.
+  bool put(const Digest& name,
+           nonstd::string_view suffix,
+           Counters& counter_updates,
+           const std::function<bool(const std::string& path)>& entry_writer,
+           bool share = true,
+           uint64_t cost = 0);
+
+  // Ask the kernel to start reading the primary storage file for an entry, if
+  // present, into the page cache so that a later `get` and read of it don't
+  // have to wait for the disk. Does not fetch from lower caches or secondary
+  // storage.
+  void readahead(const Digest& name, nonstd::string_view suffix) const;
+
+  // Store `data` as the primary storage file named `file_name` (entry name and
+  // suffix) unless it already exists, e.g. when importing a bundle. Returns
+  // whether the file was stored.
+  bool import_file(const std::string& file_name,
+                   nonstd::string_view data,
+                   Counters& counter_updates);
+
+  // Return whether an entry may exist, i.e. false only if it's missing in the
+  // primary storage and there are no lower caches, peers or secondary storage
+  // that could have it. Never fetches the entry.
+  bool may_contain(const Digest& name, nonstd::string_view suffix) const;
+
+  // Set the time after which `get` no longer searches lower caches, peers or
+  // the secondary storage, or nullopt for no limit. See lookup_timeout.
+  void set_lookup_deadline(
+    nonstd::optional<std::chrono::steady_clock::time_point> deadline);
+
+  // Return whether the deadline set with `set_lookup_deadline` has passed.
+  bool lookup_deadline_passed() const;
+
+  // Return the time left until the lookup deadline in microseconds, or
+  // UINT32_MAX if there is no deadline.
+  uint32_t lookup_time_left() const;
+
+  // Return whether `path` (as returned by `get`) is in the primary storage.
+  // Files in lower caches must not be modified, not even their mtime.
+  bool is_primary_path(const std::string& path) const;
+
+  // Remove an entry from the primary storage. The secondary storage is shared
+  // with other clients and is left alone.
+  void remove(const Digest& name, nonstd::string_view suffix);
+
+  // Upload entries queued by `put` to the secondary storage in one batch, in a
+  // detached child process if possible.
+  void flush();
+
+  // Fetch the entries in `keys` that are missing in the primary storage from
+  // the secondary storage in one batch. Counter updates are added to
+  // `level_1_counter_updates`, indexed by level 1 subdirectory. Returns the
+  // number of fetched entries.
+  size_t prefetch(const std::vector<SecondaryStorage::Key>& keys,
+                  std::array<Counters, 16>& level_1_counter_updates);
+
+private:
+  struct PrimaryStorageFile
+  {
+    std::string path;
+    Stat stat;
+  };
+
+  struct LowerCache
+  {
+    // Path of the cache directory or bundle.
+    std::string path;
+    // Mapped bundle, or nullptr for a cache directory.
+    std::unique_ptr<CacheBundle> bundle;
+  };
+
+  struct LowerFile
+  {
+    // Path of the file in a lower cache directory, or of the bundle.
+    std::string path;
+    // Data of the file if it is in a bundle.
+    nonstd::optional<nonstd::string_view> bundled_data;
+  };
+
+  const Config& m_config;
+  std::vector<LowerCache> m_lower_caches;
+  // Temporary copies of files in bundles returned by `get`.
+  std::vector<std::string> m_extracted_files;
+  std::unique_ptr<SecondaryStorage> m_secondary_storage;
+  std::vector<std::unique_ptr<SecondaryStorage>> m_peers;
+  std::unique_ptr<NegativeCache> m_negative_cache;
+  std::vector<SecondaryStorage::Entry> m_pending_uploads;
+  nonstd::optional<std::chrono::steady_clock::time_point> m_lookup_deadline;
+
+  // Cache level of the most recently found primary storage file. Entries
+  // looked up together, e.g. a manifest and its result, are normally stored
+  // on the same level, so this level is probed first. Stores remove copies on
+  // other levels so that the probe order doesn't matter.
+  mutable uint8_t m_level_hint = k_min_cache_levels;
+
+  // Cache levels recorded in level 1 subdirectories, by subdirectory name.
+  mutable std::unordered_map<char, nonstd::optional<uint8_t>>
+    m_recorded_levels;
+
+  // Mapped presence filters of level 1 subdirectories, by subdirectory name.
+  mutable std::unordered_map<char, std::unique_ptr<PresenceFilter>>
+    m_presence_filters;
+
+  // Mapped packs of level 1 subdirectories, by subdirectory name, or nullptr
+  // if a subdirectory has none.
+  mutable std::unordered_map<char, std::unique_ptr<CacheBundle>> m_packs;
+
+  PrimaryStorageFile look_up_primary_file(const Digest& name,
+                                          nonstd::string_view suffix) const;
+  PrimaryStorageFile look_up_primary_file(const std::string& file_name) const;
+
+  nonstd::optional<uint8_t> get_recorded_cache_level(char subdir) const;
+
+  // Get the presence filter of a level 1 subdirectory, or nullptr if it has
+  // none. The filter is created if presence_filter is enabled.
+  PresenceFilter* get_presence_filter(char subdir) const;
+
+  // Record that the primary storage file at `path` exists in the presence
+  // filter of its subdirectory, if any.
+  void record_presence(const std::string& path) const;
+
+  // Remove copies of the primary storage file at `path` on other cache levels
+  // of a subdirectory without a recorded level, since look_up_primary_file
+  // may find a deeper copy before a shallower one.
+  void remove_duplicates(const std::string& path,
+                         Counters& counter_updates) const;
+
+  // Find an entry in the lower caches. Returns the first match.
+  nonstd::optional<LowerFile> look_up_lower_file(const Digest& name,
+                                                 nonstd::string_view suffix);
+
+  // Get the pack of a level 1 subdirectory, or nullptr if it has none.
+  CacheBundle* get_pack(char subdir) const;
+
+  // Unpack an entry from the pack of its subdirectory to `file`.
+  bool get_from_pack(const Digest& name,
+                     nonstd::string_view suffix,
+                     PrimaryStorageFile& file);
+
+  // Write the data of a file in a bundle to a temporary file and return its
+  // path.
+  std::string extract_bundled_file(nonstd::string_view data);
+
+  bool get_from_lower_cache(const Digest& name,
+                            nonstd::string_view suffix,
+                            PrimaryStorageFile& file,
+                            Counters& counter_updates);
+
+  // Upload the entries queued by `put` to the secondary storage and clear the
+  // queue.
+  void upload_pending_entries();
+
+  // Fetch an entry from the first peer that has it.
+  bool get_from_peers(const Digest& name,
+                      nonstd::string_view suffix,
+                      PrimaryStorageFile& file,
+                      Counters& counter_updates);
+
+  // Get the record of entries recently missing in the secondary storage, or
+  // nullptr if secondary_storage_miss_ttl is 0.
+  NegativeCache* get_negative_cache();
+
+  bool get_from_secondary_storage(const Digest& name,
+                                  nonstd::string_view suffix,
+                                  PrimaryStorageFile& file,
+                                  Counters& counter_updates);
+
+  // Store `data` fetched from the secondary storage, a peer, a lower cache or a
+  // bundle in `file`.
+  bool store_fetched_file(PrimaryStorageFile& file,
+                          const std::string& data,
+                          Counters& counter_updates,
+                          nonstd::string_view source = "secondary storage");
+};
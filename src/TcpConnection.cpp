@@ -0,0 +1,388 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "TcpConnection.hpp"
+
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using nonstd::nullopt;
+using nonstd::optional;
+using nonstd::string_view;
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+const int k_send_flags = MSG_NOSIGNAL;
+#else
+const int k_send_flags = 0;
+#endif
+
+// Return whether `error` means that a non-blocking operation would block.
+bool
+would_block(int error)
+{
+#if EAGAIN != EWOULDBLOCK
+  if (error == EWOULDBLOCK) {
+    return true;
+  }
+#endif
+  return error == EAGAIN;
+}
+
+int
+milliseconds_left(TcpConnection::Clock::time_point deadline)
+{
+  const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - TcpConnection::Clock::now())
+                      .count();
+  return left > 0 ? static_cast<int>(left) : 0;
+}
+
+// Wait until `fd` is ready for `events`. Returns false (with errno set) on
+// timeout or error.
+bool
+wait_for(int fd, short events, TcpConnection::Clock::time_point deadline)
+{
+  while (true) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    const int result = poll(&pfd, 1, milliseconds_left(deadline));
+    if (result > 0) {
+      // Errors and hangups are reported by the following read or send call.
+      return true;
+    } else if (result == 0) {
+      errno = ETIMEDOUT;
+      return false;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+struct Resolution
+{
+  std::mutex mutex;
+  std::condition_variable done_condition;
+  bool done = false;
+  bool abandoned = false;
+  int result = 0;
+  addrinfo* addresses = nullptr;
+};
+
+// Like getaddrinfo, but give up at `deadline`. Returns nullopt on timeout.
+optional<int>
+resolve(const std::string& host,
+        const std::string& port,
+        const addrinfo& hints,
+        TcpConnection::Clock::time_point deadline,
+        addrinfo** addresses)
+{
+  // Addresses don't need a lookup.
+  addrinfo numeric_hints = hints;
+  numeric_hints.ai_flags |= AI_NUMERICHOST;
+  const int result =
+    getaddrinfo(host.c_str(), port.c_str(), &numeric_hints, addresses);
+  if (result != EAI_NONAME) {
+    return result;
+  }
+
+  // getaddrinfo can't be interrupted, so look up names on a detached thread
+  // that frees the result itself if it arrives after the deadline.
+  const auto resolution = std::make_shared<Resolution>();
+  std::thread([resolution, host, port, hints] {
+    addrinfo* thread_addresses;
+    const int thread_result =
+      getaddrinfo(host.c_str(), port.c_str(), &hints, &thread_addresses);
+    std::lock_guard<std::mutex> lock(resolution->mutex);
+    if (resolution->abandoned) {
+      if (thread_result == 0) {
+        freeaddrinfo(thread_addresses);
+      }
+      return;
+    }
+    resolution->done = true;
+    resolution->result = thread_result;
+    resolution->addresses = thread_addresses;
+    resolution->done_condition.notify_one();
+  }).detach();
+
+  std::unique_lock<std::mutex> lock(resolution->mutex);
+  if (!resolution->done_condition.wait_until(
+        lock, deadline, [&] { return resolution->done; })) {
+    resolution->abandoned = true;
+    return nullopt;
+  }
+  *addresses = resolution->addresses;
+  return resolution->result;
+}
+
+void
+set_up_socket(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  // A copy in a concurrently started compiler would keep the connection open.
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+  const int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+} // namespace
+
+TcpConnection::TcpConnection(Fd&& fd) : m_fd(std::move(fd))
+{
+}
+
+TcpConnection
+TcpConnection::connect(const std::string& host,
+                       const std::string& port,
+                       Clock::time_point deadline)
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo* addresses;
+  const auto result = resolve(host, port, hints, deadline, &addresses);
+  if (!result) {
+    LOG("Timed out resolving {}", host);
+    return TcpConnection();
+  } else if (*result != 0) {
+    LOG("Failed to resolve {}: {}", host, gai_strerror(*result));
+    return TcpConnection();
+  }
+
+  Fd fd;
+  for (addrinfo* address = addresses; address && !fd;
+       address = address->ai_next) {
+    Fd candidate(
+      socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+    if (!candidate) {
+      continue;
+    }
+    set_up_socket(*candidate);
+
+    if (::connect(*candidate, address->ai_addr, address->ai_addrlen) != 0) {
+      if (errno != EINPROGRESS || !wait_for(*candidate, POLLOUT, deadline)) {
+        continue;
+      }
+      int error = 0;
+      socklen_t length = sizeof(error);
+      if (getsockopt(*candidate, SOL_SOCKET, SO_ERROR, &error, &length) != 0
+          || error != 0) {
+        errno = error;
+        continue;
+      }
+    }
+    fd = std::move(candidate);
+  }
+  freeaddrinfo(addresses);
+
+  if (!fd) {
+    LOG("Failed to connect to {}:{}: {}", host, port, strerror(errno));
+  }
+  return TcpConnection(std::move(fd));
+}
+
+Fd
+TcpConnection::listen(const std::string& host, const std::string& port)
+{
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo* addresses;
+  const int result = getaddrinfo(
+    host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &addresses);
+  if (result != 0) {
+    LOG("Failed to resolve {}: {}", host, gai_strerror(result));
+    return Fd();
+  }
+
+  Fd fd;
+  for (addrinfo* address = addresses; address && !fd;
+       address = address->ai_next) {
+    Fd candidate(
+      socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+    if (!candidate) {
+      continue;
+    }
+    fcntl(*candidate, F_SETFD, FD_CLOEXEC);
+    const int one = 1;
+    setsockopt(*candidate, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(*candidate, address->ai_addr, address->ai_addrlen) == 0
+        && ::listen(*candidate, SOMAXCONN) == 0) {
+      fd = std::move(candidate);
+    }
+  }
+  freeaddrinfo(addresses);
+
+  if (!fd) {
+    LOG("Failed to listen on {}:{}: {}", host, port, strerror(errno));
+  }
+  return fd;
+}
+
+std::string
+TcpConnection::get_local_port(int fd)
+{
+  sockaddr_storage address;
+  socklen_t length = sizeof(address);
+  if (getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+    return "";
+  }
+  if (address.ss_family == AF_INET6) {
+    return FMT("{}",
+               ntohs(reinterpret_cast<sockaddr_in6*>(&address)->sin6_port));
+  }
+  return FMT("{}", ntohs(reinterpret_cast<sockaddr_in*>(&address)->sin_port));
+}
+
+TcpConnection
+TcpConnection::accept(int listen_fd)
+{
+  Fd fd;
+  do {
+    fd = Fd(::accept(listen_fd, nullptr, nullptr));
+  } while (!fd && errno == EINTR);
+  if (fd) {
+    set_up_socket(*fd);
+  }
+  return TcpConnection(std::move(fd));
+}
+
+bool
+TcpConnection::send(string_view data, Clock::time_point deadline)
+{
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const auto result =
+      ::send(*m_fd, data.data() + sent, data.size() - sent, k_send_flags);
+    if (result >= 0) {
+      sent += result;
+    } else if (would_block(errno)) {
+      if (!wait_for(*m_fd, POLLOUT, deadline)) {
+        return false;
+      }
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+optional<size_t>
+TcpConnection::receive(std::string& data, Clock::time_point deadline)
+{
+  char buffer[16384];
+  while (true) {
+    const auto result = read(*m_fd, buffer, sizeof(buffer));
+    if (result >= 0) {
+      data.append(buffer, result);
+      return result;
+    } else if (would_block(errno)) {
+      if (!wait_for(*m_fd, POLLIN, deadline)) {
+        return nullopt;
+      }
+    } else if (errno != EINTR) {
+      return nullopt;
+    }
+  }
+}
+
+bool
+TcpConnection::receive_all(std::string& data, Clock::time_point deadline)
+{
+  while (true) {
+    const auto result = receive(data, deadline);
+    if (!result) {
+      return false;
+    } else if (*result == 0) {
+      return true;
+    }
+  }
+}
+
+void
+TcpConnection::close()
+{
+  m_fd.close();
+}
+
+optional<std::pair<std::string, std::string>>
+TcpConnection::parse_host_and_port(string_view authority,
+                                   string_view default_port)
+{
+  string_view host;
+  string_view port;
+  if (Util::starts_with(authority, "[")) {
+    // IPv6 address literal.
+    const auto bracket = authority.find(']');
+    if (bracket == string_view::npos) {
+      return nullopt;
+    }
+    host = authority.substr(1, bracket - 1);
+    const auto after = authority.substr(bracket + 1);
+    if (!after.empty()) {
+      if (after[0] != ':') {
+        return nullopt;
+      }
+      port = after.substr(1);
+    }
+  } else {
+    const auto colon = authority.find(':');
+    host = authority.substr(0, colon);
+    if (colon != string_view::npos) {
+      port = authority.substr(colon + 1);
+    }
+  }
+  if (host.empty()) {
+    return nullopt;
+  }
+
+  if (port.empty()) {
+    port = default_port;
+  } else {
+    try {
+      Util::parse_unsigned(std::string(port), 1, 65535, "port");
+    } catch (const Error&) {
+      return nullopt;
+    }
+  }
+
+  return std::make_pair(std::string(host), std::string(port));
+}
@@ -0,0 +1,93 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Fd.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+// A TCP connection where each operation must finish before a deadline. Used by
+// secondary storage backends so that a slow server can't stall a compilation
+// for longer than the configured timeout.
+class TcpConnection
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  TcpConnection() = default;
+
+  // Connect to `host` and `port`, resolving `host` before `deadline` too.
+  // Returns an unconnected object (and logs the reason) on failure.
+  static TcpConnection connect(const std::string& host,
+                               const std::string& port,
+                               Clock::time_point deadline);
+
+  // Listen for connections on `host` and `port`. Returns an invalid Fd (and
+  // logs the reason) on failure.
+  static Fd listen(const std::string& host, const std::string& port);
+
+  // Return the port that the socket `fd` is bound to, or the empty string on
+  // failure.
+  static std::string get_local_port(int fd);
+
+  // Wait for a connection on the listening socket `listen_fd` and accept it.
+  // Returns an unconnected object (with errno set) on failure.
+  static TcpConnection accept(int listen_fd);
+
+  explicit operator bool() const;
+
+  // Send all of `data`. Returns false (with errno set) on failure.
+  bool send(nonstd::string_view data, Clock::time_point deadline);
+
+  // Receive at least one byte and append it to `data`. Returns the number of
+  // appended bytes, 0 if the peer has closed the connection or nullopt (with
+  // errno set) on failure.
+  nonstd::optional<size_t> receive(std::string& data,
+                                   Clock::time_point deadline);
+
+  // Receive until the peer closes the connection. Returns false (with errno
+  // set) on failure.
+  bool receive_all(std::string& data, Clock::time_point deadline);
+
+  void close();
+
+  // Split `authority` on the form "host[:port]" or "[ipv6-address][:port]"
+  // into host and port, using `default_port` if there is no port. Returns
+  // nullopt if `authority` is malformed.
+  static nonstd::optional<std::pair<std::string, std::string>>
+  parse_host_and_port(nonstd::string_view authority,
+                      nonstd::string_view default_port);
+
+private:
+  Fd m_fd;
+
+  explicit TcpConnection(Fd&& fd);
+};
+
+inline TcpConnection::operator bool() const
+{
+  return static_cast<bool>(m_fd);
+}
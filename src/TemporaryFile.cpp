@@ -56,3 +56,9 @@ TemporaryFile::TemporaryFile(string_view path_prefix)
   fchmod(*fd, 0666 & ~get_umask());
 #endif
 }
+
+TemporaryFile::TemporaryFile(Fd&& fd_, std::string path_)
+  : fd(std::move(fd_)),
+    path(std::move(path_))
+{
+}
@@ -34,6 +34,9 @@ public:
   //  the directory will be created if possible.`
   TemporaryFile(nonstd::string_view path_prefix);
 
+  // Adopt an already created file.
+  TemporaryFile(Fd&& fd_, std::string path_);
+
   TemporaryFile(TemporaryFile&& other) noexcept = default;
 
   // Note: Should be declared noexcept, but since GCC 4.8 trips on it, don't do
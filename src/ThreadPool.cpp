@@ -18,6 +18,9 @@
 
 #include "ThreadPool.hpp"
 
+#include <algorithm>
+#include <atomic>
+
 ThreadPool::ThreadPool(size_t number_of_threads, size_t task_queue_max_size)
   : m_task_queue_max_size(task_queue_max_size)
 {
@@ -33,19 +36,94 @@ ThreadPool::~ThreadPool()
 }
 
 void
-ThreadPool::enqueue(std::function<void()> function)
+ThreadPool::enqueue(std::function<void()> function, Priority priority)
 {
   {
     std::unique_lock<std::mutex> lock(m_mutex);
-    if (m_task_queue.size() >= m_task_queue_max_size) {
-      m_task_popped_condition.wait(
-        lock, [this] { return m_task_queue.size() < m_task_queue_max_size; });
+    if (priority == Priority::high) {
+      m_high_priority_task_queue.emplace(std::move(function));
+    } else {
+      if (m_task_queue.size() >= m_task_queue_max_size) {
+        m_task_popped_condition.wait(
+          lock, [this] { return m_task_queue.size() < m_task_queue_max_size; });
+      }
+      m_task_queue.emplace(std::move(function));
     }
-    m_task_queue.emplace(function);
   }
   m_task_enqueued_or_shutting_down_condition.notify_one();
 }
 
+bool
+ThreadPool::for_each_index(size_t count,
+                           const std::function<bool(size_t)>& function,
+                           size_t max_helpers)
+{
+  std::atomic<size_t> next_index(0);
+  std::atomic<bool> cancelled(false);
+  std::mutex mutex;
+  std::condition_variable finished_condition;
+  size_t finished_helpers = 0;
+
+  const auto run = [&] {
+    while (!cancelled) {
+      const size_t index = next_index++;
+      if (index >= count) {
+        break;
+      }
+      if (!function(index)) {
+        cancelled = true;
+      }
+    }
+  };
+
+  const size_t helpers =
+    count > 1 ? std::min({m_worker_threads.size(), max_helpers, count - 1})
+              : 0;
+  // The caller is waiting, so don't let the helpers queue up behind
+  // background work.
+  for (size_t i = 0; i < helpers; ++i) {
+    enqueue(
+      [&] {
+        run();
+        std::unique_lock<std::mutex> lock(mutex);
+        ++finished_helpers;
+        finished_condition.notify_one();
+      },
+      Priority::high);
+  }
+
+  run();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  finished_condition.wait(lock, [&] { return finished_helpers == helpers; });
+  return !cancelled;
+}
+
+void
+ThreadPool::wait_all()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_worker_threads.empty()) {
+    // Nobody else will run the tasks.
+    while (!m_high_priority_task_queue.empty() || !m_task_queue.empty()) {
+      auto& queue = m_high_priority_task_queue.empty()
+                      ? m_task_queue
+                      : m_high_priority_task_queue;
+      auto task = std::move(queue.front());
+      queue.pop();
+      lock.unlock();
+      m_task_popped_condition.notify_all();
+      task();
+      lock.lock();
+    }
+    return;
+  }
+  m_idle_condition.wait(lock, [this] {
+    return m_task_queue.empty() && m_high_priority_task_queue.empty()
+           && m_running_tasks == 0;
+  });
+}
+
 void
 ThreadPool::shut_down()
 {
@@ -69,16 +147,29 @@ ThreadPool::worker_thread_main()
 
     {
       std::unique_lock<std::mutex> lock(m_mutex);
-      m_task_enqueued_or_shutting_down_condition.wait(
-        lock, [this] { return m_shutting_down || !m_task_queue.empty(); });
-      if (m_shutting_down && m_task_queue.empty()) {
-        return;
+      m_task_enqueued_or_shutting_down_condition.wait(lock, [this] {
+        return m_shutting_down || !m_task_queue.empty()
+               || !m_high_priority_task_queue.empty();
+      });
+      if (!m_high_priority_task_queue.empty()) {
+        task = std::move(m_high_priority_task_queue.front());
+        m_high_priority_task_queue.pop();
+      } else if (!m_task_queue.empty()) {
+        task = std::move(m_task_queue.front());
+        m_task_queue.pop();
+      } else {
+        return; // Shutting down.
       }
-      task = std::move(m_task_queue.front());
-      m_task_queue.pop();
+      ++m_running_tasks;
     }
 
     m_task_popped_condition.notify_all();
     task();
+
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      --m_running_tasks;
+    }
+    m_idle_condition.notify_all();
   }
 }
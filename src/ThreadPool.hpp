@@ -22,30 +22,88 @@
 
 #include <condition_variable>
 #include <functional>
+#include <future>
 #include <limits>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <type_traits>
 
 class ThreadPool
 {
 public:
+  enum class Priority {
+    // Background work.
+    normal,
+    // Work that someone is waiting for. Started before all normal priority
+    // tasks and not subject to `task_queue_max_size`.
+    high,
+  };
+
   explicit ThreadPool(
     size_t number_of_threads,
     size_t task_queue_max_size = std::numeric_limits<size_t>::max());
   ~ThreadPool();
 
-  void enqueue(std::function<void()> function);
+  void enqueue(std::function<void()> function,
+               Priority priority = Priority::normal);
+
+  // Like `enqueue` but return a future for the return value (or exception) of
+  // `function`.
+  template<typename F>
+  std::future<typename std::result_of<F()>::type>
+  submit(F function, Priority priority = Priority::normal);
+
+  // Wait until all enqueued tasks have finished. The pool can be used again
+  // afterwards. A pool without worker threads runs the tasks on the calling
+  // thread.
+  void wait_all();
+
   void shut_down();
 
+  // Call `function` for each index in [0, `count`) on the calling thread and
+  // at most `max_helpers` of the pool's worker threads, and wait for the calls
+  // to finish. No new calls are started after a call has returned false.
+  // Returns false if any call returned false, otherwise true.
+  bool for_each_index(
+    size_t count,
+    const std::function<bool(size_t)>& function,
+    size_t max_helpers = std::numeric_limits<size_t>::max());
+
+  size_t number_of_threads() const;
+
 private:
   std::vector<std::thread> m_worker_threads;
   std::queue<std::function<void()>> m_task_queue;
+  std::queue<std::function<void()>> m_high_priority_task_queue;
   size_t m_task_queue_max_size;
+  size_t m_running_tasks = 0;
   bool m_shutting_down = false;
   std::mutex m_mutex;
   std::condition_variable m_task_enqueued_or_shutting_down_condition;
   std::condition_variable m_task_popped_condition;
+  std::condition_variable m_idle_condition;
 
   void worker_thread_main();
 };
+
+inline size_t
+ThreadPool::number_of_threads() const
+{
+  return m_worker_threads.size();
+}
+
+template<typename F>
+inline std::future<typename std::result_of<F()>::type>
+ThreadPool::submit(F function, Priority priority)
+{
+  using Result = typename std::result_of<F()>::type;
+
+  // std::function requires a copyable target, so share the packaged task.
+  const auto task =
+    std::make_shared<std::packaged_task<Result()>>(std::move(function));
+  auto future = task->get_future();
+  enqueue([task] { (*task)(); }, priority);
+  return future;
+}
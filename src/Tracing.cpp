@@ -0,0 +1,206 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Tracing.hpp"
+
+#include "Config.hpp"
+#include "File.hpp"
+#include "Lockfile.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <vector>
+
+using nonstd::string_view;
+
+namespace {
+
+// Spans beyond this many overwrite the oldest ones.
+const size_t k_max_events = 4096;
+
+struct Event
+{
+  const char* name;
+  std::string detail;
+  uint64_t start;
+  uint64_t duration;
+  uint32_t thread;
+};
+
+bool tracing_enabled = false;
+std::string trace_file_path;
+
+// Start of the invocation in microseconds since the epoch.
+uint64_t start_time;
+
+// Ring buffer of recorded spans.
+std::mutex events_mutex;
+std::vector<Event> events;
+uint64_t recorded_events = 0;
+
+std::atomic<uint32_t> next_thread_id(0);
+
+uint64_t
+now()
+{
+  // Use wall clock time so that spans from different processes line up.
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+uint32_t
+thread_id()
+{
+  thread_local const uint32_t id = next_thread_id++;
+  return id;
+}
+
+} // namespace
+
+namespace Tracing {
+
+void
+init(const Config& config)
+{
+  if (config.trace_file().empty()) {
+    return;
+  }
+  if (config.trace_sample_rate() < 1.0) {
+    std::mt19937 random_engine(std::random_device{}());
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(random_engine)
+        >= config.trace_sample_rate()) {
+      return;
+    }
+  }
+
+  trace_file_path = config.trace_file();
+  start_time = now();
+  thread_id(); // Make the calling (main) thread number 0.
+  events.reserve(k_max_events);
+  tracing_enabled = true;
+}
+
+bool
+enabled()
+{
+  return tracing_enabled;
+}
+
+void
+flush(string_view invocation)
+{
+  if (!tracing_enabled) {
+    return;
+  }
+
+  const uint64_t end_time = now();
+  const auto pid = static_cast<uint64_t>(getpid());
+
+  std::lock_guard<std::mutex> lock(events_mutex);
+
+  const uint64_t dropped = recorded_events - events.size();
+  std::string data;
+  data += FMT(
+    "{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},"
+    "\"args\":{{\"name\":\"{}\"}}}},\n",
+    pid,
+    Util::escape_json(invocation));
+  data += FMT(
+    "{{\"name\":\"ccache\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":{},"
+    "\"tid\":0,\"args\":{{\"invocation\":\"{}\",\"dropped_spans\":{}}}}},\n",
+    start_time,
+    end_time - start_time,
+    pid,
+    Util::escape_json(invocation),
+    dropped);
+  for (const auto& event : events) {
+    data += FMT(
+      "{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":{},"
+      "\"tid\":{}",
+      event.name,
+      event.start,
+      event.duration,
+      pid,
+      event.thread);
+    if (!event.detail.empty()) {
+      data += FMT(",\"args\":{{\"detail\":\"{}\"}}",
+                  Util::escape_json(event.detail));
+    }
+    data += "},\n";
+  }
+
+  // The lock makes sure that only the first writer starts the JSON array and
+  // that output from concurrent invocations isn't interleaved.
+  Lockfile lockfile(trace_file_path);
+  if (!lockfile.acquired()) {
+    LOG("Failed to lock {}", trace_file_path);
+    return;
+  }
+  File file(trace_file_path, "ab");
+  if (!file) {
+    LOG("Failed to open {}: {}", trace_file_path, strerror(errno));
+    return;
+  }
+  fseek(*file, 0, SEEK_END);
+  if (ftell(*file) == 0) {
+    data.insert(0, "[\n");
+  }
+  if (fwrite(data.data(), data.size(), 1, *file) != 1) {
+    LOG("Failed to write to {}: {}", trace_file_path, strerror(errno));
+  }
+}
+
+Span::Span(const char* name, string_view detail) : m_name(name)
+{
+  if (tracing_enabled) {
+    m_detail = std::string(detail);
+    m_start = now();
+  }
+}
+
+Span::~Span()
+{
+  end();
+}
+
+void
+Span::end()
+{
+  if (m_start == 0) {
+    return;
+  }
+  Event event{
+    m_name, std::move(m_detail), m_start, now() - m_start, thread_id()};
+
+  std::lock_guard<std::mutex> lock(events_mutex);
+  if (events.size() < k_max_events) {
+    events.push_back(std::move(event));
+  } else {
+    events[recorded_events % k_max_events] = std::move(event);
+  }
+  ++recorded_events;
+  m_start = 0;
+}
+
+} // namespace Tracing
@@ -0,0 +1,67 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+class Config;
+
+// Low-overhead tracing of ccache invocations, enabled at runtime with the
+// trace_file option. Spans are kept in a fixed-size ring buffer in memory and
+// are appended to the trace file in Chrome's Trace Event Format when the
+// invocation finishes, so that the traces of all invocations in a build end up
+// in one file.
+namespace Tracing {
+
+// Start tracing if trace_file is set and this invocation is selected according
+// to trace_sample_rate. Must be called once before creating spans.
+void init(const Config& config);
+
+// Return whether this invocation is traced.
+bool enabled();
+
+// Append the recorded spans and a span for the whole invocation, named by
+// `invocation`, to the trace file.
+void flush(nonstd::string_view invocation);
+
+// Records the time from construction to destruction if tracing is enabled.
+class Span : NonCopyable
+{
+public:
+  // `name` must outlive the span, e.g. be a string literal. `detail`, e.g. a
+  // path, is only copied if tracing is enabled.
+  explicit Span(const char* name, nonstd::string_view detail = {});
+  ~Span();
+
+  // Record the span now instead of when destructed.
+  void end();
+
+private:
+  const char* const m_name;
+  std::string m_detail;
+  uint64_t m_start = 0; // 0 when not tracing.
+};
+
+} // namespace Tracing
@@ -22,8 +22,14 @@
 #include "Context.hpp"
 #include "Fd.hpp"
 #include "FormatNonstdStringView.hpp"
+#include "Jobserver.hpp"
 #include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "PresenceFilter.hpp"
+#include "SharedCounters.hpp"
+#include "Storage.hpp"
 #include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 
 extern "C" {
@@ -32,6 +38,7 @@ extern "C" {
 
 #include <algorithm>
 #include <fstream>
+#include <numeric>
 
 #ifndef HAVE_DIRENT_H
 #  include <filesystem>
@@ -58,6 +65,8 @@ extern "C" {
 #endif
 
 #ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
 #  ifdef HAVE_SYS_IOCTL_H
 #    include <sys/ioctl.h>
 #  endif
@@ -71,6 +80,7 @@ extern "C" {
 #endif
 
 #ifdef __APPLE__
+#  include <copyfile.h>
 #  ifdef HAVE_SYS_CLONEFILE_H
 #    include <sys/clonefile.h>
 #    ifdef CLONE_NOOWNERCOPY
@@ -85,6 +95,8 @@ using nonstd::string_view;
 
 namespace {
 
+const uint64_t k_min_size_for_preallocation = 1024 * 1024;
+
 // Search for the first match of the following regular expression:
 //
 //   \x1b\[[\x30-\x3f]*[\x20-\x2f]*[Km]
@@ -199,6 +211,166 @@ rewrite_stderr_to_absolute_paths(string_view text)
   return result;
 }
 
+#ifdef HAVE_DIRENT_H
+
+using DirEntryVisitor =
+  std::function<void(const char* name, unsigned char type)>;
+
+// Call `visitor` with the name and type (a DT_* value, possibly DT_UNKNOWN) of
+// each entry except "." and ".." in the directory open as `dir_fd`. Returns
+// false with errno set on error.
+bool
+read_dir_entries(int dir_fd, const DirEntryVisitor& visitor)
+{
+#  if defined(__linux__) && defined(SYS_getdents64)
+  // Read entries in large batches straight from the kernel, bypassing the
+  // small buffer used by readdir. The layout of struct linux_dirent64 is
+  // d_ino (8 bytes), d_off (8 bytes), d_reclen (2 bytes), d_type (1 byte) and
+  // d_name (NUL-terminated).
+  const size_t d_reclen_offset = 16;
+  const size_t d_type_offset = 18;
+  const size_t d_name_offset = 19;
+  const size_t buffer_size = 64 * 1024;
+  std::unique_ptr<char[]> buffer(new char[buffer_size]);
+
+  while (true) {
+    const long n = syscall(SYS_getdents64, dir_fd, buffer.get(), buffer_size);
+    if (n < 0) {
+      return false;
+    }
+    if (n == 0) {
+      return true;
+    }
+    for (long pos = 0; pos < n;) {
+      const char* entry = buffer.get() + pos;
+      uint16_t reclen;
+      memcpy(&reclen, entry + d_reclen_offset, sizeof(reclen));
+      pos += reclen;
+
+      const char* name = entry + d_name_offset;
+      if (strcmp(name, "") == 0 || strcmp(name, ".") == 0
+          || strcmp(name, "..") == 0) {
+        continue;
+      }
+      visitor(name, static_cast<unsigned char>(entry[d_type_offset]));
+    }
+  }
+#  else
+  // fdopendir takes ownership of the descriptor, so give it a copy.
+  DIR* dir = fdopendir(dup(dir_fd));
+  if (!dir) {
+    return false;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir))) {
+    if (strcmp(entry->d_name, "") == 0 || strcmp(entry->d_name, ".") == 0
+        || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+#    ifdef _DIRENT_HAVE_D_TYPE
+    visitor(entry->d_name, entry->d_type);
+#    else
+    visitor(entry->d_name, DT_UNKNOWN);
+#    endif
+  }
+  closedir(dir);
+  return true;
+#  endif
+}
+
+// Like Util::traverse, but also pass the file descriptor of the directory that
+// contains `path` and the name of `path` relative to it to `visitor`, so that
+// the visitor can stat files without resolving the whole path again.
+using TraverseAtVisitor = std::function<void(
+  const std::string& path, bool is_dir, int dir_fd, const char* name)>;
+
+void
+traverse_at(int parent_fd,
+            const char* name,
+            const std::string& path,
+            const TraverseAtVisitor& visitor)
+{
+  Fd dir_fd(openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (!dir_fd) {
+    if (errno == ENOTDIR) {
+      visitor(path, false, parent_fd, name);
+      return;
+    }
+    throw Error("failed to open directory {}: {}", path, strerror(errno));
+  }
+
+  const bool ok =
+    read_dir_entries(*dir_fd, [&](const char* entry_name, unsigned char type) {
+      std::string entry_path = path + "/" + entry_name;
+      bool is_dir;
+      if (type != DT_UNKNOWN) {
+        is_dir = type == DT_DIR;
+      } else {
+        auto stat = Stat::lstat_at(*dir_fd, entry_name);
+        if (!stat) {
+          if (stat.error_number() == ENOENT || stat.error_number() == ESTALE) {
+            return;
+          }
+          throw Error("failed to lstat {}: {}",
+                      entry_path,
+                      strerror(stat.error_number()));
+        }
+        is_dir = stat.is_directory();
+      }
+      if (is_dir) {
+        traverse_at(*dir_fd, entry_name, entry_path, visitor);
+      } else {
+        visitor(entry_path, false, *dir_fd, entry_name);
+      }
+    });
+  if (!ok) {
+    throw Error("failed to read directory {}: {}", path, strerror(errno));
+  }
+  visitor(path, true, parent_fd, name);
+}
+
+#endif
+
+// Compute the relative form of the absolute `path`, or return `path` unmodified
+// if no relative path refers to the same file.
+std::string
+make_relative_path_uncached(const Context& ctx, string_view path)
+{
+  // The algorithm for computing relative paths below only works for existing
+  // paths. If the path doesn't exist, find the first ancestor directory that
+  // does exist and assemble the path again afterwards.
+  string_view original_path = path;
+  std::string path_suffix;
+  Stat path_stat;
+  while (!(path_stat = Stat::stat(std::string(path)))) {
+    path = Util::dir_name(path);
+  }
+  path_suffix = std::string(original_path.substr(path.length()));
+
+  std::string path_str(path);
+  std::string normalized_path = Util::normalize_absolute_path(path_str);
+  std::vector<std::string> relpath_candidates = {
+    Util::get_relative_path(ctx.actual_cwd, normalized_path),
+  };
+  if (ctx.apparent_cwd != ctx.actual_cwd) {
+    relpath_candidates.emplace_back(
+      Util::get_relative_path(ctx.apparent_cwd, normalized_path));
+    // Move best (= shortest) match first:
+    if (relpath_candidates[0].length() > relpath_candidates[1].length()) {
+      std::swap(relpath_candidates[0], relpath_candidates[1]);
+    }
+  }
+
+  for (const auto& relpath : relpath_candidates) {
+    if (Stat::stat(relpath).same_inode_as(path_stat)) {
+      return relpath + path_suffix;
+    }
+  }
+
+  // No match so nothing else to do than to return the unmodified path.
+  return std::string(original_path);
+}
+
 } // namespace
 
 namespace Util {
@@ -343,6 +515,56 @@ copy_fd(int fd_in, int fd_out)
           [=](const void* data, size_t size) { write_fd(fd_out, data, size); });
 }
 
+bool
+copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size)
+{
+#ifdef __linux__
+  uint64_t copied = 0;
+  bool use_sendfile = false;
+  while (copied < size) {
+    ssize_t n;
+    if (!use_sendfile) {
+#  ifdef HAVE_COPY_FILE_RANGE
+      loff_t in_offset = offset + copied;
+      n = copy_file_range(
+        fd_in, &in_offset, fd_out, nullptr, size - copied, 0);
+#  else
+      n = -1;
+      errno = ENOSYS;
+#  endif
+      if (n == -1 && copied == 0
+          && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+              || errno == EOPNOTSUPP)) {
+        use_sendfile = true;
+        continue;
+      }
+    } else {
+      off_t in_offset = offset + copied;
+      n = sendfile(fd_out, fd_in, &in_offset, size - copied);
+      if (n == -1 && copied == 0 && (errno == ENOSYS || errno == EINVAL)) {
+        return false;
+      }
+    }
+    if (n == -1) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      throw Error(strerror(errno));
+    } else if (n == 0) {
+      throw Error("unexpected end of file");
+    }
+    copied += n;
+  }
+  return true;
+#else
+  (void)fd_in;
+  (void)offset;
+  (void)fd_out;
+  (void)size;
+  return false;
+#endif
+}
+
 void
 copy_file(const std::string& src, const std::string& dest, bool via_tmp_file)
 {
@@ -365,9 +587,45 @@ copy_file(const std::string& src, const std::string& dest, bool via_tmp_file)
     }
   }
 
-  copy_fd(*src_fd, *dest_fd);
+#ifdef _WIN32
+  // Let the system copy the data, which for instance enables server-side copy
+  // on SMB shares.
   dest_fd.close();
   src_fd.close();
+  const std::string& target = via_tmp_file ? tmp_file : dest;
+  if (!CopyFileA(src.c_str(), target.c_str(), FALSE)) {
+    DWORD error = GetLastError();
+    throw Error("failed to copy {} to {}: {}",
+                src,
+                target,
+                Win32Util::error_message(error));
+  }
+#else
+  // Prefer copying inside the kernel, which avoids passing the data through
+  // userspace and enables server-side copy on e.g. NFS 4.2.
+  const auto src_size = Stat::stat(src).size();
+#  ifdef __APPLE__
+  const bool copied = fcopyfile(*src_fd, *dest_fd, nullptr, COPYFILE_DATA) == 0;
+  if (!copied) {
+    LOG("Failed to copy {} using fcopyfile: {}", src, strerror(errno));
+  }
+#  else
+  const bool copied = copy_fd_range(*src_fd, 0, *dest_fd, src_size);
+#  endif
+  if (!copied) {
+    // Preallocate large destination files (typically raw object files stored
+    // in or retrieved from the cache) to avoid fragmentation.
+    if (src_size >= k_min_size_for_preallocation) {
+      const int err = fallocate(*dest_fd, src_size);
+      if (err) {
+        LOG("Failed to preallocate {}: {}", dest, strerror(err));
+      }
+    }
+    copy_fd(*src_fd, *dest_fd);
+  }
+  dest_fd.close();
+  src_fd.close();
+#endif
 
   if (via_tmp_file) {
     Util::rename(tmp_file, dest);
@@ -499,15 +757,53 @@ fallocate(int fd, long new_size)
 void
 for_each_level_1_subdir(const std::string& cache_dir,
                         const SubdirVisitor& visitor,
-                        const ProgressReceiver& progress_receiver)
-{
-  for (int i = 0; i <= 0xF; i++) {
-    double progress = 1.0 * i / 16;
-    progress_receiver(progress);
-    std::string subdir_path = FMT("{}/{:x}", cache_dir, i);
-    visitor(subdir_path, [&](double inner_progress) {
-      progress_receiver(progress + inner_progress / 16);
+                        const ProgressReceiver& progress_receiver,
+                        size_t jobs)
+{
+  if (jobs == 0) {
+    jobs = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  if (jobs == 1) {
+    for (int i = 0; i <= 0xF; i++) {
+      double progress = 1.0 * i / 16;
+      progress_receiver(progress);
+      std::string subdir_path = FMT("{}/{:x}", cache_dir, i);
+      visitor(subdir_path, [&](double inner_progress) {
+        progress_receiver(progress + inner_progress / 16);
+      });
+    }
+    progress_receiver(1.0);
+    return;
+  }
+
+  // Overall progress is the average progress of the subdirectories.
+  std::vector<double> subdir_progress(16, 0.0);
+  std::mutex mutex;
+  std::exception_ptr exception;
+
+  progress_receiver(0.0);
+  Jobserver::Tokens tokens(std::min<size_t>(jobs, 16) - 1);
+  ThreadPool(tokens.count())
+    .for_each_index(16, [&](size_t i) {
+      try {
+        visitor(FMT("{}/{:x}", cache_dir, i), [&, i](double inner_progress) {
+          std::lock_guard<std::mutex> lock(mutex);
+          subdir_progress[i] = inner_progress;
+          progress_receiver(std::accumulate(subdir_progress.begin(),
+                                            subdir_progress.end(),
+                                            0.0)
+                            / 16);
+        });
+        return true;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        exception = std::current_exception();
+        return false;
+      }
     });
+  if (exception) {
+    std::rethrow_exception(exception);
   }
   progress_receiver(1.0);
 }
@@ -582,6 +878,24 @@ ensure_dir_exists(nonstd::string_view dir)
   }
 }
 
+std::string
+escape_json(string_view value)
+{
+  std::string result;
+  result.reserve(value.size());
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      result += FMT("\\u{:04x}", static_cast<unsigned>(c));
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
 std::string
 get_actual_cwd()
 {
@@ -606,7 +920,9 @@ get_apparent_cwd(const std::string& actual_cwd)
   return actual_cwd;
 #else
   auto pwd = getenv("PWD");
-  if (!pwd) {
+  if (!pwd || actual_cwd == pwd) {
+    // getcwd(3) returns a normalized path, so there is nothing to check in the
+    // common case where $PWD agrees with it.
     return actual_cwd;
   }
 
@@ -646,7 +962,8 @@ get_extension(string_view path)
 void
 get_level_1_files(const std::string& dir,
                   const ProgressReceiver& progress_receiver,
-                  std::vector<std::shared_ptr<CacheFile>>& files)
+                  std::vector<std::shared_ptr<CacheFile>>& files,
+                  bool stat_files)
 {
   if (!Stat::stat(dir)) {
     return;
@@ -654,20 +971,54 @@ get_level_1_files(const std::string& dir,
 
   size_t level_2_directories = 0;
 
-  Util::traverse(dir, [&](const std::string& path, bool is_dir) {
+  const auto visit = [&](const std::string& path, bool is_dir) {
     auto name = Util::base_name(path);
-    if (name == "CACHEDIR.TAG" || name == "stats" || name.starts_with(".nfs")) {
-      return;
+    if (name == "CACHEDIR.TAG" || name == "stats" || name == "cleanup"
+        || name == LruIndex::k_file_name
+        || name == PresenceFilter::k_file_name
+        || name == SharedCounters::k_file_name
+        || name == Storage::k_level_file_name
+        || name == Storage::k_pack_file_name || name.starts_with(".nfs")) {
+      return false;
     }
 
     if (!is_dir) {
-      files.push_back(std::make_shared<CacheFile>(path));
+      return true;
     } else if (path != dir
                && path.find('/', dir.size() + 1) == std::string::npos) {
       ++level_2_directories;
       progress_receiver(level_2_directories / 16.0);
     }
+    return false;
+  };
+
+#ifdef HAVE_DIRENT_H
+  // Callers need the lstat result of all files, so get it relative to the
+  // directory file descriptor while traversing.
+  traverse_at(
+    AT_FDCWD,
+    dir.c_str(),
+    dir,
+    [&](const std::string& path, bool is_dir, int dir_fd, const char* name) {
+      if (visit(path, is_dir)) {
+        if (!stat_files) {
+          files.push_back(std::make_shared<CacheFile>(path));
+          return;
+        }
+        auto stat = Stat::lstat_at(dir_fd, name);
+        if (stat || stat.error_number() != ENOENT) {
+          files.push_back(std::make_shared<CacheFile>(path, stat));
+        }
+      }
+    });
+#else
+  (void)stat_files;
+  Util::traverse(dir, [&](const std::string& path, bool is_dir) {
+    if (visit(path, is_dir)) {
+      files.push_back(std::make_shared<CacheFile>(path));
+    }
   });
+#endif
 
   progress_receiver(1.0);
 }
@@ -820,6 +1171,31 @@ is_precompiled_header(string_view path)
          || get_extension(dir_name(path)) == ".gch";
 }
 
+void
+lower_process_priority()
+{
+#ifndef _WIN32
+  errno = 0;
+  if (nice(19) == -1 && errno != 0) {
+    LOG("Failed to lower CPU priority: {}", strerror(errno));
+  }
+#  ifdef SYS_ioprio_set
+  // Use the idle I/O scheduling class (IOPRIO_CLASS_IDLE) for this process
+  // (IOPRIO_WHO_PROCESS). The constants are not exported by glibc.
+  const int ioprio_who_process = 1;
+  const int ioprio_class_idle = 3;
+  const int ioprio_class_shift = 13;
+  if (syscall(SYS_ioprio_set,
+              ioprio_who_process,
+              0,
+              ioprio_class_idle << ioprio_class_shift)
+      != 0) {
+    LOG("Failed to lower I/O priority: {}", strerror(errno));
+  }
+#  endif
+#endif
+}
+
 optional<tm>
 localtime(optional<time_t> time)
 {
@@ -855,39 +1231,33 @@ make_relative_path(const Context& ctx, string_view path)
   }
 #endif
 
-  // The algorithm for computing relative paths below only works for existing
-  // paths. If the path doesn't exist, find the first ancestor directory that
-  // does exist and assemble the path again afterwards.
-  string_view original_path = path;
-  std::string path_suffix;
-  Stat path_stat;
-  while (!(path_stat = Stat::stat(std::string(path)))) {
-    path = Util::dir_name(path);
+  // Relative paths are resolved per directory and memoized in the context
+  // since many paths (e.g. include files) typically share a few directories.
+  const auto name = Util::base_name(path);
+  const auto dir = Util::dir_name(path);
+  if (name.empty() || name == "." || name == ".." || dir == path) {
+    return make_relative_path_uncached(ctx, path);
   }
-  path_suffix = std::string(original_path.substr(path.length()));
 
-  std::string path_str(path);
-  std::string normalized_path = Util::normalize_absolute_path(path_str);
-  std::vector<std::string> relpath_candidates = {
-    Util::get_relative_path(ctx.actual_cwd, normalized_path),
-  };
-  if (ctx.apparent_cwd != ctx.actual_cwd) {
-    relpath_candidates.emplace_back(
-      Util::get_relative_path(ctx.apparent_cwd, normalized_path));
-    // Move best (= shortest) match first:
-    if (relpath_candidates[0].length() > relpath_candidates[1].length()) {
-      std::swap(relpath_candidates[0], relpath_candidates[1]);
-    }
+  std::string dir_str(dir);
+  auto it = ctx.relative_dir_cache.find(dir_str);
+  if (it == ctx.relative_dir_cache.end()) {
+    it = ctx.relative_dir_cache
+           .emplace(dir_str, make_relative_path_uncached(ctx, dir))
+           .first;
   }
 
-  for (const auto& relpath : relpath_candidates) {
-    if (Stat::stat(relpath).same_inode_as(path_stat)) {
-      return relpath + path_suffix;
-    }
+  const std::string& relative_dir = it->second;
+  if (relative_dir == dir) {
+    return std::string(path);
+  } else if (relative_dir == ".") {
+    // Like make_relative_path_uncached, only drop the "./" prefix if the path
+    // exists.
+    return Stat::stat(std::string(path)) ? std::string(name)
+                                         : FMT("./{}", name);
+  } else {
+    return FMT("{}/{}", relative_dir, name);
   }
-
-  // No match so nothing else to do than to return the unmodified path.
-  return std::string(original_path);
 }
 
 bool
@@ -1102,35 +1472,30 @@ read_fd(int fd, DataReceiver data_receiver)
 }
 
 std::string
-read_file(const std::string& path, size_t size_hint)
+read_fd_to_string(int fd, size_t size_hint)
 {
   if (size_hint == 0) {
-    auto stat = Stat::stat(path);
-    if (!stat) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
       throw Error(strerror(errno));
     }
-    size_hint = stat.size();
+    size_hint = st.st_size;
   }
 
   // +1 to be able to detect EOF in the first read call
   size_hint = (size_hint < 1024) ? 1024 : size_hint + 1;
 
-  Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
-  if (!fd) {
-    throw Error(strerror(errno));
-  }
-
   ssize_t ret = 0;
   size_t pos = 0;
   std::string result;
   result.resize(size_hint);
 
   while (true) {
-    if (pos > result.size()) {
+    if (pos >= result.size()) {
       result.resize(2 * result.size());
     }
     const size_t max_read = result.size() - pos;
-    ret = read(*fd, &result[pos], max_read);
+    ret = read(fd, &result[pos], max_read);
     if (ret == 0 || (ret == -1 && errno != EINTR)) {
       break;
     }
@@ -1143,7 +1508,6 @@ read_file(const std::string& path, size_t size_hint)
   }
 
   if (ret == -1) {
-    LOG("Failed reading {}", path);
     throw Error(strerror(errno));
   }
 
@@ -1151,6 +1515,22 @@ read_file(const std::string& path, size_t size_hint)
   return result;
 }
 
+std::string
+read_file(const std::string& path, size_t size_hint)
+{
+  Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    throw Error(strerror(errno));
+  }
+
+  try {
+    return read_fd_to_string(*fd, size_hint);
+  } catch (const Error&) {
+    LOG("Failed reading {}", path);
+    throw;
+  }
+}
+
 #ifndef _WIN32
 std::string
 read_link(const std::string& path)
@@ -1257,27 +1637,23 @@ same_program_name(nonstd::string_view program_name,
 }
 
 void
-send_to_stderr(const Context& ctx, const std::string& text)
+send_to_stderr(const Context& ctx, string_view text)
 {
-  const std::string* text_to_send = &text;
+  string_view text_to_send = text;
   std::string modified_text;
 
   if (ctx.args_info.strip_diagnostics_colors) {
-    try {
-      modified_text = strip_ansi_csi_seqs(text);
-      text_to_send = &modified_text;
-    } catch (const Error&) {
-      // Fall through
-    }
+    modified_text = strip_ansi_csi_seqs(text);
+    text_to_send = modified_text;
   }
 
   if (ctx.config.absolute_paths_in_stderr()) {
-    modified_text = rewrite_stderr_to_absolute_paths(*text_to_send);
-    text_to_send = &modified_text;
+    modified_text = rewrite_stderr_to_absolute_paths(text_to_send);
+    text_to_send = modified_text;
   }
 
   try {
-    write_fd(STDERR_FILENO, text_to_send->data(), text_to_send->length());
+    write_fd(STDERR_FILENO, text_to_send.data(), text_to_send.length());
   } catch (Error& e) {
     throw Error("Failed to write to stderr: {}", e.what());
   }
@@ -1365,47 +1741,57 @@ to_lowercase(string_view string)
 void
 traverse(const std::string& path, const TraverseVisitor& visitor)
 {
-  DIR* dir = opendir(path.c_str());
-  if (dir) {
-    struct dirent* entry;
-    while ((entry = readdir(dir))) {
-      if (strcmp(entry->d_name, "") == 0 || strcmp(entry->d_name, ".") == 0
-          || strcmp(entry->d_name, "..") == 0) {
-        continue;
-      }
+  traverse_at(
+    AT_FDCWD,
+    path.c_str(),
+    path,
+    [&](const std::string& entry_path, bool is_dir, int, const char*) {
+      visitor(entry_path, is_dir);
+    });
+}
 
-      std::string entry_path = path + "/" + entry->d_name;
-      bool is_dir;
-#  ifdef _DIRENT_HAVE_D_TYPE
-      if (entry->d_type != DT_UNKNOWN) {
-        is_dir = entry->d_type == DT_DIR;
-      } else
-#  endif
-      {
-        auto stat = Stat::lstat(entry_path);
-        if (!stat) {
-          if (stat.error_number() == ENOENT || stat.error_number() == ESTALE) {
-            continue;
-          }
-          throw Error("failed to lstat {}: {}",
-                      entry_path,
-                      strerror(stat.error_number()));
-        }
-        is_dir = stat.is_directory();
+#elif defined(_WIN32)
+
+void
+traverse(const std::string& path, const TraverseVisitor& visitor)
+{
+  const DWORD attributes = GetFileAttributesA(path.c_str());
+  if (attributes == INVALID_FILE_ATTRIBUTES) {
+    throw Error("failed to open directory {}: {}",
+                path,
+                Win32Util::error_message(GetLastError()));
+  }
+  if (!(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+    visitor(path, false);
+    return;
+  }
+
+  // FindExInfoBasic skips looking up the short names and
+  // FIND_FIRST_EX_LARGE_FETCH fetches the entries in larger batches.
+  WIN32_FIND_DATAA entry;
+  HANDLE handle = FindFirstFileExA(FMT("{}\\*", path).c_str(),
+                                   FindExInfoBasic,
+                                   &entry,
+                                   FindExSearchNameMatch,
+                                   nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+  if (handle != INVALID_HANDLE_VALUE) {
+    do {
+      if (strcmp(entry.cFileName, ".") == 0
+          || strcmp(entry.cFileName, "..") == 0) {
+        continue;
       }
-      if (is_dir) {
+      const auto entry_path = FMT("{}/{}", path, entry.cFileName);
+      if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+          && !(entry.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
         traverse(entry_path, visitor);
       } else {
         visitor(entry_path, false);
       }
-    }
-    closedir(dir);
-    visitor(path, true);
-  } else if (errno == ENOTDIR) {
-    visitor(path, false);
-  } else {
-    throw Error("failed to open directory {}: {}", path, strerror(errno));
+    } while (FindNextFileA(handle, &entry));
+    FindClose(handle);
   }
+  visitor(path, true);
 }
 
 #else // If not available, use the C++17 std::filesystem implementation.
@@ -1507,6 +1893,15 @@ update_mtime(const std::string& path)
 #endif
 }
 
+bool
+set_mtime(const std::string& path, time_t mtime)
+{
+  struct utimbuf times;
+  times.actime = time(nullptr);
+  times.modtime = mtime;
+  return utime(path.c_str(), &times) == 0;
+}
+
 void
 wipe_path(const std::string& path)
 {
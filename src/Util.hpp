@@ -114,8 +114,16 @@ size_t common_dir_prefix_length(nonstd::string_view dir,
 // Copy all data from `fd_in` to `fd_out`. Throws `Error` on error.
 void copy_fd(int fd_in, int fd_out);
 
+// Copy `size` bytes at `offset` in `fd_in` to the current position of `fd_out`
+// inside the kernel, using copy_file_range(2) (which may share extents on
+// reflink-capable file systems) or sendfile(2). Returns false without writing
+// anything if neither is supported for the file descriptors. Throws `Error` on
+// other errors.
+bool copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size);
+
 // Copy a file from `src` to `dest`. If via_tmp_file is true, `src` is copied to
-// a temporary file and then renamed to dest. Throws `Error` on error.
+// a temporary file and then renamed to dest. The data is copied by the kernel
+// or file server when possible. Throws `Error` on error.
 void copy_file(const std::string& src,
                const std::string& dest,
                bool via_tmp_file = false);
@@ -138,6 +146,9 @@ ends_with(nonstd::string_view string, nonstd::string_view suffix)
 // Like create_dir but throws Fatal on error.
 void ensure_dir_exists(nonstd::string_view dir);
 
+// Escape `value` for use in a JSON string.
+std::string escape_json(nonstd::string_view value);
+
 // Expand all instances of $VAR or ${VAR}, where VAR is an environment variable,
 // in `str`. Throws `Error` if one of the environment variables.
 [[nodiscard]] std::string expand_environment_variables(const std::string& str);
@@ -158,9 +169,13 @@ int fallocate(int fd, long new_size);
 // - visitor: Function to call with directory path and progress_receiver as
 //   arguments.
 // - progress_receiver: Function that will be called for progress updates.
+// - jobs: Number of subdirectories to visit concurrently, 0 meaning the number
+//   of CPUs. The visitor and progress_receiver must then be thread-safe, but
+//   calls to progress_receiver are serialized.
 void for_each_level_1_subdir(const std::string& cache_dir,
                              const SubdirVisitor& visitor,
-                             const ProgressReceiver& progress_receiver);
+                             const ProgressReceiver& progress_receiver,
+                             size_t jobs = 1);
 
 // Format `argv` as a simple string for logging purposes. That is, the result is
 // not intended to be machine parsable. `argv` must be terminated by a nullptr.
@@ -209,9 +224,12 @@ nonstd::string_view get_extension(nonstd::string_view path);
 // - dir: The directory to traverse recursively.
 // - progress_receiver: Function that will be called for progress updates.
 // - files: Found files.
+// - stat_files: Whether to lstat the files while traversing. If false, the
+//   files are lstat-ed on demand by CacheFile::lstat.
 void get_level_1_files(const std::string& dir,
                        const ProgressReceiver& progress_receiver,
-                       std::vector<std::shared_ptr<CacheFile>>& files);
+                       std::vector<std::shared_ptr<CacheFile>>& files,
+                       bool stat_files = true);
 
 // Return the current user's home directory, or throw `Fatal` if it can't
 // be determined.
@@ -302,6 +320,10 @@ is_full_path(nonstd::string_view path)
 // Headers" in GCC docs).
 bool is_precompiled_header(nonstd::string_view path);
 
+// Lower the CPU and I/O priority of the current process as much as possible.
+// Does nothing on Windows.
+void lower_process_priority();
+
 // Thread-safe version of `localtime(3)`. If `time` is not specified the current
 // time of day is used.
 nonstd::optional<tm> localtime(nonstd::optional<time_t> time = {});
@@ -360,6 +382,12 @@ uint64_t parse_unsigned(const std::string& value,
 // did not return -1.
 bool read_fd(int fd, DataReceiver data_receiver);
 
+// Return the data read from `fd` until end of file. If `size_hint` is not 0
+// then assume that the file has this size (this saves a system call).
+//
+// Throws `Error` on error.
+std::string read_fd_to_string(int fd, size_t size_hint = 0);
+
 // Return `path`'s content as a string. If `size_hint` is not 0 then assume that
 // `path` has this size (this saves system calls).
 //
@@ -393,9 +421,10 @@ bool same_program_name(nonstd::string_view program_name,
 
 // Send `text` to STDERR_FILENO, optionally stripping ANSI color sequences if
 // `ctx.args_info.strip_diagnostics_colors` is true and rewriting paths to
-// absolute if `ctx.config.absolute_paths_in_stderr` is true. Throws `Error` on
-// error.
-void send_to_stderr(const Context& ctx, const std::string& text);
+// absolute if `ctx.config.absolute_paths_in_stderr` is true. Since both are
+// done line by line, text may be sent in parts that end with a newline. Throws
+// `Error` on error.
+void send_to_stderr(const Context& ctx, nonstd::string_view text);
 
 // Set the FD_CLOEXEC on file descriptor `fd`. This is a NOP on Windows.
 void set_cloexec_flag(int fd);
@@ -474,6 +503,9 @@ void unsetenv(const std::string& name);
 // Set mtime of `path` to the current timestamp.
 void update_mtime(const std::string& path);
 
+// Set mtime of `path` to `mtime`. Returns false on error.
+bool set_mtime(const std::string& path, time_t mtime);
+
 // Remove `path` (and its contents if it's a directory). A nonexistent path is
 // not considered an error.
 //
@@ -19,13 +19,17 @@
 #include "ZstdCompressor.hpp"
 
 #include "Logging.hpp"
+#include "ZstdContexts.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
 #include <algorithm>
 
-ZstdCompressor::ZstdCompressor(FILE* stream, int8_t compression_level)
-  : m_stream(stream), m_zstd_stream(ZSTD_createCStream())
+ZstdCompressor::ZstdCompressor(FILE* stream,
+                               int8_t compression_level,
+                               nonstd::string_view dictionary,
+                               uint32_t threads)
+  : m_stream(stream), m_zstd_stream(ZstdContexts::acquire_cstream())
 {
   if (compression_level == 0) {
     compression_level = default_compression_level;
@@ -52,14 +56,40 @@ ZstdCompressor::ZstdCompressor(FILE* stream, int8_t compression_level)
 
   size_t ret = ZSTD_initCStream(m_zstd_stream, m_compression_level);
   if (ZSTD_isError(ret)) {
-    ZSTD_freeCStream(m_zstd_stream);
+    ZstdContexts::release(m_zstd_stream);
     throw Error("error initializing zstd compression stream");
   }
+
+  if (!dictionary.empty()) {
+#if ZSTD_VERSION_NUMBER >= 10400
+    ret = ZSTD_CCtx_loadDictionary(
+      m_zstd_stream, dictionary.data(), dictionary.size());
+#else
+    ret = static_cast<size_t>(-1);
+#endif
+    if (ZSTD_isError(ret)) {
+      ZstdContexts::release(m_zstd_stream);
+      throw Error("error loading zstd compression dictionary");
+    }
+  }
+
+  if (threads > 0) {
+#if ZSTD_VERSION_NUMBER >= 10400
+    // Fails if libzstd was built without multithreading support, in which case
+    // compression simply continues in the calling thread.
+    ret = ZSTD_CCtx_setParameter(m_zstd_stream, ZSTD_c_nbWorkers, threads);
+    if (ZSTD_isError(ret)) {
+      LOG("Not using {} zstd worker threads: {}",
+          threads,
+          ZSTD_getErrorName(ret));
+    }
+#endif
+  }
 }
 
 ZstdCompressor::~ZstdCompressor()
 {
-  ZSTD_freeCStream(m_zstd_stream);
+  ZstdContexts::release(m_zstd_stream);
 }
 
 int8_t
@@ -76,6 +106,9 @@ ZstdCompressor::write(const void* data, size_t count)
   m_zstd_in.pos = 0;
 
   int flush = data ? 0 : 1;
+  if (count > 0) {
+    m_in_frame = true;
+  }
 
   size_t ret;
   while (m_zstd_in.pos < m_zstd_in.size) {
@@ -106,6 +139,21 @@ ZstdCompressor::write(const void* data, size_t count)
   }
 }
 
+bool
+ZstdCompressor::write_frame(nonstd::string_view frame)
+{
+  if (m_in_frame) {
+    // End the current frame. Later writes start a new one.
+    write(nullptr, 0);
+    m_in_frame = false;
+  }
+  if (fwrite(frame.data(), 1, frame.size(), m_stream) != frame.size()
+      || ferror(m_stream)) {
+    throw Error("failed to write to zstd output stream");
+  }
+  return true;
+}
+
 void
 ZstdCompressor::finalize()
 {
@@ -23,6 +23,8 @@
 #include "Compressor.hpp"
 #include "NonCopyable.hpp"
 
+#include "third_party/nonstd/string_view.hpp"
+
 #include <zstd.h>
 
 // A compressor of a Zstandard stream.
@@ -32,12 +34,18 @@ public:
   // Parameters:
   // - stream: The file to write data to.
   // - compression_level: Desired compression level.
-  ZstdCompressor(FILE* stream, int8_t compression_level);
+  // - dictionary: Dictionary to compress with, if any.
+  // - threads: Number of zstd worker threads to use, 0 for none.
+  ZstdCompressor(FILE* stream,
+                 int8_t compression_level,
+                 nonstd::string_view dictionary = {},
+                 uint32_t threads = 0);
 
   ~ZstdCompressor() override;
 
   int8_t actual_compression_level() const override;
   void write(const void* data, size_t count) override;
+  bool write_frame(nonstd::string_view frame) override;
   void finalize() override;
 
   constexpr static uint8_t default_compression_level = 1;
@@ -48,4 +56,5 @@ private:
   ZSTD_inBuffer m_zstd_in;
   ZSTD_outBuffer m_zstd_out;
   int8_t m_compression_level;
+  bool m_in_frame = false;
 };
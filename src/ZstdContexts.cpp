@@ -0,0 +1,112 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ZstdContexts.hpp"
+
+#include <vector>
+
+namespace {
+
+// More than one stream of a kind is only in use at a time when entries are
+// nested, e.g. a manifest read while a result is written.
+const size_t k_max_pooled_streams = 2;
+
+template<typename T, size_t (*free_stream)(T*)> class StreamPool
+{
+public:
+  ~StreamPool()
+  {
+    for (T* stream : m_streams) {
+      free_stream(stream);
+    }
+  }
+
+  T*
+  acquire()
+  {
+    if (m_streams.empty()) {
+      return nullptr;
+    }
+    T* stream = m_streams.back();
+    m_streams.pop_back();
+    return stream;
+  }
+
+  void
+  release(T* stream)
+  {
+    if (m_streams.size() < k_max_pooled_streams) {
+      m_streams.push_back(stream);
+    } else {
+      free_stream(stream);
+    }
+  }
+
+private:
+  std::vector<T*> m_streams;
+};
+
+thread_local StreamPool<ZSTD_CStream, ZSTD_freeCStream> cstreams;
+thread_local StreamPool<ZSTD_DStream, ZSTD_freeDStream> dstreams;
+
+} // namespace
+
+namespace ZstdContexts {
+
+ZSTD_CStream*
+acquire_cstream()
+{
+  ZSTD_CStream* stream = cstreams.acquire();
+  return stream ? stream : ZSTD_createCStream();
+}
+
+void
+release(ZSTD_CStream* stream)
+{
+#if ZSTD_VERSION_NUMBER >= 10400
+  // Also drops a loaded dictionary and worker threads.
+  if (ZSTD_isError(
+        ZSTD_CCtx_reset(stream, ZSTD_reset_session_and_parameters))) {
+    ZSTD_freeCStream(stream);
+    return;
+  }
+#endif
+  cstreams.release(stream);
+}
+
+ZSTD_DStream*
+acquire_dstream()
+{
+  ZSTD_DStream* stream = dstreams.acquire();
+  return stream ? stream : ZSTD_createDStream();
+}
+
+void
+release(ZSTD_DStream* stream)
+{
+#if ZSTD_VERSION_NUMBER >= 10400
+  if (ZSTD_isError(
+        ZSTD_DCtx_reset(stream, ZSTD_reset_session_and_parameters))) {
+    ZSTD_freeDStream(stream);
+    return;
+  }
+#endif
+  dstreams.release(stream);
+}
+
+} // namespace ZstdContexts
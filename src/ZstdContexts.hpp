@@ -0,0 +1,44 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <zstd.h>
+
+// Per-thread pools of zstd streams. Creating a stream is cheap, but its window
+// and buffers are allocated on first use, which dominates the cost of handling
+// small cache entries when many are processed in a row, e.g. by --recompress.
+// A released stream is reset, so an acquired stream always starts without
+// parameters or dictionary.
+namespace ZstdContexts {
+
+// Return a compression stream. Never returns nullptr.
+ZSTD_CStream* acquire_cstream();
+
+// Return `stream` from `acquire_cstream` to the pool of the calling thread.
+void release(ZSTD_CStream* stream);
+
+// Return a decompression stream. Never returns nullptr.
+ZSTD_DStream* acquire_dstream();
+
+// Return `stream` from `acquire_dstream` to the pool of the calling thread.
+void release(ZSTD_DStream* stream);
+
+} // namespace ZstdContexts
@@ -18,31 +18,58 @@
 
 #include "ZstdDecompressor.hpp"
 
+#include "ZstdContexts.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
-ZstdDecompressor::ZstdDecompressor(FILE* stream)
+ZstdDecompressor::ZstdDecompressor(FILE* stream,
+                                   nonstd::string_view dictionary)
   : m_stream(stream),
     m_input_size(0),
     m_input_consumed(0),
-    m_zstd_stream(ZSTD_createDStream()),
+    m_zstd_stream(ZstdContexts::acquire_dstream()),
     m_reached_stream_end(false)
 {
   size_t ret = ZSTD_initDStream(m_zstd_stream);
   if (ZSTD_isError(ret)) {
-    ZSTD_freeDStream(m_zstd_stream);
+    ZstdContexts::release(m_zstd_stream);
     throw Error("failed to initialize zstd decompression stream");
   }
+
+  if (!dictionary.empty()) {
+#if ZSTD_VERSION_NUMBER >= 10400
+    ret = ZSTD_DCtx_loadDictionary(
+      m_zstd_stream, dictionary.data(), dictionary.size());
+#else
+    ret = static_cast<size_t>(-1);
+#endif
+    if (ZSTD_isError(ret)) {
+      ZstdContexts::release(m_zstd_stream);
+      throw Error("failed to load zstd decompression dictionary");
+    }
+  }
+
+  const long offset = ftell(stream);
+  if (offset >= 0 && m_map.map(fileno(stream))
+      && static_cast<size_t>(offset) <= m_map.data().size()) {
+    m_mapped_offset = offset;
+    m_mapped_input = m_map.data().substr(m_mapped_offset);
+  }
 }
 
 ZstdDecompressor::~ZstdDecompressor()
 {
-  ZSTD_freeDStream(m_zstd_stream);
+  ZstdContexts::release(m_zstd_stream);
 }
 
 void
 ZstdDecompressor::read(void* data, size_t count)
 {
+  if (m_mapped_input.data()) {
+    read_mapped(data, count);
+    return;
+  }
+
   size_t bytes_read = 0;
   while (bytes_read < count) {
     ASSERT(m_input_size >= m_input_consumed);
@@ -65,18 +92,46 @@ ZstdDecompressor::read(void* data, size_t count)
     if (ZSTD_isError(ret)) {
       throw Error("failed to read from zstd input stream");
     }
-    if (ret == 0) {
-      m_reached_stream_end = true;
-      break;
-    }
     bytes_read += m_zstd_out.pos;
     m_input_consumed += m_zstd_in.pos;
+
+    // 0 means that a frame has been decoded completely. The stream may consist
+    // of several frames (see Compressor::write_frame), in which case reading
+    // continues with the next one.
+    m_reached_stream_end = ret == 0;
   }
 }
 
+void
+ZstdDecompressor::read_mapped(void* data, size_t count)
+{
+  // All remaining input is handed over at once, so the whole read is normally
+  // done in one call.
+  ZSTD_inBuffer in = {
+    m_mapped_input.data(), m_mapped_input.size(), m_mapped_consumed};
+  ZSTD_outBuffer out = {data, count, 0};
+  while (out.pos < out.size) {
+    const size_t in_pos = in.pos;
+    const size_t out_pos = out.pos;
+    size_t ret = ZSTD_decompressStream(m_zstd_stream, &out, &in);
+    if (ZSTD_isError(ret) || (in.pos == in_pos && out.pos == out_pos)) {
+      throw Error("failed to read from zstd input stream");
+    }
+    m_reached_stream_end = ret == 0;
+  }
+  m_mapped_consumed = in.pos;
+}
+
 void
 ZstdDecompressor::finalize()
 {
+  if (m_mapped_input.data()
+      && fseek(m_stream,
+               static_cast<long>(m_mapped_offset + m_mapped_consumed),
+               SEEK_SET)
+           != 0) {
+    throw Error("failed to seek in zstd input stream");
+  }
   if (!m_reached_stream_end) {
     throw Error("garbage data at end of zstd input stream");
   }
@@ -21,17 +21,26 @@
 #include "system.hpp"
 
 #include "Decompressor.hpp"
+#include "MemoryMap.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
 
 #include <fstream>
 #include <zstd.h>
 
 // A decompressor of a Zstandard stream.
+//
+// Large enough regular files are decompressed straight from a memory mapping
+// instead of being read through the stdio and input buffers. In that case the
+// position of the file is only updated to the end of the consumed input by
+// `finalize`.
 class ZstdDecompressor : public Decompressor
 {
 public:
   // Parameters:
   // - stream: The file to read data from.
-  explicit ZstdDecompressor(FILE* stream);
+  // - dictionary: Dictionary that the data was compressed with, if any.
+  explicit ZstdDecompressor(FILE* stream, nonstd::string_view dictionary = {});
 
   ~ZstdDecompressor() override;
 
@@ -40,6 +49,11 @@ public:
 
 private:
   FILE* m_stream;
+  MemoryMap m_map;
+  // Input from the current position of `m_stream` in `m_map`, if mapped.
+  nonstd::string_view m_mapped_input;
+  size_t m_mapped_offset = 0;
+  size_t m_mapped_consumed = 0;
   char m_input_buffer[READ_BUFFER_SIZE];
   size_t m_input_size;
   size_t m_input_consumed;
@@ -47,4 +61,6 @@ private:
   ZSTD_inBuffer m_zstd_in;
   ZSTD_outBuffer m_zstd_out;
   bool m_reached_stream_end;
+
+  void read_mapped(void* data, size_t count);
 };
@@ -0,0 +1,142 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ZstdDelta.hpp"
+
+#include "ZstdCompressor.hpp"
+#include "exceptions.hpp"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace {
+
+// Base and data must fit in a window of at most this size (128 MiB), which the
+// decompressor has to allow explicitly.
+const int k_max_window_log = 27;
+
+int
+window_log(uint64_t size)
+{
+  int log = 10; // ZSTD_WINDOWLOG_MIN
+  while (log < 64 && (uint64_t(1) << log) < size) {
+    ++log;
+  }
+  return log;
+}
+
+} // namespace
+
+namespace ZstdDelta {
+
+bool
+supported()
+{
+  // ZSTD_CCtx_refPrefix and the advanced parameters are stable since 1.4.0.
+  return ZSTD_VERSION_NUMBER >= 10400;
+}
+
+bool
+fits(uint64_t base_size, uint64_t size)
+{
+  return window_log(base_size + size) <= k_max_window_log;
+}
+
+std::string
+compress(nonstd::string_view base, nonstd::string_view data, int8_t level)
+{
+#if ZSTD_VERSION_NUMBER >= 10400
+  std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx(ZSTD_createCCtx(),
+                                                             ZSTD_freeCCtx);
+  const int compression_level =
+    level == 0 ? ZstdCompressor::default_compression_level
+               : std::min<int>(level, ZSTD_maxCLevel());
+  std::string delta(ZSTD_compressBound(data.size()), '\0');
+  size_t ret = cctx ? 0 : static_cast<size_t>(-1);
+  for (const auto& parameter :
+       {std::make_pair(ZSTD_c_compressionLevel, compression_level),
+        std::make_pair(ZSTD_c_windowLog,
+                       window_log(base.size() + data.size())),
+        std::make_pair(ZSTD_c_enableLongDistanceMatching, 1),
+        std::make_pair(ZSTD_c_checksumFlag, 1)}) {
+    if (!ZSTD_isError(ret)) {
+      ret = ZSTD_CCtx_setParameter(cctx.get(), parameter.first, parameter.second);
+    }
+  }
+  if (!ZSTD_isError(ret)) {
+    ret = ZSTD_CCtx_refPrefix(cctx.get(), base.data(), base.size());
+  }
+  if (!ZSTD_isError(ret)) {
+    ret = ZSTD_compress2(
+      cctx.get(), &delta[0], delta.size(), data.data(), data.size());
+  }
+  if (ZSTD_isError(ret)) {
+    throw Error("Delta compression failed: {}", ZSTD_getErrorName(ret));
+  }
+  delta.resize(ret);
+  return delta;
+#else
+  (void)base;
+  (void)data;
+  (void)level;
+  throw Error("Delta compression is not supported by libzstd {}",
+              ZSTD_versionString());
+#endif
+}
+
+std::string
+decompress(nonstd::string_view base, nonstd::string_view delta, uint64_t size)
+{
+#if ZSTD_VERSION_NUMBER >= 10400
+  std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx(ZSTD_createDCtx(),
+                                                             ZSTD_freeDCtx);
+  std::string data(size, '\0');
+  size_t ret = dctx ? 0 : static_cast<size_t>(-1);
+  if (!ZSTD_isError(ret)) {
+    ret = ZSTD_DCtx_setParameter(
+      dctx.get(), ZSTD_d_windowLogMax, k_max_window_log);
+  }
+  if (!ZSTD_isError(ret)) {
+    ret = ZSTD_DCtx_refPrefix(dctx.get(), base.data(), base.size());
+  }
+  if (!ZSTD_isError(ret)) {
+    ret = ZSTD_decompressDCtx(
+      dctx.get(), &data[0], data.size(), delta.data(), delta.size());
+  }
+  if (ZSTD_isError(ret)) {
+    throw Error("Delta decompression failed: {}", ZSTD_getErrorName(ret));
+  }
+  if (ret != size) {
+    throw Error("Bad size of delta decompressed data (actual {} bytes,"
+                " expected {} bytes)",
+                ret,
+                size);
+  }
+  return data;
+#else
+  (void)base;
+  (void)delta;
+  (void)size;
+  throw Error("Delta compression is not supported by libzstd {}",
+              ZSTD_versionString());
+#endif
+}
+
+} // namespace ZstdDelta
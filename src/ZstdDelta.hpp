@@ -0,0 +1,49 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+// Delta compression with zstd, where data is compressed with an earlier version
+// of it as a prefix (like `zstd --patch-from`) so that unchanged parts are
+// stored as references into the earlier version.
+namespace ZstdDelta {
+
+// Whether the linked libzstd supports delta compression.
+bool supported();
+
+// Whether data of `size` bytes can be delta compressed against a base of
+// `base_size` bytes without exceeding the window size limit.
+bool fits(uint64_t base_size, uint64_t size);
+
+// Compress `data` with `base` as prefix at `level` (0 for the default level).
+// Throws Error on failure.
+std::string
+compress(nonstd::string_view base, nonstd::string_view data, int8_t level);
+
+// Decompress `delta` of data of `size` bytes with `base` as prefix. Throws Error
+// on failure or if the result doesn't have `size` bytes.
+std::string
+decompress(nonstd::string_view base, nonstd::string_view delta, uint64_t size);
+
+} // namespace ZstdDelta
@@ -0,0 +1,150 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ZstdDictionary.hpp"
+
+#include "AtomicFile.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <zdict.h>
+#include <zstd.h>
+
+#include <map>
+#include <mutex>
+
+namespace {
+
+std::mutex mutex;
+std::string dictionary_dir;
+bool current_id_loaded = false;
+uint32_t current_dictionary_id = 0;
+std::map<uint32_t, std::shared_ptr<const std::string>> loaded_dictionaries;
+
+std::string
+dictionary_path(uint32_t id)
+{
+  return FMT("{}/{:08x}", dictionary_dir, id);
+}
+
+} // namespace
+
+namespace ZstdDictionary {
+
+bool
+supported()
+{
+  // ZSTD_CCtx_loadDictionary and ZSTD_DCtx_loadDictionary are stable since
+  // 1.4.0.
+  return ZSTD_VERSION_NUMBER >= 10400;
+}
+
+void
+set_cache_dir(const std::string& cache_dir)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  dictionary_dir = cache_dir.empty() ? "" : cache_dir + "/dictionaries";
+  current_id_loaded = false;
+  loaded_dictionaries.clear();
+}
+
+uint32_t
+current_id()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!current_id_loaded) {
+    current_id_loaded = true;
+    current_dictionary_id = 0;
+    if (supported() && !dictionary_dir.empty()) {
+      try {
+        const auto id = Util::read_file(dictionary_dir + "/current");
+        current_dictionary_id =
+          std::strtoul(Util::strip_whitespace(id).c_str(), nullptr, 16);
+      } catch (const Error&) {
+        // No dictionary.
+      }
+    }
+  }
+  return current_dictionary_id;
+}
+
+std::shared_ptr<const std::string>
+load(uint32_t id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const auto it = loaded_dictionaries.find(id);
+  if (it != loaded_dictionaries.end()) {
+    return it->second;
+  }
+  if (!supported()) {
+    throw Error("zstd dictionaries are not supported by libzstd {}",
+                ZSTD_versionString());
+  }
+  if (dictionary_dir.empty()) {
+    throw Error("Unknown location of zstd dictionary {:08x}", id);
+  }
+  const auto path = dictionary_path(id);
+  auto dictionary = std::make_shared<const std::string>(Util::read_file(path));
+  if (ZDICT_getDictID(dictionary->data(), dictionary->size()) != id) {
+    throw Error("Bad zstd dictionary {}", path);
+  }
+  loaded_dictionaries.emplace(id, dictionary);
+  return dictionary;
+}
+
+uint32_t
+train(const std::string& samples,
+      const std::vector<size_t>& sample_sizes,
+      size_t max_size)
+{
+  if (!supported()) {
+    throw Error("zstd dictionaries are not supported by libzstd {}",
+                ZSTD_versionString());
+  }
+
+  std::string dictionary(max_size, '\0');
+  const size_t size = ZDICT_trainFromBuffer(&dictionary[0],
+                                            dictionary.size(),
+                                            samples.data(),
+                                            sample_sizes.data(),
+                                            sample_sizes.size());
+  if (ZDICT_isError(size)) {
+    throw Error("Failed to train zstd dictionary: {}",
+                ZDICT_getErrorName(size));
+  }
+  dictionary.resize(size);
+  const uint32_t id = ZDICT_getDictID(dictionary.data(), dictionary.size());
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Util::ensure_dir_exists(dictionary_dir);
+  AtomicFile dictionary_file(dictionary_path(id), AtomicFile::Mode::binary);
+  dictionary_file.write(dictionary);
+  dictionary_file.commit();
+  AtomicFile current_file(dictionary_dir + "/current", AtomicFile::Mode::text);
+  current_file.write(FMT("{:08x}\n", id));
+  current_file.commit();
+  LOG("Stored zstd dictionary {} ({} bytes)", dictionary_path(id), size);
+
+  current_id_loaded = true;
+  current_dictionary_id = id;
+  return id;
+}
+
+} // namespace ZstdDictionary
@@ -0,0 +1,54 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Zstandard dictionaries trained on cache entries by --train-dictionary. A
+// dictionary is stored as <cache_dir>/dictionaries/<id> where <id> is the
+// dictionary ID in hexadecimal. The dictionary to compress new cache entries
+// with is named by <cache_dir>/dictionaries/current. Dictionaries are never
+// removed by ccache since cache entries compressed with them may still exist.
+namespace ZstdDictionary {
+
+// Whether the linked libzstd supports dictionaries.
+bool supported();
+
+// Set the cache directory to look for dictionaries in.
+void set_cache_dir(const std::string& cache_dir);
+
+// Return the ID of the dictionary to compress new cache entries with, or 0 if
+// there is none.
+uint32_t current_id();
+
+// Return the content of dictionary `id`. Throws Error if not available.
+std::shared_ptr<const std::string> load(uint32_t id);
+
+// Train a dictionary of at most `max_size` bytes on `samples`, the
+// concatenation of samples with sizes `sample_sizes`, store it and make it the
+// current dictionary. Returns the dictionary ID. Throws Error on failure.
+uint32_t train(const std::string& samples,
+               const std::vector<size_t>& sample_sizes,
+               size_t max_size);
+
+} // namespace ZstdDictionary
@@ -46,6 +46,7 @@ struct ArgumentProcessingState
   ColorDiagnostics color_diagnostics = ColorDiagnostics::automatic;
   bool found_directives_only = false;
   bool found_rewrite_includes = false;
+  bool found_fmodule_output = false;
 
   std::string explicit_language;    // As specified with -x.
   std::string file_language;        // As deduced from file extension.
@@ -230,9 +231,83 @@ process_arg(Context& ctx,
     return nullopt;
   }
 
+  if (config.compiler_type() == CompilerType::msvc) {
+    // MSVC options may start with a slash as well. Normalize them to the dash
+    // form, which MSVC also accepts, but leave absolute paths to existing
+    // files alone.
+    if (Util::starts_with(args[i], "/") && !Stat::stat(args[i]).is_regular()) {
+      args[i][0] = '-';
+    }
+
+    if (args[i] == "-E" || args[i] == "-EP" || args[i] == "-P") {
+      return Statistic::called_for_preprocessing;
+    }
+
+    // PDB files shared between compilations, precompiled headers, additional
+    // listing and browse files and input files given by option are too hard.
+    if (args[i] == "-Zi" || args[i] == "-ZI" || args[i] == "-link"
+        || Util::starts_with(args[i], "-analyze")
+        || Util::starts_with(args[i], "-Yc")
+        || Util::starts_with(args[i], "-Yu")
+        || Util::starts_with(args[i], "-Fp")
+        || Util::starts_with(args[i], "-Fa")
+        || Util::starts_with(args[i], "-FA")
+        || Util::starts_with(args[i], "-Fe")
+        || Util::starts_with(args[i], "-Fm")
+        || Util::starts_with(args[i], "-Fr")
+        || Util::starts_with(args[i], "-FR")
+        || Util::starts_with(args[i], "-Tc")
+        || Util::starts_with(args[i], "-Tp")) {
+      LOG("Compiler option {} is unsupported", args[i]);
+      return Statistic::unsupported_compiler_option;
+    }
+
+    // -Fo<path>, -Fo:<path> or -Fo: <path>.
+    if (Util::starts_with(args[i], "-Fo")) {
+      std::string path;
+      if (args[i] == "-Fo:") {
+        if (i == args.size() - 1) {
+          LOG("Missing argument to {}", args[i]);
+          return Statistic::bad_compiler_arguments;
+        }
+        path = args[i + 1];
+        i++;
+      } else {
+        path = args[i].substr(args[i][3] == ':' ? 4 : 3);
+      }
+      if (path.empty() || path.back() == '/' || path.back() == '\\') {
+        // An output directory instead of an output file.
+        LOG("Unsupported object file path: {}", path);
+        return Statistic::unsupported_compiler_option;
+      }
+      args_info.output_obj = Util::make_relative_path(ctx, path);
+      return nullopt;
+    }
+
+    // The included files are listed on standard output, which is stored in
+    // the result.
+    if (args[i] == "-showIncludes") {
+      args_info.generating_includes = true;
+      state.compiler_only_args.push_back(args[i]);
+      return nullopt;
+    }
+
+    // Runtime library options like -MD and -MT and the multi-process build
+    // option -MP share their names with GCC's dependency options.
+    if (Util::starts_with(args[i], "-M")) {
+      state.common_args.push_back(args[i]);
+      return nullopt;
+    }
+  }
+
   // Special case for -E.
   if (args[i] == "-E") {
-    return Statistic::called_for_preprocessing;
+    if (!config.cache_preprocessing()) {
+      return Statistic::called_for_preprocessing;
+    }
+    // ccache adds -E itself when running the preprocessor.
+    args_info.preprocessing_only = true;
+    return nullopt;
   }
 
   // Handle "@file" argument.
@@ -248,7 +323,7 @@ process_arg(Context& ctx,
       return Statistic::bad_compiler_arguments;
     }
 
-    args.replace(i, *file_args);
+    args.replace(i, std::move(*file_args));
     i--;
     return nullopt;
   }
@@ -271,7 +346,7 @@ process_arg(Context& ctx,
         return Statistic::bad_compiler_arguments;
       }
 
-      args.insert(i + 1, *file_args);
+      args.insert(i + 1, std::move(*file_args));
     }
 
     return nullopt;
@@ -364,6 +439,38 @@ process_arg(Context& ctx,
     }
   }
 
+  // Explicitly built C++20 modules (Clang): the binary module interfaces read
+  // with -fmodule-file are hashed like other input files, and one written with
+  // -fmodule-output is stored in the result.
+  if (Util::starts_with(args[i], "-fmodule-file=")) {
+    // The value is [<name>=]<path>.
+    auto value = string_view(args[i]).substr(14);
+    const size_t eq_pos = value.find('=');
+    if (eq_pos != string_view::npos) {
+      value = value.substr(eq_pos + 1);
+    }
+    args_info.module_files.emplace_back(value);
+    state.common_args.push_back(args[i]);
+    return nullopt;
+  }
+  if (args[i] == "-fmodule-output") {
+    state.found_fmodule_output = true;
+    state.compiler_only_args_no_hash.push_back(args[i]);
+    return nullopt;
+  }
+  if (Util::starts_with(args[i], "-fmodule-output=")) {
+    args_info.output_bmi = Util::make_relative_path(ctx, args[i].substr(16));
+    state.compiler_only_args_no_hash.push_back(args[i]);
+    return nullopt;
+  }
+
+  // Binary module interfaces found implicitly can't be hashed.
+  if (args[i] == "-fmodules-ts"
+      || Util::starts_with(args[i], "-fprebuilt-module-path")) {
+    LOG("Compiler option {} is unsupported", args[i]);
+    return Statistic::could_not_use_modules;
+  }
+
   // We must have -c.
   if (args[i] == "-c") {
     state.found_c_opt = true;
@@ -652,6 +759,9 @@ process_arg(Context& ctx,
                        || args[i][6] == 'T')
                    && args[i].find(',', 8) == std::string::npos)) {
       // TODO: Make argument to MF/MQ/MT relative.
+      if (args[i] == "-Wp,-MP") {
+        args_info.seen_MP = true;
+      }
       state.dep_args.push_back(args[i]);
       return nullopt;
     } else if (config.direct_mode()) {
@@ -667,6 +777,7 @@ process_arg(Context& ctx,
   }
 
   if (args[i] == "-MP") {
+    args_info.seen_MP = true;
     state.dep_args.push_back(args[i]);
     return nullopt;
   }
@@ -1003,7 +1114,8 @@ process_args(Context& ctx)
     return Statistic::could_not_use_precompiled_header;
   }
 
-  if (!state.found_c_opt && !state.found_dc_opt && !state.found_S_opt) {
+  if (!state.found_c_opt && !state.found_dc_opt && !state.found_S_opt
+      && !args_info.preprocessing_only) {
     if (args_info.output_is_precompiled_header) {
       state.common_args.push_back("-c");
     } else {
@@ -1026,6 +1138,14 @@ process_args(Context& ctx)
     config.set_run_second_cpp(true);
   }
 
+  if (!config.run_second_cpp()
+      && (Util::get_extension(args_info.input_file) == ".cppm"
+          || Util::get_extension(args_info.input_file) == ".ixx")) {
+    // The compiler recognizes a module interface unit by its extension.
+    LOG_RAW("Compiling module interface unit; not compiling preprocessed code");
+    config.set_run_second_cpp(true);
+  }
+
   args_info.direct_i_file = language_is_preprocessed(args_info.actual_language);
 
   if (args_info.output_is_precompiled_header && !config.run_second_cpp()) {
@@ -1034,13 +1154,31 @@ process_args(Context& ctx)
     config.set_run_second_cpp(true);
   }
 
+  if (args_info.preprocessing_only) {
+    // The output of ccache's own preprocessor run is the result, so it must be
+    // what the user asked for, and the included files must be found from its
+    // line markers for the manifest.
+    if (!config.direct_mode() || config.depend_mode()
+        || config.keep_comments_cpp() || args_info.direct_i_file
+        || args_info.output_is_precompiled_header
+        || args_info.generating_dependencies || args_info.arch_args.size() > 1
+        || state.found_directives_only || state.found_rewrite_includes) {
+      LOG_RAW("Not caching preprocessing with these options");
+      return Statistic::called_for_preprocessing;
+    }
+    config.set_run_second_cpp(false);
+    if (args_info.output_obj.empty()) {
+      args_info.output_obj = "-";
+    }
+  }
+
   if (config.cpp_extension().empty()) {
     std::string p_language = p_language_for_language(args_info.actual_language);
     config.set_cpp_extension(extension_for_language(p_language).substr(1));
   }
 
   // Don't try to second guess the compilers heuristics for stdout handling.
-  if (args_info.output_obj == "-") {
+  if (args_info.output_obj == "-" && !args_info.preprocessing_only) {
     LOG_RAW("Output file is -");
     return Statistic::output_to_stdout;
   }
@@ -1049,7 +1187,10 @@ process_args(Context& ctx)
     if (args_info.output_is_precompiled_header) {
       args_info.output_obj = args_info.input_file + ".gch";
     } else {
-      string_view extension = state.found_S_opt ? ".s" : ".o";
+      string_view extension =
+        state.found_S_opt
+          ? ".s"
+          : (config.compiler_type() == CompilerType::msvc ? ".obj" : ".o");
       args_info.output_obj = Util::change_extension(
         Util::base_name(args_info.input_file), extension);
     }
@@ -1144,12 +1285,29 @@ process_args(Context& ctx)
     }
   }
 
+  if (state.found_fmodule_output && args_info.output_bmi.empty()) {
+    args_info.output_bmi = Util::change_extension(args_info.output_obj, ".pcm");
+  }
+
   if (args_info.generating_stackusage) {
     auto default_sufile_name =
       Util::change_extension(args_info.output_obj, ".su");
     args_info.output_su = Util::make_relative_path(ctx, default_sufile_name);
   }
 
+  // Map the base directory in debug info and __FILE__ so that results can be
+  // shared between checkouts in different directories. Maps given by the user
+  // take precedence.
+  if (config.auto_prefix_map() && !config.base_dir().empty()
+      && (config.compiler_type() == CompilerType::gcc
+          || config.compiler_type() == CompilerType::clang)
+      && args_info.debug_prefix_maps.empty()) {
+    const auto map = FMT("{}=.", config.base_dir());
+    LOG("Adding -ffile-prefix-map={}", map);
+    state.common_args.push_back(FMT("-ffile-prefix-map={}", map));
+    args_info.debug_prefix_maps.push_back(map);
+  }
+
   Args compiler_args = state.common_args;
   compiler_args.push_back(state.compiler_only_args_no_hash);
   compiler_args.push_back(state.compiler_only_args);
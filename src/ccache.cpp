@@ -21,29 +21,53 @@
 
 #include "Args.hpp"
 #include "ArgsInfo.hpp"
+#include "AtomicFile.hpp"
+#include "BackgroundCompressor.hpp"
+#include "BuildId.hpp"
+#include "CacheBundle.hpp"
+#include "CacheSimulator.hpp"
 #include "Checksum.hpp"
+#include "CleanupLease.hpp"
+#include "CompilationDatabase.hpp"
+#include "CompileClaim.hpp"
+#include "CompilerSlot.hpp"
 #include "Compression.hpp"
 #include "Context.hpp"
 #include "Depfile.hpp"
+#include "DigestMemo.hpp"
+#include "EventLog.hpp"
 #include "Fd.hpp"
 #include "File.hpp"
+#include "FileWatch.hpp"
 #include "Finalizer.hpp"
 #include "FormatNonstdStringView.hpp"
+#include "FrequencySketch.hpp"
 #include "Hash.hpp"
+#include "HashPipeline.hpp"
+#include "Jobserver.hpp"
 #include "Lockfile.hpp"
 #include "Logging.hpp"
 #include "Manifest.hpp"
 #include "MiniTrace.hpp"
+#include "MissExplanation.hpp"
+#include "MtimeJournal.hpp"
+#include "NonCopyable.hpp"
 #include "ProgressBar.hpp"
 #include "Result.hpp"
 #include "ResultDumper.hpp"
 #include "ResultExtractor.hpp"
 #include "ResultRetriever.hpp"
+#include "SharedCounters.hpp"
 #include "SignalHandler.hpp"
+#include "Statistics.hpp"
+#include "Storage.hpp"
 #include "StdMakeUnique.hpp"
 #include "TemporaryFile.hpp"
+#include "ThreadPool.hpp"
+#include "Tracing.hpp"
 #include "UmaskScope.hpp"
 #include "Util.hpp"
+#include "ZstdDictionary.hpp"
 #include "argprocessing.hpp"
 #include "cleanup.hpp"
 #include "compopt.hpp"
@@ -68,11 +92,25 @@
 
 #ifdef _WIN32
 #  include "Win32Util.hpp"
+#else
+#  include "CompileServer.hpp"
+#  include "PeerServer.hpp"
+#  include "TcpConnection.hpp"
 #endif
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <exception>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_set>
 
 #ifndef MYNAME
 #  define MYNAME "ccache"
@@ -99,8 +137,9 @@ version.
 
 constexpr const char USAGE_TEXT[] =
   R"(Usage:
-    {} [options]
-    {} compiler [compiler options]
+    {0} [options]
+    {0} compiler [compiler options]
+    {0} --run [--input PATH]... --output PATH... -- command [args]
     compiler [compiler options]          (via symbolic link)
 
 Common options:
@@ -112,13 +151,43 @@ Common options:
                                default
     -d, --directory PATH       operate on cache directory PATH instead of the
                                default
+        --evaluate-compression NUM
+                               print the compression ratio and speed of
+                               different compression levels on NUM randomly
+                               picked cache entries
         --evict-older-than AGE remove files older than AGE (unsigned integer
                                with a d (days) or s (seconds) suffix)
+        --export PATH          write the manifests and results in the cache to
+                               a bundle file at PATH
+        --export-size SIZE     with --export, only write the most recently
+                               used files up to SIZE (same suffixes as -M)
+        --import PATH          store the files in the bundle at PATH that are
+                               missing in the cache
     -F, --max-files NUM        set maximum number of files in cache to NUM (use
                                0 for no limit)
     -M, --max-size SIZE        set maximum size of cache to SIZE (use 0 for no
                                limit); available suffixes: k, M, G, T (decimal)
                                and Ki, Mi, Gi, Ti (binary); default suffix: G
+        --migrate              rewrite cache entries stored in the previous
+                               format version in the current one
+        --pin NAMESPACE=SIZE   protect the most recently used files stored in
+                               NAMESPACE, up to SIZE, from eviction; 0 unpins
+        --prefetch PATH        fetch the manifests and results of the
+                               compilations in the JSON compilation database at
+                               PATH from the secondary storage
+        --rebalance            move the files in each cache subdirectory to
+                               the number of directory levels suited for its
+                               size
+        --recount-stats        recount the statistics summary from the stats
+                               files
+        --scrub                verify the checksums of all results and remove
+                               corrupt ones
+        --serve-compiles ADDRESS
+                               compile preprocessed source code for other
+                               workstations on ADDRESS ([host][:port], only
+                               127.0.0.1 without host) until interrupted
+        --serve-peers ADDRESS  serve the cache read-only to other workstations
+                               on ADDRESS ([host][:port]) until interrupted
     -X, --recompress LEVEL     recompress the cache to level LEVEL (integer or
                                "uncompressed") using the Zstandard algorithm;
                                see "Cache compression" in the manual for details
@@ -128,6 +197,22 @@ Common options:
                                human-readable format
     -s, --show-stats           show summary of configuration and statistics
                                counters in human-readable format
+        --by DIMENSION         with -s, show statistics per compiler,
+                               directory or namespace instead (see
+                               stats_breakdown)
+        --session ID           with -s or -z, show or zero the statistics of
+                               session ID instead (see session)
+        --simulate PATH        print the hit rates that the compilations in
+                               the event log at PATH would get with different
+                               cache sizes and cleanup policies
+        --train-dictionary     train a Zstandard dictionary on the cache entries
+                               and compress new cache entries with it; see
+                               "Cache compression" in the manual for details
+    -v, --verbose              with -s, also show durations of the phases of
+                               ccache invocations (see phase_durations)
+        --watch DIRS           watch the colon-separated directory trees DIRS
+                               for changes until interrupted so that unchanged
+                               include files need not be rehashed (Linux only)
     -z, --zero-stats           zero statistics counters
 
     -h, --help                 print this help text
@@ -138,13 +223,21 @@ Options for scripting or debugging:
                                PATH
         --dump-manifest PATH   dump manifest file at PATH in text format
         --dump-result PATH     dump result file at PATH in text format
+        --explain-miss PATH    print which hashed inputs changed between the
+                               last two compilations of the output file PATH
+                               that were stored in the cache (see
+                               explain_misses)
         --extract-result PATH  extract data stored in result file at PATH to the
                                current working directory
     -k, --get-config KEY       print the value of configuration key KEY
         --hash-file PATH       print the hash (160 bit BLAKE3) of the file at
                                PATH
+        --metrics              print statistics in OpenMetrics text format
         --print-stats          print statistics counter IDs and corresponding
                                values in machine-parsable format
+        --probe PATH           print whether each compilation in the JSON
+                               compilation database at PATH would be a direct
+                               mode cache hit, without running any compiler
 
 See also the manual on <https://ccache.dev/documentation.html>.
 )";
@@ -153,26 +246,12 @@ See also the manual on <https://ccache.dev/documentation.html>.
 // files.
 const int k_tempdir_cleanup_interval = 2 * 24 * 60 * 60; // 2 days
 
-// Maximum files per cache directory. This constant is somewhat arbitrarily
-// chosen to be large enough to avoid unnecessary cache levels but small enough
-// not to make esoteric file systems (with bad performance for large
-// directories) too slow. It could be made configurable, but hopefully there
-// will be no need to do that.
-const uint64_t k_max_cache_files_per_directory = 2000;
-
-// Minimum number of cache levels ($CCACHE_DIR/1/2/stored_file).
-const uint8_t k_min_cache_levels = 2;
+// Include files are hashed on several threads if there are at least this many.
+const size_t k_min_include_files_for_threads = 16;
 
-// Maximum number of cache levels ($CCACHE_DIR/1/2/3/stored_file).
-//
-// On a cache miss, (k_max_cache_levels - k_min_cache_levels + 1) cache lookups
-// (i.e. stat system calls) will be performed for a cache entry.
-//
-// An assumption made here is that if a cache is so large that it holds more
-// than 16^4 * k_max_cache_files_per_directory files then we can assume that the
-// file system is sane enough to handle more than
-// k_max_cache_files_per_directory.
-const uint8_t k_max_cache_levels = 4;
+// Preprocessed output at least this large is hashed on a separate thread while
+// it's scanned.
+const size_t k_min_size_for_hash_pipeline = 1024 * 1024;
 
 // This is a string that identifies the current "version" of the hash sum
 // computed by ccache. If, for any reason, we want to force the hash sum to be
@@ -232,6 +311,26 @@ clean_up_internal_tempdir(const Config& config)
   });
 }
 
+// Return `path` relocated like the compiler does in debug info according to the
+// -fdebug-prefix-map and -ffile-prefix-map options. The last matching map wins.
+static std::string
+apply_debug_prefix_maps(const ArgsInfo& args_info, const std::string& path)
+{
+  std::string result = path;
+  for (const auto& map : args_info.debug_prefix_maps) {
+    size_t sep_pos = map.find('=');
+    if (sep_pos != std::string::npos) {
+      const auto old_path = string_view(map).substr(0, sep_pos);
+      const auto new_path = string_view(map).substr(sep_pos + 1);
+      if (Util::starts_with(path, old_path)) {
+        LOG("Relocating {} from {} to {}", path, old_path, new_path);
+        result = FMT("{}{}", new_path, path.substr(old_path.size()));
+      }
+    }
+  }
+  return result;
+}
+
 static void
 init_hash_debug(Context& ctx,
                 Hash& hash,
@@ -282,6 +381,9 @@ guess_compiler(string_view path)
   } else if (name.find("gcc") != nonstd::string_view::npos
              || name.find("g++") != nonstd::string_view::npos) {
     return CompilerType::gcc;
+  } else if (Util::to_lowercase(name) == "cl"
+             || Util::to_lowercase(name) == "cl.exe") {
+    return CompilerType::msvc;
   } else if (name.find("nvcc") != nonstd::string_view::npos) {
     return CompilerType::nvcc;
   } else if (name == "pump" || name == "distcc-pump") {
@@ -291,129 +393,406 @@ guess_compiler(string_view path)
   }
 }
 
+// Return whether the compiler is clang-cl, i.e. Clang in MSVC driver mode,
+// which is otherwise handled like Clang.
 static bool
-do_remember_include_file(Context& ctx,
-                         std::string path,
-                         Hash& cpp_hash,
-                         bool system,
-                         Hash* depend_mode_hash)
+is_clang_cl(const Context& ctx)
 {
-  bool is_pch = false;
-
-  if (path.length() >= 2 && path[0] == '<' && path[path.length() - 1] == '>') {
-    // Typically <built-in> or <command-line>.
-    return true;
+  if (ctx.config.compiler_type() != CompilerType::clang) {
+    return false;
   }
-
-  if (path == ctx.args_info.input_file) {
-    // Don't remember the input file.
+  const auto name = Util::to_lowercase(Util::base_name(ctx.orig_args[0]));
+  if (name.find("clang-cl") != std::string::npos) {
     return true;
   }
-
-  if (system && (ctx.config.sloppiness() & SLOPPY_SYSTEM_HEADERS)) {
-    // Don't remember this system header.
-    return true;
+  for (size_t i = 1; i < ctx.orig_args.size(); ++i) {
+    if (ctx.orig_args[i] == "--driver-mode=cl") {
+      return true;
+    }
   }
+  return false;
+}
 
-  if (ctx.included_files.find(path) != ctx.included_files.end()) {
-    // Already known include file.
+// Return whether `current` has the identity, size and modification time
+// recorded in `stat`.
+static bool
+is_same_file_version(const Stat& current, const Stat& stat)
+{
+  return current && stat && current.same_inode_as(stat)
+         && current.size() == stat.size()
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+         && current.mtim().tv_sec == stat.mtim().tv_sec
+         && current.mtim().tv_nsec == stat.mtim().tv_nsec
+#else
+         && current.mtime() == stat.mtime()
+#endif
+    ;
+}
+
+// Return whether `path` still has the identity, size and modification time
+// recorded in `stat`. Non-regular files like /dev/null are always considered
+// unmodified.
+static bool
+is_unmodified(const std::string& path, const Stat& stat)
+{
+  if (stat && !stat.is_regular()) {
     return true;
   }
+  return is_same_file_version(Stat::stat(path), stat);
+}
 
-  // Canonicalize path for comparison; Clang uses ./header.h.
-  if (Util::starts_with(path, "./")) {
-    path.erase(0, 2);
-  }
+namespace {
+
+enum class IncludeFileStatus { ok, ignored, failed };
 
+} // namespace
+
+// Check whether an include file may be remembered. Does not modify `ctx`, so
+// it can be called from worker threads. The result of stat-ing the file is
+// stored in `stat` if given.
+static IncludeFileStatus
+check_include_file(const Context& ctx,
+                   const std::string& path,
+                   Stat* stat = nullptr)
+{
 #ifdef _WIN32
   {
     // stat fails on directories on win32.
     DWORD attributes = GetFileAttributes(path.c_str());
     if (attributes != INVALID_FILE_ATTRIBUTES
         && attributes & FILE_ATTRIBUTE_DIRECTORY) {
-      return true;
+      return IncludeFileStatus::ignored;
     }
   }
 #endif
 
+  // Not stat-ed through ctx.stat_cache since the result may be from before
+  // the compilation started, which would defeat the checks for files modified
+  // during the compilation below.
   auto st = Stat::stat(path, Stat::OnError::log);
+  if (stat) {
+    *stat = st;
+  }
   if (!st) {
-    return false;
+    return IncludeFileStatus::failed;
   }
   if (st.is_directory()) {
     // Ignore directory, typically $PWD.
-    return true;
+    return IncludeFileStatus::ignored;
   }
   if (!st.is_regular()) {
     // Device, pipe, socket or other strange creature.
     LOG("Non-regular include file {}", path);
-    return false;
+    return IncludeFileStatus::failed;
   }
 
-  for (const auto& ignore_header_path : ctx.ignore_header_paths) {
-    if (Util::matches_dir_prefix_or_file(ignore_header_path, path)) {
-      return true;
-    }
+  if (ctx.ignore_header_paths.matches(path)) {
+    return IncludeFileStatus::ignored;
   }
 
+  // Files in the digest map are hashed by the digest from the build, so a race
+  // with writing them doesn't matter.
+  const bool mapped = find_in_digest_map(ctx, path);
+
   // The comparison using >= is intentional, due to a possible race between
   // starting compilation and writing the include file. See also the notes
   // under "Performance" in doc/MANUAL.adoc.
-  if (!(ctx.config.sloppiness() & SLOPPY_INCLUDE_FILE_MTIME)
+  if (!mapped && !(ctx.config.sloppiness() & SLOPPY_INCLUDE_FILE_MTIME)
       && st.mtime() >= ctx.time_of_compilation) {
     LOG("Include file {} too new", path);
-    return false;
+    return IncludeFileStatus::failed;
   }
 
   // The same >= logic as above applies to the change time of the file.
-  if (!(ctx.config.sloppiness() & SLOPPY_INCLUDE_FILE_CTIME)
+  if (!mapped && !(ctx.config.sloppiness() & SLOPPY_INCLUDE_FILE_CTIME)
       && st.ctime() >= ctx.time_of_compilation) {
     LOG("Include file {} ctime too new", path);
-    return false;
+    return IncludeFileStatus::failed;
+  }
+
+  return IncludeFileStatus::ok;
+}
+
+// Check and hash an include file which is not a precompiled header. Like
+// check_include_file, this can be called from worker threads.
+static IncludeFileStatus
+hash_include_file(const Context& ctx, const std::string& path, Digest& digest)
+{
+  Stat stat;
+  const auto status = check_include_file(ctx, path, &stat);
+  if (status != IncludeFileStatus::ok) {
+    return status;
+  }
+
+  // The digest computed while verifying the manifest can only be reused if the
+  // file hasn't been modified since it was stat-ed then.
+  const auto verified = ctx.verified_include_digests.find(path);
+  if (verified != ctx.verified_include_digests.end()
+      && is_same_file_version(stat, ctx.stat_cache.stat(path))) {
+    digest = verified->second;
+    return IncludeFileStatus::ok;
   }
 
-  // Let's hash the include file content.
   Hash fhash;
+  int result = hash_source_code_file(ctx, fhash, path);
+  if (result & HASH_SOURCE_CODE_ERROR
+      || result & HASH_SOURCE_CODE_FOUND_TIME) {
+    return IncludeFileStatus::failed;
+  }
+  digest = fhash.digest();
+  return IncludeFileStatus::ok;
+}
 
-  is_pch = Util::is_precompiled_header(path);
-  if (is_pch) {
-    if (ctx.included_pch_file.empty()) {
-      LOG("Detected use of precompiled header: {}", path);
-    }
-    bool using_pch_sum = false;
-    if (ctx.config.pch_external_checksum()) {
-      // hash pch.sum instead of pch when it exists
-      // to prevent hashing a very large .pch file every time
-      std::string pch_sum_path = FMT("{}.sum", path);
-      if (Stat::stat(pch_sum_path, Stat::OnError::log)) {
-        path = std::move(pch_sum_path);
-        using_pch_sum = true;
-        LOG("Using pch.sum file {}", path);
+// Hash the include files queued by remember_include_file and store them in
+// ctx.included_files in the order they were found.
+static void
+hash_pending_include_files(Context& ctx)
+{
+  auto pending = std::move(ctx.pending_include_files);
+  ctx.pending_include_files.clear();
+  ctx.pending_include_file_paths.clear();
+  if (pending.empty() || !ctx.config.direct_mode()) {
+    return;
+  }
+
+  std::vector<IncludeFileStatus> statuses(pending.size(),
+                                          IncludeFileStatus::ignored);
+  std::vector<Digest> digests(pending.size());
+  const auto hash_file = [&](size_t i) {
+    statuses[i] =
+      hash_include_file(ctx, std::string(pending[i].first), digests[i]);
+    return statuses[i] != IncludeFileStatus::failed;
+  };
+
+  // Reading many headers with a cold page cache is dominated by I/O latency,
+  // so use a few threads for them.
+  const size_t threads = ctx.include_file_threads();
+  if (pending.size() >= k_min_include_files_for_threads && threads > 1) {
+    // The calling thread also takes part in the hashing.
+    Jobserver::Tokens tokens(threads - 1);
+    ctx.include_file_thread_pool().for_each_index(
+      pending.size(), hash_file, tokens.count());
+  } else {
+    for (size_t i = 0; i < pending.size(); ++i) {
+      if (!hash_file(i)) {
+        break;
       }
     }
+  }
 
-    if (!hash_binary_file(ctx, fhash, path)) {
-      return false;
+  // Hashing stops after the first failure, but all files before it have been
+  // hashed.
+  for (size_t i = 0; i < pending.size(); ++i) {
+    if (statuses[i] == IncludeFileStatus::failed) {
+      LOG_RAW("Disabling direct mode");
+      ctx.config.set_direct_mode(false);
+      return;
+    }
+    if (statuses[i] == IncludeFileStatus::ignored) {
+      continue;
+    }
+    ctx.included_files.emplace(pending[i].first, digests[i]);
+
+    Hash* depend_mode_hash = pending[i].second;
+    if (depend_mode_hash) {
+      depend_mode_hash->hash_delimiter("include");
+      depend_mode_hash->hash(digests[i].to_string());
     }
-    cpp_hash.hash_delimiter(using_pch_sum ? "pch_sum_hash" : "pch_hash");
-    cpp_hash.hash(fhash.digest().to_string());
   }
+}
 
-  if (ctx.config.direct_mode()) {
-    if (!is_pch) { // else: the file has already been hashed.
-      int result = hash_source_code_file(ctx, fhash, path);
-      if (result & HASH_SOURCE_CODE_ERROR
-          || result & HASH_SOURCE_CODE_FOUND_TIME) {
-        return false;
-      }
+// The digest file written next to a precompiled header produced by ccache
+// contains the identity of the precompiled header followed by the digest of
+// its content, letting consumers skip hashing it as long as it's unmodified.
+static std::string
+get_pch_digest_path(const std::string& pch_path)
+{
+  return FMT("{}.ccache-digest", pch_path);
+}
+
+static optional<Digest>
+get_pch_identity(const std::string& pch_path, const Stat& stat)
+{
+  // The identity is bound to the file name instead of the full path since the
+  // precompiled header may be referred to via different paths.
+  Hash hash;
+  if (!DigestMemo::hash_file_identity(
+        hash, std::string(Util::base_name(pch_path)), stat)) {
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    // A newly written file is only safe to identify if the file system has
+    // subsecond timestamps.
+    if (stat.mtim().tv_nsec == 0) {
+      return nullopt;
+    }
+#else
+    return nullopt;
+#endif
+  }
+  return hash.digest();
+}
+
+static void
+write_pch_digest_file(const Context& ctx, const std::string& pch_path)
+{
+  const auto stat = Stat::stat(pch_path);
+  if (!stat) {
+    return;
+  }
+  const auto identity = get_pch_identity(pch_path, stat);
+  if (!identity) {
+    LOG("Not writing digest file for {} since it's too new", pch_path);
+    return;
+  }
+  Digest digest;
+  if (!get_binary_file_digest(ctx, pch_path, digest)) {
+    return;
+  }
+  if (!is_unmodified(pch_path, stat)) {
+    LOG("{} was modified while hashing it", pch_path);
+    return;
+  }
+
+  std::string data(reinterpret_cast<const char*>(identity->bytes()),
+                   Digest::size());
+  data.append(reinterpret_cast<const char*>(digest.bytes()), Digest::size());
+  const auto digest_path = get_pch_digest_path(pch_path);
+  try {
+    AtomicFile file(digest_path, AtomicFile::Mode::binary);
+    file.write(data);
+    file.commit();
+    LOG("Wrote digest file {}", digest_path);
+  } catch (const Error& e) {
+    LOG("Failed to write {}: {}", digest_path, e.what());
+  }
+}
+
+// Return the content digest stored in the digest file of the precompiled
+// header at `pch_path` if it's still valid.
+static optional<Digest>
+read_pch_digest_file(const std::string& pch_path)
+{
+  const auto digest_path = get_pch_digest_path(pch_path);
+  std::string data;
+  try {
+    data = Util::read_file(digest_path);
+  } catch (const Error&) {
+    return nullopt;
+  }
+  if (data.size() != 2 * Digest::size()) {
+    LOG("Ignoring malformed digest file {}", digest_path);
+    return nullopt;
+  }
+
+  const auto identity = get_pch_identity(pch_path, Stat::stat(pch_path));
+  if (!identity
+      || memcmp(identity->bytes(), data.data(), Digest::size()) != 0) {
+    LOG("Ignoring stale digest file {}", digest_path);
+    return nullopt;
+  }
+
+  Digest digest;
+  memcpy(digest.bytes(), data.data() + Digest::size(), Digest::size());
+  return digest;
+}
+
+static bool
+do_remember_include_file(Context& ctx,
+                         std::string path,
+                         Hash& cpp_hash,
+                         bool system,
+                         Hash* depend_mode_hash)
+{
+  if (path.length() >= 2 && path[0] == '<' && path[path.length() - 1] == '>') {
+    // Typically <built-in> or <command-line>.
+    return true;
+  }
+
+  if (path == ctx.args_info.input_file) {
+    // Don't remember the input file.
+    return true;
+  }
+
+  if (system && (ctx.config.sloppiness() & SLOPPY_SYSTEM_HEADERS)) {
+    // Don't remember this system header.
+    return true;
+  }
+
+  if (ctx.system_include_roots.matches(path)) {
+    // Covered by the fingerprint of the root.
+    return true;
+  }
+
+  if (ctx.included_files.find(path) != ctx.included_files.end()
+      || ctx.pending_include_file_paths.find(path)
+           != ctx.pending_include_file_paths.end()) {
+    // Already known include file.
+    return true;
+  }
+
+  // Canonicalize path for comparison; Clang uses ./header.h.
+  if (Util::starts_with(path, "./")) {
+    path.erase(0, 2);
+  }
+
+  if (!Util::is_precompiled_header(path)) {
+    // Only the digest is needed, and only in direct mode, so hash the file
+    // later together with all other include files.
+    if (ctx.config.direct_mode()) {
+      const auto stored_path = ctx.arena.copy(path);
+      ctx.pending_include_file_paths.insert(stored_path);
+      ctx.pending_include_files.emplace_back(stored_path, depend_mode_hash);
+    }
+    return true;
+  }
+
+  // Hash queued include files first so that digests are added to
+  // depend_mode_hash in order.
+  hash_pending_include_files(ctx);
+
+  const auto status = check_include_file(ctx, path);
+  if (status != IncludeFileStatus::ok) {
+    return status == IncludeFileStatus::ignored;
+  }
+
+  if (ctx.included_pch_file.empty()) {
+    LOG("Detected use of precompiled header: {}", path);
+  }
+  bool using_pch_sum = false;
+  if (ctx.config.pch_external_checksum()) {
+    // hash pch.sum instead of pch when it exists
+    // to prevent hashing a very large .pch file every time
+    std::string pch_sum_path = FMT("{}.sum", path);
+    if (Stat::stat(pch_sum_path, Stat::OnError::log)) {
+      path = std::move(pch_sum_path);
+      using_pch_sum = true;
+      LOG("Using pch.sum file {}", path);
+    }
+  }
+
+  // Let's hash the include file content, unless ccache produced the
+  // precompiled header and recorded its digest.
+  optional<Digest> d;
+  if (!using_pch_sum) {
+    d = read_pch_digest_file(path);
+    if (d) {
+      LOG("Using digest file for {}", path);
+    }
+  }
+  if (!d) {
+    d.emplace();
+    if (!get_binary_file_digest(ctx, path, *d)) {
+      return false;
     }
+  }
+  cpp_hash.hash_delimiter(using_pch_sum ? "pch_sum_hash" : "pch_hash");
+  cpp_hash.hash(d->to_string());
 
-    Digest d = fhash.digest();
-    ctx.included_files.emplace(path, d);
+  if (ctx.config.direct_mode()) {
+    ctx.included_files.emplace(ctx.arena.copy(path), *d);
 
     if (depend_mode_hash) {
       depend_mode_hash->hash_delimiter("include");
-      depend_mode_hash->hash(d.to_string());
+      depend_mode_hash->hash(d->to_string());
     }
   }
 
@@ -422,6 +801,8 @@ do_remember_include_file(Context& ctx,
 
 // This function hashes an include file and stores the path and hash in
 // ctx.included_files. If the include file is a PCH, cpp_hash is also updated.
+// Other include files are only queued; hash_pending_include_files must be
+// called before ctx.included_files is used.
 static void
 remember_include_file(Context& ctx,
                       const std::string& path,
@@ -444,29 +825,33 @@ print_included_files(const Context& ctx, FILE* fp)
   }
 }
 
-// This function reads and hashes a file. While doing this, it also does these
-// things:
+// Include files found in preprocessed output: path and whether it's a system
+// header.
+using PreprocessedIncludes = std::vector<std::pair<std::string, bool>>;
+
+// This function hashes preprocessed output. While doing this, it also does
+// these things:
 //
 // - Makes include file paths for which the base directory is a prefix relative
 //   when computing the hash sum.
-// - Stores the paths and hashes of included files in ctx.included_files.
+// - Adds the paths of included files to `includes`, for
+//   remember_preprocessed_includes.
+//
+// `data` must start at the beginning of a line and be followed by a NUL byte
+// somewhere after `size` bytes. Output may be processed in several calls as
+// long as each one ends with a complete line.
 static bool
-process_preprocessed_file(Context& ctx,
-                          Hash& hash,
-                          const std::string& path,
-                          bool pump)
+process_preprocessed_output(Context& ctx,
+                            HashPipeline& hash,
+                            char* data,
+                            size_t size,
+                            bool pump,
+                            PreprocessedIncludes& includes)
 {
-  std::string data;
-  try {
-    data = Util::read_file(path);
-  } catch (Error&) {
-    return false;
-  }
-
   // Bytes between p and q are pending to be hashed.
-  const char* p = &data[0];
-  char* q = &data[0];
-  const char* end = p + data.length();
+  const char* p = data;
+  char* q = data;
+  const char* end = p + size;
 
   // There must be at least 7 characters (# 1 "x") left to potentially find an
   // include file path.
@@ -506,7 +891,7 @@ process_preprocessed_file(Context& ctx,
             // HP/AIX:
             || (q[1] == 'l' && q[2] == 'i' && q[3] == 'n' && q[4] == 'e'
                 && q[5] == ' '))
-        && (q == data.data() || q[-1] == '\n')) {
+        && (q == data || q[-1] == '\n')) {
       // Workarounds for preprocessor linemarker bugs in GCC version 6.
       if (q[2] == '3') {
         if (Util::starts_with(q, hash_31_command_line_newline)) {
@@ -563,6 +948,18 @@ process_preprocessed_file(Context& ctx,
       if (!ctx.has_absolute_include_headers) {
         ctx.has_absolute_include_headers = Util::is_absolute_path(inc_path);
       }
+      if (ctx.config.compiler_type() == CompilerType::msvc) {
+        // MSVC escapes backslashes: #line 1 "C:\\dir\\file.h".
+        std::string unescaped;
+        for (size_t j = 0; j < inc_path.size(); ++j) {
+          if (inc_path[j] == '\\' && j + 1 < inc_path.size()
+              && inc_path[j + 1] == '\\') {
+            ++j;
+          }
+          unescaped += inc_path[j];
+        }
+        inc_path = std::move(unescaped);
+      }
       inc_path = Util::make_relative_path(ctx, inc_path);
 
       bool should_hash_inc_path = true;
@@ -580,10 +977,15 @@ process_preprocessed_file(Context& ctx,
         }
       }
       if (should_hash_inc_path) {
-        hash.hash(inc_path);
+        // Paths that are still absolute end up relocated in the debug info, so
+        // hash them relocated too in order to share results between
+        // directories.
+        hash.hash(Util::is_absolute_path(inc_path)
+                    ? apply_debug_prefix_maps(ctx.args_info, inc_path)
+                    : inc_path);
       }
 
-      remember_include_file(ctx, inc_path, hash, system, nullptr);
+      includes.emplace_back(std::move(inc_path), system);
       p = q; // Everything of interest between p and q has been hashed now.
     } else if (q[0] == '.' && q[1] == 'i' && q[2] == 'n' && q[3] == 'c'
                && q[4] == 'b' && q[5] == 'i' && q[6] == 'n') {
@@ -609,11 +1011,31 @@ process_preprocessed_file(Context& ctx,
       p = q;
       continue;
     } else {
-      q++;
+      q += find_preprocessed_marker(q + 1, end, pump) - q;
     }
   }
 
   hash.hash(p, (end - p));
+  return true;
+}
+
+// Remember the include files found by process_preprocessed_output. Only
+// precompiled headers are added to `hash`, after the preprocessed output.
+static void
+remember_preprocessed_includes(Context& ctx,
+                               Hash& hash,
+                               const PreprocessedIncludes& includes)
+{
+  for (const auto& include : includes) {
+    remember_include_file(ctx, include.first, hash, include.second, nullptr);
+  }
+}
+
+// Hash what process_preprocessed_output can't find in the preprocessed output.
+static void
+finish_preprocessed_output(Context& ctx, Hash& hash)
+{
+  hash_pending_include_files(ctx);
 
   // Explicitly check the .gch/.pch/.pth file as Clang does not include any
   // mention of it in the preprocessed output.
@@ -627,34 +1049,98 @@ process_preprocessed_file(Context& ctx,
   if (debug_included) {
     print_included_files(ctx, stdout);
   }
+}
+
+bool
+process_preprocessed_file(Context& ctx,
+                          Hash& hash,
+                          const std::string& path,
+                          bool pump)
+{
+  std::string data;
+  try {
+    data = Util::read_file(path);
+  } catch (Error&) {
+    return false;
+  }
+
+  // Hash the text of large output on another thread while it's scanned.
+  PreprocessedIncludes includes;
+  HashPipeline pipeline(hash,
+                        data.size() >= k_min_size_for_hash_pipeline
+                          && std::thread::hardware_concurrency() > 1);
+  if (!process_preprocessed_output(
+        ctx, pipeline, &data[0], data.size(), pump, includes)) {
+    return false;
+  }
+  pipeline.finish();
+  remember_preprocessed_includes(ctx, hash, includes);
+  finish_preprocessed_output(ctx, hash);
+  return true;
+}
 
+#ifndef _WIN32
+// Like process_preprocessed_file but read the preprocessed output from `fd` and
+// process each complete line as soon as it has been read.
+static bool
+process_preprocessed_stream(Context& ctx, Hash& hash, const Fd& fd, bool pump)
+{
+  std::string data;
+  bool ok = true;
+  PreprocessedIncludes includes;
+  // The data is only valid until the next read, so hash it right away.
+  HashPipeline pipeline(hash, false);
+  const bool read_ok =
+    Util::read_fd(*fd, [&](const void* buffer, size_t size) {
+      if (!ok) {
+        return;
+      }
+      data.append(static_cast<const char*>(buffer), size);
+      const size_t line_end = data.rfind('\n');
+      if (line_end != std::string::npos) {
+        ok = process_preprocessed_output(
+          ctx, pipeline, &data[0], line_end + 1, pump, includes);
+        data.erase(0, line_end + 1);
+      }
+    });
+  if (!read_ok || !ok
+      || !process_preprocessed_output(
+        ctx, pipeline, &data[0], data.size(), pump, includes)) {
+    return false;
+  }
+  remember_preprocessed_includes(ctx, hash, includes);
+  finish_preprocessed_output(ctx, hash);
   return true;
 }
+#endif
 
 // Extract the used includes from the dependency file. Note that we cannot
 // distinguish system headers from other includes here.
 static optional<Digest>
 result_name_from_depfile(Context& ctx, Hash& hash)
 {
+  const std::string& dep_file = ctx.args_info.injected_output_dep.empty()
+                                  ? ctx.args_info.output_dep
+                                  : ctx.args_info.injected_output_dep;
   std::string file_content;
   try {
-    file_content = Util::read_file(ctx.args_info.output_dep);
+    file_content = Util::read_file(dep_file);
   } catch (const Error& e) {
-    LOG(
-      "Cannot open dependency file {}: {}", ctx.args_info.output_dep, e.what());
+    LOG("Cannot open dependency file {}: {}", dep_file, e.what());
     return nullopt;
   }
 
-  for (string_view token : Depfile::tokenize(file_content)) {
+  Depfile::for_each_token(file_content, [&](string_view token) {
     if (token.ends_with(":")) {
-      continue;
+      return;
     }
     if (!ctx.has_absolute_include_headers) {
       ctx.has_absolute_include_headers = Util::is_absolute_path(token);
     }
     std::string path = Util::make_relative_path(ctx, token);
     remember_include_file(ctx, path, hash, false, &hash);
-  }
+  });
+  hash_pending_include_files(ctx);
 
   // Explicitly check the .gch/.pch/.pth file as it may not be mentioned in the
   // dependencies output.
@@ -671,24 +1157,86 @@ result_name_from_depfile(Context& ctx, Hash& hash)
 
   return hash.digest();
 }
-// Execute the compiler/preprocessor, with logic to retry without requesting
-// colored diagnostics messages if that fails.
-static int
-do_execute(Context& ctx,
-           Args& args,
-           TemporaryFile&& tmp_stdout,
-           TemporaryFile&& tmp_stderr)
-{
-  UmaskScope umask_scope(ctx.original_umask);
 
-  if (ctx.diagnostics_color_failed) {
-    DEBUG_ASSERT(ctx.config.compiler_type() == CompilerType::gcc);
+// MSVC writes diagnostics and, with /showIncludes, a note per included file to
+// standard output. Collect the paths of the notes in `included_files` and
+// return the output without them unless the user asked for them.
+static std::string
+extract_msvc_included_files(const Context& ctx,
+                            string_view stdout_data,
+                            std::vector<std::string>& included_files)
+{
+  static const string_view include_prefix = "Note: including file:";
+
+  std::string remaining;
+  while (!stdout_data.empty()) {
+    const size_t eol = stdout_data.find('\n');
+    const auto line = stdout_data.substr(
+      0, eol == string_view::npos ? stdout_data.size() : eol + 1);
+    stdout_data.remove_prefix(line.size());
+
+    if (line.starts_with(include_prefix)) {
+      // The path is indented to show the nesting of includes.
+      included_files.emplace_back(
+        Util::strip_whitespace(line.substr(include_prefix.size())));
+      if (!ctx.args_info.generating_includes) {
+        continue;
+      }
+    }
+    remaining.append(line.data(), line.size());
+  }
+  return remaining;
+}
+
+// Like result_name_from_depfile but for the included files listed by MSVC's
+// /showIncludes.
+static Digest
+result_name_from_included_files(Context& ctx,
+                                Hash& hash,
+                                const std::vector<std::string>& included_files)
+{
+  for (const auto& included_file : included_files) {
+    if (!ctx.has_absolute_include_headers) {
+      ctx.has_absolute_include_headers = Util::is_absolute_path(included_file);
+    }
+    std::string path = Util::make_relative_path(ctx, included_file);
+    remember_include_file(ctx, path, hash, false, &hash);
+  }
+  finish_preprocessed_output(ctx, hash);
+  return hash.digest();
+}
+
+// Wait for a slot for running the real compiler on a cache miss, if limited by
+// max_compiler_jobs.
+static std::unique_ptr<CompilerSlot>
+acquire_compiler_slot(const Context& ctx)
+{
+  return std::make_unique<CompilerSlot>(
+    FMT("{}/compiler_slots", ctx.config.temporary_dir()),
+    ctx.config.max_compiler_jobs());
+}
+
+// Execute the compiler/preprocessor, with logic to retry without requesting
+// colored diagnostics messages if that fails. The resources used by the last
+// run are stored in `usage` if non-null.
+static int
+do_execute(Context& ctx,
+           Args& args,
+           TemporaryFile&& tmp_stdout,
+           TemporaryFile&& tmp_stderr,
+           ProcessUsage* usage = nullptr)
+{
+  UmaskScope umask_scope(ctx.original_umask);
+
+  if (ctx.diagnostics_color_failed) {
+    DEBUG_ASSERT(ctx.config.compiler_type() == CompilerType::gcc);
     args.erase_last("-fdiagnostics-color");
   }
   int status = execute(args.to_argv().data(),
                        std::move(tmp_stdout.fd),
                        std::move(tmp_stderr.fd),
-                       &ctx.compiler_pid);
+                       &ctx.compiler_pid,
+                       usage);
   if (status != 0 && !ctx.diagnostics_color_failed
       && ctx.config.compiler_type() == CompilerType::gcc) {
     auto errors = Util::read_file(tmp_stderr.path);
@@ -719,40 +1267,12 @@ do_execute(Context& ctx,
 
       ctx.diagnostics_color_failed = true;
       return do_execute(
-        ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+        ctx, args, std::move(tmp_stdout), std::move(tmp_stderr), usage);
     }
   }
   return status;
 }
 
-struct LookUpCacheFileResult
-{
-  std::string path;
-  Stat stat;
-  uint8_t level;
-};
-
-static LookUpCacheFileResult
-look_up_cache_file(const std::string& cache_dir,
-                   const Digest& name,
-                   nonstd::string_view suffix)
-{
-  const auto name_string = FMT("{}{}", name.to_string(), suffix);
-
-  for (uint8_t level = k_min_cache_levels; level <= k_max_cache_levels;
-       ++level) {
-    const auto path = Util::get_path_in_cache(cache_dir, level, name_string);
-    const auto stat = Stat::stat(path);
-    if (stat) {
-      return {path, stat, level};
-    }
-  }
-
-  const auto shallowest_path =
-    Util::get_path_in_cache(cache_dir, k_min_cache_levels, name_string);
-  return {shallowest_path, Stat(), k_min_cache_levels};
-}
-
 // Create or update the manifest file.
 static void
 update_manifest_file(Context& ctx)
@@ -762,12 +1282,11 @@ update_manifest_file(Context& ctx)
     return;
   }
 
-  ASSERT(ctx.manifest_path());
+  ASSERT(ctx.manifest_name());
   ASSERT(ctx.result_path());
 
   MTR_BEGIN("manifest", "manifest_put");
-
-  const auto old_stat = Stat::stat(*ctx.manifest_path());
+  Tracing::Span span("manifest_put");
 
   // See comment in get_file_hash_index for why saving of timestamps is forced
   // for precompiled headers.
@@ -775,22 +1294,26 @@ update_manifest_file(Context& ctx)
     (ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES)
     || ctx.args_info.output_is_precompiled_header;
 
-  LOG("Adding result name to {}", *ctx.manifest_path());
-  if (!Manifest::put(ctx.config,
-                     *ctx.manifest_path(),
-                     *ctx.result_name(),
-                     ctx.included_files,
-                     ctx.time_of_compilation,
-                     save_timestamp)) {
-    LOG("Failed to add result name to {}", *ctx.manifest_path());
-  } else {
-    const auto new_stat = Stat::stat(*ctx.manifest_path(), Stat::OnError::log);
-    ctx.manifest_counter_updates.increment(
-      Statistic::cache_size_kibibyte,
-      Util::size_change_kibibyte(old_stat, new_stat));
-    ctx.manifest_counter_updates.increment(Statistic::files_in_cache,
-                                           !old_stat && new_stat ? 1 : 0);
-  }
+  ctx.storage.put(
+    *ctx.manifest_name(),
+    Manifest::k_file_suffix,
+    ctx.manifest_counter_updates,
+    [&](const std::string& path) {
+      ctx.set_manifest_path(path);
+      LOG("Adding result name to {}", path);
+      if (!Manifest::put(ctx,
+                         path,
+                         *ctx.result_name(),
+                         ctx.included_files,
+                         ctx.time_of_compilation,
+                         save_timestamp)) {
+        LOG("Failed to add result name to {}", path);
+        return false;
+      }
+      return true;
+    },
+    true,
+    ctx.compiler_duration_ms);
   MTR_END("manifest", "manifest_put");
 }
 
@@ -855,202 +1378,1048 @@ find_coverage_file(const Context& ctx)
   return {true, found_file, found_file == mangled_form};
 }
 
-// Run the real compiler and put the result in cache.
-static void
-to_cache(Context& ctx,
-         Args& args,
-         const Args& depend_extra_args,
-         Hash* depend_mode_hash)
+// Hand the compilation result back to the build system by letting the parent
+// process send the compiler's output and exit successfully, and continue in a
+// detached child process. Returns true in the child or false (in the original
+// process) if the child could not be created.
+static bool
+continue_in_background(Context& ctx,
+                       const std::string& stdout_data,
+                       const std::string& stderr_path)
 {
-  args.push_back("-o");
-  args.push_back(ctx.args_info.output_obj);
-
-  if (ctx.config.hard_link() && ctx.args_info.output_obj != "/dev/null") {
-    // Workaround for Clang bug where it overwrites an existing object file
-    // when it's compiling an assembler file, see
-    // <https://bugs.llvm.org/show_bug.cgi?id=39782>.
-    Util::unlink_safe(ctx.args_info.output_obj);
+#ifdef _WIN32
+  (void)ctx;
+  (void)stdout_data;
+  (void)stderr_path;
+  return false;
+#else
+  const auto stderr_data = Util::read_file(stderr_path);
+  ctx.shut_down_include_file_thread_pool();
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+    return false;
   }
-
-  if (ctx.args_info.generating_diagnostics) {
-    args.push_back("--serialize-diagnostics");
-    args.push_back(ctx.args_info.output_dia);
+  if (pid > 0) {
+    // Don't run any destructors since they would for instance remove
+    // temporary files that the child still needs.
+    Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+    Util::send_to_stderr(ctx, stderr_data);
+    _exit(EXIT_SUCCESS);
   }
 
-  // Turn off DEPENDENCIES_OUTPUT when running cc1, because otherwise it will
-  // emit a line like this:
-  //
-  //   tmp.stdout.vexed.732.o: /home/mbp/.ccache/tmp.stdout.vexed.732.i
-  Util::unsetenv("DEPENDENCIES_OUTPUT");
-  Util::unsetenv("SUNPRO_DEPENDENCIES");
-
-  if (ctx.config.run_second_cpp()) {
-    args.push_back(ctx.args_info.input_file);
-  } else {
-    args.push_back(ctx.i_tmpfile);
+  // Detach from the build system, which may wait for the standard streams to
+  // be closed.
+  setsid();
+  Fd null_fd(open("/dev/null", O_RDWR));
+  if (null_fd) {
+    dup2(*null_fd, STDIN_FILENO);
+    dup2(*null_fd, STDOUT_FILENO);
+    dup2(*null_fd, STDERR_FILENO);
   }
+  LOG("Storing result in background process {}", getpid());
+  return true;
+#endif
+}
 
-  if (ctx.args_info.seen_split_dwarf) {
-    // Remove any pre-existing .dwo file since we want to check if the compiler
-    // produced one, intentionally not using x_unlink or tmp_unlink since we're
-    // not interested in logging successful deletions or failures due to
-    // nonexistent .dwo files.
-    if (unlink(ctx.args_info.output_dwo.c_str()) != 0 && errno != ENOENT
-        && errno != ESTALE) {
-      LOG("Failed to unlink {}: {}", ctx.args_info.output_dwo, strerror(errno));
-      throw Failure(Statistic::bad_output_file);
-    }
+// Add an entry with the compiler duration, if known, to the result `files` so
+// that hits can count the time they save.
+static void
+add_compile_time_entry(
+  Context& ctx, std::vector<std::pair<Result::FileType, std::string>>& files)
+{
+  if (ctx.compiler_duration_ms == 0) {
+    return;
   }
+  TemporaryFile tmp_file = ctx.create_transient_file(
+    FMT("{}/tmp.compile_time", ctx.config.temporary_dir()));
+  const std::string path = tmp_file.path;
+  tmp_file.fd.close();
+  Util::write_file(path, FMT("{}", ctx.compiler_duration_ms));
+  files.emplace_back(Result::FileType::compile_time, path);
+}
 
-  LOG_RAW("Running real compiler");
-  MTR_BEGIN("execute", "compiler");
-
-  TemporaryFile tmp_stdout(FMT("{}/tmp.stdout", ctx.config.temporary_dir()));
-  ctx.register_pending_tmp_file(tmp_stdout.path);
-  std::string tmp_stdout_path = tmp_stdout.path;
-
-  TemporaryFile tmp_stderr(FMT("{}/tmp.stderr", ctx.config.temporary_dir()));
-  ctx.register_pending_tmp_file(tmp_stderr.path);
-  std::string tmp_stderr_path = tmp_stderr.path;
-
-  int status;
-  if (!ctx.config.depend_mode()) {
-    status =
-      do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
-    args.pop_back(3);
-  } else {
-    // Use the original arguments (including dependency options) in depend
-    // mode.
-    Args depend_mode_args = ctx.orig_args;
-    depend_mode_args.erase_with_prefix("--ccache-");
-    depend_mode_args.push_back(depend_extra_args);
-    add_prefix(ctx, depend_mode_args, ctx.config.prefix_command());
-
-    ctx.time_of_compilation = time(nullptr);
-    status = do_execute(
-      ctx, depend_mode_args, std::move(tmp_stdout), std::move(tmp_stderr));
+// Add an entry with the digest of the warning options first in the result
+// `files` if they were left out of the result name, so that hits can tell
+// whether the stored diagnostics apply.
+static void
+add_warning_options_entry(
+  Context& ctx, std::vector<std::pair<Result::FileType, std::string>>& files)
+{
+  if (!ctx.warning_options_digest) {
+    return;
   }
-  MTR_END("execute", "compiler");
+  TemporaryFile tmp_file = ctx.create_transient_file(
+    FMT("{}/tmp.warning_options", ctx.config.temporary_dir()));
+  const std::string path = tmp_file.path;
+  tmp_file.fd.close();
+  Util::write_file(path, ctx.warning_options_digest->to_string());
+  files.insert(files.begin(), {Result::FileType::warning_options, path});
+}
 
-  auto st = Stat::stat(tmp_stdout_path, Stat::OnError::log);
-  if (!st) {
-    // The stdout file was removed - cleanup in progress? Better bail out.
-    throw Failure(Statistic::missing_cache_file);
+// Add an entry with the digests of the output files among `files` first in the
+// result if keep_identical_outputs is enabled, so that hits can leave identical
+// output files untouched.
+static void
+add_output_digests_entry(
+  Context& ctx, std::vector<std::pair<Result::FileType, std::string>>& files)
+{
+  if (!ctx.config.keep_identical_outputs()) {
+    return;
   }
-
-  // distcc-pump outputs lines like this:
-  // __________Using # distcc servers in pump mode
-  if (st.size() != 0 && ctx.config.compiler_type() != CompilerType::pump) {
-    LOG_RAW("Compiler produced stdout");
-    throw Failure(Statistic::compiler_produced_stdout);
+  std::string digests;
+  for (const auto& file : files) {
+    if (file.first == Result::FileType::stderr_output
+        || file.first == Result::FileType::stdout_output
+        || file.first == Result::FileType::exit_status
+        || file.first == Result::FileType::compile_time
+        || file.first == Result::FileType::warning_options) {
+      continue;
+    }
+    Hash hash;
+    if (!hash.hash_file(file.second)) {
+      return;
+    }
+    digests += FMT("{} {}\n",
+                   static_cast<Result::UnderlyingFileTypeInt>(file.first),
+                   hash.digest().to_string());
+  }
+  if (digests.empty()) {
+    return;
   }
+  TemporaryFile tmp_file = ctx.create_transient_file(
+    FMT("{}/tmp.output_digests", ctx.config.temporary_dir()));
+  const std::string path = tmp_file.path;
+  tmp_file.fd.close();
+  Util::write_file(path, digests);
+  files.insert(files.begin(), {Result::FileType::output_digests, path});
+}
 
-  // Merge stderr from the preprocessor (if any) and stderr from the real
-  // compiler into tmp_stderr.
-  if (!ctx.cpp_stderr.empty()) {
-    std::string combined_stderr =
-      Util::read_file(ctx.cpp_stderr) + Util::read_file(tmp_stderr_path);
-    Util::write_file(tmp_stderr_path, combined_stderr);
+// Store a result consisting of `files` (file type and path pairs, stderr
+// output only if non-empty) and update the manifest, if any. Returns whether
+// the result was stored.
+static bool
+put_result(Context& ctx,
+           std::vector<std::pair<Result::FileType, std::string>> files)
+{
+  add_compile_time_entry(ctx, files);
+  add_output_digests_entry(ctx, files);
+  const bool stored = ctx.storage.put(
+    *ctx.result_name(),
+    Result::k_file_suffix,
+    ctx.counter_updates,
+    [&](const std::string& path) {
+      ctx.set_result_path(path);
+      Result::Writer result_writer(ctx, path);
+      for (const auto& file : files) {
+        if (file.first == Result::FileType::stderr_output) {
+          const auto st = Stat::stat(file.second, Stat::OnError::log);
+          if (!st || st.size() == 0) {
+            continue;
+          }
+        }
+        result_writer.write(file.first, file.second);
+      }
+      auto error = result_writer.finalize();
+      if (error) {
+        LOG("Error: {}", *error);
+        return false;
+      }
+      LOG("Stored in cache: {}", path);
+      return true;
+    },
+    true,
+    ctx.compiler_duration_ms);
+  if (stored && ctx.manifest_name()) {
+    update_manifest_file(ctx);
   }
+  return stored;
+}
 
-  if (status != 0) {
-    LOG("Compiler gave exit status {}", status);
+// Store the exit status and stderr output of a failed compilation so that the
+// failure can be replayed by later invocations.
+static void
+store_failure(Context& ctx, int status, const std::string& stderr_path)
+{
+  TemporaryFile tmp_status =
+    ctx.create_transient_file(FMT("{}/tmp.status", ctx.config.temporary_dir()));
+  const std::string status_path = tmp_status.path;
+  tmp_status.fd.close();
+  Util::write_file(status_path, FMT("{} {}", status, time(nullptr)));
+
+  // The exit status goes first so that a reader can refuse an unwanted failure
+  // before any stderr output has been replayed.
+  put_result(ctx,
+             {{Result::FileType::exit_status, status_path},
+              {Result::FileType::stderr_output, stderr_path}});
+}
 
-    // We can output stderr immediately instead of rerunning the compiler.
-    Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+// Store the output of a -E invocation, already produced by the preprocessor
+// run that calculated the result name, and hand it to the caller.
+static void
+store_preprocessed_output(Context& ctx)
+{
+  ASSERT(!ctx.i_tmpfile.empty());
 
-    throw Failure(Statistic::compile_failed, status);
+  std::vector<std::pair<Result::FileType, std::string>> files;
+  files.emplace_back(Result::FileType::object, ctx.i_tmpfile);
+  if (!ctx.cpp_stderr.empty()) {
+    files.emplace_back(Result::FileType::stderr_output, ctx.cpp_stderr);
+  }
+  if (!put_result(ctx, files)) {
+    throw Failure(Statistic::internal_error);
   }
 
-  if (ctx.config.depend_mode()) {
-    ASSERT(depend_mode_hash);
-    auto result_name = result_name_from_depfile(ctx, *depend_mode_hash);
-    if (!result_name) {
+  if (ctx.args_info.output_obj == "-") {
+    Fd fd(open(ctx.i_tmpfile.c_str(), O_RDONLY | O_BINARY));
+    if (!fd) {
+      LOG("Failed to open {}: {}", ctx.i_tmpfile, strerror(errno));
       throw Failure(Statistic::internal_error);
     }
-    ctx.set_result_name(*result_name);
+    Util::copy_fd(*fd, STDOUT_FILENO);
+  } else {
+    Util::copy_file(ctx.i_tmpfile, ctx.args_info.output_obj);
+  }
+  if (!ctx.cpp_stderr.empty()) {
+    Util::send_to_stderr(ctx, Util::read_file(ctx.cpp_stderr));
   }
+}
 
-  bool produce_dep_file = ctx.args_info.generating_dependencies
-                          && ctx.args_info.output_dep != "/dev/null";
+// Return whether the compilation only writes the object file, so that it can
+// be run speculatively with a private object file (see the
+// speculative_compile_delay option).
+static bool
+can_compile_speculatively(const Context& ctx)
+{
+  const auto& args_info = ctx.args_info;
+  return ctx.config.run_second_cpp() && !ctx.config.depend_mode()
+         && !ctx.config.read_only() && !ctx.config.read_only_direct()
+         && ctx.config.compiler_type() != CompilerType::msvc
+         && ctx.config.compiler_type() != CompilerType::pump
+         && !args_info.preprocessing_only && args_info.expect_output_obj
+         && args_info.output_obj != "/dev/null" && args_info.output_obj != "-"
+         && !args_info.generating_dependencies
+         && !args_info.generating_coverage
+         && !args_info.generating_stackusage
+         && !args_info.generating_diagnostics && args_info.output_bmi.empty()
+         && !args_info.seen_split_dwarf && !getenv("DEPENDENCIES_OUTPUT")
+         && !getenv("SUNPRO_DEPENDENCIES");
+}
 
-  if (produce_dep_file) {
-    Depfile::make_paths_relative_in_output_dep(ctx);
-  }
+// A compilation started speculatively during the lookup, once
+// speculative_compile_delay milliseconds have passed, writing a private object
+// file. On a miss, to_cache adopts its output instead of running the compiler;
+// otherwise the compiler is killed when the object is destroyed.
+class SpeculativeCompiler : NonCopyable
+{
+public:
+  // `args` are the compiler arguments without output and input file.
+  SpeculativeCompiler(Context& ctx, const Args& args);
+  ~SpeculativeCompiler();
+
+  // Wait for the compiler to exit and move the object file into place. Returns
+  // the exit status, or nullopt if the compiler hasn't been started (it then
+  // won't be) or its object file couldn't be moved.
+  optional<int> finish();
+
+  const std::string& stdout_path() const;
+  const std::string& stderr_path() const;
+  uint64_t duration_ms() const;
+
+private:
+  Context& m_ctx;
+  Jobserver::Tokens m_tokens;
+  std::string m_obj_path;
+  std::string m_stdout_path;
+  std::string m_stderr_path;
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_stopped = false;
+  pid_t m_pid = 0;
+  std::chrono::steady_clock::time_point m_start;
+  uint64_t m_duration_ms = 0;
+  std::thread m_thread;
+
+  // Start the compiler unless stopped within the delay.
+  void run(const Args& args, Fd fd_out, Fd fd_err);
+
+  // Stop waiting for the delay.
+  void stop();
+};
 
-  const auto obj_stat = Stat::stat(ctx.args_info.output_obj);
-  if (!obj_stat) {
-    if (ctx.args_info.expect_output_obj) {
-      LOG_RAW("Compiler didn't produce an object file (unexpected)");
-      throw Failure(Statistic::compiler_produced_no_output);
-    } else {
-      LOG_RAW("Compiler didn't produce an object file (expected)");
-    }
-  } else if (obj_stat.size() == 0) {
-    LOG_RAW("Compiler produced an empty object file");
-    throw Failure(Statistic::compiler_produced_empty_output);
+SpeculativeCompiler::SpeculativeCompiler(Context& ctx, const Args& args)
+  : m_ctx(ctx),
+    // The compiler runs in addition to ccache itself.
+    m_tokens(1)
+{
+#ifndef _WIN32
+  if (m_tokens.count() == 0) {
+    LOG_RAW("Not compiling speculatively without jobserver token");
+    return;
   }
 
-  const auto stderr_stat = Stat::stat(tmp_stderr_path, Stat::OnError::log);
-  if (!stderr_stat) {
-    throw Failure(Statistic::internal_error);
+  // The object file is renamed into place, so keep it in the same directory.
+  TemporaryFile tmp_obj(FMT("{}.ccache-speculative", ctx.args_info.output_obj));
+  if (tmp_obj.path.empty()) {
+    return;
   }
+  m_obj_path = tmp_obj.path;
+  ctx.register_pending_tmp_file(m_obj_path);
+  TemporaryFile tmp_stdout =
+    ctx.create_transient_file(FMT("{}/tmp.stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr =
+    ctx.create_transient_file(FMT("{}/tmp.stderr", ctx.config.temporary_dir()));
+  m_stdout_path = tmp_stdout.path;
+  m_stderr_path = tmp_stderr.path;
+
+  Args compiler_args = args;
+  add_prefix(ctx, compiler_args, ctx.config.prefix_command());
+  compiler_args.push_back("-o");
+  compiler_args.push_back(m_obj_path);
+  compiler_args.push_back(ctx.args_info.input_file);
+
+  // Fd isn't copyable, so hand over the descriptors via shared pointers like
+  // get_result_name_from_multi_arch_cpp does.
+  auto fd_out = std::make_shared<Fd>(std::move(tmp_stdout.fd));
+  auto fd_err = std::make_shared<Fd>(std::move(tmp_stderr.fd));
+  m_thread = std::thread([this, compiler_args, fd_out, fd_err] {
+    run(compiler_args, std::move(*fd_out), std::move(*fd_err));
+  });
+#else
+  (void)args;
+#endif
+}
 
-  const auto result_file = look_up_cache_file(
-    ctx.config.cache_dir(), *ctx.result_name(), Result::k_file_suffix);
-  ctx.set_result_path(result_file.path);
-  Result::Writer result_writer(ctx, result_file.path);
-
-  if (stderr_stat.size() > 0) {
-    result_writer.write(Result::FileType::stderr_output, tmp_stderr_path);
+SpeculativeCompiler::~SpeculativeCompiler()
+{
+  stop();
+#ifndef _WIN32
+  if (m_pid != 0) {
+    LOG_RAW("Cancelling speculative compilation");
+    kill(m_pid, SIGTERM);
+    try {
+      execute_wait(&m_pid);
+    } catch (const Fatal& e) {
+      LOG("Error: {}", e.what());
+    }
   }
-  if (obj_stat) {
-    result_writer.write(Result::FileType::object, ctx.args_info.output_obj);
+#endif
+}
+
+void
+SpeculativeCompiler::run(const Args& args, Fd fd_out, Fd fd_err)
+{
+#ifndef _WIN32
+  // Let the main thread handle signals.
+  SignalHandler::block_signals();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_condition.wait_for(
+        lock,
+        std::chrono::milliseconds(m_ctx.config.speculative_compile_delay()),
+        [this] { return m_stopped; })) {
+    return;
   }
-  if (ctx.args_info.generating_dependencies) {
-    result_writer.write(Result::FileType::dependency, ctx.args_info.output_dep);
+  LOG_RAW("Starting speculative compilation");
+  m_start = std::chrono::steady_clock::now();
+  try {
+    execute_async(
+      args.to_argv().data(), std::move(fd_out), std::move(fd_err), &m_pid);
+  } catch (const Fatal& e) {
+    LOG("Failed to start speculative compilation: {}", e.what());
+    m_pid = 0;
   }
-  if (ctx.args_info.generating_coverage) {
-    const auto coverage_file = find_coverage_file(ctx);
-    if (!coverage_file.found) {
-      throw Failure(Statistic::internal_error);
-    }
-    result_writer.write(coverage_file.mangled
-                          ? Result::FileType::coverage_mangled
-                          : Result::FileType::coverage_unmangled,
-                        coverage_file.path);
+#else
+  (void)args;
+  (void)fd_out;
+  (void)fd_err;
+#endif
+}
+
+void
+SpeculativeCompiler::stop()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stopped = true;
   }
-  if (ctx.args_info.generating_stackusage) {
-    result_writer.write(Result::FileType::stackusage, ctx.args_info.output_su);
+  m_condition.notify_one();
+  if (m_thread.joinable()) {
+    m_thread.join();
   }
-  if (ctx.args_info.generating_diagnostics) {
-    result_writer.write(Result::FileType::diagnostic, ctx.args_info.output_dia);
+}
+
+optional<int>
+SpeculativeCompiler::finish()
+{
+  stop();
+#ifndef _WIN32
+  if (m_pid == 0) {
+    return nullopt;
   }
-  if (ctx.args_info.seen_split_dwarf && Stat::stat(ctx.args_info.output_dwo)) {
-    // Only store .dwo file if it was created by the compiler (GCC and Clang
-    // behave differently e.g. for "-gsplit-dwarf -g1").
-    result_writer.write(Result::FileType::dwarf_object,
-                        ctx.args_info.output_dwo);
+  const int status = execute_wait(&m_pid);
+  m_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - m_start)
+                    .count();
+  m_tokens.release();
+  if (status != 0) {
+    return status;
   }
 
-  auto error = result_writer.finalize();
-  if (error) {
-    LOG("Error: {}", *error);
-  } else {
-    LOG("Stored in cache: {}", result_file.path);
+  // The object file was created by mkstemp and the compiler may have run with
+  // ccache's umask instead of the original one.
+  mode_t mask = umask(0);
+  umask(mask);
+  if (m_ctx.original_umask) {
+    mask = *m_ctx.original_umask;
   }
-
-  auto new_result_stat = Stat::stat(result_file.path, Stat::OnError::log);
-  if (!new_result_stat) {
-    throw Failure(Statistic::internal_error);
+  chmod(m_obj_path.c_str(), 0666 & ~mask);
+  try {
+    Util::rename(m_obj_path, m_ctx.args_info.output_obj);
+  } catch (const Error& e) {
+    LOG("Failed to adopt speculative compilation: {}", e.what());
+    return nullopt;
   }
-  ctx.counter_updates.increment(
-    Statistic::cache_size_kibibyte,
-    Util::size_change_kibibyte(result_file.stat, new_result_stat));
-  ctx.counter_updates.increment(Statistic::files_in_cache,
-                                result_file.stat ? 0 : 1);
+  LOG_RAW("Adopting output of speculative compilation");
+  return status;
+#else
+  return nullopt;
+#endif
+}
 
-  MTR_END("file", "file_put");
+const std::string&
+SpeculativeCompiler::stdout_path() const
+{
+  return m_stdout_path;
+}
+
+const std::string&
+SpeculativeCompiler::stderr_path() const
+{
+  return m_stderr_path;
+}
+
+uint64_t
+SpeculativeCompiler::duration_ms() const
+{
+  return m_duration_ms;
+}
+
+// Return whether the compilation can be sent to a compile server, i.e. whether
+// the compiler only needs the preprocessed source code and only produces the
+// object file.
+static bool
+can_compile_remotely(const Context& ctx)
+{
+#ifdef _WIN32
+  (void)ctx;
+  return false;
+#else
+  const auto& args_info = ctx.args_info;
+  return !ctx.config.compile_servers().empty() && !ctx.config.run_second_cpp()
+         && !ctx.config.depend_mode() && ctx.config.prefix_command().empty()
+         && (ctx.config.compiler_type() == CompilerType::gcc
+             || ctx.config.compiler_type() == CompilerType::clang)
+         && args_info.output_obj != "/dev/null" && !args_info.seen_split_dwarf
+         && !args_info.generating_coverage && !args_info.generating_stackusage
+         && !args_info.generating_diagnostics && !args_info.profile_use
+         && !args_info.output_is_precompiled_header
+         && !args_info.using_precompiled_header
+         && args_info.sanitize_blacklists.empty()
+         && args_info.module_files.empty();
+#endif
+}
+
+// Compile the preprocessed source code on one of the compile servers, trying
+// them in random order. `args` ends with the output and source file arguments.
+// Returns false if no server compiled it successfully, in which case the
+// caller compiles locally, so that failures get local diagnostics.
+static bool
+compile_remotely(Context& ctx,
+                 const Args& args,
+                 const std::string& stdout_path,
+                 const std::string& stderr_path)
+{
+#ifdef _WIN32
+  (void)ctx;
+  (void)args;
+  (void)stdout_path;
+  (void)stderr_path;
+  return false;
+#else
+  CompileServer::Job job;
+  job.compiler = std::string(Util::base_name(args[0]));
+  job.compiler_digest = CompileServer::compiler_digest(args[0]);
+  job.extension = std::string(Util::get_extension(ctx.i_tmpfile).substr(1));
+  if (ctx.args_info.generating_debuginfo) {
+    job.cwd = apply_debug_prefix_maps(ctx.args_info, ctx.apparent_cwd);
+  }
+  for (size_t i = 1; i < args.size() - 3; ++i) {
+    if (args[i].empty()) {
+      return false;
+    }
+    job.args.push_back(args[i]);
+  }
+  const auto refused_arg = CompileServer::find_refused_arg(job.args);
+  if (refused_arg) {
+    LOG("Compiling locally since compile servers refuse {}", *refused_arg);
+    return false;
+  }
+
+  auto servers = Util::split_into_strings(ctx.config.compile_servers(), " ");
+  std::shuffle(
+    servers.begin(), servers.end(), std::mt19937(std::random_device()()));
+  try {
+    job.source = Util::read_file(ctx.i_tmpfile);
+    for (const auto& server : servers) {
+      const auto host_and_port = TcpConnection::parse_host_and_port(
+        server, CompileServer::k_default_port);
+      if (!host_and_port) {
+        LOG("Unsupported compile server: {}", server);
+        continue;
+      }
+      const auto outcome = CompileServer::compile(
+        host_and_port->first, host_and_port->second, job);
+      if (!outcome) {
+        continue;
+      }
+      if (outcome->status != 0) {
+        LOG("Compilation on {} gave exit status {}; compiling locally",
+            server,
+            outcome->status);
+        return false;
+      }
+      Util::write_file(ctx.args_info.output_obj, outcome->object);
+      Util::write_file(stdout_path, outcome->stdout_data);
+      Util::write_file(stderr_path, outcome->stderr_data);
+      LOG("Compiled on {}", server);
+      return true;
+    }
+  } catch (const Error& e) {
+    LOG("Failed to compile remotely: {}", e.what());
+  }
+  return false;
+#endif
+}
+
+static bool
+should_rewrite_dependency_target(const ArgsInfo& args_info)
+{
+  return !args_info.dependency_target_specified && args_info.seen_MD_MMD;
+}
+
+static std::vector<std::string>
+included_file_paths(const Context& ctx)
+{
+  std::vector<std::string> paths;
+  paths.reserve(ctx.included_files.size());
+  for (const auto& included_file : ctx.included_files) {
+    paths.emplace_back(included_file.first.data(), included_file.first.size());
+  }
+  return paths;
+}
+
+// Return the dependency file for the compilation with `included_files`, or
+// nullopt if the compiler's dependency file can't be reproduced since the
+// target isn't the object file.
+static optional<std::string>
+regenerate_dependency_file(const Context& ctx,
+                           std::vector<std::string> included_files)
+{
+  if (!should_rewrite_dependency_target(ctx.args_info)) {
+    return nullopt;
+  }
+  std::sort(included_files.begin(), included_files.end());
+  return Depfile::generate(ctx.args_info.output_obj,
+                           ctx.args_info.input_file,
+                           included_files,
+                           ctx.args_info.seen_MP);
+}
+
+// Return whether the dependency file written by the compiler can be left out
+// of the result since it can be regenerated from the include files recorded in
+// the manifest.
+static bool
+can_regenerate_dependency_file(const Context& ctx)
+{
+  if (!ctx.config.regenerate_depfiles() || !ctx.config.direct_mode()
+      || ctx.config.depend_mode() || ctx.args_info.output_dep == "/dev/null") {
+    return false;
+  }
+  const auto regenerated =
+    regenerate_dependency_file(ctx, included_file_paths(ctx));
+  if (!regenerated) {
+    return false;
+  }
+  std::string content;
+  try {
+    content = Util::read_file(ctx.args_info.output_dep);
+  } catch (const Error& e) {
+    LOG("Failed to read {}: {}", ctx.args_info.output_dep, e.what());
+    return false;
+  }
+  if (!Depfile::is_equivalent(content, *regenerated)) {
+    LOG_RAW("Storing dependency file that differs from the include files");
+    return false;
+  }
+  LOG_RAW("Not storing dependency file that can be regenerated");
+  return true;
+}
+
+// Return whether options that only affect diagnostics are left out of the
+// result name of the compilation, see ignore_warning_options. Diagnostics are
+// then regenerated with a syntax check when they were stored for other
+// warning options.
+static bool
+ignores_warning_options(const Context& ctx)
+{
+  return ctx.config.ignore_warning_options()
+         && (ctx.config.compiler_type() == CompilerType::gcc
+             || ctx.config.compiler_type() == CompilerType::clang)
+         && ctx.config.run_second_cpp() && !ctx.args_info.preprocessing_only
+         && !ctx.args_info.output_is_precompiled_header
+         && !ctx.args_info.generating_diagnostics;
+}
+
+// Return the arguments that make the compiler check the syntax of the input
+// file with `compiler_args`, leaving out the options that produce output
+// files.
+static Args
+syntax_check_args(const Context& ctx, const Args& compiler_args)
+{
+  Args args;
+  for (size_t i = 0; i < compiler_args.size(); ++i) {
+    const string_view arg = compiler_args[i];
+    if (i > 0 && arg == "-c") {
+      continue;
+    }
+    if (i > 0 && arg.starts_with("-M")) {
+      if (arg.length() == 3 && compopt_takes_arg(arg)) {
+        ++i;
+      }
+      continue;
+    }
+    if (arg.starts_with("-Wp,-MD,") || arg.starts_with("-Wp,-MMD,")) {
+      continue;
+    }
+    args.push_back(compiler_args[i]);
+  }
+  args.push_back("-fsyntax-only");
+  args.push_back(ctx.args_info.input_file);
+  return args;
+}
+
+// Send the diagnostics for the current warning options, produced by checking
+// the syntax of the input file, to stderr. Returns false if the check fails,
+// e.g. due to -Werror, in which case the compilation must be run for real.
+static bool
+regenerate_diagnostics(Context& ctx)
+{
+  if (ctx.syntax_check_args.empty()) {
+    return false;
+  }
+  LOG_RAW("Regenerating diagnostics for the current warning options");
+
+  TemporaryFile tmp_stdout =
+    ctx.create_transient_file(FMT("{}/tmp.stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr =
+    ctx.create_transient_file(FMT("{}/tmp.stderr", ctx.config.temporary_dir()));
+  const std::string stderr_path = tmp_stderr.path;
+
+  // Like when compiling, don't let the compiler write a dependency file.
+  Util::unsetenv("DEPENDENCIES_OUTPUT");
+  Util::unsetenv("SUNPRO_DEPENDENCIES");
+
+  const int status = do_execute(
+    ctx, ctx.syntax_check_args, std::move(tmp_stdout), std::move(tmp_stderr));
+  if (status != 0) {
+    LOG("Syntax check gave exit status {}", status);
+    return false;
+  }
+  Util::send_to_stderr(ctx, Util::read_file(stderr_path));
+  return true;
+}
+
+// Return whether the result of a compilation should be stored, i.e. whether its
+// result name has recently been missed at least admission_threshold times.
+static bool
+admit_result(Context& ctx)
+{
+  const uint32_t threshold = ctx.config.admission_threshold();
+  if (threshold <= 1) {
+    return true;
+  }
+  FrequencySketch sketch(ctx.config.cache_dir());
+  if (!sketch) {
+    return true;
+  }
+  const uint32_t misses = sketch.add(*ctx.result_name());
+  if (misses >= threshold) {
+    return true;
+  }
+  LOG("Not storing result since it has been missed {} of {} times",
+      misses,
+      threshold);
+  ctx.counter_updates.increment(Statistic::result_not_admitted);
+  return false;
+}
+
+// Run the real compiler and put the result in cache. If `speculative_compiler`
+// is given, its compilation is used if it has been started and succeeds.
+// Returns whether the result was stored.
+static bool
+to_cache(Context& ctx,
+         Args& args,
+         const Args& depend_extra_args,
+         Hash* depend_mode_hash,
+         SpeculativeCompiler* speculative_compiler = nullptr)
+{
+  const bool is_msvc = ctx.config.compiler_type() == CompilerType::msvc;
+  if (is_msvc) {
+    args.push_back(FMT("-Fo{}", ctx.args_info.output_obj));
+  } else {
+    args.push_back("-o");
+    args.push_back(ctx.args_info.output_obj);
+  }
+
+  if (ctx.config.hard_link() && ctx.args_info.output_obj != "/dev/null") {
+    // Workaround for Clang bug where it overwrites an existing object file
+    // when it's compiling an assembler file, see
+    // <https://bugs.llvm.org/show_bug.cgi?id=39782>.
+    Util::unlink_safe(ctx.args_info.output_obj);
+  }
+
+  if (ctx.args_info.generating_diagnostics) {
+    args.push_back("--serialize-diagnostics");
+    args.push_back(ctx.args_info.output_dia);
+  }
+
+  // Turn off DEPENDENCIES_OUTPUT when running cc1, because otherwise it will
+  // emit a line like this:
+  //
+  //   tmp.stdout.vexed.732.o: /home/mbp/.ccache/tmp.stdout.vexed.732.i
+  Util::unsetenv("DEPENDENCIES_OUTPUT");
+  Util::unsetenv("SUNPRO_DEPENDENCIES");
+
+  if (ctx.config.run_second_cpp()) {
+    args.push_back(ctx.args_info.input_file);
+  } else {
+    args.push_back(ctx.i_tmpfile);
+  }
+
+  if (ctx.args_info.seen_split_dwarf) {
+    // Remove any pre-existing .dwo file since we want to check if the compiler
+    // produced one, intentionally not using x_unlink or tmp_unlink since we're
+    // not interested in logging successful deletions or failures due to
+    // nonexistent .dwo files.
+    if (unlink(ctx.args_info.output_dwo.c_str()) != 0 && errno != ENOENT
+        && errno != ESTALE) {
+      LOG("Failed to unlink {}: {}", ctx.args_info.output_dwo, strerror(errno));
+      throw Failure(Statistic::bad_output_file);
+    }
+  }
+
+  LOG_RAW("Running real compiler");
+  MTR_BEGIN("execute", "compiler");
+  Statistics::PhaseTimer compiler_execution_timer(ctx,
+                                                  Phase::compiler_execution);
+  const auto compiler_start = std::chrono::steady_clock::now();
+  Tracing::Span compiler_span("compiler");
+
+  TemporaryFile tmp_stdout =
+    ctx.create_transient_file(FMT("{}/tmp.stdout", ctx.config.temporary_dir()));
+  std::string tmp_stdout_path = tmp_stdout.path;
+
+  TemporaryFile tmp_stderr =
+    ctx.create_transient_file(FMT("{}/tmp.stderr", ctx.config.temporary_dir()));
+  std::string tmp_stderr_path = tmp_stderr.path;
+
+  // A failed speculative compilation is run again for the usual error handling.
+  const auto speculative_status =
+    speculative_compiler ? speculative_compiler->finish() : nullopt;
+  const bool adopt_speculative = speculative_status && *speculative_status == 0;
+  if (speculative_status && !adopt_speculative) {
+    LOG("Speculative compilation gave exit status {}", *speculative_status);
+  }
+
+  const bool remote = !adopt_speculative && can_compile_remotely(ctx);
+
+  // Large objects are stored as raw files when cloning or hard linking, so
+  // there is nothing to compress ahead then. A remote compilation writes the
+  // object at once.
+  if (!adopt_speculative && !remote && ctx.config.stream_compression()
+      && ctx.args_info.output_obj != "/dev/null"
+      && Compression::type_from_config(ctx.config) == Compression::Type::zstd
+      && !ctx.config.file_clone() && !ctx.config.hard_link()) {
+    ctx.background_compressor = std::make_unique<BackgroundCompressor>(
+      ctx.config, ctx.args_info.output_obj);
+  }
+
+  int status;
+  if (adopt_speculative) {
+    status = 0;
+    tmp_stdout_path = speculative_compiler->stdout_path();
+    tmp_stderr_path = speculative_compiler->stderr_path();
+    args.pop_back(3);
+  } else if (remote
+             && compile_remotely(ctx, args, tmp_stdout_path, tmp_stderr_path)) {
+    status = 0;
+    args.pop_back(3);
+  } else if (!ctx.config.depend_mode()) {
+    const auto compiler_slot = acquire_compiler_slot(ctx);
+    status = do_execute(ctx,
+                        args,
+                        std::move(tmp_stdout),
+                        std::move(tmp_stderr),
+                        &ctx.invocation.compiler_usage);
+    args.pop_back(is_msvc ? 2 : 3);
+  } else {
+    // Use the original arguments (including dependency options) in depend
+    // mode.
+    Args depend_mode_args = ctx.orig_args;
+    depend_mode_args.erase_with_prefix("--ccache-");
+    depend_mode_args.push_back(depend_extra_args);
+    add_prefix(ctx, depend_mode_args, ctx.config.prefix_command());
+
+    ctx.time_of_compilation = time(nullptr);
+    const auto compiler_slot = acquire_compiler_slot(ctx);
+    status = do_execute(ctx,
+                        depend_mode_args,
+                        std::move(tmp_stdout),
+                        std::move(tmp_stderr),
+                        &ctx.invocation.compiler_usage);
+  }
+  MTR_END("execute", "compiler");
+  compiler_execution_timer.stop();
+  const auto& compiler_usage = ctx.invocation.compiler_usage;
+  if (compiler_usage.cpu_time_us != 0) {
+    LOG("Compiler used {} ms of CPU time and at most {} KiB of memory",
+        compiler_usage.cpu_time_us / 1000,
+        compiler_usage.max_rss_kib);
+    if (ctx.config.phase_durations()) {
+      Statistics::add_phase_duration(ctx.phase_durations,
+                                     Phase::compiler_cpu_time,
+                                     compiler_usage.cpu_time_us);
+    }
+  }
+  ctx.compiler_duration_ms =
+    adopt_speculative
+      ? speculative_compiler->duration_ms()
+      : std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - compiler_start)
+          .count();
+  ctx.counter_updates.increment(Statistic::time_spent_on_misses,
+                                ctx.compiler_duration_ms);
+  compiler_span.end();
+  if (ctx.background_compressor) {
+    ctx.background_compressor->stop();
+  }
+
+  auto st = Stat::stat(tmp_stdout_path, Stat::OnError::log);
+  if (!st) {
+    // The stdout file was removed - cleanup in progress? Better bail out.
+    throw Failure(Statistic::missing_cache_file);
+  }
+
+  std::string stdout_data;
+  std::vector<std::string> msvc_included_files;
+  if (is_msvc) {
+    stdout_data = extract_msvc_included_files(
+      ctx, Util::read_file(tmp_stdout_path), msvc_included_files);
+    Util::write_file(tmp_stdout_path, stdout_data);
+  } else if (st.size() != 0
+             && ctx.config.compiler_type() != CompilerType::pump) {
+    // distcc-pump outputs lines like this:
+    // __________Using # distcc servers in pump mode
+    LOG_RAW("Compiler produced stdout");
+    throw Failure(Statistic::compiler_produced_stdout);
+  }
+
+  // Merge stderr from the preprocessor (if any) and stderr from the real
+  // compiler into tmp_stderr.
+  if (!ctx.cpp_stderr.empty()) {
+    std::string combined_stderr =
+      Util::read_file(ctx.cpp_stderr) + Util::read_file(tmp_stderr_path);
+    Util::write_file(tmp_stderr_path, combined_stderr);
+  }
+
+  if (status != 0) {
+    LOG("Compiler gave exit status {}", status);
+
+    // We can output stderr immediately instead of rerunning the compiler.
+    Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+    Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+
+    // In depend mode the result name is only known from a successful
+    // compilation's dependency file. MSVC's diagnostics on stdout are not
+    // stored for failures.
+    // Failures may be due to warning options left out of the result name.
+    if (ctx.config.cache_failures() && !ctx.config.depend_mode() && !is_msvc
+        && !ctx.warning_options_digest) {
+      store_failure(ctx, status, tmp_stderr_path);
+    }
+
+    throw Failure(Statistic::compile_failed, status);
+  }
+
+  if (ctx.config.depend_mode() && is_msvc) {
+    ASSERT(depend_mode_hash);
+    ctx.set_result_name(result_name_from_included_files(
+      ctx, *depend_mode_hash, msvc_included_files));
+  } else if (ctx.config.depend_mode()) {
+    ASSERT(depend_mode_hash);
+    auto result_name = result_name_from_depfile(ctx, *depend_mode_hash);
+    if (!result_name) {
+      throw Failure(Statistic::internal_error);
+    }
+    ctx.set_result_name(*result_name);
+  }
+
+  bool produce_dep_file = ctx.args_info.generating_dependencies
+                          && ctx.args_info.output_dep != "/dev/null";
+
+  if (produce_dep_file) {
+    Depfile::make_paths_relative_in_output_dep(ctx);
+  }
+
+  const auto obj_stat = Stat::stat(ctx.args_info.output_obj);
+  if (!obj_stat) {
+    if (ctx.args_info.expect_output_obj) {
+      LOG_RAW("Compiler didn't produce an object file (unexpected)");
+      throw Failure(Statistic::compiler_produced_no_output);
+    } else {
+      LOG_RAW("Compiler didn't produce an object file (expected)");
+    }
+  } else if (obj_stat.size() == 0) {
+    LOG_RAW("Compiler produced an empty object file");
+    throw Failure(Statistic::compiler_produced_empty_output);
+  }
+
+  const auto stderr_stat = Stat::stat(tmp_stderr_path, Stat::OnError::log);
+  if (!stderr_stat) {
+    throw Failure(Statistic::internal_error);
+  }
+
+  std::vector<std::pair<Result::FileType, std::string>> result_files;
+  if (stderr_stat.size() > 0) {
+    result_files.emplace_back(Result::FileType::stderr_output, tmp_stderr_path);
+  }
+  if (!stdout_data.empty()) {
+    result_files.emplace_back(Result::FileType::stdout_output, tmp_stdout_path);
+  }
+  if (obj_stat) {
+    result_files.emplace_back(Result::FileType::object,
+                              ctx.args_info.output_obj);
+  }
+  if (ctx.args_info.generating_dependencies
+      && !can_regenerate_dependency_file(ctx)) {
+    result_files.emplace_back(Result::FileType::dependency,
+                              ctx.args_info.output_dep);
+  }
+  if (ctx.args_info.generating_coverage) {
+    const auto coverage_file = find_coverage_file(ctx);
+    if (!coverage_file.found) {
+      throw Failure(Statistic::internal_error);
+    }
+    result_files.emplace_back(coverage_file.mangled
+                                ? Result::FileType::coverage_mangled
+                                : Result::FileType::coverage_unmangled,
+                              coverage_file.path);
+  }
+  if (ctx.args_info.generating_stackusage) {
+    result_files.emplace_back(Result::FileType::stackusage,
+                              ctx.args_info.output_su);
+  }
+  if (ctx.args_info.generating_diagnostics) {
+    result_files.emplace_back(Result::FileType::diagnostic,
+                              ctx.args_info.output_dia);
+  }
+  if (!ctx.args_info.output_bmi.empty()) {
+    if (!Stat::stat(ctx.args_info.output_bmi)) {
+      LOG("Compiler didn't produce {}", ctx.args_info.output_bmi);
+      throw Failure(Statistic::compiler_produced_no_output);
+    }
+    result_files.emplace_back(Result::FileType::module_interface,
+                              ctx.args_info.output_bmi);
+  }
+  if (ctx.args_info.seen_split_dwarf && Stat::stat(ctx.args_info.output_dwo)) {
+    // Only store .dwo file if it was created by the compiler (GCC and Clang
+    // behave differently e.g. for "-gsplit-dwarf -g1").
+    result_files.emplace_back(Result::FileType::dwarf_object,
+                              ctx.args_info.output_dwo);
+  }
+  add_warning_options_entry(ctx, result_files);
+  add_compile_time_entry(ctx, result_files);
+  add_output_digests_entry(ctx, result_files);
+
+  const bool admitted = admit_result(ctx);
+
+  // The compiler's output is complete at this point, so if requested, let the
+  // build system continue while a background process stores the result.
+  std::vector<Stat> result_file_stats;
+  if (admitted && ctx.config.write_behind()) {
+    for (const auto& file : result_files) {
+      result_file_stats.push_back(Stat::stat(file.second));
+    }
+  }
+  const bool in_background =
+    admitted && ctx.config.write_behind()
+    && continue_in_background(ctx, stdout_data, tmp_stderr_path);
+
+  // Results referring to raw, shared or delta base files can't be used on their
+  // own, so don't share them with the secondary storage.
+  const bool share = !ctx.config.file_clone() && !ctx.config.hard_link()
+                     && !ctx.config.deduplication()
+                     && ctx.config.max_delta_chain() == 0;
+  bool modified = false;
+  const bool stored = admitted && ctx.storage.put(
+    *ctx.result_name(),
+    Result::k_file_suffix,
+    ctx.counter_updates,
+    [&](const std::string& path) {
+      ctx.set_result_path(path);
+      Result::Writer result_writer(ctx, path);
+      for (const auto& file : result_files) {
+        result_writer.write(file.first, file.second);
+      }
+
+      auto error = result_writer.finalize();
+      if (error) {
+        LOG("Error: {}", *error);
+        return false;
+      }
+
+      // The build system may already have modified the files.
+      for (size_t i = 0; i < result_file_stats.size(); ++i) {
+        if (!is_unmodified(result_files[i].second, result_file_stats[i])) {
+          LOG("{} was modified while storing the result",
+              result_files[i].second);
+          Util::unlink_safe(path);
+          modified = true;
+          return false;
+        }
+      }
+
+      LOG("Stored in cache: {}", path);
+      return true;
+    },
+    share);
+  // An output modified by the build system before a background store finishes
+  // is expected with write_behind and just leaves the result uncached.
+  if (admitted && !stored && !modified) {
+    if (in_background) {
+      // The compilation result has already been handed back, so there is
+      // nothing to fall back to.
+      throw Failure(Statistic::internal_error, EXIT_SUCCESS);
+    }
+    throw Failure(Statistic::internal_error);
+  }
+
+  MTR_END("file", "file_put");
+
+  if (ctx.args_info.output_is_precompiled_header && obj_stat) {
+    write_pch_digest_file(ctx, ctx.args_info.output_obj);
+  }
 
   // Make sure we have a CACHEDIR.TAG in the cache part of cache_dir. This can
   // be done almost anywhere, but we might as well do it near the end as we save
@@ -1058,16 +2427,53 @@ to_cache(Context& ctx,
   create_cachedir_tag(ctx);
 
   // Everything OK.
-  Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+  if (!in_background) {
+    Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+    Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+  }
+  return stored;
+}
+
+// Output of a preprocessor run that has already finished.
+struct PreprocessorOutput
+{
+  std::string stdout_path;
+  std::string stderr_path;
+  int status = -1;
+};
+
+// Add the arguments that make the compiler preprocess the input file to
+// standard output to `args`. Returns the number of arguments added at the end.
+static size_t
+add_preprocessor_mode_args(const Context& ctx, Args& args)
+{
+  size_t args_added = 2;
+  args.push_back("-E");
+  if (ctx.args_info.actual_language == "hip") {
+    args.push_back("-o");
+    args.push_back("-");
+    args_added += 2;
+  }
+  if (ctx.config.keep_comments_cpp()) {
+    args.push_back("-C");
+    args_added++;
+  }
+  args.push_back(ctx.args_info.input_file);
+  return args_added;
 }
 
 // Find the result name by running the compiler in preprocessor mode and
-// hashing the result.
+// hashing the result. If `output` is given, the preprocessor has already been
+// run and its output is hashed instead.
 static Digest
-get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
+get_result_name_from_cpp(Context& ctx,
+                         Args& args,
+                         Hash& hash,
+                         const PreprocessorOutput* output = nullptr)
 {
   ctx.time_of_compilation = time(nullptr);
 
+  const bool is_pump = ctx.config.compiler_type() == CompilerType::pump;
   std::string stderr_path;
   std::string stdout_path;
   int status;
@@ -1076,36 +2482,59 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
     // and directly form the correct i_tmpfile.
     stdout_path = ctx.args_info.input_file;
     status = 0;
+  } else if (output) {
+    stdout_path = output->stdout_path;
+    stderr_path = output->stderr_path;
+    status = output->status;
   } else {
     // Run cpp on the input file to obtain the .i.
 
-    TemporaryFile tmp_stdout(
-      FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
-    stdout_path = tmp_stdout.path;
-    ctx.register_pending_tmp_file(stdout_path);
-
-    TemporaryFile tmp_stderr(
+    TemporaryFile tmp_stderr = ctx.create_transient_file(
       FMT("{}/tmp.cpp_stderr", ctx.config.temporary_dir()));
     stderr_path = tmp_stderr.path;
-    ctx.register_pending_tmp_file(stderr_path);
 
-    size_t args_added = 2;
-    args.push_back("-E");
-    if (ctx.args_info.actual_language == "hip") {
-      args.push_back("-o");
-      args.push_back("-");
-      args_added += 2;
-    }
-    if (ctx.config.keep_comments_cpp()) {
-      args.push_back("-C");
-      args_added++;
-    }
-    args.push_back(ctx.args_info.input_file);
+    const size_t args_added = add_preprocessor_mode_args(ctx, args);
     add_prefix(ctx, args, ctx.config.prefix_command_cpp());
+    const auto compiler_slot = acquire_compiler_slot(ctx);
     LOG_RAW("Running preprocessor");
     MTR_BEGIN("execute", "preprocessor");
-    status =
-      do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+    Tracing::Span preprocessor_span("preprocessor");
+#ifndef _WIN32
+    if (ctx.config.run_second_cpp()) {
+      // The preprocessed output is only needed for the hash, so process it
+      // while the preprocessor runs instead of storing it in a file.
+      hash.hash_delimiter("cpp");
+      bool processed = false;
+      std::exception_ptr processing_error;
+      UmaskScope umask_scope(ctx.original_umask);
+      status = execute(
+        args.to_argv().data(),
+        [&](const Fd& fd) {
+          try {
+            processed = process_preprocessed_stream(ctx, hash, fd, is_pump);
+          } catch (const Failure&) {
+            // Report a preprocessor error first.
+            processing_error = std::current_exception();
+          }
+        },
+        std::move(tmp_stderr.fd),
+        &ctx.compiler_pid);
+      if (status == 0 && processing_error) {
+        std::rethrow_exception(processing_error);
+      }
+      if (status == 0 && !processed) {
+        throw Failure(Statistic::internal_error);
+      }
+    } else
+#endif
+    {
+      TemporaryFile tmp_stdout(
+        FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
+      stdout_path = tmp_stdout.path;
+      ctx.register_pending_tmp_file(stdout_path);
+      status =
+        do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+    }
     MTR_END("execute", "preprocessor");
     args.pop_back(args_added);
   }
@@ -1115,10 +2544,11 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
     throw Failure(Statistic::preprocessor_error);
   }
 
-  hash.hash_delimiter("cpp");
-  bool is_pump = ctx.config.compiler_type() == CompilerType::pump;
-  if (!process_preprocessed_file(ctx, hash, stdout_path, is_pump)) {
-    throw Failure(Statistic::internal_error);
+  if (!stdout_path.empty()) {
+    hash.hash_delimiter("cpp");
+    if (!process_preprocessed_file(ctx, hash, stdout_path, is_pump)) {
+      throw Failure(Statistic::internal_error);
+    }
   }
 
   hash.hash_delimiter("cppstderr");
@@ -1130,7 +2560,7 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
 
   if (ctx.args_info.direct_i_file) {
     ctx.i_tmpfile = ctx.args_info.input_file;
-  } else {
+  } else if (!stdout_path.empty()) {
     // i_tmpfile needs the proper cpp_extension for the compiler to do its
     // thing correctly
     ctx.i_tmpfile = FMT("{}.{}", stdout_path, ctx.config.cpp_extension());
@@ -1149,6 +2579,128 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
   return hash.digest();
 }
 
+// Calculate the digest of the content of the compiler (if `content` is true)
+// or of the output of the compiler check command, reusing a digest memoized by
+// a previous invocation for the same compiler if possible.
+// Get the path to the GCC internal program `name` (e.g. cc1plus) that the GCC
+// driver at `path` runs, if any.
+static optional<std::string>
+get_gcc_program_path(const Context& ctx,
+                     const std::string& path,
+                     const std::string& name)
+{
+  TemporaryFile tmp_stdout(FMT("{}/tmp.prog_name", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr(
+    FMT("{}/tmp.prog_name_stderr", ctx.config.temporary_dir()));
+  const std::string stdout_path = tmp_stdout.path;
+  const std::string stderr_path = tmp_stderr.path;
+
+  Args args;
+  args.push_back(path);
+  args.push_back(FMT("-print-prog-name={}", name));
+  pid_t pid = 0;
+  const int status = execute(args.to_argv().data(),
+                             std::move(tmp_stdout.fd),
+                             std::move(tmp_stderr.fd),
+                             &pid);
+  optional<std::string> program_path;
+  if (status == 0) {
+    try {
+      program_path =
+        std::string(Util::strip_whitespace(Util::read_file(stdout_path)));
+    } catch (const Error& e) {
+      LOG("Failed to read {}: {}", stdout_path, e.what());
+    }
+  }
+  Util::unlink_tmp(stdout_path);
+  Util::unlink_tmp(stderr_path);
+
+  // GCC prints just the name if the program is not found.
+  if (!program_path || !Util::is_absolute_path(*program_path)
+      || !Stat::stat(*program_path)) {
+    return nullopt;
+  }
+  return program_path;
+}
+
+// Hash the build IDs of the compiler at `path` and, for GCC, of the cc1 and
+// cc1plus programs that it runs. The content of a file without a build ID is
+// hashed instead.
+static bool
+hash_compiler_build_ids(const Context& ctx, Hash& hash, const std::string& path)
+{
+  std::vector<std::string> paths{path};
+  if (ctx.config.compiler_type() == CompilerType::gcc) {
+    for (const char* name : {"cc1", "cc1plus"}) {
+      const auto program_path = get_gcc_program_path(ctx, path, name);
+      if (program_path) {
+        paths.push_back(*program_path);
+      }
+    }
+  }
+
+  bool success = true;
+  for (const auto& p : paths) {
+    const auto build_id = BuildId::read(p);
+    if (build_id) {
+      hash.hash_delimiter("build_id");
+      hash.hash(build_id->data(), build_id->size(), Hash::HashType::binary);
+    } else {
+      LOG("No build ID found in {}, hashing its content", p);
+      hash.hash_delimiter("content");
+      success = hash_binary_file(ctx, hash, p) && success;
+    }
+  }
+  return success;
+}
+
+static Digest
+get_compiler_check_digest(const Context& ctx,
+                          const Stat& st,
+                          const std::string& path,
+                          bool content)
+{
+  Hash key_hash;
+  key_hash.hash_delimiter("compiler_check");
+  if (content) {
+    // Only depends on the file, so e.g. the digests of nvcc's host compilers
+    // are shared by all nvcc installations.
+    key_hash.hash("content");
+  } else {
+    key_hash.hash(ctx.config.compiler_check());
+    key_hash.hash(ctx.orig_args[0]);
+  }
+  const bool memoizable = DigestMemo::hash_file_identity(key_hash, path, st);
+  const Digest key = key_hash.digest();
+
+  if (memoizable) {
+    const auto memoized_digest = ctx.digest_memo.get(key);
+    if (memoized_digest) {
+      LOG("Using memoized compiler check result for {}", path);
+      return *memoized_digest;
+    }
+  }
+
+  Hash hash;
+  bool success = true;
+  if (content) {
+    success = hash_binary_file(ctx, hash, path);
+  } else if (ctx.config.compiler_check() == "buildid") {
+    success = hash_compiler_build_ids(ctx, hash, path);
+  } else if (!hash_multicommand_output(
+               hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
+    LOG("Failure running compiler check command: {}",
+        ctx.config.compiler_check());
+    throw Failure(Statistic::compiler_check_failed);
+  }
+
+  const Digest digest = hash.digest();
+  if (memoizable && success) {
+    ctx.digest_memo.put(key, digest);
+  }
+  return digest;
+}
+
 // Hash mtime or content of a file, or the output of a command, according to
 // the CCACHE_COMPILERCHECK setting.
 static void
@@ -1167,12 +2719,29 @@ hash_compiler(const Context& ctx,
   } else if (Util::starts_with(ctx.config.compiler_check(), "string:")) {
     hash.hash_delimiter("cc_hash");
     hash.hash(&ctx.config.compiler_check()[7]);
+  } else if (ctx.config.compiler_check() == "buildid") {
+    hash.hash_delimiter("cc_buildid");
+    if (ctx.config.memoize_compiler_check()) {
+      const auto digest = get_compiler_check_digest(ctx, st, path, false);
+      hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+    } else {
+      hash_compiler_build_ids(ctx, hash, path);
+    }
   } else if (ctx.config.compiler_check() == "content" || !allow_command) {
     hash.hash_delimiter("cc_content");
-    hash_binary_file(ctx, hash, path);
+    if (ctx.config.memoize_compiler_check()) {
+      const auto digest = get_compiler_check_digest(ctx, st, path, true);
+      hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+    } else {
+      hash_binary_file(ctx, hash, path);
+    }
   } else { // command string
-    if (!hash_multicommand_output(
-          hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
+    if (ctx.config.memoize_compiler_check()) {
+      hash.hash_delimiter("cc_command");
+      const auto digest = get_compiler_check_digest(ctx, st, path, false);
+      hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
+    } else if (!hash_multicommand_output(
+                 hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
       LOG("Failure running compiler check command: {}",
           ctx.config.compiler_check());
       throw Failure(Statistic::compiler_check_failed);
@@ -1222,7 +2791,7 @@ hash_nvcc_host_compiler(const Context& ctx,
         std::string path = find_executable(ctx, compiler, CCACHE_NAME);
         if (!path.empty()) {
           auto st = Stat::stat(path, Stat::OnError::log);
-          hash_compiler(ctx, hash, st, ccbin, false);
+          hash_compiler(ctx, hash, st, path, false);
         }
       }
     }
@@ -1231,19 +2800,72 @@ hash_nvcc_host_compiler(const Context& ctx,
   }
 }
 
+// Hash the content digest of an input file that isn't a source or header file,
+// e.g. one of extra_files_to_hash or a profile data file. The digest is
+// memoized by `kind` and the identity of the file, so the file is only read
+// again when it changes, whether or not the inode cache is enabled or still
+// has the file.
 static bool
-should_rewrite_dependency_target(const ArgsInfo& args_info)
+hash_memoized_file(const Context& ctx,
+                   Hash& hash,
+                   const std::string& path,
+                   const Stat& st,
+                   string_view kind)
 {
-  return !args_info.dependency_target_specified && args_info.seen_MD_MMD;
+  Hash key_hash;
+  key_hash.hash_delimiter(kind);
+  const bool memoizable = DigestMemo::hash_file_identity(key_hash, path, st);
+  const Digest key = key_hash.digest();
+
+  optional<Digest> digest = memoizable ? ctx.digest_memo.get(key) : nullopt;
+  if (digest) {
+    LOG("Using memoized digest of {}", path);
+  } else {
+    Digest file_digest;
+    if (!get_binary_file_digest(ctx, path, file_digest)) {
+      return false;
+    }
+    if (memoizable) {
+      ctx.digest_memo.put(key, file_digest);
+    }
+    digest = file_digest;
+  }
+
+  hash.hash(digest->bytes(), Digest::size(), Hash::HashType::binary);
+  return true;
 }
 
-// update a hash with information common for the direct and preprocessor modes.
-static void
-hash_common_info(const Context& ctx,
-                 const Args& args,
-                 Hash& hash,
-                 const ArgsInfo& args_info)
+// How hash_shared_common_info hashes files.
+enum class FileHashing {
+  content,
+  // Hash the identities of files instead, for the key of the memoized state.
+  identity,
+};
+
+// Update a hash with the part of the common information that is typically the
+// same for all compilations in a directory. Returns false if the identity of a
+// file can't be trusted when hashing identities.
+static bool
+hash_shared_common_info(const Context& ctx,
+                        const Args& args,
+                        Hash& hash,
+                        const ArgsInfo& args_info,
+                        FileHashing file_hashing)
 {
+  bool trusted = true;
+  const auto hash_file = [&](const std::string& path, bool memoize) {
+    if (file_hashing == FileHashing::content) {
+      if (!memoize) {
+        return hash_binary_file(ctx, hash, path);
+      }
+      const auto st = Stat::stat(path, Stat::OnError::log);
+      return st && hash_memoized_file(ctx, hash, path, st, "file content");
+    }
+    const auto st = Stat::stat(path);
+    trusted = st && DigestMemo::hash_file_identity(hash, path, st) && trusted;
+    return true;
+  };
+
   hash.hash(HASH_PREFIX);
 
   // We have to hash the extension, as a .i file isn't treated the same by the
@@ -1263,7 +2885,22 @@ hash_common_info(const Context& ctx,
   }
 
   // Hash information about the compiler.
-  hash_compiler(ctx, hash, st, compiler_path, true);
+  if (file_hashing == FileHashing::content) {
+    hash_compiler(ctx, hash, st, compiler_path, true);
+  } else {
+    hash.hash_delimiter("cc_identity");
+    hash.hash(ctx.config.compiler_check());
+    trusted =
+      DigestMemo::hash_file_identity(hash, compiler_path, st) && trusted;
+    // Build IDs and command output may depend on other files than the
+    // compiler, so they are trusted as much as memoize_compiler_check says.
+    const auto& check = ctx.config.compiler_check();
+    if (check != "none" && check != "mtime" && check != "content"
+        && !Util::starts_with(check, "string:")
+        && !ctx.config.memoize_compiler_check()) {
+      trusted = false;
+    }
+  }
 
   // Also hash the compiler name as some compilers use hard links and behave
   // differently depending on the real name.
@@ -1302,26 +2939,96 @@ hash_common_info(const Context& ctx,
 
   // Possibly hash the current working directory.
   if (args_info.generating_debuginfo && ctx.config.hash_dir()) {
-    std::string dir_to_hash = ctx.apparent_cwd;
-    for (const auto& map : args_info.debug_prefix_maps) {
-      size_t sep_pos = map.find('=');
-      if (sep_pos != std::string::npos) {
-        std::string old_path = map.substr(0, sep_pos);
-        std::string new_path = map.substr(sep_pos + 1);
-        LOG("Relocating debuginfo from {} to {} (CWD: {})",
-            old_path,
-            new_path,
-            ctx.apparent_cwd);
-        if (Util::starts_with(ctx.apparent_cwd, old_path)) {
-          dir_to_hash = new_path + ctx.apparent_cwd.substr(old_path.size());
-        }
-      }
-    }
+    const std::string dir_to_hash =
+      apply_debug_prefix_maps(args_info, ctx.apparent_cwd);
     LOG("Hashing CWD {}", dir_to_hash);
     hash.hash_delimiter("cwd");
     hash.hash(dir_to_hash);
   }
 
+  for (const auto& module_file : args_info.module_files) {
+    LOG("Hashing module file {}", module_file);
+    hash.hash_delimiter("module file");
+    if (!hash_file(module_file, false)) {
+      throw Failure(Statistic::error_hashing_extra_file);
+    }
+  }
+
+  // Possibly hash the sanitize blacklist file path.
+  for (const auto& sanitize_blacklist : args_info.sanitize_blacklists) {
+    LOG("Hashing sanitize blacklist {}", sanitize_blacklist);
+    hash.hash("sanitizeblacklist");
+    if (!hash_file(sanitize_blacklist, true)) {
+      throw Failure(Statistic::error_hashing_extra_file);
+    }
+  }
+
+  if (!ctx.config.extra_files_to_hash().empty()) {
+    for (const std::string& path : Util::split_into_strings(
+           ctx.config.extra_files_to_hash(), PATH_DELIM)) {
+      LOG("Hashing extra file {}", path);
+      hash.hash_delimiter("extrafile");
+      if (!hash_file(path, true)) {
+        throw Failure(Statistic::error_hashing_extra_file);
+      }
+    }
+  }
+
+  // Possibly hash GCC_COLORS (for color diagnostics).
+  if (ctx.config.compiler_type() == CompilerType::gcc) {
+    const char* gcc_colors = getenv("GCC_COLORS");
+    if (gcc_colors) {
+      hash.hash_delimiter("gcccolors");
+      hash.hash(gcc_colors);
+    }
+  }
+
+  return trusted;
+}
+
+// Update a hash with information common for the direct and preprocessor modes.
+static void
+hash_common_info(const Context& ctx,
+                 const Args& args,
+                 Hash& hash,
+                 const ArgsInfo& args_info)
+{
+  // If the shared part hashes file contents, the hash state after it is
+  // memoized, keyed by the identities of the files, so that e.g.
+  // extra_files_to_hash aren't hashed again. Hash debugging and miss
+  // explanations need the full input.
+  const bool hashes_files =
+    !args_info.module_files.empty() || !args_info.sanitize_blacklists.empty()
+    || !ctx.config.extra_files_to_hash().empty()
+    || (ctx.config.compiler_check() == "content"
+        && !ctx.config.memoize_compiler_check());
+  optional<Digest> memo_key;
+  if (hashes_files && !ctx.config.debug() && !ctx.config.explain_misses()) {
+    Hash key_hash;
+    key_hash.hash_delimiter("common info state");
+    key_hash.hash(CCACHE_VERSION);
+    key_hash.hash(static_cast<int64_t>(Hash::default_algorithm()));
+    key_hash.hash(static_cast<int64_t>(ctx.config.inode_cache()));
+    key_hash.hash(static_cast<int64_t>(ctx.config.memoize_compiler_check()));
+    const Digest initial = hash.digest();
+    key_hash.hash(initial.bytes(), Digest::size(), Hash::HashType::binary);
+    if (hash_shared_common_info(
+          ctx, args, key_hash, args_info, FileHashing::identity)) {
+      memo_key = key_hash.digest();
+    }
+  }
+
+  const auto memoized_state =
+    memo_key ? ctx.digest_memo.get_data(*memo_key) : nullopt;
+  if (memoized_state && hash.set_state(*memoized_state)) {
+    LOG_RAW("Using memoized common hash state");
+  } else {
+    hash_shared_common_info(ctx, args, hash, args_info, FileHashing::content);
+    if (memo_key) {
+      ctx.digest_memo.put_data(*memo_key, hash.state());
+    }
+  }
+
   if ((!should_rewrite_dependency_target(ctx.args_info)
        && ctx.args_info.generating_dependencies)
       || ctx.args_info.seen_split_dwarf) {
@@ -1336,6 +3043,14 @@ hash_common_info(const Context& ctx,
     hash.hash(ctx.args_info.output_obj);
   }
 
+  if (ctx.args_info.preprocessing_only) {
+    // The preprocessed output is the result, and its line markers contain the
+    // input file path and possibly the working directory.
+    hash.hash_delimiter("preprocessing only");
+    hash.hash(ctx.args_info.input_file);
+    hash.hash(ctx.apparent_cwd);
+  }
+
   // Possibly hash the coverage data file path.
   if (ctx.args_info.generating_coverage && ctx.args_info.profile_arcs) {
     std::string dir;
@@ -1352,35 +3067,6 @@ hash_common_info(const Context& ctx,
     hash.hash_delimiter("gcda");
     hash.hash(gcda_path);
   }
-
-  // Possibly hash the sanitize blacklist file path.
-  for (const auto& sanitize_blacklist : args_info.sanitize_blacklists) {
-    LOG("Hashing sanitize blacklist {}", sanitize_blacklist);
-    hash.hash("sanitizeblacklist");
-    if (!hash_binary_file(ctx, hash, sanitize_blacklist)) {
-      throw Failure(Statistic::error_hashing_extra_file);
-    }
-  }
-
-  if (!ctx.config.extra_files_to_hash().empty()) {
-    for (const std::string& path : Util::split_into_strings(
-           ctx.config.extra_files_to_hash(), PATH_DELIM)) {
-      LOG("Hashing extra file {}", path);
-      hash.hash_delimiter("extrafile");
-      if (!hash_binary_file(ctx, hash, path)) {
-        throw Failure(Statistic::error_hashing_extra_file);
-      }
-    }
-  }
-
-  // Possibly hash GCC_COLORS (for color diagnostics).
-  if (ctx.config.compiler_type() == CompilerType::gcc) {
-    const char* gcc_colors = getenv("GCC_COLORS");
-    if (gcc_colors) {
-      hash.hash_delimiter("gcccolors");
-      hash.hash(gcc_colors);
-    }
-  }
 }
 
 static bool
@@ -1411,7 +3097,9 @@ hash_profile_data_file(const Context& ctx, Hash& hash)
     if (st && !st.is_directory()) {
       LOG("Adding profile data {} to the hash", p);
       hash.hash_delimiter("-fprofile-use");
-      if (hash_binary_file(ctx, hash, p)) {
+      // Profile data can be large and is the same for all compilations in a
+      // build, so its digest is memoized.
+      if (hash_memoized_file(ctx, hash, p, st, "profile data")) {
         found = true;
       }
     }
@@ -1421,7 +3109,7 @@ hash_profile_data_file(const Context& ctx, Hash& hash)
 }
 
 static bool
-option_should_be_ignored(const std::string& arg,
+option_should_be_ignored(string_view arg,
                          const std::vector<std::string>& patterns)
 {
   return std::any_of(
@@ -1433,6 +3121,318 @@ option_should_be_ignored(const std::string& arg,
     });
 }
 
+// Find the result name for a compilation with several -arch options by
+// running the preprocessor once per architecture. The preprocessors for all
+// but the first architecture run concurrently with the first one, writing to
+// temporary files, and the outputs are then hashed in -arch order so that the
+// result name doesn't depend on which preprocessor finishes first.
+static Digest
+get_result_name_from_multi_arch_cpp(Context& ctx, Args& args, Hash& hash)
+{
+  const auto& arch_args = ctx.args_info.arch_args;
+  std::vector<PreprocessorOutput> outputs(arch_args.size());
+
+  // The umask is process-wide, so set it for all preprocessors up front.
+  UmaskScope umask_scope(ctx.original_umask);
+  Jobserver::Tokens tokens(ctx.args_info.direct_i_file ? 0
+                                                      : arch_args.size() - 1);
+  ThreadPool thread_pool(tokens.count());
+  for (size_t i = 1; i < arch_args.size() && !ctx.args_info.direct_i_file;
+       ++i) {
+    TemporaryFile tmp_stdout(
+      FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
+    TemporaryFile tmp_stderr = ctx.create_transient_file(
+      FMT("{}/tmp.cpp_stderr", ctx.config.temporary_dir()));
+    outputs[i].stdout_path = tmp_stdout.path;
+    outputs[i].stderr_path = tmp_stderr.path;
+    ctx.register_pending_tmp_file(tmp_stdout.path);
+
+    Args arch_cpp_args = args;
+    arch_cpp_args.push_back("-arch");
+    arch_cpp_args.push_back(arch_args[i]);
+    add_preprocessor_mode_args(ctx, arch_cpp_args);
+    add_prefix(ctx, arch_cpp_args, ctx.config.prefix_command_cpp());
+
+    // TemporaryFile isn't copyable, so hand over the file descriptors.
+    auto fd_out = std::make_shared<Fd>(std::move(tmp_stdout.fd));
+    auto fd_err = std::make_shared<Fd>(std::move(tmp_stderr.fd));
+    auto& status = outputs[i].status;
+    thread_pool.enqueue([arch_cpp_args, fd_out, fd_err, &status] {
+      try {
+        pid_t pid = 0;
+        status = execute(arch_cpp_args.to_argv().data(),
+                         std::move(*fd_out),
+                         std::move(*fd_err),
+                         &pid);
+      } catch (const std::exception& e) {
+        LOG("Failed to run preprocessor: {}", e.what());
+        status = -1;
+      }
+    });
+  }
+
+  optional<Digest> result_name;
+  args.push_back("-arch");
+  for (size_t i = 0; i < arch_args.size(); ++i) {
+    if (i == 1) {
+      // Runs the remaining preprocessors here if there are no worker threads.
+      thread_pool.wait_all();
+    }
+    args.push_back(arch_args[i]);
+    // Rerun a failed preprocessor on this thread to get the usual error
+    // handling, e.g. for unsupported -fdiagnostics-color.
+    const bool use_output = i > 0 && outputs[i].status == 0;
+    result_name = get_result_name_from_cpp(
+      ctx, args, hash, use_output ? &outputs[i] : nullptr);
+    LOG("Got result name from preprocessor with -arch {}", arch_args[i]);
+    args.pop_back();
+  }
+  args.pop_back();
+
+  return *result_name;
+}
+
+// A preprocessor started before the direct mode lookup so that its output is
+// ready if the lookup misses (see the speculative_cpp option). The preprocessor
+// is killed if its output isn't used when the object is destroyed.
+class SpeculativePreprocessor : NonCopyable
+{
+public:
+  SpeculativePreprocessor(Context& ctx, const Args& args);
+  ~SpeculativePreprocessor();
+
+  // Wait for the preprocessor to exit and return its output, or nullptr if it
+  // wasn't started or failed, in which case it should be run again the usual
+  // way to get the usual error handling.
+  const PreprocessorOutput* finish();
+
+private:
+  Context& m_ctx;
+  Jobserver::Tokens m_tokens;
+  PreprocessorOutput m_output;
+};
+
+SpeculativePreprocessor::SpeculativePreprocessor(Context& ctx,
+                                                 const Args& args)
+  : m_ctx(ctx),
+    // The preprocessor runs in addition to ccache itself.
+    m_tokens(1)
+{
+#ifndef _WIN32
+  if (m_tokens.count() == 0) {
+    LOG_RAW("Not starting speculative preprocessor without jobserver token");
+    return;
+  }
+
+  TemporaryFile tmp_stdout(
+    FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr = ctx.create_transient_file(
+    FMT("{}/tmp.cpp_stderr", ctx.config.temporary_dir()));
+  m_output.stdout_path = tmp_stdout.path;
+  m_output.stderr_path = tmp_stderr.path;
+  ctx.register_pending_tmp_file(tmp_stdout.path);
+
+  Args cpp_args = args;
+  add_preprocessor_mode_args(ctx, cpp_args);
+  add_prefix(ctx, cpp_args, ctx.config.prefix_command_cpp());
+  LOG_RAW("Starting speculative preprocessor");
+  UmaskScope umask_scope(ctx.original_umask);
+  execute_async(cpp_args.to_argv().data(),
+                std::move(tmp_stdout.fd),
+                std::move(tmp_stderr.fd),
+                &ctx.compiler_pid);
+#else
+  (void)args;
+#endif
+}
+
+SpeculativePreprocessor::~SpeculativePreprocessor()
+{
+#ifndef _WIN32
+  if (m_ctx.compiler_pid != 0) {
+    LOG_RAW("Cancelling speculative preprocessor");
+    kill(m_ctx.compiler_pid, SIGTERM);
+    try {
+      execute_wait(&m_ctx.compiler_pid);
+    } catch (const Fatal& e) {
+      LOG("Error: {}", e.what());
+    }
+  }
+#endif
+}
+
+const PreprocessorOutput*
+SpeculativePreprocessor::finish()
+{
+#ifndef _WIN32
+  if (m_ctx.compiler_pid == 0) {
+    return nullptr;
+  }
+  Tracing::Span span("speculative_preprocessor_wait");
+  m_output.status = execute_wait(&m_ctx.compiler_pid);
+  m_tokens.release();
+  if (m_output.status != 0) {
+    LOG("Speculative preprocessor gave exit status {}", m_output.status);
+    return nullptr;
+  }
+  LOG_RAW("Using output of speculative preprocessor");
+  return &m_output;
+#else
+  return nullptr;
+#endif
+}
+
+// Split an item of the `system_include_roots` setting into the root and the
+// optional stamp file after "=".
+static std::pair<nonstd::string_view, nonstd::string_view>
+split_system_include_root(nonstd::string_view item)
+{
+  const auto eq = item.find('=');
+  if (eq == nonstd::string_view::npos) {
+    return {item, {}};
+  }
+  return {item.substr(0, eq), item.substr(eq + 1)};
+}
+
+// Hash the fingerprints of the system include roots, i.e. the identities of
+// the root directories and their stamp files. Returns false if a root or stamp
+// file can't be fingerprinted, in which case its include files must be
+// recorded in the manifest as usual.
+static bool
+hash_system_include_roots(const Context& ctx, Hash& hash)
+{
+  for (const auto& item : Util::split_into_views(
+         ctx.config.system_include_roots(), PATH_DELIM)) {
+    const auto root_and_stamp = split_system_include_root(item);
+    for (const auto& path : {root_and_stamp.first, root_and_stamp.second}) {
+      if (path.empty()) {
+        continue;
+      }
+      const std::string path_str(path);
+      const auto stat = ctx.stat_cache.stat(path_str, Stat::OnError::log);
+      if (!stat || !DigestMemo::hash_file_identity(hash, path_str, stat)) {
+        LOG("Not fingerprinting system include root {} since {} is missing or"
+            " too new",
+            root_and_stamp.first,
+            path_str);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Get the concrete target options that the compiler at `path` uses for a
+// -march=native style `option` on this host, as reported by the compiler
+// driver with -###. The result is memoized per compiler and host name.
+static optional<std::string>
+resolve_native_target_option(const Context& ctx,
+                             const std::string& path,
+                             const std::string& option)
+{
+  const auto st = Stat::stat(path);
+  if (!st) {
+    return nullopt;
+  }
+  Hash key_hash;
+  key_hash.hash_delimiter("native target option");
+  key_hash.hash(option);
+  key_hash.hash(Util::get_hostname());
+  const bool memoizable = DigestMemo::hash_file_identity(key_hash, path, st);
+  const Digest key = key_hash.digest();
+  if (memoizable) {
+    auto memoized = ctx.digest_memo.get_data(key);
+    if (memoized) {
+      return memoized;
+    }
+  }
+
+  TemporaryFile tmp_stdout(
+    FMT("{}/tmp.native_stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr(
+    FMT("{}/tmp.native_stderr", ctx.config.temporary_dir()));
+  const std::string stdout_path = tmp_stdout.path;
+  const std::string stderr_path = tmp_stderr.path;
+
+  Args args;
+  args.push_back(path);
+  args.push_back(option);
+  args.push_back("-###");
+  args.push_back("-E");
+  args.push_back("-x");
+  args.push_back("c");
+  args.push_back("-");
+  pid_t pid = 0;
+  const int status = execute(args.to_argv().data(),
+                             std::move(tmp_stdout.fd),
+                             std::move(tmp_stderr.fd),
+                             &pid);
+  std::string output;
+  if (status == 0) {
+    try {
+      output = Util::read_file(stderr_path);
+    } catch (const Error& e) {
+      LOG("Failed to read {}: {}", stderr_path, e.what());
+    }
+  }
+  Util::unlink_tmp(stdout_path);
+  Util::unlink_tmp(stderr_path);
+
+  // Pick the target options from the commands that the driver would run, i.e.
+  // -m options and --param values from GCC and -target-cpu, -target-feature
+  // and -tune-cpu values from Clang. Other parts of the commands, like
+  // temporary file names, may differ between runs.
+  std::string resolved;
+  for (const auto& line : Util::split_into_strings(output, "\n")) {
+    if (!Util::starts_with(line, " ")) {
+      continue;
+    }
+    const Args command = Args::from_atfile_string(line);
+    for (size_t i = 0; i < command.size(); ++i) {
+      const std::string& arg = command[i];
+      if (Util::starts_with(arg, "-m")) {
+        resolved += arg + ' ';
+      } else if ((arg == "--param" || arg == "-target-cpu"
+                  || arg == "-target-feature" || arg == "-tune-cpu")
+                 && i + 1 < command.size()) {
+        resolved += arg + ' ' + command[i + 1] + ' ';
+        ++i;
+      }
+    }
+  }
+  if (resolved.empty()) {
+    LOG("Failed to resolve {} for {}", option, path);
+    return nullopt;
+  }
+
+  if (memoizable) {
+    ctx.digest_memo.put_data(key, resolved);
+  }
+  return resolved;
+}
+
+// Start the time budget for looking up a result if lookup_timeout is set.
+static void
+start_lookup_deadline(Context& ctx)
+{
+  if (ctx.config.lookup_timeout() > 0) {
+    ctx.storage.set_lookup_deadline(
+      std::chrono::steady_clock::now()
+      + std::chrono::milliseconds(ctx.config.lookup_timeout()));
+  }
+}
+
+// Give up the lookup in favor of running the compiler if it has taken longer
+// than lookup_timeout.
+static void
+check_lookup_deadline(const Context& ctx)
+{
+  if (ctx.storage.lookup_deadline_passed()) {
+    LOG("Lookup took longer than {} ms", ctx.config.lookup_timeout());
+    throw Failure(Statistic::lookup_timeout);
+  }
+}
+
 // Update a hash sum with information specific to the direct and preprocessor
 // modes and calculate the result name. Returns the result name on success,
 // otherwise nullopt.
@@ -1441,7 +3441,8 @@ calculate_result_name(Context& ctx,
                       const Args& args,
                       Args& preprocessor_args,
                       Hash& hash,
-                      bool direct_mode)
+                      bool direct_mode,
+                      const PreprocessorOutput* cpp_output = nullptr)
 {
   bool found_ccbin = false;
 
@@ -1453,34 +3454,48 @@ calculate_result_name(Context& ctx,
     hash.hash(Manifest::k_version);
   }
 
+  // Options that only affect diagnostics are hashed separately so that
+  // compilations that only differ in warnings share results.
+  const bool ignore_warning_options = ignores_warning_options(ctx);
+  Hash warning_options_hash;
+
   // clang will emit warnings for unused linker flags, so we shouldn't skip
   // those arguments.
   int is_clang = ctx.config.compiler_type() == CompilerType::clang
                  || ctx.config.compiler_type() == CompilerType::other;
 
-  // First the arguments.
+  // First the arguments. Options are classified via views into the argument
+  // strings to avoid creating temporary strings for each argument.
   for (size_t i = 1; i < args.size(); i++) {
+    const string_view arg = args[i];
+
     // Trust the user if they've said we should not hash a given option.
-    if (option_should_be_ignored(args[i], ctx.ignore_options())) {
-      LOG("Not hashing ignored option: {}", args[i]);
-      if (i + 1 < args.size() && compopt_takes_arg(args[i])) {
+    if (option_should_be_ignored(arg, ctx.ignore_options())) {
+      LOG("Not hashing ignored option: {}", arg);
+      if (i + 1 < args.size() && compopt_takes_arg(arg)) {
         i++;
         LOG("Not hashing argument of ignored option: {}", args[i]);
       }
       continue;
     }
 
+    if (ignore_warning_options && compopt_affects_diagnostics_only(arg)) {
+      warning_options_hash.hash_delimiter("arg");
+      warning_options_hash.hash(arg);
+      continue;
+    }
+
     // -L doesn't affect compilation (except for clang).
-    if (i < args.size() - 1 && args[i] == "-L" && !is_clang) {
+    if (i < args.size() - 1 && arg == "-L" && !is_clang) {
       i++;
       continue;
     }
-    if (Util::starts_with(args[i], "-L") && !is_clang) {
+    if (arg.starts_with("-L") && !is_clang) {
       continue;
     }
 
     // -Wl,... doesn't affect compilation (except for clang).
-    if (Util::starts_with(args[i], "-Wl,") && !is_clang) {
+    if (arg.starts_with("-Wl,") && !is_clang) {
       continue;
     }
 
@@ -1488,17 +3503,17 @@ calculate_result_name(Context& ctx,
     // CCACHE_BASEDIR to reuse results across different directories. Skip using
     // the value of the option from hashing but still hash the existence of the
     // option.
-    if (Util::starts_with(args[i], "-fdebug-prefix-map=")) {
+    if (arg.starts_with("-fdebug-prefix-map=")) {
       hash.hash_delimiter("arg");
       hash.hash("-fdebug-prefix-map=");
       continue;
     }
-    if (Util::starts_with(args[i], "-ffile-prefix-map=")) {
+    if (arg.starts_with("-ffile-prefix-map=")) {
       hash.hash_delimiter("arg");
       hash.hash("-ffile-prefix-map=");
       continue;
     }
-    if (Util::starts_with(args[i], "-fmacro-prefix-map=")) {
+    if (arg.starts_with("-fmacro-prefix-map=")) {
       hash.hash_delimiter("arg");
       hash.hash("-fmacro-prefix-map=");
       continue;
@@ -1510,13 +3525,13 @@ calculate_result_name(Context& ctx,
     // might not be the case.
     if (!direct_mode && !ctx.args_info.output_is_precompiled_header
         && !ctx.args_info.using_precompiled_header) {
-      if (compopt_affects_cpp_output(args[i])) {
-        if (compopt_takes_arg(args[i])) {
+      if (compopt_affects_cpp_output(arg)) {
+        if (compopt_takes_arg(arg)) {
           i++;
         }
         continue;
       }
-      if (compopt_affects_cpp_output(args[i].substr(0, 2))) {
+      if (compopt_affects_cpp_output(arg.substr(0, 2))) {
         continue;
       }
     }
@@ -1524,23 +3539,23 @@ calculate_result_name(Context& ctx,
     // If we're generating dependencies, we make sure to skip the filename of
     // the dependency file, since it doesn't impact the output.
     if (ctx.args_info.generating_dependencies) {
-      if (Util::starts_with(args[i], "-Wp,")) {
-        if (Util::starts_with(args[i], "-Wp,-MD,")
-            && args[i].find(',', 8) == std::string::npos) {
-          hash.hash(args[i].data(), 8);
+      if (arg.starts_with("-Wp,")) {
+        if (arg.starts_with("-Wp,-MD,")
+            && arg.find(',', 8) == string_view::npos) {
+          hash.hash(arg.data(), 8);
           continue;
-        } else if (Util::starts_with(args[i], "-Wp,-MMD,")
-                   && args[i].find(',', 9) == std::string::npos) {
-          hash.hash(args[i].data(), 9);
+        } else if (arg.starts_with("-Wp,-MMD,")
+                   && arg.find(',', 9) == string_view::npos) {
+          hash.hash(arg.data(), 9);
           continue;
         }
-      } else if (Util::starts_with(args[i], "-MF")) {
+      } else if (arg.starts_with("-MF")) {
         // In either case, hash the "-MF" part.
         hash.hash_delimiter("arg");
-        hash.hash(args[i].data(), 3);
+        hash.hash(arg.data(), 3);
 
         if (ctx.args_info.output_dep != "/dev/null") {
-          bool separate_argument = (args[i].size() == 3);
+          bool separate_argument = (arg.size() == 3);
           if (separate_argument) {
             // Next argument is dependency name, so skip it.
             i++;
@@ -1550,9 +3565,8 @@ calculate_result_name(Context& ctx,
       }
     }
 
-    if (Util::starts_with(args[i], "-specs=")
-        || Util::starts_with(args[i], "--specs=")) {
-      std::string path = args[i].substr(args[i].find('=') + 1);
+    if (arg.starts_with("-specs=") || arg.starts_with("--specs=")) {
+      std::string path(arg.substr(arg.find('=') + 1));
       auto st = Stat::stat(path, Stat::OnError::log);
       if (st) {
         // If given an explicit specs file, then hash that file, but don't
@@ -1563,16 +3577,17 @@ calculate_result_name(Context& ctx,
       }
     }
 
-    if (Util::starts_with(args[i], "-fplugin=")) {
-      auto st = Stat::stat(&args[i][9], Stat::OnError::log);
+    if (arg.starts_with("-fplugin=")) {
+      std::string path(arg.substr(9));
+      auto st = Stat::stat(path, Stat::OnError::log);
       if (st) {
         hash.hash_delimiter("plugin");
-        hash_compiler(ctx, hash, st, &args[i][9], false);
+        hash_compiler(ctx, hash, st, path, false);
         continue;
       }
     }
 
-    if (args[i] == "-Xclang" && i + 3 < args.size() && args[i + 1] == "-load"
+    if (arg == "-Xclang" && i + 3 < args.size() && args[i + 1] == "-load"
         && args[i + 2] == "-Xclang") {
       auto st = Stat::stat(args[i + 3], Stat::OnError::log);
       if (st) {
@@ -1583,7 +3598,7 @@ calculate_result_name(Context& ctx,
       }
     }
 
-    if ((args[i] == "-ccbin" || args[i] == "--compiler-bindir")
+    if ((arg == "-ccbin" || arg == "--compiler-bindir")
         && i + 1 < args.size()) {
       auto st = Stat::stat(args[i + 1]);
       if (st) {
@@ -1595,16 +3610,38 @@ calculate_result_name(Context& ctx,
       }
     }
 
+    // -march=native and friends mean different things on different hosts, so
+    // hash what they resolve to instead.
+    if ((arg == "-march=native" || arg == "-mcpu=native"
+         || arg == "-mtune=native")
+        && (ctx.config.compiler_type() == CompilerType::gcc
+            || ctx.config.compiler_type() == CompilerType::clang)) {
+      const auto resolved =
+        resolve_native_target_option(ctx, args[0], std::string(arg));
+      if (resolved) {
+        LOG("Hashing {} as {}", arg, *resolved);
+        hash.hash_delimiter("native arg");
+        hash.hash(arg);
+        hash.hash(*resolved);
+        continue;
+      }
+    }
+
     // All other arguments are included in the hash.
     hash.hash_delimiter("arg");
-    hash.hash(args[i]);
-    if (i + 1 < args.size() && compopt_takes_arg(args[i])) {
+    hash.hash(arg);
+    if (i + 1 < args.size() && compopt_takes_arg(arg)) {
       i++;
       hash.hash_delimiter("arg");
       hash.hash(args[i]);
     }
   }
 
+  if (ignore_warning_options) {
+    hash.hash_delimiter("warning options ignored");
+    ctx.warning_options_digest = warning_options_hash.digest();
+  }
+
   // Make results with dependency file /dev/null different from those without
   // it.
   if (ctx.args_info.generating_dependencies
@@ -1678,6 +3715,11 @@ calculate_result_name(Context& ctx,
     hash.hash_delimiter("inputfile");
     hash.hash(ctx.args_info.input_file);
 
+    if (!ctx.system_include_roots.empty()
+        && !hash_system_include_roots(ctx, hash)) {
+      ctx.system_include_roots.clear();
+    }
+
     hash.hash_delimiter("sourcecode");
     int result = hash_source_code_file(ctx, hash, ctx.args_info.input_file);
     if (result & HASH_SOURCE_CODE_ERROR) {
@@ -1692,40 +3734,60 @@ calculate_result_name(Context& ctx,
     const auto manifest_name = hash.digest();
     ctx.set_manifest_name(manifest_name);
 
-    const auto manifest_file = look_up_cache_file(
-      ctx.config.cache_dir(), manifest_name, Manifest::k_file_suffix);
-    ctx.set_manifest_path(manifest_file.path);
+    Statistics::PhaseTimer manifest_lookup_timer(ctx, Phase::manifest_lookup);
+    Tracing::Span manifest_lookup_span("manifest_lookup");
+    start_lookup_deadline(ctx);
+    const auto manifest_path = ctx.storage.get(
+      manifest_name, Manifest::k_file_suffix, ctx.manifest_counter_updates);
 
-    if (manifest_file.stat) {
-      LOG("Looking for result name in {}", manifest_file.path);
+    if (manifest_path) {
+      ctx.set_manifest_path(*manifest_path);
+      LOG("Looking for result name in {}", *manifest_path);
       MTR_BEGIN("manifest", "manifest_get");
-      result_name = Manifest::get(ctx, manifest_file.path);
+      bool needs_touch = false;
+      std::vector<std::string> included_files;
+      result_name =
+        Manifest::get(ctx, *manifest_path, &needs_touch, &included_files);
       MTR_END("manifest", "manifest_get");
+      manifest_lookup_timer.stop();
+      manifest_lookup_span.end();
       if (result_name) {
         LOG_RAW("Got result name from manifest");
+        ctx.manifest_included_files = std::move(included_files);
+        if (needs_touch && !ctx.config.read_only()
+            && !ctx.config.read_only_direct()
+            && ctx.storage.is_primary_path(*manifest_path)) {
+          // Keep the entry in front of older ones. The secondary storage copy
+          // is left as is since only the order of entries changes.
+          ctx.storage.put(
+            manifest_name,
+            Manifest::k_file_suffix,
+            ctx.manifest_counter_updates,
+            [&](const std::string& path) {
+              return Manifest::touch(ctx.config,
+                                     path,
+                                     *result_name,
+                                     time(nullptr),
+                                     ctx.storage.lookup_time_left());
+            },
+            false);
+        }
       } else {
         LOG_RAW("Did not find result name in manifest");
+        check_lookup_deadline(ctx);
       }
     } else {
       LOG("No manifest with name {} in the cache", manifest_name.to_string());
+      check_lookup_deadline(ctx);
     }
   } else {
     if (ctx.args_info.arch_args.empty()) {
-      result_name = get_result_name_from_cpp(ctx, preprocessor_args, hash);
+      result_name =
+        get_result_name_from_cpp(ctx, preprocessor_args, hash, cpp_output);
       LOG_RAW("Got result name from preprocessor");
     } else {
-      preprocessor_args.push_back("-arch");
-      for (size_t i = 0; i < ctx.args_info.arch_args.size(); ++i) {
-        preprocessor_args.push_back(ctx.args_info.arch_args[i]);
-        result_name = get_result_name_from_cpp(ctx, preprocessor_args, hash);
-        LOG("Got result name from preprocessor with -arch {}",
-            ctx.args_info.arch_args[i]);
-        if (i != ctx.args_info.arch_args.size() - 1) {
-          result_name = nullopt;
-        }
-        preprocessor_args.pop_back();
-      }
-      preprocessor_args.pop_back();
+      result_name =
+        get_result_name_from_multi_arch_cpp(ctx, preprocessor_args, hash);
     }
   }
 
@@ -1761,16 +3823,21 @@ from_cache(Context& ctx, FromCacheCallMode mode)
   }
 
   MTR_BEGIN("cache", "from_cache");
+  Statistics::PhaseTimer result_retrieval_timer(ctx, Phase::result_retrieval);
 
   // Get result from cache.
-  const auto result_file = look_up_cache_file(
-    ctx.config.cache_dir(), *ctx.result_name(), Result::k_file_suffix);
-  if (!result_file.stat) {
+  const auto result_path = ctx.storage.get(
+    *ctx.result_name(), Result::k_file_suffix, ctx.counter_updates);
+  if (!result_path) {
     LOG("No result with name {} in the cache", ctx.result_name()->to_string());
+    check_lookup_deadline(ctx);
     return nullopt;
   }
-  ctx.set_result_path(result_file.path);
-  Result::Reader result_reader(result_file.path);
+  ctx.set_result_path(*result_path);
+  check_lookup_deadline(ctx);
+  Result::Reader result_reader(*result_path,
+                               ctx.config.cache_dir(),
+                               ctx.config.trust_scrubbed_entries());
   ResultRetriever result_retriever(
     ctx, should_rewrite_dependency_target(ctx.args_info));
 
@@ -1781,10 +3848,50 @@ from_cache(Context& ctx, FromCacheCallMode mode)
     return nullopt;
   }
 
+  if (result_retriever.has_stale_diagnostics()
+      && !regenerate_diagnostics(ctx)) {
+    // Let the real compiler report the failure, without leaving the retrieved
+    // object file behind.
+    if (ctx.args_info.output_obj != "/dev/null") {
+      Util::unlink_safe(ctx.args_info.output_obj);
+    }
+    throw Failure(Statistic::compile_failed);
+  }
+
+  if (ctx.args_info.generating_dependencies
+      && ctx.args_info.output_dep != "/dev/null"
+      && !result_retriever.has_dependency_file()) {
+    optional<std::string> content;
+    if (mode == FromCacheCallMode::direct) {
+      if (ctx.manifest_included_files) {
+        content = regenerate_dependency_file(ctx, *ctx.manifest_included_files);
+      }
+    } else if (ctx.config.direct_mode()) {
+      // The include files found by the preprocessor are complete unless
+      // hashing one of them disabled the direct mode.
+      content = regenerate_dependency_file(ctx, included_file_paths(ctx));
+    }
+    if (!content) {
+      LOG_RAW("Cannot regenerate the dependency file missing from the result");
+      return nullopt;
+    }
+    try {
+      Util::write_file(ctx.args_info.output_dep, *content);
+    } catch (const Error& e) {
+      LOG("Failed to write {}: {}", ctx.args_info.output_dep, e.what());
+      return nullopt;
+    }
+    LOG("Regenerated dependency file {}", ctx.args_info.output_dep);
+  }
+
   // Update modification timestamp to save file from LRU cleanup.
-  Util::update_mtime(*ctx.result_path());
+  if (ctx.storage.is_primary_path(*ctx.result_path())) {
+    MtimeJournal::record_use(ctx.config, *ctx.result_path());
+  }
 
   LOG_RAW("Succeeded getting cached result");
+  ctx.counter_updates.increment(Statistic::time_saved_by_hits,
+                                ctx.cached_compiler_duration_ms);
 
   return mode == FromCacheCallMode::direct ? Statistic::direct_cache_hit
                                            : Statistic::preprocessed_cache_hit;
@@ -1865,10 +3972,23 @@ default_config_dir(const std::string& home_dir)
 static void
 set_up_config(Config& config)
 {
-  const std::string home_dir = Util::get_home_directory();
-  const std::string legacy_ccache_dir = home_dir + "/.ccache";
-  const bool legacy_ccache_dir_exists =
-    Stat::stat(legacy_ccache_dir).is_directory();
+  // The home directory is only needed when neither the environment nor the
+  // configuration says where the cache is, so look it up lazily.
+  optional<std::string> home_dir;
+  const auto get_home_dir = [&]() -> const std::string& {
+    if (!home_dir) {
+      home_dir = Util::get_home_directory();
+    }
+    return *home_dir;
+  };
+  optional<bool> legacy_dir_exists;
+  const auto legacy_ccache_dir = [&] { return get_home_dir() + "/.ccache"; };
+  const auto legacy_ccache_dir_exists = [&] {
+    if (!legacy_dir_exists) {
+      legacy_dir_exists = Stat::stat(legacy_ccache_dir()).is_directory();
+    }
+    return *legacy_dir_exists;
+  };
   const char* const env_xdg_cache_home = getenv("XDG_CACHE_HOME");
   const char* const env_xdg_config_home = getenv("XDG_CONFIG_HOME");
 
@@ -1893,12 +4013,12 @@ set_up_config(Config& config)
       primary_config_dir = env_ccache_dir;
     } else if (!config.cache_dir().empty() && !env_ccache_dir) {
       primary_config_dir = config.cache_dir();
-    } else if (legacy_ccache_dir_exists) {
-      primary_config_dir = legacy_ccache_dir;
+    } else if (legacy_ccache_dir_exists()) {
+      primary_config_dir = legacy_ccache_dir();
     } else if (env_xdg_config_home) {
       primary_config_dir = FMT("{}/ccache", env_xdg_config_home);
     } else {
-      primary_config_dir = default_config_dir(home_dir);
+      primary_config_dir = default_config_dir(get_home_dir());
     }
     config.set_primary_config_path(primary_config_dir + "/ccache.conf");
   }
@@ -1906,7 +4026,9 @@ set_up_config(Config& config)
   const std::string& cache_dir_before_primary_config = config.cache_dir();
 
   MTR_BEGIN("config", "conf_read_primary");
-  config.update_from_file(config.primary_config_path());
+  config.update_from_file_via_snapshot(
+    config.primary_config_path(),
+    FMT("{}.snapshot", config.primary_config_path()));
   MTR_END("config", "conf_read_primary");
 
   // Ignore cache_dir set in primary config.
@@ -1918,26 +4040,37 @@ set_up_config(Config& config)
   MTR_END("config", "conf_update_from_environment");
 
   if (config.cache_dir().empty()) {
-    if (legacy_ccache_dir_exists) {
-      config.set_cache_dir(legacy_ccache_dir);
+    if (legacy_ccache_dir_exists()) {
+      config.set_cache_dir(legacy_ccache_dir());
     } else if (env_xdg_cache_home) {
       config.set_cache_dir(FMT("{}/ccache", env_xdg_cache_home));
     } else {
-      config.set_cache_dir(default_cache_dir(home_dir));
+      config.set_cache_dir(default_cache_dir(get_home_dir()));
     }
   }
   // else: cache_dir was set explicitly via environment or via secondary config.
 
   // We have now determined config.cache_dir and populated the rest of config in
   // prio order (1. environment, 2. primary config, 3. secondary config).
+
+  ZstdDictionary::set_cache_dir(config.cache_dir());
+  Hash::set_default_algorithm(config.hash_algorithm() == "xxh3"
+                                ? Hash::Algorithm::xxh3
+                                : Hash::Algorithm::blake3);
 }
 
 static void
-set_up_context(Context& ctx, int argc, const char* const* argv)
+set_up_context(Context& ctx, const Args& args)
 {
-  ctx.orig_args = Args::from_argv(argc, argv);
-  ctx.ignore_header_paths = Util::split_into_strings(
-    ctx.config.ignore_headers_in_manifest(), PATH_DELIM);
+  ctx.orig_args = args;
+  for (const auto& path : Util::split_into_views(
+         ctx.config.ignore_headers_in_manifest(), PATH_DELIM)) {
+    ctx.ignore_header_paths.add(path);
+  }
+  for (const auto& item : Util::split_into_views(
+         ctx.config.system_include_roots(), PATH_DELIM)) {
+    ctx.system_include_roots.add(split_system_include_root(item).first);
+  }
   ctx.set_ignore_options(
     Util::split_into_strings(ctx.config.ignore_options(), " "));
 }
@@ -1947,7 +4080,7 @@ static void
 initialize(Context& ctx, int argc, const char* const* argv)
 {
   set_up_config(ctx.config);
-  set_up_context(ctx, argc, argv);
+  set_up_context(ctx, Args::from_argv(argc, argv));
   Logging::init(ctx.config);
 
   // Set default umask for all files created by ccache from now on (if
@@ -1970,6 +4103,14 @@ initialize(Context& ctx, int argc, const char* const* argv)
     LOG_RAW("Error: tracing is not enabled!");
 #endif
   }
+
+  if (!ctx.config.digest_map().empty()) {
+    ctx.digest_map = read_digest_map(ctx.config.digest_map(), ctx.actual_cwd);
+  }
+
+  if (ctx.config.git_index() && ctx.config.inode_cache()) {
+    ctx.git_index = std::make_unique<GitIndex>(ctx.actual_cwd);
+  }
 }
 
 // Make a copy of stderr that will not be cached, so things like distcc can
@@ -2003,30 +4144,38 @@ configuration_printer(const std::string& key,
   PRINT(stdout, "({}) {} = {}\n", origin, key, value);
 }
 
-static int cache_compilation(int argc, const char* const* argv);
+static int cache_compilation(int argc,
+                             const char* const* argv,
+                             const ArgsInfo& declared_files = ArgsInfo());
 static Statistic do_cache_compilation(Context& ctx, const char* const* argv);
 
-static uint8_t
-calculate_wanted_cache_level(uint64_t files_in_level_1)
+// Add `counter_updates` to `counters`. If `stats_update_timer` is given, also
+// stop it and add the phase durations, so that the stats update phase covers
+// waiting for the lock and reading the stats file.
+static void
+add_counter_updates(const Context& ctx,
+                    Counters& counters,
+                    const Counters& counter_updates,
+                    Statistics::PhaseTimer* stats_update_timer)
 {
-  uint64_t files_per_directory = files_in_level_1 / 16;
-  for (uint8_t i = k_min_cache_levels; i <= k_max_cache_levels; ++i) {
-    if (files_per_directory < k_max_cache_files_per_directory) {
-      return i;
-    }
-    files_per_directory /= 16;
+  counters.increment(counter_updates);
+  if (stats_update_timer) {
+    stats_update_timer->stop();
+    counters.increment(ctx.phase_durations);
   }
-  return k_max_cache_levels;
 }
 
 static optional<Counters>
-update_stats_and_maybe_move_cache_file(const Context& ctx,
-                                       const Digest& name,
-                                       const std::string& current_path,
-                                       const Counters& counter_updates,
-                                       const std::string& file_suffix)
+update_stats_and_maybe_move_cache_file(
+  const Context& ctx,
+  const Digest& name,
+  const std::string& current_path,
+  const Counters& counter_updates,
+  const std::string& file_suffix,
+  Statistics::PhaseTimer* stats_update_timer = nullptr,
+  const Counters& counter_decrements = Counters())
 {
-  if (counter_updates.all_zero()) {
+  if (counter_updates.all_zero() && counter_decrements.all_zero()) {
     return nullopt;
   }
 
@@ -2035,42 +4184,138 @@ update_stats_and_maybe_move_cache_file(const Context& ctx,
   // subdirectory for other counters to reduce lock contention.
   const bool use_stats_on_level_1 =
     counter_updates.get(Statistic::cache_size_kibibyte) != 0
-    || counter_updates.get(Statistic::files_in_cache) != 0;
+    || counter_updates.get(Statistic::files_in_cache) != 0
+    || !counter_decrements.all_zero();
   std::string level_string = FMT("{:x}", name.bytes()[0] >> 4);
+  if (!use_stats_on_level_1 && ctx.config.shared_stats()) {
+    SharedCounters shared_counters(
+      FMT("{}/{}", ctx.config.cache_dir(), level_string), true);
+    if (shared_counters) {
+      Counters updates;
+      add_counter_updates(ctx, updates, counter_updates, stats_update_timer);
+      shared_counters.increment(updates);
+      return nullopt;
+    }
+  }
   if (!use_stats_on_level_1) {
     level_string += FMT("/{:x}", name.bytes()[0] & 0xF);
   }
   const auto stats_file =
     FMT("{}/{}/stats", ctx.config.cache_dir(), level_string);
 
-  auto counters =
-    Statistics::update(stats_file, [&counter_updates](Counters& cs) {
-      cs.increment(counter_updates);
-    });
-  if (!counters) {
+  auto counters =
+    Statistics::update(ctx.config.cache_dir(), stats_file, [&](Counters& cs) {
+      add_counter_updates(ctx, cs, counter_updates, stats_update_timer);
+      for (const auto statistic :
+           {Statistic::cache_size_kibibyte, Statistic::files_in_cache}) {
+        cs.increment(statistic,
+                     -static_cast<int64_t>(counter_decrements.get(statistic)));
+      }
+    });
+  if (!counters) {
+    return nullopt;
+  }
+
+  if (use_stats_on_level_1) {
+    // Only consider moving cache files to another level when we have read the
+    // level 1 stats file since it's only then we know the proper
+    // files_in_cache value.
+    const auto wanted_level =
+      Storage::wanted_cache_level(counters->get(Statistic::files_in_cache));
+    const auto subdir = FMT("{}/{}", ctx.config.cache_dir(), level_string);
+    const auto recorded_level = Storage::read_cache_level(subdir);
+    bool rebalance;
+    if (recorded_level) {
+      // Only move to deeper levels automatically so that a file count going up
+      // and down around a limit doesn't move all files back and forth.
+      rebalance = wanted_level > *recorded_level;
+    } else {
+      const auto wanted_path = Util::get_path_in_cache(
+        ctx.config.cache_dir(), wanted_level, name.to_string() + file_suffix);
+      rebalance = current_path != wanted_path;
+    }
+    if (rebalance) {
+      // Move all files in the subdirectory in one go instead of one file per
+      // compilation, so that lookups only need to probe one level.
+      rebalance_dir(subdir, wanted_level, [](double) {});
+    }
+  }
+  return counters;
+}
+
+// Return the top-level directory below base_dir of the source file, or the
+// source file's directory if it's not below base_dir.
+static std::string
+source_top_level_dir(const Context& ctx)
+{
+  std::string path = ctx.args_info.input_file;
+  if (!Util::is_absolute_path(path)) {
+    path = FMT("{}/{}", ctx.apparent_cwd, path);
+  }
+  path = Util::normalize_absolute_path(path);
+
+  const auto& base_dir = ctx.config.base_dir();
+  if (!base_dir.empty() && Util::starts_with(path, base_dir + "/")) {
+    const auto relative = string_view(path).substr(base_dir.length() + 1);
+    const size_t slash = relative.find('/');
+    if (slash != string_view::npos) {
+      return FMT("{}/{}", base_dir, relative.substr(0, slash));
+    }
+    return base_dir;
+  }
+  return std::string(Util::dir_name(path));
+}
+
+// Add the result of the compilation to each dimension of stats_breakdown.
+static void
+update_stats_breakdown(const Context& ctx)
+{
+  Counters updates = ctx.counter_updates;
+  updates.increment(ctx.phase_durations);
+
+  for (const auto& dimension :
+       Util::split_into_strings(ctx.config.stats_breakdown(), ", ")) {
+    std::string key;
+    if (dimension == "compiler") {
+      key = ctx.orig_args.empty() ? "" : ctx.orig_args[0];
+    } else if (dimension == "directory") {
+      key =
+        ctx.args_info.input_file.empty() ? "" : source_top_level_dir(ctx);
+    } else if (dimension == "namespace") {
+      key = ctx.config.namespace_();
+    }
+    Statistics::update_breakdown(
+      ctx.config, dimension, key.empty() ? "(none)" : key, updates);
+  }
+}
+
+// Add the cache size bookkeeping in `counter_updates` for the cache file
+// `name` to the statistics of the namespace with tag `tag`. Returns the
+// updated counters of the namespace in the level 1 subdirectory of `name`.
+static optional<Counters>
+update_namespace_stats(const Context& ctx,
+                       const std::string& tag,
+                       const Digest& name,
+                       const Counters& counter_updates)
+{
+  if (counter_updates.get(Statistic::cache_size_kibibyte) == 0
+      && counter_updates.get(Statistic::files_in_cache) == 0) {
     return nullopt;
   }
-
-  if (use_stats_on_level_1) {
-    // Only consider moving the cache file to another level when we have read
-    // the level 1 stats file since it's only then we know the proper
-    // files_in_cache value.
-    const auto wanted_level =
-      calculate_wanted_cache_level(counters->get(Statistic::files_in_cache));
-    const auto wanted_path = Util::get_path_in_cache(
-      ctx.config.cache_dir(), wanted_level, name.to_string() + file_suffix);
-    if (current_path != wanted_path) {
-      Util::ensure_dir_exists(Util::dir_name(wanted_path));
-      LOG("Moving {} to {}", current_path, wanted_path);
-      try {
-        Util::rename(current_path, wanted_path);
-      } catch (const Error&) {
-        // Two ccache processes may move the file at the same time, so failure
-        // to rename is OK.
-      }
-    }
+  const auto path = Statistics::namespace_stats_file(
+    ctx.config.cache_dir(), tag, FMT("{:x}", name.bytes()[0] >> 4));
+  if (!Util::create_dir(Util::dir_name(path))) {
+    LOG("Failed to create {}: {}", Util::dir_name(path), strerror(errno));
+    return nullopt;
   }
-  return counters;
+  return Statistics::update(path, [&](Counters& cs) {
+    Counters updates;
+    updates.set(Statistic::cache_size_kibibyte,
+                counter_updates.get(Statistic::cache_size_kibibyte));
+    updates.set(Statistic::files_in_cache,
+                counter_updates.get(Statistic::files_in_cache));
+    cs.increment(updates);
+  });
 }
 
 static void
@@ -2095,6 +4340,17 @@ finalize_stats_and_trigger_cleanup(Context& ctx)
     return;
   }
 
+  if (!config.stats_breakdown().empty()) {
+    update_stats_breakdown(ctx);
+  }
+  if (!config.session().empty()) {
+    Counters updates = ctx.counter_updates;
+    updates.increment(ctx.phase_durations);
+    Statistics::update_session(config, updates);
+  }
+
+  Statistics::PhaseTimer stats_update_timer(ctx, Phase::stats_update);
+
   if (!ctx.result_path()) {
     ASSERT(ctx.counter_updates.get(Statistic::cache_size_kibibyte) == 0);
     ASSERT(ctx.counter_updates.get(Statistic::files_in_cache) == 0);
@@ -2102,18 +4358,41 @@ finalize_stats_and_trigger_cleanup(Context& ctx)
     // Context::set_result_path hasn't been called yet, so we just choose one of
     // the stats files in the 256 level 2 directories.
     const auto bucket = getpid() % 256;
+    if (config.shared_stats()) {
+      SharedCounters shared_counters(
+        FMT("{}/{:x}", config.cache_dir(), bucket / 16), true);
+      if (shared_counters) {
+        Counters updates;
+        add_counter_updates(
+          ctx, updates, ctx.counter_updates, &stats_update_timer);
+        shared_counters.increment(updates);
+        return;
+      }
+    }
     const auto stats_file =
       FMT("{}/{:x}/{:x}/stats", config.cache_dir(), bucket / 16, bucket % 16);
-    Statistics::update(
-      stats_file, [&ctx](Counters& cs) { cs.increment(ctx.counter_updates); });
+    Statistics::update(config.cache_dir(), stats_file, [&](Counters& cs) {
+      add_counter_updates(ctx, cs, ctx.counter_updates, &stats_update_timer);
+    });
     return;
   }
 
+  // If the manifest and the result are in the same level 1 subdirectory, update
+  // its stats file once for both.
+  Counters counter_updates = ctx.counter_updates;
+  Counters manifest_counter_updates = ctx.manifest_counter_updates;
+  if (ctx.manifest_path()
+      && (ctx.manifest_name()->bytes()[0] >> 4)
+           == (ctx.result_name()->bytes()[0] >> 4)) {
+    counter_updates.increment(manifest_counter_updates);
+    manifest_counter_updates = Counters();
+  }
+
   if (ctx.manifest_path()) {
     update_stats_and_maybe_move_cache_file(ctx,
                                            *ctx.manifest_name(),
                                            *ctx.manifest_path(),
-                                           ctx.manifest_counter_updates,
+                                           manifest_counter_updates,
                                            Manifest::k_file_suffix);
   }
 
@@ -2121,8 +4400,22 @@ finalize_stats_and_trigger_cleanup(Context& ctx)
     update_stats_and_maybe_move_cache_file(ctx,
                                            *ctx.result_name(),
                                            *ctx.result_path(),
-                                           ctx.counter_updates,
-                                           Result::k_file_suffix);
+                                           counter_updates,
+                                           Result::k_file_suffix,
+                                           &stats_update_timer,
+                                           ctx.counter_decrements);
+
+  const auto namespace_tag = Statistics::namespace_tag(config.namespace_());
+  optional<Counters> namespace_counters;
+  if (!namespace_tag.empty()) {
+    if (ctx.manifest_path()) {
+      update_namespace_stats(
+        ctx, namespace_tag, *ctx.manifest_name(), manifest_counter_updates);
+    }
+    namespace_counters = update_namespace_stats(
+      ctx, namespace_tag, *ctx.result_name(), counter_updates);
+  }
+
   if (!counters) {
     return;
   }
@@ -2148,14 +4441,65 @@ finalize_stats_and_trigger_cleanup(Context& ctx)
         config.max_size() / 1024 / 16);
     need_cleanup = true;
   }
+  if (namespace_counters && config.namespace_max_size() != 0
+      && namespace_counters->get(Statistic::cache_size_kibibyte)
+           > config.namespace_max_size() / 1024 / 16) {
+    LOG("Need to clean up {} since namespace {} holds {} KiB (limit: {} KiB)",
+        subdir,
+        config.namespace_(),
+        namespace_counters->get(Statistic::cache_size_kibibyte),
+        config.namespace_max_size() / 1024 / 16);
+    need_cleanup = true;
+  }
 
   if (need_cleanup) {
+    MtimeJournal::flush(config);
     const double factor = config.limit_multiple() / 16;
     const uint64_t max_size = round(config.max_size() * factor);
     const uint32_t max_files = round(config.max_files() * factor);
     const time_t max_age = 0;
-    clean_up_dir(
-      subdir, max_size, max_files, max_age, [](double /*progress*/) {});
+    const bool cost_aware = config.cleanup_policy() == "gdsf";
+    const uint64_t namespace_max_size =
+      round(config.namespace_max_size() * factor);
+    if (config.background_cleanup()
+        && clean_up_dir_in_background(subdir,
+                                      max_size,
+                                      max_files,
+                                      config.cleanup_sample_size(),
+                                      cost_aware,
+                                      namespace_tag,
+                                      namespace_max_size,
+                                      config.pack_max_file_size())) {
+      return;
+    }
+    // Another host sharing the cache directory may already be cleaning up.
+    CleanupLease lease(subdir);
+    if (!lease.acquired()) {
+      return;
+    }
+    // The other phase durations have already been written.
+    ctx.phase_durations = Counters();
+    Statistics::PhaseTimer cleanup_timer(ctx, Phase::cleanup);
+    Tracing::Span cleanup_span("cleanup", subdir);
+    clean_up_dir(subdir,
+                 max_size,
+                 max_files,
+                 max_age,
+                 [](double /*progress*/) {},
+                 true,
+                 config.cleanup_sample_size(),
+                 cost_aware,
+                 namespace_tag,
+                 namespace_max_size);
+    pack_dir(subdir, config.pack_max_file_size());
+    cleanup_timer.stop();
+    cleanup_span.end();
+    if (config.phase_durations()) {
+      Statistics::update(
+        config.cache_dir(), FMT("{}/stats", subdir), [&ctx](Counters& cs) {
+          cs.increment(ctx.phase_durations);
+        });
+    }
   }
 }
 
@@ -2163,22 +4507,33 @@ static void
 finalize_at_exit(Context& ctx)
 {
   try {
+    ctx.storage.flush();
     finalize_stats_and_trigger_cleanup(ctx);
+    EventLog::write(ctx);
   } catch (const ErrorBase& e) {
     // finalize_at_exit must not throw since it's called by a destructor.
     LOG("Error while finalizing stats: {}", e.what());
   }
 
+  Tracing::flush(ctx.args_info.output_obj.empty() ? ctx.args_info.input_file
+                                                   : ctx.args_info.output_obj);
+
   // Dump log buffer last to not lose any logs.
   if (ctx.config.debug() && !ctx.args_info.output_obj.empty()) {
     const auto path = FMT("{}.ccache-log", ctx.args_info.output_obj);
     Logging::dump_log(path);
   }
+
+  Logging::flush();
 }
 
 // The entry point when invoked to cache a compilation.
+// Run the compilation in `argv` with the help of the cache. `declared_files`
+// holds the input and output files of a command given to --run.
 static int
-cache_compilation(int argc, const char* const* argv)
+cache_compilation(int argc,
+                  const char* const* argv,
+                  const ArgsInfo& declared_files)
 {
   tzset(); // Needed for localtime_r.
 
@@ -2191,15 +4546,29 @@ cache_compilation(int argc, const char* const* argv)
     SignalHandler signal_handler(ctx);
     Finalizer finalizer([&ctx] { finalize_at_exit(ctx); });
 
+    Statistics::PhaseTimer config_setup_timer(ctx, Phase::config_setup);
     initialize(ctx, argc, argv);
+    ctx.args_info.command_inputs = declared_files.command_inputs;
+    ctx.args_info.command_outputs = declared_files.command_outputs;
+    Tracing::init(ctx.config);
+    config_setup_timer.stop();
 
     MTR_BEGIN("main", "find_compiler");
+    Statistics::PhaseTimer find_compiler_timer(ctx, Phase::find_compiler);
+    Tracing::Span find_compiler_span("find_compiler");
     find_compiler(ctx, &find_executable);
+    find_compiler_timer.stop();
+    find_compiler_span.end();
     MTR_END("main", "find_compiler");
 
     try {
       Statistic statistic = do_cache_compilation(ctx, argv);
-      ctx.counter_updates.increment(statistic);
+      if (statistic != Statistic::none) {
+        ctx.counter_updates.increment(statistic);
+      }
+      if (ctx.cached_exit_status) {
+        return *ctx.cached_exit_status;
+      }
     } catch (const Failure& e) {
       if (e.statistic() != Statistic::none) {
         ctx.counter_updates.increment(e.statistic());
@@ -2215,28 +4584,738 @@ cache_compilation(int argc, const char* const* argv)
 
       ASSERT(!ctx.orig_args.empty());
 
-      ctx.orig_args.erase_with_prefix("--ccache-");
-      add_prefix(ctx, ctx.orig_args, ctx.config.prefix_command());
+      ctx.orig_args.erase_with_prefix("--ccache-");
+      add_prefix(ctx, ctx.orig_args, ctx.config.prefix_command());
+
+      LOG_RAW("Failed; falling back to running the real compiler");
+
+      saved_orig_args = std::move(ctx.orig_args);
+      auto execv_argv = saved_orig_args.to_argv();
+      LOG("Executing {}", Util::format_argv_for_logging(execv_argv.data()));
+      // Run execv below after ctx and finalizer have been destructed.
+    }
+  }
+
+  if (fall_back_to_original_compiler) {
+    if (original_umask) {
+      umask(*original_umask);
+    }
+    auto execv_argv = saved_orig_args.to_argv();
+    execv(execv_argv[0], const_cast<char* const*>(execv_argv.data()));
+    throw Fatal("execv of {} failed: {}", execv_argv[0], strerror(errno));
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Return the path of the ccache executable that was run as `argv0`, or the
+// empty string if it can't be found.
+static std::string
+find_ccache_executable(const Context& ctx, const std::string& argv0)
+{
+  const std::string path = argv0.find('/') != std::string::npos
+                             ? argv0
+                             : find_executable(ctx, argv0, "");
+  // When masquerading, `argv0` is a symlink to ccache.
+  return path.empty() ? path : Util::real_path(path);
+}
+
+// Merge the dependency files of the architecture slices of a compilation into
+// one with `target` (or the target of the first slice if empty) depending on
+// the union of the slices' prerequisites.
+static std::string
+merge_slice_dependency_files(const std::vector<std::string>& paths,
+                             const std::string& target)
+{
+  std::vector<std::string> targets;
+  std::vector<std::string> prerequisites;
+  std::unordered_set<std::string> seen;
+  bool phony_targets = false;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    // Only the first rule of a slice is of interest; -MP adds more.
+    bool in_targets = true;
+    bool first_rule = true;
+    for (const auto& token : Depfile::tokenize(Util::read_file(paths[i]))) {
+      const bool is_target = Util::ends_with(token, ":");
+      if (!first_rule) {
+        phony_targets = true;
+        break;
+      } else if (in_targets) {
+        if (i == 0) {
+          targets.push_back(is_target ? token.substr(0, token.size() - 1)
+                                      : token);
+        }
+        in_targets = !is_target;
+      } else if (is_target) {
+        first_rule = false;
+        phony_targets = true;
+        break;
+      } else if (seen.insert(token).second) {
+        prerequisites.push_back(token);
+      }
+    }
+  }
+
+  std::string result;
+  if (!target.empty()) {
+    result += Depfile::escape_filename(target);
+  } else {
+    for (size_t i = 0; i < targets.size(); ++i) {
+      result += FMT(
+        "{}{}", i == 0 ? "" : " ", Depfile::escape_filename(targets[i]));
+    }
+  }
+  result += ":";
+  for (const auto& prerequisite : prerequisites) {
+    result += FMT(" \\\n {}", Depfile::escape_filename(prerequisite));
+  }
+  result += "\n";
+  if (phony_targets) {
+    // The first prerequisite is the source file, which -MP leaves out.
+    for (size_t i = 1; i < prerequisites.size(); ++i) {
+      result += FMT("\n{}:\n", Depfile::escape_filename(prerequisites[i]));
+    }
+  }
+  return result;
+}
+
+// Compile each -arch slice of a multi-arch compilation with a separate ccache
+// invocation and combine the slices with lipo, so that single-arch and
+// multi-arch compilations share cache entries. Returns nullopt if the
+// compilation can't be split.
+static optional<Statistic>
+compile_arch_slices(Context& ctx, const char* const* argv)
+{
+  const auto& args_info = ctx.args_info;
+  if (args_info.generating_coverage || args_info.generating_stackusage
+      || args_info.generating_diagnostics || args_info.seen_split_dwarf
+      || !args_info.output_bmi.empty() || args_info.output_is_precompiled_header
+      || (args_info.generating_dependencies && !args_info.seen_MD_MMD)) {
+    LOG_RAW("Not splitting multi-arch compilation with extra outputs");
+    return nullopt;
+  }
+
+  const std::string lipo = find_executable(ctx, "lipo", CCACHE_NAME);
+  const std::string ccache = find_ccache_executable(ctx, argv[0]);
+  if (lipo.empty() || ccache.empty()) {
+    LOG_RAW("Not splitting multi-arch compilation: lipo or ccache not found");
+    return nullopt;
+  }
+
+  // Remove the -arch and -o options; the slices get their own.
+  Args common_args;
+  common_args.push_back(ccache);
+  size_t arch_count = 0;
+  // Without -MF, the slices write their dependency files next to their object
+  // files and the paths are not part of the hash.
+  bool dep_file_specified = false;
+  for (size_t i = 0; i < ctx.orig_args.size(); ++i) {
+    const auto& arg = ctx.orig_args[i];
+    dep_file_specified = dep_file_specified || Util::starts_with(arg, "-MF");
+    if ((arg == "-arch" || arg == "-o") && i + 1 < ctx.orig_args.size()) {
+      arch_count += arg == "-arch" ? 1 : 0;
+      ++i;
+    } else if (arg != FMT("-o{}", args_info.output_obj)) {
+      common_args.push_back(arg);
+    }
+  }
+  if (arch_count != args_info.arch_args.size()) {
+    // E.g. -arch options in an @file.
+    LOG_RAW("Not splitting multi-arch compilation: -arch options not found");
+    return nullopt;
+  }
+
+  const auto& arch_args = args_info.arch_args;
+  std::vector<std::string> slice_objs;
+  std::vector<std::string> slice_deps;
+  std::vector<Args> slice_commands;
+  for (const auto& arch : arch_args) {
+    // The slice paths are deterministic since the object file path is part of
+    // the hash when the dependency target is specified.
+    slice_objs.push_back(FMT("{}.ccache-{}{}",
+                             Util::remove_extension(args_info.output_obj),
+                             arch,
+                             Util::get_extension(args_info.output_obj)));
+    ctx.register_pending_tmp_file(slice_objs.back());
+    Args command = common_args;
+    command.push_back("-arch");
+    command.push_back(arch);
+    command.push_back("-o");
+    command.push_back(slice_objs.back());
+    if (args_info.generating_dependencies) {
+      slice_deps.push_back(Util::change_extension(slice_objs.back(), ".d"));
+      ctx.register_pending_tmp_file(slice_deps.back());
+      if (dep_file_specified) {
+        command.push_back("-MF");
+        command.push_back(slice_deps.back());
+      }
+    }
+    slice_commands.push_back(std::move(command));
+  }
+
+  LOG("Compiling {} arch slices separately", arch_args.size());
+  std::vector<int> statuses(arch_args.size(), 0);
+  UmaskScope umask_scope(ctx.original_umask);
+  const auto compile_slice = [&](size_t i) {
+    // The slices write their diagnostics to our stdout and stderr.
+    pid_t pid = 0;
+    statuses[i] = execute(slice_commands[i].to_argv().data(),
+                          Fd(dup(STDOUT_FILENO)),
+                          Fd(dup(STDERR_FILENO)),
+                          &pid);
+    return true;
+  };
+  Jobserver::Tokens tokens(arch_args.size() - 1);
+  ThreadPool(tokens.count()).for_each_index(arch_args.size(), compile_slice);
+  for (const int status : statuses) {
+    if (status != 0) {
+      // The compiler has already reported the error.
+      throw Failure(Statistic::none, status);
+    }
+  }
+
+  Args lipo_args;
+  lipo_args.push_back(lipo);
+  lipo_args.push_back("-create");
+  for (const auto& slice_obj : slice_objs) {
+    lipo_args.push_back(slice_obj);
+  }
+  lipo_args.push_back("-output");
+  lipo_args.push_back(args_info.output_obj);
+  pid_t pid = 0;
+  if (execute(lipo_args.to_argv().data(),
+              Fd(dup(STDOUT_FILENO)),
+              Fd(dup(STDERR_FILENO)),
+              &pid)
+      != 0) {
+    LOG_RAW("lipo failed");
+    throw Failure(Statistic::internal_error);
+  }
+
+  if (args_info.generating_dependencies) {
+    Util::write_file(
+      args_info.output_dep,
+      merge_slice_dependency_files(
+        slice_deps,
+        args_info.dependency_target_specified ? "" : args_info.output_obj));
+  }
+
+  // The slices have updated the statistics.
+  return Statistic::none;
+}
+
+// Compile each source file of an invocation with several source files, like
+// "cc -c a.c b.c", by a separate ccache invocation so that the object files are
+// cached independently. The output of the invocations is written in source file
+// order and the exit status is that of the first failing invocation, if any.
+// Returns nullopt if the invocation can't be split.
+static optional<Statistic>
+compile_source_files(Context& ctx, const char* const* argv)
+{
+  const std::string ccache = find_ccache_executable(ctx, argv[0]);
+  if (ccache.empty()) {
+    LOG_RAW("Not splitting compilation: ccache not found");
+    return nullopt;
+  }
+
+  Args common_args;
+  common_args.push_back(ccache);
+  common_args.push_back(ctx.orig_args[0]);
+  std::vector<std::string> source_files;
+  bool found_c_or_S = false;
+  for (size_t i = 1; i < ctx.orig_args.size(); ++i) {
+    const auto& arg = ctx.orig_args[i];
+    if (arg == "--ccache-skip" && i + 1 < ctx.orig_args.size()) {
+      common_args.push_back(arg);
+      common_args.push_back(ctx.orig_args[++i]);
+      continue;
+    }
+    // Options whose meaning depends on the position or that name a single
+    // output would not mean the same thing for each source file.
+    if (Util::starts_with(arg, "@") || Util::starts_with(arg, "-o")
+        || Util::starts_with(arg, "-x") || Util::starts_with(arg, "-MF")
+        || Util::starts_with(arg, "-MT") || Util::starts_with(arg, "-MQ")
+        || arg == "-E" || arg == "-arch") {
+      LOG("Not splitting compilation with {}", arg);
+      return nullopt;
+    }
+    if (arg == "-c" || arg == "-S") {
+      found_c_or_S = true;
+    }
+    if (Util::starts_with(arg, "-")) {
+      common_args.push_back(arg);
+      if (compopt_takes_arg(arg) && i + 1 < ctx.orig_args.size()) {
+        common_args.push_back(ctx.orig_args[++i]);
+      }
+    } else if (!language_for_file(arg).empty()
+               && Stat::stat(arg).is_regular()) {
+      source_files.push_back(arg);
+    } else {
+      common_args.push_back(arg);
+    }
+  }
+  if (!found_c_or_S || source_files.size() < 2) {
+    LOG_RAW("Not splitting compilation: no -c or -S and source files found");
+    return nullopt;
+  }
+
+  const size_t count = source_files.size();
+  std::vector<Args> commands;
+  std::vector<std::string> stdout_paths;
+  std::vector<std::string> stderr_paths;
+  std::vector<Fd> stdout_fds;
+  std::vector<Fd> stderr_fds;
+  for (const auto& source_file : source_files) {
+    Args command = common_args;
+    command.push_back(source_file);
+    commands.push_back(std::move(command));
+
+    TemporaryFile tmp_stdout = ctx.create_transient_file(
+      FMT("{}/tmp.split_stdout", ctx.config.temporary_dir()));
+    TemporaryFile tmp_stderr = ctx.create_transient_file(
+      FMT("{}/tmp.split_stderr", ctx.config.temporary_dir()));
+    stdout_paths.push_back(tmp_stdout.path);
+    stderr_paths.push_back(tmp_stderr.path);
+    stdout_fds.push_back(std::move(tmp_stdout.fd));
+    stderr_fds.push_back(std::move(tmp_stderr.fd));
+  }
+
+  const size_t jobs =
+    ctx.config.split_source_jobs() != 0
+      ? ctx.config.split_source_jobs()
+      : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  LOG("Compiling {} source files separately with up to {} jobs", count, jobs);
+  std::vector<int> statuses(count, 0);
+  UmaskScope umask_scope(ctx.original_umask);
+  const auto compile_source_file = [&](size_t i) {
+    pid_t pid = 0;
+    statuses[i] = execute(commands[i].to_argv().data(),
+                          std::move(stdout_fds[i]),
+                          std::move(stderr_fds[i]),
+                          &pid);
+    return true;
+  };
+  Jobserver::Tokens tokens(std::min(jobs, count) - 1);
+  ThreadPool(tokens.count()).for_each_index(count, compile_source_file);
+
+  int exit_status = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const auto stdout_data = Util::read_file(stdout_paths[i]);
+    const auto stderr_data = Util::read_file(stderr_paths[i]);
+    Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+    Util::write_fd(STDERR_FILENO, stderr_data.data(), stderr_data.size());
+    if (exit_status == 0) {
+      exit_status = statuses[i];
+    }
+  }
+  if (exit_status != 0) {
+    throw Failure(Statistic::none, exit_status);
+  }
+
+  // The invocations have updated the statistics.
+  return Statistic::none;
+}
+
+// Hash the content of `path` if it names a regular file. Returns false if the
+// file can't be hashed.
+static bool
+hash_link_input(const Context& ctx, Hash& hash, const std::string& path)
+{
+  if (path.empty() || !Stat::stat(path).is_regular()) {
+    return true;
+  }
+  hash.hash_delimiter("file");
+  hash.hash(path);
+  return hash_binary_file(ctx, hash, path);
+}
+
+// Cache the output of a link step, like "cc -o prog a.o b.o -lm", keyed by the
+// linker command line and the content of the files it references. Libraries
+// given with -l are hashed if found in a -L directory; other libraries (i.e.
+// the system libraries) are assumed to change only when the compiler does.
+static Statistic
+cache_link(Context& ctx)
+{
+  Hash hash;
+  hash.hash(HASH_PREFIX);
+  hash.hash_delimiter("link");
+
+  const std::string& compiler = ctx.orig_args[0];
+  const auto compiler_st = Stat::stat(compiler, Stat::OnError::log);
+  if (!compiler_st) {
+    throw Failure(Statistic::could_not_find_compiler);
+  }
+  hash_compiler(ctx, hash, compiler_st, compiler, true);
+  hash.hash_delimiter("cc_name");
+  hash.hash(Util::base_name(compiler));
+
+  const char* env_vars[] = {
+    "COMPILER_PATH",
+    "GCC_EXEC_PREFIX",
+    "LIBRARY_PATH",
+    "SOURCE_DATE_EPOCH",
+  };
+  for (const char* name : env_vars) {
+    const char* value = getenv(name);
+    if (value) {
+      hash.hash_delimiter(name);
+      hash.hash(value);
+    }
+  }
+
+  std::string output = "a.out";
+  bool relocatable = false;
+  std::vector<std::string> library_dirs;
+  std::vector<std::string> libraries;
+  for (size_t i = 1; i < ctx.orig_args.size(); ++i) {
+    const auto& arg = ctx.orig_args[i];
+    if (Util::starts_with(arg, "@")) {
+      LOG("Not caching link with {}", arg);
+      throw Failure(Statistic::called_for_link);
+    }
+    if (arg == "-o" && i + 1 < ctx.orig_args.size()) {
+      output = ctx.orig_args[++i];
+      continue;
+    }
+    if (Util::starts_with(arg, "-o")) {
+      output = arg.substr(2);
+      continue;
+    }
+
+    hash.hash_delimiter("arg");
+    hash.hash(arg);
+    bool hashed = true;
+    if (arg == "-r") {
+      relocatable = true;
+    } else if ((arg == "-L" || arg == "-l") && i + 1 < ctx.orig_args.size()) {
+      ++i;
+      hash.hash(ctx.orig_args[i]);
+      (arg == "-L" ? library_dirs : libraries).push_back(ctx.orig_args[i]);
+      continue;
+    } else if (Util::starts_with(arg, "-L")) {
+      library_dirs.push_back(arg.substr(2));
+    } else if (Util::starts_with(arg, "-l")) {
+      libraries.push_back(arg.substr(2));
+    } else if (Util::starts_with(arg, "-Wl,")) {
+      for (const auto& part : Util::split_into_strings(arg.substr(4), ",")) {
+        hashed = hashed && hash_link_input(ctx, hash, part);
+      }
+    } else if (Util::starts_with(arg, "-")) {
+      const auto eq_pos = arg.find('=');
+      if (eq_pos != std::string::npos) {
+        hashed = hash_link_input(ctx, hash, arg.substr(eq_pos + 1));
+      }
+    } else if (!Stat::stat(arg).is_regular()) {
+      LOG("Not caching link with missing input {}", arg);
+      throw Failure(Statistic::called_for_link);
+    } else {
+      hashed = hash_link_input(ctx, hash, arg);
+    }
+    if (Util::starts_with(arg, "-") && compopt_takes_arg(arg)
+        && i + 1 < ctx.orig_args.size()) {
+      ++i;
+      hash.hash_delimiter("arg");
+      hash.hash(ctx.orig_args[i]);
+      hashed = hashed && hash_link_input(ctx, hash, ctx.orig_args[i]);
+    }
+    if (!hashed) {
+      throw Failure(Statistic::called_for_link);
+    }
+  }
+
+  for (const auto& library : libraries) {
+    for (const auto& dir : library_dirs) {
+      for (const char* suffix : {".so", ".a"}) {
+        const auto path = FMT("{}/lib{}{}", dir, library, suffix);
+        if (!hash_link_input(ctx, hash, path)) {
+          throw Failure(Statistic::called_for_link);
+        }
+      }
+    }
+  }
+
+  ctx.set_result_name(hash.digest());
+  ctx.args_info.output_obj = output;
+  LOG("Link output: {}", output);
+
+  if (from_cache(ctx, FromCacheCallMode::direct)) {
+    if (!relocatable) {
+      UmaskScope umask_scope(ctx.original_umask);
+      const mode_t mask = umask(0);
+      umask(mask);
+      chmod(output.c_str(), 0777 & ~mask);
+    }
+    return Statistic::link_cache_hit;
+  }
+
+  if (ctx.config.read_only()) {
+    LOG_RAW("Read-only mode; running linker without caching the result");
+    throw Failure(Statistic::called_for_link);
+  }
+
+  TemporaryFile tmp_stdout = ctx.create_transient_file(
+    FMT("{}/tmp.link_stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr = ctx.create_transient_file(
+    FMT("{}/tmp.link_stderr", ctx.config.temporary_dir()));
+  const std::string stdout_path = tmp_stdout.path;
+  const std::string stderr_path = tmp_stderr.path;
+
+  Args args = ctx.orig_args;
+  add_prefix(ctx, args, ctx.config.prefix_command());
+  LOG_RAW("Running real linker");
+  const auto linker_start = std::chrono::steady_clock::now();
+  const int status =
+    do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+  ctx.compiler_duration_ms =
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - linker_start)
+      .count();
+  ctx.counter_updates.increment(Statistic::time_spent_on_misses,
+                                ctx.compiler_duration_ms);
+
+  const auto stdout_data = Util::read_file(stdout_path);
+  Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+  Util::send_to_stderr(ctx, Util::read_file(stderr_path));
+  if (status != 0) {
+    LOG("Linker gave exit status {}", status);
+    throw Failure(Statistic::called_for_link, status);
+  }
+
+  const auto st = Stat::stat(output, Stat::OnError::log);
+  if (!st) {
+    throw Failure(Statistic::compiler_produced_no_output);
+  }
+  if (ctx.config.max_link_size() != 0
+      && st.size() > ctx.config.max_link_size()) {
+    LOG("Not storing {} since it's larger than max_link_size", output);
+  } else {
+    put_result(ctx,
+               {{Result::FileType::object, output},
+                {Result::FileType::stderr_output, stderr_path}});
+  }
+  return Statistic::link_cache_miss;
+}
+
+// Cache the output files of a command run with --run, like a code generator,
+// keyed by the command line, the identity of the program (see compiler_check)
+// and the content of the declared input files.
+static Statistic
+cache_command(Context& ctx)
+{
+  const auto& inputs = ctx.args_info.command_inputs;
+  const auto& outputs = ctx.args_info.command_outputs;
+
+  Hash hash;
+  hash.hash(HASH_PREFIX);
+  hash.hash_delimiter("command");
+
+  const std::string& program = ctx.orig_args[0];
+  const auto program_st = Stat::stat(program, Stat::OnError::log);
+  if (!program_st) {
+    throw Failure(Statistic::could_not_find_compiler);
+  }
+  hash_compiler(ctx, hash, program_st, program, true);
+  hash.hash_delimiter("program_name");
+  hash.hash(Util::base_name(program));
+
+  for (size_t i = 1; i < ctx.orig_args.size(); ++i) {
+    hash.hash_delimiter("arg");
+    hash.hash(ctx.orig_args[i]);
+  }
+  for (const auto& input : inputs) {
+    hash.hash_delimiter("input");
+    hash.hash(input);
+    if (!hash_binary_file(ctx, hash, input)) {
+      LOG("Failed to hash input file {}", input);
+      throw Failure(Statistic::error_hashing_extra_file);
+    }
+  }
+  for (const auto& output : outputs) {
+    hash.hash_delimiter("output");
+    hash.hash(output);
+  }
+
+  ctx.set_result_name(hash.digest());
+
+  if (from_cache(ctx, FromCacheCallMode::direct)) {
+    return Statistic::command_cache_hit;
+  }
+
+  if (ctx.config.read_only()) {
+    LOG_RAW("Read-only mode; running command without caching the result");
+    throw Failure(Statistic::none);
+  }
+
+  TemporaryFile tmp_stdout = ctx.create_transient_file(
+    FMT("{}/tmp.command_stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr = ctx.create_transient_file(
+    FMT("{}/tmp.command_stderr", ctx.config.temporary_dir()));
+  const std::string stdout_path = tmp_stdout.path;
+  const std::string stderr_path = tmp_stderr.path;
+
+  Args args = ctx.orig_args;
+  add_prefix(ctx, args, ctx.config.prefix_command());
+  LOG_RAW("Running command");
+  const auto command_start = std::chrono::steady_clock::now();
+  const int status = do_execute(ctx,
+                                args,
+                                std::move(tmp_stdout),
+                                std::move(tmp_stderr),
+                                &ctx.invocation.compiler_usage);
+  ctx.compiler_duration_ms =
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - command_start)
+      .count();
+  ctx.counter_updates.increment(Statistic::time_spent_on_misses,
+                                ctx.compiler_duration_ms);
+
+  const auto stdout_data = Util::read_file(stdout_path);
+  Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+  Util::send_to_stderr(ctx, Util::read_file(stderr_path));
+  if (status != 0) {
+    LOG("Command gave exit status {}", status);
+    throw Failure(Statistic::compile_failed, status);
+  }
+
+  std::vector<std::pair<Result::FileType, std::string>> files;
+  for (const auto& output : outputs) {
+    if (!Stat::stat(output, Stat::OnError::log).is_regular()) {
+      LOG("Command didn't produce {}", output);
+      throw Failure(Statistic::compiler_produced_no_output);
+    }
+    files.emplace_back(Result::FileType::command_output, output);
+  }
+  if (!stdout_data.empty()) {
+    files.emplace_back(Result::FileType::stdout_output, stdout_path);
+  }
+  files.emplace_back(Result::FileType::stderr_output, stderr_path);
+  put_result(ctx, files);
+  return Statistic::command_cache_miss;
+}
+
+// Return whether `arg` asks the compiler for information about itself instead
+// of compiling, like "--version", "-dumpmachine" or "-print-search-dirs".
+static bool
+is_compiler_query_option(const std::string& arg)
+{
+  return arg == "--version" || arg == "-v" || arg == "-dumpversion"
+         || arg == "-dumpfullversion" || arg == "-dumpmachine"
+         || arg == "-dumpspecs" || Util::starts_with(arg, "-print-")
+         || Util::starts_with(arg, "--print-");
+}
+
+// Return whether the compiler command line `args` only queries the compiler,
+// i.e. has a query option and otherwise only options that don't name files in
+// separate arguments.
+static bool
+is_compiler_query(const Args& args)
+{
+  bool query = false;
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (is_compiler_query_option(args[i])) {
+      query = true;
+    } else if (args[i].size() < 2 || args[i][0] != '-') {
+      return false;
+    }
+  }
+  return query;
+}
+
+// Cache the output of a compiler query like "cc -m32 -print-multi-os-directory"
+// as issued many times by configure scripts, keyed by the compiler and the
+// command line. Only successful queries are cached.
+static Statistic
+cache_compiler_query(Context& ctx)
+{
+  Hash hash;
+  hash.hash(HASH_PREFIX);
+  hash.hash_delimiter("query");
+
+  const std::string& compiler = ctx.orig_args[0];
+  const auto compiler_st = Stat::stat(compiler, Stat::OnError::log);
+  if (!compiler_st) {
+    throw Failure(Statistic::could_not_find_compiler);
+  }
+  hash_compiler(ctx, hash, compiler_st, compiler, true);
+  // The output may contain the path of the compiler, e.g. with -v.
+  hash.hash_delimiter("cc_path");
+  hash.hash(compiler);
+
+  bool only_query_options = true;
+  for (size_t i = 1; i < ctx.orig_args.size(); ++i) {
+    hash.hash_delimiter("arg");
+    hash.hash(ctx.orig_args[i]);
+    only_query_options =
+      only_query_options && is_compiler_query_option(ctx.orig_args[i]);
+  }
+  if (!only_query_options) {
+    // Other options, e.g. -B or --sysroot, may contain relative paths.
+    hash.hash_delimiter("cwd");
+    hash.hash(ctx.apparent_cwd);
+  }
+
+  const char* env_vars[] = {
+    "COMPILER_PATH",
+    "GCC_EXEC_PREFIX",
+    "LANG",
+    "LC_ALL",
+    "LC_MESSAGES",
+    "LIBRARY_PATH",
+  };
+  for (const char* name : env_vars) {
+    const char* value = getenv(name);
+    if (value) {
+      hash.hash_delimiter(name);
+      hash.hash(value);
+    }
+  }
+
+  ctx.set_result_name(hash.digest());
 
-      LOG_RAW("Failed; falling back to running the real compiler");
+  if (from_cache(ctx, FromCacheCallMode::direct)) {
+    return Statistic::query_cache_hit;
+  }
 
-      saved_orig_args = std::move(ctx.orig_args);
-      auto execv_argv = saved_orig_args.to_argv();
-      LOG("Executing {}", Util::format_argv_for_logging(execv_argv.data()));
-      // Run execv below after ctx and finalizer have been destructed.
-    }
+  if (ctx.config.read_only()) {
+    LOG_RAW("Read-only mode; running compiler query without caching it");
+    throw Failure(Statistic::no_input_file);
   }
 
-  if (fall_back_to_original_compiler) {
-    if (original_umask) {
-      umask(*original_umask);
-    }
-    auto execv_argv = saved_orig_args.to_argv();
-    execv(execv_argv[0], const_cast<char* const*>(execv_argv.data()));
-    throw Fatal("execv of {} failed: {}", execv_argv[0], strerror(errno));
+  TemporaryFile tmp_stdout = ctx.create_transient_file(
+    FMT("{}/tmp.query_stdout", ctx.config.temporary_dir()));
+  TemporaryFile tmp_stderr = ctx.create_transient_file(
+    FMT("{}/tmp.query_stderr", ctx.config.temporary_dir()));
+  const std::string stdout_path = tmp_stdout.path;
+  const std::string stderr_path = tmp_stderr.path;
+
+  Args args = ctx.orig_args;
+  add_prefix(ctx, args, ctx.config.prefix_command());
+  LOG_RAW("Running real compiler query");
+  const auto compiler_start = std::chrono::steady_clock::now();
+  const int status =
+    do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+  ctx.compiler_duration_ms =
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - compiler_start)
+      .count();
+  ctx.counter_updates.increment(Statistic::time_spent_on_misses,
+                                ctx.compiler_duration_ms);
+
+  const auto stdout_data = Util::read_file(stdout_path);
+  Util::write_fd(STDOUT_FILENO, stdout_data.data(), stdout_data.size());
+  Util::send_to_stderr(ctx, Util::read_file(stderr_path));
+  if (status != 0) {
+    LOG("Compiler query gave exit status {}", status);
+    throw Failure(Statistic::no_input_file, status);
   }
 
-  return EXIT_SUCCESS;
+  std::vector<std::pair<Result::FileType, std::string>> files;
+  if (!stdout_data.empty()) {
+    files.emplace_back(Result::FileType::stdout_output, stdout_path);
+  }
+  files.emplace_back(Result::FileType::stderr_output, stderr_path);
+  put_result(ctx, files);
+  return Statistic::query_cache_miss;
 }
 
 static Statistic
@@ -2270,6 +5349,8 @@ do_cache_compilation(Context& ctx, const char* const* argv)
     throw Failure(Statistic::cache_miss);
   }
 
+  ctx.storage.initialize();
+
   MTR_BEGIN("main", "set_up_uncached_err");
   set_up_uncached_err();
   MTR_END("main", "set_up_uncached_err");
@@ -2281,6 +5362,10 @@ do_cache_compilation(Context& ctx, const char* const* argv)
     LOG("Apparent working directory: {}", ctx.apparent_cwd);
   }
 
+  if (!ctx.args_info.command_outputs.empty()) {
+    return cache_command(ctx);
+  }
+
   LOG("Compiler type: {}", compiler_type_to_string(ctx.config.compiler_type()));
 
   MTR_BEGIN("main", "process_args");
@@ -2288,13 +5373,67 @@ do_cache_compilation(Context& ctx, const char* const* argv)
   MTR_END("main", "process_args");
 
   if (processed.error) {
+    if (*processed.error == Statistic::multiple_source_files
+        && ctx.config.split_sources()) {
+      const auto result = compile_source_files(ctx, argv);
+      if (result) {
+        return *result;
+      }
+    }
+    if (*processed.error == Statistic::called_for_link
+        && ctx.config.cache_links()) {
+      return cache_link(ctx);
+    }
+    if (*processed.error == Statistic::no_input_file
+        && ctx.config.cache_compiler_queries()
+        && is_compiler_query(ctx.orig_args)) {
+      return cache_compiler_query(ctx);
+    }
     throw Failure(*processed.error);
   }
 
-  if (ctx.config.depend_mode()
-      && (!ctx.args_info.generating_dependencies
-          || ctx.args_info.output_dep == "/dev/null"
-          || !ctx.config.run_second_cpp())) {
+  if (ctx.config.split_arch() && ctx.args_info.arch_args.size() > 1) {
+    const auto result = compile_arch_slices(ctx, argv);
+    if (result) {
+      return *result;
+    }
+  }
+
+  if (ignores_warning_options(ctx)) {
+    ctx.syntax_check_args = syntax_check_args(ctx, processed.compiler_args);
+  }
+
+  if (ctx.config.depend_mode() && !ctx.args_info.generating_dependencies
+      && ctx.config.run_second_cpp()
+      && (ctx.config.compiler_type() == CompilerType::gcc
+          || ctx.config.compiler_type() == CompilerType::clang
+          || ctx.config.compiler_type() == CompilerType::nvcc)) {
+    // Let the compiler write the dependency information to a private file so
+    // that depend mode can be used without the preprocessor.
+    TemporaryFile tmp_dep(FMT("{}/tmp.dep", ctx.config.temporary_dir()));
+    ctx.register_pending_tmp_file(tmp_dep.path);
+    ctx.args_info.injected_output_dep = tmp_dep.path;
+    if (is_clang_cl(ctx)) {
+      // clang-cl takes -MD to mean /MD, so pass the options to Clang itself.
+      ctx.args_info.depend_extra_args.push_back("/clang:-MD");
+      ctx.args_info.depend_extra_args.push_back(
+        FMT("/clang:-MF{}", tmp_dep.path));
+    } else {
+      ctx.args_info.depend_extra_args.push_back("-MD");
+      ctx.args_info.depend_extra_args.push_back("-MF");
+      ctx.args_info.depend_extra_args.push_back(tmp_dep.path);
+    }
+    LOG("Injected dependency file: {}", tmp_dep.path);
+  } else if (ctx.config.depend_mode() && ctx.config.run_second_cpp()
+             && ctx.config.compiler_type() == CompilerType::msvc) {
+    // MSVC lists the included files on standard output instead.
+    if (!ctx.args_info.generating_includes) {
+      ctx.args_info.depend_extra_args.push_back("/showIncludes");
+    }
+  } else if (ctx.config.depend_mode()
+             && (!ctx.args_info.generating_dependencies
+                 || ctx.args_info.output_dep == "/dev/null"
+                 || !ctx.config.run_second_cpp())) {
     LOG_RAW("Disabling depend mode");
     ctx.config.set_depend_mode(false);
   }
@@ -2334,12 +5473,19 @@ do_cache_compilation(Context& ctx, const char* const* argv)
                             : nullptr;
 
   Hash common_hash;
+  if (ctx.config.explain_misses()) {
+    common_hash.enable_sections();
+  }
   init_hash_debug(
     ctx, common_hash, ctx.args_info.output_obj, 'c', "COMMON", debug_text_file);
 
   MTR_BEGIN("hash", "common_hash");
+  Statistics::PhaseTimer hash_common_info_timer(ctx, Phase::hash_common_info);
+  Tracing::Span hash_common_info_span("hash_common_info");
   hash_common_info(
     ctx, processed.preprocessor_args, common_hash, ctx.args_info);
+  hash_common_info_timer.stop();
+  hash_common_info_span.end();
   MTR_END("hash", "common_hash");
 
   // Try to find the hash using the manifest.
@@ -2354,6 +5500,25 @@ do_cache_compilation(Context& ctx, const char* const* argv)
   Args args_to_hash = processed.preprocessor_args;
   args_to_hash.push_back(processed.extra_args_to_hash);
 
+  // Run the preprocessor during the direct mode lookup if its output would be
+  // needed on a miss.
+  std::unique_ptr<SpeculativePreprocessor> speculative_preprocessor;
+  if (ctx.config.speculative_cpp() && ctx.config.direct_mode()
+      && !ctx.config.depend_mode() && !ctx.config.read_only_direct()
+      && ctx.args_info.arch_args.empty() && !ctx.args_info.direct_i_file) {
+    speculative_preprocessor = std::make_unique<SpeculativePreprocessor>(
+      ctx, processed.preprocessor_args);
+  }
+
+  // Bound the time that a slow lookup adds to a miss by compiling in parallel
+  // once it has taken long enough.
+  std::unique_ptr<SpeculativeCompiler> speculative_compiler;
+  if (ctx.config.speculative_compile_delay() > 0
+      && can_compile_speculatively(ctx)) {
+    speculative_compiler =
+      std::make_unique<SpeculativeCompiler>(ctx, processed.compiler_args);
+  }
+
   bool put_result_in_manifest = false;
   optional<Digest> result_name;
   optional<Digest> result_name_from_manifest;
@@ -2382,6 +5547,7 @@ do_cache_compilation(Context& ctx, const char* const* argv)
       // Add result to manifest later.
       put_result_in_manifest = true;
     }
+    ctx.storage.set_lookup_deadline(nullopt);
   }
 
   if (ctx.config.read_only_direct()) {
@@ -2389,6 +5555,10 @@ do_cache_compilation(Context& ctx, const char* const* argv)
     throw Failure(Statistic::cache_miss);
   }
 
+  // Sections of the hash that the result name is calculated from, if
+  // explain_misses is enabled.
+  std::vector<Hash::Section> result_hash_sections;
+
   if (!ctx.config.depend_mode()) {
     // Find the hash using the preprocessed output. Also updates
     // ctx.included_files.
@@ -2402,13 +5572,21 @@ do_cache_compilation(Context& ctx, const char* const* argv)
 
     MTR_BEGIN("hash", "cpp_hash");
     result_name = calculate_result_name(
-      ctx, args_to_hash, processed.preprocessor_args, cpp_hash, false);
+      ctx,
+      args_to_hash,
+      processed.preprocessor_args,
+      cpp_hash,
+      false,
+      speculative_preprocessor ? speculative_preprocessor->finish() : nullptr);
     MTR_END("hash", "cpp_hash");
 
     // calculate_result_name does not return nullopt if the last (direct_mode)
     // argument is false.
     ASSERT(result_name);
     ctx.set_result_name(*result_name);
+    if (ctx.config.explain_misses()) {
+      result_hash_sections = cpp_hash.sections();
+    }
 
     if (result_name_from_manifest && result_name_from_manifest != result_name) {
       // manifest_path is guaranteed to be set when calculate_result_name
@@ -2431,13 +5609,15 @@ do_cache_compilation(Context& ctx, const char* const* argv)
       LOG_RAW("Hash from manifest doesn't match preprocessor output");
       LOG_RAW("Likely reason: different CCACHE_BASEDIRs used");
       LOG_RAW("Removing manifest as a safety measure");
-      Util::unlink_safe(*ctx.manifest_path());
+      ctx.storage.remove(*ctx.manifest_name(), Manifest::k_file_suffix);
 
       put_result_in_manifest = true;
     }
 
     // If we can return from cache at this point then do.
+    start_lookup_deadline(ctx);
     auto result = from_cache(ctx, FromCacheCallMode::cpp);
+    ctx.storage.set_lookup_deadline(nullopt);
     if (result) {
       if (put_result_in_manifest) {
         update_manifest_file(ctx);
@@ -2451,6 +5631,29 @@ do_cache_compilation(Context& ctx, const char* const* argv)
     throw Failure(Statistic::cache_miss);
   }
 
+  if (ctx.args_info.preprocessing_only) {
+    store_preprocessed_output(ctx);
+    return Statistic::cache_miss;
+  }
+
+  // Let an identical compilation that is already running store the result
+  // instead of running the compiler too. The claim is held until the result
+  // is stored.
+  std::unique_ptr<CompileClaim> compile_claim;
+  if (ctx.config.coalesce_timeout() > 0 && !ctx.config.depend_mode()) {
+    compile_claim = std::make_unique<CompileClaim>(FMT(
+      "{}/claims/{}", ctx.config.cache_dir(), ctx.result_name()->to_string()));
+    if (compile_claim->wait(ctx.config.coalesce_timeout())) {
+      auto result = from_cache(ctx, FromCacheCallMode::cpp);
+      if (result) {
+        if (put_result_in_manifest) {
+          update_manifest_file(ctx);
+        }
+        return *result;
+      }
+    }
+  }
+
   add_prefix(ctx, processed.compiler_args, ctx.config.prefix_command());
 
   // In depend_mode, extend the direct hash.
@@ -2458,31 +5661,368 @@ do_cache_compilation(Context& ctx, const char* const* argv)
 
   // Run real compiler, sending output to cache.
   MTR_BEGIN("cache", "to_cache");
-  to_cache(ctx,
-           processed.compiler_args,
-           ctx.args_info.depend_extra_args,
-           depend_mode_hash);
-  update_manifest_file(ctx);
+  Statistics::PhaseTimer to_cache_timer(ctx, Phase::to_cache);
+  if (to_cache(ctx,
+               processed.compiler_args,
+               ctx.args_info.depend_extra_args,
+               depend_mode_hash,
+               speculative_compiler.get())) {
+    update_manifest_file(ctx);
+  }
+  to_cache_timer.stop();
   MTR_END("cache", "to_cache");
 
+  if (ctx.config.explain_misses()) {
+    MissExplanation::record(ctx,
+                            depend_mode_hash ? depend_mode_hash->sections()
+                                             : result_hash_sections);
+  }
+
   return Statistic::cache_miss;
 }
 
+static const char*
+lookup_result_to_string(LookupResult result)
+{
+  switch (result) {
+  case LookupResult::hit:
+    return "hit";
+  case LookupResult::miss:
+    return "miss";
+  case LookupResult::uncacheable:
+    return "uncacheable";
+  case LookupResult::error:
+    break;
+  }
+  return "error";
+}
+
+// Names of the cache entries found by probe_compilation.
+struct ProbedNames
+{
+  optional<Digest> manifest;
+  optional<Digest> result;
+};
+
+// Look up the direct mode result of a compilation in the current working
+// directory without running the preprocessor or the compiler. Safe to call
+// from several threads since all state lives in a private context.
+static LookupResult
+probe_compilation(const Config& config,
+                  const Args& args,
+                  ProbedNames* names = nullptr)
+{
+  Context ctx;
+  ctx.config = config;
+  set_up_context(ctx, args);
+
+  try {
+    find_compiler(ctx, &find_executable);
+    if (ctx.config.compiler_type() == CompilerType::auto_guess) {
+      ctx.config.set_compiler_type(guess_compiler(ctx.orig_args[0]));
+    }
+    ctx.storage.initialize();
+
+    ProcessArgsResult processed = process_args(ctx);
+    if (processed.error || !ctx.config.direct_mode()) {
+      return LookupResult::uncacheable;
+    }
+
+    Hash hash;
+    hash_common_info(ctx, processed.preprocessor_args, hash, ctx.args_info);
+    Args args_to_hash = processed.preprocessor_args;
+    args_to_hash.push_back(processed.extra_args_to_hash);
+    Args dummy_args;
+    const auto result_name =
+      calculate_result_name(ctx, args_to_hash, dummy_args, hash, true);
+    if (names) {
+      names->manifest = ctx.manifest_name();
+      names->result = result_name;
+    }
+    if (!result_name) {
+      return ctx.config.direct_mode() ? LookupResult::miss
+                                      : LookupResult::uncacheable;
+    }
+    return ctx.storage.get(
+             *result_name, Result::k_file_suffix, ctx.counter_updates)
+             ? LookupResult::hit
+             : LookupResult::miss;
+  } catch (const ErrorBase& e) {
+    LOG("Failed to probe {}: {}",
+        Util::format_argv_for_logging(ctx.orig_args.to_argv().data()),
+        e.what());
+    return LookupResult::error;
+  } catch (const Failure&) {
+    return LookupResult::uncacheable;
+  }
+}
+
+LookupResult
+lookup_compilation(const Config& config, const Args& args)
+{
+  Config lookup_config = config;
+  lookup_config.set_read_only_direct(true);
+  lookup_config.set_secondary_storage("");
+  return probe_compilation(lookup_config, args);
+}
+
+// Read the JSON compilation database at `path` ("-" for standard input).
+static std::vector<CompilationDatabase::Entry>
+read_compilation_database(const std::string& path)
+{
+  std::string json;
+  if (path == "-") {
+    Util::read_fd(STDIN_FILENO, [&](const void* data, size_t size) {
+      json.append(static_cast<const char*>(data), size);
+    });
+  } else {
+    json = Util::read_file(path);
+  }
+  return CompilationDatabase::parse(json);
+}
+
+// Call `function` with the index of each of `entries` whose working directory
+// could be entered, with that directory as the current working directory.
+// Entries in the same directory are handled in parallel; the working directory
+// is process-wide, so directories are visited one at a time.
+static void
+for_each_compilation(const std::vector<CompilationDatabase::Entry>& entries,
+                     const std::vector<size_t>& indexes,
+                     const std::function<void(size_t)>& function)
+{
+  std::map<std::string, std::vector<size_t>> indexes_by_directory;
+  for (const size_t i : indexes) {
+    indexes_by_directory[entries[i].directory].push_back(i);
+  }
+
+  const std::string original_cwd = Util::get_actual_cwd();
+  const size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+  Jobserver::Tokens tokens(threads - 1);
+  ThreadPool thread_pool(tokens.count());
+  for (const auto& directory_indexes : indexes_by_directory) {
+    if (chdir(directory_indexes.first.c_str()) != 0) {
+      LOG("Failed to change directory to {}: {}",
+          directory_indexes.first,
+          strerror(errno));
+      continue;
+    }
+    const auto& group = directory_indexes.second;
+    thread_pool.for_each_index(group.size(), [&](size_t i) {
+      function(group[i]);
+      return true;
+    });
+  }
+  if (chdir(original_cwd.c_str()) != 0) {
+    LOG("Failed to change directory to {}: {}", original_cwd, strerror(errno));
+  }
+}
+
+static std::vector<size_t>
+all_indexes(size_t count)
+{
+  std::vector<size_t> indexes(count);
+  for (size_t i = 0; i < count; ++i) {
+    indexes[i] = i;
+  }
+  return indexes;
+}
+
+// Probe all compilations in the compilation database at `path` and print one
+// line with the result and source file per entry, in database order.
+static void
+probe_compilations(const Config& config, const std::string& path)
+{
+  const auto entries = read_compilation_database(path);
+
+  std::vector<LookupResult> results(entries.size(), LookupResult::error);
+  for_each_compilation(entries, all_indexes(entries.size()), [&](size_t i) {
+    results[i] = lookup_compilation(config, entries[i].args);
+  });
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    PRINT(stdout,
+          "{} {}\n",
+          lookup_result_to_string(results[i]),
+          entries[i].file.empty() ? entries[i].directory : entries[i].file);
+  }
+}
+
+// Fetch the manifests and results of the compilations in the compilation
+// database at `path` from the secondary storage into the local cache. Missing
+// manifests are fetched in one batch, then the results named by the manifests.
+static void
+prefetch_compilations(const Config& config, const std::string& path)
+{
+  if (config.secondary_storage().empty()) {
+    throw Error("no secondary storage configured");
+  }
+  const auto entries = read_compilation_database(path);
+
+  Storage storage(config);
+  storage.initialize();
+  std::array<Counters, 16> level_1_counter_updates;
+  std::vector<SecondaryStorage::Key> keys;
+  const auto fetch = [&](const char* kind) {
+    const size_t fetched = storage.prefetch(keys, level_1_counter_updates);
+    LOG("Prefetched {} of {} {}s", fetched, keys.size(), kind);
+    keys.clear();
+    return fetched;
+  };
+
+  // Hashing uses the local cache only; the lookups are batched below.
+  Config probe_config = config;
+  probe_config.set_read_only_direct(true);
+  probe_config.set_secondary_storage("");
+
+  std::vector<ProbedNames> names(entries.size());
+  std::vector<LookupResult> results(entries.size(), LookupResult::error);
+  const auto probe = [&](size_t i) {
+    results[i] = probe_compilation(probe_config, entries[i].args, &names[i]);
+  };
+  for_each_compilation(entries, all_indexes(entries.size()), probe);
+
+  std::vector<size_t> reprobe;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (results[i] == LookupResult::miss && !names[i].result
+        && names[i].manifest) {
+      keys.push_back({*names[i].manifest, Manifest::k_file_suffix});
+      reprobe.push_back(i);
+    }
+  }
+  const size_t fetched_manifests = fetch("manifest");
+  if (fetched_manifests > 0) {
+    for_each_compilation(entries, reprobe, probe);
+  }
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (results[i] == LookupResult::miss && names[i].result) {
+      keys.push_back({*names[i].result, Result::k_file_suffix});
+    }
+  }
+  const size_t fetched_results = fetch("result");
+
+  for (size_t i = 0; i < level_1_counter_updates.size(); ++i) {
+    if (!level_1_counter_updates[i].all_zero()) {
+      Statistics::update(
+        config.cache_dir(),
+        FMT("{}/{:x}/stats", config.cache_dir(), i),
+        [&](Counters& cs) { cs.increment(level_1_counter_updates[i]); });
+    }
+  }
+
+  PRINT(stdout,
+        "Prefetched {} manifests and {} results for {} compilations\n",
+        fetched_manifests,
+        fetched_results,
+        entries.size());
+}
+
+// Split `address` ("[host][:port]", where port 0 means any free port) into
+// host and port. The host is empty if not given.
+static std::pair<std::string, std::string>
+parse_listen_address(const std::string& address,
+                     const std::string& default_port)
+{
+  std::string host = address;
+  std::string port = default_port;
+  const auto colon = address.rfind(':');
+  if (colon != std::string::npos
+      && address.find(']', colon) == std::string::npos) {
+    host = address.substr(0, colon);
+    port = FMT(
+      "{}", Util::parse_unsigned(address.substr(colon + 1), 0, 65535, "port"));
+  }
+  if (Util::starts_with(host, "[") && Util::ends_with(host, "]")) {
+    host = host.substr(1, host.size() - 2);
+  }
+  return {host, port};
+}
+
+// Serve the local cache to peer workstations on `address` until interrupted.
+static void
+serve_peers(const Config& config, const std::string& address)
+{
+#ifdef _WIN32
+  (void)config;
+  (void)address;
+  throw Error("--serve-peers is not supported on Windows");
+#else
+  std::string host;
+  std::string port;
+  std::tie(host, port) =
+    parse_listen_address(address, PeerServer::k_default_port);
+
+  PeerServer server(config);
+  if (!server.listen(host, port)) {
+    throw Error("failed to listen on {}: {}", address, strerror(errno));
+  }
+  PRINT(stdout, "Serving {} on port {}\n", config.cache_dir(), server.port());
+  fflush(stdout);
+  server.run();
+#endif
+}
+
+// Compile for other workstations on `address` until interrupted.
+static void
+serve_compiles(const Config& config, const std::string& address)
+{
+#ifdef _WIN32
+  (void)config;
+  (void)address;
+  throw Error("--serve-compiles is not supported on Windows");
+#else
+  std::string host;
+  std::string port;
+  std::tie(host, port) =
+    parse_listen_address(address, CompileServer::k_default_port);
+
+  CompileServer server(config,
+                       std::max(std::thread::hardware_concurrency(), 1u));
+  if (!server.listen(host, port)) {
+    throw Error("failed to listen on {}: {}", address, strerror(errno));
+  }
+  PRINT(stdout, "Compiling on port {}\n", server.port());
+  fflush(stdout);
+  server.run();
+#endif
+}
+
 // The main program when not doing a compile.
 static int
 handle_main_options(int argc, const char* const* argv)
 {
   enum longopts {
+    BY,
     CHECKSUM_FILE,
     CONFIG_PATH,
     DUMP_MANIFEST,
     DUMP_RESULT,
+    EVALUATE_COMPRESSION,
     EVICT_OLDER_THAN,
+    EXPLAIN_MISS,
+    EXPORT,
+    EXPORT_SIZE,
     EXTRACT_RESULT,
     HASH_FILE,
+    IMPORT,
+    METRICS,
+    MIGRATE,
+    PIN,
+    PREFETCH,
     PRINT_STATS,
+    PROBE,
+    REBALANCE,
+    RECOUNT_STATS,
+    SCRUB,
+    SERVE_COMPILES,
+    SERVE_PEERS,
+    SESSION,
+    SIMULATE,
+    TRAIN_DICTIONARY,
+    WATCH,
   };
   static const struct option options[] = {
+    {"by", required_argument, nullptr, BY},
     {"checksum-file", required_argument, nullptr, CHECKSUM_FILE},
     {"cleanup", no_argument, nullptr, 'c'},
     {"clear", no_argument, nullptr, 'C'},
@@ -2490,36 +6030,90 @@ handle_main_options(int argc, const char* const* argv)
     {"directory", required_argument, nullptr, 'd'},
     {"dump-manifest", required_argument, nullptr, DUMP_MANIFEST},
     {"dump-result", required_argument, nullptr, DUMP_RESULT},
+    {"evaluate-compression", required_argument, nullptr, EVALUATE_COMPRESSION},
     {"evict-older-than", required_argument, nullptr, EVICT_OLDER_THAN},
+    {"explain-miss", required_argument, nullptr, EXPLAIN_MISS},
+    {"export", required_argument, nullptr, EXPORT},
+    {"export-size", required_argument, nullptr, EXPORT_SIZE},
     {"extract-result", required_argument, nullptr, EXTRACT_RESULT},
     {"get-config", required_argument, nullptr, 'k'},
     {"hash-file", required_argument, nullptr, HASH_FILE},
     {"help", no_argument, nullptr, 'h'},
+    {"import", required_argument, nullptr, IMPORT},
     {"max-files", required_argument, nullptr, 'F'},
     {"max-size", required_argument, nullptr, 'M'},
+    {"metrics", no_argument, nullptr, METRICS},
+    {"migrate", no_argument, nullptr, MIGRATE},
+    {"pin", required_argument, nullptr, PIN},
+    {"prefetch", required_argument, nullptr, PREFETCH},
     {"print-stats", no_argument, nullptr, PRINT_STATS},
+    {"probe", required_argument, nullptr, PROBE},
+    {"rebalance", no_argument, nullptr, REBALANCE},
     {"recompress", required_argument, nullptr, 'X'},
+    {"recount-stats", no_argument, nullptr, RECOUNT_STATS},
+    {"scrub", no_argument, nullptr, SCRUB},
+    {"serve-compiles", required_argument, nullptr, SERVE_COMPILES},
+    {"serve-peers", required_argument, nullptr, SERVE_PEERS},
+    {"session", required_argument, nullptr, SESSION},
     {"set-config", required_argument, nullptr, 'o'},
     {"show-compression", no_argument, nullptr, 'x'},
     {"show-config", no_argument, nullptr, 'p'},
     {"show-stats", no_argument, nullptr, 's'},
+    {"simulate", required_argument, nullptr, SIMULATE},
+    {"train-dictionary", no_argument, nullptr, TRAIN_DICTIONARY},
+    {"verbose", no_argument, nullptr, 'v'},
     {"version", no_argument, nullptr, 'V'},
+    {"watch", required_argument, nullptr, WATCH},
     {"zero-stats", no_argument, nullptr, 'z'},
     {nullptr, 0, nullptr, 0}};
 
   Context ctx;
   initialize(ctx, argc, argv);
 
+  const char* const short_options = "cCd:k:hF:M:po:svVxX:z";
+
+  // --verbose, --by, --session and --export-size affect options given before
+  // them, so look for them first.
+  bool verbose = false;
+  std::string breakdown_dimension;
+  std::string session;
+  uint64_t export_size = 0;
   int c;
+  opterr = 0;
+  while ((c = getopt_long(argc,
+                          const_cast<char* const*>(argv),
+                          short_options,
+                          options,
+                          nullptr))
+         != -1) {
+    if (c == 'v') {
+      verbose = true;
+    } else if (c == BY) {
+      breakdown_dimension = optarg;
+    } else if (c == SESSION) {
+      session = optarg;
+    } else if (c == EXPORT_SIZE) {
+      export_size = Util::parse_size(optarg);
+    }
+  }
+  opterr = 1;
+  optind = 1;
+
   while ((c = getopt_long(argc,
                           const_cast<char* const*>(argv),
-                          "cCd:k:hF:M:po:sVxX:z",
+                          short_options,
                           options,
                           nullptr))
          != -1) {
     std::string arg = optarg ? optarg : std::string();
 
     switch (c) {
+    case BY:
+      if (arg != "compiler" && arg != "directory" && arg != "namespace") {
+        throw Error("unknown statistics dimension: \"{}\"", arg);
+      }
+      break;
+
     case CHECKSUM_FILE: {
       Checksum checksum;
       Fd fd(arg == "-" ? STDIN_FILENO : open(arg.c_str(), O_RDONLY));
@@ -2539,7 +6133,7 @@ handle_main_options(int argc, const char* const* argv)
 
     case DUMP_RESULT: {
       ResultDumper result_dumper(stdout);
-      Result::Reader result_reader(arg);
+      Result::Reader result_reader(arg, ctx.config.cache_dir());
       auto error = result_reader.read(result_dumper);
       if (error) {
         PRINT(stderr, "Error: {}\n", *error);
@@ -2547,9 +6141,20 @@ handle_main_options(int argc, const char* const* argv)
       return error ? EXIT_FAILURE : EXIT_SUCCESS;
     }
 
+    case EVALUATE_COMPRESSION: {
+      const auto sample_count = static_cast<uint32_t>(
+        Util::parse_unsigned(arg, 1, UINT32_MAX, "number of cache entries"));
+      ProgressBar progress_bar("Evaluating...");
+      compress_evaluate(ctx.config, sample_count, [&](double progress) {
+        progress_bar.update(progress);
+      });
+      break;
+    }
+
     case EVICT_OLDER_THAN: {
       auto seconds = Util::parse_duration(arg);
       ProgressBar progress_bar("Evicting...");
+      MtimeJournal::flush(ctx.config);
       clean_old(
         ctx, [&](double progress) { progress_bar.update(progress); }, seconds);
       if (isatty(STDOUT_FILENO)) {
@@ -2558,9 +6163,40 @@ handle_main_options(int argc, const char* const* argv)
       break;
     }
 
+    case EXPLAIN_MISS: {
+      const auto explanation = MissExplanation::explain(ctx.config, arg);
+      if (!explanation) {
+        PRINT(stderr,
+              "Error: Fewer than two compilations of {} have been recorded;"
+              " is explain_misses enabled?\n",
+              arg);
+        return EXIT_FAILURE;
+      }
+      PRINT_RAW(stdout, *explanation);
+      break;
+    }
+
+    case EXPORT: {
+      ProgressBar progress_bar("Exporting...");
+      MtimeJournal::flush(ctx.config);
+      const auto exported = CacheBundle::write(
+        ctx.config, arg, export_size, [&](double progress) {
+          progress_bar.update(progress);
+        });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout, "Exported {} files to {}\n", exported, arg);
+      break;
+    }
+
+    case EXPORT_SIZE:
+      // Handled above.
+      break;
+
     case EXTRACT_RESULT: {
       ResultExtractor result_extractor(".");
-      Result::Reader result_reader(arg);
+      Result::Reader result_reader(arg, ctx.config.cache_dir());
       auto error = result_reader.read(result_extractor);
       if (error) {
         PRINT(stderr, "Error: {}\n", *error);
@@ -2579,13 +6215,137 @@ handle_main_options(int argc, const char* const* argv)
       break;
     }
 
+    case IMPORT: {
+      const CacheBundle bundle(arg);
+      if (!bundle) {
+        throw Error("{} is not a readable cache bundle", arg);
+      }
+      ProgressBar progress_bar("Importing...");
+      const auto imported = bundle.import(
+        ctx.config, [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout,
+            "Imported {} of {} files from {}\n",
+            imported,
+            bundle.size(),
+            arg);
+      break;
+    }
+
+    case METRICS:
+      PRINT_RAW(stdout, Statistics::format_open_metrics(ctx.config));
+      break;
+
+    case MIGRATE: {
+      ProgressBar progress_bar("Migrating...");
+      const auto result = migrate_all(
+        ctx.config, [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout,
+            "Upgraded {} manifests, failed to upgrade {}\n",
+            result.upgraded,
+            result.failed);
+      break;
+    }
+
+    case PIN: {
+      const auto eq_pos = arg.rfind('=');
+      if (eq_pos == std::string::npos || eq_pos == 0) {
+        throw Error("missing equal sign in \"{}\"", arg);
+      }
+      const auto ns = arg.substr(0, eq_pos);
+      const uint64_t size = Util::parse_size(arg.substr(eq_pos + 1));
+      pin_namespace(ctx.config, ns, size);
+      if (size == 0) {
+        PRINT(stdout, "Unpinned namespace {}\n", ns);
+      } else {
+        PRINT(stdout,
+              "Pinned up to {} of namespace {}\n",
+              Util::format_human_readable_size(size),
+              ns);
+      }
+      break;
+    }
+
+    case PREFETCH:
+      prefetch_compilations(ctx.config, arg);
+      break;
+
     case PRINT_STATS:
       PRINT_RAW(stdout, Statistics::format_machine_readable(ctx.config));
       break;
 
+    case PROBE:
+      probe_compilations(ctx.config, arg);
+      break;
+
+    case REBALANCE: {
+      ProgressBar progress_bar("Rebalancing...");
+      rebalance_all(ctx.config,
+                    [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      break;
+    }
+
+    case RECOUNT_STATS:
+      Statistics::recount(ctx.config);
+      PRINT_RAW(stdout, "Statistics recounted\n");
+      break;
+
+    case SCRUB: {
+      ProgressBar progress_bar("Scrubbing...");
+      const auto result = scrub_all(
+        ctx.config, [&](double progress) { progress_bar.update(progress); });
+      if (isatty(STDOUT_FILENO)) {
+        PRINT_RAW(stdout, "\n");
+      }
+      PRINT(stdout,
+            "Verified {} results, removed {} corrupt results\n",
+            result.verified,
+            result.removed);
+      break;
+    }
+
+    case SERVE_COMPILES:
+      serve_compiles(ctx.config, arg);
+      break;
+
+    case SERVE_PEERS:
+      serve_peers(ctx.config, arg);
+      break;
+
+    case SESSION:
+      // Handled above.
+      break;
+
+    case SIMULATE: {
+      const auto trace = CacheSimulator::parse(Util::read_file(arg));
+      PRINT_RAW(stdout, CacheSimulator::report(ctx.config, trace));
+      break;
+    }
+
+    case TRAIN_DICTIONARY: {
+      ProgressBar progress_bar("Training...");
+      compress_train_dictionary(
+        ctx.config, [&](double progress) { progress_bar.update(progress); });
+      break;
+    }
+
+    case WATCH:
+      FileWatch::watch(ctx.config.cache_dir(),
+                       Util::split_into_strings(arg, ":"));
+      break;
+
     case 'c': // --cleanup
     {
       ProgressBar progress_bar("Cleaning...");
+      MtimeJournal::flush(ctx.config);
       clean_up_all(ctx.config,
                    [&](double progress) { progress_bar.update(progress); });
       if (isatty(STDOUT_FILENO)) {
@@ -2660,7 +6420,22 @@ handle_main_options(int argc, const char* const* argv)
       break;
 
     case 's': // --show-stats
-      PRINT_RAW(stdout, Statistics::format_human_readable(ctx.config));
+      if (!session.empty()) {
+        PRINT_RAW(stdout,
+                  Statistics::format_human_readable(
+                    ctx.config, verbose, session));
+      } else if (!breakdown_dimension.empty()) {
+        PRINT_RAW(
+          stdout,
+          Statistics::format_breakdown(ctx.config, breakdown_dimension));
+      } else {
+        PRINT_RAW(stdout,
+                  Statistics::format_human_readable(ctx.config, verbose));
+      }
+      break;
+
+    case 'v': // --verbose
+      // Handled above.
       break;
 
     case 'V': // --version
@@ -2693,6 +6468,11 @@ handle_main_options(int argc, const char* const* argv)
     }
 
     case 'z': // --zero-stats
+      if (!session.empty()) {
+        Statistics::zero_session(ctx.config, session);
+        PRINT(stdout, "Statistics of session {} zeroed\n", session);
+        break;
+      }
       Statistics::zero_all_counters(ctx.config);
       PRINT_RAW(stdout, "Statistics zeroed\n");
       break;
@@ -2713,6 +6493,48 @@ handle_main_options(int argc, const char* const* argv)
 
 int ccache_main(int argc, const char* const* argv);
 
+// Handle "ccache --run [--input PATH]... --output PATH... -- command [args]".
+static int
+run_command(int argc, const char* const* argv)
+{
+  ArgsInfo declared_files;
+  int i = 2;
+  for (; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--") {
+      ++i;
+      break;
+    }
+    if (arg == "--input" && i + 1 < argc) {
+      declared_files.command_inputs.emplace_back(argv[++i]);
+    } else if (arg == "--output" && i + 1 < argc) {
+      declared_files.command_outputs.emplace_back(argv[++i]);
+    } else {
+      throw Error("invalid --run option: {}", arg);
+    }
+  }
+  if (i >= argc) {
+    throw Error("missing command after --run options and --");
+  }
+  if (declared_files.command_outputs.empty()) {
+    throw Error("--run needs at least one --output");
+  }
+  // Leave room in the result for the other entries.
+  if (declared_files.command_outputs.size()
+      > UINT8_MAX - Result::k_max_entries) {
+    throw Error("too many --output files");
+  }
+
+  // Keep the ccache program name first so that the command is looked up like a
+  // compiler given to ccache.
+  std::vector<const char*> command_argv{argv[0]};
+  command_argv.insert(command_argv.end(), argv + i, argv + argc);
+  command_argv.push_back(nullptr);
+  return cache_compilation(static_cast<int>(command_argv.size() - 1),
+                           command_argv.data(),
+                           declared_files);
+}
+
 int
 ccache_main(int argc, const char* const* argv)
 {
@@ -2724,6 +6546,9 @@ ccache_main(int argc, const char* const* argv)
         PRINT(stderr, USAGE_TEXT, CCACHE_NAME, CCACHE_NAME);
         exit(EXIT_FAILURE);
       }
+      if (std::string(argv[1]) == "--run") {
+        return run_command(argc, argv);
+      }
       // If the first argument isn't an option, then assume we are being passed
       // a compiler name and options.
       if (argv[1][0] == '-') {
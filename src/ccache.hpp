@@ -28,7 +28,9 @@
 #include <functional>
 #include <string>
 
+class Args;
 class Context;
+class Hash;
 
 extern const char CCACHE_VERSION[];
 
@@ -51,6 +53,11 @@ const uint32_t SLOPPY_CLANG_INDEX_STORE = 1 << 7;
 const uint32_t SLOPPY_LOCALE = 1 << 8;
 // Allow caching even if -fmodules is used.
 const uint32_t SLOPPY_MODULES = 1 << 9;
+// Allow Clang precompiled header results whose include files have new mtimes
+// but unchanged content, restoring the mtimes recorded in the manifest.
+const uint32_t SLOPPY_PCH_INPUT_MTIME = 1 << 10;
+
+enum class LookupResult { hit, miss, uncacheable, error };
 
 using FindExecutableFunction =
   std::function<std::string(const Context& ctx,
@@ -61,3 +68,17 @@ using FindExecutableFunction =
 void find_compiler(Context& ctx,
                    const FindExecutableFunction& find_executable_function);
 CompilerType guess_compiler(nonstd::string_view path);
+
+// Used by benchmarks.
+bool process_preprocessed_file(Context& ctx,
+                               Hash& hash,
+                               const std::string& path,
+                               bool pump);
+
+// Look up the direct mode result of the compilation `args` in the current
+// working directory and the local cache of `config` without running the
+// preprocessor or the compiler and without modifying the cache. Safe to call
+// from several threads, so build systems linking with ccache_lib can use it to
+// find out which jobs will hit before scheduling them. Keys are computed with
+// Hash::default_algorithm(), which should match the hash_algorithm of `config`.
+LookupResult lookup_compilation(const Config& config, const Args& args);
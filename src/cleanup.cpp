@@ -19,17 +19,47 @@
 
 #include "cleanup.hpp"
 
+#include "AtomicFile.hpp"
+#include "CacheBundle.hpp"
+#include "CacheEntryReader.hpp"
 #include "CacheFile.hpp"
+#include "CleanupLease.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Fd.hpp"
+#include "File.hpp"
+#include "Jobserver.hpp"
 #include "Logging.hpp"
+#include "LruIndex.hpp"
+#include "Manifest.hpp"
+#include "PresenceFilter.hpp"
+#include "Result.hpp"
+#include "Stat.hpp"
+#include "Statistics.hpp"
+#include "StdMakeUnique.hpp"
+#include "Storage.hpp"
 #include "Util.hpp"
+#include "fmtmacros.hpp"
 
 #ifdef INODE_CACHE_SUPPORTED
 #  include "InodeCache.hpp"
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <tuple>
+#include <unordered_set>
+
+static const char k_cleanup_marker_name[] = "cleanup";
+static const char k_checkpoint_file_name[] = "maintenance.checkpoint";
+static const char k_pins_file_name[] = "pinned_namespaces";
+
+// Minimum time in seconds since a file was last used before it is packed.
+static const int64_t k_pack_min_age = 3600;
 
 static void
 delete_file(const std::string& path,
@@ -50,14 +80,38 @@ delete_file(const std::string& path,
   }
 }
 
+// Delete the raw files belonging to the result at `path` (if it is a result)
+// since they are useless on their own. Returns the paths of the deleted files
+// so that the caller can avoid accounting for them again when reaching them.
+static std::vector<std::string>
+delete_raw_files_of_result(const std::string& path,
+                           uint64_t* cache_size,
+                           uint64_t* files_in_cache)
+{
+  std::vector<std::string> deleted;
+  if (!Util::ends_with(path, Result::k_file_suffix)) {
+    return deleted;
+  }
+  for (uint8_t i = 0; i < Result::k_max_entries; ++i) {
+    const auto raw_file = Result::get_raw_file_path(path, i);
+    const auto stat = Stat::lstat(raw_file);
+    if (stat) {
+      delete_file(raw_file, stat.size_on_disk(), cache_size, files_in_cache);
+      deleted.push_back(raw_file);
+    }
+  }
+  return deleted;
+}
+
 static void
 update_counters(const std::string& dir,
                 uint64_t files_in_cache,
                 uint64_t cache_size,
                 bool cleanup_performed)
 {
+  const std::string cache_dir(Util::dir_name(dir));
   const std::string stats_file = dir + "/stats";
-  Statistics::update(stats_file, [=](Counters& cs) {
+  Statistics::update(cache_dir, stats_file, [=](Counters& cs) {
     if (cleanup_performed) {
       cs.increment(Statistic::cleanups_performed);
     }
@@ -66,13 +120,532 @@ update_counters(const std::string& dir,
   });
 }
 
+// Find the cache file with index name `name` on any cache level. Returns an
+// empty path if there is no such file.
+static std::string
+find_cache_file(const std::string& cache_dir,
+                const std::string& name,
+                Stat& stat)
+{
+  // Files directly in the level 1 subdirectory are left by old ccache
+  // versions.
+  for (uint8_t level = 1; level <= Storage::k_max_cache_levels; ++level) {
+    auto path = Util::get_path_in_cache(cache_dir, level, name);
+    stat = Stat::lstat(path);
+    if (stat) {
+      return path;
+    }
+  }
+  return {};
+}
+
+// Get the packed entries of `subdir` that are not shadowed by one of the loose
+// `files`, with the size of their data and the time of the pack.
+static std::vector<std::pair<std::string, LruIndex::Entry>>
+get_packed_entries(const std::string& subdir,
+                   const std::vector<std::shared_ptr<CacheFile>>& files)
+{
+  std::vector<std::pair<std::string, LruIndex::Entry>> packed_entries;
+  const auto pack_path = FMT("{}/{}", subdir, Storage::k_pack_file_name);
+  const auto pack_stat = Stat::stat(pack_path);
+  if (!pack_stat) {
+    return packed_entries;
+  }
+  CacheBundle pack(pack_path);
+  if (!pack) {
+    return packed_entries;
+  }
+
+  const std::string cache_dir(Util::dir_name(subdir));
+  std::unordered_set<std::string> loose_names;
+  for (const auto& file : files) {
+    loose_names.insert(LruIndex::name_from_path(cache_dir, file->path()));
+  }
+  for (uint64_t i = 0; i < pack.size(); ++i) {
+    std::string name(pack.name(i));
+    const auto data = pack.data(i);
+    if (data && loose_names.count(name) == 0) {
+      LruIndex::Entry entry;
+      entry.time = pack_stat.mtime();
+      entry.size = data->size();
+      packed_entries.emplace_back(std::move(name), entry);
+    }
+  }
+  return packed_entries;
+}
+
+// Get the name (or path) of the result that the raw file with name (or path)
+// `name` belongs to, or `name` if it's not a raw file of a result for which
+// `is_result` returns true. Since the result name may itself end with digits,
+// both possible lengths of the entry number are tried.
+template<typename IsResult>
+static std::string
+owner_of_raw_file(const std::string& name, const IsResult& is_result)
+{
+  static_assert(Result::k_max_entries <= 100, "entry number has 1-2 digits");
+  if (!Util::ends_with(name, "W")) {
+    return name;
+  }
+  const size_t end = name.length() - 1;
+  for (size_t digits = 1; digits <= 2 && digits < end; ++digits) {
+    if (name[end - digits] < '0' || name[end - digits] > '9') {
+      break;
+    }
+    auto owner =
+      FMT("{}{}", name.substr(0, end - digits), Result::k_file_suffix);
+    if (is_result(owner)) {
+      return owner;
+    }
+  }
+  return name;
+}
+
+// Size on disk and number of files evicted per namespace tag.
+using NamespaceEvictions =
+  std::unordered_map<std::string, std::pair<uint64_t, uint64_t>>;
+
+static void
+add_namespace_eviction(NamespaceEvictions& evictions,
+                       const LruIndex::Entry& entry)
+{
+  if (!entry.namespace_tag.empty()) {
+    auto& eviction = evictions[entry.namespace_tag];
+    eviction.first += entry.size;
+    eviction.second += 1;
+  }
+}
+
+// Subtract `evictions` from the namespace statistics of `subdir`.
+static void
+update_namespace_counters(const std::string& subdir,
+                          const NamespaceEvictions& evictions)
+{
+  const std::string cache_dir(Util::dir_name(subdir));
+  const std::string level_string(Util::base_name(subdir));
+  for (const auto& eviction : evictions) {
+    const auto path = Statistics::namespace_stats_file(
+      cache_dir, eviction.first, level_string);
+    if (!Stat::stat(path)) {
+      continue;
+    }
+    Statistics::update(path, [&](Counters& cs) {
+      cs.increment(Statistic::cache_size_kibibyte,
+                   -static_cast<int64_t>(eviction.second.first / 1024));
+      cs.increment(Statistic::files_in_cache,
+                   -static_cast<int64_t>(eviction.second.second));
+    });
+  }
+}
+
+// Get the names of the files in `entries` that are protected by `pins`: for each
+// pinned namespace, the most recently used files that fit in the
+// subdirectory's share of the pinned size.
+static std::unordered_set<std::string>
+find_pinned_files(
+  const std::unordered_map<std::string, LruIndex::Entry>& entries,
+  const std::map<std::string, uint64_t>& pins)
+{
+  std::unordered_map<std::string, uint64_t> budgets;
+  for (const auto& pin : pins) {
+    budgets[Statistics::namespace_tag(pin.first)] = pin.second / 16;
+  }
+
+  std::vector<const std::pair<const std::string, LruIndex::Entry>*> candidates;
+  for (const auto& entry : entries) {
+    if (budgets.count(entry.second.namespace_tag) != 0) {
+      candidates.push_back(&entry);
+    }
+  }
+  std::sort(candidates.begin(),
+            candidates.end(),
+            [](const std::pair<const std::string, LruIndex::Entry>* a,
+               const std::pair<const std::string, LruIndex::Entry>* b) {
+              return a->second.time > b->second.time;
+            });
+
+  std::unordered_set<std::string> pinned;
+  for (const auto* entry : candidates) {
+    auto& budget = budgets[entry->second.namespace_tag];
+    if (entry->second.size <= budget) {
+      budget -= entry->second.size;
+      pinned.insert(entry->first);
+    }
+  }
+  return pinned;
+}
+
+// Clean up one cache subdirectory based on its LRU index, only looking at the
+// files that are evicted. If `cost_aware` is true, files are evicted by lowest
+// GreedyDual-Size-Frequency priority instead of by age. If `namespace_max_size`
+// is not 0, files of the namespace with tag `namespace_tag` are evicted until
+// they take up at most `namespace_max_size` bytes. Files protected by `pins` are
+// never evicted. The remaining entries are added to `presence_filter` if it's
+// mapped.
+static void
+clean_up_dir_using_index(const std::string& subdir,
+                         LruIndex& index,
+                         PresenceFilter& presence_filter,
+                         uint64_t max_size,
+                         uint64_t max_files,
+                         uint64_t max_age,
+                         const Util::ProgressReceiver& progress_receiver,
+                         bool cost_aware,
+                         const std::string& namespace_tag,
+                         uint64_t namespace_max_size,
+                         const std::map<std::string, uint64_t>& pins)
+{
+  const std::string cache_dir(Util::dir_name(subdir));
+  auto& entries = index.entries();
+
+  uint64_t cache_size = 0;
+  uint64_t files_in_cache = 0;
+  uint64_t namespace_size = 0;
+  time_t current_time = time(nullptr);
+
+  const auto is_result = [&](const std::string& name) {
+    return entries.count(name) != 0;
+  };
+
+  // A result and its raw files are only useful together, so they are valued
+  // by their total size and evicted together, the result first.
+  std::unordered_map<std::string, uint64_t> group_sizes;
+  if (cost_aware) {
+    for (const auto& entry : entries) {
+      group_sizes[owner_of_raw_file(entry.first, is_result)] +=
+        entry.second.size;
+    }
+  }
+
+  // Lowest priority first, then oldest first, then results before their raw
+  // files, which are aged (and valued) as their result. The names point to
+  // keys in `entries`.
+  using QueueItem = std::tuple<double, int64_t, bool, const std::string*>;
+  const auto make_queue_item = [&](const std::string& name,
+                                   const LruIndex::Entry& entry) {
+    const auto owner_name = owner_of_raw_file(name, is_result);
+    const bool is_raw_file = owner_name != name;
+    const auto& valued = is_raw_file ? entries.find(owner_name)->second : entry;
+    return QueueItem(
+      cost_aware ? valued.priority(group_sizes[owner_name]) : 0.0,
+      valued.time,
+      is_raw_file,
+      &name);
+  };
+  std::priority_queue<QueueItem,
+                      std::vector<QueueItem>,
+                      std::greater<QueueItem>>
+    queue;
+  for (const auto& entry : entries) {
+    cache_size += entry.second.size;
+    files_in_cache += 1;
+    if (!namespace_tag.empty() && entry.second.namespace_tag == namespace_tag) {
+      namespace_size += entry.second.size;
+    }
+    queue.push(make_queue_item(entry.first, entry.second));
+  }
+  if (namespace_tag.empty()) {
+    namespace_max_size = 0;
+  }
+  const auto pinned = find_pinned_files(entries, pins);
+
+  LOG("Before cleanup: {:.0f} KiB, {:.0f} files (from LRU index)",
+      static_cast<double>(cache_size) / 1024,
+      static_cast<double>(files_in_cache));
+  if (!pinned.empty()) {
+    LOG("{} files are pinned", pinned.size());
+  }
+  if (namespace_max_size != 0) {
+    LOG("Namespace {} holds {:.0f} KiB (limit: {:.0f} KiB)",
+        namespace_tag,
+        static_cast<double>(namespace_size) / 1024,
+        static_cast<double>(namespace_max_size) / 1024);
+  }
+
+  const auto evict_from_namespace = [&](const LruIndex::Entry& entry) {
+    if (!namespace_tag.empty() && entry.namespace_tag == namespace_tag) {
+      namespace_size -= std::min(namespace_size, entry.size);
+    }
+  };
+
+  std::unordered_set<std::string> deleted_raw_files;
+  NamespaceEvictions namespace_evictions;
+  bool cleaned = false;
+  while (!queue.empty()) {
+    const double priority = std::get<0>(queue.top());
+    const auto entry = entries.find(*std::get<3>(queue.top()));
+    queue.pop();
+    const int64_t time = entry->second.time;
+
+    const bool within_limits =
+      (max_size == 0 || cache_size <= max_size)
+      && (max_files == 0 || files_in_cache <= max_files)
+      && (max_age == 0
+          || time > (current_time - static_cast<int64_t>(max_age)));
+    if (within_limits
+        && (namespace_max_size == 0 || namespace_size <= namespace_max_size)) {
+      break;
+    }
+    if (within_limits && entry->second.namespace_tag != namespace_tag) {
+      // Only the namespace is over its limit, so leave other files alone.
+      continue;
+    }
+    const auto owner_name = owner_of_raw_file(entry->first, is_result);
+    if (pinned.count(entry->first) != 0 || pinned.count(owner_name) != 0) {
+      continue;
+    }
+    if (owner_name != entry->first) {
+      // Only evicted together with its result, which was used after the raw
+      // file was queued.
+      continue;
+    }
+
+    Stat stat;
+    const auto path = find_cache_file(cache_dir, entry->first, stat);
+    if (path.empty()) {
+      if (deleted_raw_files.erase(entry->first) == 0) {
+        // Removed by someone else, e.g. a parallel cleanup.
+        cache_size -= entry->second.size;
+        --files_in_cache;
+        evict_from_namespace(entry->second);
+      }
+      entries.erase(entry);
+      continue;
+    }
+    if (stat.mtime() > time) {
+      // Used without the index knowing about it, so try again later.
+      entry->second.time = stat.mtime();
+      ++entry->second.hits;
+      entry->second.inflation = index.inflation();
+      queue.push(make_queue_item(entry->first, entry->second));
+      continue;
+    }
+
+    if (cost_aware) {
+      index.set_inflation(std::max(index.inflation(), priority));
+    }
+    delete_file(path, entry->second.size, &cache_size, &files_in_cache);
+    evict_from_namespace(entry->second);
+    add_namespace_eviction(namespace_evictions, entry->second);
+    for (const auto& raw_file :
+         delete_raw_files_of_result(path, &cache_size, &files_in_cache)) {
+      const auto raw_name = LruIndex::name_from_path(cache_dir, raw_file);
+      const auto raw_entry = entries.find(raw_name);
+      if (raw_entry != entries.end()) {
+        evict_from_namespace(raw_entry->second);
+        add_namespace_eviction(namespace_evictions, raw_entry->second);
+      }
+      deleted_raw_files.insert(raw_name);
+    }
+    entries.erase(entry);
+    cleaned = true;
+  }
+  progress_receiver(1.0);
+
+  LOG("After cleanup: {:.0f} KiB, {:.0f} files",
+      static_cast<double>(cache_size) / 1024,
+      static_cast<double>(files_in_cache));
+
+  if (cleaned) {
+    LOG("Cleaned up cache directory {}", subdir);
+  }
+
+  if (presence_filter) {
+    for (const auto& entry : entries) {
+      presence_filter.add(entry.first);
+    }
+    presence_filter.end_rebuild();
+  }
+
+  index.save();
+  update_namespace_counters(subdir, namespace_evictions);
+  update_counters(subdir, files_in_cache, cache_size, cleaned);
+}
+
+// Clean up one cache subdirectory by repeatedly evicting the least recently
+// used of `sample_size` randomly picked files, only looking at picked files.
+// The remaining files are added to `presence_filter` if it's mapped.
+static void
+clean_up_dir_by_sampling(const std::string& subdir,
+                         PresenceFilter& presence_filter,
+                         uint64_t max_size,
+                         uint64_t max_files,
+                         uint32_t sample_size,
+                         const Util::ProgressReceiver& progress_receiver)
+{
+  std::vector<std::shared_ptr<CacheFile>> files;
+  Util::get_level_1_files(
+    subdir,
+    [&](double progress) { progress_receiver(progress / 2); },
+    files,
+    false);
+
+  // Raw files are only evicted together with their result, so only results
+  // and orphaned raw files are sampled.
+  std::unordered_set<std::string> result_paths;
+  for (const auto& file : files) {
+    if (Util::ends_with(file->path(), Result::k_file_suffix)) {
+      result_paths.insert(file->path());
+    }
+  }
+  std::vector<std::shared_ptr<CacheFile>> raw_files;
+  const auto raw_files_begin = std::partition(
+    files.begin(), files.end(), [&](const std::shared_ptr<CacheFile>& file) {
+      return owner_of_raw_file(file->path(), [&](const std::string& path) {
+               return result_paths.count(path) != 0;
+             })
+             == file->path();
+    });
+  raw_files.assign(std::make_move_iterator(raw_files_begin),
+                   std::make_move_iterator(files.end()));
+  files.erase(raw_files_begin, files.end());
+
+  const auto counters = Statistics::read(subdir + "/stats");
+  uint64_t cache_size =
+    counters.get(Statistic::cache_size_kibibyte) * UINT64_C(1024);
+  uint64_t files_in_cache = counters.get(Statistic::files_in_cache);
+
+  LOG("Before cleanup: {:.0f} KiB, {:.0f} files (from counters)",
+      static_cast<double>(cache_size) / 1024,
+      static_cast<double>(files_in_cache));
+
+  std::mt19937_64 random_engine(std::random_device{}());
+  const size_t initial_files = files.size();
+  std::unordered_set<std::string> deleted_raw_files;
+  bool cleaned = false;
+
+  while (!files.empty()
+         && ((max_size != 0 && cache_size > max_size)
+             || (max_files != 0 && files_in_cache > max_files))) {
+    nonstd::optional<size_t> oldest;
+    for (uint32_t i = 0; i < sample_size && !files.empty(); ++i) {
+      std::uniform_int_distribution<size_t> distribution(0, files.size() - 1);
+      size_t index = distribution(random_engine);
+      if (!files[index]->lstat().is_regular()
+          || deleted_raw_files.count(files[index]->path()) > 0) {
+        // Removed by someone else or not a file, so never pick it again.
+        std::swap(files[index], files.back());
+        if (oldest && *oldest == files.size() - 1) {
+          oldest = index;
+        }
+        files.pop_back();
+        continue;
+      }
+      if (!oldest
+          || files[index]->lstat().mtime() < files[*oldest]->lstat().mtime()) {
+        oldest = index;
+      }
+    }
+    if (!oldest) {
+      continue;
+    }
+
+    const auto& file = files[*oldest];
+    delete_file(
+      file->path(), file->lstat().size_on_disk(), &cache_size, &files_in_cache);
+    for (auto& raw_file : delete_raw_files_of_result(
+           file->path(), &cache_size, &files_in_cache)) {
+      deleted_raw_files.insert(std::move(raw_file));
+    }
+    cleaned = true;
+    std::swap(files[*oldest], files.back());
+    files.pop_back();
+
+    progress_receiver(0.5
+                      + 0.5 * (initial_files - files.size()) / initial_files);
+  }
+  progress_receiver(1.0);
+
+  LOG("After cleanup: {:.0f} KiB, {:.0f} files",
+      static_cast<double>(cache_size) / 1024,
+      static_cast<double>(files_in_cache));
+
+  if (cleaned) {
+    LOG("Cleaned up cache directory {}", subdir);
+  }
+
+  if (presence_filter) {
+    const std::string cache_dir(Util::dir_name(subdir));
+    files.insert(files.end(), raw_files.begin(), raw_files.end());
+    for (const auto& file : files) {
+      if (deleted_raw_files.count(file->path()) == 0) {
+        presence_filter.add(LruIndex::name_from_path(cache_dir, file->path()));
+      }
+    }
+    presence_filter.end_rebuild();
+  }
+
+  update_counters(subdir, files_in_cache, cache_size, cleaned);
+}
+
+// Like Util::for_each_level_1_subdir but record the visited subdirectories in a
+// checkpoint file in the cache directory. If `operation` is interrupted,
+// running it again skips the subdirectories that were already visited.
+static void
+for_each_level_1_subdir_resumable(
+  const Config& config,
+  const std::string& operation,
+  const Util::SubdirVisitor& visitor,
+  const Util::ProgressReceiver& progress_receiver)
+{
+  const auto checkpoint_path =
+    FMT("{}/{}", config.cache_dir(), k_checkpoint_file_name);
+  std::unordered_set<std::string> visited;
+  try {
+    const auto lines =
+      Util::split_into_strings(Util::read_file(checkpoint_path), "\n");
+    if (!lines.empty() && lines[0] == operation) {
+      visited.insert(lines.begin() + 1, lines.end());
+      LOG("Resuming {} with {} subdirectories already done",
+          operation,
+          visited.size());
+    }
+  } catch (const Error&) {
+    // No checkpoint.
+  }
+
+  std::mutex mutex;
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      const std::string name(Util::base_name(subdir));
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (visited.count(name) > 0) {
+          sub_progress_receiver(1.0);
+          return;
+        }
+      }
+
+      visitor(subdir, sub_progress_receiver);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      visited.insert(name);
+      try {
+        AtomicFile checkpoint(checkpoint_path, AtomicFile::Mode::text);
+        checkpoint.write(operation + "\n");
+        for (const auto& visited_name : visited) {
+          checkpoint.write(visited_name + "\n");
+        }
+        checkpoint.commit();
+      } catch (const Error& e) {
+        LOG("Failed to write {}: {}", checkpoint_path, e.what());
+      }
+    },
+    progress_receiver,
+    config.maintenance_jobs());
+
+  Util::unlink_safe(checkpoint_path, Util::UnlinkLog::ignore_failure);
+}
+
 void
 clean_old(const Context& ctx,
           const Util::ProgressReceiver& progress_receiver,
           uint64_t max_age)
 {
-  Util::for_each_level_1_subdir(
-    ctx.config.cache_dir(),
+  for_each_level_1_subdir_resumable(
+    ctx.config,
+    FMT("evict-older-than {}", max_age),
     [&](const std::string& subdir,
         const Util::ProgressReceiver& sub_progress_receiver) {
       clean_up_dir(subdir, 0, 0, max_age, sub_progress_receiver);
@@ -86,10 +659,50 @@ clean_up_dir(const std::string& subdir,
              uint64_t max_size,
              uint64_t max_files,
              uint64_t max_age,
-             const Util::ProgressReceiver& progress_receiver)
+             const Util::ProgressReceiver& progress_receiver,
+             bool use_index,
+             uint32_t sample_size,
+             bool cost_aware,
+             const std::string& namespace_tag,
+             uint64_t namespace_max_size)
 {
   LOG("Cleaning up cache directory {}", subdir);
 
+  // An existing presence filter is rebuilt from the entries that are kept.
+  // Entries stored from now on are added by the storing processes.
+  PresenceFilter presence_filter(subdir, false);
+  if (presence_filter) {
+    presence_filter.begin_rebuild();
+  }
+
+  LruIndex index(subdir);
+  const bool index_loaded = index.load();
+  // Only the index knows which namespace stored a file.
+  const auto pins = get_pinned_namespaces(std::string(Util::dir_name(subdir)));
+  if ((use_index || !pins.empty()) && index_loaded) {
+    clean_up_dir_using_index(subdir,
+                             index,
+                             presence_filter,
+                             max_size,
+                             max_files,
+                             max_age,
+                             progress_receiver,
+                             cost_aware,
+                             namespace_tag,
+                             namespace_max_size,
+                             pins);
+    return;
+  }
+  if (sample_size != 0) {
+    clean_up_dir_by_sampling(subdir,
+                             presence_filter,
+                             max_size,
+                             max_files,
+                             sample_size,
+                             progress_receiver);
+    return;
+  }
+
   std::vector<std::shared_ptr<CacheFile>> files;
   Util::get_level_1_files(
     subdir, [&](double progress) { progress_receiver(progress / 3); }, files);
@@ -97,6 +710,7 @@ clean_up_dir(const std::string& subdir,
   uint64_t cache_size = 0;
   uint64_t files_in_cache = 0;
   time_t current_time = time(nullptr);
+  std::unordered_map<std::string, time_t> result_mtimes;
 
   for (size_t i = 0; i < files.size();
        ++i, progress_receiver(1.0 / 3 + 1.0 * i / files.size() / 3)) {
@@ -116,34 +730,88 @@ clean_up_dir(const std::string& subdir,
 
     cache_size += file->lstat().size_on_disk();
     files_in_cache += 1;
+    if (Util::ends_with(file->path(), Result::k_file_suffix)) {
+      result_mtimes.emplace(file->path(), file->lstat().mtime());
+    }
   }
 
-  // Sort according to modification time, oldest first.
-  std::sort(files.begin(),
-            files.end(),
-            [](const std::shared_ptr<CacheFile>& f1,
-               const std::shared_ptr<CacheFile>& f2) {
-              return f1->lstat().mtime() < f2->lstat().mtime();
-            });
+  // A result and its raw files are only useful together, so raw files are aged
+  // as their result and evicted together with it.
+  std::unordered_map<std::string, std::string> raw_file_owners;
+  for (const auto& file : files) {
+    auto owner =
+      owner_of_raw_file(file->path(), [&](const std::string& path) {
+        return result_mtimes.count(path) != 0;
+      });
+    if (owner != file->path()) {
+      raw_file_owners.emplace(file->path(), std::move(owner));
+    }
+  }
+  const auto unit_of = [&](const CacheFile& file) -> const std::string& {
+    const auto owner = raw_file_owners.find(file.path());
+    return owner != raw_file_owners.end() ? owner->second : file.path();
+  };
+  const auto unit_mtime = [&](const CacheFile& file) {
+    const auto result = result_mtimes.find(unit_of(file));
+    return result != result_mtimes.end() ? result->second
+                                         : file.lstat().mtime();
+  };
+
+  // With only an age limit, each file can be judged on its own, so the files
+  // don't need to be sorted.
+  const bool age_limit_only = max_size == 0 && max_files == 0;
+  if (!age_limit_only) {
+    // Sort according to modification time, oldest first, then results before
+    // their raw files.
+    std::sort(files.begin(),
+              files.end(),
+              [&](const std::shared_ptr<CacheFile>& f1,
+                  const std::shared_ptr<CacheFile>& f2) {
+                const auto mtime1 = unit_mtime(*f1);
+                const auto mtime2 = unit_mtime(*f2);
+                const bool raw1 = raw_file_owners.count(f1->path()) != 0;
+                const bool raw2 = raw_file_owners.count(f2->path()) != 0;
+                return std::tie(mtime1, unit_of(*f1), raw1)
+                       < std::tie(mtime2, unit_of(*f2), raw2);
+              });
+  }
 
   LOG("Before cleanup: {:.0f} KiB, {:.0f} files",
       static_cast<double>(cache_size) / 1024,
       static_cast<double>(files_in_cache));
 
+  const std::string cache_dir(Util::dir_name(subdir));
+  NamespaceEvictions namespace_evictions;
+  const auto add_eviction = [&](const std::string& path) {
+    const auto entry =
+      index.entries().find(LruIndex::name_from_path(cache_dir, path));
+    if (entry != index.entries().end()) {
+      add_namespace_eviction(namespace_evictions, entry->second);
+    }
+  };
+
+  std::unordered_set<std::string> deleted_raw_files;
+  std::vector<std::shared_ptr<CacheFile>> kept_files;
   bool cleaned = false;
-  for (size_t i = 0; i < files.size();
+  size_t i = 0;
+  for (; i < files.size();
        ++i, progress_receiver(2.0 / 3 + 1.0 * i / files.size() / 3)) {
     const auto& file = files[i];
 
-    if (!file->lstat() || file->lstat().is_directory()) {
+    if (!file->lstat() || file->lstat().is_directory()
+        || deleted_raw_files.count(file->path()) > 0) {
       continue;
     }
 
     if ((max_size == 0 || cache_size <= max_size)
         && (max_files == 0 || files_in_cache <= max_files)
         && (max_age == 0
-            || file->lstat().mtime()
+            || unit_mtime(*file)
                  > (current_time - static_cast<int64_t>(max_age)))) {
+      if (age_limit_only) {
+        kept_files.push_back(file);
+        continue;
+      }
       break;
     }
 
@@ -168,9 +836,64 @@ clean_up_dir(const std::string& subdir,
 
     delete_file(
       file->path(), file->lstat().size_on_disk(), &cache_size, &files_in_cache);
+    add_eviction(file->path());
+    for (auto& raw_file : delete_raw_files_of_result(
+           file->path(), &cache_size, &files_in_cache)) {
+      add_eviction(raw_file);
+      deleted_raw_files.insert(std::move(raw_file));
+    }
     cleaned = true;
   }
 
+  // Rebuild the LRU index from the remaining files, keeping what a previous
+  // index knew about them.
+  std::unordered_map<std::string, LruIndex::Entry> previous_entries;
+  previous_entries.swap(index.entries());
+  kept_files.insert(kept_files.end(), files.begin() + i, files.end());
+  for (const auto& file : kept_files) {
+    if (file->lstat().is_regular()
+        && Util::base_name(file->path()).find(".tmp.") == std::string::npos
+        && deleted_raw_files.count(file->path()) == 0) {
+      const auto name = LruIndex::name_from_path(cache_dir, file->path());
+      if (presence_filter) {
+        presence_filter.add(name);
+      }
+      const auto previous = previous_entries.find(name);
+      auto& entry = index.entries()[name];
+      if (previous != previous_entries.end()) {
+        entry = previous->second;
+      }
+      entry.time = file->lstat().mtime();
+      entry.size = file->lstat().size_on_disk();
+      if (entry.file_size != file->lstat().size()) {
+        // Changed without a store record, e.g. by appending to a manifest.
+        entry.file_size = 0;
+        entry.content_size = 0;
+      }
+    }
+  }
+  // Packed entries are left to cleanups using the index, so they are only
+  // counted and kept in the index.
+  for (const auto& packed : get_packed_entries(subdir, files)) {
+    if (presence_filter) {
+      presence_filter.add(packed.first);
+    }
+    const auto previous = previous_entries.find(packed.first);
+    auto& entry = index.entries()[packed.first];
+    entry = previous != previous_entries.end() ? previous->second
+                                               : packed.second;
+    entry.size = packed.second.size;
+    cache_size += entry.size;
+    files_in_cache += 1;
+  }
+  if (presence_filter) {
+    presence_filter.end_rebuild();
+  }
+  if (Stat::stat(subdir)) {
+    index.save();
+  }
+  update_namespace_counters(subdir, namespace_evictions);
+
   LOG("After cleanup: {:.0f} KiB, {:.0f} files",
       static_cast<double>(cache_size) / 1024,
       static_cast<double>(files_in_cache));
@@ -187,6 +910,8 @@ void
 clean_up_all(const Config& config,
              const Util::ProgressReceiver& progress_receiver)
 {
+  // Cost-aware eviction needs the costs recorded in the LRU index.
+  const bool cost_aware = config.cleanup_policy() == "gdsf";
   Util::for_each_level_1_subdir(
     config.cache_dir(),
     [&](const std::string& subdir,
@@ -195,9 +920,279 @@ clean_up_all(const Config& config,
                    config.max_size() / 16,
                    config.max_files() / 16,
                    0,
-                   sub_progress_receiver);
+                   sub_progress_receiver,
+                   cost_aware,
+                   0,
+                   cost_aware);
+      pack_dir(subdir, config.pack_max_file_size());
     },
-    progress_receiver);
+    progress_receiver,
+    config.maintenance_jobs());
+}
+
+void
+pack_dir(const std::string& subdir, uint64_t max_file_size)
+{
+  const auto pack_path = FMT("{}/{}", subdir, Storage::k_pack_file_name);
+  const auto pack_stat = Stat::stat(pack_path);
+  if (!pack_stat && max_file_size == 0) {
+    return;
+  }
+  std::unique_ptr<CacheBundle> pack;
+  if (pack_stat) {
+    pack = std::make_unique<CacheBundle>(pack_path);
+  }
+
+  LruIndex index(subdir);
+  const bool index_loaded = index.load();
+  if (!index_loaded && max_file_size != 0) {
+    LOG("Not packing {} since it has no LRU index", subdir);
+    return;
+  }
+  auto& entries = index.entries();
+
+  const std::string cache_dir(Util::dir_name(subdir));
+  const auto level = Storage::read_cache_level(subdir);
+  const time_t current_time = time(nullptr);
+  int64_t size_change = 0;
+  bool changed = pack && !*pack;
+  uint64_t moved = 0;
+  std::vector<CacheBundle::File> files;
+  std::unordered_set<std::string> packed_names;
+
+  for (uint64_t i = 0; pack && *pack && i < pack->size(); ++i) {
+    std::string name(pack->name(i));
+    const auto data = pack->data(i);
+    const auto entry = entries.find(name);
+    if (!data || (index_loaded && entry == entries.end())) {
+      // Evicted.
+      changed = true;
+      continue;
+    }
+
+    Stat stat;
+    if (max_file_size == 0) {
+      if (find_cache_file(cache_dir, name, stat).empty()) {
+        const auto path = Util::get_path_in_cache(
+          cache_dir, level ? *level : Storage::k_min_cache_levels, name);
+        Storage::unpack_file(cache_dir, path, *data);
+        stat = Stat::lstat(path);
+      }
+    } else if ((entry->second.time <= pack_stat.mtime()
+                && entry->second.size == data->size())
+               || find_cache_file(cache_dir, name, stat).empty()) {
+      // Still packed. Only entries used since the pack was written or sized
+      // by a scan that found a loose file may have been unpacked.
+      packed_names.insert(name);
+      files.push_back({std::move(name), {}, data});
+      continue;
+    }
+
+    // The loose file takes over.
+    if (entry != entries.end() && stat) {
+      size_change += static_cast<int64_t>(stat.size_on_disk())
+                     - static_cast<int64_t>(entry->second.size);
+      entry->second.size = stat.size_on_disk();
+    }
+    changed = true;
+  }
+
+  // Loose files to pack and their status when they were picked.
+  std::vector<std::pair<std::string, Stat>> loose_files;
+  for (const auto& entry : entries) {
+    const auto& name = entry.first;
+    if (max_file_size == 0
+        || entry.second.time > current_time - k_pack_min_age
+        || entry.second.file_size > max_file_size
+        || packed_names.count(name) != 0
+        || !(Util::ends_with(name, Manifest::k_file_suffix)
+             || Util::ends_with(name, Result::k_file_suffix))
+        // Raw files are kept next to their result.
+        || entries.count(Result::get_raw_file_path(name, 0)) != 0) {
+      continue;
+    }
+    Stat stat;
+    auto path = find_cache_file(cache_dir, name, stat);
+    if (path.empty() || !stat.is_regular() || stat.size() > max_file_size
+        || stat.mtime() > current_time - k_pack_min_age
+        || (Util::ends_with(name, Result::k_file_suffix)
+            && Stat::lstat(Result::get_raw_file_path(path, 0)))) {
+      continue;
+    }
+    files.push_back({name, path, nonstd::nullopt});
+    loose_files.emplace_back(std::move(path), stat);
+  }
+
+  if (!changed && loose_files.empty()) {
+    return;
+  }
+
+  uint64_t packed = 0;
+  if (files.empty()) {
+    Util::unlink_safe(pack_path);
+  } else {
+    std::sort(files.begin(),
+              files.end(),
+              [](const CacheBundle::File& f1, const CacheBundle::File& f2) {
+                return f1.name < f2.name;
+              });
+    try {
+      packed = CacheBundle::write_files(pack_path, files, [](double) {});
+    } catch (const Error& e) {
+      LOG("Failed to write {}: {}", pack_path, e.what());
+      return;
+    }
+  }
+
+  // The loose files are removed unless they have changed since they were
+  // picked, in which case they shadow their packed copies.
+  if (!loose_files.empty()) {
+    CacheBundle new_pack(pack_path);
+    for (const auto& loose_file : loose_files) {
+      const auto& path = loose_file.first;
+      const auto name = LruIndex::name_from_path(cache_dir, path);
+      const auto data = new_pack ? new_pack.get(name) : nonstd::nullopt;
+      const auto stat = Stat::lstat(path);
+      if (!data || stat.mtime() != loose_file.second.mtime()
+          || stat.size() != loose_file.second.size()
+          || !Util::unlink_safe(path)) {
+        continue;
+      }
+      auto& entry = entries[name];
+      size_change += static_cast<int64_t>(data->size())
+                     - static_cast<int64_t>(entry.size);
+      entry.size = data->size();
+      ++moved;
+    }
+  }
+
+  if (index_loaded) {
+    index.save();
+  }
+  if (size_change != 0) {
+    Statistics::update(cache_dir, subdir + "/stats", [=](Counters& cs) {
+      cs.increment(Statistic::cache_size_kibibyte, size_change / 1024);
+    });
+  }
+  if (files.empty()) {
+    LOG("Removed the pack of {}", subdir);
+  } else {
+    LOG("Packed {} files in {}, {} in total", moved, subdir, packed);
+  }
+}
+
+void
+pin_namespace(const Config& config, const std::string& ns, uint64_t max_size)
+{
+  auto pins = get_pinned_namespaces(config.cache_dir());
+  if (max_size == 0) {
+    pins.erase(ns);
+  } else {
+    pins[ns] = max_size;
+  }
+
+  const auto path = FMT("{}/{}", config.cache_dir(), k_pins_file_name);
+  if (pins.empty()) {
+    Util::unlink_safe(path, Util::UnlinkLog::ignore_failure);
+    return;
+  }
+  Util::ensure_dir_exists(config.cache_dir());
+  AtomicFile file(path, AtomicFile::Mode::text);
+  for (const auto& pin : pins) {
+    file.write(FMT("{} {}\n", pin.second, pin.first));
+  }
+  file.commit();
+}
+
+std::map<std::string, uint64_t>
+get_pinned_namespaces(const std::string& cache_dir)
+{
+  std::map<std::string, uint64_t> pins;
+  const auto path = FMT("{}/{}", cache_dir, k_pins_file_name);
+  std::string data;
+  try {
+    data = Util::read_file(path);
+  } catch (const Error&) {
+    // Nothing is pinned.
+    return pins;
+  }
+  for (const auto& line : Util::split_into_strings(data, "\n")) {
+    const auto space = line.find(' ');
+    try {
+      pins[line.substr(space + 1)] =
+        Util::parse_unsigned(line.substr(0, space));
+    } catch (const Error& e) {
+      LOG("Ignoring malformed line in {}: {}", path, e.what());
+    }
+  }
+  return pins;
+}
+
+void
+rebalance_dir(const std::string& subdir,
+              uint8_t level,
+              const Util::ProgressReceiver& progress_receiver)
+{
+  std::vector<std::shared_ptr<CacheFile>> files;
+  Util::get_level_1_files(
+    subdir,
+    [&](double progress) { progress_receiver(progress / 2); },
+    files,
+    false);
+
+  if (level == 0) {
+    level = Storage::wanted_cache_level(files.size());
+  }
+  LOG("Rebalancing cache directory {} to cache level {}", subdir, level);
+
+  // Record the level first so that entries stored during the rebalancing end
+  // up on the new level.
+  try {
+    Storage::write_cache_level(subdir, level);
+  } catch (const Error& e) {
+    LOG("Failed to record cache level in {}: {}", subdir, e.what());
+    return;
+  }
+
+  const std::string cache_dir(Util::dir_name(subdir));
+  for (size_t i = 0; i < files.size(); ++i) {
+    progress_receiver(0.5 + 0.5 * i / files.size());
+
+    // Only move finished cache entries, not e.g. temporary files or locks.
+    const auto& path = files[i]->path();
+    const auto name = LruIndex::name_from_path(cache_dir, path);
+    if (name.length() <= level
+        || !std::all_of(name.begin(), name.end(), [](char c) {
+             return isalnum(static_cast<unsigned char>(c));
+           })) {
+      continue;
+    }
+
+    const auto wanted_path = Util::get_path_in_cache(cache_dir, level, name);
+    if (path == wanted_path) {
+      continue;
+    }
+    try {
+      Util::ensure_dir_exists(Util::dir_name(wanted_path));
+      Util::rename(path, wanted_path);
+    } catch (const Error&) {
+      // Another process may have moved or removed the file.
+    }
+  }
+}
+
+void
+rebalance_all(const Config& config,
+              const Util::ProgressReceiver& progress_receiver)
+{
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      rebalance_dir(subdir, 0, sub_progress_receiver);
+    },
+    progress_receiver,
+    config.maintenance_jobs());
 }
 
 // Wipe one cache subdirectory.
@@ -207,16 +1202,40 @@ wipe_dir(const std::string& subdir,
 {
   LOG("Clearing out cache directory {}", subdir);
 
+  PresenceFilter presence_filter(subdir, false);
+  if (presence_filter) {
+    presence_filter.begin_rebuild();
+  }
+
+  // The files are removed regardless of their metadata, so don't stat them.
   std::vector<std::shared_ptr<CacheFile>> files;
   Util::get_level_1_files(
-    subdir, [&](double progress) { progress_receiver(progress / 2); }, files);
+    subdir,
+    [&](double progress) { progress_receiver(progress / 2); },
+    files,
+    false);
 
+  const std::string cache_dir(Util::dir_name(subdir));
   for (size_t i = 0; i < files.size(); ++i) {
-    Util::unlink_safe(files[i]->path());
+    if (!Util::unlink_safe(files[i]->path()) && presence_filter) {
+      presence_filter.add(
+        LruIndex::name_from_path(cache_dir, files[i]->path()));
+    }
     progress_receiver(0.5 + 0.5 * i / files.size());
   }
+  const bool pack_removed = Util::unlink_safe(
+    FMT("{}/{}", subdir, Storage::k_pack_file_name),
+    Util::UnlinkLog::ignore_failure);
+  if (presence_filter) {
+    presence_filter.end_rebuild();
+  }
 
-  const bool cleared = !files.empty();
+  if (Stat::stat(subdir)) {
+    // Write an empty index.
+    LruIndex(subdir).save();
+  }
+
+  const bool cleared = !files.empty() || pack_removed;
   if (cleared) {
     LOG("Cleared out cache directory {}", subdir);
   }
@@ -227,9 +1246,333 @@ wipe_dir(const std::string& subdir,
 void
 wipe_all(const Context& ctx, const Util::ProgressReceiver& progress_receiver)
 {
-  Util::for_each_level_1_subdir(
-    ctx.config.cache_dir(), wipe_dir, progress_receiver);
+  for_each_level_1_subdir_resumable(
+    ctx.config, "clear", wipe_dir, progress_receiver);
+  Util::wipe_path(FMT("{}/namespaces", ctx.config.cache_dir()));
+  ctx.digest_memo.clear();
 #ifdef INODE_CACHE_SUPPORTED
   ctx.inode_cache.drop();
 #endif
 }
+
+namespace {
+
+// Reads all entries of a result without doing anything with them.
+class NullConsumer : public Result::Reader::Consumer
+{
+public:
+  void
+  on_header(CacheEntryReader& /*cache_entry_reader*/) override
+  {
+  }
+
+  void
+  on_entry_start(uint32_t /*entry_number*/,
+                 Result::FileType /*file_type*/,
+                 uint64_t /*file_len*/,
+                 nonstd::optional<std::string> /*raw_file*/) override
+  {
+  }
+
+  void
+  on_entry_data(const uint8_t* /*data*/, size_t /*size*/) override
+  {
+  }
+
+  void
+  on_entry_end() override
+  {
+  }
+};
+
+} // namespace
+
+ScrubResult
+scrub_all(const Config& config, const Util::ProgressReceiver& progress_receiver)
+{
+  // Scrubbing reads the whole cache, so leave the I/O and CPU to compilations.
+  Util::lower_process_priority();
+
+  std::atomic<uint64_t> verified(0);
+  std::atomic<uint64_t> removed(0);
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      std::vector<std::shared_ptr<CacheFile>> files;
+      Util::get_level_1_files(
+        subdir,
+        [&](double progress) { sub_progress_receiver(0.1 * progress); },
+        files);
+
+      int64_t removed_files = 0;
+      int64_t removed_kibibyte = 0;
+      for (size_t i = 0; i < files.size(); ++i) {
+        sub_progress_receiver(0.1 + 0.9 * i / files.size());
+        const auto& path = files[i]->path();
+        if (files[i]->type() != CacheFile::Type::result) {
+          continue;
+        }
+        // Already verified results are verified again to detect corruption
+        // that happened since.
+        File file(path, "rb");
+        if (!file) {
+          continue;
+        }
+
+        NullConsumer consumer;
+        const auto error =
+          Result::Reader(path, config.cache_dir()).read(consumer);
+        if (!error) {
+          CacheEntryReader::mark_scrubbed(fileno(file.get()));
+          ++verified;
+          continue;
+        }
+        if (!Stat::lstat(path)) {
+          // Removed by another process.
+          continue;
+        }
+
+        LOG("Removing corrupt result {}: {}", path, *error);
+        std::vector<std::string> paths{path};
+        for (uint8_t j = 0; j < Result::k_max_entries; ++j) {
+          paths.push_back(Result::get_raw_file_path(path, j));
+        }
+        for (const auto& p : paths) {
+          const auto stat = Stat::lstat(p);
+          if (stat && Util::unlink_safe(p)) {
+            ++removed_files;
+            removed_kibibyte += stat.size_on_disk() / 1024;
+          }
+        }
+        ++removed;
+      }
+
+      if (removed_files > 0) {
+        Statistics::update(
+          config.cache_dir(), subdir + "/stats", [=](Counters& cs) {
+            cs.increment(Statistic::files_in_cache, -removed_files);
+            cs.increment(Statistic::cache_size_kibibyte, -removed_kibibyte);
+          });
+      }
+    },
+    progress_receiver,
+    config.maintenance_jobs());
+
+  ScrubResult result;
+  result.verified = verified;
+  result.removed = removed;
+  return result;
+}
+
+MigrationResult
+migrate_all(const Config& config,
+            const Util::ProgressReceiver& progress_receiver)
+{
+  std::atomic<uint64_t> upgraded(0);
+  std::atomic<uint64_t> failed(0);
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      std::vector<std::shared_ptr<CacheFile>> files;
+      Util::get_level_1_files(
+        subdir,
+        [&](double progress) { sub_progress_receiver(0.1 * progress); },
+        files);
+
+      int64_t size_change_kibibyte = 0;
+      for (size_t i = 0; i < files.size(); ++i) {
+        sub_progress_receiver(0.1 + 0.9 * i / files.size());
+        const auto& file = files[i];
+        if (file->type() != CacheFile::Type::manifest) {
+          continue;
+        }
+        try {
+          if (Manifest::upgrade(config, file->path())) {
+            const auto new_stat = Stat::lstat(file->path(), Stat::OnError::log);
+            size_change_kibibyte +=
+              (static_cast<int64_t>(new_stat.size_on_disk())
+               - static_cast<int64_t>(file->lstat().size_on_disk()))
+              / 1024;
+            ++upgraded;
+          }
+        } catch (const Error& e) {
+          LOG("Failed to upgrade {}: {}", file->path(), e.what());
+          ++failed;
+        }
+      }
+
+      if (size_change_kibibyte != 0) {
+        Statistics::update(
+          config.cache_dir(), subdir + "/stats", [=](Counters& cs) {
+            cs.increment(Statistic::cache_size_kibibyte, size_change_kibibyte);
+          });
+      }
+    },
+    progress_receiver,
+    config.maintenance_jobs());
+
+  MigrationResult result;
+  result.upgraded = upgraded;
+  result.failed = failed;
+  return result;
+}
+
+#ifndef _WIN32
+
+// Clean up subdirectories with a cleanup marker until there are none left.
+// `lock_fd` is locked on entry.
+static void
+clean_up_marked_dirs(const std::string& cache_dir,
+                     int lock_fd,
+                     uint64_t max_size,
+                     uint64_t max_files,
+                     uint32_t sample_size,
+                     bool cost_aware,
+                     const std::string& namespace_tag,
+                     uint64_t namespace_max_size,
+                     uint64_t pack_max_file_size)
+{
+  while (true) {
+    bool found_marker;
+    do {
+      found_marker = false;
+      for (int i = 0; i <= 0xF; ++i) {
+        const auto subdir = FMT("{}/{:x}", cache_dir, i);
+        // Remove the marker first so that a cleanup requested while cleaning
+        // up is not lost.
+        if (unlink(FMT("{}/{}", subdir, k_cleanup_marker_name).c_str())
+            == 0) {
+          found_marker = true;
+          CleanupLease lease(subdir);
+          if (!lease.acquired()) {
+            continue;
+          }
+          clean_up_dir(subdir,
+                       max_size,
+                       max_files,
+                       0,
+                       [](double /*progress*/) {},
+                       true,
+                       sample_size,
+                       cost_aware,
+                       namespace_tag,
+                       namespace_max_size);
+          pack_dir(subdir, pack_max_file_size);
+        }
+      }
+    } while (found_marker);
+
+    flock(lock_fd, LOCK_UN);
+
+    // A marker created after the last check but before the lock was released
+    // was left for us by a process that failed to get the lock.
+    bool marker_left = false;
+    for (int i = 0; i <= 0xF && !marker_left; ++i) {
+      marker_left =
+        Stat::lstat(FMT("{}/{:x}/{}", cache_dir, i, k_cleanup_marker_name));
+    }
+    if (!marker_left || flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+      return;
+    }
+  }
+}
+
+#endif
+
+bool
+clean_up_dir_in_background(const std::string& subdir,
+                           uint64_t max_size,
+                           uint64_t max_files,
+                           uint32_t sample_size,
+                           bool cost_aware,
+                           const std::string& namespace_tag,
+                           uint64_t namespace_max_size,
+                           uint64_t pack_max_file_size)
+{
+#ifdef _WIN32
+  (void)subdir;
+  (void)max_size;
+  (void)max_files;
+  (void)sample_size;
+  (void)cost_aware;
+  (void)namespace_tag;
+  (void)namespace_max_size;
+  (void)pack_max_file_size;
+  return false;
+#else
+  const auto marker_path = FMT("{}/{}", subdir, k_cleanup_marker_name);
+  Fd marker_fd(open(marker_path.c_str(), O_WRONLY | O_CREAT, 0666));
+  if (!marker_fd) {
+    LOG("Failed to create {}: {}", marker_path, strerror(errno));
+    return false;
+  }
+  marker_fd.close();
+
+  const std::string cache_dir(Util::dir_name(subdir));
+  const auto lock_path = FMT("{}/cleanup.lock", cache_dir);
+  Fd lock_fd(open(lock_path.c_str(), O_RDWR | O_CREAT, 0666));
+  if (!lock_fd) {
+    LOG("Failed to open {}: {}", lock_path, strerror(errno));
+    return false;
+  }
+  if (flock(*lock_fd, LOCK_EX | LOCK_NB) != 0) {
+    if (errno == EWOULDBLOCK) {
+      LOG_RAW("Background cleanup is already running");
+      return true;
+    }
+    LOG("Failed to lock {}: {}", lock_path, strerror(errno));
+    return false;
+  }
+
+  // The cleanup process keeps the token until it's done.
+  Jobserver::Tokens token(1);
+  if (token.count() == 0) {
+    LOG_RAW("No jobserver token available for background cleanup");
+    return false;
+  }
+
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+    return false;
+  }
+  if (pid > 0) {
+    // The lock is shared with the child and stays held until the child is
+    // done, even though our descriptor is closed.
+    LOG("Started background cleanup process {}", pid);
+    token.forget();
+    return true;
+  }
+
+  // Detach from the build system, which may wait for the standard streams to
+  // be closed.
+  setsid();
+  Fd null_fd(open("/dev/null", O_RDWR));
+  if (null_fd) {
+    dup2(*null_fd, STDIN_FILENO);
+    dup2(*null_fd, STDOUT_FILENO);
+    dup2(*null_fd, STDERR_FILENO);
+  }
+  Util::lower_process_priority();
+
+  try {
+    clean_up_marked_dirs(cache_dir,
+                         *lock_fd,
+                         max_size,
+                         max_files,
+                         sample_size,
+                         cost_aware,
+                         namespace_tag,
+                         namespace_max_size,
+                         pack_max_file_size);
+  } catch (const ErrorBase& e) {
+    LOG("Error during background cleanup: {}", e.what());
+  }
+  token.release();
+
+  // Don't run any destructors or exit handlers of the original process.
+  _exit(EXIT_SUCCESS);
+#endif
+}
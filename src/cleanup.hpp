@@ -22,6 +22,7 @@
 
 #include "Util.hpp"
 
+#include <map>
 #include <string>
 
 class Config;
@@ -31,14 +32,100 @@ void clean_old(const Context& ctx,
                const Util::ProgressReceiver& progress_receiver,
                uint64_t max_age);
 
+// Clean up one cache subdirectory. If `use_index` is true and the subdirectory
+// has an LRU index, the files to evict are found using the index instead of by
+// scanning the subdirectory. A scan rebuilds the index. Otherwise, if
+// `sample_size` is not 0, the least recently used of `sample_size` random files
+// is evicted repeatedly, starting from the size in the statistics counters.
+// Sampling ignores `max_age`. If `cost_aware` is true, a cleanup using the
+// index evicts the files that save the least compile time per byte first, see
+// LruIndex::Entry::priority. If `namespace_max_size` is not 0, a cleanup using
+// the index also evicts files stored in the namespace with tag `namespace_tag`
+// (see Statistics::namespace_tag) until they take up at most
+// `namespace_max_size` bytes. Files of namespaces pinned with `pin_namespace`
+// are only protected by a cleanup using the index, so the index is then used
+// even if `use_index` is false. Likewise, packed entries (see `pack_dir`) are
+// only evicted by a cleanup using the index; other cleanups keep them.
 void clean_up_dir(const std::string& subdir,
                   uint64_t max_size,
                   uint64_t max_files,
                   uint64_t max_age,
-                  const Util::ProgressReceiver& progress_receiver);
+                  const Util::ProgressReceiver& progress_receiver,
+                  bool use_index = false,
+                  uint32_t sample_size = 0,
+                  bool cost_aware = false,
+                  const std::string& namespace_tag = {},
+                  uint64_t namespace_max_size = 0);
+
+// Mark `subdir` as needing cleanup and make sure that a detached background
+// process with low priority cleans up all marked subdirectories of the cache.
+// Only one such process runs per cache directory. Returns false if the cleanup
+// could not be delegated, in which case the caller should clean up itself.
+// Cleaned up subdirectories are then packed using `pack_max_file_size`, see
+// `pack_dir`.
+bool clean_up_dir_in_background(const std::string& subdir,
+                                uint64_t max_size,
+                                uint64_t max_files,
+                                uint32_t sample_size,
+                                bool cost_aware,
+                                const std::string& namespace_tag,
+                                uint64_t namespace_max_size,
+                                uint64_t pack_max_file_size);
 
 void clean_up_all(const Config& config,
                   const Util::ProgressReceiver& progress_receiver);
 
+// Move the manifests and results (without raw files) in one cache subdirectory
+// that are at most `max_file_size` bytes large and have not been used for an
+// hour into the pack of the subdirectory, see Storage::k_pack_file_name, and
+// drop packed entries that have been evicted or unpacked since the pack was
+// written. Packed entries are found and evicted using the LRU index, so nothing
+// is packed without one. If `max_file_size` is 0, all packed entries are
+// unpacked instead and the pack is removed.
+void pack_dir(const std::string& subdir, uint64_t max_file_size);
+
+// Protect the files stored by compilations in namespace `ns` from eviction,
+// keeping the most recently used ones that fit in `max_size` bytes. A
+// `max_size` of 0 removes the protection.
+void pin_namespace(const Config& config,
+                   const std::string& ns,
+                   uint64_t max_size);
+
+// Get the pinned namespaces of `cache_dir` and their sizes.
+std::map<std::string, uint64_t>
+get_pinned_namespaces(const std::string& cache_dir);
+
+// Move all cache entries in one cache subdirectory to cache level `level` and
+// record the level so that lookups only need to look on that level. If `level`
+// is 0, the level is chosen based on the number of files in the subdirectory.
+void rebalance_dir(const std::string& subdir,
+                   uint8_t level,
+                   const Util::ProgressReceiver& progress_receiver);
+
+void rebalance_all(const Config& config,
+                   const Util::ProgressReceiver& progress_receiver);
+
 void wipe_all(const Context& ctx,
               const Util::ProgressReceiver& progress_receiver);
+
+struct ScrubResult
+{
+  uint64_t verified = 0;
+  uint64_t removed = 0;
+};
+
+// Verify the checksums of all results, mark intact results as verified and
+// remove corrupt ones.
+ScrubResult scrub_all(const Config& config,
+                      const Util::ProgressReceiver& progress_receiver);
+
+struct MigrationResult
+{
+  uint64_t upgraded = 0;
+  uint64_t failed = 0;
+};
+
+// Rewrite all manifests stored in the previous format version in the current
+// one.
+MigrationResult migrate_all(const Config& config,
+                            const Util::ProgressReceiver& progress_receiver);
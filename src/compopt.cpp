@@ -21,6 +21,12 @@
 #include "fmtmacros.hpp"
 
 #include "third_party/fmt/core.h"
+#include "third_party/nonstd/string_view.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 
 // The option it too hard to handle at all.
 #define TOO_HARD (1 << 0)
@@ -45,6 +51,10 @@
 // The option only affects compilation; not passed to the preprocessor.
 #define AFFECTS_COMP (1 << 6)
 
+// The option only affects diagnostics, i.e. which warnings and errors are
+// reported, not the preprocessor output or the generated code.
+#define DIAGNOSTICS_ONLY (1 << 7)
+
 struct CompOpt
 {
   const char* name;
@@ -80,9 +90,10 @@ const CompOpt compopts[] = {
   {"-U", AFFECTS_CPP | TAKES_ARG | TAKES_CONCAT_ARG},
   {"-V", TAKES_ARG},
   {"-Wa,", TAKES_CONCAT_ARG | AFFECTS_COMP},
-  {"-Werror", AFFECTS_COMP}, // don't exit with error when preprocessing
+  // Don't exit with error when preprocessing.
+  {"-Werror", AFFECTS_COMP | DIAGNOSTICS_ONLY},
   {"-Wl,", TAKES_CONCAT_ARG | AFFECTS_COMP},
-  {"-Wno-error", AFFECTS_COMP},
+  {"-Wno-error", AFFECTS_COMP | DIAGNOSTICS_ONLY},
   {"-Xassembler", TAKES_ARG | TAKES_CONCAT_ARG | AFFECTS_COMP},
   {"-Xclang", TAKES_ARG},
   {"-Xlinker", TAKES_ARG | TAKES_CONCAT_ARG | AFFECTS_COMP},
@@ -97,6 +108,8 @@ const CompOpt compopts[] = {
   {"-ccbin", AFFECTS_CPP | TAKES_ARG}, // nvcc
   {"-emit-pch", AFFECTS_COMP},         // Clang
   {"-emit-pth", AFFECTS_COMP},         // Clang
+  {"-ferror-limit=", TAKES_CONCAT_ARG | DIAGNOSTICS_ONLY}, // Clang
+  {"-fmax-errors=", TAKES_CONCAT_ARG | DIAGNOSTICS_ONLY},
   {"-fno-working-directory", AFFECTS_CPP},
   {"-fplugin=libcc1plugin", TOO_HARD}, // interaction with GDB
   {"-frepo", TOO_HARD},
@@ -123,6 +136,8 @@ const CompOpt compopts[] = {
   {"-nostdinc", AFFECTS_CPP},
   {"-nostdinc++", AFFECTS_CPP},
   {"-odir", AFFECTS_CPP | TAKES_ARG}, // nvcc
+  {"-pedantic", DIAGNOSTICS_ONLY},
+  {"-pedantic-errors", DIAGNOSTICS_ONLY},
   {"-pie", AFFECTS_COMP},
   {"-prebind", AFFECTS_COMP},
   {"-preload", AFFECTS_COMP},
@@ -134,48 +149,81 @@ const CompOpt compopts[] = {
   {"-stdlib=", AFFECTS_CPP | TAKES_CONCAT_ARG},
   {"-trigraphs", AFFECTS_CPP},
   {"-u", TAKES_ARG | TAKES_CONCAT_ARG},
+  {"-w", DIAGNOSTICS_ONLY},
 };
 
-static int
-compare_compopts(const void* key1, const void* key2)
+// FNV-1a hash of an option name, used to avoid creating temporary strings when
+// looking up (prefixes of) options.
+struct CompOptNameHash
 {
-  const CompOpt* opt1 = static_cast<const CompOpt*>(key1);
-  const CompOpt* opt2 = static_cast<const CompOpt*>(key2);
-  return strcmp(opt1->name, opt2->name);
-}
+  size_t
+  operator()(nonstd::string_view name) const
+  {
+    uint32_t hash = 2166136261U;
+    for (char c : name) {
+      hash = (hash ^ static_cast<uint8_t>(c)) * 16777619U;
+    }
+    return hash;
+  }
+};
 
-static int
-compare_prefix_compopts(const void* key1, const void* key2)
+// Hash table index of the compopts table, built once on first use.
+struct CompOptIndex
 {
-  const CompOpt* opt1 = static_cast<const CompOpt*>(key1);
-  const CompOpt* opt2 = static_cast<const CompOpt*>(key2);
-  return strncmp(opt1->name, opt2->name, strlen(opt2->name));
+  std::unordered_map<nonstd::string_view, const CompOpt*, CompOptNameHash>
+    options;
+
+  // Distinct lengths of names of options taking a concatenated argument, in
+  // descending order.
+  std::vector<size_t> concat_arg_name_lengths;
+};
+
+static const CompOptIndex&
+get_index()
+{
+  static const CompOptIndex index = [] {
+    CompOptIndex result;
+    result.options.reserve(ARRAY_SIZE(compopts));
+    for (const auto& compopt : compopts) {
+      const nonstd::string_view name(compopt.name);
+      result.options.emplace(name, &compopt);
+      if (compopt.type & TAKES_CONCAT_ARG) {
+        result.concat_arg_name_lengths.push_back(name.length());
+      }
+    }
+    auto& lengths = result.concat_arg_name_lengths;
+    std::sort(lengths.begin(), lengths.end(), std::greater<size_t>());
+    lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+    return result;
+  }();
+  return index;
 }
 
 static const CompOpt*
-find(const std::string& option)
+find(nonstd::string_view option)
 {
-  CompOpt key;
-  key.name = option.c_str();
-  void* result = bsearch(&key,
-                         compopts,
-                         ARRAY_SIZE(compopts),
-                         sizeof(compopts[0]),
-                         compare_compopts);
-  return static_cast<CompOpt*>(result);
+  const auto& options = get_index().options;
+  const auto it = options.find(option);
+  return it != options.end() ? it->second : nullptr;
 }
 
+// Find the option with the longest name that is a prefix of `option`. Only
+// options taking a concatenated argument are considered.
 static const CompOpt*
-find_prefix(const std::string& option)
+find_prefix(nonstd::string_view option)
 {
-  CompOpt key;
-  key.name = option.c_str();
-  void* result = bsearch(&key,
-                         compopts,
-                         ARRAY_SIZE(compopts),
-                         sizeof(compopts[0]),
-                         compare_prefix_compopts);
-  return static_cast<CompOpt*>(result);
+  const auto& index = get_index();
+  for (size_t length : index.concat_arg_name_lengths) {
+    if (length > option.length()) {
+      continue;
+    }
+    const auto it =
+      index.options.find(option.substr(0, length));
+    if (it != index.options.end() && (it->second->type & TAKES_CONCAT_ARG)) {
+      return it->second;
+    }
+  }
+  return nullptr;
 }
 
 // Used by unittest/test_compopt.cpp.
@@ -209,49 +257,49 @@ compopt_verify_sortedness_and_flags()
 }
 
 bool
-compopt_affects_cpp_output(const std::string& option)
+compopt_affects_cpp_output(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & AFFECTS_CPP);
 }
 
 bool
-compopt_affects_compiler_output(const std::string& option)
+compopt_affects_compiler_output(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & AFFECTS_COMP);
 }
 
 bool
-compopt_too_hard(const std::string& option)
+compopt_too_hard(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & TOO_HARD);
 }
 
 bool
-compopt_too_hard_for_direct_mode(const std::string& option)
+compopt_too_hard_for_direct_mode(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & TOO_HARD_DIRECT);
 }
 
 bool
-compopt_takes_path(const std::string& option)
+compopt_takes_path(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & TAKES_PATH);
 }
 
 bool
-compopt_takes_arg(const std::string& option)
+compopt_takes_arg(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & TAKES_ARG);
 }
 
 bool
-compopt_takes_concat_arg(const std::string& option)
+compopt_takes_concat_arg(nonstd::string_view option)
 {
   const CompOpt* co = find(option);
   return co && (co->type & TAKES_CONCAT_ARG);
@@ -260,19 +308,36 @@ compopt_takes_concat_arg(const std::string& option)
 // Determines if the prefix of the option matches any option and affects the
 // preprocessor.
 bool
-compopt_prefix_affects_cpp_output(const std::string& option)
+compopt_prefix_affects_cpp_output(nonstd::string_view option)
 {
   // Prefix options have to take concatenated args.
   const CompOpt* co = find_prefix(option);
-  return co && (co->type & TAKES_CONCAT_ARG) && (co->type & AFFECTS_CPP);
+  return co && (co->type & AFFECTS_CPP);
 }
 
 // Determines if the prefix of the option matches any option and affects the
 // preprocessor.
 bool
-compopt_prefix_affects_compiler_output(const std::string& option)
+compopt_prefix_affects_compiler_output(nonstd::string_view option)
 {
   // Prefix options have to take concatenated args.
   const CompOpt* co = find_prefix(option);
-  return co && (co->type & TAKES_CONCAT_ARG) && (co->type & AFFECTS_COMP);
+  return co && (co->type & AFFECTS_COMP);
+}
+
+bool
+compopt_affects_diagnostics_only(nonstd::string_view option)
+{
+  const CompOpt* co = find(option);
+  if (!co) {
+    co = find_prefix(option);
+  }
+  if (co) {
+    return co->type & DIAGNOSTICS_ONLY;
+  }
+  // Other -W options enable, disable or promote warnings, e.g. -Wshadow,
+  // -Wno-unused or -Werror=format, except for -Wp, which passes options to the
+  // preprocessor. -Wa, and -Wl, are in the table.
+  return option.length() > 2 && option.starts_with("-W")
+         && !option.starts_with("-Wp,");
 }
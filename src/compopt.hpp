@@ -20,16 +20,19 @@
 
 #include "system.hpp"
 
+#include "third_party/nonstd/string_view.hpp"
+
 #include <string>
 
-bool compopt_short(bool (*fn)(const std::string& option),
+bool compopt_short(bool (*fn)(nonstd::string_view option),
                    const std::string& option);
-bool compopt_affects_cpp_output(const std::string& option);
-bool compopt_affects_compiler_output(const std::string& option);
-bool compopt_too_hard(const std::string& option);
-bool compopt_too_hard_for_direct_mode(const std::string& option);
-bool compopt_takes_path(const std::string& option);
-bool compopt_takes_arg(const std::string& option);
-bool compopt_takes_concat_arg(const std::string& option);
-bool compopt_prefix_affects_cpp_output(const std::string& option);
-bool compopt_prefix_affects_compiler_output(const std::string& option);
+bool compopt_affects_cpp_output(nonstd::string_view option);
+bool compopt_affects_compiler_output(nonstd::string_view option);
+bool compopt_too_hard(nonstd::string_view option);
+bool compopt_too_hard_for_direct_mode(nonstd::string_view option);
+bool compopt_takes_path(nonstd::string_view option);
+bool compopt_takes_arg(nonstd::string_view option);
+bool compopt_takes_concat_arg(nonstd::string_view option);
+bool compopt_prefix_affects_cpp_output(nonstd::string_view option);
+bool compopt_prefix_affects_compiler_output(nonstd::string_view option);
+bool compopt_affects_diagnostics_only(nonstd::string_view option);
@@ -21,20 +21,30 @@
 #include "AtomicFile.hpp"
 #include "CacheEntryReader.hpp"
 #include "CacheEntryWriter.hpp"
+#include "Compressor.hpp"
 #include "Context.hpp"
+#include "Decompressor.hpp"
 #include "File.hpp"
+#include "Jobserver.hpp"
 #include "Logging.hpp"
+#include "LruIndex.hpp"
 #include "Manifest.hpp"
 #include "Result.hpp"
 #include "Statistics.hpp"
 #include "StdMakeUnique.hpp"
 #include "ThreadPool.hpp"
 #include "ZstdCompressor.hpp"
+#include "ZstdDictionary.hpp"
 #include "assertions.hpp"
 #include "fmtmacros.hpp"
 
 #include "third_party/fmt/core.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <random>
 #include <string>
 #include <thread>
 
@@ -103,6 +113,50 @@ RecompressionStatistics::incompressible_size() const
   return m_incompressible_size;
 }
 
+// Limits the rate of processed bytes summed over all threads.
+class RateLimiter
+{
+public:
+  // `bytes_per_second` 0 means no limit.
+  explicit RateLimiter(uint64_t bytes_per_second);
+
+  // Account for `bytes` processed bytes and sleep as long as needed to stay
+  // within the limit.
+  void throttle(uint64_t bytes);
+
+private:
+  const uint64_t m_bytes_per_second;
+  const std::chrono::steady_clock::time_point m_start;
+  std::mutex m_mutex;
+  uint64_t m_bytes = 0;
+};
+
+RateLimiter::RateLimiter(uint64_t bytes_per_second)
+  : m_bytes_per_second(bytes_per_second),
+    m_start(std::chrono::steady_clock::now())
+{
+}
+
+void
+RateLimiter::throttle(uint64_t bytes)
+{
+  if (m_bytes_per_second == 0) {
+    return;
+  }
+
+  std::chrono::duration<double> elapsed_when_done;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_bytes += bytes;
+    elapsed_when_done = std::chrono::duration<double>(
+      static_cast<double>(m_bytes) / m_bytes_per_second);
+  }
+  std::this_thread::sleep_until(
+    m_start
+    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      elapsed_when_done));
+}
+
 File
 open_file(const std::string& path, const char* mode)
 {
@@ -150,11 +204,102 @@ create_writer(FILE* stream,
                                             reader.payload_size());
 }
 
+// A compression type and level to evaluate.
+struct CompressionVariant
+{
+  Compression::Type type;
+  int8_t level;
+};
+
+// A cache entry payload to evaluate the compression variants on.
+struct EvaluationSample
+{
+  CacheFile::Type type;
+  std::string payload;
+};
+
+struct EvaluationResult
+{
+  uint64_t content_size = 0;
+  uint64_t compressed_size = 0;
+  double compression_time = 0.0;   // Seconds.
+  double decompression_time = 0.0; // Seconds.
+};
+
+std::vector<CompressionVariant>
+get_compression_variants()
+{
+  std::vector<CompressionVariant> variants;
+  for (int8_t level : {-5, -1, 1, 3, 6, 9, 12, 15, 19}) {
+    variants.push_back({Compression::Type::zstd, level});
+  }
+  if (ZstdDictionary::supported() && ZstdDictionary::current_id() != 0) {
+    for (int8_t level : {1, 3, 9}) {
+      variants.push_back({Compression::Type::zstd_with_dictionary, level});
+    }
+  }
+#ifdef HAVE_LZ4
+  for (int8_t level : {1, 9}) {
+    variants.push_back({Compression::Type::lz4, level});
+  }
+#endif
+  return variants;
+}
+
+// Compress `sample` with `variant` into a temporary file, decompress it again
+// and add the sizes and durations to `result`.
 void
+evaluate_sample(const CompressionVariant& variant,
+                uint32_t dictionary_id,
+                const EvaluationSample& sample,
+                EvaluationResult& result)
+{
+  File file(std::tmpfile());
+  if (!file) {
+    throw Error("failed to create temporary file: {}", strerror(errno));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto compressor = Compressor::create_from_type(
+    variant.type, file.get(), variant.level, dictionary_id);
+  compressor->write(sample.payload.data(), sample.payload.size());
+  compressor->finalize();
+  fflush(file.get());
+  const std::chrono::duration<double> compression_time =
+    std::chrono::steady_clock::now() - start;
+  const auto compressed_size = ftell(file.get());
+  rewind(file.get());
+
+  std::string decompressed(sample.payload.size(), '\0');
+  start = std::chrono::steady_clock::now();
+  auto decompressor =
+    Decompressor::create_from_type(variant.type, file.get(), dictionary_id);
+  decompressor->read(&decompressed[0], decompressed.size());
+  decompressor->finalize();
+  const std::chrono::duration<double> decompression_time =
+    std::chrono::steady_clock::now() - start;
+  if (decompressed != sample.payload) {
+    throw Error("{} level {} did not round-trip",
+                Compression::type_to_string(variant.type),
+                variant.level);
+  }
+
+  result.content_size += sample.payload.size();
+  result.compressed_size += compressed_size;
+  result.compression_time += compression_time.count();
+  result.decompression_time += decompression_time.count();
+}
+
+// Recompress `cache_file` unless it already has the wanted compression, which
+// is found out by only reading the header. Returns the change of the cache
+// size in KiB.
+int64_t
 recompress_file(RecompressionStatistics& statistics,
-                const std::string& stats_file,
+                RateLimiter& rate_limiter,
+                const std::string& cache_dir,
                 const CacheFile& cache_file,
-                optional<int8_t> level)
+                optional<int8_t> level,
+                bool adaptive)
 {
   auto file = open_file(cache_file.path(), "rb");
   auto reader = create_reader(cache_file, file.get());
@@ -164,10 +309,27 @@ recompress_file(RecompressionStatistics& statistics,
   int8_t wanted_level =
     level ? (*level == 0 ? ZstdCompressor::default_compression_level : *level)
           : 0;
+  if (level && adaptive) {
+    wanted_level =
+      Compression::adapt_level(wanted_level, reader->payload_size());
+  }
+
+  // Recompression always produces zstd (with the current dictionary, if any),
+  // so entries of other compression types are converted as well.
+  const uint32_t wanted_dictionary_id =
+    level ? ZstdDictionary::current_id() : 0;
+  Compression::Type wanted_type = Compression::Type::none;
+  if (level) {
+    wanted_type = wanted_dictionary_id != 0
+                    ? Compression::Type::zstd_with_dictionary
+                    : Compression::Type::zstd;
+  }
 
-  if (reader->compression_level() == wanted_level) {
+  if (reader->compression_type() == wanted_type
+      && reader->compression_level() == wanted_level
+      && reader->dictionary_id() == wanted_dictionary_id) {
     statistics.update(content_size, old_stat.size(), old_stat.size(), 0);
-    return;
+    return 0;
   }
 
   LOG("Recompressing {} to {}",
@@ -191,19 +353,24 @@ recompress_file(RecompressionStatistics& statistics,
   reader->finalize();
   writer->finalize();
 
+  if (cache_file.type() == CacheFile::Type::manifest) {
+    // Keep result entries appended to the manifest.
+    atomic_new_file.write(Manifest::read_appended_entries(file.get()));
+  }
+
   file.close();
 
   atomic_new_file.commit();
   auto new_stat = Stat::stat(cache_file.path(), Stat::OnError::log);
 
-  Statistics::update(stats_file, [=](Counters& cs) {
-    cs.increment(Statistic::cache_size_kibibyte,
-                 Util::size_change_kibibyte(old_stat, new_stat));
-  });
+  LruIndex::record_store(
+    cache_dir, cache_file.path(), new_stat.size_on_disk());
 
   statistics.update(content_size, old_stat.size(), new_stat.size(), 0);
+  rate_limiter.throttle(old_stat.size() + new_stat.size());
 
   LOG("Recompression of {} done", cache_file.path());
+  return Util::size_change_kibibyte(old_stat, new_stat);
 }
 
 } // namespace
@@ -216,6 +383,7 @@ compress_stats(const Config& config,
   uint64_t compr_size = 0;
   uint64_t content_size = 0;
   uint64_t incompr_size = 0;
+  std::mutex mutex;
 
   Util::for_each_level_1_subdir(
     config.cache_dir(),
@@ -227,23 +395,45 @@ compress_stats(const Config& config,
         [&](double progress) { sub_progress_receiver(progress / 2); },
         files);
 
+      // The sizes recorded in the LRU index save opening each file to read
+      // its header.
+      LruIndex index(subdir);
+      index.load();
+
+      uint64_t subdir_on_disk_size = 0;
+      uint64_t subdir_compr_size = 0;
+      uint64_t subdir_content_size = 0;
+      uint64_t subdir_incompr_size = 0;
+
       for (size_t i = 0; i < files.size(); ++i) {
         const auto& cache_file = files[i];
-        on_disk_size += cache_file->lstat().size_on_disk();
-
-        try {
-          auto file = open_file(cache_file->path(), "rb");
-          auto reader = create_reader(*cache_file, file.get());
-          compr_size += cache_file->lstat().size();
-          content_size += reader->content_size();
-        } catch (Error&) {
-          incompr_size += cache_file->lstat().size();
+        const auto& st = cache_file->lstat();
+        subdir_on_disk_size += st.size_on_disk();
+
+        const auto entry = index.entries().find(
+          LruIndex::name_from_path(config.cache_dir(), cache_file->path()));
+        const uint64_t file_content_size =
+          entry != index.entries().end() && entry->second.file_size == st.size()
+            ? entry->second.content_size
+            : cache_file->content_size();
+        if (file_content_size > 0) {
+          subdir_compr_size += st.size();
+          subdir_content_size += file_content_size;
+        } else {
+          subdir_incompr_size += st.size();
         }
 
         sub_progress_receiver(1.0 / 2 + 1.0 * i / files.size() / 2);
       }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      on_disk_size += subdir_on_disk_size;
+      compr_size += subdir_compr_size;
+      content_size += subdir_content_size;
+      incompr_size += subdir_incompr_size;
     },
-    progress_receiver);
+    progress_receiver,
+    config.maintenance_jobs());
 
   if (isatty(STDOUT_FILENO)) {
     PRINT_RAW(stdout, "\n\n");
@@ -276,16 +466,194 @@ compress_stats(const Config& config,
   PRINT(stdout, "Incompressible data:   {:>8s}\n", incompr_size_str);
 }
 
+void
+compress_evaluate(const Config& config,
+                  uint32_t sample_count,
+                  const Util::ProgressReceiver& progress_receiver)
+{
+  std::vector<std::shared_ptr<CacheFile>> files;
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      Util::get_level_1_files(subdir, sub_progress_receiver, files);
+    },
+    [&](double progress) { progress_receiver(progress / 4); });
+
+  // Sample entries from the whole cache, not only the first subdirectories.
+  std::shuffle(
+    files.begin(), files.end(), std::mt19937(std::random_device()()));
+
+  std::vector<EvaluationSample> samples;
+  uint64_t total_size = 0;
+  for (size_t i = 0; i < files.size() && samples.size() < sample_count; ++i) {
+    const auto& cache_file = *files[i];
+    if (cache_file.type() == CacheFile::Type::unknown) {
+      continue;
+    }
+    try {
+      auto file = open_file(cache_file.path(), "rb");
+      auto reader = create_reader(cache_file, file.get());
+      EvaluationSample sample{cache_file.type(), std::string()};
+      sample.payload.resize(reader->payload_size());
+      reader->read(&sample.payload[0], sample.payload.size());
+      total_size += sample.payload.size();
+      samples.push_back(std::move(sample));
+    } catch (Error& e) {
+      LOG("Not evaluating {}: {}", cache_file.path(), e.what());
+    }
+  }
+  if (samples.empty()) {
+    throw Error("no cache entries to evaluate");
+  }
+
+  const auto variants = get_compression_variants();
+  const uint32_t dictionary_id = ZstdDictionary::current_id();
+
+  // One result per file type (result and manifest) for each variant.
+  std::vector<std::array<EvaluationResult, 2>> results(variants.size());
+  size_t variants_done = 0;
+  optional<std::string> error;
+  std::mutex mutex;
+  const size_t jobs = config.maintenance_jobs() != 0
+                        ? config.maintenance_jobs()
+                        : std::max(std::thread::hardware_concurrency(), 1u);
+  Jobserver::Tokens tokens(std::min(jobs, variants.size()) - 1);
+  ThreadPool(tokens.count()).for_each_index(variants.size(), [&](size_t i) {
+    try {
+      for (const auto& sample : samples) {
+        const size_t type = sample.type == CacheFile::Type::result ? 0 : 1;
+        evaluate_sample(variants[i], dictionary_id, sample, results[i][type]);
+      }
+    } catch (const Error& e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      error = e.what();
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    progress_receiver(0.25 + 0.75 * ++variants_done / variants.size());
+    return true;
+  });
+  if (error) {
+    throw Error(*error);
+  }
+  progress_receiver(1.0);
+
+  if (isatty(STDOUT_FILENO)) {
+    PRINT_RAW(stdout, "\n\n");
+  }
+
+  const size_t threads = tokens.count() + 1;
+  PRINT(stdout,
+        "Evaluated {} cache entries ({}) with {} thread{}\n",
+        samples.size(),
+        Util::format_human_readable_size(total_size),
+        threads,
+        threads == 1 ? "" : "s");
+  for (size_t type = 0; type < 2; ++type) {
+    if (results[0][type].content_size == 0) {
+      continue;
+    }
+    PRINT(stdout,
+          "\n{:<30s}  Ratio  Compr. MB/s  Decompr. MB/s\n",
+          type == 0 ? "Results" : "Manifests");
+    for (size_t i = 0; i < variants.size(); ++i) {
+      const auto& result = results[i][type];
+      PRINT(stdout,
+            "  {:<28s}  {:>5.3f}  {:>11.1f}  {:>13.1f}\n",
+            FMT("{} level {}",
+                Compression::type_to_string(variants[i].type),
+                variants[i].level),
+            static_cast<double>(result.content_size) / result.compressed_size,
+            result.content_size / 1e6 / result.compression_time,
+            result.content_size / 1e6 / result.decompression_time);
+    }
+  }
+}
+
+void
+compress_train_dictionary(const Config& config,
+                          const Util::ProgressReceiver& progress_receiver)
+{
+  if (!ZstdDictionary::supported()) {
+    throw Error("the zstd library is too old to support dictionaries");
+  }
+
+  // 110 KiB is the dictionary size recommended by the zstd documentation and
+  // about 100 times as much sample data is needed to train it well.
+  const size_t dictionary_size = 110 * 1024;
+  const size_t max_total_sample_size = 100 * dictionary_size;
+  const size_t max_sample_size = 128 * 1024;
+
+  std::vector<std::shared_ptr<CacheFile>> files;
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      Util::get_level_1_files(subdir, sub_progress_receiver, files);
+    },
+    [&](double progress) { progress_receiver(progress / 2); });
+
+  // Sample entries from the whole cache, not only the first subdirectories.
+  std::shuffle(
+    files.begin(), files.end(), std::mt19937(std::random_device()()));
+
+  std::string samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (samples.size() >= max_total_sample_size) {
+      break;
+    }
+    const auto& cache_file = *files[i];
+    if (cache_file.type() == CacheFile::Type::unknown) {
+      continue;
+    }
+    const size_t offset = samples.size();
+    try {
+      auto file = open_file(cache_file.path(), "rb");
+      auto reader = create_reader(cache_file, file.get());
+      const size_t sample_size = std::min<uint64_t>(
+        {reader->payload_size(),
+         max_sample_size,
+         max_total_sample_size - offset});
+      samples.resize(offset + sample_size);
+      reader->read(&samples[offset], sample_size);
+      sample_sizes.push_back(sample_size);
+    } catch (Error& e) {
+      LOG("Not using {} for training: {}", cache_file.path(), e.what());
+      samples.resize(offset);
+    }
+    progress_receiver(0.5 + 0.5 * samples.size() / max_total_sample_size);
+  }
+  progress_receiver(1.0);
+
+  if (isatty(STDOUT_FILENO)) {
+    PRINT_RAW(stdout, "\n\n");
+  }
+
+  const uint32_t id =
+    ZstdDictionary::train(samples, sample_sizes, dictionary_size);
+  PRINT(stdout,
+        "Trained dictionary {:08x} on {} cache entries ({})\n",
+        id,
+        sample_sizes.size(),
+        Util::format_human_readable_size(samples.size()));
+}
+
 void
 compress_recompress(Context& ctx,
                     optional<int8_t> level,
                     const Util::ProgressReceiver& progress_receiver)
 {
-  const size_t threads = std::thread::hardware_concurrency();
-  const size_t read_ahead = 2 * threads;
-  ThreadPool thread_pool(threads, read_ahead);
+  if (ctx.config.recompress_low_priority()) {
+    Util::lower_process_priority();
+  }
+
   RecompressionStatistics statistics;
+  RateLimiter rate_limiter(ctx.config.recompress_rate_limit());
 
+  // Each job streams one file at a time and the statistics counters are
+  // updated once per subdirectory.
   Util::for_each_level_1_subdir(
     ctx.config.cache_dir(),
     [&](const std::string& subdir,
@@ -296,19 +664,22 @@ compress_recompress(Context& ctx,
         [&](double progress) { sub_progress_receiver(0.1 * progress); },
         files);
 
-      auto stats_file = subdir + "/stats";
-
+      int64_t size_change_kibibyte = 0;
       for (size_t i = 0; i < files.size(); ++i) {
         const auto& file = files[i];
 
         if (file->type() != CacheFile::Type::unknown) {
-          thread_pool.enqueue([&statistics, stats_file, file, level] {
-            try {
-              recompress_file(statistics, stats_file, *file, level);
-            } catch (Error&) {
-              // Ignore for now.
-            }
-          });
+          try {
+            size_change_kibibyte +=
+              recompress_file(statistics,
+                              rate_limiter,
+                              ctx.config.cache_dir(),
+                              *file,
+                              level,
+                              ctx.config.adaptive_compression());
+          } catch (Error&) {
+            // Ignore for now.
+          }
         } else {
           statistics.update(0, 0, 0, file->lstat().size());
         }
@@ -316,13 +687,15 @@ compress_recompress(Context& ctx,
         sub_progress_receiver(0.1 + 0.9 * i / files.size());
       }
 
-      if (Util::ends_with(subdir, "f")) {
-        // Wait here instead of after Util::for_each_level_1_subdir to avoid
-        // updating the progress bar to 100% before all work is done.
-        thread_pool.shut_down();
+      if (size_change_kibibyte != 0) {
+        Statistics::update(
+          ctx.config.cache_dir(), subdir + "/stats", [=](Counters& cs) {
+            cs.increment(Statistic::cache_size_kibibyte, size_change_kibibyte);
+          });
       }
     },
-    progress_receiver);
+    progress_receiver,
+    ctx.config.maintenance_jobs());
 
   if (isatty(STDOUT_FILENO)) {
     PRINT_RAW(stdout, "\n\n");
@@ -30,6 +30,18 @@ class Context;
 void compress_stats(const Config& config,
                     const Util::ProgressReceiver& progress_receiver);
 
+// Evaluate the compression ratio and speed of different compression types and
+// levels on `sample_count` randomly picked cache entries and print the results
+// per file type.
+void compress_evaluate(const Config& config,
+                       uint32_t sample_count,
+                       const Util::ProgressReceiver& progress_receiver);
+
+// Train a zstd dictionary on a sample of the cache entries and make it the
+// dictionary to compress new cache entries with.
+void compress_train_dictionary(const Config& config,
+                               const Util::ProgressReceiver& progress_receiver);
+
 // Recompress the cache.
 //
 // Arguments:
@@ -21,7 +21,9 @@
 
 #include "Config.hpp"
 #include "Context.hpp"
+#include "DigestMemo.hpp"
 #include "Fd.hpp"
+#include "Hash.hpp"
 #include "Logging.hpp"
 #include "SignalHandler.hpp"
 #include "Stat.hpp"
@@ -33,11 +35,25 @@
 #  include "Win32Util.hpp"
 #endif
 
+#ifdef HAVE_POSIX_SPAWN
+#  include <spawn.h>
+#endif
+
+#ifdef HAVE_WAIT4
+#  include <sys/resource.h>
+#endif
+
+using nonstd::nullopt;
+using nonstd::optional;
 using nonstd::string_view;
 
 #ifdef _WIN32
 int
-execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* /*pid*/)
+execute(const char* const* argv,
+        Fd&& fd_out,
+        Fd&& fd_err,
+        pid_t* /*pid*/,
+        ProcessUsage* /*usage*/)
 {
   return win32execute(argv[0], argv, 1, fd_out.release(), fd_err.release());
 }
@@ -45,9 +61,15 @@ execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* /*pid*/)
 std::string
 win32getshell(const std::string& path)
 {
+  const std::string extension = Util::to_lowercase(Util::get_extension(path));
+  if (extension == ".exe") {
+    // Fast path for the common case of a native compiler.
+    return {};
+  }
+
   const char* path_env = getenv("PATH");
   std::string sh;
-  if (Util::to_lowercase(Util::get_extension(path)) == ".sh" && path_env) {
+  if (extension == ".sh" && path_env) {
     sh = find_executable_in_path("sh.exe", "", path_env);
   }
   if (sh.empty() && getenv("CCACHE_DETECT_SHEBANG")) {
@@ -108,7 +130,10 @@ win32execute(const char* path,
   std::string args = Win32Util::argv_to_string(argv, sh);
   std::string full_path = Win32Util::add_exe_suffix(path);
   std::string tmp_file_path;
-  if (args.length() > 8192) {
+  // CreateProcess accepts command lines of up to 32767 characters including
+  // the terminating null character, so only fall back to a response file
+  // (which costs creating, writing and removing a file) above that.
+  if (args.length() >= 32767) {
     TemporaryFile tmp_file(path);
     Util::write_fd(*tmp_file.fd, args.data(), args.length());
     args = FMT("\"@{}\"", tmp_file.path);
@@ -153,13 +178,81 @@ win32execute(const char* path,
 
 #else
 
-// Execute a compiler backend, capturing all output to the given paths the full
-// path to the compiler to run is in argv[0].
-int
-execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* pid)
+#ifdef HAVE_POSIX_SPAWN
+// Start argv[0] with posix_spawn, which unlike fork doesn't need to copy the
+// page tables of ccache's address space. Returns false if the process could not
+// be started this way.
+static bool
+posix_spawn_with_fds(const char* const* argv,
+                     int fd_out,
+                     int fd_err,
+                     pid_t* pid)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, fd_err, STDERR_FILENO);
+  if (fd_out > STDERR_FILENO) {
+    posix_spawn_file_actions_addclose(&actions, fd_out);
+  }
+  if (fd_err > STDERR_FILENO && fd_err != fd_out) {
+    posix_spawn_file_actions_addclose(&actions, fd_err);
+  }
+
+  // Signals are blocked while spawning (see below), so explicitly let the
+  // child start with the current signal mask.
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t sigmask;
+  sigprocmask(SIG_SETMASK, nullptr, &sigmask);
+  posix_spawnattr_setsigmask(&attr, &sigmask);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  int result;
+  {
+    SignalHandlerBlocker signal_handler_blocker;
+    result = posix_spawn(pid,
+                         argv[0],
+                         &actions,
+                         &attr,
+                         const_cast<char* const*>(argv),
+                         environ);
+    if (result != 0) {
+      *pid = 0;
+    }
+  }
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (result != 0) {
+    LOG("posix_spawn of {} failed: {}", argv[0], strerror(result));
+    return false;
+  }
+  return true;
+}
+#endif
+
+// Start argv[0], in directory `dir` if non-null.
+static void
+spawn(const char* const* argv,
+      Fd&& fd_out,
+      Fd&& fd_err,
+      pid_t* pid,
+      const char* dir = nullptr)
 {
   LOG("Executing {}", Util::format_argv_for_logging(argv));
 
+#ifdef HAVE_POSIX_SPAWN
+  // posix_spawn can't portably change the working directory.
+  if (!dir && posix_spawn_with_fds(argv, *fd_out, *fd_err, pid)) {
+    fd_out.close();
+    fd_err.close();
+    return;
+  }
+  // Else: Fall back to fork and exec, which reports errors like before.
+#endif
+
   {
     SignalHandlerBlocker signal_handler_blocker;
     *pid = fork();
@@ -175,22 +268,52 @@ execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* pid)
     fd_out.close();
     dup2(*fd_err, STDERR_FILENO);
     fd_err.close();
+    if (dir && chdir(dir) != 0) {
+      exit(EXIT_FAILURE);
+    }
     exit(execv(argv[0], const_cast<char* const*>(argv)));
   }
 
   fd_out.close();
   fd_err.close();
+}
 
+static int
+wait_for_exit(pid_t* pid, ProcessUsage* usage = nullptr)
+{
   int status;
   int result;
 
+#ifdef HAVE_WAIT4
+  struct rusage ru;
+  while ((result = wait4(*pid, &status, 0, &ru)) != *pid) {
+#else
   while ((result = waitpid(*pid, &status, 0)) != *pid) {
+#endif
     if (result == -1 && errno == EINTR) {
       continue;
     }
     throw Fatal("waitpid failed: {}", strerror(errno));
   }
 
+#ifdef HAVE_WAIT4
+  if (usage) {
+    usage->cpu_time_us =
+      (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * UINT64_C(1000000)
+      + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#  ifdef __APPLE__
+    // Reported in bytes on macOS.
+    usage->max_rss_kib = ru.ru_maxrss / 1024;
+#  else
+    usage->max_rss_kib = ru.ru_maxrss;
+#  endif
+    usage->blocks_read = ru.ru_inblock;
+    usage->blocks_written = ru.ru_oublock;
+  }
+#else
+  (void)usage;
+#endif
+
   {
     SignalHandlerBlocker signal_handler_blocker;
     *pid = 0;
@@ -202,6 +325,103 @@ execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* pid)
 
   return WEXITSTATUS(status);
 }
+
+// Execute a compiler backend, capturing all output to the given paths the full
+// path to the compiler to run is in argv[0].
+int
+execute(const char* const* argv,
+        Fd&& fd_out,
+        Fd&& fd_err,
+        pid_t* pid,
+        ProcessUsage* usage)
+{
+  spawn(argv, std::move(fd_out), std::move(fd_err), pid);
+  return wait_for_exit(pid, usage);
+}
+
+int
+execute_in_dir(const std::string& dir,
+               const char* const* argv,
+               Fd&& fd_out,
+               Fd&& fd_err,
+               pid_t* pid)
+{
+  spawn(argv, std::move(fd_out), std::move(fd_err), pid, dir.c_str());
+  return wait_for_exit(pid);
+}
+
+void
+execute_async(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* pid)
+{
+  spawn(argv, std::move(fd_out), std::move(fd_err), pid);
+}
+
+int
+execute_wait(pid_t* pid)
+{
+  return wait_for_exit(pid);
+}
+
+int
+execute(const char* const* argv,
+        const std::function<void(const Fd& fd)>& stdout_reader,
+        Fd&& fd_err,
+        pid_t* pid)
+{
+  int pipe_fds[2];
+  if (pipe(pipe_fds) == -1) {
+    throw Fatal("Failed to create pipe: {}", strerror(errno));
+  }
+  Fd read_fd(pipe_fds[0]);
+  Fd write_fd(pipe_fds[1]);
+  fcntl(*read_fd, F_SETFD, FD_CLOEXEC);
+
+  spawn(argv, std::move(write_fd), std::move(fd_err), pid);
+  try {
+    stdout_reader(read_fd);
+  } catch (...) {
+    // Closing the pipe terminates the process if it writes more output.
+    read_fd.close();
+    wait_for_exit(pid);
+    throw;
+  }
+  read_fd.close();
+  return wait_for_exit(pid);
+}
+#endif
+
+#ifndef _WIN32
+// Compute a digest of the identities of the files and directories that
+// determine the result of searching for `name` in `path`. `entries[0]` is the
+// found executable and the rest are skipped candidates. Directories preceding
+// the found executable are included since adding an executable to them would
+// change the result. Returns nullopt if an identity can't be trusted.
+static optional<Digest>
+hash_search_identity(const std::vector<std::string>& entries,
+                     const std::string& path,
+                     const std::string& name)
+{
+  Hash hash;
+  for (const auto& dir : Util::split_into_strings(path, PATH_DELIM)) {
+    if (FMT("{}/{}", dir, name) == entries[0]) {
+      break;
+    }
+    const auto st = Stat::stat(dir);
+    if (!st) {
+      hash.hash_delimiter("missing");
+      hash.hash(dir);
+    } else if (!DigestMemo::hash_file_identity(hash, dir, st)) {
+      return nullopt;
+    }
+  }
+  for (const auto& entry : entries) {
+    const auto st = Stat::lstat(entry);
+    if (!st || !DigestMemo::hash_file_identity(hash, entry, st)) {
+      return nullopt;
+    }
+  }
+  return hash.digest();
+}
 #endif
 
 std::string
@@ -222,13 +442,60 @@ find_executable(const Context& ctx,
     return {};
   }
 
+#ifdef _WIN32
   return find_executable_in_path(name, exclude_name, path);
+#else
+  // Don't create the memo (and thereby the cache directory) when disabled.
+  if (!ctx.config.memoize_path_lookup() || ctx.config.disable()) {
+    return find_executable_in_path(name, exclude_name, path);
+  }
+
+  Hash hash;
+  hash.hash_delimiter("find_executable");
+  hash.hash(path);
+  hash.hash(name);
+  hash.hash(exclude_name);
+  const auto memo_key = hash.digest();
+
+  const auto memo = ctx.digest_memo.get_data(memo_key);
+  if (memo) {
+    auto entries = Util::split_into_strings(*memo, "\n");
+    if (entries.size() >= 2) {
+      const std::string identity = entries[0];
+      entries.erase(entries.begin());
+      const auto current_identity = hash_search_identity(entries, path, name);
+      if (current_identity && current_identity->to_string() == identity) {
+        LOG("Found {} in memoized executable search", entries[0]);
+        return entries[0];
+      }
+    }
+  }
+
+  std::vector<std::string> skipped;
+  const auto result =
+    find_executable_in_path(name, exclude_name, path, &skipped);
+  if (!result.empty()) {
+    std::vector<std::string> entries{result};
+    entries.insert(entries.end(), skipped.begin(), skipped.end());
+    const auto identity = hash_search_identity(entries, path, name);
+    if (identity) {
+      std::string data = identity->to_string();
+      for (const auto& entry : entries) {
+        data += '\n';
+        data += entry;
+      }
+      ctx.digest_memo.put_data(memo_key, data);
+    }
+  }
+  return result;
+#endif
 }
 
 std::string
 find_executable_in_path(const std::string& name,
                         const std::string& exclude_name,
-                        const std::string& path)
+                        const std::string& path,
+                        std::vector<std::string>* skipped_candidates)
 {
   if (path.empty()) {
     return {};
@@ -265,12 +532,17 @@ find_executable_in_path(const std::string& name,
         std::string real_path = Util::real_path(fname, true);
         if (Util::base_name(real_path) == exclude_name) {
           // It's a link to "ccache"!
+          if (skipped_candidates) {
+            skipped_candidates->push_back(fname);
+          }
           continue;
         }
       }
 
       // Found it!
       return fname;
+    } else if (st1 && skipped_candidates) {
+      skipped_candidates->push_back(fname);
     }
 #endif
   }
@@ -22,11 +22,61 @@
 
 #include "Fd.hpp"
 
+#include <functional>
 #include <string>
+#include <vector>
 
 class Context;
 
-int execute(const char* const* argv, Fd&& fd_out, Fd&& fd_err, pid_t* pid);
+// Resources used by a process, as far as the platform reports them.
+struct ProcessUsage
+{
+  // User and system CPU time in microseconds.
+  uint64_t cpu_time_us = 0;
+
+  // Maximum resident set size in KiB.
+  uint64_t max_rss_kib = 0;
+
+  // Number of block input and output operations.
+  uint64_t blocks_read = 0;
+  uint64_t blocks_written = 0;
+};
+
+// Execute `argv` and return its exit status. If `usage` is non-null, it's set
+// to the resources used by the process.
+int execute(const char* const* argv,
+            Fd&& fd_out,
+            Fd&& fd_err,
+            pid_t* pid,
+            ProcessUsage* usage = nullptr);
+
+#ifndef _WIN32
+// Like the above but connect the standard output to a pipe that
+// `stdout_reader` consumes while the process runs.
+int execute(const char* const* argv,
+            const std::function<void(const Fd& fd)>& stdout_reader,
+            Fd&& fd_err,
+            pid_t* pid);
+
+// Like the first execute but run the process with working directory `dir`
+// instead of the one of this process.
+int execute_in_dir(const std::string& dir,
+                   const char* const* argv,
+                   Fd&& fd_out,
+                   Fd&& fd_err,
+                   pid_t* pid);
+
+// Like the first execute but return without waiting for the process to exit.
+// Call execute_wait to get the exit status.
+void execute_async(const char* const* argv,
+                   Fd&& fd_out,
+                   Fd&& fd_err,
+                   pid_t* pid);
+
+// Wait for a process started by execute_async to exit and return its exit
+// status like execute. `*pid` is set to 0.
+int execute_wait(pid_t* pid);
+#endif
 
 // Find an executable named `name` in `$PATH`. Exclude any executables that are
 // links to `exclude_name`.
@@ -34,9 +84,13 @@ std::string find_executable(const Context& ctx,
                             const std::string& name,
                             const std::string& exclude_name);
 
-std::string find_executable_in_path(const std::string& name,
-                                    const std::string& exclude_name,
-                                    const std::string& path);
+// Like find_executable but search `path` instead of `$PATH`. Candidates that
+// exist but are skipped are added to `skipped_candidates` if non-null.
+std::string
+find_executable_in_path(const std::string& name,
+                        const std::string& exclude_name,
+                        const std::string& path,
+                        std::vector<std::string>* skipped_candidates = nullptr);
 
 #ifdef _WIN32
 std::string win32getshell(const std::string& path);
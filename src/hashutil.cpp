@@ -21,9 +21,12 @@
 #include "Args.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Fd.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
+#include "MemoryMap.hpp"
 #include "Stat.hpp"
+#include "Tracing.hpp"
 #include "ccache.hpp"
 #include "execute.hpp"
 #include "fmtmacros.hpp"
@@ -39,10 +42,21 @@
 #  include "Win32Util.hpp"
 #endif
 
-#ifdef HAVE_AVX2
+#ifdef HAVE_POSIX_SPAWN
+#  include <spawn.h>
+#endif
+
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512BW)
 #  include <immintrin.h>
 #endif
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+#ifdef __ARM_NEON
+#  include <arm_neon.h>
+#endif
 
+using nonstd::nullopt;
 using nonstd::string_view;
 
 namespace {
@@ -84,6 +98,8 @@ check_for_temporal_macros_helper(string_view str, size_t pos)
   return 0;
 }
 
+} // namespace
+
 int
 check_for_temporal_macros_bmh(string_view str)
 {
@@ -111,9 +127,6 @@ check_for_temporal_macros_bmh(string_view str)
 }
 
 #ifdef HAVE_AVX2
-int check_for_temporal_macros_avx2(string_view str)
-  __attribute__((target("avx2")));
-
 // The following algorithm, which uses AVX2 instructions to find __DATE__,
 // __TIME__ and __TIMESTAMP__, is heavily inspired by
 // <http://0x80.pl/articles/simd-strfind.html>.
@@ -163,6 +176,227 @@ check_for_temporal_macros_avx2(string_view str)
 }
 #endif
 
+#ifdef HAVE_AVX512BW
+// Like check_for_temporal_macros_avx2 but 64 bytes at a time. AVX-512BW
+// comparisons produce a bit mask directly.
+int
+check_for_temporal_macros_avx512bw(string_view str)
+{
+  int result = 0;
+
+  const __m512i first = _mm512_set1_epi8('_');
+  const __m512i last = _mm512_set1_epi8('E');
+
+  size_t pos = 0;
+  for (; pos + 5 + 64 <= str.length(); pos += 64) {
+    const __m512i block_first = _mm512_loadu_si512(&str[pos]);
+    const __m512i block_last = _mm512_loadu_si512(&str[pos + 5]);
+
+    uint64_t mask = _mm512_cmpeq_epi8_mask(first, block_first)
+                    & _mm512_cmpeq_epi8_mask(last, block_last);
+
+    while (mask != 0) {
+      const auto start = pos + __builtin_ctzll(mask) + 1;
+      mask = mask & (mask - 1);
+      result |= check_for_temporal_macros_helper(str, start);
+    }
+  }
+
+  result |= check_for_temporal_macros_bmh(str.substr(pos));
+
+  return result;
+}
+#endif
+
+#ifdef __ARM_NEON
+// Like check_for_temporal_macros_avx2 but 16 bytes at a time. NEON is part of
+// the AArch64 baseline, so no runtime check is needed.
+int
+check_for_temporal_macros_neon(string_view str)
+{
+  int result = 0;
+
+  const uint8x16_t first = vdupq_n_u8('_');
+  const uint8x16_t last = vdupq_n_u8('E');
+
+  size_t pos = 0;
+  for (; pos + 5 + 16 <= str.length(); pos += 16) {
+    const uint8x16_t block_first =
+      vld1q_u8(reinterpret_cast<const uint8_t*>(&str[pos]));
+    const uint8x16_t block_last =
+      vld1q_u8(reinterpret_cast<const uint8_t*>(&str[pos + 5]));
+    const uint8x16_t matches =
+      vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+
+    // Narrow each byte of the comparison result to four bits to get a 64-bit
+    // mask and keep one bit per byte.
+    uint64_t mask =
+      vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0)
+      & UINT64_C(0x8888888888888888);
+
+    while (mask != 0) {
+      const auto start = pos + __builtin_ctzll(mask) / 4 + 1;
+      mask = mask & (mask - 1);
+      result |= check_for_temporal_macros_helper(str, start);
+    }
+  }
+
+  result |= check_for_temporal_macros_bmh(str.substr(pos));
+
+  return result;
+}
+#endif
+
+namespace {
+
+bool
+is_preprocessed_marker_candidate(const char* q, bool pump)
+{
+  return (q[0] == '#' && q[-1] == '\n') || (q[0] == '.' && q[6] == 'n')
+         || (pump && q[0] == '_' && q[8] == '_');
+}
+
+const char*
+find_preprocessed_marker_scalar(const char* begin, const char* end, bool pump)
+{
+  for (const char* q = begin; q < end - 7; ++q) {
+    if (is_preprocessed_marker_candidate(q, pump)) {
+      return q;
+    }
+  }
+  return end;
+}
+
+#ifdef HAVE_AVX2
+const char* find_preprocessed_marker_avx2(const char* begin,
+                                          const char* end,
+                                          bool pump)
+  __attribute__((target("avx2")));
+
+// Like check_for_temporal_macros_avx2, look for the first and last (or, for
+// linemarkers, preceding) characters of the markers 32 bytes at a time.
+const char*
+find_preprocessed_marker_avx2(const char* begin, const char* end, bool pump)
+{
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i n = _mm256_set1_epi8('n');
+  const __m256i underscore = _mm256_set1_epi8('_');
+  const __m256i zero = _mm256_setzero_si256();
+
+  const char* q = begin;
+  for (; q + 8 + 32 <= end; q += 32) {
+    const __m256i block =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q));
+    const __m256i block_prev =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q - 1));
+    const __m256i block_6 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q + 6));
+    const __m256i block_8 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(q + 8));
+
+    // For i in 0..31, set byte i to 0xFF if a marker may start at q[i].
+    const __m256i linemarker =
+      _mm256_and_si256(_mm256_cmpeq_epi8(block, hash),
+                       _mm256_cmpeq_epi8(block_prev, newline));
+    const __m256i incbin = _mm256_and_si256(_mm256_cmpeq_epi8(block, dot),
+                                            _mm256_cmpeq_epi8(block_6, n));
+    const __m256i pump_line =
+      pump ? _mm256_and_si256(_mm256_cmpeq_epi8(block, underscore),
+                              _mm256_cmpeq_epi8(block_8, underscore))
+           : zero;
+
+    const uint32_t mask = _mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_or_si256(linemarker, incbin), pump_line));
+    if (mask != 0) {
+      return q + __builtin_ctz(mask);
+    }
+  }
+
+  return find_preprocessed_marker_scalar(q, end, pump);
+}
+#endif
+
+#if defined(__SSE2__)
+const char*
+find_preprocessed_marker_simd(const char* begin, const char* end, bool pump)
+{
+  const __m128i hash = _mm_set1_epi8('#');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i n = _mm_set1_epi8('n');
+  const __m128i underscore = _mm_set1_epi8('_');
+  const __m128i zero = _mm_setzero_si128();
+
+  const char* q = begin;
+  for (; q + 8 + 16 <= end; q += 16) {
+    const auto load = [](const char* pos) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+    };
+    const __m128i block = load(q);
+
+    const __m128i linemarker = _mm_and_si128(
+      _mm_cmpeq_epi8(block, hash), _mm_cmpeq_epi8(load(q - 1), newline));
+    const __m128i incbin = _mm_and_si128(_mm_cmpeq_epi8(block, dot),
+                                         _mm_cmpeq_epi8(load(q + 6), n));
+    const __m128i pump_line =
+      pump ? _mm_and_si128(_mm_cmpeq_epi8(block, underscore),
+                           _mm_cmpeq_epi8(load(q + 8), underscore))
+           : zero;
+
+    const int mask = _mm_movemask_epi8(
+      _mm_or_si128(_mm_or_si128(linemarker, incbin), pump_line));
+    if (mask != 0) {
+      return q + __builtin_ctz(mask);
+    }
+  }
+
+  return find_preprocessed_marker_scalar(q, end, pump);
+}
+#elif defined(__ARM_NEON)
+const char*
+find_preprocessed_marker_simd(const char* begin, const char* end, bool pump)
+{
+  const uint8x16_t hash = vdupq_n_u8('#');
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  const uint8x16_t dot = vdupq_n_u8('.');
+  const uint8x16_t n = vdupq_n_u8('n');
+  const uint8x16_t underscore = vdupq_n_u8('_');
+  const uint8x16_t zero = vdupq_n_u8(0);
+
+  const char* q = begin;
+  for (; q + 8 + 16 <= end; q += 16) {
+    const auto load = [](const char* pos) {
+      return vld1q_u8(reinterpret_cast<const uint8_t*>(pos));
+    };
+    const uint8x16_t block = load(q);
+
+    const uint8x16_t linemarker =
+      vandq_u8(vceqq_u8(block, hash), vceqq_u8(load(q - 1), newline));
+    const uint8x16_t incbin =
+      vandq_u8(vceqq_u8(block, dot), vceqq_u8(load(q + 6), n));
+    const uint8x16_t pump_line =
+      pump ? vandq_u8(vceqq_u8(block, underscore),
+                      vceqq_u8(load(q + 8), underscore))
+           : zero;
+
+    // Narrow each byte of the comparison result to four bits to get a 64-bit
+    // mask.
+    const uint8x16_t matches =
+      vorrq_u8(vorrq_u8(linemarker, incbin), pump_line);
+    const uint64_t mask = vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+    if (mask != 0) {
+      return q + __builtin_ctzll(mask) / 4;
+    }
+  }
+
+  return find_preprocessed_marker_scalar(q, end, pump);
+}
+#endif
+
 int
 hash_source_code_file_nocache(const Context& ctx,
                               Hash& hash,
@@ -177,9 +411,22 @@ hash_source_code_file_nocache(const Context& ctx,
       return HASH_SOURCE_CODE_ERROR;
     }
   } else {
+    // Large files are hashed and scanned directly from a mapping to avoid
+    // copying them into a string.
+    Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
+    if (!fd) {
+      return HASH_SOURCE_CODE_ERROR;
+    }
+    MemoryMap map;
+    if (map.map(*fd)) {
+      return hash_source_code_string(ctx, hash, map.data(), path);
+    }
+
+    // Smaller files are read through the already open descriptor so that each
+    // file is only opened once.
     std::string data;
     try {
-      data = Util::read_file(path, size_hint);
+      data = Util::read_fd_to_string(*fd, size_hint);
     } catch (Error&) {
       return HASH_SOURCE_CODE_ERROR;
     }
@@ -207,12 +454,37 @@ get_content_type(const Config& config, const std::string& path)
 int
 check_for_temporal_macros(string_view str)
 {
+#ifdef HAVE_AVX512BW
+  static const bool cpu_supports_avx512bw = __builtin_cpu_supports("avx512bw");
+  if (cpu_supports_avx512bw) {
+    return check_for_temporal_macros_avx512bw(str);
+  }
+#endif
 #ifdef HAVE_AVX2
   if (blake3_cpu_supports_avx2()) {
     return check_for_temporal_macros_avx2(str);
   }
 #endif
+#ifdef __ARM_NEON
+  return check_for_temporal_macros_neon(str);
+#else
   return check_for_temporal_macros_bmh(str);
+#endif
+}
+
+const char*
+find_preprocessed_marker(const char* begin, const char* end, bool pump)
+{
+#ifdef HAVE_AVX2
+  if (blake3_cpu_supports_avx2()) {
+    return find_preprocessed_marker_avx2(begin, end, pump);
+  }
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+  return find_preprocessed_marker_simd(begin, end, pump);
+#else
+  return find_preprocessed_marker_scalar(begin, end, pump);
+#endif
 }
 
 int
@@ -259,7 +531,7 @@ hash_source_code_string(const Context& ctx,
 
     // Make sure that the hash sum changes if the (potential) expansion of
     // __TIMESTAMP__ changes.
-    const auto stat = Stat::stat(path);
+    const auto stat = ctx.stat_cache.stat(path);
     if (!stat) {
       return HASH_SOURCE_CODE_ERROR;
     }
@@ -290,6 +562,15 @@ hash_source_code_file(const Context& ctx,
                       const std::string& path,
                       size_t size_hint)
 {
+  Tracing::Span span("hash_file", path);
+
+  const auto mapped_digest = find_in_digest_map(ctx, path);
+  if (mapped_digest) {
+    hash.hash_delimiter("build digest");
+    hash.hash(*mapped_digest);
+    return HASH_SOURCE_CODE_OK;
+  }
+
 #ifdef INODE_CACHE_SUPPORTED
   if (!ctx.config.inode_cache()) {
 #endif
@@ -306,17 +587,33 @@ hash_source_code_file(const Context& ctx,
   Digest digest;
   int return_value;
   if (!ctx.inode_cache.get(path, content_type, digest, &return_value)) {
-    Hash file_hash;
-    return_value = hash_source_code_file_nocache(
-      ctx,
-      file_hash,
-      path,
-      size_hint,
-      content_type == InodeCache::ContentType::precompiled_header);
-    if (return_value == HASH_SOURCE_CODE_ERROR) {
-      return HASH_SOURCE_CODE_ERROR;
+    // A file tracked by git with up-to-date stat data in the index has the
+    // content of its blob, which may have been hashed before in another work
+    // tree.
+    const auto blob_id =
+      ctx.git_index
+          && content_type != InodeCache::ContentType::precompiled_header
+        ? ctx.git_index->blob_id(path, ctx.stat_cache.stat(path))
+        : nullopt;
+    if (!blob_id
+        || !ctx.inode_cache.get_by_content_id(
+          *blob_id, content_type, digest, &return_value)) {
+      Hash file_hash;
+      return_value = hash_source_code_file_nocache(
+        ctx,
+        file_hash,
+        path,
+        size_hint,
+        content_type == InodeCache::ContentType::precompiled_header);
+      if (return_value == HASH_SOURCE_CODE_ERROR) {
+        return HASH_SOURCE_CODE_ERROR;
+      }
+      digest = file_hash.digest();
+      if (blob_id && return_value == HASH_SOURCE_CODE_OK) {
+        ctx.inode_cache.put_by_content_id(
+          *blob_id, content_type, digest, return_value);
+      }
     }
-    digest = file_hash.digest();
     ctx.inode_cache.put(path, content_type, digest, return_value);
   }
   hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
@@ -324,6 +621,54 @@ hash_source_code_file(const Context& ctx,
 #endif
 }
 
+std::unordered_map<std::string, std::string>
+read_digest_map(const std::string& path, const std::string& cwd)
+{
+  std::unordered_map<std::string, std::string> result;
+  std::string content;
+  try {
+    content = Util::read_file(path);
+  } catch (const Error& e) {
+    LOG("Failed to read digest map {}: {}", path, e.what());
+    return result;
+  }
+
+  const auto absolute_path =
+    Util::is_absolute_path(path) ? path : FMT("{}/{}", cwd, path);
+  const auto map_dir = Util::dir_name(absolute_path);
+  for (const auto line : Util::split_into_views(content, "\n")) {
+    const auto space = line.find(' ');
+    if (space == string_view::npos || space == 0 || space + 2 > line.size()) {
+      LOG("Ignoring malformed line in digest map {}: {}", path, line);
+      continue;
+    }
+    // sha256sum separates the digest from the path with " " (text mode) or
+    // " *" (binary mode) after the first space.
+    const auto file = line.substr(space + 2);
+    if (file.empty() || (line[space + 1] != ' ' && line[space + 1] != '*')) {
+      LOG("Ignoring malformed line in digest map {}: {}", path, line);
+      continue;
+    }
+    result[Util::normalize_absolute_path(
+      Util::is_absolute_path(file) ? std::string(file)
+                                   : FMT("{}/{}", map_dir, file))] =
+      std::string(line.substr(0, space));
+  }
+  LOG("Read {} entries from digest map {}", result.size(), path);
+  return result;
+}
+
+const std::string*
+find_in_digest_map(const Context& ctx, const std::string& path)
+{
+  if (ctx.digest_map.empty()) {
+    return nullptr;
+  }
+  const auto it = ctx.digest_map.find(Util::normalize_absolute_path(
+    Util::is_absolute_path(path) ? path : FMT("{}/{}", ctx.actual_cwd, path)));
+  return it != ctx.digest_map.end() ? &it->second : nullptr;
+}
+
 bool
 hash_binary_file(const Context& ctx, Hash& hash, const std::string& path)
 {
@@ -336,13 +681,8 @@ hash_binary_file(const Context& ctx, Hash& hash, const std::string& path)
   // files separately so that digests based on file contents can be reused. Then
   // add the digest into the outer hash instead.
   Digest digest;
-  if (!ctx.inode_cache.get(path, InodeCache::ContentType::binary, digest)) {
-    Hash file_hash;
-    if (!file_hash.hash_file(path)) {
-      return false;
-    }
-    digest = file_hash.digest();
-    ctx.inode_cache.put(path, InodeCache::ContentType::binary, digest);
+  if (!get_binary_file_digest(ctx, path, digest)) {
+    return false;
   }
   hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
   return true;
@@ -351,6 +691,32 @@ hash_binary_file(const Context& ctx, Hash& hash, const std::string& path)
 #endif
 }
 
+bool
+get_binary_file_digest(const Context& ctx,
+                       const std::string& path,
+                       Digest& digest)
+{
+#ifdef INODE_CACHE_SUPPORTED
+  if (ctx.config.inode_cache()
+      && ctx.inode_cache.get(path, InodeCache::ContentType::binary, digest)) {
+    return true;
+  }
+#endif
+
+  Hash file_hash;
+  if (!file_hash.hash_file(path)) {
+    return false;
+  }
+  digest = file_hash.digest();
+
+#ifdef INODE_CACHE_SUPPORTED
+  if (ctx.config.inode_cache()) {
+    ctx.inode_cache.put(path, InodeCache::ContentType::binary, digest);
+  }
+#endif
+  return true;
+}
+
 bool
 hash_command_output(Hash& hash,
                     const std::string& command,
@@ -455,9 +821,36 @@ hash_command_output(Hash& hash,
     throw Fatal("pipe failed: {}", strerror(errno));
   }
 
-  pid_t pid = fork();
+  pid_t pid = -1;
+#ifdef HAVE_POSIX_SPAWN
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addclose(&actions, pipefd[0]);
+  posix_spawn_file_actions_addclose(&actions, 0);
+  posix_spawn_file_actions_adddup2(&actions, pipefd[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, pipefd[1], 2);
+  if (pipefd[1] > 2) {
+    posix_spawn_file_actions_addclose(&actions, pipefd[1]);
+  }
+  const int result = posix_spawnp(&pid,
+                                  argv[0],
+                                  &actions,
+                                  nullptr,
+                                  const_cast<char* const*>(argv.data()),
+                                  environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (result != 0) {
+    // Fall back to fork and exec below, which reports errors like before.
+    LOG("posix_spawnp of {} failed: {}", argv[0], strerror(result));
+    pid = -1;
+  }
+#endif
+
   if (pid == -1) {
-    throw Fatal("fork failed: {}", strerror(errno));
+    pid = fork();
+    if (pid == -1) {
+      throw Fatal("fork failed: {}", strerror(errno));
+    }
   }
 
   if (pid == 0) {
@@ -23,9 +23,11 @@
 #include "third_party/nonstd/string_view.hpp"
 
 #include <string>
+#include <unordered_map>
 
 class Config;
 class Context;
+class Digest;
 class Hash;
 
 const int HASH_SOURCE_CODE_OK = 0;
@@ -42,24 +44,67 @@ const int HASH_SOURCE_CODE_FOUND_TIMESTAMP = (1 << 3);
 // appropriately.
 int check_for_temporal_macros(nonstd::string_view str);
 
+// The implementations check_for_temporal_macros chooses from, exposed for
+// benchmarks.
+int check_for_temporal_macros_bmh(nonstd::string_view str);
+#ifdef HAVE_AVX2
+int check_for_temporal_macros_avx2(nonstd::string_view str)
+  __attribute__((target("avx2")));
+#endif
+#ifdef HAVE_AVX512BW
+int check_for_temporal_macros_avx512bw(nonstd::string_view str)
+  __attribute__((target("avx512bw")));
+#endif
+#ifdef __ARM_NEON
+int check_for_temporal_macros_neon(nonstd::string_view str);
+#endif
+
+// Return the first position in [`begin`, `end` - 7) that may start a
+// linemarker (a '#' after a newline), an ".incbin" directive or, if `pump` is
+// true, a distcc-pump message, or `end` if there is no such position.
+//
+// Pre-condition: begin[-1] is readable.
+const char*
+find_preprocessed_marker(const char* begin, const char* end, bool pump);
+
 // Hash a string. Returns a bitmask of HASH_SOURCE_CODE_* results.
 int hash_source_code_string(const Context& ctx,
                             Hash& hash,
                             nonstd::string_view str,
                             const std::string& path);
 
-// Hash a file ignoring comments. Returns a bitmask of HASH_SOURCE_CODE_*
-// results.
+// Hash a file ignoring comments. If the file is listed in the digest map, its
+// digest from the map is hashed instead of the content. Returns a bitmask of
+// HASH_SOURCE_CODE_* results.
 int hash_source_code_file(const Context& ctx,
                           Hash& hash,
                           const std::string& path,
                           size_t size_hint = 0);
 
+// Read a digest map file in sha256sum format ("<digest>  <path>" lines).
+// Relative paths are taken relative to the directory of the map file. Returns
+// an empty map (and logs the reason) if the file can't be read.
+std::unordered_map<std::string, std::string>
+read_digest_map(const std::string& path, const std::string& cwd);
+
+// Return the digest of `path` from `ctx.digest_map`, or nullptr if it isn't
+// listed.
+const std::string* find_in_digest_map(const Context& ctx,
+                                      const std::string& path);
+
 // Hash a binary file using the inode cache if enabled.
 //
 // Returns true on success, otherwise false.
 bool hash_binary_file(const Context& ctx, Hash& hash, const std::string& path);
 
+// Get the digest of the content of a binary file using the inode cache if
+// enabled.
+//
+// Returns true on success, otherwise false.
+bool get_binary_file_digest(const Context& ctx,
+                            const std::string& path,
+                            Digest& digest);
+
 // Hash the output of `command` (not executed via a shell). A "%compiler%"
 // string in `command` will be replaced with `compiler`.
 bool hash_command_output(Hash& hash,
@@ -41,6 +41,9 @@ const struct
   {".CXX", "c++"},
   {".c++", "c++"},
   {".C++", "c++"},
+  // C++20 module interface units:
+  {".cppm", "c++"},
+  {".ixx", "c++"},
   {".m", "objective-c"},
   {".M", "objective-c++"},
   {".mm", "objective-c++"},
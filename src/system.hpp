@@ -176,6 +176,16 @@ DLLIMPORT extern char** environ;
 #  define INODE_CACHE_SUPPORTED
 #endif
 
+// macOS calls the nanosecond resolution timestamps st_[cm]timespec.
+#if !defined(HAVE_STRUCT_STAT_ST_CTIM) && defined(HAVE_STRUCT_STAT_ST_CTIMESPEC)
+#  define st_ctim st_ctimespec
+#  define HAVE_STRUCT_STAT_ST_CTIM
+#endif
+#if !defined(HAVE_STRUCT_STAT_ST_MTIM) && defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+#  define st_mtim st_mtimespec
+#  define HAVE_STRUCT_STAT_ST_MTIM
+#endif
+
 // Workaround for missing std::is_trivially_copyable in GCC < 5.
 #if __GNUG__ && __GNUC__ < 5
 #  define IS_TRIVIALLY_COPYABLE(T) __has_trivial_copy(T)
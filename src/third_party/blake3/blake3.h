@@ -48,6 +48,20 @@ void blake3_hasher_update(blake3_hasher *self, const void *input,
                           size_t input_len);
 void blake3_hasher_finalize(const blake3_hasher *self, uint8_t *out,
                             size_t out_len);
+
+// ccache modification: Multi-threaded hashing. `join` must call
+// `task(left_arg)` and `task(right_arg)`, possibly concurrently, and return
+// when both calls have returned. It is called for the left and right halves
+// of subtrees of at least BLAKE3_MIN_JOIN_LEN bytes. The result is identical
+// to blake3_hasher_update.
+#define BLAKE3_MIN_JOIN_LEN (1024 * 1024)
+typedef struct {
+  void (*join)(void *context, void (*task)(void *), void *left_arg,
+               void *right_arg);
+  void *context;
+} blake3_joiner;
+void blake3_hasher_update_join(blake3_hasher *self, const void *input,
+                               size_t input_len, const blake3_joiner *joiner);
 void blake3_hasher_finalize_seek(const blake3_hasher *self, uint64_t seek,
                                  uint8_t *out, size_t out_len);
 
@@ -127,6 +127,84 @@ base_tests() {
     $CCACHE_COMPILE -c test1.c test2.c
     expect_stat 'multiple source files' 1
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SPLITSOURCES"
+
+    export CCACHE_SPLITSOURCES=1
+    echo 'int test2;' >test2.c
+    echo 'int test3 = ;' >test3.c
+
+    $REAL_COMPILER -c test1.c test2.c
+    mv test1.o reference_test1.o
+    mv test2.o reference_test2.o
+
+    $CCACHE_COMPILE -c test1.c test2.c
+    expect_stat 'cache miss' 2
+    expect_equal_object_files reference_test1.o test1.o
+    expect_equal_object_files reference_test2.o test2.o
+
+    rm test1.o test2.o
+    $CCACHE_COMPILE -c test1.c test2.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 2
+    expect_equal_object_files reference_test1.o test1.o
+    expect_equal_object_files reference_test2.o test2.o
+
+    $REAL_COMPILER -c test3.c 2>test3_stderr.txt
+    cat test3_stderr.txt test3_stderr.txt >reference_stderr.txt
+    $CCACHE_COMPILE -c test3.c test1.c test3.c 2>stderr.txt
+    status=$?
+    if [ $status -eq 0 ]; then
+        test_failed "Expected failure"
+    fi
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'compile failed' 2
+    expect_equal_content reference_stderr.txt stderr.txt
+
+    CCACHE_SPLITSOURCEJOBS=1 $CCACHE_COMPILE -c test1.c test2.c
+    expect_stat 'cache hit (preprocessed)' 5
+
+    $CCACHE_COMPILE -c test1.c test2.c -o test.o 2>/dev/null
+    expect_stat 'multiple source files' 1
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_STREAMCOMPRESSION"
+
+    # A fake compiler that writes a 3 MB object in two steps.
+    head -c 3000000 /dev/urandom >reference.o
+    cat >compiler.sh <<'EOF'
+#!/bin/sh
+prev=
+for arg in "$@"; do
+    case $prev,$arg in
+        -o,*) out=$arg ;;
+        *,-E) preprocess=1 ;;
+        *,-*) ;;
+        *) input=$arg ;;
+    esac
+    prev=$arg
+done
+if [ -n "$preprocess" ]; then
+    cat $input
+    exit 0
+fi
+head -c 2500000 reference.o >$out
+sleep 1
+tail -c +2500001 reference.o >>$out
+EOF
+    chmod +x compiler.sh
+
+    CCACHE_STREAMCOMPRESSION=1 $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Compressed 2 chunks of test1.o"
+    expect_contains $CCACHE_LOGFILE "Reused 2 chunks"
+    expect_equal_content reference.o test1.o
+
+    rm test1.o
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_equal_content reference.o test1.o
+
     # -------------------------------------------------------------------------
     TEST "Couldn't find the compiler"
 
@@ -348,6 +426,37 @@ base_tests() {
         fi
     done
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_LOGBUFFERSIZE"
+
+    CCACHE_LOGBUFFERSIZE=1M $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Result: cache miss"
+
+    CCACHE_LOGBUFFERSIZE=1M $CCACHE_COMPILE test1.o -o test 2>/dev/null
+    expect_stat 'called for link' 1
+    expect_contains $CCACHE_LOGFILE "Executing"
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_DEFERMTIMEUPDATES"
+
+    export CCACHE_DEFERMTIMEUPDATES=1
+    export CCACHE_TEMPDIR=$PWD/tmpdir
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    result_file=$(find $CCACHE_DIR -name '*R')
+    backdate $result_file
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_newer_than test1.c $result_file
+    expect_content tmpdir/mtime_journal "$result_file"
+
+    $CCACHE -c >/dev/null
+    expect_missing tmpdir/mtime_journal
+    expect_newer_than $result_file test1.c
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_DISABLE"
 
@@ -538,6 +647,28 @@ base_tests() {
         expect_stat 'cache miss' 1
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_HASHALGORITHM"
+
+    CCACHE_HASHALGORITHM=xxh3 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+
+    CCACHE_HASHALGORITHM=xxh3 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    # The algorithms have separate keys.
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 2
+
+    CCACHE_HASHALGORITHM=xxh3 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_NOHASHDIR"
 
@@ -595,6 +726,53 @@ base_tests() {
     expect_stat 'cache miss' 3
     expect_stat 'error hashing extra file' 1
 
+    # -------------------------------------------------------------------------
+    TEST "Memoized common hash state"
+
+    echo "a" >a
+    backdate a
+
+    CCACHE_EXTRAFILES=a $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    rm $CCACHE_LOGFILE
+    CCACHE_EXTRAFILES=a $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Using memoized common hash state"
+
+    echo "a2" >a
+    backdate a
+
+    CCACHE_EXTRAFILES=a $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Memoized extra file digest"
+
+    echo "a" >a
+    echo "b" >b
+    backdate a b
+
+    CCACHE_EXTRAFILES=a $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    # The common hash state differs but the digest of a is reused.
+    rm $CCACHE_LOGFILE
+    CCACHE_EXTRAFILES="a${PATH_DELIM}b" $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Using memoized digest of a"
+    expect_not_contains $CCACHE_LOGFILE "Using memoized digest of b"
+
+    echo "a2" >a
+    backdate a
+
+    CCACHE_EXTRAFILES="a${PATH_DELIM}b" $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 3
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_PREFIX"
 
@@ -645,6 +823,34 @@ b"
     expect_stat 'cache miss' 32
     expect_stat 'files in cache' 32
 
+    # -------------------------------------------------------------------------
+    if ! $HOST_OS_WINDOWS; then
+        TEST "CCACHE_STRIPEDIRS"
+
+        export CCACHE_STRIPEDIRS=$PWD/stripe1:$PWD/stripe2
+        for i in $(seq 32); do
+            generate_code $i test$i.c
+            $CCACHE_COMPILE -c test$i.c
+        done
+        expect_stat 'cache miss' 32
+        expect_stat 'files in cache' 32
+        if [ ! -L $CCACHE_DIR/0 ] || [ ! -d stripe1/0 ] || [ ! -d stripe2/1 ]; then
+            test_failed "Level 1 subdirectories not placed on stripes"
+        fi
+        expect_file_count 32 '*R' "stripe1 stripe2"
+
+        $CCACHE_COMPILE -c test1.c
+        expect_stat 'cache hit (preprocessed)' 1
+
+        $CCACHE -c >/dev/null
+        expect_stat 'files in cache' 32
+        expect_file_count 32 '*R' "stripe1 stripe2"
+
+        $CCACHE -C >/dev/null
+        expect_stat 'files in cache' 0
+        expect_file_count 0 '*R' "stripe1 stripe2"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "Called for preprocessing"
 
@@ -801,6 +1007,62 @@ EOF
         test_failed "Compiler type $compiler_type != clang"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "-fmodule-file and -fmodule-output"
+
+    # A fake Clang that "compiles" by copying the source code to the outputs.
+    cat >clang <<'EOF'
+#!/bin/sh
+prev=
+for arg in "$@"; do
+    case $prev,$arg in
+        -o,*) out=$arg ;;
+        *,-E) preprocess=1 ;;
+        *,-fmodule-output=*) bmi=${arg#-fmodule-output=} ;;
+        *,-*) ;;
+        *) input=$arg ;;
+    esac
+    prev=$arg
+done
+if [ -n "$preprocess" ]; then
+    cat $input
+    exit 0
+fi
+cat $input >$out
+if [ -n "$bmi" ]; then
+    echo "bmi for $input" >$bmi
+fi
+EOF
+    chmod +x clang
+    echo 'export module a;' >a.cppm
+    echo 'import a;' >b.cpp
+    echo 1 >a.pcm
+
+    $CCACHE ./clang -c a.cppm -fmodule-output=a_out.pcm
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+    expect_content a_out.pcm "bmi for a.cppm"
+
+    rm a.o a_out.pcm
+    $CCACHE ./clang -c a.cppm -fmodule-output=a_out.pcm
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_exists a.o
+    expect_content a_out.pcm "bmi for a.cppm"
+
+    $CCACHE ./clang -c b.cpp -fmodule-file=a=a.pcm
+    expect_stat 'cache miss' 2
+
+    $CCACHE ./clang -c b.cpp -fmodule-file=a=a.pcm
+    expect_stat 'cache hit (preprocessed)' 2
+
+    echo 2 >a.pcm
+    $CCACHE ./clang -c b.cpp -fmodule-file=a=a.pcm
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 3
+
+    $CCACHE ./clang -c b.cpp -fprebuilt-module-path=.
+    expect_stat "can't use modules" 1
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_PATH"
 
@@ -869,6 +1131,31 @@ EOF
     expect_stat 'cache hit (preprocessed)' 1
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILERCHECK=buildid"
+
+    # A script has no build ID, so its content is hashed instead.
+    cat >compiler.sh <<EOF
+#!/bin/sh
+CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+export CCACHE_DISABLE
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+
+    CCACHE_COMPILERCHECK=buildid $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    CCACHE_COMPILERCHECK=buildid $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    echo "# Compiler upgrade" >>compiler.sh
+
+    CCACHE_COMPILERCHECK=buildid $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_COMPILERCHECK=none"
 
@@ -954,6 +1241,49 @@ EOF
     expect_stat 'cache hit (preprocessed)' 2
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_MEMOIZE_COMPILERCHECK"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+export CCACHE_DISABLE
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+    backdate compiler.sh
+
+    cat >check.sh <<EOF
+#!/bin/sh
+echo run >>check.log
+echo \$1
+EOF
+    chmod +x check.sh
+
+    export CCACHE_MEMOIZE_COMPILERCHECK=1
+    export CCACHE_COMPILERCHECK='./check.sh %compiler%'
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_content check.log "run"
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_content check.log "run"
+
+    echo "# Compiler upgrade" >>compiler.sh
+    backdate compiler.sh
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 1
+    expect_content check.log "run
+run"
+
+    unset CCACHE_COMPILERCHECK
+    unset CCACHE_MEMOIZE_COMPILERCHECK
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_COMPILERCHECK=unknown_command"
 
@@ -994,7 +1324,13 @@ EOF
     expect_perm test.d -rw-r--r--
     expect_perm "$CCACHE_CONFIGPATH" -rw-rw-r--
     expect_perm "$CCACHE_DIR" drwxrwxr-x
-    expect_perm "$CCACHE_DIR/tmp" drwxrwxr-x
+    if $HOST_OS_LINUX && [ -z "$CCACHE_NOCPP2" ]; then
+        # Compiler output is kept in memory, so the temporary directory is not
+        # needed.
+        expect_missing "$CCACHE_DIR/tmp"
+    else
+        expect_perm "$CCACHE_DIR/tmp" drwxrwxr-x
+    fi
     expect_perm "$level_1_dir" drwxrwxr-x
     expect_perm "$level_1_dir/stats" -rw-rw-r--
     expect_perm "$level_2_dir" drwxrwxr-x
@@ -1029,6 +1365,175 @@ EOF
 
     umask $saved_umask
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_WRITEBEHIND"
+
+    wait_for_background_store() {
+        for i in $(seq 50); do
+            if $CCACHE --print-stats | grep -q '^cache_miss[[:space:]]*1$'; then
+                break
+            fi
+            sleep 0.1
+        done
+    }
+
+    $REAL_COMPILER -c -o reference_test1.o test1.c
+
+    CCACHE_WRITEBEHIND=1 $CCACHE_COMPILE -c test1.c
+    expect_exists test1.o
+    wait_for_background_store
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+
+    rm test1.o
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_object_files reference_test1.o test1.o
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SHAREDSTATS"
+
+    export CCACHE_SHAREDSTATS=1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    for i in 1 2 3; do
+        $CCACHE_COMPILE -c test1.c
+    done
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'cache miss' 1
+    expect_file_count 1 'stats.shared' $CCACHE_DIR
+
+    $CCACHE -z >/dev/null
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 1
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_PHASEDURATIONS"
+
+    $CCACHE_COMPILE -c test1.c
+    if $CCACHE --print-stats | grep -q '^phase_'; then
+        test_failed "Phase durations recorded without CCACHE_PHASEDURATIONS"
+    fi
+
+    export CCACHE_PHASEDURATIONS=1
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    if ! $CCACHE --print-stats | grep -q '^phase_find_compiler_count[[:space:]]*2$'; then
+        test_failed "Expected two find_compiler durations"
+    fi
+    if ! $CCACHE --print-stats | grep -q '^phase_result_retrieval_count[[:space:]]*2$'; then
+        test_failed "Expected two result_retrieval durations"
+    fi
+    if ! $CCACHE -s -v | grep -q '^phase durations'; then
+        test_failed "No phase durations in ccache -s -v"
+    fi
+    if $CCACHE -s | grep -q '^phase durations'; then
+        test_failed "Phase durations in ccache -s"
+    fi
+    if $CCACHE --print-stats | grep -q '^phase_compiler_cpu_time'; then
+        test_failed "Compiler CPU time recorded for hits"
+    fi
+
+    generate_code 2 test2.c
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'cache miss' 2
+    if ! $HOST_OS_WINDOWS && ! $CCACHE --print-stats | grep -q '^phase_compiler_cpu_time_count[[:space:]]*1$'; then
+        test_failed "Expected one compiler_cpu_time"
+    fi
+
+    $CCACHE -z >/dev/null
+    if $CCACHE --print-stats | grep -q '^phase_'; then
+        test_failed "Phase durations not zeroed"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Time saved by hits"
+
+    $CCACHE_COMPILE -c test1.c
+    spent=$($CCACHE --print-stats | awk '$1 == "time_spent_on_misses" { print $2 }')
+
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    saved=$($CCACHE --print-stats | awk '$1 == "time_saved_by_hits" { print $2 }')
+    if [ "$saved" != "$((2 * spent))" ]; then
+        test_failed "Expected saved time $((2 * spent)), actual $saved"
+    fi
+    if [ "$($CCACHE --print-stats | awk '$1 == "time_spent_on_misses" { print $2 }')" != "$spent" ]; then
+        test_failed "Time spent on misses changed by hits"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_TRACEFILE"
+
+    CCACHE_TRACEFILE=trace.json $CCACHE_COMPILE -c test1.c
+    CCACHE_TRACEFILE=trace.json $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_contains trace.json '"name":"compiler"'
+    expect_contains trace.json '"name":"result_read"'
+    if [ "$(head -n 1 trace.json)" != "[" ]; then
+        test_failed "Trace file does not start a JSON array"
+    fi
+    if [ "$(grep -c '"name":"ccache"' trace.json)" -ne 2 ]; then
+        test_failed "Expected two traced invocations"
+    fi
+
+    CCACHE_TRACEFILE=sampled.json CCACHE_TRACESAMPLERATE=0 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_missing sampled.json
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_EXPLAINMISSES"
+
+    export CCACHE_EXPLAINMISSES=1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    if $CCACHE --explain-miss test1.o >/dev/null 2>&1; then
+        test_failed "--explain-miss succeeded after one compilation"
+    fi
+
+    $CCACHE_COMPILE -O2 -c test1.c
+    expect_stat 'cache miss' 2
+    $CCACHE --explain-miss test1.o >explanation.txt
+    expect_contains explanation.txt "arg added: -O2"
+
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -O2 -c test1.c
+    expect_stat 'cache miss' 3
+    $CCACHE --explain-miss $PWD/test1.o >explanation.txt
+    expect_contains explanation.txt "are identical"
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_EVENTLOG"
+
+    CCACHE_EVENTLOG=events.jsonl $CCACHE_COMPILE -c test1.c
+    CCACHE_EVENTLOG=events.jsonl $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_contains events.jsonl '"input_file":"test1.c"'
+    if [ "$(wc -l <events.jsonl)" -ne 2 ]; then
+        test_failed "Expected two events"
+    fi
+    if ! head -n 1 events.jsonl | grep -q '"result":"cache_miss".*"bytes_retrieved":0,"bytes_stored":[1-9]'; then
+        test_failed "Unexpected miss event: $(head -n 1 events.jsonl)"
+    fi
+    if ! $HOST_OS_WINDOWS && ! head -n 1 events.jsonl | grep -q '"compiler_cpu_us":[1-9][0-9]*,"compiler_max_rss_kib":[1-9]'; then
+        test_failed "No compiler resource usage in miss event: $(head -n 1 events.jsonl)"
+    fi
+    if ! tail -n 1 events.jsonl | grep -q '"result":"preprocessed_cache_hit".*"bytes_retrieved":[1-9][0-9]*,"bytes_stored":0,"compressed_size":0,"result_name":"[0-9a-z]\{1,\}","compiler_duration_ms":[0-9]*,"compiler_cpu_us":0,"compiler_max_rss_kib":0,"compiler_blocks_read":0,"compiler_blocks_written":0}'; then
+        test_failed "Unexpected hit event: $(tail -n 1 events.jsonl)"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "No object file due to bad prefix"
 
@@ -1147,6 +1652,26 @@ EOF
     expect_equal_content reference.stderr test.stderr
     expect_equal_content reference.d test.d
 
+    # -------------------------------------------------------------------------
+    TEST "--metrics"
+
+    CCACHE_PHASEDURATIONS=1 $CCACHE_COMPILE -c test1.c
+    CCACHE_PHASEDURATIONS=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    $CCACHE --metrics >metrics.txt
+    if ! grep -q '^ccache_cache_miss_total 1$' metrics.txt; then
+        test_failed "Expected cache miss counter in --metrics output"
+    fi
+    if ! grep -q '^# TYPE ccache_files_in_cache gauge$' metrics.txt; then
+        test_failed "Expected files in cache gauge in --metrics output"
+    fi
+    if ! grep -q '^ccache_phase_duration_seconds_count{phase="find_compiler"} 2$' metrics.txt; then
+        test_failed "Expected phase histogram in --metrics output"
+    fi
+    if [ "$(tail -n 1 metrics.txt)" != "# EOF" ]; then
+        test_failed "Expected --metrics output to end with # EOF"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "--zero-stats"
 
@@ -1381,6 +1906,555 @@ EOF
         fi
     done
 
+    # -------------------------------------------------------------------------
+    TEST "--train-dictionary"
+
+    for i in $(seq 50); do
+        printf 'int foo%d(int x) { return x * %d; }\nint bar%d;\n' $i $i $i >dict$i.c
+        $CCACHE_COMPILE -c dict$i.c
+    done
+    expect_stat 'cache miss' 50
+
+    $CCACHE --train-dictionary >train.out
+    if [ $? -ne 0 ]; then
+        test_failed "--train-dictionary failed: $(cat train.out)"
+    fi
+    expect_exists $CCACHE_DIR/dictionaries/current
+    dictionary_id=$(cat $CCACHE_DIR/dictionaries/current)
+    expect_exists $CCACHE_DIR/dictionaries/$dictionary_id
+
+    echo 'int new_file;' >new.c
+    $CCACHE_COMPILE -c new.c
+    expect_stat 'cache miss' 51
+    result=$(find $CCACHE_DIR -name '*R' -newer $CCACHE_DIR/dictionaries/current)
+    if ! $CCACHE --dump-result $result | grep -q "Dictionary ID: $dictionary_id"; then
+        test_failed "New result not compressed with the dictionary"
+    fi
+
+    # The dictionary is evaluated along with the plain compression levels.
+    $CCACHE --evaluate-compression 10 >evaluate.out
+    if [ $? -ne 0 ]; then
+        test_failed "--evaluate-compression failed: $(cat evaluate.out)"
+    fi
+    expect_contains evaluate.out "Evaluated 10 cache entries"
+    expect_contains evaluate.out "zstd level 19"
+    expect_contains evaluate.out "zstd with dictionary level 3"
+
+    # Existing entries are compressed with the dictionary when recompressed.
+    $CCACHE -X 1 >/dev/null
+    for result in $(find $CCACHE_DIR -name '*R'); do
+        if ! $CCACHE --dump-result $result | grep -q "Dictionary ID: $dictionary_id"; then
+            test_failed "Recompressed result not compressed with the dictionary"
+        fi
+    done
+    $CCACHE_COMPILE -c dict1.c
+    $CCACHE_COMPILE -c new.c
+    expect_stat 'cache hit (preprocessed)' 2
+
+    # -------------------------------------------------------------------------
+if $HOST_OS_LINUX; then
+    TEST "Compiler output kept in memory"
+
+    cat <<EOF >warning.c
+#warning here
+int x;
+EOF
+    # Any use of the temporary directory would fail. Without run_second_cpp,
+    # the preprocessed output must be a file for the compiler to read.
+    unset CCACHE_NOCPP2
+    touch not_a_dir
+    export CCACHE_TEMPDIR=$PWD/not_a_dir/tmp
+
+    $CCACHE_COMPILE -c warning.c 2>stderr1.txt
+    expect_stat 'cache miss' 1
+    expect_contains stderr1.txt here
+
+    $CCACHE_COMPILE -c warning.c 2>stderr2.txt
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_equal_content stderr1.txt stderr2.txt
+fi
+
+    # -------------------------------------------------------------------------
+    TEST "--recompress with rate limit and low priority"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    CCACHE_RECOMPRESSLOWPRIORITY=1 CCACHE_RECOMPRESSRATELIMIT=1M $CCACHE -X 19 >/dev/null
+    for result in $(find $CCACHE_DIR -name '*R'); do
+        if ! $CCACHE --dump-result $result | grep -q "Compression level: 19"; then
+            test_failed "Result not recompressed to level 19"
+        fi
+    done
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "--scrub"
+
+    export CCACHE_NOCOMPRESS=1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+
+    $CCACHE --scrub >scrub.txt
+    expect_contains scrub.txt "Verified 1 results, removed 0 corrupt results"
+
+    # Corrupt the checksum without changing the size.
+    result=$(find $CCACHE_DIR -name '*R')
+    size=$(wc -c <$result)
+    if [ "$(tail -c 1 $result)" = x ]; then byte=y; else byte=x; fi
+    printf $byte | dd of=$result bs=1 seek=$((size - 1)) conv=notrunc 2>/dev/null
+
+    if $HOST_OS_LINUX && python3 -c "import os, sys; os.getxattr(sys.argv[1], 'user.ccache.scrubbed')" $result 2>/dev/null; then
+        CCACHE_TRUSTSCRUBBED=1 $CCACHE_COMPILE -c test1.c
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 1
+    fi
+
+    $CCACHE --scrub >scrub.txt
+    expect_contains scrub.txt "Verified 0 results, removed 1 corrupt results"
+    expect_stat 'files in cache' 0
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 1
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_CACHEFAILURES"
+
+    echo 'int x = ;' >fail.c
+
+    $CCACHE_COMPILE -c fail.c 2>stderr1.txt
+    status1=$?
+    expect_stat 'compile failed' 1
+    expect_stat 'files in cache' 0
+    if [ $status1 -eq 0 ]; then
+        test_failed "Expected failure"
+    fi
+
+    export CCACHE_CACHEFAILURES=1
+
+    $CCACHE_COMPILE -c fail.c 2>stderr2.txt
+    status2=$?
+    expect_stat 'compile failed' 2
+    expect_stat 'files in cache' 1
+    if [ $status2 -ne $status1 ]; then
+        test_failed "Expected exit status $status1, got $status2"
+    fi
+    expect_equal_content stderr1.txt stderr2.txt
+
+    touch fail.o
+    $CCACHE_COMPILE -c fail.c 2>stderr3.txt
+    status3=$?
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'compile failed' 2
+    if [ $status3 -ne $status1 ]; then
+        test_failed "Expected exit status $status1, got $status3"
+    fi
+    expect_equal_content stderr1.txt stderr3.txt
+    expect_missing fail.o
+
+    CCACHE_MAXFAILUREAGE=1s $CCACHE_COMPILE -c fail.c 2>/dev/null
+    expect_stat 'cache hit (preprocessed)' 2
+
+    sleep 2
+    CCACHE_MAXFAILUREAGE=1s $CCACHE_COMPILE -c fail.c 2>/dev/null
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'compile failed' 3
+
+    unset CCACHE_CACHEFAILURES
+    $CCACHE_COMPILE -c fail.c 2>/dev/null
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'compile failed' 4
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SESSION"
+
+    CCACHE_SESSION=job1 $CCACHE_COMPILE -c test1.c
+    CCACHE_SESSION=job2 $CCACHE_COMPILE -c test1.c
+    CCACHE_SESSION=job2 $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_stat 'cache hit (preprocessed)' 3
+
+    $CCACHE -s --session job1 >job1.txt
+    expect_contains job1.txt "session                             job1"
+    if ! grep -Eq "^cache miss +1$" job1.txt; then
+        test_failed "Expected 1 miss in session job1: $(cat job1.txt)"
+    fi
+    if ! grep -Eq "^cache hit \(preprocessed\) +0$" job1.txt; then
+        test_failed "Unexpected hit in session job1: $(cat job1.txt)"
+    fi
+    $CCACHE --session job2 -s >job2.txt
+    if ! grep -Eq "^cache hit \(preprocessed\) +2$" job2.txt; then
+        test_failed "Expected 2 hits in session job2: $(cat job2.txt)"
+    fi
+
+    # Zeroing the whole cache keeps the sessions and vice versa.
+    $CCACHE -z >/dev/null
+    $CCACHE -s --session job1 >job1.txt
+    if ! grep -Eq "^cache miss +1$" job1.txt; then
+        test_failed "Session job1 was zeroed: $(cat job1.txt)"
+    fi
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE -z --session job1 >/dev/null
+    expect_stat 'cache hit (preprocessed)' 1
+    if $CCACHE -s --session job1 >/dev/null 2>&1; then
+        test_failed "Session job1 was not removed"
+    fi
+
+    # -------------------------------------------------------------------------
+    if $COMPILER_TYPE_GCC || $COMPILER_TYPE_CLANG; then
+        TEST "CCACHE_IGNOREWARNINGOPTIONS"
+
+        echo 'int f(int x) { int unused; return x; }' >warn.c
+        unset CCACHE_NOCPP2
+        export CCACHE_IGNOREWARNINGOPTIONS=1
+
+        $CCACHE_COMPILE -c warn.c 2>stderr1.txt
+        expect_stat 'cache miss' 1
+        expect_content stderr1.txt ""
+
+        $CCACHE_COMPILE -Wall -c warn.c 2>stderr2.txt
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 1
+        expect_contains stderr2.txt unused
+        expect_contains $CCACHE_LOGFILE "Regenerating diagnostics"
+
+        $CCACHE_COMPILE -c warn.c 2>stderr3.txt
+        expect_stat 'cache hit (preprocessed)' 2
+        expect_content stderr3.txt ""
+
+        rm warn.o
+        $CCACHE_COMPILE -Wall -Werror -c warn.c 2>stderr4.txt
+        status=$?
+        expect_stat 'cache hit (preprocessed)' 2
+        expect_stat 'compile failed' 1
+        if [ $status -eq 0 ]; then
+            test_failed "Expected failure"
+        fi
+        expect_contains stderr4.txt unused
+        expect_missing warn.o
+
+        unset CCACHE_IGNOREWARNINGOPTIONS
+        $CCACHE_COMPILE -Wall -c warn.c 2>/dev/null
+        expect_stat 'cache miss' 2
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_CACHELINKS"
+
+    echo 'int f(void) { return 1; }' >f.c
+    echo 'int f(void); int main(void) { return f(); }' >main.c
+    $COMPILER -c f.c main.c
+
+    $CCACHE_COMPILE f.o main.o -o prog
+    expect_stat 'called for link' 1
+
+    export CCACHE_CACHELINKS=1
+
+    $CCACHE_COMPILE f.o main.o -o prog
+    expect_stat 'called for link' 1
+    expect_stat 'link not in cache' 1
+    expect_stat 'files in cache' 1
+    cp prog prog.ref
+
+    rm prog
+    $CCACHE_COMPILE f.o main.o -o prog
+    expect_stat 'cache hit (link)' 1
+    expect_equal_content prog prog.ref
+    if [ ! -x prog ]; then
+        test_failed "prog is not executable"
+    fi
+
+    echo 'int f(void) { return 2; }' >f.c
+    $COMPILER -c f.c
+    $CCACHE_COMPILE f.o main.o -o prog
+    expect_stat 'cache hit (link)' 1
+    expect_stat 'link not in cache' 2
+
+    echo 'int f(void) { return 3; }' >f.c
+    $COMPILER -c f.c
+    CCACHE_MAXLINKSIZE=1k $CCACHE_COMPILE f.o main.o -o prog2
+    expect_stat 'link not in cache' 3
+    expect_stat 'files in cache' 2
+    expect_exists prog2
+
+    echo f.o main.o >link_args.txt
+    $CCACHE_COMPILE @link_args.txt -o prog3
+    expect_stat 'called for link' 2
+
+    unset CCACHE_CACHELINKS
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_ADMISSIONTHRESHOLD"
+
+    export CCACHE_ADMISSIONTHRESHOLD=2
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_stat 'result not admitted' 1
+    expect_stat 'files in cache' 0
+    expect_exists test1.o
+    expect_exists $CCACHE_DIR/miss_frequencies
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 2
+    expect_stat 'result not admitted' 1
+    expect_stat 'files in cache' 1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
+    unset CCACHE_ADMISSIONTHRESHOLD
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_CACHECOMPILERQUERIES"
+
+    $COMPILER -dumpmachine >machine.ref
+
+    $CCACHE_COMPILE -dumpmachine >machine.txt
+    expect_stat 'no input file' 1
+
+    export CCACHE_CACHECOMPILERQUERIES=1
+
+    $CCACHE_COMPILE -dumpmachine >machine.txt
+    expect_stat 'query not in cache' 1
+    expect_stat 'files in cache' 1
+    expect_equal_content machine.txt machine.ref
+
+    $CCACHE_COMPILE -dumpmachine >machine.txt
+    expect_stat 'cache hit (query)' 1
+    expect_stat 'query not in cache' 1
+    expect_equal_content machine.txt machine.ref
+
+    $CCACHE_COMPILE --version >version.txt
+    $CCACHE_COMPILE --version >version2.txt
+    expect_stat 'cache hit (query)' 2
+    expect_stat 'query not in cache' 2
+    expect_equal_content version2.txt version.txt
+
+    # Failed queries are not cached.
+    $CCACHE_COMPILE -print-no-such-thing 2>/dev/null
+    $CCACHE_COMPILE -print-no-such-thing 2>/dev/null
+    expect_stat 'no input file' 3
+    expect_stat 'files in cache' 2
+
+    unset CCACHE_CACHECOMPILERQUERIES
+
+    # -------------------------------------------------------------------------
+    if ! $HOST_OS_WINDOWS; then
+        TEST "CCACHE_COALESCETIMEOUT"
+
+        cat >slow-prefix <<'EOF'
+#!/bin/sh
+sleep 1
+exec "$@"
+EOF
+        chmod +x slow-prefix
+
+        export CCACHE_COALESCETIMEOUT=10000
+        export CCACHE_PREFIX=$PWD/slow-prefix
+
+        $CCACHE_COMPILE -c test1.c -o first.o &
+        sleep 0.3
+        $CCACHE_COMPILE -c test1.c -o second.o
+        wait
+        expect_stat 'cache miss' 1
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_contains $CCACHE_LOGFILE "Compile claim"
+        expect_equal_object_files first.o second.o
+        expect_missing $CCACHE_DIR/claims/*
+
+        unset CCACHE_COALESCETIMEOUT CCACHE_PREFIX
+    fi
+
+    # -------------------------------------------------------------------------
+    if $COMPILER -march=native -c test1.c -o /dev/null >/dev/null 2>&1; then
+        TEST "-march=native"
+
+        $CCACHE_COMPILE -march=native -c test1.c
+        expect_stat 'cache hit (preprocessed)' 0
+        expect_stat 'cache miss' 1
+        expect_contains $CCACHE_LOGFILE "Hashing -march=native as "
+
+        $CCACHE_COMPILE -march=native -c test1.c
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 1
+
+        $CCACHE_COMPILE -c test1.c
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 2
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_KEEPIDENTICALOUTPUTS"
+
+    export CCACHE_KEEPIDENTICALOUTPUTS=1
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    cp test1.o reference.o
+
+    # An identical object file keeps its modification time.
+    backdate marker test1.o
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_contains $CCACHE_LOGFILE "Keeping identical test1.o"
+    expect_newer_than marker test1.o
+    expect_equal_object_files reference.o test1.o
+
+    # A different one is replaced.
+    echo garbage >test1.o
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_equal_object_files reference.o test1.o
+
+    # Results stored without digests are retrieved as usual.
+    unset CCACHE_KEEPIDENTICALOUTPUTS
+    $CCACHE -C >/dev/null
+    $CCACHE_COMPILE -c test1.c
+    backdate marker test1.o
+    CCACHE_KEEPIDENTICALOUTPUTS=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+    if ! [ test1.o -nt marker ]; then
+        test_failed "test1.o was not rewritten"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_DEDUPLICATION"
+
+    mkdir dir1 dir2
+    echo 'int big[8192] = {1};' >dir1/big.c
+    cp dir1/big.c dir2/big.c
+
+    CCACHE_DEDUPLICATION=1 $CCACHE_COMPILE -c dir1/big.c -o dir1/big.o
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+
+    CCACHE_DEDUPLICATION=1 $CCACHE_COMPILE -c dir2/big.c -o dir2/big.o
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 3
+    expect_equal_object_files dir1/big.o dir2/big.o
+
+    rm dir1/big.o dir2/big.o
+    CCACHE_DEDUPLICATION=1 $CCACHE_COMPILE -c dir1/big.c -o dir1/big.o
+    CCACHE_DEDUPLICATION=1 $CCACHE_COMPILE -c dir2/big.c -o dir2/big.o
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_equal_object_files dir1/big.o dir2/big.o
+
+    # A result referring to a removed shared file is a cache miss.
+    for result in $(find $CCACHE_DIR -name '*R'); do
+        content_size=$($CCACHE --dump-result $result 2>/dev/null | sed -n 's/^Content size: //p')
+        if [ $content_size -gt 32768 ]; then
+            rm $result
+        fi
+    done
+    expect_file_count 2 '*R' $CCACHE_DIR
+    CCACHE_DEDUPLICATION=1 $CCACHE_COMPILE -c dir1/big.c -o dir1/big.o
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_MAXDELTACHAIN"
+
+    awk 'BEGIN { srand(1); printf "int big[] = {"; for (i = 0; i < 20000; i++) printf "%d,", int(rand() * 1000000); print "};" }' >big.c
+    export CCACHE_MAXDELTACHAIN=2
+
+    for i in 1 2 3 4; do
+        echo "int v$i;" >>big.c
+        $CCACHE_COMPILE -c big.c
+        expect_stat 'cache miss' $i
+        cp big.o big$i.o
+    done
+    # The second and third results are deltas against the first and second, but
+    # the fourth would exceed the chain length limit.
+    expect_contains $CCACHE_LOGFILE "(depth 2)"
+    expect_not_contains $CCACHE_LOGFILE "(depth 3)"
+    expect_file_count 4 '*R' $CCACHE_DIR
+
+    rm big.o
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_equal_object_files big4.o big.o
+
+    # Results of earlier versions are still usable.
+    head -n 1 big.c >big.c.tmp
+    echo "int v1;" >>big.c.tmp
+    echo "int v2;" >>big.c.tmp
+    echo "int v3;" >>big.c.tmp
+    mv big.c.tmp big.c
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_equal_object_files big3.o big.o
+
+    # A result whose delta base has been removed is a cache miss.
+    base=$(sed -n 's/.* as a delta of .* against \([0-9a-z]*\) (depth 1)$/\1/p' $CCACHE_LOGFILE | head -n 1)
+    rm $CCACHE_DIR/${base:0:1}/${base:1:1}/${base:2}R
+    rm big.o
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 5
+    expect_equal_object_files big3.o big.o
+
+    unset CCACHE_MAXDELTACHAIN
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_FRAMEDRESULTS"
+
+    echo 'int x;' >test2.c
+    echo '#warning hello' >>test2.c
+    $REAL_COMPILER -c -MMD -MF reference_test2.d test2.c 2>reference_stderr.txt
+    mv test2.o reference_test2.o
+
+    for compress in 1 0; do
+        if [ $compress -eq 0 ]; then
+            export CCACHE_NOCOMPRESS=1
+        fi
+        $CCACHE -C >/dev/null
+        rm -f test2.o test2.d
+
+        CCACHE_FRAMEDRESULTS=1 $CCACHE_COMPILE -c -MMD -MF test2.d test2.c 2>stderr.txt
+        expect_stat 'files in cache' 1
+        result=$(find $CCACHE_DIR -name '*R')
+        if ! $CCACHE --dump-result $result | grep -q "^Version: 2$"; then
+            test_failed "Result not framed"
+        fi
+
+        rm test2.o test2.d
+        $CCACHE_COMPILE -c -MMD -MF test2.d test2.c 2>stderr.txt
+        expect_equal_object_files reference_test2.o test2.o
+        expect_equal_content reference_test2.d test2.d
+        expect_equal_content reference_stderr.txt stderr.txt
+
+        $CCACHE --extract-result $result
+        expect_equal_object_files reference_test2.o ccache-result.o
+        expect_equal_content reference_test2.d ccache-result.d
+        rm ccache-result.*
+    done
+    unset CCACHE_NOCOMPRESS
+    expect_stat 'cache hit (preprocessed)' 2
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_FRAMEDRESULTS, parallel decompression"
+
+    echo 'int big[300000] = {1};' >test2.c
+    echo '#warning hello' >>test2.c
+    $REAL_COMPILER -c -MMD -MF reference_test2.d test2.c 2>reference_stderr.txt
+    mv test2.o reference_test2.o
+
+    CCACHE_FRAMEDRESULTS=1 $CCACHE_COMPILE -c -MMD -MF test2.d test2.c 2>stderr.txt
+    expect_stat 'cache miss' 1
+
+    rm test2.o test2.d
+    $CCACHE_COMPILE -c -MMD -MF test2.d test2.c 2>stderr.txt
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_equal_object_files reference_test2.o test2.o
+    expect_equal_content reference_test2.d test2.d
+    expect_equal_content reference_stderr.txt stderr.txt
+
     # -------------------------------------------------------------------------
     TEST "--hash-file"
 
@@ -1396,6 +2470,47 @@ EOF
     else
         test_failed "Unexpected output of --hash-file"
     fi
+
+    # -------------------------------------------------------------------------
+    TEST "Generic command with --run"
+
+    cat >gen.sh <<EOF
+#!/bin/sh
+echo generating
+tr a-z A-Z <"\$1" >"\$2"
+cat "\$1" "\$1" >"\$3"
+EOF
+    chmod +x gen.sh
+    backdate gen.sh
+    echo abc >in.txt
+
+    $CCACHE --run --input in.txt --output out1.txt --output out2.txt -- \
+        ./gen.sh in.txt out1.txt out2.txt >stdout.txt
+    expect_stat 'command not in cache' 1
+    expect_stat 'files in cache' 1
+    expect_content out1.txt "ABC"
+    expect_content stdout.txt "generating"
+
+    rm out1.txt out2.txt stdout.txt
+    $CCACHE --run --input in.txt --output out1.txt --output out2.txt -- \
+        ./gen.sh in.txt out1.txt out2.txt >stdout.txt
+    expect_stat 'cache hit (command)' 1
+    expect_stat 'command not in cache' 1
+    expect_content out1.txt "ABC"
+    printf "abc\nabc\n" >expected.txt
+    expect_equal_content expected.txt out2.txt
+    expect_content stdout.txt "generating"
+
+    echo def >in.txt
+    $CCACHE --run --input in.txt --output out1.txt --output out2.txt -- \
+        ./gen.sh in.txt out1.txt out2.txt >/dev/null
+    expect_stat 'cache hit (command)' 1
+    expect_stat 'command not in cache' 2
+    expect_content out1.txt "DEF"
+
+    if $CCACHE --run --input in.txt -- ./gen.sh 2>/dev/null; then
+        test_failed "--run without --output succeeded"
+    fi
 }
 
 # =============================================================================
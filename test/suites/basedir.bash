@@ -311,4 +311,25 @@ EOF
         expect_stat 'cache miss' 1
         expect_equal_content reference.stderr ccache.stderr
     fi
+
+    # -------------------------------------------------------------------------
+    TEST "Absolute paths in stderr spanning many chunks"
+
+    for i in $(seq 5000); do
+        echo "#warning warning number $i"
+    done >test.h
+    echo '#include "test.h"' >test.c
+    backdate test.h
+
+    pwd=$PWD.real
+    $REAL_COMPILER -c $pwd/test.c 2>reference.stderr
+
+    CCACHE_ABSSTDERR=1 CCACHE_BASEDIR="$pwd" $CCACHE_COMPILE -c $pwd/test.c 2>ccache.stderr
+    expect_stat 'cache miss' 1
+    expect_equal_content reference.stderr ccache.stderr
+
+    CCACHE_ABSSTDERR=1 CCACHE_BASEDIR="$pwd" $CCACHE_COMPILE -c $pwd/test.c 2>ccache.stderr
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_content reference.stderr ccache.stderr
 }
@@ -0,0 +1,68 @@
+SUITE_bundles_SETUP() {
+    generate_code 1 test.c
+}
+
+SUITE_bundles() {
+    # -------------------------------------------------------------------------
+    TEST "Export and import"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    $CCACHE --export cache.bundle >export.out
+    expect_contains export.out "Exported 1 files"
+    $CCACHE -C >/dev/null
+    $CCACHE -z >/dev/null
+
+    $CCACHE --import cache.bundle >import.out
+    expect_contains import.out "Imported 1 of 1 files"
+    expect_stat 'files in cache' 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+
+    $CCACHE --import cache.bundle >import.out
+    expect_contains import.out "Imported 0 of 1 files"
+
+    # -------------------------------------------------------------------------
+    TEST "Export of most recently used files"
+
+    generate_code 2 test2.c
+    $CCACHE_COMPILE -c test.c
+    touch -d '-1 hour' $(find $CCACHE_DIR -name '*R')
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'files in cache' 2
+
+    size=$(find $CCACHE_DIR -name '*R' -newer test.o -exec cat {} + | wc -c)
+    size=$(awk "BEGIN { printf \"%.3fk\", $size / 1000 }")
+    $CCACHE --export-size $size --export cache.bundle >export.out
+    expect_contains export.out "Exported 1 files"
+    $CCACHE -C >/dev/null
+    $CCACHE --import cache.bundle >/dev/null
+
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'cache hit (preprocessed)' 1
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "Bundle as lower cache"
+
+    $COMPILER -c test.c -o reference_test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    $CCACHE --export cache.bundle >/dev/null
+    $CCACHE -C >/dev/null
+    export CCACHE_LOWERCACHEDIRS=$PWD/cache.bundle
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 0
+    expect_equal_object_files reference_test.o test.o
+
+    CCACHE_LOWERCACHECOPYUP=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'files in cache' 1
+}
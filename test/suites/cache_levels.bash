@@ -121,4 +121,64 @@ SUITE_cache_levels() {
     expect_stat 'files in cache' $((files + 2))
     expect_on_level R 4
     expect_on_level M 4
+
+    # -------------------------------------------------------------------------
+    TEST "Level recorded when moving files"
+
+    files=$((16 * 16 * 2001))
+    add_fake_files_counters $files
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+    level_files=$(find $CCACHE_DIR -name level)
+    if [ -z "$level_files" ]; then
+        test_failed "No level file written"
+    fi
+    for level_file in $level_files; do
+        expect_content $level_file 3
+    done
+
+    # -------------------------------------------------------------------------
+    TEST "Recorded level is not decreased automatically"
+
+    add_fake_files_counters 0
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        echo 3 >$CCACHE_DIR/$x/level
+    done
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+
+    # -------------------------------------------------------------------------
+    TEST "--rebalance"
+
+    files=$((16 * 16 * 2001))
+    add_fake_files_counters $files
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+    expect_on_level R 3
+    expect_on_level M 3
+
+    $CCACHE --rebalance >/dev/null
+    expect_on_level R 2
+    expect_on_level M 2
+    for level_file in $(find $CCACHE_DIR -name level); do
+        expect_content $level_file 2
+    done
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
 }
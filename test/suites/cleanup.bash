@@ -64,6 +64,55 @@ SUITE_cleanup() {
         expect_exists $file
     done
 
+    # -------------------------------------------------------------------------
+    TEST "Forced cache cleanup, raw files of evicted results"
+
+    prepare_cleanup_test_dir $CCACHE_DIR/a
+    printf '%4017s' '' | tr ' ' 'A' >$CCACHE_DIR/a/result00W
+    # NUMFILES: 11, TOTALSIZE: 17 KiB, MAXFILES: 0, MAXSIZE: 0
+    echo "0 0 0 0 0 0 0 0 0 0 0 11 17 0 0" >$CCACHE_DIR/a/stats
+
+    # The raw file is recently used but useless without its result.
+    $CCACHE -F 112 -M 0 >/dev/null
+    $CCACHE -c >/dev/null
+    expect_file_count 7 '*R' $CCACHE_DIR
+    expect_file_count 0 '*W' $CCACHE_DIR
+    expect_stat 'files in cache' 7
+    expect_missing $CCACHE_DIR/a/result0R
+    expect_missing $CCACHE_DIR/a/result00W
+
+    # -------------------------------------------------------------------------
+    TEST "Cache cleanup, raw files aged as their result"
+
+    prepare_raw_file_test_dir() {
+        prepare_cleanup_test_dir $1
+        # The raw file was stored long ago but its result was used recently.
+        printf '%4017s' '' | tr ' ' 'A' >$1/result90W
+        backdate 0 $1/result90W
+        # NUMFILES: 11, TOTALSIZE: 17 KiB, MAXFILES: 0, MAXSIZE: 0
+        echo "0 0 0 0 0 0 0 0 0 0 0 11 17 0 0" >$1/stats
+    }
+
+    prepare_raw_file_test_dir $CCACHE_DIR/a
+    $CCACHE -F 112 -M 0 >/dev/null
+    $CCACHE -c >/dev/null
+    expect_file_count 6 '*R' $CCACHE_DIR
+    expect_missing $CCACHE_DIR/a/result3R
+    expect_exists $CCACHE_DIR/a/result9R
+    expect_exists $CCACHE_DIR/a/result90W
+
+    # The same using the LRU index.
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_raw_file_test_dir $CCACHE_DIR/$x
+    done
+    $CCACHE -F 0 -M 0 -c >/dev/null # create LRU indexes
+    $CCACHE -F 176 -M 0 >/dev/null
+
+    touch empty.c
+    CCACHE_LIMIT_MULTIPLE=0.9 $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_file_count 16 'result90W' $CCACHE_DIR
+
     # -------------------------------------------------------------------------
     if [ -n "$ENABLE_CACHE_CLEANUP_TESTS" ]; then
         TEST "Forced cache cleanup, size limit"
@@ -129,6 +178,209 @@ SUITE_cleanup() {
     expect_stat 'files in cache' 157
     expect_stat 'cleanups performed' 1
 
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup leased by another host"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+        ln -s "other-host:1:0:$(($(date +%s) + 100))" \
+           $CCACHE_DIR/$x/cleanup.lease
+    done
+
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    touch empty.c
+    CCACHE_LIMIT_MULTIPLE=0.9 $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 161 '*R' $CCACHE_DIR
+    expect_stat 'cleanups performed' 0
+    if ! grep -q "is leased by other-host" $CCACHE_LOGFILE; then
+        test_failed "Cleanup lease was not respected"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup using LRU index"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 0 -M 0 -c >/dev/null # create LRU indexes
+    expect_file_count 16 'lru' $CCACHE_DIR
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    # Files used without the index knowing about it must not be evicted.
+    touch $CCACHE_DIR/*/result0R
+
+    touch empty.c
+    CCACHE_LIMIT_MULTIPLE=0.9 $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_file_count 16 'result0R' $CCACHE_DIR
+    expect_stat 'files in cache' 159
+    expect_stat 'cleanups performed' 1
+    if ! grep -q "from LRU index" $CCACHE_LOGFILE; then
+        test_failed "Cleanup did not use the LRU index"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Cost-aware cache cleanup"
+
+    prepare_cleanup_test_dir $CCACHE_DIR/a
+
+    $CCACHE -F 0 -M 0 -c >/dev/null # create LRU index
+    expect_exists $CCACHE_DIR/a/lru
+
+    # Record that the oldest result took a minute to compile.
+    echo "1 4096 60000 - aresult0R" >>$CCACHE_DIR/a/lru
+
+    CCACHE_CLEANUPPOLICY=gdsf $CCACHE -F 144 -M 0 -c >/dev/null
+    expect_file_count 9 '*R' $CCACHE_DIR
+    expect_exists $CCACHE_DIR/a/result0R
+    expect_missing $CCACHE_DIR/a/result1R
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup of namespace"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 0 -M 0 -c >/dev/null # create LRU indexes
+
+    # Only files of the namespace are evicted when only the namespace is over
+    # its limit.
+    echo 'int x;' >test1.c
+    CCACHE_NAMESPACE=team CCACHE_NAMESPACEMAXSIZE=1k \
+        $CCACHE_COMPILE -c test1.c
+    expect_file_count 160 '*R' $CCACHE_DIR
+    expect_stat 'cleanups performed' 1
+
+    touch empty.c
+    CCACHE_NAMESPACE=team $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 161 '*R' $CCACHE_DIR
+    CCACHE_NAMESPACE=team $CCACHE -s >stats.txt
+    expect_contains stats.txt "namespace cache size"
+
+    $CCACHE -C >/dev/null
+    expect_missing $CCACHE_DIR/namespaces
+
+    # -------------------------------------------------------------------------
+    TEST "Pinned namespace"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 0 -M 0 -c >/dev/null # create LRU indexes
+
+    echo 'int x;' >test1.c
+    CCACHE_NAMESPACE=release $CCACHE_COMPILE -c test1.c
+    expect_file_count 161 '*R' $CCACHE_DIR
+
+    $CCACHE --pin release=1M >pin.txt
+    expect_contains pin.txt "Pinned up to 1.0 MB of namespace release"
+    sleep 2
+
+    $CCACHE --evict-older-than 1s >/dev/null
+    expect_file_count 1 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 1
+
+    # Files that don't fit in the subdirectory's share of the size are not
+    # protected.
+    $CCACHE --pin release=1k >/dev/null
+    $CCACHE --evict-older-than 1s >/dev/null
+    expect_file_count 0 '*R' $CCACHE_DIR
+
+    $CCACHE --pin release=0 >pin.txt
+    expect_contains pin.txt "Unpinned namespace release"
+    expect_missing $CCACHE_DIR/pinned_namespaces
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup by sampling"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    touch empty.c
+    CCACHE_CLEANUPSAMPLESIZE=3 CCACHE_LIMIT_MULTIPLE=0.9 \
+        $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 159
+    expect_stat 'cleanups performed' 1
+    if ! grep -q "from counters" $CCACHE_LOGFILE; then
+        test_failed "Cleanup did not use sampling"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Automatic cache cleanup in background"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    touch empty.c
+    CCACHE_BACKGROUNDCLEANUP=1 CCACHE_LIMIT_MULTIPLE=0.9 \
+        $CCACHE_COMPILE -c empty.c -o empty.o
+    for i in $(seq 50); do
+        if [ -z "$(find $CCACHE_DIR -name cleanup)" ] \
+           && $CCACHE --print-stats | grep -q '^cleanups_performed[[:space:]]*1$'; then
+            break
+        fi
+        sleep 0.1
+    done
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_stat 'files in cache' 159
+    expect_stat 'cleanups performed' 1
+    if ! grep -q "Started background cleanup process" $CCACHE_LOGFILE; then
+        test_failed "Cleanup was not done in the background"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Background cleanup needs a jobserver token"
+
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+
+    $CCACHE -F 160 -M 0 >/dev/null
+
+    touch empty.c
+    mkfifo jobserver
+    MAKEFLAGS="-j2 --jobserver-auth=fifo:$PWD/jobserver" \
+        CCACHE_BACKGROUNDCLEANUP=1 CCACHE_LIMIT_MULTIPLE=0.9 \
+        $CCACHE_COMPILE -c empty.c -o empty.o
+    expect_file_count 159 '*R' $CCACHE_DIR
+    expect_stat 'cleanups performed' 1
+    if ! grep -q "No jobserver token available" $CCACHE_LOGFILE; then
+        test_failed "Cleanup was done in the background without a token"
+    fi
+
+    $CCACHE -z >/dev/null
+    for x in 0 1 2 3 4 5 6 7 8 9 a b c d e f; do
+        prepare_cleanup_test_dir $CCACHE_DIR/$x
+    done
+    rm $CCACHE_LOGFILE
+
+    # The background cleanup returns the token when done.
+    exec 3<>jobserver
+    printf + >&3
+    MAKEFLAGS="-j2 --jobserver-auth=fifo:$PWD/jobserver" \
+        CCACHE_BACKGROUNDCLEANUP=1 CCACHE_LIMIT_MULTIPLE=0.9 \
+        $CCACHE_COMPILE -c empty.c -o empty.o
+    if ! grep -q "Started background cleanup process" $CCACHE_LOGFILE; then
+        test_failed "Cleanup was not done in the background"
+    fi
+    token=
+    read -r -t 10 -n 1 -u 3 token
+    exec 3>&-
+    if [ "$token" != "+" ]; then
+        test_failed "Jobserver token was not returned"
+    fi
+
     # -------------------------------------------------------------------------
     TEST "No cleanup of new unknown file"
 
@@ -198,4 +450,95 @@ SUITE_cleanup() {
     backdate $CCACHE_DIR/a/nowR
     $CCACHE --evict-older-than 10s  >/dev/null
     expect_stat 'files in cache' 0
+
+    # -------------------------------------------------------------------------
+    TEST "Resuming interrupted eviction of old files"
+
+    prepare_cleanup_test_dir $CCACHE_DIR/a
+    prepare_cleanup_test_dir $CCACHE_DIR/b
+    $CCACHE -F 0 -M 0 >/dev/null
+    printf 'evict-older-than 10\na\n' >$CCACHE_DIR/maintenance.checkpoint
+
+    $CCACHE --evict-older-than 10s >/dev/null
+    expect_file_count 10 '*R' $CCACHE_DIR/a
+    expect_file_count 0 '*R' $CCACHE_DIR/b
+    expect_missing $CCACHE_DIR/maintenance.checkpoint
+
+    $CCACHE --evict-older-than 10s >/dev/null
+    expect_file_count 0 '*R' $CCACHE_DIR/a
+
+    # -------------------------------------------------------------------------
+    TEST "Presence filter rebuilt by cleanup"
+
+    export CCACHE_PRESENCEFILTER=1
+    echo 'int x;' >test1.c
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    # The filters are created but not trusted until rebuilt.
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    if [ -z "$(find $CCACHE_DIR -name presence)" ]; then
+        test_failed "No presence filter was created"
+    fi
+
+    $CCACHE -c >/dev/null
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+
+    # Entries that the filters don't know about are not found...
+    (cd $CCACHE_DIR && find . -name '*[MR]' | tar cf - -T -) >entries.tar
+    $CCACHE -C >/dev/null
+    (cd $CCACHE_DIR && tar xf -) <entries.tar
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 2
+
+    # ...until the filters have been rebuilt.
+    $CCACHE -C >/dev/null
+    (cd $CCACHE_DIR && tar xf -) <entries.tar
+    $CCACHE -c >/dev/null
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+
+    # -------------------------------------------------------------------------
+    TEST "Packing of small cache entries"
+
+    unset CCACHE_NODIRECT
+    export CCACHE_PACKMAXFILESIZE=64k
+    echo 'int x;' >test1.c
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    # Recently used entries are not packed.
+    $CCACHE -c >/dev/null
+    expect_file_count 2 '*[MR]' $CCACHE_DIR
+    expect_file_count 0 'pack' $CCACHE_DIR
+
+    backdate $(find $CCACHE_DIR -name '*[MR]')
+    $CCACHE -c >/dev/null
+    expect_file_count 0 '*[MR]' $CCACHE_DIR
+    if [ -z "$(find $CCACHE_DIR -name pack)" ]; then
+        test_failed "No pack was written"
+    fi
+    expect_stat 'files in cache' 2
+
+    # Packed entries are unpacked when used.
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_file_count 2 '*[MR]' $CCACHE_DIR
+
+    # Disabling packing unpacks the remaining entries.
+    backdate $(find $CCACHE_DIR -name '*[MR]')
+    $CCACHE -c >/dev/null
+    expect_file_count 0 '*[MR]' $CCACHE_DIR
+    CCACHE_PACKMAXFILESIZE=0 $CCACHE -c >/dev/null
+    expect_file_count 2 '*[MR]' $CCACHE_DIR
+    expect_file_count 0 'pack' $CCACHE_DIR
+    expect_stat 'files in cache' 2
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 2
 }
@@ -0,0 +1,92 @@
+SUITE_compile_servers_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "--serve-compiles is not supported on Windows"
+    fi
+}
+
+start_compile_server() {
+    CCACHE_LOGFILE=$PWD/compile_server.log \
+        $CCACHE --serve-compiles 127.0.0.1:0 >compile_server.out &
+    compile_server_pid=$!
+    while ! grep -q port compile_server.out 2>/dev/null; do
+        sleep 0.1
+    done
+    compile_server_port=$(sed 's/.* //' compile_server.out)
+}
+
+stop_compile_server() {
+    kill $compile_server_pid
+    wait $compile_server_pid 2>/dev/null
+}
+
+SUITE_compile_servers_SETUP() {
+    generate_code 1 test.c
+    start_compile_server
+    export CCACHE_COMPILESERVERS="127.0.0.1:1 127.0.0.1:$compile_server_port"
+    export CCACHE_NOCPP2=1
+    export CCACHE_LOGFILE=$PWD/ccache.log
+}
+
+SUITE_compile_servers() {
+    # -------------------------------------------------------------------------
+    TEST "Miss is compiled on a server"
+
+    $COMPILER -c test.c -o reference_test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+    expect_contains $CCACHE_LOGFILE "Compiled on 127.0.0.1:$compile_server_port"
+    expect_equal_object_files reference_test.o test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_equal_object_files reference_test.o test.o
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+    TEST "Failed compilation is rerun locally"
+
+    echo 'int x = ;' >error.c
+
+    $CCACHE_COMPILE -c error.c 2>stderr.txt && test_failed "Expected failure"
+    expect_stat 'compile failed' 1
+    expect_contains $CCACHE_LOGFILE "compiling locally"
+    expect_contains stderr.txt "error.c"
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+    TEST "Compilation is local with options that servers refuse"
+
+    $CCACHE_COMPILE -Wa,--noexecstack -c test.c
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "compile servers refuse -Wa,--noexecstack"
+    expect_not_contains $CCACHE_LOGFILE "Compiled on"
+    expect_exists test.o
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+    TEST "Compilation is local with run_second_cpp"
+
+    unset CCACHE_NOCPP2
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_not_contains $CCACHE_LOGFILE "Compiled on"
+    expect_exists test.o
+
+    stop_compile_server
+
+    # -------------------------------------------------------------------------
+    TEST "Compilation is local when no server is reachable"
+
+    stop_compile_server
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_not_contains $CCACHE_LOGFILE "Compiled on"
+    expect_exists test.o
+}
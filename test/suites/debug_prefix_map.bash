@@ -60,4 +60,31 @@ SUITE_debug_prefix_map() {
     expect_stat 'cache miss' 1
     expect_stat 'files in cache' 2
     expect_objdump_not_contains test.o "$(pwd)"
+
+    # -------------------------------------------------------------------------
+    touch prefix_map_probe.c
+    if $REAL_COMPILER -c -ffile-prefix-map=old=new prefix_map_probe.c 2>/dev/null; then
+        TEST "CCACHE_AUTOPREFIXMAP"
+
+        cd dir1
+        CCACHE_AUTOPREFIXMAP=1 CCACHE_BASEDIR=$(pwd) $CCACHE_COMPILE -I$(pwd)/include -g -c $(pwd)/src/test.c -o $(pwd)/test.o
+        expect_stat 'cache hit (direct)' 0
+        expect_stat 'cache hit (preprocessed)' 0
+        expect_stat 'cache miss' 1
+        expect_stat 'files in cache' 2
+        expect_objdump_not_contains test.o "$(pwd)"
+
+        cd ../dir2
+        CCACHE_AUTOPREFIXMAP=1 CCACHE_BASEDIR=$(pwd) $CCACHE_COMPILE -I$(pwd)/include -g -c $(pwd)/src/test.c -o $(pwd)/test.o
+        expect_stat 'cache hit (direct)' 1
+        expect_stat 'cache hit (preprocessed)' 0
+        expect_stat 'cache miss' 1
+        expect_stat 'files in cache' 2
+        expect_objdump_not_contains test.o "$(pwd)"
+
+        CCACHE_AUTOPREFIXMAP=1 CCACHE_BASEDIR=$(pwd) CCACHE_NODIRECT=1 $CCACHE_COMPILE -I$(pwd)/include -g -c $(pwd)/src/test.c -o $(pwd)/test.o
+        expect_stat 'cache hit (direct)' 1
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 1
+    fi
 }
@@ -142,6 +142,101 @@ SUITE_depend() {
     expect_stat 'cache miss' 1
     expect_stat 'files in cache' 2
 
+    # -------------------------------------------------------------------------
+    TEST "No dependency options"
+
+    $REAL_COMPILER -c -o reference_test.o test.c
+
+    CCACHE_DEPEND=1 $CCACHE_COMPILE -c test.c
+    expect_equal_object_files reference_test.o test.o
+    expect_missing test.d
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2 # result + manifest
+
+    CCACHE_DEPEND=1 $CCACHE_COMPILE -c test.c
+    expect_equal_object_files reference_test.o test.o
+    expect_missing test.d
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 2
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+
+    CCACHE_DEPEND=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 3
+
+    # -------------------------------------------------------------------------
+    TEST "No dependency options, clang-cl"
+
+    # A stand-in for clang-cl that fails on -MD, which means /MD to clang-cl,
+    # and passes /clang: options on to the real compiler, which might not
+    # understand Clang's -fcolor-diagnostics.
+    cat <<EOF >clang-cl
+#!/bin/bash
+args=()
+for arg in "\$@"; do
+    case \$arg in
+        -MD) echo "-MD selects the runtime library" >&2; exit 1 ;;
+        /clang:*) args+=("\${arg#/clang:}") ;;
+        -fcolor-diagnostics) ;;
+        *) args+=("\$arg") ;;
+    esac
+done
+exec $REAL_COMPILER "\${args[@]}"
+EOF
+    chmod +x clang-cl
+    backdate clang-cl
+
+    CCACHE_DEPEND=1 $CCACHE ./clang-cl -c test.c
+    expect_missing test.d
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    CCACHE_DEPEND=1 $CCACHE ./clang-cl -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+
+    CCACHE_DEPEND=1 $CCACHE ./clang-cl -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "No dependency options, nvcc"
+
+    cat <<EOF >nvcc
+#!/bin/sh
+exec $REAL_COMPILER "\$@"
+EOF
+    chmod +x nvcc
+    backdate nvcc
+
+    CCACHE_DEPEND=1 CCACHE_LOGFILE=nvcc.log $CCACHE ./nvcc -c test.c
+    expect_contains nvcc.log "Injected dependency file"
+    expect_missing test.d
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    CCACHE_DEPEND=1 $CCACHE ./nvcc -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+
+    CCACHE_DEPEND=1 $CCACHE ./nvcc -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "Dependency file paths converted to relative if CCACHE_BASEDIR specified"
 
@@ -82,6 +82,67 @@ SUITE_direct() {
     expect_stat 'cache hit (preprocessed)' 1
     expect_stat 'cache miss' 1
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SPECULATIVECPP"
+
+    $REAL_COMPILER -c -o reference_test.o test.c
+
+    CCACHE_SPECULATIVECPP=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Using output of speculative preprocessor"
+    expect_equal_object_files reference_test.o test.o
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    rm $CCACHE_LOGFILE
+    CCACHE_SPECULATIVECPP=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Using output of speculative preprocessor"
+
+    rm $CCACHE_LOGFILE
+    CCACHE_SPECULATIVECPP=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Cancelling speculative preprocessor"
+    expect_not_contains $CCACHE_LOGFILE "Using output of speculative preprocessor"
+
+    # A failing preprocessor is run again the usual way.
+    echo '#error broken' >>test3.h
+    CCACHE_SPECULATIVECPP=1 $CCACHE_COMPILE -c test.c 2>/dev/null
+    expect_stat 'preprocessor error' 1
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SPECULATIVECOMPILEDELAY"
+
+    $REAL_COMPILER -c -o reference_test.o test.c
+    export CCACHE_SPECULATIVECOMPILEDELAY=1
+
+    # Running the preprocessor after the direct mode miss takes longer than the
+    # delay.
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Adopting output of speculative compilation"
+    expect_equal_object_files reference_test.o test.o
+    ls -l reference_test.o | cut -c1-10 >reference_mode.txt
+    ls -l test.o | cut -c1-10 >mode.txt
+    expect_equal_content reference_mode.txt mode.txt
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_object_files reference_test.o test.o
+    expect_file_count 0 '*.ccache-speculative*' .
+
+    # A failed speculative compilation is run again.
+    echo 'int x = ;' >error.c
+    $CCACHE_COMPILE -c error.c 2>/dev/null
+    expect_stat 'compile failed' 1
+    expect_contains $CCACHE_LOGFILE "Speculative compilation gave exit status"
+
+    unset CCACHE_SPECULATIVECOMPILEDELAY
+
     # -------------------------------------------------------------------------
     TEST "Modified include file"
 
@@ -102,6 +163,153 @@ SUITE_direct() {
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_DIGESTMAP"
+
+    mkdir gen
+    echo "111  ../test3.h" >gen/digests
+    export CCACHE_DIGESTMAP=gen/digests
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    # The map is trusted, so a changed (and too new) file with the same digest
+    # is a hit.
+    echo "int test3_2;" >>test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "222  ../test3.h" >gen/digests
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SYSTEMINCLUDEROOTS"
+
+    mkdir sys
+    echo "int sys1;" >sys/sys1.h
+    echo '#include <sys1.h>' >>test.c
+    touch sys.stamp
+    backdate sys/sys1.h sys sys.stamp
+    export CCACHE_SYSTEMINCLUDEROOTS="$PWD/sys=$PWD/sys.stamp"
+
+    $CCACHE_COMPILE -isystem $PWD/sys -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    manifest=`find $CCACHE_DIR -name '*M'`
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump test1.h
+    expect_not_contains manifest.dump sys1.h
+
+    $CCACHE_COMPILE -isystem $PWD/sys -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # A changed stamp invalidates the fingerprint.
+    echo "int sys2;" >sys/sys1.h
+    backdate 1 sys/sys1.h sys.stamp
+    $CCACHE_COMPILE -isystem $PWD/sys -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_REGENERATEDEPFILES"
+
+    export CCACHE_REGENERATEDEPFILES=1
+    $REAL_COMPILER -c -MD -MP test.c
+    mv test.o reference_test.o
+    mv test.d reference_test.d
+
+    $CCACHE_COMPILE -c -MD -MP test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_equal_content test.d reference_test.d
+
+    result=$(find $CCACHE_DIR -name '*R')
+    if $CCACHE --dump-result $result | grep -q '\.d '; then
+        test_failed "Dependency file stored in result"
+    fi
+
+    rm test.d
+    $CCACHE_COMPILE -c -MD -MP test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_object_files reference_test.o test.o
+    tr -s ' \\\n' '\n' <reference_test.d | sort >expected_tokens
+    tr -s ' \\\n' '\n' <test.d | sort >actual_tokens
+    expect_equal_content actual_tokens expected_tokens
+
+    # The dependency file is stored if it can't be regenerated.
+    $CCACHE_COMPILE -c -MD -MT other.o test.c
+    expect_stat 'cache miss' 2
+    result=$(find $CCACHE_DIR -name '*R' -newer $result)
+    if ! $CCACHE --dump-result $result | grep -q '\.d '; then
+        test_failed "Dependency file not stored in result"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Include file after large preprocessed output"
+
+    for i in $(seq 10000); do
+        echo "int big_$i;"
+    done >big.h
+    cat <<EOF >big.c
+#include "big.h"
+#include "test2.h"
+EOF
+    backdate big.h
+
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "int test2_2;" >>test2.h
+    backdate test2.h
+    $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Modified include file among many include files"
+
+    for i in $(seq 50); do
+        echo "int many_$i;" >many_$i.h
+        echo "#include \"many_$i.h\""
+    done >many.c
+    backdate many_*.h
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    echo "int many_37_2;" >>many_37.h
+    backdate many_37.h
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+
+    $CCACHE_COMPILE -c many.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "Removed but previously compiled header file"
 
@@ -426,6 +634,114 @@ EOF
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 5
 
+    # -------------------------------------------------------------------------
+    TEST "Result entries are appended to the manifest"
+
+    for i in 0 1 2; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache miss' 3
+    expect_contains $CCACHE_LOGFILE "Reusing manifest"
+
+    manifest=`find $CCACHE_DIR -name '*M'`
+    if ! $CCACHE --dump-manifest $manifest | grep -q 'Appended result entries: 2'; then
+        test_failed "Expected two appended result entries"
+    fi
+
+    $CCACHE -X 5 >/dev/null
+    if ! $CCACHE --dump-manifest $manifest | grep -q 'Appended result entries: 2'; then
+        test_failed "Appended result entries lost by recompression"
+    fi
+
+    for i in 0 1 2; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "Least recently used manifest entries are evicted"
+
+    export CCACHE_MAXMANIFESTENTRIES=2
+
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    echo "int test1_b;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+
+    # Use the first entry so that the second becomes the least recently used.
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+
+    echo "int test1_c;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+
+    echo "int test1_b;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache hit (preprocessed)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest entries with missing results are removed"
+
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    result_a=$(find $CCACHE_DIR -name '*R')
+
+    echo "int test1_b;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+
+    rm $result_a
+
+    echo "int test1_c;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+    expect_contains $CCACHE_LOGFILE "Removed 1 entries with missing results"
+
+    manifest=$(find $CCACHE_DIR -name '*M')
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Results (2)"
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest entries older than max_manifest_entry_age are evicted"
+
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    sleep 2
+
+    echo "int test1_b;" >test1.h
+    backdate test1.h
+    CCACHE_MAXMANIFESTENTRYAGE=1s $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+
+    echo "int test1_a;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 1
+
     # -------------------------------------------------------------------------
     TEST "-MD"
 
@@ -878,6 +1194,26 @@ EOF
     expect_stat 'cache hit (preprocessed)' 1
     expect_stat 'cache miss' 1
 
+    # -------------------------------------------------------------------------
+    TEST "Too new include file among many include files disables direct mode"
+
+    for i in $(seq 50); do
+        echo "int new_$i;" >new_$i.h
+        echo "#include \"new_$i.h\""
+    done >new.c
+    backdate new_*.h
+    touch -t 203801010000 new_42.h
+
+    $CCACHE_COMPILE -c new.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c new.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
     # -------------------------------------------------------------------------
     TEST "__DATE__ in header file results in direct cache hit as the date remains the same"
 
@@ -1140,4 +1476,184 @@ EOF
     expect_stat 'files in cache' 2
 
     expect_equal_content $manifest_file saved.manifest
+
+    # -------------------------------------------------------------------------
+    TEST "--probe"
+
+    mkdir dir
+    cp test.c test1.h test2.h test3.h dir
+    echo "int dir;" >>dir/test3.h
+    cat <<EOF >compile_commands.json
+[
+  {"directory": "$PWD", "command": "$COMPILER -c test.c", "file": "test.c"},
+  {"directory": "$PWD/dir", "command": "$COMPILER -c test.c", "file": "dir/test.c"},
+  {"directory": "$PWD", "command": "$COMPILER test.c", "file": "test.c"}
+]
+EOF
+
+    $CCACHE --probe compile_commands.json >probe.txt
+    printf "miss test.c\nmiss dir/test.c\nuncacheable test.c\n" >expected.txt
+    expect_equal_content probe.txt expected.txt
+    expect_stat 'cache miss' 0
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+
+    $CCACHE --probe - <compile_commands.json >probe.txt
+    printf "hit test.c\nmiss dir/test.c\nuncacheable test.c\n" >expected.txt
+    expect_equal_content probe.txt expected.txt
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "--migrate"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    cp $manifest_file saved.manifest
+
+    $CCACHE --migrate >migrate.txt
+    expect_contains migrate.txt "Upgraded 0 manifests, failed to upgrade 0"
+    expect_equal_content $manifest_file saved.manifest
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Concurrent manifest updates are merged"
+
+    # The compilations share a manifest but get different results.
+    for i in $(seq 10); do
+        mkdir dir$i
+        echo '#include "h.h"' >dir$i/test.c
+        echo "int h$i;" >dir$i/h.h
+    done
+    backdate dir*/test.c dir*/h.h
+
+    for i in $(seq 10); do
+        (cd dir$i && CCACHE_BASEDIR=$PWD/.. $CCACHE_COMPILE -c test.c) &
+    done
+    wait
+    expect_stat 'cache miss' 10
+
+    manifests=$(find $CCACHE_DIR -name '*M')
+    if [ $(echo $manifests | wc -w) -ne 1 ]; then
+        test_failed "Expected one manifest, found: $manifests"
+    fi
+    $CCACHE --dump-manifest $manifests >manifest.dump
+    expect_contains manifest.dump "Results (10):"
+
+    for i in $(seq 10); do
+        (cd dir$i && CCACHE_BASEDIR=$PWD/.. $CCACHE_COMPILE -c test.c)
+    done
+    expect_stat 'cache hit (direct)' 10
+    expect_stat 'cache miss' 10
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_MAXCOMPILERJOBS"
+
+    export CCACHE_MAXCOMPILERJOBS=1
+
+    CCACHE_LOGFILE=miss.log $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_contains miss.log "Acquired compiler slot"
+
+    CCACHE_LOGFILE=hit.log $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_not_contains hit.log "compiler slot"
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_CACHEPREPROCESSING"
+
+    $REAL_COMPILER -E test.c >reference.i
+
+    $CCACHE_COMPILE -E test.c >test.i
+    expect_stat 'called for preprocessing' 1
+    expect_stat 'cache miss' 0
+
+    export CCACHE_CACHEPREPROCESSING=1
+
+    $CCACHE_COMPILE -E test.c >test.i
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_equal_content reference.i test.i
+
+    $CCACHE_COMPILE -E test.c >test.i
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_content reference.i test.i
+
+    $CCACHE_COMPILE -E test.c -o test2.i
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 1
+    expect_equal_content reference.i test2.i
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    $REAL_COMPILER -E test.c >reference.i
+
+    $CCACHE_COMPILE -E test.c >test.i
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 3
+    expect_equal_content reference.i test.i
+
+    $CCACHE_COMPILE -E test.c >test.i
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 3
+    expect_equal_content reference.i test.i
+
+    # -------------------------------------------------------------------------
+    if $HOST_OS_LINUX; then
+        TEST "--watch"
+
+        mkdir src
+        for i in $(seq 20); do
+            echo "int watched_$i;" >src/watched_$i.h
+            echo "#include \"watched_$i.h\""
+        done >src/watched.c
+        backdate src/*.h
+
+        $CCACHE --watch $PWD/src </dev/null >/dev/null 2>&1 &
+        watcher=$!
+        for i in $(seq 50); do
+            [ -f $CCACHE_DIR/file_watch ] && break
+            sleep 0.1
+        done
+        sleep 0.5
+
+        cd src
+        $CCACHE_COMPILE -c watched.c
+        expect_stat 'cache hit (direct)' 0
+        expect_stat 'cache miss' 1
+
+        $CCACHE_COMPILE -c watched.c
+        expect_stat 'cache hit (direct)' 1
+        expect_stat 'cache miss' 1
+
+        CCACHE_LOGFILE=watch.log $CCACHE_COMPILE -c watched.c
+        expect_stat 'cache hit (direct)' 2
+        expect_stat 'cache miss' 1
+        expect_contains watch.log "20 of "
+
+        echo "int changed;" >>watched_7.h
+        backdate watched_7.h
+        CCACHE_LOGFILE=watch2.log $CCACHE_COMPILE -c watched.c
+        expect_stat 'cache hit (direct)' 2
+        expect_stat 'cache miss' 2
+        expect_contains watch2.log "19 of "
+        cd ..
+
+        kill $watcher
+        wait $watcher
+        if [ -f $CCACHE_DIR/file_watch ]; then
+            test_failed "file_watch not removed when the watcher stopped"
+        fi
+    fi
 }
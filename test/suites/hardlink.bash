@@ -31,6 +31,37 @@ SUITE_hardlink() {
         test_failed "Object files not hard linked"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_RAWFILEMINSIZE"
+
+    export CCACHE_HARDLINK=1
+    echo 'int small;' >small.c
+    echo 'int big[8192] = {1};' >big.c
+
+    CCACHE_RAWFILEMINSIZE=16k $CCACHE_COMPILE -c small.c
+    CCACHE_RAWFILEMINSIZE=16k $CCACHE_COMPILE -c big.c
+    expect_stat 'cache miss' 2
+    expect_stat 'files in cache' 3
+    expect_file_count 1 '*W' $CCACHE_DIR
+
+    mv small.o small.o.saved
+    mv big.o big.o.saved
+
+    CCACHE_RAWFILEMINSIZE=16k $CCACHE_COMPILE -c small.c
+    CCACHE_RAWFILEMINSIZE=16k $CCACHE_COMPILE -c big.c
+    expect_stat 'cache hit (preprocessed)' 2
+    if [ small.o -ef small.o.saved ]; then
+        test_failed "Small object file hard linked"
+    fi
+    if [ ! big.o -ef big.o.saved ]; then
+        test_failed "Big object file not hard linked"
+    fi
+
+    # Overwriting a result with an embedded entry removes the old raw file.
+    CCACHE_RECACHE=1 CCACHE_RAWFILEMINSIZE=1M $CCACHE_COMPILE -c big.c
+    expect_stat 'files in cache' 2
+    expect_file_count 0 '*W' $CCACHE_DIR
+
     # -------------------------------------------------------------------------
     TEST "Corrupted file size is detected"
 
@@ -1,8 +1,12 @@
 SUITE_inode_cache_PROBE() {
-    temp_dir=$(dirname $($CCACHE -k temporary_dir))
-    fs=$(stat -fLc %T $temp_dir)
+    if [ -d "$XDG_RUNTIME_DIR" ]; then
+        inode_cache_dir=$XDG_RUNTIME_DIR
+    else
+        inode_cache_dir=$(dirname $($CCACHE -k temporary_dir))
+    fi
+    fs=$(stat -fLc %T $inode_cache_dir)
     if [ "$fs" = "nfs" ]; then
-        echo "ccache temporary directory is on NFS"
+        echo "ccache inode cache directory is on NFS"
     fi
 }
 
@@ -93,4 +97,50 @@ inode_cache_tests() {
     echo "// replace" > test1.c
     $CCACHE_COMPILE -c test1.c
     expect_inode_cache 0 1 1 test1.c
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_INODECACHEDIR"
+
+    echo "// inode cache dir" > test1.c
+    CCACHE_INODECACHEDIR=$PWD/inode-cache-dir $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 0 1 1 test1.c
+    expect_exists inode-cache-dir/inode-cache.v*
+
+    CCACHE_INODECACHEDIR=$PWD/inode-cache-dir $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 1 0 0 test1.c
+
+    # -------------------------------------------------------------------------
+    if git --version >/dev/null 2>&1; then
+        for index_version in 2 4; do
+            TEST "CCACHE_GITINDEX, index version $index_version"
+
+            mkdir repo1
+            cd repo1
+            git init -q
+            echo "// git index" > test1.c
+            git add test1.c
+            git -c user.name=a -c user.email=a@b commit -q -m test
+            cd ..
+            git clone -q repo1 repo2
+
+            for repo in repo1 repo2; do
+                cd $repo
+                # Make the index entry older than the index.
+                backdate test1.c
+                git update-index -q --refresh
+                git update-index --index-version $index_version
+                cd ..
+            done
+
+            cd repo1
+            CCACHE_GITINDEX=1 $CCACHE_COMPILE -c test1.c
+            expect_inode_cache 0 1 1 test1.c
+            expect_contains test1.o.ccache-log "inode cache insert: content "
+            cd ../repo2
+            CCACHE_GITINDEX=1 $CCACHE_COMPILE -c test1.c
+            expect_inode_cache 0 1 1 test1.c
+            expect_contains test1.o.ccache-log "inode cache hit: content "
+            cd ..
+        done
+    fi
 }
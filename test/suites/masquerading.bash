@@ -49,4 +49,39 @@ SUITE_masquerading() {
     expect_stat 'cache miss' 1
     expect_stat 'files in cache' 1
     expect_equal_object_files reference_test1.o test1.o
+
+    # -------------------------------------------------------------------------
+    TEST "Masquerading via PATH, memoized path lookup"
+
+    $REAL_COMPILER -c -o reference_test1.o test1.c
+
+    mkdir bin
+    ln -s "$CCACHE" bin/$COMPILER_BIN
+    touch -h -t 202001010000 bin/$COMPILER_BIN
+    touch -t 202001010000 bin
+    export CCACHE_MEMOIZE_PATHLOOKUP=1
+    search_path=$PWD/wrapper:$PWD/bin:$PATH
+
+    PATH=$search_path $COMPILER_BIN $COMPILER_ARGS -c test1.c
+    expect_stat 'cache miss' 1
+    expect_equal_object_files reference_test1.o test1.o
+
+    PATH=$search_path $COMPILER_BIN $COMPILER_ARGS -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_contains $CCACHE_LOGFILE "in memoized executable search"
+    expect_equal_object_files reference_test1.o test1.o
+
+    mkdir wrapper
+    cat >wrapper/$COMPILER_BIN <<EOF
+#!/bin/sh
+touch wrapper_executed
+exec $REAL_COMPILER_BIN "\$@"
+EOF
+    chmod +x wrapper/$COMPILER_BIN
+    touch -t 202001010000 wrapper
+
+    PATH=$search_path $COMPILER_BIN $COMPILER_ARGS -c test1.c
+    if [ ! -f wrapper_executed ]; then
+        test_failed "Stale memoized path lookup was used"
+    fi
 }
@@ -0,0 +1,146 @@
+SUITE_msvc_PROBE() {
+    if $HOST_OS_WINDOWS || $HOST_OS_CYGWIN; then
+        echo "fake cl script not supported on $(uname -s)"
+    fi
+}
+
+SUITE_msvc_SETUP() {
+    unset CCACHE_NODIRECT
+
+    # A minimal imitation of cl.exe: the "object file" is the source code with
+    # its includes expanded, the source file name is written to stdout like cl
+    # does and /showIncludes notes are written for each included file.
+    cat <<'EOF' >cl
+#!/bin/sh
+obj=
+src=
+preprocess=false
+show_includes=false
+for arg in "$@"; do
+    case $arg in
+        -Fo*|/Fo*) obj=${arg#?Fo}; obj=${obj#:} ;;
+        -E|/E) preprocess=true ;;
+        -showIncludes|/showIncludes) show_includes=true ;;
+        -*|/*) ;;
+        *) src=$arg ;;
+    esac
+done
+if $preprocess; then
+    echo "$src" >&2
+    printf '#line 1 "%s"\n' "$src"
+else
+    echo "$src"
+fi
+expanded=$(sed -n 's/^#include "\(.*\)"$/\1/p' "$src" | while read inc; do
+    if $show_includes && ! $preprocess; then
+        echo "Note: including file: $(pwd)/$inc" >&3
+    fi
+    if $preprocess; then
+        printf '#line 1 "%s"\n' "$inc"
+    fi
+    cat "$inc"
+done 3>&1)
+if $preprocess; then
+    echo "$expanded"
+    grep -v '^#include' "$src"
+else
+    [ -z "$obj" ] && obj=$(basename "$src" .c).obj
+    echo "$expanded" | grep -v '^Note: including file:' >"$obj"
+    grep -v '^#include' "$src" >>"$obj"
+    echo "$expanded" | grep '^Note: including file:' || true
+fi
+EOF
+    chmod +x cl
+    backdate cl
+
+    cat <<EOF >test.c
+#include "test.h"
+int main(void) { return 0; }
+EOF
+    echo "int test;" >test.h
+    backdate test.h
+}
+
+SUITE_msvc() {
+    # -------------------------------------------------------------------------
+    TEST "Preprocessor and direct mode"
+
+    $CCACHE ./cl /c /nologo /MD /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_contains test.obj "int test;"
+    expect_content stdout.txt "test.c"
+
+    rm test.obj
+    $CCACHE ./cl /c /nologo /MD /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_contains test.obj "int test;"
+    expect_content stdout.txt "test.c"
+
+    echo "int test2;" >test.h
+    backdate test.h
+    $CCACHE ./cl /c /nologo /MD /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+    expect_contains test.obj "int test2;"
+
+    # -------------------------------------------------------------------------
+    TEST "Default object file name"
+
+    $CCACHE ./cl /c test.c >stdout.txt
+    expect_stat 'cache miss' 1
+    expect_exists test.obj
+
+    rm test.obj
+    $CCACHE ./cl /c test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_exists test.obj
+
+    # -------------------------------------------------------------------------
+    TEST "Depend mode with injected /showIncludes"
+
+    CCACHE_DEPEND=1 $CCACHE ./cl /c /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_content stdout.txt "test.c"
+    expect_contains test.obj "int test;"
+
+    rm test.obj
+    CCACHE_DEPEND=1 $CCACHE ./cl /c /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_content stdout.txt "test.c"
+    expect_contains test.obj "int test;"
+
+    echo "int test2;" >test.h
+    backdate test.h
+    CCACHE_DEPEND=1 $CCACHE ./cl /c /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_contains test.obj "int test2;"
+
+    # -------------------------------------------------------------------------
+    TEST "Depend mode with /showIncludes from the user"
+
+    CCACHE_DEPEND=1 $CCACHE ./cl /c /showIncludes /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache miss' 1
+    expect_contains stdout.txt "Note: including file: $(pwd)/test.h"
+
+    CCACHE_DEPEND=1 $CCACHE ./cl /c /showIncludes /Fo:test.obj test.c >stdout.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_contains stdout.txt "Note: including file: $(pwd)/test.h"
+
+    # -------------------------------------------------------------------------
+    TEST "Unsupported options"
+
+    $CCACHE ./cl /c /Zi /Fo:test.obj test.c >stdout.txt
+    expect_stat 'unsupported compiler option' 1
+
+    $CCACHE ./cl /EP test.c >stdout.txt
+    expect_stat 'called for preprocessing' 1
+}
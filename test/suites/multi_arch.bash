@@ -61,4 +61,26 @@ SUITE_multi_arch() {
     $CCACHE_COMPILE -arch i386 -arch x86_64 -c test1.c
     expect_stat 'cache hit (preprocessed)' 2
     expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_SPLITARCH"
+
+    export CCACHE_SPLITARCH=1
+
+    $CCACHE_COMPILE -arch i386 -arch x86_64 -MD -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_exists test1.d
+    if [ "$(lipo -archs test1.o)" != "i386 x86_64" ]; then
+        test_failed "Unexpected architectures in test1.o: $(lipo -archs test1.o)"
+    fi
+
+    # The slices are shared with single-arch compilations.
+    $CCACHE_COMPILE -arch x86_64 -MD -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    $CCACHE_COMPILE -arch i386 -arch x86_64 -MD -c test1.c
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 2
 }
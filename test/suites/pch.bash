@@ -177,6 +177,37 @@ pch_suite_common() {
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "Use .gch, -include, digest file written by ccache"
+
+    CCACHE_SLOPPINESS="$DEFAULT_SLOPPINESS pch_defines" $CCACHE_COMPILE $SYSROOT -c pch.h
+    expect_stat 'cache miss' 1
+    expect_exists pch.h.gch.ccache-digest
+
+    # The .gch is used right away, so it's too new unless sloppy.
+
+    CCACHE_SLOPPINESS="$DEFAULT_SLOPPINESS time_macros include_file_mtime" $CCACHE_COMPILE $SYSROOT -c -include pch.h pch2.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Using digest file for"
+
+    rm $CCACHE_LOGFILE
+    CCACHE_SLOPPINESS="$DEFAULT_SLOPPINESS time_macros include_file_mtime" $CCACHE_COMPILE $SYSROOT -c -include pch.h pch2.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    # The digest file is ignored when the .gch is rebuilt by someone else.
+    echo '#include <string.h> /*change pch*/' >>pch.h
+    backdate pch.h
+    $REAL_COMPILER $SYSROOT -c pch.h
+    backdate pch.h.gch
+
+    rm $CCACHE_LOGFILE
+    CCACHE_SLOPPINESS="$DEFAULT_SLOPPINESS time_macros include_file_mtime" $CCACHE_COMPILE $SYSROOT -c -include pch.h pch2.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 3
+    expect_contains $CCACHE_LOGFILE "Ignoring stale digest file"
+
     # -------------------------------------------------------------------------
     TEST "Use .gch, preprocessor mode, -include"
 
@@ -646,6 +677,35 @@ EOF
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "Create .pch, include file mtime changed, pch_input_mtime"
+
+    backdate test.h
+    cat <<EOF >pch2.h
+    #include <stdlib.h>
+    #include "test.h"
+EOF
+    sleep 1
+
+    export CCACHE_SLOPPINESS="$DEFAULT_SLOPPINESS pch_defines pch_input_mtime"
+    $CCACHE_COMPILE $SYSROOT -c pch2.h
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    touch -r test.h test.h.ref
+
+    touch test.h
+    sleep 1
+
+    $CCACHE_COMPILE $SYSROOT -c pch2.h
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    if [ test.h -nt test.h.ref ]; then
+        test_failed "mtime of test.h was not restored"
+    fi
+
+    $REAL_COMPILER $SYSROOT -c -include pch2.h pch2.c
+    expect_exists pch2.o
+
     # -------------------------------------------------------------------------
     TEST "Use .pch, -include, no sloppiness"
 
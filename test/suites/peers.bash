@@ -0,0 +1,92 @@
+SUITE_peers_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "--serve-peers is not supported on Windows"
+    fi
+}
+
+start_peer_server() {
+    CCACHE_DIR=$PWD/peer $CCACHE --serve-peers 127.0.0.1:0 >peer_server.out &
+    peer_server_pid=$!
+    while ! grep -q port peer_server.out 2>/dev/null; do
+        sleep 0.1
+    done
+    peer_port=$(sed 's/.* //' peer_server.out)
+}
+
+stop_peer_server() {
+    kill $peer_server_pid
+    wait $peer_server_pid 2>/dev/null
+}
+
+SUITE_peers_SETUP() {
+    generate_code 1 test.c
+    start_peer_server
+    export CCACHE_PEERS="127.0.0.1:1 127.0.0.1:$peer_port"
+}
+
+SUITE_peers() {
+    # -------------------------------------------------------------------------
+    TEST "Result is fetched from peer on local miss"
+
+    CCACHE_DIR=$PWD/peer $CCACHE_COMPILE -c test.c
+    rm test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 1
+    expect_exists test.o
+
+    stop_peer_server
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest and result are fetched in direct mode"
+
+    unset CCACHE_NODIRECT
+
+    CCACHE_DIR=$PWD/peer $CCACHE_COMPILE -c test.c
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 2
+
+    stop_peer_server
+
+    # -------------------------------------------------------------------------
+    TEST "Idle connection doesn't delay other peers"
+
+    CCACHE_DIR=$PWD/peer $CCACHE_COMPILE -c test.c
+    rm test.o
+
+    exec 3<>/dev/tcp/127.0.0.1/$peer_port
+    $CCACHE_COMPILE -c test.c
+    exec 3<&-
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+
+    stop_peer_server
+
+    # -------------------------------------------------------------------------
+    TEST "Entries are not uploaded to peers"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 0 '*R' peer
+
+    stop_peer_server
+
+    # -------------------------------------------------------------------------
+    TEST "Results with hard links are not served"
+
+    CCACHE_DIR=$PWD/peer CCACHE_HARDLINK=1 $CCACHE_COMPILE -c test.c
+    stop_peer_server
+    CCACHE_HARDLINK=1 start_peer_server
+    export CCACHE_PEERS=127.0.0.1:$peer_port
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    stop_peer_server
+}
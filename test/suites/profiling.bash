@@ -97,6 +97,25 @@ SUITE_profiling() {
     expect_stat 'cache hit (direct)' 1
     expect_stat 'cache miss' 3
 
+    # -------------------------------------------------------------------------
+    TEST "-fprofile-use, memoized profile data digest"
+
+    $CCACHE_COMPILE -fprofile-generate -c test.c
+    $COMPILER -fprofile-generate test.o -o test
+
+    ./test
+    merge_profiling_data .
+    backdate $(find . -name '*.gcda' -o -name '*.profdata')
+
+    # The profile data is hashed for both the direct and the preprocessor mode
+    # but only read once.
+    $CCACHE_COMPILE -fprofile-use -c test.c
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Using memoized digest of"
+
+    $CCACHE_COMPILE -fprofile-use -c test.c
+    expect_stat 'cache hit (direct)' 1
+
     # -------------------------------------------------------------------------
     TEST "-ftest-coverage with -fprofile-dir"
 
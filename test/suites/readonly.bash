@@ -84,4 +84,52 @@ SUITE_readonly() {
     if [ $files_after -ne $files_before ]; then
         test_failed "Read-only mode + direct mode stored files in the cache"
     fi
+
+    # -------------------------------------------------------------------------
+    TEST "Lower cache"
+
+    CCACHE_DIRECT=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    mv $CCACHE_DIR lower
+    chmod -R a-w lower
+    export CCACHE_LOWERCACHEDIRS=$PWD/lower
+    sleep 0.1
+    touch reference
+
+    CCACHE_DIRECT=1 $CCACHE_COMPILE -c test.c
+    status1=$?
+    $CCACHE_COMPILE -c test.c
+    status2=$?
+    modified_files=`find lower -newer reference | wc -l`
+
+    chmod -R +w lower
+
+    if [ $status1 -ne 0 ] || [ $status2 -ne 0 ]; then
+        test_failed "Failure when compiling test.c with lower cache"
+    fi
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 0
+    if [ $modified_files -ne 0 ]; then
+        test_failed "Lower cache was modified"
+    fi
+
+    # -------------------------------------------------------------------------
+    TEST "Lower cache with copy up"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    mv $CCACHE_DIR lower
+    export CCACHE_LOWERCACHEDIRS=$PWD/lower
+    export CCACHE_LOWERCACHECOPYUP=1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'files in cache' 1
+
+    rm -rf lower
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 0
 }
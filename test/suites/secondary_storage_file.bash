@@ -0,0 +1,108 @@
+SUITE_secondary_storage_file_SETUP() {
+    generate_code 1 test.c
+    export CCACHE_SECONDARY_STORAGE=file:$PWD/remote
+}
+
+SUITE_secondary_storage_file() {
+    # -------------------------------------------------------------------------
+    TEST "Result is stored and fetched on local miss"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 '*R' remote
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 0
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest and result are fetched in direct mode"
+
+    unset CCACHE_NODIRECT
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 '*M' remote
+    expect_eventual_file_count 1 '*R' remote
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 2
+
+    # -------------------------------------------------------------------------
+    TEST "--prefetch"
+
+    unset CCACHE_NODIRECT
+    cat <<EOF >compile_commands.json
+[{"directory": "$PWD", "command": "$COMPILER -c test.c", "file": "test.c"}]
+EOF
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+
+    remove_cache
+
+    $CCACHE --prefetch compile_commands.json >prefetch.txt
+    expect_content prefetch.txt "Prefetched 1 manifests and 1 results for 1 compilations"
+    expect_stat 'files in cache' 2
+
+    CCACHE_SECONDARY_STORAGE= $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 0
+
+    $CCACHE --prefetch compile_commands.json >prefetch.txt
+    expect_content prefetch.txt "Prefetched 0 manifests and 0 results for 1 compilations"
+    expect_stat 'files in cache' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Recent misses are remembered"
+
+    unset CCACHE_NODIRECT
+    export CCACHE_SECONDARY_STORAGE_MISS_TTL=3600
+    cat <<EOF >compile_commands.json
+[{"directory": "$PWD", "command": "$COMPILER -c test.c", "file": "test.c"}]
+EOF
+
+    $CCACHE --prefetch compile_commands.json >prefetch.txt
+    expect_content prefetch.txt "Prefetched 0 manifests and 0 results for 1 compilations"
+
+    # Another host stores the manifest and result after the miss.
+    CCACHE_DIR=$PWD/other $CCACHE_COMPILE -c test.c
+    expect_eventual_file_count 1 '*M' remote
+    expect_eventual_file_count 1 '*R' remote
+
+    # The manifest is still considered missing but the result is fetched.
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Unwritable secondary storage directory"
+
+    touch remote
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_exists test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+}
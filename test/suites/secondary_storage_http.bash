@@ -0,0 +1,190 @@
+SUITE_secondary_storage_http_PROBE() {
+    if ! python3 -c 'from http.server import ThreadingHTTPServer' >/dev/null 2>&1; then
+        echo "python3 not available"
+    fi
+}
+
+start_http_server() {
+    mkdir -p remote
+    cat >http_server.py <<'EOF'
+import http.server
+import os
+import sys
+import threading
+import time
+
+root = sys.argv[1]
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def reply(self, status, data=b""):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def entry_path(self):
+        if self.path.startswith("/slow/"):
+            time.sleep(2)
+        return os.path.join(root, os.path.basename(self.path))
+
+    def do_GET(self):
+        path = self.entry_path()
+        if os.path.isfile(path):
+            with open(path, "rb") as f:
+                self.reply(200, f.read())
+        else:
+            self.reply(404)
+
+    def do_PUT(self):
+        path = self.entry_path()
+        data = self.rfile.read(int(self.headers["Content-Length"]))
+        with open(path + ".tmp", "wb") as f:
+            f.write(data)
+        os.rename(path + ".tmp", path)
+        self.reply(201)
+
+    def log_message(self, *args):
+        pass
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+with open("http_port.tmp", "w") as f:
+    f.write(str(server.server_address[1]))
+os.rename("http_port.tmp", "http_port")
+threading.Thread(target=server.serve_forever, daemon=True).start()
+
+# Exit when the test script does.
+parent = os.getppid()
+while os.getppid() == parent:
+    time.sleep(0.2)
+EOF
+    python3 http_server.py remote </dev/null >/dev/null 2>&1 &
+    http_server_pid=$!
+    while [ ! -f http_port ]; do
+        sleep 0.1
+    done
+    http_port=$(cat http_port)
+}
+
+stop_http_server() {
+    kill $http_server_pid
+    wait $http_server_pid 2>/dev/null
+}
+
+SUITE_secondary_storage_http_SETUP() {
+    generate_code 1 test.c
+    start_http_server
+    export CCACHE_SECONDARY_STORAGE=http://127.0.0.1:$http_port/cache
+}
+
+SUITE_secondary_storage_http() {
+    # -------------------------------------------------------------------------
+    TEST "Result is uploaded and fetched on local miss"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "to secondary storage in background process"
+    expect_eventual_file_count 1 '*R' remote
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 0
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Host name is resolved"
+
+    export CCACHE_SECONDARY_STORAGE=http://localhost:$http_port/cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 '*R' remote
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest and result are fetched in direct mode"
+
+    unset CCACHE_NODIRECT
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 '*M' remote
+    expect_eventual_file_count 1 '*R' remote
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 2
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Results with raw files are not uploaded"
+
+    CCACHE_HARDLINK=1 $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 0 '*R' remote
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Slow secondary storage times out"
+
+    export CCACHE_SECONDARY_STORAGE=http://127.0.0.1:$http_port/slow
+    export CCACHE_SECONDARY_STORAGE_TIMEOUT=100
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_exists test.o
+    if ! grep -q "timed out" $CCACHE_LOGFILE; then
+        test_failed "Expected timeout in log"
+    fi
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Lookup timeout falls back to running the compiler"
+
+    export CCACHE_SECONDARY_STORAGE=http://127.0.0.1:$http_port/slow
+    export CCACHE_SECONDARY_STORAGE_TIMEOUT=5000
+    export CCACHE_LOOKUPTIMEOUT=500
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'lookup timed out' 1
+    expect_exists test.o
+    if ! grep -q "Lookup took longer than 500 ms" $CCACHE_LOGFILE; then
+        test_failed "Expected lookup timeout in log"
+    fi
+
+    stop_http_server
+
+    # -------------------------------------------------------------------------
+    TEST "Unreachable secondary storage"
+
+    stop_http_server
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_exists test.o
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+}
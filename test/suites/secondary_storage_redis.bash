@@ -0,0 +1,152 @@
+SUITE_secondary_storage_redis_PROBE() {
+    if ! python3 -c 'import socketserver' >/dev/null 2>&1; then
+        echo "python3 not available"
+    fi
+}
+
+# A minimal Redis protocol server storing values in files in the "remote"
+# directory and logging each accepted connection to "connections.log".
+start_redis_server() {
+    mkdir -p remote
+    cat >redis_server.py <<'EOF'
+import os
+import socketserver
+import sys
+import threading
+import time
+
+root = sys.argv[1]
+password = sys.argv[2] if len(sys.argv) > 2 else None
+
+class Handler(socketserver.StreamRequestHandler):
+    def read_command(self):
+        line = self.rfile.readline()
+        if not line:
+            return None
+        args = []
+        for _ in range(int(line[1:])):
+            length = int(self.rfile.readline()[1:])
+            args.append(self.rfile.read(length + 2)[:-2])
+        return args
+
+    def handle(self):
+        with open("connections.log", "a") as f:
+            f.write("connection\n")
+        authenticated = password is None
+        while True:
+            args = self.read_command()
+            if args is None:
+                return
+            command = args[0].upper()
+            path = os.path.join(root, args[1].decode()) if len(args) > 1 else ""
+            if command == b"AUTH":
+                authenticated = args[-1].decode() == password
+                reply = b"+OK\r\n" if authenticated else b"-WRONGPASS\r\n"
+            elif not authenticated:
+                reply = b"-NOAUTH Authentication required.\r\n"
+            elif command == b"SELECT":
+                reply = b"+OK\r\n"
+            elif command == b"GET":
+                if os.path.isfile(path):
+                    with open(path, "rb") as f:
+                        data = f.read()
+                    reply = b"$%d\r\n%s\r\n" % (len(data), data)
+                else:
+                    reply = b"$-1\r\n"
+            elif command == b"SET":
+                with open(path + ".tmp", "wb") as f:
+                    f.write(args[2])
+                os.rename(path + ".tmp", path)
+                reply = b"+OK\r\n"
+            elif command == b"DEL":
+                reply = b":0\r\n"
+            else:
+                reply = b"-ERR unknown command\r\n"
+            self.wfile.write(reply)
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    daemon_threads = True
+
+server = Server(("127.0.0.1", 0), Handler)
+with open("redis_port.tmp", "w") as f:
+    f.write(str(server.server_address[1]))
+os.rename("redis_port.tmp", "redis_port")
+threading.Thread(target=server.serve_forever, daemon=True).start()
+
+# Exit when the test script does.
+parent = os.getppid()
+while os.getppid() == parent:
+    time.sleep(0.2)
+EOF
+    python3 redis_server.py remote "$@" </dev/null >/dev/null 2>&1 &
+    redis_server_pid=$!
+    while [ ! -f redis_port ]; do
+        sleep 0.1
+    done
+    redis_port=$(cat redis_port)
+}
+
+stop_redis_server() {
+    kill $redis_server_pid
+    wait $redis_server_pid 2>/dev/null
+    rm -f redis_port
+}
+
+SUITE_secondary_storage_redis_SETUP() {
+    generate_code 1 test.c
+}
+
+SUITE_secondary_storage_redis() {
+    # -------------------------------------------------------------------------
+    TEST "Manifest and result are fetched on local miss"
+
+    start_redis_server
+    export CCACHE_SECONDARY_STORAGE=redis://127.0.0.1:$redis_port/1
+    unset CCACHE_NODIRECT
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 'ccache:*M' remote
+    expect_eventual_file_count 1 'ccache:*R' remote
+    # All requests of an invocation use the same connection.
+    expect_content connections.log "connection"
+
+    remove_cache
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 0
+    expect_stat 'files in cache' 2
+
+    stop_redis_server
+
+    # -------------------------------------------------------------------------
+    TEST "Authentication"
+
+    start_redis_server secret
+
+    CCACHE_SECONDARY_STORAGE=redis://127.0.0.1:$redis_port \
+        $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_file_count 0 'ccache:*R' remote
+    if ! grep -q "NOAUTH" $CCACHE_LOGFILE; then
+        test_failed "Expected NOAUTH error in log"
+    fi
+
+    remove_cache
+
+    CCACHE_SECONDARY_STORAGE=redis://:secret@127.0.0.1:$redis_port \
+        $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    expect_eventual_file_count 1 'ccache:*R' remote
+
+    remove_cache
+
+    CCACHE_SECONDARY_STORAGE=redis://:secret@127.0.0.1:$redis_port \
+        $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 0
+
+    stop_redis_server
+}
@@ -0,0 +1,221 @@
+SUITE_syscall_budget_PROBE() {
+    if ! $HOST_OS_LINUX; then
+        echo "call counting only works on Linux"
+        return
+    fi
+
+    # The counter is preloaded into ccache and counts calls to the libc
+    # wrappers of the interesting system calls plus heap allocations. ccache
+    # writes the counts to $CALL_COUNTER_FILE when it exits.
+    cat <<'EOF' >call_counter.c
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { STAT, OPEN, READ, WRITE, RENAME, MALLOC, N_KINDS };
+static const char* const kind_names[N_KINDS] = {
+    "stat", "open", "read", "write", "rename", "malloc"};
+static unsigned long counts[N_KINDS];
+
+#define COUNT(kind) __atomic_fetch_add(&counts[kind], 1, __ATOMIC_RELAXED)
+
+#define WRAP(kind, ret, name, params, args) \
+    ret name params \
+    { \
+        static ret(*real) params; \
+        if (!real) { \
+            real = (ret(*) params)dlsym(RTLD_NEXT, #name); \
+        } \
+        COUNT(kind); \
+        return real args; \
+    }
+
+struct stat;
+struct stat64;
+struct statx;
+
+WRAP(STAT, int, stat, (const char* p, struct stat* b), (p, b))
+WRAP(STAT, int, stat64, (const char* p, struct stat64* b), (p, b))
+WRAP(STAT, int, lstat, (const char* p, struct stat* b), (p, b))
+WRAP(STAT, int, lstat64, (const char* p, struct stat64* b), (p, b))
+WRAP(STAT, int, fstatat, (int d, const char* p, struct stat* b, int f), (d, p, b, f))
+WRAP(STAT, int, fstatat64, (int d, const char* p, struct stat64* b, int f), (d, p, b, f))
+WRAP(STAT, int, statx, (int d, const char* p, int f, unsigned m, struct statx* b), (d, p, f, m, b))
+WRAP(STAT, int, __xstat, (int v, const char* p, struct stat* b), (v, p, b))
+WRAP(STAT, int, __xstat64, (int v, const char* p, struct stat64* b), (v, p, b))
+WRAP(STAT, int, __lxstat, (int v, const char* p, struct stat* b), (v, p, b))
+WRAP(STAT, int, __lxstat64, (int v, const char* p, struct stat64* b), (v, p, b))
+
+WRAP(OPEN, FILE*, fopen, (const char* p, const char* m), (p, m))
+WRAP(OPEN, FILE*, fopen64, (const char* p, const char* m), (p, m))
+
+#define WRAP_OPEN(name, params, args) \
+    int name params \
+    { \
+        static int (*real) params; \
+        if (!real) { \
+            real = (int(*) params)dlsym(RTLD_NEXT, #name); \
+        } \
+        va_list ap; \
+        va_start(ap, f); \
+        unsigned mode = va_arg(ap, unsigned); \
+        va_end(ap); \
+        COUNT(OPEN); \
+        return real args; \
+    }
+
+WRAP_OPEN(open, (const char* p, int f, ...), (p, f, mode))
+WRAP_OPEN(open64, (const char* p, int f, ...), (p, f, mode))
+WRAP_OPEN(openat, (int d, const char* p, int f, ...), (d, p, f, mode))
+WRAP_OPEN(openat64, (int d, const char* p, int f, ...), (d, p, f, mode))
+
+WRAP(READ, long, read, (int d, void* b, size_t n), (d, b, n))
+WRAP(READ, long, pread, (int d, void* b, size_t n, long o), (d, b, n, o))
+WRAP(READ, long, pread64, (int d, void* b, size_t n, long o), (d, b, n, o))
+WRAP(WRITE, long, write, (int d, const void* b, size_t n), (d, b, n))
+WRAP(WRITE, long, pwrite, (int d, const void* b, size_t n, long o), (d, b, n, o))
+WRAP(WRITE, long, pwrite64, (int d, const void* b, size_t n, long o), (d, b, n, o))
+
+WRAP(RENAME, int, rename, (const char* a, const char* b), (a, b))
+WRAP(RENAME, int, renameat, (int d1, const char* a, int d2, const char* b), (d1, a, d2, b))
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+
+void* malloc(size_t n) { COUNT(MALLOC); return __libc_malloc(n); }
+void* calloc(size_t n, size_t s) { COUNT(MALLOC); return __libc_calloc(n, s); }
+void* realloc(void* p, size_t n) { COUNT(MALLOC); return __libc_realloc(p, n); }
+
+long readlink(const char* p, char* b, size_t n);
+
+__attribute__((destructor)) static void report(void)
+{
+    // Only count calls made by ccache itself, not by the compiler.
+    char exe[4096];
+    long len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    const char* path = getenv("CALL_COUNTER_FILE");
+    if (len <= 0 || !path) {
+        return;
+    }
+    exe[len] = '\0';
+    const char* base = strrchr(exe, '/');
+    if (strcmp(base ? base + 1 : exe, "ccache") != 0) {
+        return;
+    }
+    unsigned long snapshot[N_KINDS];
+    memcpy(snapshot, counts, sizeof(snapshot));
+    FILE* f = fopen(path, "w");
+    if (f) {
+        for (int i = 0; i < N_KINDS; ++i) {
+            fprintf(f, "%s %lu\n", kind_names[i], snapshot[i]);
+        }
+        fclose(f);
+    }
+}
+EOF
+    if ! $REAL_COMPILER -shared -fPIC -O2 -o $ABS_TESTDIR/call_counter.so \
+            call_counter.c -ldl >/dev/null 2>&1; then
+        echo "failed to build the call counter"
+        return
+    fi
+    LD_PRELOAD=$ABS_TESTDIR/call_counter.so \
+        CALL_COUNTER_FILE=$PWD/counts $CCACHE --version >/dev/null
+    if ! grep -q '^malloc [1-9]' counts 2>/dev/null; then
+        echo "failed to preload the call counter"
+    fi
+}
+
+SUITE_syscall_budget_SETUP() {
+    unset CCACHE_NODIRECT
+
+    for n in 10 110; do
+        mkdir include_$n
+        echo "// test_$n.c" >test_$n.c
+        for i in $(seq $n); do
+            echo "int h_$i;" >include_$n/h_$i.h
+            echo "#include \"include_$n/h_$i.h\"" >>test_$n.c
+        done
+        backdate include_$n/*.h
+    done
+}
+
+# Runs ccache with the call counter preloaded and sets count_stat, count_open,
+# count_read, count_write, count_rename and count_malloc.
+count_calls() {
+    rm -f $ABS_TESTDIR/counts
+    LD_PRELOAD=$ABS_TESTDIR/call_counter.so \
+        CALL_COUNTER_FILE=$ABS_TESTDIR/counts "$@"
+    if [ ! -f $ABS_TESTDIR/counts ]; then
+        test_failed "Call counts were not written"
+    fi
+    while read kind count; do
+        eval count_$kind=$count
+    done <$ABS_TESTDIR/counts
+}
+
+# Compiles test_10.c and test_110.c and checks the calls made for the 100 extra
+# include files and the calls made for test_10.c against the given budgets,
+# specified as "kind:per_100_includes:total" words.
+expect_call_budget() {
+    local description=$1
+    shift
+    local budget kind per_100_includes total small large
+
+    for n in 10 110; do
+        count_calls $CCACHE_COMPILE -c test_$n.c
+        for kind in stat open read write rename malloc; do
+            eval calls_${kind}_$n=\$count_$kind
+        done
+    done
+
+    for budget in "$@"; do
+        IFS=: read kind per_100_includes total <<<"$budget"
+        eval small=\$calls_${kind}_10
+        eval large=\$calls_${kind}_110
+        if $verbose; then
+            printf "%-20s %-6s %6d for 100 includes, %6d for 10 includes\n" \
+                "$description" $kind $((large - small)) $small
+        fi
+        if [ $((large - small)) -gt $per_100_includes ]; then
+            test_failed "$description: $((large - small)) $kind calls for 100 includes (budget $per_100_includes)"
+        fi
+        if [ $small -gt $total ]; then
+            test_failed "$description: $small $kind calls for 10 includes (budget $total)"
+        fi
+    done
+}
+
+SUITE_syscall_budget() {
+    # -------------------------------------------------------------------------
+    TEST "Cache miss"
+
+    expect_call_budget "cache miss" \
+        stat:300:150 open:300:60 \
+        read:150:30 write:10:10 rename:10:8 malloc:1700:2000
+    expect_stat 'cache miss' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Direct mode hit"
+
+    $CCACHE_COMPILE -c test_10.c
+    $CCACHE_COMPILE -c test_110.c
+    expect_call_budget "direct hit" \
+        stat:150:90 open:300:50 \
+        read:150:20 write:10:5 rename:10:3 malloc:350:1500
+    expect_stat 'cache hit (direct)' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Preprocessor mode hit"
+
+    export CCACHE_NODIRECT=1
+    $CCACHE_COMPILE -c test_10.c
+    $CCACHE_COMPILE -c test_110.c
+    expect_call_budget "preprocessed hit" \
+        stat:50:70 open:50:15 \
+        read:50:10 write:10:5 rename:10:3 malloc:600:1500
+    expect_stat 'cache hit (preprocessed)' 2
+}
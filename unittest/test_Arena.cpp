@@ -0,0 +1,89 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Arena.hpp"
+
+#include "third_party/doctest.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+using nonstd::string_view;
+
+TEST_SUITE_BEGIN("Arena");
+
+TEST_CASE("Arena::allocate")
+{
+  Arena arena(1024);
+
+  SUBCASE("alignment")
+  {
+    arena.allocate(1, 1);
+    void* p = arena.allocate(8, 8);
+    CHECK(reinterpret_cast<uintptr_t>(p) % 8 == 0);
+    p = arena.allocate(3, 64);
+    CHECK(reinterpret_cast<uintptr_t>(p) % 64 == 0);
+  }
+
+  SUBCASE("small allocations share a block")
+  {
+    for (int i = 0; i < 100; ++i) {
+      arena.allocate(8, 8);
+    }
+    CHECK(arena.capacity() == 1024);
+  }
+
+  SUBCASE("large allocation gets its own block")
+  {
+    char* small = static_cast<char*>(arena.allocate(8, 1));
+    arena.allocate(4096, 1);
+    CHECK(arena.capacity() == 1024 + 4096 + 1);
+    char* next = static_cast<char*>(arena.allocate(8, 1));
+    CHECK(next == small + 8);
+  }
+}
+
+TEST_CASE("Arena::copy")
+{
+  Arena arena(16);
+  const std::string original = "a string longer than the block size";
+
+  const string_view copy = arena.copy(original);
+  CHECK(copy == original);
+  CHECK(copy.data() != original.data());
+  CHECK(copy.data()[copy.size()] == '\0');
+
+  CHECK(arena.copy("").empty());
+}
+
+TEST_CASE("StringViewHash")
+{
+  Arena arena;
+  std::unordered_map<string_view, int, StringViewHash> map;
+  map.emplace(arena.copy(std::string("foo")), 1);
+  map.emplace(arena.copy(std::string("bar")), 2);
+
+  const std::string key = "foo";
+  REQUIRE(map.find(key) != map.end());
+  CHECK(map.find(key)->second == 1);
+  CHECK(map.find("bar")->second == 2);
+  CHECK(map.find("baz") == map.end());
+}
+
+TEST_SUITE_END();
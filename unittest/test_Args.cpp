@@ -263,6 +263,13 @@ TEST_CASE("Args operations")
     CHECK(args == Args::from_string("x y eeny meeny x y miny moe x y"));
   }
 
+  SUBCASE("insert moved args")
+  {
+    args.insert(2, Args::from_string("x y"));
+    args.insert(0, Args::from_string("z"));
+    CHECK(args == Args::from_string("z eeny meeny x y miny moe"));
+  }
+
   SUBCASE("pop_back")
   {
     args.pop_back();
@@ -306,6 +313,13 @@ TEST_CASE("Args operations")
     args.replace(0, more_args);
     CHECK(args == Args::from_string("x y meeny x y"));
   }
+
+  SUBCASE("replace with moved args")
+  {
+    args.replace(3, Args::from_string("x y"));
+    args.replace(0, Args::from_string("z"));
+    CHECK(args == Args::from_string("z meeny miny x y"));
+  }
 }
 
 TEST_SUITE_END();
@@ -0,0 +1,113 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/BuildId.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+namespace {
+
+void
+put(std::string& data, size_t offset, uint64_t value, size_t size)
+{
+  if (data.size() < offset + size) {
+    data.resize(offset + size);
+  }
+  for (size_t i = 0; i < size; ++i) {
+    data[offset + i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("BuildId");
+
+TEST_CASE("BuildId::read")
+{
+  TestContext test_context;
+
+  SUBCASE("ELF")
+  {
+    std::string elf("\x7f" "ELF\x02\x01\x01", 7);
+    put(elf, 0x20, 64, 8); // e_phoff
+    put(elf, 0x36, 56, 2); // e_phentsize
+    put(elf, 0x38, 2, 2);  // e_phnum
+    put(elf, 64, 1, 4);    // PT_LOAD
+    put(elf, 120, 4, 4);   // PT_NOTE
+    put(elf, 120 + 0x08, 176, 8);
+    put(elf, 120 + 0x20, 40, 8);
+    // A note of another type followed by the build ID note.
+    put(elf, 176, 4, 4);
+    put(elf, 180, 4, 4);
+    put(elf, 184, 1, 4);
+    elf.replace(188, 4, std::string("GNU\0", 4));
+    put(elf, 192, 0x11111111, 4);
+    put(elf, 196, 4, 4);
+    put(elf, 200, 4, 4);
+    put(elf, 204, 3, 4);
+    elf.replace(208, 4, std::string("GNU\0", 4));
+    put(elf, 212, 0x04030201, 4);
+    Util::write_file("elf", elf);
+
+    CHECK(BuildId::read("elf") == std::string("\x01\x02\x03\x04"));
+  }
+
+  SUBCASE("ELF without build ID")
+  {
+    std::string elf("\x7f" "ELF\x01\x01\x01", 7);
+    put(elf, 0x1C, 52, 4); // e_phoff
+    put(elf, 0x2A, 32, 2); // e_phentsize
+    put(elf, 0x2C, 1, 2);  // e_phnum
+    put(elf, 52, 1, 4);    // PT_LOAD
+    put(elf, 84, 0, 4);
+    Util::write_file("elf", elf);
+
+    CHECK(!BuildId::read("elf"));
+  }
+
+  SUBCASE("Mach-O")
+  {
+    std::string macho;
+    put(macho, 0, 0xfeedfacf, 4);
+    put(macho, 16, 2, 4);  // ncmds
+    put(macho, 20, 32, 4); // sizeofcmds
+    put(macho, 32, 0x19, 4);
+    put(macho, 36, 8, 4);
+    put(macho, 40, 0x1b, 4); // LC_UUID
+    put(macho, 44, 24, 4);
+    macho += "0123456789abcdef";
+    Util::write_file("macho", macho);
+
+    CHECK(BuildId::read("macho") == "0123456789abcdef");
+  }
+
+  SUBCASE("other files")
+  {
+    Util::write_file("script", "#!/bin/sh\nexec gcc \"$@\"\n");
+    CHECK(!BuildId::read("script"));
+    Util::write_file("short", "\x7f" "E");
+    CHECK(!BuildId::read("short"));
+    CHECK(!BuildId::read("nonexistent"));
+  }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,162 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CacheBundle.hpp"
+#include "../src/Config.hpp"
+#include "../src/Statistics.hpp"
+#include "../src/Storage.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("CacheBundle");
+
+namespace {
+
+void
+create_cache_file(const std::string& cache_dir,
+                  const std::string& name,
+                  const std::string& content,
+                  time_t mtime)
+{
+  const auto path = Util::get_path_in_cache(cache_dir, 2, name);
+  Util::ensure_dir_exists(Util::dir_name(path));
+  Util::write_file(path, content);
+  struct utimbuf buf;
+  buf.actime = mtime;
+  buf.modtime = mtime;
+  utime(path.c_str(), &buf);
+}
+
+} // namespace
+
+TEST_CASE("Export and import")
+{
+  TestContext test_context;
+
+  const auto cwd = Util::get_actual_cwd();
+  Config config;
+  config.set_cache_dir(FMT("{}/cache", cwd));
+  create_cache_file(config.cache_dir(), "00aaaaaaaaM", "manifest", 3000);
+  create_cache_file(config.cache_dir(), "00bbbbbbbbR", "result b", 2000);
+  create_cache_file(config.cache_dir(), "f0ccccccccR", "result c", 1000);
+  create_cache_file(config.cache_dir(), "f0cccccccc0W", "raw", 1000);
+  create_cache_file(config.cache_dir(), "f0ddddddddR.tmp.1", "partial", 4000);
+
+  const auto no_progress = [](double) {};
+
+  SUBCASE("all files")
+  {
+    CHECK(CacheBundle::write(config, "all.bundle", 0, no_progress) == 4);
+
+    const CacheBundle bundle("all.bundle");
+    REQUIRE(bundle);
+    CHECK(bundle.size() == 4);
+    CHECK(bundle.get("00aaaaaaaaM") == nonstd::string_view("manifest"));
+    CHECK(bundle.get("00bbbbbbbbR") == nonstd::string_view("result b"));
+    CHECK(bundle.get("f0ccccccccR") == nonstd::string_view("result c"));
+    CHECK(bundle.get("f0cccccccc0W") == nonstd::string_view("raw"));
+    CHECK(!bundle.get("f0ddddddddR.tmp.1"));
+    CHECK(!bundle.get("00"));
+    CHECK(!bundle.get("ffffffffffR"));
+
+    Config import_config;
+    import_config.set_cache_dir(FMT("{}/imported", cwd));
+    CHECK(bundle.import(import_config, no_progress) == 4);
+    CHECK(Util::read_file(Util::get_path_in_cache(
+            import_config.cache_dir(), 2, "f0cccccccc0W"))
+          == "raw");
+    const auto counters =
+      Statistics::read(FMT("{}/f/stats", import_config.cache_dir()));
+    CHECK(counters.get(Statistic::files_in_cache) == 2);
+
+    // Files already in the cache are not stored again.
+    CHECK(bundle.import(import_config, no_progress) == 0);
+  }
+
+  SUBCASE("most recently used files")
+  {
+    CHECK(CacheBundle::write(config, "mru.bundle", 16, no_progress) == 2);
+
+    const CacheBundle bundle("mru.bundle");
+    REQUIRE(bundle);
+    CHECK(bundle.get("00aaaaaaaaM"));
+    CHECK(bundle.get("00bbbbbbbbR"));
+    CHECK(!bundle.get("f0ccccccccR"));
+  }
+
+  SUBCASE("packed files")
+  {
+    const auto pack_path =
+      FMT("{}/0/{}", config.cache_dir(), Storage::k_pack_file_name);
+    CHECK(CacheBundle::write_files(pack_path,
+                                   {{"00aaaaaaaaM", {}, {"old manifest"}},
+                                    {"00eeeeeeeeR", {}, {"result e"}}},
+                                   no_progress)
+          == 2);
+    CHECK(CacheBundle::write(config, "packed.bundle", 0, no_progress) == 5);
+
+    const CacheBundle bundle("packed.bundle");
+    REQUIRE(bundle);
+    CHECK(bundle.get("00aaaaaaaaM") == nonstd::string_view("manifest"));
+    CHECK(bundle.get("00eeeeeeeeR") == nonstd::string_view("result e"));
+  }
+}
+
+TEST_CASE("Write files")
+{
+  TestContext test_context;
+
+  Util::write_file("b", "file b");
+  const auto no_progress = [](double) {};
+  CHECK(CacheBundle::write_files("test.bundle",
+                                 {{"a", {}, {"data a"}},
+                                  {"b", "b", {}},
+                                  {"c", "missing", {}},
+                                  {"d", {}, {""}}},
+                                 no_progress)
+        == 3);
+
+  const CacheBundle bundle("test.bundle");
+  REQUIRE(bundle);
+  REQUIRE(bundle.size() == 3);
+  CHECK(bundle.name(0) == "a");
+  CHECK(bundle.data(0) == nonstd::string_view("data a"));
+  CHECK(bundle.name(1) == "b");
+  CHECK(bundle.data(1) == nonstd::string_view("file b"));
+  CHECK(bundle.name(2) == "d");
+  CHECK(bundle.data(2) == nonstd::string_view(""));
+}
+
+TEST_CASE("Invalid bundle")
+{
+  TestContext test_context;
+
+  CHECK(!CacheBundle("missing.bundle"));
+  Util::write_file("empty.bundle", "");
+  CHECK(!CacheBundle("empty.bundle"));
+  Util::write_file("truncated.bundle",
+                   std::string("cCbD\x01\0\0\0\0\0\0\0\0\0\0\x02", 16));
+  CHECK(!CacheBundle("truncated.bundle"));
+}
+
+TEST_SUITE_END();
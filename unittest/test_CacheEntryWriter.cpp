@@ -0,0 +1,97 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CacheEntryReader.hpp"
+#include "../src/CacheEntryWriter.hpp"
+#include "../src/File.hpp"
+#include "../src/exceptions.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+#include "third_party/nonstd/optional.hpp"
+
+#include <string>
+
+using TestUtil::TestContext;
+
+namespace {
+
+const uint8_t k_magic[4] = {'T', 'e', 's', 't'};
+const uint8_t k_version = 3;
+
+void
+write_entry(Compression::Type compression_type,
+            nonstd::optional<uint64_t> payload_size,
+            const std::string& payload)
+{
+  File file("entry", "wb");
+  CacheEntryWriter writer(
+    file.get(), k_magic, k_version, compression_type, 1, payload_size);
+  writer.write(payload.data(), payload.size());
+  writer.finalize();
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("CacheEntryWriter");
+
+TEST_CASE("Entries with and without known payload size")
+{
+  TestContext test_context;
+
+  const std::string payload(10000, 'x');
+
+  for (const auto compression_type :
+       {Compression::Type::none, Compression::Type::zstd}) {
+    for (const bool streamed : {false, true}) {
+      CAPTURE(Compression::type_to_string(compression_type));
+      CAPTURE(streamed);
+      write_entry(compression_type,
+                  streamed ? nonstd::nullopt
+                           : nonstd::optional<uint64_t>(payload.size()),
+                  payload);
+
+      File file("entry", "rb");
+      CacheEntryReader reader(file.get(), k_magic, k_version);
+      CHECK(reader.streamed() == streamed);
+      CHECK(reader.version() == k_version);
+      CHECK(reader.payload_size() == payload.size());
+      CHECK(reader.content_size() == 15 + payload.size() + (streamed ? 16 : 8));
+
+      std::string data(payload.size(), '\0');
+      reader.read(&data[0], data.size());
+      CHECK(data == payload);
+      reader.finalize();
+    }
+  }
+}
+
+TEST_CASE("Streamed entry with wrong payload size")
+{
+  TestContext test_context;
+
+  write_entry(Compression::Type::none, nonstd::nullopt, "abcdefghijklmnop");
+
+  File file("entry", "rb");
+  CacheEntryReader reader(file.get(), k_magic, k_version);
+  char data[8];
+  reader.read(data, sizeof(data));
+  CHECK_THROWS_AS(reader.finalize(), Error);
+}
+
+TEST_SUITE_END();
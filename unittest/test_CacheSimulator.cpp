@@ -0,0 +1,99 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CacheSimulator.hpp"
+
+#include "third_party/doctest.h"
+
+using CacheSimulator::Policy;
+using CacheSimulator::simulate;
+
+TEST_SUITE_BEGIN("CacheSimulator");
+
+TEST_CASE("CacheSimulator::parse")
+{
+  const auto trace = CacheSimulator::parse(
+    "{\"time\":1,\"result\":\"cache_miss\",\"compressed_size\":1000,"
+    "\"result_name\":\"0abc\",\"compiler_duration_ms\":40}\n"
+    "{\"time\":2,\"result\":\"unsupported_source_language\","
+    "\"result_name\":\"\"}\n"
+    "{\"time\":3,\"result\":\"direct_cache_hit\",\"bytes_retrieved\":3000,"
+    "\"result_name\":\"f123\",\"compiler_duration_ms\":0}\n"
+    "{\"time\":4,\"result\":\"direct_cache_hit\",\"bytes_retrieved\":2000,"
+    "\"result_name\":\"0abc\",\"compiler_duration_ms\":40}\n");
+
+  REQUIRE(trace.results.size() == 2);
+  CHECK(trace.results[0].size == 1000);
+  CHECK(trace.results[0].cost == 40);
+  CHECK(trace.results[0].subdir == 0);
+  CHECK(trace.results[1].size == 3000);
+  CHECK(trace.results[1].cost == 0);
+  CHECK(trace.results[1].subdir == 15);
+  CHECK(trace.lookups == std::vector<uint32_t>{0, 1, 0});
+}
+
+TEST_CASE("CacheSimulator::simulate")
+{
+  // Three results in the same subdirectory of which two fit in a cache of
+  // 32000 bytes.
+  CacheSimulator::Trace trace;
+  trace.results.resize(3);
+  for (auto& result : trace.results) {
+    result.size = 1000;
+    result.cost = 10;
+  }
+  const uint64_t max_size = 32000;
+
+  SUBCASE("LRU")
+  {
+    trace.lookups = {0, 1, 0, 2, 0, 1};
+
+    auto outcome = simulate(trace, Policy::lru, max_size, 1.0, 0);
+    CHECK(outcome.hits == 2);
+    CHECK(outcome.misses == 4);
+    CHECK(outcome.saved_time_ms == 20);
+
+    outcome = simulate(trace, Policy::sampled_lru, max_size, 1.0, 64);
+    CHECK(outcome.hits == 2);
+    CHECK(outcome.misses == 4);
+
+    outcome = simulate(trace, Policy::lru, 0, 1.0, 0);
+    CHECK(outcome.hits == 3);
+    CHECK(outcome.misses == 3);
+
+    // Cleaned up to a single result.
+    outcome = simulate(trace, Policy::lru, max_size, 0.5, 0);
+    CHECK(outcome.hits == 1);
+    CHECK(outcome.misses == 5);
+  }
+
+  SUBCASE("GDSF")
+  {
+    trace.results[1].cost = 1000;
+    trace.lookups = {0, 1, 2, 0, 1};
+
+    auto outcome = simulate(trace, Policy::lru, max_size, 1.0, 0);
+    CHECK(outcome.hits == 0);
+
+    outcome = simulate(trace, Policy::gdsf, max_size, 1.0, 0);
+    CHECK(outcome.hits == 1);
+    CHECK(outcome.saved_time_ms == 1000);
+  }
+}
+
+TEST_SUITE_END();
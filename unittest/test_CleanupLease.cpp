@@ -0,0 +1,109 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CleanupLease.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+TEST_SUITE_BEGIN("CleanupLease");
+
+using TestUtil::TestContext;
+
+TEST_CASE("CleanupLease acquire and release")
+{
+  TestContext test_context;
+
+  {
+    CleanupLease lease(".");
+    CHECK(lease.acquired());
+    CHECK(Stat::lstat("cleanup.lease"));
+  }
+
+  CHECK(!Stat::lstat("cleanup.lease"));
+}
+
+#ifndef _WIN32
+TEST_CASE("CleanupLease is exclusive")
+{
+  TestContext test_context;
+
+  CleanupLease lease(".");
+  REQUIRE(lease.acquired());
+  CleanupLease other_lease(".");
+  CHECK(!other_lease.acquired());
+}
+
+TEST_CASE("CleanupLease of another host")
+{
+  TestContext test_context;
+
+  SUBCASE("Valid")
+  {
+    const auto content = FMT("other-host:1:0:{}", time(nullptr) + 100);
+    REQUIRE(symlink(content.c_str(), "cleanup.lease") == 0);
+
+    {
+      CleanupLease lease(".");
+      CHECK(!lease.acquired());
+    }
+    CHECK(Util::read_link("cleanup.lease") == content);
+  }
+
+  SUBCASE("Expired")
+  {
+    const auto content = FMT("other-host:1:0:{}", time(nullptr) - 1);
+    REQUIRE(symlink(content.c_str(), "cleanup.lease") == 0);
+
+    CleanupLease lease(".");
+    CHECK(lease.acquired());
+  }
+
+  SUBCASE("Garbage")
+  {
+    REQUIRE(symlink("foo", "cleanup.lease") == 0);
+
+    CleanupLease lease(".");
+    CHECK(lease.acquired());
+  }
+}
+
+TEST_CASE("CleanupLease of a dead process on this host")
+{
+  TestContext test_context;
+
+  const pid_t pid = fork();
+  if (pid == 0) {
+    _exit(0);
+  }
+  REQUIRE(pid > 0);
+  waitpid(pid, nullptr, 0);
+
+  const auto content =
+    FMT("{}:{}:0:{}", Util::get_hostname(), pid, time(nullptr) + 100);
+  REQUIRE(symlink(content.c_str(), "cleanup.lease") == 0);
+
+  CleanupLease lease(".");
+  CHECK(lease.acquired());
+}
+#endif
+
+TEST_SUITE_END();
@@ -0,0 +1,74 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CompilationDatabase.hpp"
+#include "../src/exceptions.hpp"
+
+#include "third_party/doctest.h"
+
+TEST_SUITE_BEGIN("CompilationDatabase");
+
+TEST_CASE("CompilationDatabase::parse")
+{
+  SUBCASE("empty")
+  {
+    CHECK(CompilationDatabase::parse(" [ ] ").empty());
+  }
+
+  SUBCASE("arguments and command")
+  {
+    const auto entries = CompilationDatabase::parse(R"([
+  {
+    "directory": "/build",
+    "arguments": ["cc", "-c", "-DX=\"a b\"", "foo.c"],
+    "file": "foo.c",
+    "output": "foo.o"
+  },
+  {
+    "directory": "/build/\u00e5",
+    "command": "cc -c -DX=\"a b\" 'bar baz.c'",
+    "file": "bar baz.c",
+    "extra": {"list": [1, -2.5e3, true, false, null], "empty": {}}
+  }
+])");
+    REQUIRE(entries.size() == 2);
+    CHECK(entries[0].directory == "/build");
+    CHECK(entries[0].file == "foo.c");
+    CHECK(entries[0].args.to_string() == "cc -c -DX=\"a b\" foo.c");
+    CHECK(entries[1].directory == "/build/\xc3\xa5");
+    CHECK(entries[1].args.size() == 4);
+    CHECK(entries[1].args[2] == "-DX=a b");
+    CHECK(entries[1].args[3] == "bar baz.c");
+  }
+
+  SUBCASE("invalid")
+  {
+    CHECK_THROWS_AS(CompilationDatabase::parse(""), Error);
+    CHECK_THROWS_AS(CompilationDatabase::parse("[{}]"), Error);
+    CHECK_THROWS_AS(
+      CompilationDatabase::parse(R"([{"directory": "/", "command": "cc"})"),
+      Error);
+    CHECK_THROWS_AS(CompilationDatabase::parse(R"([{"file": "a.c"}])"),
+                    Error);
+    CHECK_THROWS_AS(
+      CompilationDatabase::parse(R"([{"directory": "/", "command": "cc"}] x)"),
+      Error);
+  }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,51 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CompileClaim.hpp"
+#include "../src/Stat.hpp"
+#include "../src/StdMakeUnique.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("CompileClaim");
+
+TEST_CASE("CompileClaim")
+{
+  TestContext test_context;
+
+  auto first = std::make_unique<CompileClaim>("claims/x");
+  CHECK(first->acquired());
+  CHECK(!first->wait(0));
+  CHECK(Stat::stat("claims/x"));
+
+  CompileClaim second("claims/x");
+  CHECK(!second.acquired());
+  CHECK(!second.wait(10));
+
+  first.reset();
+  CHECK(!Stat::stat("claims/x"));
+  CHECK(second.wait(10));
+
+  CompileClaim third("claims/x");
+  CHECK(third.acquired());
+}
+
+TEST_SUITE_END();
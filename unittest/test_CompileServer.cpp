@@ -0,0 +1,224 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CompileServer.hpp"
+#include "../src/Config.hpp"
+#include "../src/HttpStorage.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <sys/stat.h>
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("CompileServer");
+
+TEST_CASE("CompileServer::encode_job and decode_job")
+{
+  CompileServer::Job job;
+  job.compiler = "gcc";
+  job.compiler_digest = "digest";
+  job.extension = "i";
+  job.args = {"-c", "-O2"};
+  job.source = std::string("int x;\0\0", 8);
+
+  SUBCASE("round trip")
+  {
+    const auto decoded =
+      CompileServer::decode_job(CompileServer::encode_job(job));
+    REQUIRE(decoded);
+    CHECK(decoded->compiler == "gcc");
+    CHECK(decoded->compiler_digest == "digest");
+    CHECK(decoded->extension == "i");
+    CHECK(decoded->cwd.empty());
+    CHECK(decoded->args == job.args);
+    CHECK(decoded->source == job.source);
+  }
+
+  SUBCASE("no arguments")
+  {
+    job.args.clear();
+    job.cwd = "/src";
+    const auto decoded =
+      CompileServer::decode_job(CompileServer::encode_job(job));
+    REQUIRE(decoded);
+    CHECK(decoded->cwd == "/src");
+    CHECK(decoded->args.empty());
+    CHECK(decoded->source == job.source);
+  }
+
+  SUBCASE("truncated")
+  {
+    CHECK(!CompileServer::decode_job(std::string("gcc\0digest\0i\0", 13)));
+    CHECK(!CompileServer::decode_job(""));
+  }
+}
+
+TEST_CASE("CompileServer::encode_outcome and decode_outcome")
+{
+  CompileServer::Outcome outcome;
+  outcome.status = 1;
+  outcome.stdout_data = "out";
+  outcome.stderr_data = "error\n";
+  outcome.object = std::string("\0obj", 4);
+
+  const auto decoded =
+    CompileServer::decode_outcome(CompileServer::encode_outcome(outcome));
+  REQUIRE(decoded);
+  CHECK(decoded->status == 1);
+  CHECK(decoded->stdout_data == "out");
+  CHECK(decoded->stderr_data == "error\n");
+  CHECK(decoded->object == outcome.object);
+
+  CHECK(!CompileServer::decode_outcome("0 3 0\nab"));
+  CHECK(!CompileServer::decode_outcome("0 x 0\n"));
+  CHECK(!CompileServer::decode_outcome("0 0\n"));
+}
+
+TEST_CASE("CompileServer::respond")
+{
+  TestContext test_context;
+
+  const auto cwd = Util::get_actual_cwd();
+  Util::create_dir("bin");
+  Util::write_file("bin/cc",
+                   "#!/bin/sh\n"
+                   "while [ $# -gt 1 ]; do\n"
+                   "  [ \"$1\" = -o ] && out=$2\n"
+                   "  shift\n"
+                   "done\n"
+                   "pwd\n"
+                   "echo \"warning in $1\" >&2\n"
+                   "cat \"$1\" >\"$out\"\n");
+  chmod("bin/cc", 0555);
+  Util::write_file("ccache.conf",
+                   FMT("path = {}/bin\ntemporary_dir = {}/tmp\n", cwd, cwd));
+  Config config;
+  REQUIRE(config.update_from_file("ccache.conf"));
+
+  CompileServer server(config, 1);
+  const auto post = [&](const std::string& body) {
+    return HttpStorage::parse_response(server.respond(
+      FMT("POST /compile HTTP/1.1\r\nContent-Length: {}\r\n\r\n{}",
+          body.size(),
+          body)));
+  };
+
+  CompileServer::Job job;
+  job.compiler = "cc";
+  job.compiler_digest = CompileServer::compiler_digest("bin/cc");
+  job.extension = "i";
+  job.args = {"-c"};
+  job.source = "int x;";
+
+  SUBCASE("compiles")
+  {
+    const auto response = post(CompileServer::encode_job(job));
+    REQUIRE(response);
+    CHECK(response->status == 200);
+    const auto outcome = CompileServer::decode_outcome(response->body);
+    REQUIRE(outcome);
+    CHECK(outcome->status == 0);
+    // The job ran in a private directory, which is gone now.
+    const auto job_dir = Util::strip_whitespace(outcome->stdout_data);
+    CHECK(Util::starts_with(job_dir, Util::real_path(cwd + "/tmp") + "/"));
+    CHECK(!Stat::stat(job_dir));
+    CHECK(Util::starts_with(outcome->stderr_data, "warning in "));
+    CHECK(outcome->object == "int x;");
+  }
+
+  SUBCASE("code generation options")
+  {
+    job.args = {"-c",
+                "-x",
+                "cpp-output",
+                "-O2",
+                "-g",
+                "-fPIC",
+                "-fno-omit-frame-pointer",
+                "-march=native",
+                "-std=c99",
+                "-Wall",
+                "-fdebug-prefix-map=/src=."};
+    CHECK(post(CompileServer::encode_job(job))->status == 200);
+  }
+
+  SUBCASE("unknown compiler")
+  {
+    job.compiler = "gcc";
+    CHECK(post(CompileServer::encode_job(job))->status == 409);
+  }
+
+  SUBCASE("different compiler")
+  {
+    job.compiler_digest = "other";
+    CHECK(post(CompileServer::encode_job(job))->status == 409);
+  }
+
+  SUBCASE("refused argument")
+  {
+    for (const char* arg : {"-fplugin=evil.so",
+                            "@args",
+                            "-MD",
+                            "-Wa,-a=listing",
+                            "-Xassembler",
+                            "-save-temps",
+                            "-dumpdir",
+                            "-fdump-tree-all",
+                            "-fprofile-generate=dir",
+                            "-fstack-usage",
+                            "-o",
+                            "-mllvm",
+                            "-Werror=/tmp/x",
+                            "file.c"}) {
+      job.args = {"-c", arg};
+      CAPTURE(arg);
+      CHECK(post(CompileServer::encode_job(job))->status == 403);
+    }
+  }
+
+  SUBCASE("compiler path")
+  {
+    job.compiler = "/bin/sh";
+    CHECK(post(CompileServer::encode_job(job))->status == 400);
+  }
+
+  SUBCASE("malformed request")
+  {
+    CHECK(post("no job")->status == 400);
+    CHECK(HttpStorage::parse_response(
+            server.respond("POST /compile HTTP/1.1\r\nContent-Length: 100"
+                           "\r\n\r\nshort"))
+            ->status
+          == 400);
+    CHECK(HttpStorage::parse_response(
+            server.respond("GET /compile HTTP/1.1\r\n\r\n"))
+            ->status
+          == 405);
+    CHECK(HttpStorage::parse_response(
+            server.respond("POST /other HTTP/1.1\r\n\r\n"))
+            ->status
+          == 404);
+  }
+}
+
+TEST_SUITE_END();
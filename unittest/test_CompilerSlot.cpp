@@ -0,0 +1,59 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CompilerSlot.hpp"
+#include "../src/Stat.hpp"
+#include "../src/StdMakeUnique.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("CompilerSlot");
+
+TEST_CASE("Unlimited")
+{
+  TestContext test_context;
+
+  CompilerSlot slot("slots", 0);
+  CHECK(!slot.acquired());
+  CHECK(!Stat::stat("slots"));
+}
+
+TEST_CASE("Limited")
+{
+  TestContext test_context;
+
+  auto first = std::make_unique<CompilerSlot>("slots", 2);
+  CHECK(first->acquired());
+  CHECK(Stat::stat("slots/0"));
+  CHECK(Stat::stat("slots/1"));
+
+  CompilerSlot second("slots", 2, 10);
+  CHECK(second.acquired());
+
+  auto third = std::make_unique<CompilerSlot>("slots", 2, 10);
+  CHECK(!third->acquired());
+
+  first.reset();
+  third = std::make_unique<CompilerSlot>("slots", 2, 10);
+  CHECK(third->acquired());
+}
+
+TEST_SUITE_END();
@@ -29,6 +29,36 @@ TEST_CASE("Compression::level_from_config")
   CHECK(Compression::level_from_config(config) == 0);
 }
 
+TEST_CASE("Compression::level_for_entry")
+{
+  Config config;
+  CHECK(Compression::level_for_entry(config, 100) == 0);
+}
+
+TEST_CASE("Compression::adapt_level")
+{
+  const uint64_t kib = 1024;
+  const uint64_t mib = 1024 * 1024;
+
+  // Small entries.
+  CHECK(Compression::adapt_level(0, 10 * kib) == 6);
+  CHECK(Compression::adapt_level(3, 10 * kib) == 6);
+  CHECK(Compression::adapt_level(19, 10 * kib) == 19);
+
+  // Medium entries.
+  CHECK(Compression::adapt_level(0, 1 * mib) == 1);
+  CHECK(Compression::adapt_level(-3, 1 * mib) == -3);
+  CHECK(Compression::adapt_level(5, 1 * mib) == 5);
+
+  // Huge entries.
+  CHECK(Compression::adapt_level(0, 100 * mib) == -1);
+  CHECK(Compression::adapt_level(-5, 100 * mib) == -5);
+
+  // Busy system.
+  CHECK(Compression::adapt_level(5, 10 * kib, true) == -1);
+  CHECK(Compression::adapt_level(5, 1 * mib, true) == -1);
+}
+
 TEST_CASE("Compression::type_from_config")
 {
   Config config;
@@ -39,13 +69,20 @@ TEST_CASE("Compression::type_from_int")
 {
   CHECK(Compression::type_from_int(0) == Compression::Type::none);
   CHECK(Compression::type_from_int(1) == Compression::Type::zstd);
-  CHECK_THROWS_WITH(Compression::type_from_int(2), "Unknown type: 2");
+  CHECK(Compression::type_from_int(2)
+        == Compression::Type::zstd_with_dictionary);
+  CHECK(Compression::type_from_int(3) == Compression::Type::lz4);
+  CHECK_THROWS_WITH(Compression::type_from_int(4), "Unknown type: 4");
 }
 
 TEST_CASE("Compression::type_to_string")
 {
   CHECK(Compression::type_to_string(Compression::Type::none) == "none");
   CHECK(Compression::type_to_string(Compression::Type::zstd) == "zstd");
+  CHECK(
+    Compression::type_to_string(Compression::Type::zstd_with_dictionary)
+    == "zstd with dictionary");
+  CHECK(Compression::type_to_string(Compression::Type::lz4) == "lz4");
 }
 
 TEST_SUITE_END();
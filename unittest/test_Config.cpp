@@ -17,6 +17,7 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "../src/Config.hpp"
+#include "../src/Stat.hpp"
 #include "../src/Util.hpp"
 #include "../src/ccache.hpp"
 #include "../src/exceptions.hpp"
@@ -39,41 +40,112 @@ TEST_CASE("Config: default values")
 {
   Config config;
 
+  CHECK_FALSE(config.adaptive_compression());
+  CHECK(config.admission_threshold() == 1);
+  CHECK_FALSE(config.auto_prefix_map());
+  CHECK_FALSE(config.background_cleanup());
   CHECK(config.base_dir().empty());
+  CHECK_FALSE(config.cache_compiler_queries());
   CHECK(config.cache_dir().empty()); // Set later
+  CHECK_FALSE(config.cache_failures());
+  CHECK_FALSE(config.cache_links());
+  CHECK_FALSE(config.cache_preprocessing());
+  CHECK(config.cleanup_policy() == "lru");
+  CHECK(config.cleanup_sample_size() == 0);
+  CHECK(config.coalesce_timeout() == 0);
+  CHECK(config.compile_servers().empty());
   CHECK(config.compiler().empty());
   CHECK(config.compiler_check() == "mtime");
   CHECK(config.compiler_type() == CompilerType::auto_guess);
   CHECK(config.compression());
   CHECK(config.compression_level() == 0);
+  CHECK(config.compression_threads() == 0);
+  CHECK(config.compression_type() == "zstd");
+  CHECK(!config.config_snapshot());
   CHECK(config.cpp_extension().empty());
   CHECK(!config.debug());
+  CHECK(!config.deduplication());
+  CHECK(!config.defer_mtime_updates());
   CHECK(!config.depend_mode());
+  CHECK(config.digest_map().empty());
   CHECK(config.direct_mode());
   CHECK(!config.disable());
+  CHECK(config.event_log().empty());
+  CHECK(!config.explain_misses());
   CHECK(config.extra_files_to_hash().empty());
   CHECK(!config.file_clone());
+  CHECK(!config.framed_results());
+  CHECK(!config.git_index());
   CHECK(!config.hard_link());
+  CHECK(config.hash_algorithm() == "blake3");
   CHECK(config.hash_dir());
   CHECK(config.ignore_headers_in_manifest().empty());
   CHECK(config.ignore_options().empty());
+  CHECK_FALSE(config.ignore_warning_options());
+  CHECK(config.include_file_jobs() == 0);
+  CHECK(config.inode_cache_dir().empty());
+  CHECK(config.inode_cache_entries() == 128 * 1024);
+  CHECK(config.inode_cache_immutable_dirs().empty());
   CHECK_FALSE(config.keep_comments_cpp());
+  CHECK_FALSE(config.keep_identical_outputs());
   CHECK(config.limit_multiple() == Approx(0.8));
+  CHECK(config.log_buffer_size() == 0);
   CHECK(config.log_file().empty());
+  CHECK(config.lookup_timeout() == 0);
+  CHECK_FALSE(config.lower_cache_copy_up());
+  CHECK(config.lower_cache_dirs().empty());
+  CHECK(config.maintenance_jobs() == 0);
+  CHECK(config.max_compiler_jobs() == 0);
+  CHECK(config.max_delta_chain() == 0);
+  CHECK(config.max_failure_age() == 86400);
   CHECK(config.max_files() == 0);
+  CHECK(config.max_link_size() == 0);
+  CHECK(config.max_manifest_entries() == 100);
+  CHECK(config.max_manifest_entry_age() == 0);
   CHECK(config.max_size() == static_cast<uint64_t>(5) * 1000 * 1000 * 1000);
+  CHECK_FALSE(config.memoize_compiler_check());
+  CHECK_FALSE(config.memoize_path_lookup());
+  CHECK(config.namespace_().empty());
+  CHECK(config.namespace_max_size() == 0);
+  CHECK(config.pack_max_file_size() == 0);
   CHECK(config.path().empty());
   CHECK_FALSE(config.pch_external_checksum());
+  CHECK(config.peer_timeout() == 100);
+  CHECK(config.peers().empty());
+  CHECK_FALSE(config.phase_durations());
   CHECK(config.prefix_command().empty());
   CHECK(config.prefix_command_cpp().empty());
+  CHECK_FALSE(config.presence_filter());
+  CHECK(config.raw_file_min_size() == 0);
   CHECK_FALSE(config.read_only());
   CHECK_FALSE(config.read_only_direct());
   CHECK_FALSE(config.recache());
+  CHECK_FALSE(config.recompress_low_priority());
+  CHECK(config.recompress_rate_limit() == 0);
+  CHECK_FALSE(config.regenerate_depfiles());
   CHECK(config.run_second_cpp());
+  CHECK(config.secondary_storage().empty());
+  CHECK(config.secondary_storage_miss_ttl() == 0);
+  CHECK(config.secondary_storage_timeout() == 500);
+  CHECK(config.session().empty());
+  CHECK_FALSE(config.shared_stats());
   CHECK(config.sloppiness() == 0);
+  CHECK(config.speculative_compile_delay() == 0);
+  CHECK_FALSE(config.speculative_cpp());
+  CHECK_FALSE(config.split_arch());
+  CHECK(config.split_source_jobs() == 0);
+  CHECK_FALSE(config.split_sources());
   CHECK(config.stats());
+  CHECK(config.stats_breakdown().empty());
+  CHECK_FALSE(config.stream_compression());
+  CHECK(config.stripe_dirs().empty());
+  CHECK(config.system_include_roots().empty());
   CHECK(config.temporary_dir().empty()); // Set later
+  CHECK(config.trace_file().empty());
+  CHECK(config.trace_sample_rate() == Approx(1.0));
+  CHECK_FALSE(config.trust_scrubbed_entries());
   CHECK(config.umask() == std::numeric_limits<uint32_t>::max());
+  CHECK_FALSE(config.write_behind());
 }
 
 TEST_CASE("Config::update_from_file")
@@ -91,9 +163,14 @@ TEST_CASE("Config::update_from_file")
 
   Util::write_file(
     "ccache.conf",
+    "auto_prefix_map = true\n"
     "base_dir = " + base_dir + "\n"
+    "cache_compiler_queries = true\n"
     "cache_dir=\n"
     "cache_dir = $USER$/${USER}/.ccache\n"
+    "cache_failures = true\n"
+    "cache_links = true\n"
+    "cache_preprocessing = true\n"
     "\n"
     "\n"
     "  #A comment\n"
@@ -102,75 +179,157 @@ TEST_CASE("Config::update_from_file")
     "compiler_type = pump\n"
     "compression=false\n"
     "compression_level= 2\n"
+    "config_snapshot = true\n"
     "cpp_extension = .foo\n"
+    "defer_mtime_updates = true\n"
     "depend_mode = true\n"
+    "digest_map = $USER.map\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "event_log = $USER.events\n"
+    "explain_misses = true\n"
     "extra_files_to_hash = a:b c:$USER\n"
     "file_clone = true\n"
+    "framed_results = true\n"
+    "git_index = true\n"
     "hard_link = true\n"
+    "hash_algorithm = xxh3\n"
     "hash_dir = false\n"
     "ignore_headers_in_manifest = a:b/c\n"
     "ignore_options = -a=* -b\n"
+    "ignore_warning_options = true\n"
+    "include_file_jobs = 32\n"
     "keep_comments_cpp = true\n"
+    "keep_identical_outputs = true\n"
     "limit_multiple = 1.0\n"
+    "log_buffer_size = 64k\n"
     "log_file = $USER${USER} \n"
+    "lookup_timeout = 250\n"
+    "lower_cache_copy_up = true\n"
+    "lower_cache_dirs = /a:/b\n"
+    "max_compiler_jobs = 8\n"
+    "max_failure_age = 7s\n"
     "max_files = 17\n"
+    "max_link_size = 2.0M\n"
     "max_size = 123M\n"
+    "namespace = ns_$USER\n"
+    "pack_max_file_size = 4k\n"
     "path = $USER.x\n"
     "pch_external_checksum = true\n"
+    "phase_durations = true\n"
     "prefix_command = x$USER\n"
     "prefix_command_cpp = y\n"
+    "presence_filter = true\n"
+    "raw_file_min_size = 1.5M\n"
     "read_only = true\n"
     "read_only_direct = true\n"
     "recache = true\n"
+    "recompress_low_priority = true\n"
+    "recompress_rate_limit = 1.0M\n"
+    "regenerate_depfiles = true\n"
     "run_second_cpp = false\n"
+    "session = job_$USER\n"
     "sloppiness =     time_macros   ,include_file_mtime"
     "  include_file_ctime,file_stat_matches,file_stat_matches_ctime,pch_defines"
-    " ,  no_system_headers,system_headers,clang_index_store\n"
+    " ,  no_system_headers,system_headers,clang_index_store,pch_input_mtime\n"
+    "speculative_cpp = true\n"
+    "split_arch = true\n"
+    "split_source_jobs = 3\n"
+    "split_sources = true\n"
     "stats = false\n"
+    "stats_breakdown = compiler,namespace\n"
+    "stream_compression = true\n"
+    "stripe_dirs = /a:/b\n"
+    "system_include_roots = /usr/include=/$USER.stamp\n"
     "temporary_dir = ${USER}_foo\n"
+    "trace_file = $USER.trace\n"
+    "trace_sample_rate = 0.25\n"
+    "trust_scrubbed_entries = true\n"
     "umask = 777"); // Note: no newline.
 
   Config config;
   REQUIRE(config.update_from_file("ccache.conf"));
+  CHECK(config.auto_prefix_map());
   CHECK(config.base_dir() == base_dir);
+  CHECK(config.cache_compiler_queries());
   CHECK(config.cache_dir() == FMT("{0}$/{0}/.ccache", user));
+  CHECK(config.cache_failures());
+  CHECK(config.cache_links());
+  CHECK(config.cache_preprocessing());
   CHECK(config.compiler() == "foo");
   CHECK(config.compiler_check() == "none");
   CHECK(config.compiler_type() == CompilerType::pump);
   CHECK_FALSE(config.compression());
   CHECK(config.compression_level() == 2);
+  CHECK(config.config_snapshot());
   CHECK(config.cpp_extension() == ".foo");
+  CHECK(config.defer_mtime_updates());
   CHECK(config.depend_mode());
+  CHECK(config.digest_map() == FMT("{}.map", user));
   CHECK_FALSE(config.direct_mode());
   CHECK(config.disable());
+  CHECK(config.event_log() == FMT("{}.events", user));
+  CHECK(config.explain_misses());
   CHECK(config.extra_files_to_hash() == FMT("a:b c:{}", user));
   CHECK(config.file_clone());
+  CHECK(config.framed_results());
+  CHECK(config.git_index());
   CHECK(config.hard_link());
+  CHECK(config.hash_algorithm() == "xxh3");
   CHECK_FALSE(config.hash_dir());
   CHECK(config.ignore_headers_in_manifest() == "a:b/c");
   CHECK(config.ignore_options() == "-a=* -b");
+  CHECK(config.ignore_warning_options());
+  CHECK(config.include_file_jobs() == 32);
   CHECK(config.keep_comments_cpp());
+  CHECK(config.keep_identical_outputs());
   CHECK(config.limit_multiple() == Approx(1.0));
+  CHECK(config.log_buffer_size() == 64 * 1000);
   CHECK(config.log_file() == FMT("{0}{0}", user));
+  CHECK(config.lookup_timeout() == 250);
+  CHECK(config.lower_cache_copy_up());
+  CHECK(config.lower_cache_dirs() == "/a:/b");
+  CHECK(config.max_compiler_jobs() == 8);
+  CHECK(config.max_failure_age() == 7);
   CHECK(config.max_files() == 17);
+  CHECK(config.max_link_size() == 2 * 1000 * 1000);
   CHECK(config.max_size() == 123 * 1000 * 1000);
+  CHECK(config.namespace_() == FMT("ns_{}", user));
+  CHECK(config.pack_max_file_size() == 4000);
   CHECK(config.path() == FMT("{}.x", user));
   CHECK(config.pch_external_checksum());
+  CHECK(config.phase_durations());
   CHECK(config.prefix_command() == FMT("x{}", user));
   CHECK(config.prefix_command_cpp() == "y");
+  CHECK(config.presence_filter());
+  CHECK(config.raw_file_min_size() == 1500 * 1000);
   CHECK(config.read_only());
   CHECK(config.read_only_direct());
   CHECK(config.recache());
+  CHECK(config.recompress_low_priority());
+  CHECK(config.recompress_rate_limit() == 1000 * 1000);
+  CHECK(config.regenerate_depfiles());
   CHECK_FALSE(config.run_second_cpp());
+  CHECK(config.session() == FMT("job_{}", user));
   CHECK(config.sloppiness()
         == (SLOPPY_INCLUDE_FILE_MTIME | SLOPPY_INCLUDE_FILE_CTIME
             | SLOPPY_TIME_MACROS | SLOPPY_FILE_STAT_MATCHES
             | SLOPPY_FILE_STAT_MATCHES_CTIME | SLOPPY_SYSTEM_HEADERS
-            | SLOPPY_PCH_DEFINES | SLOPPY_CLANG_INDEX_STORE));
+            | SLOPPY_PCH_DEFINES | SLOPPY_CLANG_INDEX_STORE
+            | SLOPPY_PCH_INPUT_MTIME));
+  CHECK(config.speculative_cpp());
+  CHECK(config.split_arch());
+  CHECK(config.split_source_jobs() == 3);
+  CHECK(config.split_sources());
   CHECK_FALSE(config.stats());
+  CHECK(config.stats_breakdown() == "compiler,namespace");
+  CHECK(config.stream_compression());
+  CHECK(config.stripe_dirs() == "/a:/b");
+  CHECK(config.system_include_roots() == FMT("/usr/include=/{}.stamp", user));
   CHECK(config.temporary_dir() == FMT("{}_foo", user));
+  CHECK(config.trace_file() == FMT("{}.trace", user));
+  CHECK(config.trace_sample_rate() == Approx(0.25));
+  CHECK(config.trust_scrubbed_entries());
   CHECK(config.umask() == 0777);
 }
 
@@ -228,6 +387,35 @@ TEST_CASE("Config::update_from_file, error handling")
     // Other cases tested in test_Util.c.
   }
 
+  SUBCASE("unknown cleanup policy")
+  {
+    Util::write_file("ccache.conf", "cleanup_policy = lfu");
+    REQUIRE_THROWS_WITH(config.update_from_file("ccache.conf"),
+                        "ccache.conf:1: unknown cleanup policy: \"lfu\"");
+  }
+
+  SUBCASE("unknown hash algorithm")
+  {
+    Util::write_file("ccache.conf", "hash_algorithm = md4");
+    REQUIRE_THROWS_WITH(config.update_from_file("ccache.conf"),
+                        "ccache.conf:1: unknown hash algorithm: \"md4\"");
+  }
+
+  SUBCASE("unknown compression type")
+  {
+    Util::write_file("ccache.conf", "compression_type = gzip");
+    REQUIRE_THROWS_WITH(config.update_from_file("ccache.conf"),
+                        "ccache.conf:1: unknown compression type: \"gzip\"");
+  }
+
+  SUBCASE("unknown statistics dimension")
+  {
+    Util::write_file("ccache.conf", "stats_breakdown = compiler, toolchain");
+    REQUIRE_THROWS_WITH(
+      config.update_from_file("ccache.conf"),
+      "ccache.conf:1: unknown statistics dimension: \"toolchain\"");
+  }
+
   SUBCASE("unknown sloppiness")
   {
     Util::write_file("ccache.conf", "sloppiness = time_macros, foo");
@@ -267,6 +455,62 @@ TEST_CASE("Config::update_from_file, error handling")
   }
 }
 
+TEST_CASE("Config::update_from_file_via_snapshot")
+{
+  TestContext test_context;
+
+  Util::write_file("ccache.conf", "config_snapshot = true\nmax_files = 17\n");
+  struct utimbuf buf;
+  buf.actime = time(nullptr) - 10;
+  buf.modtime = buf.actime;
+  utime("ccache.conf", &buf);
+
+  SUBCASE("missing file")
+  {
+    Config config;
+    CHECK(!config.update_from_file_via_snapshot("missing.conf", "snapshot"));
+    CHECK(!Stat::stat("snapshot"));
+  }
+
+  SUBCASE("snapshot written and used")
+  {
+    Config config1;
+    REQUIRE(config1.update_from_file_via_snapshot("ccache.conf", "snapshot"));
+    CHECK(config1.max_files() == 17);
+    CHECK(Stat::stat("snapshot"));
+
+    Config config2;
+    REQUIRE(config2.update_from_file_via_snapshot("ccache.conf", "snapshot"));
+    CHECK(config2.config_snapshot());
+    CHECK(config2.max_files() == 17);
+  }
+
+  SUBCASE("stale snapshot ignored")
+  {
+    Config config1;
+    REQUIRE(config1.update_from_file_via_snapshot("ccache.conf", "snapshot"));
+
+    Util::write_file("ccache.conf", "max_files = 42\n");
+    utime("ccache.conf", &buf);
+
+    Config config2;
+    REQUIRE(config2.update_from_file_via_snapshot("ccache.conf", "snapshot"));
+    CHECK(!config2.config_snapshot());
+    CHECK(config2.max_files() == 42);
+  }
+
+  SUBCASE("not written when disabled")
+  {
+    Util::write_file("ccache.conf", "max_files = 17\n");
+    utime("ccache.conf", &buf);
+
+    Config config;
+    REQUIRE(config.update_from_file_via_snapshot("ccache.conf", "snapshot"));
+    CHECK(config.max_files() == 17);
+    CHECK(!Stat::stat("snapshot"));
+  }
+}
+
 TEST_CASE("Config::update_from_environment")
 {
   Config config;
@@ -362,48 +606,119 @@ TEST_CASE("Config::visit_items")
   Util::write_file(
     "test.conf",
     "absolute_paths_in_stderr = true\n"
+    "adaptive_compression = true\n"
+    "admission_threshold = 2\n"
+    "auto_prefix_map = true\n"
+    "background_cleanup = true\n"
 #ifndef _WIN32
     "base_dir = /bd\n"
 #else
     "base_dir = C:/bd\n"
 #endif
+    "cache_compiler_queries = true\n"
     "cache_dir = cd\n"
+    "cache_failures = true\n"
+    "cache_links = true\n"
+    "cache_preprocessing = true\n"
+    "cleanup_policy = gdsf\n"
+    "cleanup_sample_size = 5\n"
+    "coalesce_timeout = 100\n"
+    "compile_servers = a b:1\n"
     "compiler = c\n"
     "compiler_check = cc\n"
     "compiler_type = clang\n"
     "compression = true\n"
     "compression_level = 8\n"
+    "compression_threads = 4\n"
+    "compression_type = lz4\n"
+    "config_snapshot = true\n"
     "cpp_extension = ce\n"
     "debug = false\n"
+    "deduplication = true\n"
+    "defer_mtime_updates = true\n"
     "depend_mode = true\n"
+    "digest_map = dm\n"
     "direct_mode = false\n"
     "disable = true\n"
+    "event_log = el\n"
+    "explain_misses = true\n"
     "extra_files_to_hash = efth\n"
     "file_clone = true\n"
+    "framed_results = true\n"
+    "git_index = true\n"
     "hard_link = true\n"
+    "hash_algorithm = xxh3\n"
     "hash_dir = false\n"
     "ignore_headers_in_manifest = ihim\n"
     "ignore_options = -a=* -b\n"
+    "ignore_warning_options = true\n"
+    "include_file_jobs = 32\n"
     "inode_cache = false\n"
+    "inode_cache_dir = icd\n"
+    "inode_cache_entries = 4711\n"
+    "inode_cache_immutable_dirs = /opt/sdk\n"
     "keep_comments_cpp = true\n"
+    "keep_identical_outputs = true\n"
     "limit_multiple = 0.0\n"
+    "log_buffer_size = 1.0M\n"
     "log_file = lf\n"
+    "lookup_timeout = 250\n"
+    "lower_cache_copy_up = true\n"
+    "lower_cache_dirs = /a:/b\n"
+    "maintenance_jobs = 3\n"
+    "max_compiler_jobs = 8\n"
+    "max_delta_chain = 3\n"
+    "max_failure_age = 7s\n"
     "max_files = 4711\n"
+    "max_link_size = 2.0M\n"
+    "max_manifest_entries = 17\n"
+    "max_manifest_entry_age = 30d\n"
     "max_size = 98.7M\n"
+    "memoize_compiler_check = true\n"
+    "memoize_path_lookup = true\n"
+    "namespace = ns\n"
+    "namespace_max_size = 2.0G\n"
+    "pack_max_file_size = 4k\n"
     "path = p\n"
     "pch_external_checksum = true\n"
+    "peer_timeout = 50\n"
+    "peers = a b:1\n"
+    "phase_durations = true\n"
     "prefix_command = pc\n"
     "prefix_command_cpp = pcc\n"
+    "presence_filter = true\n"
+    "raw_file_min_size = 1.5M\n"
     "read_only = true\n"
     "read_only_direct = true\n"
     "recache = true\n"
+    "recompress_low_priority = true\n"
+    "recompress_rate_limit = 1.0M\n"
+    "regenerate_depfiles = true\n"
     "run_second_cpp = false\n"
+    "secondary_storage = http://localhost:8080/cache\n"
+    "secondary_storage_miss_ttl = 30\n"
+    "secondary_storage_timeout = 700\n"
+    "session = job-42\n"
+    "shared_stats = true\n"
     "sloppiness = include_file_mtime, include_file_ctime, time_macros,"
     " file_stat_matches, file_stat_matches_ctime, pch_defines, system_headers,"
     " clang_index_store\n"
+    "speculative_compile_delay = 100\n"
+    "speculative_cpp = true\n"
+    "split_arch = true\n"
+    "split_source_jobs = 3\n"
+    "split_sources = true\n"
     "stats = false\n"
+    "stats_breakdown = compiler, directory\n"
+    "stream_compression = true\n"
+    "stripe_dirs = /a:/b\n"
+    "system_include_roots = /usr/include\n"
     "temporary_dir = td\n"
-    "umask = 022\n");
+    "trace_file = tf\n"
+    "trace_sample_rate = 0.5\n"
+    "trust_scrubbed_entries = true\n"
+    "umask = 022\n"
+    "write_behind = true\n");
 
   Config config;
   config.update_from_file("test.conf");
@@ -418,48 +733,119 @@ TEST_CASE("Config::visit_items")
 
   std::vector<std::string> expected = {
     "(test.conf) absolute_paths_in_stderr = true",
+    "(test.conf) adaptive_compression = true",
+    "(test.conf) admission_threshold = 2",
+    "(test.conf) auto_prefix_map = true",
+    "(test.conf) background_cleanup = true",
 #ifndef _WIN32
     "(test.conf) base_dir = /bd",
 #else
     "(test.conf) base_dir = C:/bd",
 #endif
+    "(test.conf) cache_compiler_queries = true",
     "(test.conf) cache_dir = cd",
+    "(test.conf) cache_failures = true",
+    "(test.conf) cache_links = true",
+    "(test.conf) cache_preprocessing = true",
+    "(test.conf) cleanup_policy = gdsf",
+    "(test.conf) cleanup_sample_size = 5",
+    "(test.conf) coalesce_timeout = 100",
+    "(test.conf) compile_servers = a b:1",
     "(test.conf) compiler = c",
     "(test.conf) compiler_check = cc",
     "(test.conf) compiler_type = clang",
     "(test.conf) compression = true",
     "(test.conf) compression_level = 8",
+    "(test.conf) compression_threads = 4",
+    "(test.conf) compression_type = lz4",
+    "(test.conf) config_snapshot = true",
     "(test.conf) cpp_extension = ce",
     "(test.conf) debug = false",
+    "(test.conf) deduplication = true",
+    "(test.conf) defer_mtime_updates = true",
     "(test.conf) depend_mode = true",
+    "(test.conf) digest_map = dm",
     "(test.conf) direct_mode = false",
     "(test.conf) disable = true",
+    "(test.conf) event_log = el",
+    "(test.conf) explain_misses = true",
     "(test.conf) extra_files_to_hash = efth",
     "(test.conf) file_clone = true",
+    "(test.conf) framed_results = true",
+    "(test.conf) git_index = true",
     "(test.conf) hard_link = true",
+    "(test.conf) hash_algorithm = xxh3",
     "(test.conf) hash_dir = false",
     "(test.conf) ignore_headers_in_manifest = ihim",
     "(test.conf) ignore_options = -a=* -b",
+    "(test.conf) ignore_warning_options = true",
+    "(test.conf) include_file_jobs = 32",
     "(test.conf) inode_cache = false",
+    "(test.conf) inode_cache_dir = icd",
+    "(test.conf) inode_cache_entries = 4711",
+    "(test.conf) inode_cache_immutable_dirs = /opt/sdk",
     "(test.conf) keep_comments_cpp = true",
+    "(test.conf) keep_identical_outputs = true",
     "(test.conf) limit_multiple = 0.0",
+    "(test.conf) log_buffer_size = 1.0M",
     "(test.conf) log_file = lf",
+    "(test.conf) lookup_timeout = 250",
+    "(test.conf) lower_cache_copy_up = true",
+    "(test.conf) lower_cache_dirs = /a:/b",
+    "(test.conf) maintenance_jobs = 3",
+    "(test.conf) max_compiler_jobs = 8",
+    "(test.conf) max_delta_chain = 3",
+    "(test.conf) max_failure_age = 7s",
     "(test.conf) max_files = 4711",
+    "(test.conf) max_link_size = 2.0M",
+    "(test.conf) max_manifest_entries = 17",
+    "(test.conf) max_manifest_entry_age = 2592000s",
     "(test.conf) max_size = 98.7M",
+    "(test.conf) memoize_compiler_check = true",
+    "(test.conf) memoize_path_lookup = true",
+    "(test.conf) namespace = ns",
+    "(test.conf) namespace_max_size = 2.0G",
+    "(test.conf) pack_max_file_size = 4000",
     "(test.conf) path = p",
     "(test.conf) pch_external_checksum = true",
+    "(test.conf) peer_timeout = 50",
+    "(test.conf) peers = a b:1",
+    "(test.conf) phase_durations = true",
     "(test.conf) prefix_command = pc",
     "(test.conf) prefix_command_cpp = pcc",
+    "(test.conf) presence_filter = true",
+    "(test.conf) raw_file_min_size = 1.5M",
     "(test.conf) read_only = true",
     "(test.conf) read_only_direct = true",
     "(test.conf) recache = true",
+    "(test.conf) recompress_low_priority = true",
+    "(test.conf) recompress_rate_limit = 1.0M",
+    "(test.conf) regenerate_depfiles = true",
     "(test.conf) run_second_cpp = false",
+    "(test.conf) secondary_storage = http://localhost:8080/cache",
+    "(test.conf) secondary_storage_miss_ttl = 30",
+    "(test.conf) secondary_storage_timeout = 700",
+    "(test.conf) session = job-42",
+    "(test.conf) shared_stats = true",
     "(test.conf) sloppiness = include_file_mtime, include_file_ctime,"
     " time_macros, pch_defines, file_stat_matches, file_stat_matches_ctime,"
     " system_headers, clang_index_store",
+    "(test.conf) speculative_compile_delay = 100",
+    "(test.conf) speculative_cpp = true",
+    "(test.conf) split_arch = true",
+    "(test.conf) split_source_jobs = 3",
+    "(test.conf) split_sources = true",
     "(test.conf) stats = false",
+    "(test.conf) stats_breakdown = compiler, directory",
+    "(test.conf) stream_compression = true",
+    "(test.conf) stripe_dirs = /a:/b",
+    "(test.conf) system_include_roots = /usr/include",
     "(test.conf) temporary_dir = td",
+    "(test.conf) trace_file = tf",
+    "(test.conf) trace_sample_rate = 0.5",
+    "(test.conf) trust_scrubbed_entries = true",
     "(test.conf) umask = 022",
+    "(test.conf) write_behind = true",
   };
 
   REQUIRE(received_items.size() == expected.size());
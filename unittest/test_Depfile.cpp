@@ -72,6 +72,36 @@ TEST_CASE("Depfile::rewrite_paths")
     REQUIRE(actual);
     CHECK(*actual == expected);
   }
+
+  SUBCASE("Whitespace and missing final newline preserved")
+  {
+    ctx.config.set_base_dir(cwd);
+    const auto actual =
+      Depfile::rewrite_paths(ctx, FMT("foo.o:\t{}/bar.h  baz.h", cwd));
+    REQUIRE(actual);
+    CHECK(*actual == "foo.o:\t./bar.h  baz.h");
+  }
+}
+
+TEST_CASE("Depfile::for_each_token")
+{
+  const std::string content = "cat.o: meow\\ purr \\\n  hiss$$ \\\\";
+  std::vector<std::string> tokens;
+  std::vector<bool> in_content;
+  Depfile::for_each_token(content, [&](nonstd::string_view token) {
+    tokens.emplace_back(token.data(), token.size());
+    in_content.push_back(token.data() >= content.data()
+                         && token.data() < content.data() + content.size());
+  });
+  REQUIRE(tokens.size() == 4);
+  CHECK(tokens[0] == "cat.o:");
+  CHECK(in_content[0]);
+  CHECK(tokens[1] == "meow purr");
+  CHECK(!in_content[1]);
+  CHECK(tokens[2] == "hiss$");
+  CHECK(!in_content[2]);
+  CHECK(tokens[3] == "\\");
+  CHECK(!in_content[3]);
 }
 
 TEST_CASE("Depfile::tokenize")
@@ -202,4 +232,33 @@ TEST_CASE("Depfile::tokenize")
   }
 }
 
+TEST_CASE("Depfile::generate")
+{
+  const std::vector<std::string> headers = {"cat.h", "my dog.h"};
+
+  CHECK(Depfile::generate("cat.o", "cat.c", {}, false) == "cat.o: cat.c\n");
+  CHECK(Depfile::generate("cat.o", "cat.c", headers, false)
+        == "cat.o: cat.c \\\n cat.h \\\n my\\ dog.h\n");
+  CHECK(Depfile::generate("cat.o", "cat.c", headers, true)
+        == "cat.o: cat.c \\\n cat.h \\\n my\\ dog.h\n"
+           "\ncat.h:\n"
+           "\nmy\\ dog.h:\n");
+}
+
+TEST_CASE("Depfile::is_equivalent")
+{
+  const std::string content = "cat.o: cat.c cat.h \\\n dog.h\n\ncat.h:\n";
+
+  CHECK(Depfile::is_equivalent(content, content));
+  CHECK(Depfile::is_equivalent(content,
+                               "cat.h:\ncat.o : cat.c \\\n dog.h cat.h\n"));
+  CHECK(!Depfile::is_equivalent(content, "cat.o: cat.c cat.h dog.h\n"));
+  CHECK(!Depfile::is_equivalent(content,
+                                "cat.o: cat.h cat.c dog.h\ncat.h:\n"));
+  CHECK(!Depfile::is_equivalent(content,
+                                "cat.o: cat.c cat.h\ndog.h\ncat.h:\n"));
+  CHECK(!Depfile::is_equivalent(content,
+                                "dog.o: cat.c cat.h dog.h\ncat.h:\n"));
+}
+
 TEST_SUITE_END();
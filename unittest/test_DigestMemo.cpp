@@ -0,0 +1,133 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Config.hpp"
+#include "../src/DigestMemo.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("DigestMemo");
+
+TEST_CASE("DigestMemo get and put")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  DigestMemo memo(config);
+
+  const Digest key = Hash().hash("key").digest();
+  const Digest value = Hash().hash("value").digest();
+
+  CHECK(!memo.get(key));
+
+  memo.put(key, value);
+  const auto memoized = memo.get(key);
+  REQUIRE(memoized);
+  CHECK(*memoized == value);
+  CHECK(!memo.get(Hash().hash("other key").digest()));
+
+  memo.clear();
+  CHECK(!memo.get(key));
+}
+
+TEST_CASE("DigestMemo get_data and put_data")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  DigestMemo memo(config);
+
+  const Digest key = Hash().hash("key").digest();
+
+  CHECK(!memo.get_data(key));
+
+  memo.put_data(key, "some\ndata");
+  const auto memoized = memo.get_data(key);
+  REQUIRE(memoized);
+  CHECK(*memoized == "some\ndata");
+  CHECK(!memo.get(key)); // Not a digest.
+}
+
+TEST_CASE("DigestMemo slots")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  DigestMemo memo(config);
+
+  // Keys that only differ after the digits selecting the slot.
+  Digest key1;
+  memset(key1.bytes(), 0, Digest::size());
+  Digest key2 = key1;
+  key2.bytes()[Digest::size() - 1] = 1;
+  const Digest value = Hash().hash("value").digest();
+
+  memo.put(key1, value);
+  CHECK(memo.get(key1));
+  CHECK(!memo.get(key2));
+
+  memo.put(key2, value);
+  CHECK(!memo.get(key1));
+  CHECK(memo.get(key2));
+  CHECK(Stat::stat("memo/000"));
+}
+
+TEST_CASE("DigestMemo::hash_file_identity")
+{
+  TestContext test_context;
+
+  Util::write_file("a", "a");
+
+  SUBCASE("new file")
+  {
+    Hash hash;
+    CHECK(!DigestMemo::hash_file_identity(hash, "a", Stat::stat("a")));
+  }
+
+  SUBCASE("old file")
+  {
+    struct utimbuf buf;
+    buf.actime = time(nullptr) - 10;
+    buf.modtime = buf.actime;
+    utime("a", &buf);
+
+    Hash hash1;
+    CHECK(DigestMemo::hash_file_identity(hash1, "a", Stat::stat("a")));
+
+    Hash hash2;
+    DigestMemo::hash_file_identity(hash2, "a", Stat::stat("a"));
+    CHECK(hash1.digest() == hash2.digest());
+
+    Util::write_file("a", "bb");
+    utime("a", &buf);
+    Hash hash3;
+    DigestMemo::hash_file_identity(hash3, "a", Stat::stat("a"));
+    CHECK(hash1.digest() != hash3.digest());
+  }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,64 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Digest.hpp"
+#include "../src/FileStorage.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("FileStorage");
+
+TEST_CASE("FileStorage::parse_url")
+{
+  CHECK(FileStorage::parse_url("file:/a/b") == "/a/b");
+  CHECK(FileStorage::parse_url("file:///a/b/") == "/a/b");
+  CHECK(FileStorage::parse_url("file:/") == "/");
+
+  CHECK(!FileStorage::parse_url(""));
+  CHECK(!FileStorage::parse_url("/a/b"));
+  CHECK(!FileStorage::parse_url("file:"));
+  CHECK(!FileStorage::parse_url("file:a/b"));
+  CHECK(!FileStorage::parse_url("file://host/a/b"));
+  CHECK(!FileStorage::parse_url("http://example.com"));
+}
+
+TEST_CASE("FileStorage get, put and remove")
+{
+  TestContext test_context;
+
+  FileStorage storage(Util::get_actual_cwd() + "/remote");
+  Digest name;
+
+  CHECK(!storage.get(name, "R"));
+  CHECK(storage.put(name, "R", "data"));
+  const auto digest = name.to_string();
+  CHECK(Stat::stat(FMT(
+    "remote/{}/{}/{}R", digest[0], digest[1], digest.substr(2))));
+  CHECK(storage.get(name, "R") == "data");
+  CHECK(!storage.get(name, "M"));
+  CHECK(storage.remove(name, "R"));
+  CHECK(!storage.get(name, "R"));
+}
+
+TEST_SUITE_END();
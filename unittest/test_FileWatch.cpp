@@ -0,0 +1,52 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/FileWatch.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("FileWatch");
+
+TEST_CASE("FileWatch::absolute_path")
+{
+  CHECK(*FileWatch::absolute_path("/a/b", "c.h") == "/a/b/c.h");
+  CHECK(*FileWatch::absolute_path("/a/b", "./c/d.h") == "/a/b/c/d.h");
+  CHECK(*FileWatch::absolute_path("/a/b", "../c.h") == "/a/c.h");
+  CHECK(*FileWatch::absolute_path("/a/b", "../../c.h") == "/c.h");
+  CHECK(*FileWatch::absolute_path("/a/b", "/x/y.h") == "/x/y.h");
+  CHECK(*FileWatch::absolute_path("/a", "../../c.h") == "/c.h");
+
+  CHECK(!FileWatch::absolute_path("/a/b", "c/../d.h"));
+  CHECK(!FileWatch::absolute_path("/a/b", "c/./d.h"));
+  CHECK(!FileWatch::absolute_path("/a/b", "c//d.h"));
+  CHECK(!FileWatch::absolute_path("/a/b", "/x/../y.h"));
+}
+
+TEST_CASE("FileWatch without watcher")
+{
+  TestContext test_context;
+
+  FileWatch file_watch(".");
+  CHECK(!file_watch);
+  CHECK(!file_watch.get("/a/b.h"));
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,80 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/FrequencySketch.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("FrequencySketch");
+
+#ifdef HAVE_SYS_MMAN_H
+
+TEST_CASE("Misses are counted and shared")
+{
+  TestContext test_context;
+
+  const Digest name1 = Hash().hash("name1").digest();
+  const Digest name2 = Hash().hash("name2").digest();
+
+  FrequencySketch writer("cache");
+  REQUIRE(writer);
+  CHECK(Stat::stat("cache/miss_frequencies"));
+  CHECK(writer.add(name1) == 1);
+  CHECK(writer.add(name1) == 2);
+
+  FrequencySketch reader("cache");
+  REQUIRE(reader);
+  CHECK(reader.add(name1) == 3);
+  CHECK(reader.add(name2) == 1);
+}
+
+TEST_CASE("Counters are halved after a window")
+{
+  TestContext test_context;
+
+  const Digest name = Hash().hash("name").digest();
+
+  FrequencySketch sketch("cache");
+  REQUIRE(sketch);
+  for (int i = 0; i < 4; ++i) {
+    sketch.add(name);
+  }
+
+  int overestimates = 0;
+  for (uint32_t i = 5; i < FrequencySketch::k_window; ++i) {
+    if (sketch.add(Hash().hash(FMT("other{}", i)).digest()) > 1) {
+      ++overestimates;
+    }
+  }
+  // The next miss ends the window.
+  CHECK(sketch.add(name) == 5);
+  CHECK(sketch.add(name) == 3);
+
+  // Most names are only estimated to have been missed once.
+  CHECK(overestimates < FrequencySketch::k_window / 20);
+}
+
+#endif // HAVE_SYS_MMAN_H
+
+TEST_SUITE_END();
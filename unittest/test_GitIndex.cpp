@@ -0,0 +1,155 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/GitIndex.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <string>
+#include <vector>
+
+using TestUtil::TestContext;
+
+namespace {
+
+void
+append_uint32(std::string& data, uint32_t value)
+{
+  uint8_t buffer[4];
+  Util::int_to_big_endian(value, buffer);
+  data.append(reinterpret_cast<const char*>(buffer), sizeof(buffer));
+}
+
+// Write a version 2 git index with entries for `paths`, using their current
+// stat data and a blob id consisting of the byte `i + 1` for entry i.
+void
+write_index(const std::vector<std::string>& paths)
+{
+  std::string data = "DIRC";
+  append_uint32(data, 2);
+  append_uint32(data, paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const auto st = Stat::stat(paths[i]);
+    const size_t start = data.size();
+    append_uint32(data, st.ctime());
+    append_uint32(data, 0);
+    append_uint32(data, st.mtime());
+    append_uint32(data, 0);
+    append_uint32(data, st.device());
+    append_uint32(data, st.inode());
+    append_uint32(data, 0100644);
+    append_uint32(data, 0);
+    append_uint32(data, 0);
+    append_uint32(data, st.size());
+    data.append(20, static_cast<char>(i + 1));
+    data.push_back(0);
+    data.push_back(static_cast<char>(paths[i].size()));
+    data += paths[i];
+    do {
+      data.push_back(0);
+    } while ((data.size() - start) % 8 != 0);
+  }
+  data.append(20, 0); // Checksum, not verified.
+  Util::write_file(".git/index", data);
+}
+
+void
+set_mtime(const std::string& path, time_t mtime)
+{
+  struct utimbuf buf;
+  buf.actime = mtime;
+  buf.modtime = mtime;
+  utime(path.c_str(), &buf);
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("GitIndex");
+
+TEST_CASE("GitIndex::blob_id")
+{
+  TestContext test_context;
+
+  Util::create_dir(".git");
+  Util::create_dir("dir");
+  Util::write_file("a", "a");
+  Util::write_file("dir/b", "bb");
+  Util::write_file("new", "new");
+  set_mtime("a", time(nullptr) - 10);
+  set_mtime("dir/b", time(nullptr) - 10);
+  // Not older than the index, so the entry may be stale.
+  set_mtime("new", time(nullptr) + 10);
+  write_index({"a", "dir/b", "new"});
+
+  const auto cwd = Util::get_actual_cwd();
+
+  SUBCASE("up-to-date entries")
+  {
+    GitIndex index(cwd);
+    CHECK(index.blob_id("a", Stat::stat("a"))
+          == "0101010101010101010101010101010101010101");
+    CHECK(index.blob_id(FMT("{}/dir/b", cwd), Stat::stat("dir/b"))
+          == "0202020202020202020202020202020202020202");
+  }
+
+  SUBCASE("from subdirectory")
+  {
+    GitIndex index(FMT("{}/dir", cwd));
+    CHECK(index.blob_id("b", Stat::stat("dir/b"))
+          == "0202020202020202020202020202020202020202");
+    CHECK(index.blob_id("../a", Stat::stat("a"))
+          == "0101010101010101010101010101010101010101");
+  }
+
+  SUBCASE("modified file")
+  {
+    Util::write_file("a", "aa");
+    set_mtime("a", time(nullptr) - 10);
+    GitIndex index(cwd);
+    CHECK(!index.blob_id("a", Stat::stat("a")));
+  }
+
+  SUBCASE("file modified after the index")
+  {
+    GitIndex index(cwd);
+    CHECK(!index.blob_id("new", Stat::stat("new")));
+  }
+
+  SUBCASE("untracked file")
+  {
+    Util::write_file("c", "c");
+    set_mtime("c", time(nullptr) - 10);
+    GitIndex index(cwd);
+    CHECK(!index.blob_id("c", Stat::stat("c")));
+  }
+}
+
+TEST_CASE("GitIndex without repository")
+{
+  TestContext test_context;
+
+  Util::write_file("a", "a");
+  GitIndex index(Util::get_actual_cwd());
+  CHECK(!index.blob_id("a", Stat::stat("a")));
+}
+
+TEST_SUITE_END();
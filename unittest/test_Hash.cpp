@@ -20,6 +20,9 @@
 
 #include "third_party/doctest.h"
 
+#include <cstring>
+#include <thread>
+
 TEST_SUITE_BEGIN("Hash");
 
 TEST_CASE("known strings")
@@ -73,6 +76,140 @@ TEST_CASE("Hash::digest should be idempotent")
   CHECK(h.digest().to_string() == "af1396svbud1kqg40jfa6reciicrpcisi");
 }
 
+TEST_CASE("Large buffers give the same digest as small pieces")
+{
+  std::string data(20 * 1024 * 1024 + 123, '\0');
+  uint32_t state = 1;
+  for (auto& c : data) {
+    state = state * 1103515245 + 12345;
+    c = static_cast<char>(state >> 16);
+  }
+
+  Hash whole;
+  whole.hash("prefix");
+  whole.hash(data);
+
+  Hash pieces;
+  pieces.hash("prefix");
+  for (size_t i = 0; i < data.size(); i += 65536) {
+    pieces.hash(data.substr(i, 65536));
+  }
+
+  CHECK(whole.digest() == pieces.digest());
+}
+
+TEST_CASE("blake3_hasher_update_join")
+{
+  std::string data(5 * BLAKE3_MIN_JOIN_LEN + 4567, 'x');
+  for (size_t i = 0; i < data.size(); i += 1000) {
+    data[i] = static_cast<char>(i);
+  }
+
+  blake3_hasher sequential;
+  blake3_hasher_init(&sequential);
+  blake3_hasher_update(&sequential, "prefix", 6);
+  blake3_hasher_update(&sequential, data.data(), data.size());
+
+  size_t joins = 0;
+  blake3_joiner joiner;
+  joiner.context = &joins;
+  joiner.join =
+    [](void* context, void (*task)(void*), void* left, void* right) {
+      ++*static_cast<size_t*>(context);
+      std::thread thread(task, left);
+      task(right);
+      thread.join();
+    };
+  blake3_hasher joined;
+  blake3_hasher_init(&joined);
+  blake3_hasher_update(&joined, "prefix", 6);
+  blake3_hasher_update_join(&joined, data.data(), data.size(), &joiner);
+
+  uint8_t expected[BLAKE3_OUT_LEN];
+  uint8_t actual[BLAKE3_OUT_LEN];
+  blake3_hasher_finalize(&sequential, expected, sizeof(expected));
+  blake3_hasher_finalize(&joined, actual, sizeof(actual));
+  CHECK(joins > 0);
+  CHECK(memcmp(actual, expected, sizeof(expected)) == 0);
+}
+
+TEST_CASE("XXH3")
+{
+  const auto hex = [](const Digest& digest) {
+    return Util::format_base16(digest.bytes(), Digest::size());
+  };
+
+  // XXH3-128 of the empty string followed by "xxh3".
+  CHECK(hex(Hash(Hash::Algorithm::xxh3).digest())
+        == "99aa06d3014798d86001c324468d497f78786833");
+
+  Hash hash(Hash::Algorithm::xxh3);
+  hash.hash("message");
+  Hash copy = hash;
+  hash.hash(" digest");
+  CHECK(hash.digest() != copy.digest());
+  copy.hash(" digest");
+  CHECK(hash.digest() == copy.digest());
+  CHECK(hash.digest() != Hash().hash("message digest").digest());
+
+  const Hash::Algorithm default_algorithm = Hash::default_algorithm();
+  Hash::set_default_algorithm(Hash::Algorithm::xxh3);
+  CHECK(Hash().hash("message digest").digest() == hash.digest());
+  Hash::set_default_algorithm(default_algorithm);
+}
+
+TEST_CASE("Hash::state")
+{
+  for (const auto algorithm :
+       {Hash::Algorithm::blake3, Hash::Algorithm::xxh3}) {
+    Hash hash(algorithm);
+    hash.hash("message");
+
+    Hash restored(algorithm);
+    restored.hash("something else");
+    REQUIRE(restored.set_state(hash.state()));
+    hash.hash(" digest");
+    restored.hash(" digest");
+    CHECK(restored.digest() == hash.digest());
+  }
+
+  Hash blake3(Hash::Algorithm::blake3);
+  Hash xxh3(Hash::Algorithm::xxh3);
+  CHECK(!blake3.set_state(xxh3.state()));
+  CHECK(!blake3.set_state(""));
+  CHECK(!blake3.set_state(blake3.state().substr(1)));
+}
+
+TEST_CASE("Hash::sections")
+{
+  Hash hash;
+  hash.enable_sections();
+  hash.hash_delimiter("arg").hash("-O2");
+  hash.hash_delimiter("number").hash(42);
+  hash.hash_delimiter("long").hash(std::string(1000, 'x'));
+
+  Hash other;
+  other.enable_sections();
+  other.hash_delimiter("arg").hash("-O3");
+
+  const auto sections = hash.sections();
+  REQUIRE(sections.size() == 4);
+  CHECK(sections[0].name == "");
+  CHECK(sections[1].name == "arg");
+  CHECK(sections[1].text == "-O2");
+  CHECK(sections[1].digest != other.sections()[1].digest);
+  CHECK(sections[2].name == "number");
+  CHECK(sections[2].text == "42");
+  CHECK(sections[3].name == "long");
+  CHECK(sections[3].text == "");
+
+  // Copies continue recording independently.
+  Hash copy = hash;
+  copy.hash_delimiter("extra");
+  CHECK(copy.sections().size() == 5);
+  CHECK(hash.sections().size() == 4);
+}
+
 TEST_CASE("Digest::bytes")
 {
   Digest d = Hash().hash("message digest").digest();
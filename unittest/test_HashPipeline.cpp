@@ -0,0 +1,57 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Hash.hpp"
+#include "../src/HashPipeline.hpp"
+
+#include "third_party/doctest.h"
+
+#include <algorithm>
+#include <string>
+
+TEST_SUITE_BEGIN("HashPipeline");
+
+TEST_CASE("HashPipeline")
+{
+  std::string data;
+  for (size_t i = 0; i < 100000; ++i) {
+    data += std::to_string(i);
+  }
+
+  Hash expected;
+  for (size_t i = 0; i < data.size(); i += 1000) {
+    expected.hash(data.substr(i, 1000));
+    expected.hash("path");
+  }
+
+  for (bool threaded : {false, true}) {
+    Hash hash;
+    {
+      HashPipeline pipeline(hash, threaded);
+      for (size_t i = 0; i < data.size(); i += 1000) {
+        pipeline.hash(data.data() + i, std::min<size_t>(1000, data.size() - i));
+        pipeline.hash(std::string("path"));
+      }
+      pipeline.finish();
+      CHECK(hash.digest() == expected.digest());
+    }
+    CHECK(hash.digest() == expected.digest());
+  }
+}
+
+TEST_SUITE_END();
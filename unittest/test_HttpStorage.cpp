@@ -0,0 +1,116 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/HttpStorage.hpp"
+
+#include "third_party/doctest.h"
+
+TEST_SUITE_BEGIN("HttpStorage");
+
+TEST_CASE("HttpStorage::parse_url")
+{
+  SUBCASE("host only")
+  {
+    const auto url = HttpStorage::parse_url("http://example.com");
+    REQUIRE(url);
+    CHECK(url->host == "example.com");
+    CHECK(url->port == "80");
+    CHECK(url->path == "");
+  }
+
+  SUBCASE("host, port and path")
+  {
+    const auto url = HttpStorage::parse_url("http://localhost:8080/a/b/");
+    REQUIRE(url);
+    CHECK(url->host == "localhost");
+    CHECK(url->port == "8080");
+    CHECK(url->path == "/a/b");
+  }
+
+  SUBCASE("IPv6 address")
+  {
+    const auto url = HttpStorage::parse_url("http://[::1]:81/cache");
+    REQUIRE(url);
+    CHECK(url->host == "::1");
+    CHECK(url->port == "81");
+    CHECK(url->path == "/cache");
+  }
+
+  SUBCASE("invalid")
+  {
+    CHECK(!HttpStorage::parse_url(""));
+    CHECK(!HttpStorage::parse_url("https://example.com"));
+    CHECK(!HttpStorage::parse_url("http://"));
+    CHECK(!HttpStorage::parse_url("http://:80/"));
+    CHECK(!HttpStorage::parse_url("http://example.com:0"));
+    CHECK(!HttpStorage::parse_url("http://example.com:x"));
+    CHECK(!HttpStorage::parse_url("http://[::1"));
+  }
+}
+
+TEST_CASE("HttpStorage::parse_response")
+{
+  SUBCASE("content length")
+  {
+    const auto response = HttpStorage::parse_response(
+      "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nabcdef");
+    REQUIRE(response);
+    CHECK(response->status == 200);
+    CHECK(response->body == "abc");
+  }
+
+  SUBCASE("truncated body")
+  {
+    CHECK(!HttpStorage::parse_response(
+      "HTTP/1.1 200 OK\r\ncontent-length: 4\r\n\r\nabc"));
+  }
+
+  SUBCASE("body until end of data")
+  {
+    const auto response =
+      HttpStorage::parse_response("HTTP/1.0 404 Not Found\r\n\r\nnope");
+    REQUIRE(response);
+    CHECK(response->status == 404);
+    CHECK(response->body == "nope");
+  }
+
+  SUBCASE("chunked")
+  {
+    const auto response = HttpStorage::parse_response(
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "3\r\nabc\r\na;ext=1\r\n0123456789\r\n0\r\n\r\n");
+    REQUIRE(response);
+    CHECK(response->body == "abc0123456789");
+  }
+
+  SUBCASE("truncated chunk")
+  {
+    CHECK(!HttpStorage::parse_response(
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nabc"));
+  }
+
+  SUBCASE("malformed")
+  {
+    CHECK(!HttpStorage::parse_response(""));
+    CHECK(!HttpStorage::parse_response("HTTP/1.1 200 OK\r\n"));
+    CHECK(!HttpStorage::parse_response("FOO 200 OK\r\n\r\n"));
+    CHECK(!HttpStorage::parse_response("HTTP/1.1 abc\r\n\r\n"));
+  }
+}
+
+TEST_SUITE_END();
@@ -21,6 +21,7 @@
 #include "../src/Hash.hpp"
 #include "../src/InodeCache.hpp"
 #include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
@@ -116,21 +117,26 @@ TEST_CASE("Test put and lookup")
 
   Util::write_file("a", "something else");
 
-  CHECK(!ctx.inode_cache.get(
+  // Stat results are cached for the lifetime of a context, so use a new one to
+  // see the modified file.
+  Context ctx2;
+  init(ctx2);
+
+  CHECK(!ctx2.inode_cache.get(
     "a", InodeCache::ContentType::code, digest, &return_value));
-  CHECK(ctx.inode_cache.get_hits() == 1);
-  CHECK(ctx.inode_cache.get_misses() == 1);
-  CHECK(ctx.inode_cache.get_errors() == 0);
+  CHECK(ctx2.inode_cache.get_hits() == 1);
+  CHECK(ctx2.inode_cache.get_misses() == 1);
+  CHECK(ctx2.inode_cache.get_errors() == 0);
 
-  CHECK(put(ctx, "a", "something else", 2));
+  CHECK(put(ctx2, "a", "something else", 2));
 
-  CHECK(ctx.inode_cache.get(
+  CHECK(ctx2.inode_cache.get(
     "a", InodeCache::ContentType::code, digest, &return_value));
   CHECK(digest == Hash().hash("something else").digest());
   CHECK(return_value == 2);
-  CHECK(ctx.inode_cache.get_hits() == 2);
-  CHECK(ctx.inode_cache.get_misses() == 1);
-  CHECK(ctx.inode_cache.get_errors() == 0);
+  CHECK(ctx2.inode_cache.get_hits() == 2);
+  CHECK(ctx2.inode_cache.get_misses() == 1);
+  CHECK(ctx2.inode_cache.get_errors() == 0);
 }
 
 TEST_CASE("Drop file")
@@ -149,6 +155,64 @@ TEST_CASE("Drop file")
   CHECK(!ctx.inode_cache.drop());
 }
 
+TEST_CASE("Inode cache directory")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_dir("inode-cache-dir");
+
+  CHECK(Util::starts_with(ctx.inode_cache.get_file(), "inode-cache-dir/"));
+
+  Digest digest;
+  ctx.inode_cache.get("a", InodeCache::ContentType::binary, digest);
+  CHECK(Stat::stat(ctx.inode_cache.get_file()));
+}
+
+TEST_CASE("Immutable directories")
+{
+  TestContext test_context;
+
+  Util::create_dir("sdk");
+  struct utimbuf buf;
+  buf.actime = time(nullptr) - 10;
+  buf.modtime = buf.actime;
+
+  // Simulate that the files are recreated with the same content and mtime,
+  // like when a new container is created from an image.
+  const auto recreate = [&](const std::string& path) {
+    Util::write_file(path + ".new", "text");
+    utime((path + ".new").c_str(), &buf);
+    Util::rename(path + ".new", path);
+  };
+  recreate("sdk/a");
+  recreate("b");
+
+  const auto sdk_a = FMT("{}/sdk/a", Util::get_actual_cwd());
+  const auto b = FMT("{}/b", Util::get_actual_cwd());
+  {
+    Context ctx;
+    init(ctx);
+    ctx.config.set_inode_cache_immutable_dirs(
+      FMT("{}/sdk", Util::get_actual_cwd()));
+    CHECK(put(ctx, sdk_a, "text", 1));
+    CHECK(put(ctx, b, "text", 1));
+  }
+
+  recreate("sdk/a");
+  recreate("b");
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_immutable_dirs(
+    FMT("{}/sdk", Util::get_actual_cwd()));
+  Digest digest;
+  CHECK(ctx.inode_cache.get(sdk_a, InodeCache::ContentType::code, digest));
+  CHECK(digest == Hash().hash("text").digest());
+  CHECK(!ctx.inode_cache.get(b, InodeCache::ContentType::code, digest));
+}
+
 TEST_CASE("Test content type")
 {
   TestContext test_context;
@@ -194,4 +258,77 @@ TEST_CASE("Test content type")
   CHECK(return_value == 3);
 }
 
+TEST_CASE("Lookup makes entry most recently used")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_entries(4); // A single bucket.
+  ctx.inode_cache.drop();
+
+  for (const char* name : {"a", "b", "c", "d"}) {
+    Util::write_file(name, name);
+    CHECK(put(ctx, name, name, 0));
+  }
+
+  Digest digest;
+  CHECK(ctx.inode_cache.get("a", InodeCache::ContentType::code, digest));
+
+  Util::write_file("e", "e");
+  CHECK(put(ctx, "e", "e", 0));
+
+  CHECK(ctx.inode_cache.get("a", InodeCache::ContentType::code, digest));
+  CHECK(digest == Hash().hash("a").digest());
+  CHECK(!ctx.inode_cache.get("b", InodeCache::ContentType::code, digest));
+}
+
+TEST_CASE("Eviction and growth")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_entries(4); // A single bucket.
+  ctx.inode_cache.drop();
+
+  for (const char* name : {"a", "b", "c", "d", "e"}) {
+    Util::write_file(name, name);
+    CHECK(put(ctx, name, name, 0));
+  }
+  CHECK(ctx.inode_cache.get_capacity() == 4);
+  CHECK(ctx.inode_cache.get_occupancy() == 4);
+  CHECK(ctx.inode_cache.get_evictions() == 1);
+
+  // Putting an existing entry again replaces it.
+  CHECK(put(ctx, "e", "e", 1));
+  CHECK(ctx.inode_cache.get_occupancy() == 4);
+  CHECK(ctx.inode_cache.get_evictions() == 1);
+
+  Context ctx2;
+  init(ctx2);
+  ctx2.config.set_inode_cache_entries(100);
+
+  CHECK(ctx2.inode_cache.get_capacity() == 128);
+  CHECK(ctx2.inode_cache.get_occupancy() == 4);
+  CHECK(ctx2.inode_cache.get_evictions() == 1);
+
+  Digest digest;
+  int return_value;
+  CHECK(!ctx2.inode_cache.get(
+    "a", InodeCache::ContentType::code, digest, &return_value));
+  for (const char* name : {"b", "c", "d", "e"}) {
+    CHECK(ctx2.inode_cache.get(
+      name, InodeCache::ContentType::code, digest, &return_value));
+    CHECK(digest == Hash().hash(name).digest());
+  }
+  CHECK(return_value == 1);
+
+  // An existing larger cache is not shrunk.
+  Context ctx3;
+  init(ctx3);
+  ctx3.config.set_inode_cache_entries(4);
+  CHECK(ctx3.inode_cache.get_capacity() == 128);
+}
+
 TEST_SUITE_END();
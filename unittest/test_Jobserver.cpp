@@ -0,0 +1,39 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Jobserver.hpp"
+
+#include "third_party/doctest.h"
+
+TEST_SUITE_BEGIN("Jobserver");
+
+TEST_CASE("Jobserver::parse_auth")
+{
+  CHECK(!Jobserver::parse_auth(""));
+  CHECK(!Jobserver::parse_auth("k -j8"));
+  CHECK(*Jobserver::parse_auth(" -j8 --jobserver-auth=3,4") == "3,4");
+  CHECK(*Jobserver::parse_auth("--jobserver-fds=5,6 -j") == "5,6");
+  CHECK(*Jobserver::parse_auth("-j4 --jobserver-auth=fifo:/tmp/GMfifo1")
+        == "fifo:/tmp/GMfifo1");
+
+  // Recursive make appends its own jobserver option.
+  CHECK(*Jobserver::parse_auth("--jobserver-auth=3,4 --jobserver-auth=7,8")
+        == "7,8");
+}
+
+TEST_SUITE_END();
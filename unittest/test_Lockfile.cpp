@@ -18,10 +18,15 @@
 
 #include "../src/Lockfile.hpp"
 #include "../src/Stat.hpp"
+#include "../src/Util.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 TEST_SUITE_BEGIN("LockFile");
 
 using TestUtil::TestContext;
@@ -55,6 +60,47 @@ TEST_CASE("Lockfile breaking")
   Lockfile lock("test", 1000);
   CHECK(lock.acquired());
 }
+
+TEST_CASE("Contended lock is acquired when released")
+{
+  TestContext test_context;
+
+  std::atomic<bool> released(false);
+  std::thread holder;
+  {
+    Lockfile lock("test", 1000);
+    REQUIRE(lock.acquired());
+    holder = std::thread([&] {
+      Lockfile other_lock("test", 10000000);
+      CHECK(other_lock.acquired());
+      CHECK(released);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    released = true;
+  }
+  holder.join();
+}
+
+TEST_CASE("Locks of paths in the same directory are independent")
+{
+  TestContext test_context;
+
+  Lockfile lock_1("test1", 1000000, 5000);
+  Lockfile lock_2("test2", 1000000, 5000);
+  CHECK(lock_1.acquired());
+  CHECK(lock_2.acquired());
+}
+
+TEST_CASE("Lockfile timeout")
+{
+  TestContext test_context;
+
+  CHECK(symlink("foo", "test.lock") == 0);
+
+  Lockfile lock("test", 1000000, 5000);
+  CHECK(!lock.acquired());
+  CHECK(Util::read_link("test.lock") == "foo");
+}
 #endif // !_WIN32
 
 TEST_SUITE_END();
@@ -0,0 +1,158 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/LruIndex.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("LruIndex");
+
+TEST_CASE("LruIndex::name_from_path")
+{
+  CHECK(LruIndex::name_from_path("/c", "/c/a/b/cdefR") == "abcdefR");
+  CHECK(LruIndex::name_from_path("/c", "/c/a/bcdefR") == "abcdefR");
+  CHECK(LruIndex::name_from_path("/c", "/cd/a/bcdefR") == "");
+  CHECK(LruIndex::name_from_path("/c", "/c/") == "");
+}
+
+TEST_CASE("Records are only appended to an existing index")
+{
+  TestContext test_context;
+
+  Util::ensure_dir_exists("a/b");
+  LruIndex::record_store(".", "./a/b/cdR", 4096);
+
+  LruIndex index("a");
+  CHECK(!index.load());
+
+  index.save();
+  REQUIRE(index.load());
+  CHECK(index.entries().empty());
+
+  LruIndex::record_store(".", "./a/b/cdR", 4096);
+  LruIndex::record_store(".", "./a/b/efR", 8192);
+  LruIndex::record_use(".", "./a/b/cdR");
+  LruIndex::record_use(".", "./a/b/unknownR");
+  REQUIRE(index.load());
+  REQUIRE(index.entries().size() == 2);
+  CHECK(index.entries()["abcdR"].size == 4096);
+  CHECK(index.entries()["abefR"].size == 8192);
+}
+
+TEST_CASE("Saving picks up records appended since loading")
+{
+  TestContext test_context;
+
+  Util::ensure_dir_exists("a/b");
+  LruIndex index("a");
+  auto& entry = index.entries()["abcdR"];
+  entry.time = 1;
+  entry.size = 4096;
+  index.save();
+
+  REQUIRE(index.load());
+  LruIndex::record_store(".", "./a/b/efR", 8192);
+  LruIndex::record_use(".", "./a/b/cdR");
+  index.entries().erase("abcdR");
+  index.save();
+
+  REQUIRE(index.load());
+  REQUIRE(index.entries().size() == 1);
+  CHECK(index.entries()["abefR"].size == 8192);
+}
+
+TEST_CASE("Costs, hits, inflation and namespace tags are kept")
+{
+  TestContext test_context;
+
+  Util::ensure_dir_exists("a/b");
+  LruIndex index("a");
+  index.set_inflation(0.5);
+  index.save();
+
+  REQUIRE(index.load());
+  LruIndex::record_store(".", "./a/b/cdR", 4096, 1000, "ns");
+  LruIndex::record_store(".", "./a/b/efR", 4096);
+  LruIndex::record_use(".", "./a/b/cdR");
+  REQUIRE(index.load());
+  CHECK(index.inflation() == 0.5);
+  auto entry = index.entries()["abcdR"];
+  CHECK(entry.cost == 1000);
+  CHECK(entry.hits == 1);
+  CHECK(entry.inflation == 0.5);
+  CHECK(entry.namespace_tag == "ns");
+  CHECK(entry.priority(4096) == 0.5 + 2 * 1000 / 4.0);
+  CHECK(index.entries()["abefR"].namespace_tag.empty());
+
+  index.set_inflation(2);
+  index.save();
+  REQUIRE(index.load());
+  CHECK(index.inflation() == 2);
+  entry = index.entries()["abcdR"];
+  CHECK(entry.cost == 1000);
+  CHECK(entry.hits == 1);
+  CHECK(entry.inflation == 0.5);
+  CHECK(entry.namespace_tag == "ns");
+  CHECK(index.entries()["abefR"].namespace_tag.empty());
+}
+
+TEST_CASE("File sizes are kept")
+{
+  TestContext test_context;
+
+  Util::ensure_dir_exists("a/b");
+  LruIndex index("a");
+  index.save();
+
+  Util::write_file("a/b/cdR", "not a result");
+  LruIndex::record_store(".", "./a/b/cdR", 4096);
+  LruIndex::record_store(".", "./a/b/efR", 4096);
+  REQUIRE(index.load());
+  CHECK(index.entries()["abcdR"].file_size == 12);
+  CHECK(index.entries()["abcdR"].content_size == 0);
+  CHECK(index.entries()["abefR"].file_size == 0);
+
+  index.entries()["abcdR"].content_size = 100;
+  index.save();
+  REQUIRE(index.load());
+  CHECK(index.entries()["abcdR"].file_size == 12);
+  CHECK(index.entries()["abcdR"].content_size == 100);
+
+  // Records without sizes.
+  Util::write_file("a/lru",
+                   "ccache lru index 2 1048576 0\n"
+                   "1 4096 2 3 4 - abcdR\n");
+  REQUIRE(index.load());
+  CHECK(index.entries()["abcdR"].file_size == 0);
+  CHECK(index.entries()["abcdR"].hits == 3);
+}
+
+TEST_CASE("Invalid index")
+{
+  TestContext test_context;
+
+  Util::ensure_dir_exists("a");
+  Util::write_file("a/lru", "1 2 abcR\n");
+  CHECK(!LruIndex("a").load());
+}
+
+TEST_SUITE_END();
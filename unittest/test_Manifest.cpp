@@ -0,0 +1,175 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CacheEntryReader.hpp"
+#include "../src/CacheEntryWriter.hpp"
+#include "../src/Config.hpp"
+#include "../src/Digest.hpp"
+#include "../src/File.hpp"
+#include "../src/Manifest.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <string>
+
+using TestUtil::TestContext;
+
+namespace {
+
+template<typename T>
+void
+append_int(std::string& buffer, T value)
+{
+  uint8_t bytes[sizeof(T)];
+  Util::int_to_big_endian(value, bytes);
+  buffer.append(reinterpret_cast<const char*>(bytes), sizeof(T));
+}
+
+// Write a manifest with one result entry for one include file in the format of
+// version 2, which lacks the offset tables and the last use time of result
+// entries.
+void
+write_version_2_manifest(const std::string& path,
+                         uint32_t path_index = 0,
+                         uint32_t include_index = 0)
+{
+  Digest digest;
+  memset(digest.bytes(), 0x12, Digest::size());
+
+  std::string body;
+  append_int<uint32_t>(body, 1); // n_paths
+  append_int<uint16_t>(body, 3); // path_len
+  body += "a.h";
+  append_int<uint32_t>(body, 1); // n_includes
+  append_int<uint32_t>(body, path_index);
+  body.append(reinterpret_cast<const char*>(digest.bytes()), Digest::size());
+  append_int<uint64_t>(body, 3); // fsize
+  append_int<int64_t>(body, -1); // mtime
+  append_int<int64_t>(body, -1); // ctime
+  append_int<uint32_t>(body, 1); // n_results
+  append_int<uint32_t>(body, 1); // n_indexes
+  append_int<uint32_t>(body, include_index);
+  body.append(reinterpret_cast<const char*>(digest.bytes()), Digest::size());
+
+  File file(path, "wb");
+  CacheEntryWriter writer(file.get(),
+                          Manifest::k_magic,
+                          2,
+                          Compression::Type::none,
+                          0,
+                          body.size());
+  writer.write(body.data(), body.size());
+  writer.finalize();
+}
+
+std::string
+dump(const std::string& path)
+{
+  {
+    File file("dump", "w");
+    Manifest::dump(path, file.get());
+  }
+  return Util::read_file("dump");
+}
+
+uint8_t
+version(const std::string& path)
+{
+  File file(path, "rb");
+  return CacheEntryReader::peek_version(file.get());
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("Manifest");
+
+TEST_CASE("Manifest::upgrade")
+{
+  TestContext test_context;
+
+  Config config;
+  write_version_2_manifest("test.M");
+  const auto mtime = Stat::stat("test.M").mtime();
+
+  const auto old_dump = dump("test.M");
+  CHECK(old_dump.find("0: a.h\n") != std::string::npos);
+  CHECK(old_dump.find(FMT("Last used: {}\n", mtime)) != std::string::npos);
+
+  CHECK(Manifest::upgrade(config, "test.M"));
+  CHECK(version("test.M") == Manifest::k_version);
+  const auto new_dump = dump("test.M");
+  CHECK(new_dump.substr(new_dump.find("File paths"))
+        == old_dump.substr(old_dump.find("File paths")));
+
+  CHECK(!Manifest::upgrade(config, "test.M"));
+  CHECK(!Manifest::upgrade(config, "missing.M"));
+}
+
+TEST_CASE("Manifest::upgrade of truncated manifest")
+{
+  TestContext test_context;
+
+  Config config;
+  write_version_2_manifest("test.M");
+  std::string data = Util::read_file("test.M");
+  // Drop the last byte of the result name and fix up the content size and
+  // checksum by writing the body again.
+  const uint64_t header_size = 4 + 1 + 1 + 1 + 8;
+  const std::string body =
+    data.substr(header_size, data.size() - header_size - 8 - 1);
+  {
+    File file("test.M", "wb");
+    CacheEntryWriter writer(file.get(),
+                            Manifest::k_magic,
+                            2,
+                            Compression::Type::none,
+                            0,
+                            body.size());
+    writer.write(body.data(), body.size());
+    writer.finalize();
+  }
+  CHECK_THROWS_WITH(Manifest::upgrade(config, "test.M"),
+                    "Truncated body in manifest");
+}
+
+TEST_CASE("Manifest::upgrade with bad indexes")
+{
+  TestContext test_context;
+
+  Config config;
+
+  SUBCASE("Bad path index")
+  {
+    write_version_2_manifest("test.M", 1, 0);
+    CHECK_THROWS_WITH(Manifest::upgrade(config, "test.M"),
+                      "Bad path index 1 in manifest");
+  }
+
+  SUBCASE("Bad file info index")
+  {
+    write_version_2_manifest("test.M", 0, 1);
+    CHECK_THROWS_WITH(Manifest::upgrade(config, "test.M"),
+                      "Bad file info index 1 in manifest");
+  }
+}
+
+TEST_SUITE_END();
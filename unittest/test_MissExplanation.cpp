@@ -0,0 +1,76 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/MissExplanation.hpp"
+
+#include "third_party/doctest.h"
+
+using MissExplanation::compare;
+using MissExplanation::parse;
+
+TEST_SUITE_BEGIN("MissExplanation");
+
+TEST_CASE("MissExplanation::parse")
+{
+  const auto components = parse("arg\tabc\t-O2\ninclude file /a.h\tdef\t\nbad\n");
+  REQUIRE(components.size() == 2);
+  CHECK(components[0].name == "arg");
+  CHECK(components[0].digest == "abc");
+  CHECK(components[0].text == "-O2");
+  CHECK(components[1].name == "include file /a.h");
+  CHECK(components[1].digest == "def");
+  CHECK(components[1].text == "");
+}
+
+TEST_CASE("MissExplanation::compare")
+{
+  const auto before = parse(
+    "cwd\t1\t/src\n"
+    "arg\t2\t-c\n"
+    "arg\t3\t-O2\n"
+    "arg\t4\t-g\n"
+    "cpp\t5\t\n"
+    "include file /a.h\t6\t\n"
+    "include file /b.h\t7\t\n");
+
+  SUBCASE("identical")
+  {
+    CHECK(compare(before, before).empty());
+  }
+
+  SUBCASE("changed, added and removed")
+  {
+    const auto after = parse(
+      "cwd\t1\t/src\n"
+      "arg\t2\t-c\n"
+      "arg\t8\t-O3\n"
+      "arg\t9\t-DFOO\n"
+      "arg\t4\t-g\n"
+      "cpp\ta\t\n"
+      "include file /b.h\tb\t\n");
+    const auto differences = compare(before, after);
+    REQUIRE(differences.size() == 5);
+    CHECK(differences[0] == "arg changed: -O2 -> -O3");
+    CHECK(differences[1] == "arg added: -DFOO");
+    CHECK(differences[2] == "cpp changed");
+    CHECK(differences[3] == "include file /a.h removed");
+    CHECK(differences[4] == "include file /b.h changed");
+  }
+}
+
+TEST_SUITE_END();
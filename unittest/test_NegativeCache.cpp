@@ -0,0 +1,62 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Hash.hpp"
+#include "../src/NegativeCache.hpp"
+#include "../src/Stat.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("NegativeCache");
+
+#ifdef HAVE_SYS_MMAN_H
+
+TEST_CASE("Misses expire and are shared")
+{
+  TestContext test_context;
+
+  const Digest name1 = Hash().hash("name1").digest();
+  const Digest name2 = Hash().hash("name2").digest();
+
+  NegativeCache writer("cache");
+  REQUIRE(writer);
+  CHECK(Stat::stat("cache/secondary_misses"));
+  CHECK(!writer.is_missing(name1, "M", 1000));
+
+  writer.add(name1, "M", 1100);
+
+  NegativeCache reader("cache");
+  REQUIRE(reader);
+  CHECK(reader.is_missing(name1, "M", 1000));
+  CHECK(reader.is_missing(name1, "M", 1099));
+  CHECK(!reader.is_missing(name1, "M", 1100));
+  CHECK(!reader.is_missing(name1, "R", 1000));
+  CHECK(!reader.is_missing(name2, "M", 1000));
+
+  reader.remove(name2, "M");
+  CHECK(writer.is_missing(name1, "M", 1000));
+  reader.remove(name1, "M");
+  CHECK(!writer.is_missing(name1, "M", 1000));
+}
+
+#endif // HAVE_SYS_MMAN_H
+
+TEST_SUITE_END();
@@ -0,0 +1,98 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/PathPrefixSet.hpp"
+#include "../src/Util.hpp"
+
+#include "third_party/doctest.h"
+
+#include <vector>
+
+TEST_SUITE_BEGIN("PathPrefixSet");
+
+namespace {
+
+bool
+matches(nonstd::string_view entry, nonstd::string_view path)
+{
+  PathPrefixSet set;
+  set.add(entry);
+  const bool result = set.matches(path);
+  CHECK(result == Util::matches_dir_prefix_or_file(entry, path));
+  return result;
+}
+
+} // namespace
+
+TEST_CASE("PathPrefixSet with one entry")
+{
+  CHECK(!matches("", ""));
+  CHECK(!matches("/", ""));
+  CHECK(!matches("", "/"));
+  CHECK(matches("/", "/aa"));
+
+  CHECK(matches("aa", "aa"));
+  CHECK(!matches("aaa", "aa"));
+  CHECK(!matches("aa", "aaa"));
+  CHECK(!matches("aa/", "aa"));
+
+  CHECK(matches("/aa/bb", "/aa/bb"));
+  CHECK(!matches("/aa/b", "/aa/bb"));
+  CHECK(!matches("/aa/bbb", "/aa/bb"));
+
+  CHECK(matches("/aa", "/aa/bb"));
+  CHECK(matches("/aa/", "/aa/bb"));
+  CHECK(matches("/aa", "/aa/bb/cc"));
+  CHECK(!matches("/aa/bb", "/aa"));
+  CHECK(!matches("/aa/bb", "/aa/"));
+
+#ifdef _WIN32
+  CHECK(matches("\\aa", "\\aa\\bb"));
+  CHECK(matches("\\aa\\", "\\aa\\bb"));
+#else
+  CHECK(!matches("\\aa", "\\aa\\bb"));
+  CHECK(!matches("\\aa\\", "\\aa\\bb"));
+#endif
+}
+
+TEST_CASE("PathPrefixSet with many entries")
+{
+  PathPrefixSet set;
+  CHECK(set.empty());
+  CHECK(!set.matches("/sdk/0/a.h"));
+
+  std::vector<std::string> entries;
+  for (size_t i = 0; i < 200; ++i) {
+    entries.push_back("/sdk/" + std::to_string(i));
+  }
+  for (const auto& entry : entries) {
+    set.add(entry);
+  }
+  entries.clear();
+  set.add("/usr/include/stdio.h");
+
+  CHECK(!set.empty());
+  CHECK(set.matches("/sdk/0/a.h"));
+  CHECK(set.matches("/sdk/199/sub/b.h"));
+  CHECK(!set.matches("/sdk/200/a.h"));
+  CHECK(!set.matches("/sdk/1a.h"));
+  CHECK(set.matches("/usr/include/stdio.h"));
+  CHECK(!set.matches("/usr/include/stdlib.h"));
+}
+
+TEST_SUITE_END();
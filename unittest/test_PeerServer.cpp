@@ -0,0 +1,109 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CacheBundle.hpp"
+#include "../src/Config.hpp"
+#include "../src/Counters.hpp"
+#include "../src/Hash.hpp"
+#include "../src/HttpStorage.hpp"
+#include "../src/PeerServer.hpp"
+#include "../src/Storage.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("PeerServer");
+
+TEST_CASE("PeerServer::respond")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  Storage storage(config);
+  const Digest name = Hash().hash("name").digest();
+  Counters counters;
+  storage.put(name, "R", counters, [](const std::string& path) {
+    Util::ensure_dir_exists(Util::dir_name(path));
+    Util::write_file(path, "data");
+    return true;
+  });
+
+  PeerServer server(config);
+  const auto get = [&](const std::string& target) {
+    return HttpStorage::parse_response(
+      server.respond(FMT("GET {} HTTP/1.1\r\nHost: x\r\n\r\n", target)));
+  };
+
+  SUBCASE("existing entry")
+  {
+    const auto response = get(FMT("/{}R", name.to_string()));
+    REQUIRE(response);
+    CHECK(response->status == 200);
+    CHECK(response->body == "data");
+  }
+
+  SUBCASE("missing entry")
+  {
+    const auto response = get(FMT("/{}M", name.to_string()));
+    REQUIRE(response);
+    CHECK(response->status == 404);
+  }
+
+  SUBCASE("packed entry")
+  {
+    const auto name_string = FMT("{}M", name.to_string());
+    const auto pack_path = FMT("{}/{}/{}",
+                               config.cache_dir(),
+                               name_string[0],
+                               Storage::k_pack_file_name);
+    CacheBundle::write_files(
+      pack_path, {{name_string, {}, {"packed"}}}, [](double) {});
+    CHECK(get(FMT("/{}", name_string))->status == 404);
+
+    Util::write_file("ccache.conf", "pack_max_file_size = 1k\n");
+    REQUIRE(config.update_from_file("ccache.conf"));
+    const auto response = get(FMT("/{}", name_string));
+    REQUIRE(response);
+    CHECK(response->status == 200);
+    CHECK(response->body == "packed");
+  }
+
+  SUBCASE("not an entry")
+  {
+    CHECK(get("/CACHEDIR.TAG")->status == 404);
+    CHECK(get(FMT("/../{}R", name.to_string()))->status == 404);
+    CHECK(get(FMT("/{}X", name.to_string()))->status == 404);
+  }
+
+  SUBCASE("malformed request")
+  {
+    CHECK(HttpStorage::parse_response(server.respond("GET\r\n\r\n"))->status
+          == 400);
+    CHECK(HttpStorage::parse_response(
+            server.respond(FMT("PUT /{}R HTTP/1.1\r\n\r\n", name.to_string())))
+            ->status
+          == 405);
+  }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,99 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/PresenceFilter.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("PresenceFilter");
+
+#ifdef HAVE_SYS_MMAN_H
+
+TEST_CASE("Missing file is only created on request")
+{
+  TestContext test_context;
+
+  CHECK(!PresenceFilter("a", true));
+  Util::create_dir("a");
+  CHECK(!PresenceFilter("a", false));
+  CHECK(!Stat::stat("a/presence"));
+  CHECK(PresenceFilter("a", true));
+  CHECK(Stat::stat("a/presence"));
+  CHECK(PresenceFilter("a", false));
+}
+
+TEST_CASE("Filter is trusted after a rebuild")
+{
+  TestContext test_context;
+
+  Util::create_dir("a");
+  PresenceFilter writer("a", true);
+  REQUIRE(writer);
+
+  // A new filter doesn't know about existing entries.
+  CHECK(writer.may_contain("a1M"));
+  writer.add("a2M");
+
+  writer.begin_rebuild();
+  writer.add("a3M");
+  writer.end_rebuild();
+
+  PresenceFilter reader("a", false);
+  REQUIRE(reader);
+  CHECK(!reader.may_contain("a1M"));
+  CHECK(!reader.may_contain("a2M"));
+  CHECK(reader.may_contain("a3M"));
+
+  // Entries stored after the rebuild are seen by other processes.
+  writer.add("a4R");
+  CHECK(reader.may_contain("a4R"));
+  CHECK(!reader.may_contain("a4M"));
+}
+
+TEST_CASE("False positives are rare")
+{
+  TestContext test_context;
+
+  Util::create_dir("a");
+  PresenceFilter filter("a", true);
+  REQUIRE(filter);
+  filter.begin_rebuild();
+  for (int i = 0; i < 10000; ++i) {
+    filter.add(FMT("a{}M", i));
+  }
+  filter.end_rebuild();
+
+  int false_positives = 0;
+  for (int i = 0; i < 10000; ++i) {
+    CHECK(filter.may_contain(FMT("a{}M", i)));
+    if (filter.may_contain(FMT("a{}R", i))) {
+      ++false_positives;
+    }
+  }
+  CHECK(false_positives < 10);
+}
+
+#endif // HAVE_SYS_MMAN_H
+
+TEST_SUITE_END();
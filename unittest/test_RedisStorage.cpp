@@ -0,0 +1,144 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/RedisStorage.hpp"
+#include "../src/exceptions.hpp"
+
+#include "third_party/doctest.h"
+
+using Type = RedisStorage::Reply::Type;
+
+TEST_SUITE_BEGIN("RedisStorage");
+
+TEST_CASE("RedisStorage::parse_url")
+{
+  SUBCASE("host only")
+  {
+    const auto url = RedisStorage::parse_url("redis://localhost");
+    REQUIRE(url);
+    CHECK(url->host == "localhost");
+    CHECK(url->port == "6379");
+    CHECK(url->username == "");
+    CHECK(url->password == "");
+    CHECK(url->database == "");
+  }
+
+  SUBCASE("all parts")
+  {
+    const auto url = RedisStorage::parse_url("redis://user:p@ss@[::1]:7000/2");
+    REQUIRE(url);
+    CHECK(url->host == "::1");
+    CHECK(url->port == "7000");
+    CHECK(url->username == "user");
+    CHECK(url->password == "p@ss");
+    CHECK(url->database == "2");
+  }
+
+  SUBCASE("password only")
+  {
+    const auto url = RedisStorage::parse_url("redis://:secret@example.com/");
+    REQUIRE(url);
+    CHECK(url->host == "example.com");
+    CHECK(url->username == "");
+    CHECK(url->password == "secret");
+    CHECK(url->database == "");
+  }
+
+  SUBCASE("invalid")
+  {
+    CHECK(!RedisStorage::parse_url("http://localhost"));
+    CHECK(!RedisStorage::parse_url("redis://"));
+    CHECK(!RedisStorage::parse_url("redis://localhost/x"));
+    CHECK(!RedisStorage::parse_url("redis://localhost:99999"));
+  }
+}
+
+TEST_CASE("RedisStorage::format_command")
+{
+  CHECK(RedisStorage::format_command({"GET", "key"})
+        == "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n");
+  CHECK(RedisStorage::format_command({"SET", "k", std::string("a\r\n\0b", 5)})
+        == std::string("*3\r\n$3\r\nSET\r\n$1\r\nk\r\n$5\r\na\r\n\0b\r\n", 31));
+}
+
+TEST_CASE("RedisStorage::parse_reply")
+{
+  SUBCASE("simple types")
+  {
+    const std::string data = "+OK\r\n-ERR bad\r\n:42\r\n$-1\r\n$3\r\nabc\r\n";
+    size_t pos = 0;
+
+    auto reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::status);
+    CHECK(reply->string == "OK");
+
+    reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::error);
+    CHECK(reply->string == "ERR bad");
+
+    reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::integer);
+    CHECK(reply->integer == 42);
+
+    reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::nil);
+
+    reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::bulk_string);
+    CHECK(reply->string == "abc");
+
+    CHECK(pos == data.size());
+    CHECK(!RedisStorage::parse_reply(data, pos));
+  }
+
+  SUBCASE("array")
+  {
+    const std::string data = "*2\r\n$1\r\na\r\n:1\r\n";
+    size_t pos = 0;
+    const auto reply = RedisStorage::parse_reply(data, pos);
+    REQUIRE(reply);
+    CHECK(reply->type == Type::array);
+    REQUIRE(reply->elements.size() == 2);
+    CHECK(reply->elements[0].string == "a");
+    CHECK(reply->elements[1].integer == 1);
+  }
+
+  SUBCASE("incomplete")
+  {
+    size_t pos = 0;
+    CHECK(!RedisStorage::parse_reply("$5\r\nabc", pos));
+    CHECK(!RedisStorage::parse_reply("*2\r\n:1\r\n", pos));
+    CHECK(!RedisStorage::parse_reply("+OK", pos));
+    CHECK(pos == 0);
+  }
+
+  SUBCASE("malformed")
+  {
+    size_t pos = 0;
+    CHECK_THROWS_AS(RedisStorage::parse_reply("?\r\n", pos), Error);
+    CHECK_THROWS_AS(RedisStorage::parse_reply(":x\r\n", pos), Error);
+    CHECK_THROWS_AS(RedisStorage::parse_reply("$1\r\nab\r\n", pos), Error);
+  }
+}
+
+TEST_SUITE_END();
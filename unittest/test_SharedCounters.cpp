@@ -0,0 +1,158 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/SharedCounters.hpp"
+#include "../src/Statistics.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("SharedCounters");
+
+#ifdef HAVE_SYS_MMAN_H
+
+TEST_CASE("Missing file is only created on request")
+{
+  TestContext test_context;
+
+  CHECK(!SharedCounters("a", false));
+  CHECK(!Stat::stat("a/stats.shared"));
+  CHECK(SharedCounters("a", true));
+  CHECK(Stat::stat("a/stats.shared"));
+  CHECK(SharedCounters("a", false));
+}
+
+TEST_CASE("Counters are shared and flushed to the stats file")
+{
+  TestContext test_context;
+
+  Counters updates;
+  updates.increment(Statistic::direct_cache_hit, 2);
+  updates.increment(Statistic::cache_miss, 1);
+
+  SharedCounters writer("a", true);
+  REQUIRE(writer);
+  // The first increment flushes since there has been no flush yet.
+  writer.increment(updates);
+  CHECK(Statistics::read("a/stats").get(Statistic::direct_cache_hit) == 2);
+
+  writer.increment(updates);
+  writer.increment(updates);
+  SharedCounters reader("a", false);
+  REQUIRE(reader);
+  CHECK(reader.get().get(Statistic::direct_cache_hit) == 4);
+  CHECK(reader.get().get(Statistic::cache_miss) == 2);
+
+  CHECK(reader.flush());
+  CHECK(writer.get().all_zero());
+  const auto counters = Statistics::read("a/stats");
+  CHECK(counters.get(Statistic::direct_cache_hit) == 6);
+  CHECK(counters.get(Statistic::cache_miss) == 3);
+}
+
+TEST_CASE("StatsSummary")
+{
+  TestContext test_context;
+
+  CHECK(!StatsSummary("missing", true));
+  Util::create_dir("cache");
+  CHECK(!StatsSummary("cache", false));
+
+  StatsSummary summary("cache", true);
+  REQUIRE(summary);
+  CHECK(Stat::stat("cache/stats.summary"));
+  CHECK(summary.last_recount() == 0);
+  CHECK(summary.last_updated() == 0);
+
+  // Changes that started before the summary existed may be in progress, but
+  // are assumed to be done a minute later.
+  CHECK(!summary.begin_recount(time(nullptr)));
+
+  Counters counted;
+  counted.set(Statistic::files_in_cache, 10);
+  counted.set(Statistic::stats_zeroed_timestamp, 100);
+  summary.reset(counted, 1234, summary.begin_recount(time(nullptr) + 60));
+  CHECK(summary.last_recount() != 0);
+  CHECK(summary.last_updated() == 1234);
+
+  SUBCASE("add")
+  {
+    Counters updates;
+    updates.increment(Statistic::cache_miss, 2);
+    StatsSummary("cache", false).add(updates);
+    CHECK(summary.get().get(Statistic::cache_miss) == 2);
+    CHECK(summary.get().get(Statistic::files_in_cache) == 10);
+  }
+
+  SUBCASE("add_change")
+  {
+    Counters before;
+    before.set(Statistic::files_in_cache, 7);
+    before.set(Statistic::stats_zeroed_timestamp, 200);
+    Counters after;
+    after.set(Statistic::files_in_cache, 3);
+    after.set(Statistic::stats_zeroed_timestamp, 50);
+    summary.add_change(before, after);
+    CHECK(summary.get().get(Statistic::files_in_cache) == 6);
+    // The zeroed timestamp is the latest one.
+    CHECK(summary.get().get(Statistic::stats_zeroed_timestamp) == 100);
+
+    after.set(Statistic::stats_zeroed_timestamp, 300);
+    summary.add_change(before, after);
+    CHECK(summary.get().get(Statistic::stats_zeroed_timestamp) == 300);
+  }
+
+  SUBCASE("change during recount")
+  {
+    auto recount = summary.begin_recount(time(nullptr));
+    REQUIRE(recount);
+    summary.begin_change();
+    summary.end_change();
+    summary.reset(counted, 1234, recount);
+    CHECK(summary.last_recount() == 0);
+    CHECK(summary.last_updated() == 0);
+
+    summary.begin_change();
+    CHECK(!summary.begin_recount(time(nullptr)));
+    summary.end_change();
+    recount = summary.begin_recount(time(nullptr));
+    REQUIRE(recount);
+    summary.reset(counted, 1234, recount);
+    CHECK(summary.last_recount() != 0);
+  }
+
+  SUBCASE("abandoned change")
+  {
+    summary.begin_change();
+    CHECK(!summary.begin_recount(time(nullptr)));
+    const auto recount = summary.begin_recount(time(nullptr) + 60);
+    REQUIRE(recount);
+    summary.reset(counted, 1234, recount);
+    CHECK(summary.last_recount() != 0);
+
+    // The recount makes up for the missing end_change.
+    CHECK(summary.begin_recount(time(nullptr)));
+  }
+}
+
+#endif // HAVE_SYS_MMAN_H
+
+TEST_SUITE_END();
@@ -0,0 +1,94 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/SharedRegion.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <atomic>
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("SharedRegion");
+
+#ifdef HAVE_SYS_MMAN_H
+
+namespace {
+
+struct Region
+{
+  std::atomic<uint32_t> version;
+  std::atomic<uint64_t> value;
+};
+
+} // namespace
+
+TEST_CASE("SharedRegion creation")
+{
+  TestContext test_context;
+
+  SharedRegion missing;
+  CHECK(
+    !missing.map("dir/region", sizeof(Region), 1, SharedRegion::Create::no));
+  CHECK(
+    !missing.map("dir/region", sizeof(Region), 1, SharedRegion::Create::file));
+
+  SharedRegion created;
+  REQUIRE(created.map(
+    "dir/region", sizeof(Region), 1, SharedRegion::Create::file_and_dir));
+  CHECK(created.is_new());
+  CHECK(Stat::stat("dir/region").size() == sizeof(Region));
+  static_cast<Region*>(created.data())->value = 17;
+
+  SharedRegion existing;
+  REQUIRE(
+    existing.map("dir/region", sizeof(Region), 1, SharedRegion::Create::no));
+  CHECK(!existing.is_new());
+  CHECK(static_cast<Region*>(existing.data())->value == 17);
+}
+
+TEST_CASE("SharedRegion with other version")
+{
+  TestContext test_context;
+
+  SharedRegion region;
+  REQUIRE(region.map("region", sizeof(Region), 1, SharedRegion::Create::file));
+
+  SharedRegion other;
+  CHECK(!other.map("region", sizeof(Region), 2, SharedRegion::Create::file));
+  CHECK(!other.data());
+}
+
+TEST_CASE("SharedRegion growing")
+{
+  TestContext test_context;
+
+  Util::write_file("region", std::string(4, '\0'));
+
+  SharedRegion region;
+  CHECK(!region.map("region", sizeof(Region), 1, SharedRegion::Create::no));
+  REQUIRE(region.map("region", sizeof(Region), 1, SharedRegion::Create::file));
+  CHECK(Stat::stat("region").size() == sizeof(Region));
+}
+
+#endif // HAVE_SYS_MMAN_H
+
+TEST_SUITE_END();
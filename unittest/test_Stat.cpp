@@ -16,6 +16,7 @@
 // this program; if not, write to the Free Software Foundation, Inc., 51
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include "../src/Fd.hpp"
 #include "../src/Stat.hpp"
 #include "../src/Util.hpp"
 #include "TestUtil.hpp"
@@ -215,6 +216,26 @@ TEST_CASE("Symlinks")
     CHECK(stat.size() == 7);
   }
 }
+
+TEST_CASE("Stat relative to directory")
+{
+  TestContext test_context;
+
+  REQUIRE(mkdir("dir", 0755) == 0);
+  Util::write_file("dir/file", "1234567");
+  Fd dir_fd(open("dir", O_RDONLY));
+  REQUIRE(dir_fd);
+
+  auto stat = Stat::stat_at(*dir_fd, "file");
+  CHECK(stat);
+  CHECK(stat.is_regular());
+  CHECK(stat.size() == 7);
+  CHECK(stat.same_inode_as(Stat::stat("dir/file")));
+
+  stat = Stat::stat_at(*dir_fd, "missing");
+  CHECK(!stat);
+  CHECK(stat.error_number() == ENOENT);
+}
 #endif
 
 TEST_SUITE_END();
@@ -0,0 +1,68 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/StatCache.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("StatCache");
+
+TEST_CASE("Results are cached")
+{
+  TestContext test_context;
+
+  StatCache stat_cache;
+
+  CHECK(!stat_cache.stat("a"));
+
+  Util::write_file("a", "123");
+  const auto st = stat_cache.stat("a");
+  REQUIRE(st);
+  CHECK(st.size() == 3);
+
+  Util::write_file("a", "123456");
+  CHECK(stat_cache.stat("a").size() == 3);
+  CHECK(Stat::stat("a").size() == 6);
+}
+
+TEST_CASE("Files in the same directory")
+{
+  TestContext test_context;
+
+  StatCache stat_cache;
+
+  REQUIRE(Util::create_dir("dir"));
+  Util::write_file("dir/a", "1");
+  Util::write_file("dir/b", "12");
+  Util::write_file("dir/c", "123");
+
+  CHECK(stat_cache.stat("dir/a").size() == 1);
+  CHECK(stat_cache.stat("dir/b").size() == 2);
+  CHECK(stat_cache.stat("dir/c").size() == 3);
+  CHECK(!stat_cache.stat("dir/d"));
+
+  const auto st = stat_cache.stat(Util::get_actual_cwd() + "/dir/c");
+  CHECK(st.size() == 3);
+  CHECK(st.same_inode_as(Stat::stat("dir/c")));
+}
+
+TEST_SUITE_END();
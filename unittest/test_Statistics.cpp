@@ -16,6 +16,7 @@
 // this program; if not, write to the Free Software Foundation, Inc., 51
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
+#include "../src/Config.hpp"
 #include "../src/Statistics.hpp"
 #include "../src/Util.hpp"
 #include "../src/fmtmacros.hpp"
@@ -99,4 +100,79 @@ TEST_CASE("Update")
   CHECK(counters->get(Statistic::cache_miss) == 33);
 }
 
+TEST_CASE("Phase duration buckets")
+{
+  CHECK(Statistics::phase_bucket_index(0) == 0);
+  CHECK(Statistics::phase_bucket_index(31) == 0);
+  CHECK(Statistics::phase_bucket_index(32) == 1);
+  CHECK(Statistics::phase_bucket_index(47) == 1);
+  CHECK(Statistics::phase_bucket_index(48) == 2);
+  CHECK(Statistics::phase_bucket_index(64) == 3);
+  CHECK(Statistics::phase_bucket_index(1000000) == 30);
+  CHECK(Statistics::phase_bucket_index(UINT64_MAX)
+        == Statistics::k_phase_buckets - 1);
+
+  for (size_t i = 0; i < Statistics::k_phase_buckets; ++i) {
+    const uint64_t lower = Statistics::phase_bucket_lower_bound(i);
+    CHECK(Statistics::phase_bucket_index(lower) == i);
+    if (i > 0) {
+      CHECK(Statistics::phase_bucket_index(lower - 1) == i - 1);
+    }
+  }
+  CHECK(Statistics::phase_bucket_lower_bound(Statistics::k_phase_buckets - 1)
+        == 1 << 24);
+}
+
+TEST_CASE("Phase durations")
+{
+  Counters counters;
+  Statistics::add_phase_duration(counters, Phase::find_compiler, 40);
+  Statistics::add_phase_duration(counters, Phase::find_compiler, 45);
+  Statistics::add_phase_duration(counters, Phase::compiler_cpu_time, 2000);
+
+  const size_t find_compiler_begin =
+    Statistics::k_phase_counters_begin
+    + static_cast<size_t>(Phase::find_compiler)
+        * (Statistics::k_phase_buckets + 1);
+  CHECK(counters.get_raw(find_compiler_begin + 1) == 2);
+  CHECK(counters.get_raw(find_compiler_begin + Statistics::k_phase_buckets)
+        == 85);
+  CHECK(counters.size() == Statistics::k_phase_counters_end);
+  CHECK(counters.get(Statistic::cache_miss) == 0);
+}
+
+TEST_CASE("Breakdown")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(".");
+
+  Counters hit;
+  hit.increment(Statistic::direct_cache_hit);
+  Counters miss;
+  miss.increment(Statistic::cache_miss);
+
+  Statistics::update_breakdown(config, "compiler", "gcc", hit);
+  Statistics::update_breakdown(config, "compiler", "gcc", miss);
+  Statistics::update_breakdown(config, "compiler", "clang", miss);
+  Statistics::update_breakdown(config, "compiler", "clang", miss);
+
+  const auto lines =
+    Util::split_into_strings(Statistics::format_breakdown(config, "compiler"),
+                             "\n");
+  REQUIRE(lines.size() == 3);
+  CHECK(Util::starts_with(lines[0], "compiler"));
+  CHECK(Util::starts_with(lines[1], "clang"));
+  CHECK(lines[1].find("0.00 %") != std::string::npos);
+  CHECK(Util::starts_with(lines[2], "gcc"));
+  CHECK(lines[2].find("50.00 %") != std::string::npos);
+
+  Statistics::zero_all_counters(config);
+  CHECK(Util::split_into_strings(
+          Statistics::format_breakdown(config, "compiler"), "\n")
+          .size()
+        == 1);
+}
+
 TEST_SUITE_END();
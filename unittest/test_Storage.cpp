@@ -0,0 +1,156 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Config.hpp"
+#include "../src/Counters.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Statistics.hpp"
+#include "../src/Storage.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+TEST_SUITE_BEGIN("Storage");
+
+TEST_CASE("Storage get, put and remove in primary storage")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  Storage storage(config);
+  storage.initialize();
+
+  const Digest name = Hash().hash("name").digest();
+  Counters counters;
+
+  CHECK(!storage.get(name, "R", counters));
+
+  std::string written_path;
+  CHECK(storage.put(name, "R", counters, [&](const std::string& path) {
+    written_path = path;
+    Util::ensure_dir_exists(Util::dir_name(path));
+    Util::write_file(path, "data");
+    return true;
+  }));
+  CHECK(Util::starts_with(written_path, Util::get_actual_cwd() + "/"));
+  CHECK(Util::ends_with(written_path, name.to_string().substr(2) + "R"));
+  CHECK(counters.get(Statistic::files_in_cache) == 1);
+
+  const auto path = storage.get(name, "R", counters);
+  REQUIRE(path);
+  CHECK(*path == written_path);
+  CHECK(Util::read_file(*path) == "data");
+
+  // Updating an existing entry doesn't add a file.
+  CHECK(storage.put(name, "R", counters, [&](const std::string& path) {
+    Util::write_file(path, "data2");
+    return true;
+  }));
+  CHECK(counters.get(Statistic::files_in_cache) == 1);
+
+  // A failing entry writer is reported.
+  CHECK(!storage.put(
+    name, "M", counters, [](const std::string&) { return false; }));
+  CHECK(!storage.get(name, "M", counters));
+
+  storage.remove(name, "R");
+  CHECK(!storage.get(name, "R", counters));
+}
+
+TEST_CASE("Storage lookup of entries on different cache levels")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  Storage storage(config);
+  storage.initialize();
+
+  const Digest name1 = Hash().hash("name1").digest();
+  const Digest name2 = Hash().hash("name2").digest();
+  const Digest name3 = Hash().hash("name3").digest();
+  Counters counters;
+
+  const auto write_entry = [&](const Digest& name, uint8_t level) {
+    const auto path = Util::get_path_in_cache(
+      config.cache_dir(), level, name.to_string() + "R");
+    Util::ensure_dir_exists(Util::dir_name(path));
+    Util::write_file(path, "data");
+    return path;
+  };
+
+  const auto path1 = write_entry(name1, 3);
+  const auto path2 = write_entry(name2, 3);
+  const auto path3 = write_entry(name3, 2);
+
+  CHECK(storage.get(name1, "R", counters) == path1);
+  CHECK(storage.get(name2, "R", counters) == path2);
+  CHECK(storage.get(name3, "R", counters) == path3);
+  CHECK(storage.get(name1, "R", counters) == path1);
+}
+
+TEST_CASE("Storage removes duplicates on other cache levels")
+{
+  TestContext test_context;
+
+  Config config;
+  config.set_cache_dir(Util::get_actual_cwd());
+  Storage storage(config);
+  storage.initialize();
+
+  const Digest name1 = Hash().hash("name1").digest();
+  const Digest name2 = Hash().hash("name2").digest();
+  Counters counters;
+
+  const auto write_entry = [&](const Digest& name, uint8_t level) {
+    const auto path = Util::get_path_in_cache(
+      config.cache_dir(), level, name.to_string() + "R");
+    Util::ensure_dir_exists(Util::dir_name(path));
+    Util::write_file(path, "old");
+    return path;
+  };
+
+  // Make level 3 the hinted level.
+  const auto path1 = write_entry(name1, 3);
+  CHECK(storage.get(name1, "R", counters) == path1);
+
+  const auto deep_path2 = write_entry(name2, 3);
+  const auto shallow_path2 = write_entry(name2, 2);
+  CHECK(storage.get(name2, "R", counters) == deep_path2);
+  counters.increment(Statistic::files_in_cache, 2);
+
+  CHECK(storage.put(name2, "R", counters, [&](const std::string& path) {
+    Util::write_file(path, "new");
+    return true;
+  }));
+  CHECK(!Stat::stat(shallow_path2));
+  CHECK(counters.get(Statistic::files_in_cache) == 1);
+
+  Storage other_storage(config);
+  other_storage.initialize();
+  const auto path2 = other_storage.get(name2, "R", counters);
+  REQUIRE(path2);
+  CHECK(Util::read_file(*path2) == "new");
+}
+
+TEST_SUITE_END();
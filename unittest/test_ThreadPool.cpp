@@ -0,0 +1,154 @@
+// Copyright (C) 2020 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/ThreadPool.hpp"
+
+#include "third_party/doctest.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("ThreadPool");
+
+TEST_CASE("ThreadPool::for_each_index")
+{
+  ThreadPool thread_pool(3);
+
+  SUBCASE("no indexes")
+  {
+    CHECK(thread_pool.for_each_index(0, [](size_t) { return false; }));
+  }
+
+  SUBCASE("all indexes")
+  {
+    std::vector<std::atomic<int>> calls(100);
+    CHECK(thread_pool.for_each_index(calls.size(), [&](size_t i) {
+      ++calls[i];
+      return true;
+    }));
+    for (const auto& count : calls) {
+      CHECK(count == 1);
+    }
+  }
+
+  SUBCASE("cancellation")
+  {
+    std::atomic<size_t> calls(0);
+    CHECK(!thread_pool.for_each_index(1000, [&](size_t i) {
+      ++calls;
+      return i != 10;
+    }));
+    CHECK(calls < 1000);
+  }
+
+  SUBCASE("no helpers")
+  {
+    const auto caller = std::this_thread::get_id();
+    std::atomic<bool> on_caller(true);
+    CHECK(thread_pool.for_each_index(
+      100,
+      [&](size_t) {
+        if (std::this_thread::get_id() != caller) {
+          on_caller = false;
+        }
+        return true;
+      },
+      0));
+    CHECK(on_caller);
+  }
+
+  SUBCASE("reuse")
+  {
+    for (size_t i = 0; i < 10; ++i) {
+      CHECK(thread_pool.for_each_index(10, [](size_t) { return true; }));
+    }
+  }
+}
+
+TEST_CASE("ThreadPool::submit")
+{
+  ThreadPool thread_pool(2);
+
+  SUBCASE("return value")
+  {
+    auto future = thread_pool.submit([] { return 42; });
+    CHECK(future.get() == 42);
+  }
+
+  SUBCASE("exception")
+  {
+    auto future =
+      thread_pool.submit([]() -> int { throw std::runtime_error("x"); });
+    CHECK_THROWS_AS(future.get(), std::runtime_error);
+  }
+}
+
+TEST_CASE("ThreadPool priorities")
+{
+  ThreadPool thread_pool(1);
+
+  std::promise<void> release;
+  std::shared_future<void> released(release.get_future());
+  thread_pool.enqueue([released] { released.wait(); });
+
+  std::mutex mutex;
+  std::vector<int> order;
+  const auto record = [&](int n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(n);
+  };
+  thread_pool.enqueue([&] { record(1); });
+  thread_pool.enqueue([&] { record(2); }, ThreadPool::Priority::high);
+  thread_pool.enqueue([&] { record(3); });
+
+  release.set_value();
+  thread_pool.wait_all();
+  CHECK(order == std::vector<int>{2, 1, 3});
+}
+
+TEST_CASE("ThreadPool::wait_all")
+{
+  SUBCASE("with worker threads")
+  {
+    ThreadPool thread_pool(3);
+    std::atomic<int> calls(0);
+    for (int i = 0; i < 100; ++i) {
+      thread_pool.enqueue([&] { ++calls; });
+    }
+    thread_pool.wait_all();
+    CHECK(calls == 100);
+
+    thread_pool.enqueue([&] { ++calls; });
+    thread_pool.wait_all();
+    CHECK(calls == 101);
+  }
+
+  SUBCASE("without worker threads")
+  {
+    ThreadPool thread_pool(0);
+    int calls = 0;
+    thread_pool.enqueue([&] { ++calls; });
+    thread_pool.enqueue([&] { ++calls; }, ThreadPool::Priority::high);
+    thread_pool.wait_all();
+    CHECK(calls == 2);
+  }
+}
+
+TEST_SUITE_END();
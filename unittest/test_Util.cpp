@@ -17,6 +17,7 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "../src/Config.hpp"
+#include "../src/Context.hpp"
 #include "../src/Fd.hpp"
 #include "../src/Util.hpp"
 #include "../src/fmtmacros.hpp"
@@ -26,6 +27,7 @@
 #include "third_party/nonstd/optional.hpp"
 
 #include <algorithm>
+#include <mutex>
 
 using doctest::Approx;
 using nonstd::nullopt;
@@ -125,6 +127,45 @@ TEST_CASE("Util::common_dir_prefix_length")
   CHECK(Util::common_dir_prefix_length("/a/b", "/a/bc") == 2);
 }
 
+TEST_CASE("Util::copy_fd_range")
+{
+  TestContext test_context;
+
+  Util::write_file("src", "0123456789");
+  Fd src(open("src", O_RDONLY | O_BINARY));
+  Fd dest(open("dest", O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666));
+  REQUIRE(src);
+  REQUIRE(dest);
+
+  if (Util::copy_fd_range(*src, 2, *dest, 5)) {
+    CHECK(Util::copy_fd_range(*src, 0, *dest, 2));
+    dest.close();
+    CHECK(Util::read_file("dest") == "2345601");
+  }
+}
+
+TEST_CASE("Util::copy_file")
+{
+  TestContext test_context;
+
+  const std::string data(3 * 1024 * 1024 + 17, 'x');
+  Util::write_file("src", data);
+  Util::write_file("dest", "old content that is overwritten");
+
+  SUBCASE("Directly")
+  {
+    Util::copy_file("src", "dest");
+  }
+
+  SUBCASE("Via temporary file")
+  {
+    Util::copy_file("src", "dest", true);
+  }
+
+  CHECK(Util::read_file("dest") == data);
+  CHECK_THROWS_AS(Util::copy_file("missing", "dest"), Error);
+}
+
 TEST_CASE("Util::create_dir")
 {
   TestContext test_context;
@@ -192,6 +233,14 @@ TEST_CASE("Util::ensure_dir_exists")
     "Failed to create directory create/dir/file: Not a directory");
 }
 
+TEST_CASE("Util::escape_json")
+{
+  CHECK(Util::escape_json("") == "");
+  CHECK(Util::escape_json("foo/bar.c") == "foo/bar.c");
+  CHECK(Util::escape_json("a\"b\\c") == "a\\\"b\\\\c");
+  CHECK(Util::escape_json("a\nb\x01") == "a\\u000ab\\u0001");
+}
+
 TEST_CASE("Util::expand_environment_variables")
 {
   Util::setenv("FOO", "bar");
@@ -263,6 +312,27 @@ TEST_CASE("Util::for_each_level_1_subdir")
     "cache_dir/f",
   };
   CHECK(actual == expected);
+
+  SUBCASE("concurrently")
+  {
+    std::mutex mutex;
+    std::vector<std::string> visited;
+    double last_progress = 0.0;
+    Util::for_each_level_1_subdir(
+      "cache_dir",
+      [&](const std::string& subdir,
+          const Util::ProgressReceiver& progress_receiver) {
+        progress_receiver(0.5);
+        std::lock_guard<std::mutex> lock(mutex);
+        visited.push_back(subdir);
+      },
+      [&](double progress) { last_progress = progress; },
+      4);
+
+    std::sort(visited.begin(), visited.end());
+    CHECK(visited == expected);
+    CHECK(last_progress == 1.0);
+  }
 }
 
 TEST_CASE("Util::format_argv_for_logging")
@@ -529,6 +599,37 @@ TEST_CASE("Util::is_dir_separator")
 #endif
 }
 
+TEST_CASE("Util::make_relative_path")
+{
+  TestContext test_context;
+
+  Context ctx;
+  const auto cwd = ctx.actual_cwd;
+  REQUIRE(Util::create_dir("dir"));
+  Util::write_file("dir/a.h", "");
+  Util::write_file("b.h", "");
+
+  SUBCASE("Base directory not matching")
+  {
+    ctx.config.set_base_dir("/nonexistent");
+    CHECK(Util::make_relative_path(ctx, cwd + "/dir/a.h") == cwd + "/dir/a.h");
+    CHECK(ctx.relative_dir_cache.empty());
+  }
+
+  SUBCASE("Paths under base directory")
+  {
+    ctx.config.set_base_dir(cwd);
+    CHECK(Util::make_relative_path(ctx, cwd + "/dir/a.h") == "dir/a.h");
+    CHECK(Util::make_relative_path(ctx, cwd + "/dir/c.h") == "dir/c.h");
+    CHECK(Util::make_relative_path(ctx, cwd + "/b.h") == "b.h");
+    CHECK(Util::make_relative_path(ctx, cwd + "/c.h") == "./c.h");
+    CHECK(Util::make_relative_path(ctx, cwd + "/new/c.h") == "./new/c.h");
+    CHECK(Util::make_relative_path(ctx, cwd + "/dir") == "dir");
+    CHECK(ctx.relative_dir_cache.size() == 3);
+    CHECK(ctx.relative_dir_cache[cwd + "/dir"] == "dir");
+  }
+}
+
 TEST_CASE("Util::matches_dir_prefix_or_file")
 {
   CHECK(!Util::matches_dir_prefix_or_file("", ""));
@@ -698,6 +799,37 @@ TEST_CASE("Util::parse_unsigned")
                     "invalid unsigned integer: \"18446744073709551616\"");
 }
 
+TEST_CASE("Util::read_fd_to_string")
+{
+  TestContext test_context;
+
+  const std::string content(5000, 'x');
+  Util::write_file("test", content);
+
+  SUBCASE("Without size hint")
+  {
+    Fd fd(open("test", O_RDONLY | O_BINARY));
+    REQUIRE(fd);
+    CHECK(Util::read_fd_to_string(*fd) == content);
+  }
+
+  SUBCASE("With too small size hint")
+  {
+    Fd fd(open("test", O_RDONLY | O_BINARY));
+    REQUIRE(fd);
+    CHECK(Util::read_fd_to_string(*fd, 10) == content);
+  }
+
+  SUBCASE("After partial read")
+  {
+    Fd fd(open("test", O_RDONLY | O_BINARY));
+    REQUIRE(fd);
+    char buffer[1000];
+    REQUIRE(read(*fd, buffer, sizeof(buffer)) == sizeof(buffer));
+    CHECK(Util::read_fd_to_string(*fd, 4000) == content.substr(1000));
+  }
+}
+
 TEST_CASE("Util::read_file and Util::write_file")
 {
   TestContext test_context;
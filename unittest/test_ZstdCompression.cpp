@@ -20,6 +20,9 @@
 #include "../src/Compressor.hpp"
 #include "../src/Decompressor.hpp"
 #include "../src/File.hpp"
+#include "../src/Util.hpp"
+#include "../src/ZstdDictionary.hpp"
+#include "../src/fmtmacros.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
@@ -120,4 +123,165 @@ TEST_CASE("Large uncompressible Compression::Type::zstd roundtrip")
   decompressor->finalize();
 }
 
+TEST_CASE("Large Compression::Type::zstd stream between other data")
+{
+  TestContext test_context;
+
+  // Uncompressible, so that the file is large enough to be mapped.
+  std::string data(200000, 'x');
+  for (char& c : data) {
+    c = static_cast<char>(rand() % 256);
+  }
+
+  File f("data.zstd", "wb");
+  fwrite("head", 4, 1, f.get());
+  auto compressor =
+    Compressor::create_from_type(Compression::Type::zstd, f.get(), 1);
+  compressor->write(data.data(), data.size());
+  compressor->finalize();
+  const long end_of_stream = ftell(f.get());
+  fwrite("tail", 4, 1, f.get());
+  f.close();
+
+  f.open("data.zstd", "rb");
+  char buffer[4];
+  REQUIRE(fread(buffer, 4, 1, f.get()) == 1);
+  auto decompressor =
+    Decompressor::create_from_type(Compression::Type::zstd, f.get());
+
+  std::string result(data.size(), '\0');
+  decompressor->read(&result[0], 10);
+  decompressor->read(&result[10], result.size() - 10);
+  CHECK(result == data);
+  decompressor->finalize();
+
+  CHECK(ftell(f.get()) == end_of_stream);
+  REQUIRE(fread(buffer, 4, 1, f.get()) == 1);
+  CHECK(memcmp(buffer, "tail", 4) == 0);
+}
+
+TEST_CASE("Multithreaded Compression::Type::zstd roundtrip")
+{
+  TestContext test_context;
+
+  std::string data;
+  for (size_t i = 0; i < 100000; ++i) {
+    data += FMT("line {}\n", i);
+  }
+
+  File f("data.zstd", "wb");
+  auto compressor = Compressor::create_from_type(
+    Compression::Type::zstd, f.get(), 1, 0, 2);
+  compressor->write(data.data(), data.size());
+  compressor->finalize();
+
+  f.open("data.zstd", "rb");
+  auto decompressor =
+    Decompressor::create_from_type(Compression::Type::zstd, f.get());
+
+  std::string buffer(data.size(), '\0');
+  decompressor->read(&buffer[0], buffer.size());
+  CHECK(buffer == data);
+  decompressor->finalize();
+}
+
+TEST_CASE("Compression::Type::zstd_with_dictionary roundtrip")
+{
+  TestContext test_context;
+
+  if (!ZstdDictionary::supported()) {
+    return;
+  }
+
+  ZstdDictionary::set_cache_dir(".");
+  CHECK(ZstdDictionary::current_id() == 0);
+
+  std::string samples;
+  std::vector<size_t> sample_sizes;
+  for (size_t i = 0; i < 1000; ++i) {
+    const auto sample = FMT(
+      "#define FOO_{} {}\nint foo_{}(int x) {{ return x * {} + FOO_{}; }}\n",
+      i,
+      i * 7,
+      i,
+      i % 13,
+      i);
+    samples += sample;
+    sample_sizes.push_back(sample.size());
+  }
+  const uint32_t id = ZstdDictionary::train(samples, sample_sizes, 4096);
+  CHECK(id != 0);
+  CHECK(ZstdDictionary::current_id() == id);
+
+  const std::string data =
+    "#define FOO_1234 8638\n"
+    "int foo_1234(int x) { return x * 12 + FOO_1234; }\n";
+
+  File f("data.zstd", "wb");
+  auto compressor = Compressor::create_from_type(
+    Compression::Type::zstd_with_dictionary, f.get(), 1, id);
+  compressor->write(data.data(), data.size());
+  compressor->finalize();
+
+  f.open("data.zstd", "rb");
+  auto decompressor = Decompressor::create_from_type(
+    Compression::Type::zstd_with_dictionary, f.get(), id);
+
+  std::string buffer(data.size(), '\0');
+  decompressor->read(&buffer[0], buffer.size());
+  CHECK(buffer == data);
+  decompressor->finalize();
+
+  CHECK_THROWS(Decompressor::create_from_type(
+    Compression::Type::zstd_with_dictionary, f.get(), id + 1));
+
+  // Streams are reused, but not with the dictionary.
+  f.open("plain.zstd", "wb");
+  compressor =
+    Compressor::create_from_type(Compression::Type::zstd, f.get(), 1);
+  compressor->write(data.data(), data.size());
+  compressor->finalize();
+  compressor.reset();
+
+  f.open("plain.zstd", "rb");
+  decompressor.reset();
+  ZstdDictionary::set_cache_dir("");
+  decompressor = Decompressor::create_from_type(Compression::Type::zstd,
+                                                f.get());
+  decompressor->read(&buffer[0], buffer.size());
+  CHECK(buffer == data);
+  decompressor->finalize();
+}
+
+TEST_CASE("Compression::Type::zstd roundtrip with embedded frame")
+{
+  TestContext test_context;
+
+  File f("frame.zstd", "wb");
+  auto frame_compressor =
+    Compressor::create_from_type(Compression::Type::zstd, f.get(), 1);
+  frame_compressor->write("bar", 3);
+  frame_compressor->finalize();
+  f.close();
+  const std::string frame = Util::read_file("frame.zstd");
+
+  f.open("data.zstd", "wb");
+  auto compressor =
+    Compressor::create_from_type(Compression::Type::zstd, f.get(), 1);
+  compressor->write("foo", 3);
+  CHECK(compressor->write_frame(frame));
+  CHECK(compressor->write_frame(frame));
+  compressor->write("baz", 3);
+  compressor->finalize();
+
+  f.open("data.zstd", "rb");
+  auto decompressor =
+    Decompressor::create_from_type(Compression::Type::zstd, f.get());
+
+  char buffer[12];
+  decompressor->read(buffer, sizeof(buffer));
+  CHECK(memcmp(buffer, "foobarbarbaz", sizeof(buffer)) == 0);
+  decompressor->finalize();
+}
+
 TEST_SUITE_END();
@@ -97,6 +97,81 @@ TEST_CASE("dash_E_should_result_in_called_for_preprocessing")
   CHECK(process_args(ctx).error == Statistic::called_for_preprocessing);
 }
 
+TEST_CASE("dash_E_with_cache_preprocessing")
+{
+  TestContext test_context;
+
+  Context ctx;
+  ctx.config.set_cache_preprocessing(true);
+  Util::write_file("foo.c", "");
+
+  SUBCASE("output to stdout")
+  {
+    ctx.orig_args = Args::from_string("cc -E foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.preprocessing_only);
+    CHECK(ctx.args_info.output_obj == "-");
+    CHECK(!ctx.config.run_second_cpp());
+    CHECK(result.preprocessor_args.to_string() == "cc");
+  }
+
+  SUBCASE("output to file")
+  {
+    ctx.orig_args = Args::from_string("cc -E foo.c -o foo.i");
+    CHECK(!process_args(ctx).error);
+    CHECK(ctx.args_info.output_obj == "foo.i");
+  }
+
+  SUBCASE("dependency generation")
+  {
+    ctx.orig_args = Args::from_string("cc -E -MD foo.c");
+    CHECK(process_args(ctx).error == Statistic::called_for_preprocessing);
+  }
+}
+
+TEST_CASE("C++20 module options")
+{
+  TestContext test_context;
+
+  Context ctx;
+  Util::write_file("foo.cppm", "");
+
+  SUBCASE("-fmodule-file")
+  {
+    ctx.orig_args = Args::from_string(
+      "clang++ -c foo.cppm -fmodule-file=a.pcm -fmodule-file=b=dir/b.pcm");
+    CHECK(!process_args(ctx).error);
+    CHECK(ctx.args_info.module_files
+          == std::vector<std::string>{"a.pcm", "dir/b.pcm"});
+  }
+
+  SUBCASE("-fmodule-output with path")
+  {
+    ctx.orig_args =
+      Args::from_string("clang++ -c foo.cppm -fmodule-output=out/foo.pcm");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.output_bmi == "out/foo.pcm");
+    CHECK(result.preprocessor_args.to_string() == "clang++");
+  }
+
+  SUBCASE("-fmodule-output without path")
+  {
+    ctx.orig_args =
+      Args::from_string("clang++ -c foo.cppm -o obj/foo.o -fmodule-output");
+    Util::create_dir("obj");
+    CHECK(!process_args(ctx).error);
+    CHECK(ctx.args_info.output_bmi == "obj/foo.pcm");
+  }
+
+  SUBCASE("-fmodules-ts")
+  {
+    ctx.orig_args = Args::from_string("g++ -c foo.cppm -fmodules-ts");
+    CHECK(process_args(ctx).error == Statistic::could_not_use_modules);
+  }
+}
+
 TEST_CASE("dash_M_should_be_unsupported")
 {
   TestContext test_context;
@@ -667,4 +742,64 @@ TEST_CASE("-x")
   }
 }
 
+TEST_CASE("MSVC options")
+{
+  TestContext test_context;
+  Context ctx;
+  ctx.config.set_compiler_type(CompilerType::msvc);
+  Util::write_file("foo.c", "");
+
+  SUBCASE("slash and dash options")
+  {
+    ctx.orig_args =
+      Args::from_string("cl /c /nologo /MD -MP /DX /Fo:out.obj foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.output_obj == "out.obj");
+    CHECK(!ctx.args_info.generating_dependencies);
+    CHECK(result.preprocessor_args.to_string() == "cl -nologo -MD -MP -DX");
+    CHECK(result.compiler_args.to_string() == "cl -nologo -MD -MP -DX -c");
+  }
+
+  SUBCASE("concatenated -Fo")
+  {
+    ctx.orig_args = Args::from_string("cl -c -Foout.obj foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.output_obj == "out.obj");
+  }
+
+  SUBCASE("default object file")
+  {
+    ctx.orig_args = Args::from_string("cl -c foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.output_obj == "foo.obj");
+  }
+
+  SUBCASE("/showIncludes")
+  {
+    ctx.orig_args = Args::from_string("cl /c /showIncludes foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(!result.error);
+    CHECK(ctx.args_info.generating_includes);
+    CHECK(result.preprocessor_args.to_string() == "cl");
+    CHECK(result.extra_args_to_hash.to_string() == "-showIncludes");
+  }
+
+  SUBCASE("preprocessing")
+  {
+    ctx.orig_args = Args::from_string("cl /EP foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(result.error == Statistic::called_for_preprocessing);
+  }
+
+  SUBCASE("program database")
+  {
+    ctx.orig_args = Args::from_string("cl /c /Zi foo.c");
+    const ProcessArgsResult result = process_args(ctx);
+    CHECK(result.error == Statistic::unsupported_compiler_option);
+  }
+}
+
 TEST_SUITE_END();
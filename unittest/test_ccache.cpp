@@ -17,6 +17,7 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "../src/Context.hpp"
+#include "../src/Stat.hpp"
 #include "../src/ccache.hpp"
 #include "../src/fmtmacros.hpp"
 #include "TestUtil.hpp"
@@ -175,6 +176,10 @@ TEST_CASE("guess_compiler")
     CHECK(guess_compiler("/test/prefix/x86_64-w64-mingw32-gcc-posix")
           == CompilerType::gcc);
 
+    CHECK(guess_compiler("/test/prefix/cl") == CompilerType::msvc);
+    CHECK(guess_compiler("/test/prefix/cl.exe") == CompilerType::msvc);
+    CHECK(guess_compiler("/test/prefix/CL.EXE") == CompilerType::msvc);
+
     CHECK(guess_compiler("/test/prefix/nvcc") == CompilerType::nvcc);
     CHECK(guess_compiler("/test/prefix/nvcc-10.1.243") == CompilerType::nvcc);
 
@@ -200,4 +205,31 @@ TEST_CASE("guess_compiler")
 #endif
 }
 
+#ifndef _WIN32
+TEST_CASE("lookup_compilation")
+{
+  TestContext test_context;
+
+  const auto cwd = Util::get_actual_cwd();
+  Util::write_file(FMT("{}/gcc", cwd), "");
+  Util::write_file("test.c", "int x;\n");
+
+  Config config;
+  config.set_cache_dir(FMT("{}/cache", cwd));
+
+  SUBCASE("Uncacheable")
+  {
+    CHECK(lookup_compilation(config, Args::from_string("./gcc -E test.c"))
+          == LookupResult::uncacheable);
+  }
+
+  SUBCASE("Miss")
+  {
+    CHECK(lookup_compilation(config, Args::from_string("./gcc -c test.c"))
+          == LookupResult::miss);
+    CHECK(!Stat::stat("cache/stats"));
+  }
+}
+#endif
+
 TEST_SUITE_END();
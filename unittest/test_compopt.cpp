@@ -82,6 +82,9 @@ TEST_CASE("prefix_affects_cpp_output")
   CHECK(compopt_prefix_affects_cpp_output("-iframework"));
   CHECK(compopt_prefix_affects_cpp_output("-iframework42"));
   CHECK(!compopt_prefix_affects_cpp_output("-iframewor"));
+  CHECK(compopt_prefix_affects_cpp_output("-include-pchfoo.pch"));
+  CHECK(compopt_prefix_affects_cpp_output("-Ifoo"));
+  CHECK(!compopt_prefix_affects_cpp_output("-MFfoo"));
 }
 
 TEST_CASE("prefix_affects_compiler_output")
@@ -91,4 +94,21 @@ TEST_CASE("prefix_affects_compiler_output")
   CHECK(!compopt_prefix_affects_compiler_output("-Wa"));
 }
 
+TEST_CASE("affects_diagnostics_only")
+{
+  CHECK(compopt_affects_diagnostics_only("-Werror"));
+  CHECK(compopt_affects_diagnostics_only("-Werror=format"));
+  CHECK(compopt_affects_diagnostics_only("-Wall"));
+  CHECK(compopt_affects_diagnostics_only("-Wno-unused"));
+  CHECK(compopt_affects_diagnostics_only("-w"));
+  CHECK(compopt_affects_diagnostics_only("-pedantic"));
+  CHECK(compopt_affects_diagnostics_only("-fmax-errors=5"));
+  CHECK(!compopt_affects_diagnostics_only("-W"));
+  CHECK(!compopt_affects_diagnostics_only("-Wa,-gstabs"));
+  CHECK(!compopt_affects_diagnostics_only("-Wl,--as-needed"));
+  CHECK(!compopt_affects_diagnostics_only("-Wp,-DFOO"));
+  CHECK(!compopt_affects_diagnostics_only("-O2"));
+  CHECK(!compopt_affects_diagnostics_only("-DFOO"));
+}
+
 TEST_SUITE_END();
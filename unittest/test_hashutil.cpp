@@ -18,9 +18,11 @@
 
 #include "../src/Context.hpp"
 #include "../src/Hash.hpp"
+#include "../src/Util.hpp"
 #include "../src/hashutil.hpp"
 #include "TestUtil.hpp"
 
+#include "third_party/blake3/blake3_cpu_supports_avx2.h"
 #include "third_party/doctest.h"
 
 using nonstd::string_view;
@@ -233,4 +235,157 @@ TEST_CASE("check_for_temporal_macros")
   }
 }
 
+TEST_CASE("check_for_temporal_macros implementations")
+{
+  // Macros and near misses at all offsets relative to the vector widths.
+  const char* const words[] = {
+    " __DATE__", " __TIME__", " __TIMESTAMP__", " __DATE_", " __TIMEX__"};
+  std::string source;
+  for (size_t i = 0; i < 150; ++i) {
+    source += std::string(i % 67, 'x');
+    source += words[i % 5];
+  }
+
+  for (size_t start = 0; start < 130; ++start) {
+    for (size_t length : {8, 40, 100, 300, 10000}) {
+      const auto str = string_view(source).substr(start, length);
+      const int expected = check_for_temporal_macros_bmh(str);
+      CHECK(check_for_temporal_macros(str) == expected);
+#ifdef HAVE_AVX2
+      if (blake3_cpu_supports_avx2()) {
+        CHECK(check_for_temporal_macros_avx2(str) == expected);
+      }
+#endif
+#ifdef HAVE_AVX512BW
+      if (__builtin_cpu_supports("avx512bw")) {
+        CHECK(check_for_temporal_macros_avx512bw(str) == expected);
+      }
+#endif
+#ifdef __ARM_NEON
+      CHECK(check_for_temporal_macros_neon(str) == expected);
+#endif
+    }
+  }
+}
+
+TEST_CASE("Hashing large files")
+{
+  TestContext test_context;
+
+  // Large enough to be hashed from a memory mapping.
+  const std::string content = std::string(200 * 1024, 'x') + " __DATE__\n";
+  Util::write_file("large.h", content);
+
+  Hash h1;
+  CHECK(h1.hash_file("large.h"));
+  CHECK(h1.digest() == Hash().hash(content).digest());
+
+  Context ctx;
+  Hash h2;
+  Hash h3;
+  CHECK(hash_source_code_file(ctx, h2, "large.h")
+        == HASH_SOURCE_CODE_FOUND_DATE);
+  CHECK(hash_source_code_string(ctx, h3, content, "large.h")
+        == HASH_SOURCE_CODE_FOUND_DATE);
+  CHECK(h2.digest() == h3.digest());
+}
+
+TEST_CASE("read_digest_map")
+{
+  TestContext test_context;
+
+  const auto cwd = Util::get_actual_cwd();
+  Util::create_dir("gen");
+  Util::write_file("gen/digests.sha256",
+                   "1234  a.h\n"
+                   "5678 *sub/../b.h\n"
+                   "9abc  /abs/c.h\n"
+                   "malformed\n"
+                   "def0 x.h\n");
+  const auto map = read_digest_map("gen/digests.sha256", cwd);
+  CHECK(map.size() == 3);
+  CHECK(map.at(cwd + "/gen/a.h") == "1234");
+  CHECK(map.at(cwd + "/gen/b.h") == "5678");
+  CHECK(map.at("/abs/c.h") == "9abc");
+
+  CHECK(read_digest_map("missing", cwd).empty());
+
+  SUBCASE("mapped files are hashed by digest")
+  {
+    Context ctx;
+    ctx.digest_map = map;
+    Util::write_file("gen/a.h", "int a;");
+    Hash h1;
+    CHECK(hash_source_code_file(ctx, h1, "gen/a.h") == HASH_SOURCE_CODE_OK);
+    Util::write_file("gen/a.h", "int b; __DATE__");
+    Hash h2;
+    CHECK(hash_source_code_file(ctx, h2, "gen/a.h") == HASH_SOURCE_CODE_OK);
+    CHECK(h1.digest() == h2.digest());
+
+    ctx.digest_map[cwd + "/gen/a.h"] = "4321";
+    Hash h3;
+    hash_source_code_file(ctx, h3, "gen/a.h");
+    CHECK(h1.digest() != h3.digest());
+  }
+}
+
+TEST_CASE("find_preprocessed_marker")
+{
+  // Long enough to exercise vectorized and scalar code paths.
+  std::string data = "\n";
+  for (size_t i = 0; i < 100; ++i) {
+    data += "int a = b.c; /* _ */\n";
+  }
+  const size_t linemarker = data.size() + 1;
+  data += "\n# 1 \"x.h\"\n";
+  for (size_t i = 0; i < 3; ++i) {
+    data += "int a = b.c + 1;\n";
+  }
+  const size_t incbin = data.size();
+  data += ".incbin \"x\"\n";
+  const size_t pump = data.size();
+  data += "__________Using distcc-pump\n";
+
+  const char* begin = data.data();
+  const char* end = begin + data.size();
+
+  SUBCASE("linemarker")
+  {
+    CHECK(find_preprocessed_marker(begin + 1, end, false) - begin
+          == linemarker);
+    CHECK(find_preprocessed_marker(begin + 1, begin + linemarker, false)
+          == begin + linemarker);
+  }
+
+  SUBCASE("incbin")
+  {
+    CHECK(find_preprocessed_marker(begin + linemarker + 1, end, false) - begin
+          == incbin);
+  }
+
+  SUBCASE("pump")
+  {
+    CHECK(find_preprocessed_marker(begin + incbin + 1, end, false) == end);
+    CHECK(find_preprocessed_marker(begin + incbin + 1, end, true) - begin
+          == pump);
+  }
+
+  SUBCASE("all positions")
+  {
+    for (size_t i = 1; i < data.size(); ++i) {
+      const char* expected = end;
+      for (const char* q = begin + i; q < end - 7; ++q) {
+        if ((q[0] == '#' && q[-1] == '\n') || Util::starts_with(q, ".incbin")
+            || Util::starts_with(q, "_________")) {
+          expected = q;
+          break;
+        }
+      }
+      // Candidates are allowed before the first real marker, but no real
+      // marker may be skipped.
+      CHECK(find_preprocessed_marker(begin + i, end, true) <= expected);
+    }
+  }
+}
+
 TEST_SUITE_END();